@@ -8,10 +8,16 @@
 #include <core/md_common.h>
 #include <core/md_platform.h>
 #include <core/md_str.h>
+#include <core/md_os.h>
 
 #include <gfx/gl.h>
 #include <GLFW/glfw3.h>
 
+#if VIAMD_HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #if MD_PLATFORM_WINDOWS
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
@@ -37,6 +43,18 @@ namespace application {
 // Data
 static struct {
     Context internal_ctx{};
+
+    // Offscreen context, rendered into fbo instead of a window
+    struct {
+        GLuint fbo = 0;
+        GLuint color = 0;
+        GLuint depth = 0;
+        md_timestamp_t start = 0;
+#if VIAMD_HEADLESS_EGL
+        EGLDisplay display = EGL_NO_DISPLAY;
+        EGLContext context = EGL_NO_CONTEXT;
+#endif
+    } offscreen;
 } data;
 
 static void error_callback(int error, const char* description) { MD_LOG_ERROR("%d: %s\n", error, description); }
@@ -58,53 +76,16 @@ static void APIENTRY gl_callback(GLenum source, GLenum type, GLuint id, GLenum s
     }
 }
 
-bool initialize(Context* ctx, int width, int height, const char* title) {
-    if (!glfwInit()) {
-        // TODO Throw critical error
-        MD_LOG_ERROR("Error while initializing glfw.");
-        return false;
-    }
-    glfwSetErrorCallback(error_callback);
-
-    if (width == 0 && height == 0) {
-        int count;
-        GLFWmonitor** monitors = glfwGetMonitors(&count);
-        if (count > 0) {
-            int pos_x, pos_y, dim_x, dim_y;
-            glfwGetMonitorWorkarea(monitors[0], &pos_x, &pos_y, &dim_x, &dim_y);
-            width  = (int)(dim_x * 0.9);
-            height = (int)(dim_y * 0.9);
-        }
-    }
-
-#if MD_PLATFORM_OSX
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-    GLFWwindow* window = glfwCreateWindow((int)width, (int)height, title, NULL, NULL);
-    if (!window) {
-        MD_LOG_ERROR("Could not create glfw window.");
-        return false;
-    }
-
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
-    if (gl3wInit() != GL3W_OK) {
-        MD_LOG_ERROR("Could not load gl functions.");
-        return false;
-    }
-
+static void init_gl_debug_output() {
     if (glDebugMessageCallback) {
         glEnable(GL_DEBUG_OUTPUT);
         glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
         glDebugMessageCallback(gl_callback, NULL);
         glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, true);
     }
+}
 
-    glfwGetVersion(&data.internal_ctx.gl_info.version.major, &data.internal_ctx.gl_info.version.minor, &data.internal_ctx.gl_info.version.revision);
-
+static void init_imgui() {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImPlot::CreateContext();
@@ -157,6 +138,51 @@ bool initialize(Context* ctx, int width, int height, const char* title) {
 
     io.Fonts->Build();
     io.FontDefault = io.Fonts->Fonts[1]; // Set default to 18px
+}
+
+bool initialize(Context* ctx, int width, int height, const char* title) {
+    if (!glfwInit()) {
+        // TODO Throw critical error
+        MD_LOG_ERROR("Error while initializing glfw.");
+        return false;
+    }
+    glfwSetErrorCallback(error_callback);
+
+    if (width == 0 && height == 0) {
+        int count;
+        GLFWmonitor** monitors = glfwGetMonitors(&count);
+        if (count > 0) {
+            int pos_x, pos_y, dim_x, dim_y;
+            glfwGetMonitorWorkarea(monitors[0], &pos_x, &pos_y, &dim_x, &dim_y);
+            width  = (int)(dim_x * 0.9);
+            height = (int)(dim_y * 0.9);
+        }
+    }
+
+#if MD_PLATFORM_OSX
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    GLFWwindow* window = glfwCreateWindow((int)width, (int)height, title, NULL, NULL);
+    if (!window) {
+        MD_LOG_ERROR("Could not create glfw window.");
+        return false;
+    }
+
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+    if (gl3wInit() != GL3W_OK) {
+        MD_LOG_ERROR("Could not load gl functions.");
+        return false;
+    }
+
+    init_gl_debug_output();
+
+    glfwGetVersion(&data.internal_ctx.gl_info.version.major, &data.internal_ctx.gl_info.version.minor, &data.internal_ctx.gl_info.version.revision);
+
+    init_imgui();
 
     ImGui_ImplGlfw_InitForOpenGL(window, false);
     ImGui_ImplOpenGL3_Init("#version 150");
@@ -207,12 +233,215 @@ bool initialize(Context* ctx, int width, int height, const char* title) {
     return true;
 }
 
-void shutdown(Context* ctx) {
-    glfwDestroyWindow((GLFWwindow*)data.internal_ctx.window.ptr);
-    ImGui_ImplGlfw_Shutdown();
+#if VIAMD_HEADLESS_EGL
+// GPU nodes usually have no display server, so the display is taken from the device (EGL_EXT_platform_device) if the driver exposes them
+static bool create_egl_context(int device) {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLQUERYDEVICESEXTPROC query_devices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (query_devices && get_platform_display) {
+        EGLDeviceEXT devices[32];
+        EGLint num_devices = 0;
+        if (query_devices((EGLint)ARRAY_SIZE(devices), devices, &num_devices) && num_devices > 0) {
+            if (device < 0 || device >= num_devices) {
+                MD_LOG_ERROR("EGL: Device %d is out of range, there are %d devices", device, num_devices);
+                return false;
+            }
+            display = get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[device], NULL);
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        if (device != 0) {
+            MD_LOG_ERROR("EGL: The devices cannot be enumerated, only the default device is available");
+            return false;
+        }
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        MD_LOG_ERROR("EGL: Could not initialize the display.");
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0 || !eglBindAPI(EGL_OPENGL_API)) {
+        MD_LOG_ERROR("EGL: No config with desktop OpenGL support.");
+        eglTerminate(display);
+        return false;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 1,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    // No surface is needed, as everything is rendered into framebuffer objects (EGL_KHR_surfaceless_context)
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        MD_LOG_ERROR("EGL: Could not create a surfaceless OpenGL 4.1 context.");
+        if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+    MD_LOG_INFO("EGL %d.%d: Created offscreen context on device %d (%s)", major, minor, device, (const char*)eglQueryString(display, EGL_VENDOR));
+
+    data.offscreen.display = display;
+    data.offscreen.context = context;
+    data.internal_ctx.gl_info.version = {major, minor, 0};
+    return true;
+}
+#endif
+
+bool initialize_offscreen(Context* ctx, int width, int height, int device) {
+    if (width <= 0 || height <= 0) {
+        MD_LOG_ERROR("Invalid size of the offscreen context: %dx%d", width, height);
+        return false;
+    }
+
+#if VIAMD_HEADLESS_EGL
+    if (!create_egl_context(device)) {
+        return false;
+    }
+    if (gl3wInit2((GL3WGetProcAddressProc)eglGetProcAddress) != GL3W_OK) {
+        MD_LOG_ERROR("Could not load gl functions.");
+        return false;
+    }
+#else
+    if (device != 0) {
+        MD_LOG_ERROR("Selecting the device of the offscreen context requires VIAMD_HEADLESS_EGL");
+        return false;
+    }
+    if (!glfwInit()) {
+        MD_LOG_ERROR("Error while initializing glfw.");
+        return false;
+    }
+    glfwSetErrorCallback(error_callback);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    // The window only carries the context, the size of the framebuffer is not limited by the size of the screen
+    GLFWwindow* window = glfwCreateWindow(1, 1, "VIAMD", NULL, NULL);
+    if (!window) {
+        MD_LOG_ERROR("Could not create hidden glfw window, an offscreen context without a display server requires VIAMD_HEADLESS_EGL.");
+        return false;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+    if (gl3wInit() != GL3W_OK) {
+        MD_LOG_ERROR("Could not load gl functions.");
+        return false;
+    }
+    glfwGetVersion(&data.internal_ctx.gl_info.version.major, &data.internal_ctx.gl_info.version.minor, &data.internal_ctx.gl_info.version.revision);
+    data.internal_ctx.window.ptr = window;
+#endif
+
+    init_gl_debug_output();
+
+    auto& off = data.offscreen;
+    glGenRenderbuffers(1, &off.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, off.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &off.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, off.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &off.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, off.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, off.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, off.depth);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        MD_LOG_ERROR("Could not create the offscreen framebuffer of %dx%d.", width, height);
+        return false;
+    }
+
+    init_imgui();
+    ImGuiIO& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2((float)width, (float)height);
+    io.DisplayFramebufferScale = ImVec2(1, 1);
+    io.IniFilename = NULL;
+    // There is no platform backend for additional windows
+    io.ConfigFlags &= ~ImGuiConfigFlags_ViewportsEnable;
+    ImGui_ImplOpenGL3_Init("#version 150");
+
+    data.internal_ctx.offscreen = true;
+    data.internal_ctx.window.title = "";
+    data.internal_ctx.window.width = width;
+    data.internal_ctx.window.height = height;
+    data.internal_ctx.window.vsync = false;
+    data.internal_ctx.framebuffer.width = width;
+    data.internal_ctx.framebuffer.height = height;
+    data.internal_ctx.framebuffer.fbo = off.fbo;
+    off.start = md_time_current();
+
+    MEMCPY(ctx, &data.internal_ctx, sizeof(Context));
+
+    return true;
+}
+
+static void shutdown_offscreen() {
+    auto& off = data.offscreen;
+    if (off.fbo) glDeleteFramebuffers(1, &off.fbo);
+    if (off.color) glDeleteRenderbuffers(1, &off.color);
+    if (off.depth) glDeleteRenderbuffers(1, &off.depth);
+    off.fbo = off.color = off.depth = 0;
+    ImGui_ImplOpenGL3_Shutdown();
     ImPlot::DestroyContext();
     ImGui::DestroyContext();
+#if VIAMD_HEADLESS_EGL
+    eglMakeCurrent(off.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(off.display, off.context);
+    eglTerminate(off.display);
+    off.display = EGL_NO_DISPLAY;
+    off.context = EGL_NO_CONTEXT;
+#else
+    glfwDestroyWindow((GLFWwindow*)data.internal_ctx.window.ptr);
     glfwTerminate();
+#endif
+    data.internal_ctx.offscreen = false;
+    data.internal_ctx.framebuffer.fbo = 0;
+}
+
+// There are no events, the size is fixed and only the timing advances
+static void update_offscreen(Context* ctx) {
+    const double t = md_time_as_seconds(md_time_current() - data.offscreen.start);
+    data.internal_ctx.timing.delta_s = (t - data.internal_ctx.timing.total_s);
+    data.internal_ctx.timing.total_s = t;
+    data.internal_ctx.file_drop = ctx->file_drop;
+    data.internal_ctx.events = ctx->events;
+    data.internal_ctx.window.should_close = ctx->window.should_close;
+
+    ImGuiIO& io = ImGui::GetIO();
+    io.DeltaTime = (float)MAX(data.internal_ctx.timing.delta_s, 1.0e-4);
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui::NewFrame();
+
+    MEMCPY(ctx, &data.internal_ctx, sizeof(Context));
+}
+
+void shutdown(Context* ctx) {
+    if (data.internal_ctx.offscreen) {
+        shutdown_offscreen();
+    } else {
+        glfwDestroyWindow((GLFWwindow*)data.internal_ctx.window.ptr);
+        ImGui_ImplGlfw_Shutdown();
+        ImPlot::DestroyContext();
+        ImGui::DestroyContext();
+        glfwTerminate();
+    }
 
     ctx->window.ptr = nullptr;
     ctx->window.title = "";
@@ -221,7 +450,16 @@ void shutdown(Context* ctx) {
 }
 
 void update(Context* ctx) {
-    glfwPollEvents();
+    if (data.internal_ctx.offscreen) {
+        update_offscreen(ctx);
+        return;
+    }
+    data.internal_ctx.events = ctx->events;
+    if (ctx->events.wait) {
+        glfwWaitEventsTimeout(ctx->events.timeout_s);
+    } else {
+        glfwPollEvents();
+    }
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -265,6 +503,11 @@ void update(Context* ctx) {
 
 void render_imgui(Context* ctx) {
     (void)ctx;
+    if (data.internal_ctx.offscreen) {
+        // The frame is completed, but nothing is drawn into the image
+        ImGui::Render();
+        return;
+    }
     GLFWwindow* window = (GLFWwindow*)data.internal_ctx.window.ptr;
 
     ImGui::Render();
@@ -280,7 +523,24 @@ void render_imgui(Context* ctx) {
     glfwMakeContextCurrent(window);
 }
 
-void swap_buffers(Context* ctx) { glfwSwapBuffers((GLFWwindow*)ctx->window.ptr); }
+void swap_buffers(Context* ctx) {
+    if (data.internal_ctx.offscreen) {
+        glFlush();
+        return;
+    }
+    glfwSwapBuffers((GLFWwindow*)ctx->window.ptr);
+}
+
+void bind_default_framebuffer(unsigned int target) {
+    const GLuint fbo = data.internal_ctx.framebuffer.fbo;
+    const GLenum buffer = fbo ? GL_COLOR_ATTACHMENT0 : GL_BACK;
+    glBindFramebuffer(target, fbo);
+    if (target == GL_READ_FRAMEBUFFER) {
+        glReadBuffer(buffer);
+    } else {
+        glDrawBuffer(buffer);
+    }
+}
 
 bool file_dialog(char* str_buf, int str_cap, FileDialogFlag flags, const char* filter) {    
     nfdchar_t* out_path = NULL;
@@ -16,8 +16,11 @@ struct Context {
     struct {
         int width;
         int height;
+        unsigned int fbo;   // Stands in for the default framebuffer of an offscreen context, 0 otherwise
     } framebuffer;
 
+    bool offscreen;
+
     struct {
         struct {
             int major;
@@ -35,15 +38,26 @@ struct Context {
         FileDropCallback callback;
         void* user_data;
     } file_drop;
+
+    struct {
+        bool   wait;        // Block in update until an event arrives or the timeout expires, instead of polling
+        double timeout_s;
+    } events;
 };
 
 // Context
 bool initialize(Context* ctx, int width, int height, const char* title);
+// Context without a window, which renders into a framebuffer object of a fixed size. No events are received and the GUI is not drawn.
+// With VIAMD_HEADLESS_EGL the context is created through EGL on the given GPU, which requires no display server, otherwise a hidden window is used.
+bool initialize_offscreen(Context* ctx, int width, int height, int device);
 void shutdown(Context* ctx);
 void update(Context* ctx);
 void render_imgui(Context* ctx);
 void swap_buffers(Context* ctx);
 
+// Binds the default framebuffer (or the one of an offscreen context) to target, and selects its color buffer for reading or drawing
+void bind_default_framebuffer(unsigned int target);
+
 // File Dialog
 typedef unsigned int FileDialogFlag;
 
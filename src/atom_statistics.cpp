@@ -0,0 +1,169 @@
+#include "atom_statistics.h"
+
+#include <task_system.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+
+#include <math.h>
+#include <string.h>
+
+#define ATOM_STATISTICS_GATHER 64
+
+bool atom_statistics_init(AtomStatistics* stats, const int32_t* indices, size_t count, const superposition_ref_t* ref, md_allocator_i* alloc) {
+    ASSERT(stats);
+    ASSERT(alloc);
+    atom_statistics_free(stats);
+    if (!indices || count == 0) return false;
+
+    stats->alloc = alloc;
+    stats->count = count;
+    stats->indices = (int32_t*)md_alloc(alloc, sizeof(int32_t) * count);
+    MEMCPY(stats->indices, indices, sizeof(int32_t) * count);
+    if (ref && ref->count) {
+        superposition_ref_copy(&stats->ref, ref, alloc);
+    }
+
+    stats->num_threads = task_system::pool_num_threads();
+    stats->acc = (AtomStatisticsAccumulator*)md_alloc(alloc, sizeof(AtomStatisticsAccumulator) * stats->num_threads);
+    for (uint32_t t = 0; t < stats->num_threads; ++t) {
+        AtomStatisticsAccumulator& a = stats->acc[t];
+        a.num_frames = 0;
+        a.mean = (double*)md_alloc(alloc, sizeof(double) * 3 * count);
+        a.m2   = (double*)md_alloc(alloc, sizeof(double) * count);
+        MEMSET(a.mean, 0, sizeof(double) * 3 * count);
+        MEMSET(a.m2, 0, sizeof(double) * count);
+    }
+
+    stats->mean_x = (float*)md_alloc(alloc, sizeof(float) * count);
+    stats->mean_y = (float*)md_alloc(alloc, sizeof(float) * count);
+    stats->mean_z = (float*)md_alloc(alloc, sizeof(float) * count);
+    stats->rmsf   = (float*)md_alloc(alloc, sizeof(float) * count);
+    MEMSET(stats->rmsf, 0, sizeof(float) * count);
+    return true;
+}
+
+void atom_statistics_free(AtomStatistics* stats) {
+    ASSERT(stats);
+    if (stats->alloc) {
+        const size_t count = stats->count;
+        for (uint32_t t = 0; t < stats->num_threads; ++t) {
+            md_free(stats->alloc, stats->acc[t].mean, sizeof(double) * 3 * count);
+            md_free(stats->alloc, stats->acc[t].m2, sizeof(double) * count);
+        }
+        if (stats->acc) md_free(stats->alloc, stats->acc, sizeof(AtomStatisticsAccumulator) * stats->num_threads);
+        md_free(stats->alloc, stats->indices, sizeof(int32_t) * count);
+        md_free(stats->alloc, stats->mean_x, sizeof(float) * count);
+        md_free(stats->alloc, stats->mean_y, sizeof(float) * count);
+        md_free(stats->alloc, stats->mean_z, sizeof(float) * count);
+        md_free(stats->alloc, stats->rmsf, sizeof(float) * count);
+        superposition_ref_free(&stats->ref);
+    }
+    *stats = {};
+}
+
+void atom_statistics_add_frame(AtomStatistics* stats, const float* x, const float* y, const float* z) {
+    ASSERT(stats);
+    const uint32_t thread = task_system::thread_index();
+    ASSERT(thread < stats->num_threads);
+    if (thread >= stats->num_threads) return;
+
+    AtomStatisticsAccumulator& a = stats->acc[thread];
+    a.num_frames += 1;
+    const double inv_n = 1.0 / (double)a.num_frames;
+
+    // The rigid transform of the frame is folded into the gather
+    float r[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+    vec3_t src = {0, 0, 0};
+    vec3_t dst = {0, 0, 0};
+    if (stats->ref.count) {
+        const superposition_fit_t fit = superposition_fit(&stats->ref, x, y, z);
+        const quat_t q = fit.rotation;
+        r[0][0] = 1 - 2 * (q.y * q.y + q.z * q.z); r[0][1] = 2 * (q.x * q.y - q.z * q.w);     r[0][2] = 2 * (q.x * q.z + q.y * q.w);
+        r[1][0] = 2 * (q.x * q.y + q.z * q.w);     r[1][1] = 1 - 2 * (q.x * q.x + q.z * q.z); r[1][2] = 2 * (q.y * q.z - q.x * q.w);
+        r[2][0] = 2 * (q.x * q.z - q.y * q.w);     r[2][1] = 2 * (q.y * q.z + q.x * q.w);     r[2][2] = 1 - 2 * (q.x * q.x + q.y * q.y);
+        src = fit.com;
+        dst = stats->ref.com;
+    }
+
+    const size_t count = stats->count;
+    double* mx = a.mean + count * 0;
+    double* my = a.mean + count * 1;
+    double* mz = a.mean + count * 2;
+    float bx[ATOM_STATISTICS_GATHER], by[ATOM_STATISTICS_GATHER], bz[ATOM_STATISTICS_GATHER];
+    for (size_t beg = 0; beg < count; beg += ATOM_STATISTICS_GATHER) {
+        const size_t n = MIN(count - beg, (size_t)ATOM_STATISTICS_GATHER);
+        for (size_t j = 0; j < n; ++j) {
+            const int32_t idx = stats->indices[beg + j];
+            const float px = x[idx] - src.x;
+            const float py = y[idx] - src.y;
+            const float pz = z[idx] - src.z;
+            bx[j] = r[0][0] * px + r[0][1] * py + r[0][2] * pz + dst.x;
+            by[j] = r[1][0] * px + r[1][1] * py + r[1][2] * pz + dst.y;
+            bz[j] = r[2][0] * px + r[2][1] * py + r[2][2] * pz + dst.z;
+        }
+        // Welford: mean += d / n, m2 += d * (p - mean)
+        for (size_t j = 0; j < n; ++j) {
+            const size_t i = beg + j;
+            const double dx = bx[j] - mx[i];
+            const double dy = by[j] - my[i];
+            const double dz = bz[j] - mz[i];
+            mx[i] += dx * inv_n;
+            my[i] += dy * inv_n;
+            mz[i] += dz * inv_n;
+            a.m2[i] += dx * (bx[j] - mx[i]) + dy * (by[j] - my[i]) + dz * (bz[j] - mz[i]);
+        }
+    }
+}
+
+void atom_statistics_finalize(AtomStatistics* stats) {
+    ASSERT(stats);
+    const size_t count = stats->count;
+    if (count == 0) return;
+
+    // Chan: the accumulators are merged pairwise into the first non-empty one
+    AtomStatisticsAccumulator* dst = nullptr;
+    for (uint32_t t = 0; t < stats->num_threads; ++t) {
+        AtomStatisticsAccumulator& b = stats->acc[t];
+        if (b.num_frames == 0) continue;
+        if (!dst) {
+            dst = &b;
+            continue;
+        }
+        const double na = (double)dst->num_frames;
+        const double nb = (double)b.num_frames;
+        const double n  = na + nb;
+        const double fb = nb / n;
+        const double fab = na * nb / n;
+        for (int c = 0; c < 3; ++c) {
+            double* ma = dst->mean + count * c;
+            const double* mb = b.mean + count * c;
+            for (size_t i = 0; i < count; ++i) {
+                const double d = mb[i] - ma[i];
+                ma[i] += d * fb;
+                dst->m2[i] += d * d * fab;
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            dst->m2[i] += b.m2[i];
+        }
+        dst->num_frames += b.num_frames;
+
+        b.num_frames = 0;
+        MEMSET(b.mean, 0, sizeof(double) * 3 * count);
+        MEMSET(b.m2, 0, sizeof(double) * count);
+    }
+
+    stats->num_frames = dst ? dst->num_frames : 0;
+    if (!dst) {
+        MEMSET(stats->rmsf, 0, sizeof(float) * count);
+        return;
+    }
+    const double inv_n = 1.0 / (double)dst->num_frames;
+    for (size_t i = 0; i < count; ++i) {
+        stats->mean_x[i] = (float)dst->mean[i];
+        stats->mean_y[i] = (float)dst->mean[i + count];
+        stats->mean_z[i] = (float)dst->mean[i + count * 2];
+        stats->rmsf[i]   = (float)sqrt(dst->m2[i] * inv_n);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <superposition.h>
+
+struct md_allocator_i;
+
+// Streaming average structure and RMSF (root mean square fluctuation) of a set of atoms over the frames of a trajectory
+// Every thread folds the frames it processes into a Welford accumulator of its own, which are merged at the end (Chan et al.)
+// The memory is O(atoms x threads) independent of the number of frames, and frames can be added in any order without locks.
+// The frames can be superposed onto a reference before they are accumulated, which removes the rigid motion from the fluctuations.
+
+struct AtomStatisticsAccumulator {
+    uint64_t num_frames;
+    double* mean;       // [3][count]
+    double* m2;         // [count] sum |p - mean|^2
+};
+
+struct AtomStatistics {
+    int32_t* indices = nullptr;     // [count] Atoms to accumulate
+    size_t count = 0;
+    superposition_ref_t ref = {};   // Frames are superposed onto the reference if it is set
+    AtomStatisticsAccumulator* acc = nullptr; // [num_threads]
+    uint32_t num_threads = 0;
+
+    // Results of atom_statistics_finalize
+    uint64_t num_frames = 0;
+    float* mean_x = nullptr;        // [count] Average structure
+    float* mean_y = nullptr;
+    float* mean_z = nullptr;
+    float* rmsf = nullptr;          // [count]
+
+    md_allocator_i* alloc = nullptr;
+};
+
+// One accumulator is reserved per thread of the task system (see task_system::thread_index). ref may be NULL, in which case the frames are taken as is
+bool atom_statistics_init(AtomStatistics* stats, const int32_t* indices, size_t count, const superposition_ref_t* ref, md_allocator_i* alloc);
+void atom_statistics_free(AtomStatistics* stats);
+
+// Must be called from a thread of the task system, concurrent calls from different threads are fine
+void atom_statistics_add_frame(AtomStatistics* stats, const float* x, const float* y, const float* z);
+
+// Merges the accumulators into the results, must not be called while frames are added
+void atom_statistics_finalize(AtomStatistics* stats);
@@ -0,0 +1,63 @@
+#include "backbone_data.h"
+
+#include <md_util.h>
+#include <core/md_common.h>
+
+#include <string.h>
+
+static const md_secondary_structure_t ss_classes[4] = {
+    (md_secondary_structure_t)0, // Unknown
+    MD_SECONDARY_STRUCTURE_COIL,
+    MD_SECONDARY_STRUCTURE_HELIX,
+    MD_SECONDARY_STRUCTURE_BETA_SHEET,
+};
+
+static inline uint8_t ss_encode(md_secondary_structure_t ss) {
+    switch (ss) {
+    case MD_SECONDARY_STRUCTURE_COIL:       return 1;
+    case MD_SECONDARY_STRUCTURE_HELIX:      return 2;
+    case MD_SECONDARY_STRUCTURE_BETA_SHEET: return 3;
+    default:                                return 0;
+    }
+}
+
+void backbone_angles_encode(backbone_angles_q16_t* dst, const md_backbone_angles_t* src, size_t count) {
+    ASSERT(dst);
+    ASSERT(src);
+    for (size_t i = 0; i < count; ++i) {
+        dst[i].phi = backbone_angle_encode(src[i].phi);
+        dst[i].psi = backbone_angle_encode(src[i].psi);
+    }
+}
+
+void backbone_angles_decode(md_backbone_angles_t* dst, const backbone_angles_q16_t* src, size_t count) {
+    ASSERT(dst);
+    ASSERT(src);
+    for (size_t i = 0; i < count; ++i) {
+        dst[i].phi = backbone_angle_decode(src[i].phi);
+        dst[i].psi = backbone_angle_decode(src[i].psi);
+    }
+}
+
+void secondary_structure_pack(uint8_t* dst, const md_secondary_structure_t* src, size_t count) {
+    ASSERT(dst);
+    ASSERT(src);
+    memset(dst, 0, secondary_structure_packed_stride(count));
+    for (size_t i = 0; i < count; ++i) {
+        dst[i >> 2] |= (uint8_t)(ss_encode(src[i]) << ((i & 3) * 2));
+    }
+}
+
+void secondary_structure_unpack(md_secondary_structure_t* dst, const uint8_t* src, size_t count) {
+    ASSERT(dst);
+    ASSERT(src);
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = ss_classes[(src[i >> 2] >> ((i & 3) * 2)) & 3];
+    }
+}
+
+void secondary_structure_fill_packed(uint8_t* dst, md_secondary_structure_t ss, size_t count) {
+    ASSERT(dst);
+    const uint8_t c = ss_encode(ss);
+    memset(dst, c | (c << 2) | (c << 4) | (c << 6), secondary_structure_packed_stride(count));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <md_molecule.h>
+
+// Compact storage for per-frame backbone data
+// Angles are quantized to int16 over [-PI, PI) which gives a resolution of 2PI / 65536 (~0.0055 degrees)
+// Secondary structure is stored as 2-bit classes (unknown, coil, helix, sheet), four residues per byte
+// Each frame occupies its own row, so frames can be written concurrently and decoded independently
+
+struct backbone_angles_q16_t {
+    int16_t phi;
+    int16_t psi;
+};
+
+#define BACKBONE_ANGLE_Q16_SCALE (32768.0f / 3.14159265358979f)
+
+static inline int16_t backbone_angle_encode(float angle) {
+    // Wrap to [-PI, PI) through the integer conversion, angles from atan2 are already within range
+    const int32_t q = (int32_t)(angle * BACKBONE_ANGLE_Q16_SCALE + (angle < 0 ? -0.5f : 0.5f));
+    return (int16_t)q;
+}
+
+static inline float backbone_angle_decode(int16_t q) {
+    return (float)q * (1.0f / BACKBONE_ANGLE_Q16_SCALE);
+}
+
+void backbone_angles_encode(backbone_angles_q16_t* dst, const md_backbone_angles_t* src, size_t count);
+void backbone_angles_decode(md_backbone_angles_t* dst, const backbone_angles_q16_t* src, size_t count);
+
+// Bytes required for a packed row of count residues
+static inline size_t secondary_structure_packed_stride(size_t count) {
+    return (count + 3) / 4;
+}
+
+void secondary_structure_pack(uint8_t* dst, const md_secondary_structure_t* src, size_t count);
+void secondary_structure_unpack(md_secondary_structure_t* dst, const uint8_t* src, size_t count);
+
+// Fills a packed row with a single secondary structure
+void secondary_structure_fill_packed(uint8_t* dst, md_secondary_structure_t ss, size_t count);
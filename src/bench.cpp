@@ -0,0 +1,402 @@
+#include "bench.h"
+
+#include <gfx/gpu_timing.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace bench {
+
+// Splits the next whitespace separated token off line
+static bool next_token(str_t* tok, str_t* line) {
+    size_t beg = 0;
+    while (beg < line->len && (line->ptr[beg] == ' ' || line->ptr[beg] == '\t')) ++beg;
+    size_t end = beg;
+    while (end < line->len && line->ptr[end] != ' ' && line->ptr[end] != '\t') ++end;
+    if (beg == end) return false;
+    *tok = {line->ptr + beg, end - beg};
+    *line = {line->ptr + end, line->len - end};
+    return true;
+}
+
+static bool parse_event(Event* e, uint32_t frame, str_t cmd, str_t args) {
+    *e = {};
+    e->frame = frame;
+    str_t tok = {};
+    if (str_eq_cstr(cmd, "camera")) {
+        float v[8] = {};
+        for (int i = 0; i < 8; ++i) {
+            if (!next_token(&tok, &args)) return false;
+            v[i] = (float)parse_float(tok);
+        }
+        e->type = Event_Camera;
+        e->position = {v[0], v[1], v[2]};
+        e->orientation = quat_normalize({v[3], v[4], v[5], v[6]});
+        e->distance = v[7];
+    } else if (str_eq_cstr(cmd, "time")) {
+        if (!next_token(&tok, &args)) return false;
+        e->type = Event_Time;
+        e->time = parse_float(tok);
+    } else if (str_eq_cstr(cmd, "show") || str_eq_cstr(cmd, "hide") || str_eq_cstr(cmd, "toggle")) {
+        if (!next_token(&tok, &args)) return false;
+        e->type = str_eq_cstr(cmd, "show") ? Event_Show : str_eq_cstr(cmd, "hide") ? Event_Hide : Event_Toggle;
+        e->rep = (int32_t)parse_int(tok);
+    } else if (str_eq_cstr(cmd, "select")) {
+        args = str_trim(args);
+        if (str_empty(args) || args.len >= sizeof(e->query)) return false;
+        e->type = Event_Select;
+        str_copy_to_char_buf(e->query, sizeof(e->query), args);
+    } else if (str_eq_cstr(cmd, "deselect")) {
+        e->type = Event_Deselect;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool load_session(Session* session, str_t path, md_allocator_i* alloc) {
+    ASSERT(session);
+    ASSERT(alloc);
+    str_t txt = load_textfile(path, alloc);
+    if (str_empty(txt)) {
+        MD_LOG_ERROR("Bench: Could not read session '%.*s'", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { str_free(txt, alloc); };
+
+    *session = {};
+    str_t line = {};
+    str_t c_txt = txt;
+    int line_num = 0;
+    while (str_extract_line(&line, &c_txt)) {
+        line_num += 1;
+        for (size_t i = 0; i < line.len; ++i) {
+            if (line.ptr[i] == '#') {
+                line.len = i;
+                break;
+            }
+        }
+        str_t tok = {};
+        if (!next_token(&tok, &line)) continue;
+
+        if (str_eq_cstr(tok, "frames") || str_eq_cstr(tok, "warmup")) {
+            str_t val = {};
+            if (!next_token(&val, &line)) {
+                MD_LOG_ERROR("Bench: Missing count on line %i of the session", line_num);
+                free_session(session, alloc);
+                return false;
+            }
+            const uint32_t count = (uint32_t)MAX(0, parse_int(val));
+            if (str_eq_cstr(tok, "frames")) session->num_frames = count; else session->warmup = count;
+            continue;
+        }
+
+        str_t cmd = {};
+        Event e;
+        if (!next_token(&cmd, &line) || !parse_event(&e, (uint32_t)MAX(0, parse_int(tok)), cmd, line)) {
+            MD_LOG_ERROR("Bench: Invalid command on line %i of the session", line_num);
+            free_session(session, alloc);
+            return false;
+        }
+        md_array_push(session->events, e, alloc);
+    }
+
+    // Commands of the same frame keep the order of the file
+    const size_t num_events = md_array_size(session->events);
+    for (size_t i = 1; i < num_events; ++i) {
+        const Event e = session->events[i];
+        size_t j = i;
+        while (j > 0 && session->events[j - 1].frame > e.frame) {
+            session->events[j] = session->events[j - 1];
+            --j;
+        }
+        session->events[j] = e;
+    }
+    if (session->num_frames == 0 && num_events > 0) {
+        session->num_frames = session->events[num_events - 1].frame + 1;
+    }
+    if (session->num_frames == 0) {
+        MD_LOG_ERROR("Bench: The session '%.*s' has no frames", (int)path.len, path.ptr);
+        free_session(session, alloc);
+        return false;
+    }
+    return true;
+}
+
+void free_session(Session* session, md_allocator_i* alloc) {
+    ASSERT(session);
+    md_array_free(session->events, alloc);
+    *session = {};
+}
+
+// Keys of type which surround frame, a missing key is set to the one which is present
+static bool find_keys(const Session* session, EventType type, double frame, const Event** k0, const Event** k1) {
+    *k0 = NULL;
+    *k1 = NULL;
+    for (size_t i = 0; i < md_array_size(session->events); ++i) {
+        const Event* e = &session->events[i];
+        if (e->type != type) continue;
+        if (e->frame <= frame) {
+            *k0 = e;
+        } else {
+            *k1 = e;
+            break;
+        }
+    }
+    if (!*k0) *k0 = *k1;
+    if (!*k1) *k1 = *k0;
+    return *k0 != NULL;
+}
+
+static inline float key_param(const Event* k0, const Event* k1, double frame) {
+    return k1->frame > k0->frame ? (float)CLAMP((frame - k0->frame) / (double)(k1->frame - k0->frame), 0.0, 1.0) : 0.0f;
+}
+
+bool camera_at(const Session* session, double frame, vec3_t* position, quat_t* orientation, float* distance) {
+    ASSERT(session);
+    const Event* k0, *k1;
+    if (!find_keys(session, Event_Camera, frame, &k0, &k1)) return false;
+    const float t = key_param(k0, k1, frame);
+    // Along the arc around the look at point, as the camera animation of the viewer
+    const vec3_t look_at0 = k0->position - k0->orientation * vec3_t{0, 0, k0->distance};
+    const vec3_t look_at1 = k1->position - k1->orientation * vec3_t{0, 0, k1->distance};
+    *distance = lerp(k0->distance, k1->distance, t);
+    *orientation = quat_normalize(quat_slerp(k0->orientation, k1->orientation, t));
+    *position = lerp(look_at0, look_at1, t) + *orientation * vec3_t{0, 0, *distance};
+    return true;
+}
+
+bool time_at(const Session* session, double frame, double* time) {
+    ASSERT(session);
+    const Event* k0, *k1;
+    if (!find_keys(session, Event_Time, frame, &k0, &k1)) return false;
+    const double t = key_param(k0, k1, frame);
+    *time = k0->time + (k1->time - k0->time) * t;
+    return true;
+}
+
+struct FrameRecord {
+    float total_ms;
+    float section_ms[BENCH_MAX_SECTIONS];
+};
+
+struct GpuSample {
+    float timer_ms[GPU_TIMING_MAX_TIMERS];
+};
+
+static struct {
+    bool active = false;
+    const char* labels[BENCH_MAX_SECTIONS] = {};
+    uint32_t num_labels = 0;
+
+    struct {
+        uint32_t label;
+        md_timestamp_t beg;
+    } stack[16] = {};
+    uint32_t depth = 0;
+
+    FrameRecord current = {};
+    md_timestamp_t frame_beg = 0;
+    FrameRecord* frames = nullptr;      // md_array
+    GpuSample* gpu = nullptr;           // md_array
+    uint32_t gpu_head = 0;
+} ctx;
+
+static uint32_t find_label(const char* label) {
+    for (uint32_t i = 0; i < ctx.num_labels; ++i) {
+        if (ctx.labels[i] == label || strcmp(ctx.labels[i], label) == 0) return i;
+    }
+    if (ctx.num_labels == BENCH_MAX_SECTIONS) return BENCH_MAX_SECTIONS;
+    ctx.labels[ctx.num_labels] = label;
+    return ctx.num_labels++;
+}
+
+void begin_recording() {
+    md_array_free(ctx.frames, md_heap_allocator);
+    md_array_free(ctx.gpu, md_heap_allocator);
+    ctx = {};
+    ctx.active = true;
+    ctx.frame_beg = md_time_current();
+    gpu_timing::set_enabled(true);
+    gpu_timing::clear_history();
+    ctx.gpu_head = gpu_timing::history_head();
+}
+
+bool recording() {
+    return ctx.active;
+}
+
+void push_section(const char* label) {
+    if (!ctx.active || ctx.depth == ARRAY_SIZE(ctx.stack)) return;
+    ctx.stack[ctx.depth++] = {find_label(label), md_time_current()};
+}
+
+void pop_section() {
+    if (!ctx.active || ctx.depth == 0) return;
+    const auto& s = ctx.stack[--ctx.depth];
+    if (s.label < BENCH_MAX_SECTIONS) {
+        ctx.current.section_ms[s.label] += (float)(md_time_as_seconds(md_time_current() - s.beg) * 1000.0);
+    }
+}
+
+void end_frame() {
+    if (!ctx.active) return;
+    const md_timestamp_t now = md_time_current();
+    ctx.current.total_ms = (float)(md_time_as_seconds(now - ctx.frame_beg) * 1000.0);
+    md_array_push(ctx.frames, ctx.current, md_heap_allocator);
+    ctx.current = {};
+    ctx.frame_beg = now;
+    ctx.depth = 0;
+
+    // The GPU frames are read back some frames after they were recorded
+    size_t num_timers = 0;
+    const gpu_timing::Timer* timers = gpu_timing::timers(&num_timers);
+    const uint32_t head = gpu_timing::history_head();
+    for (uint32_t idx = ctx.gpu_head; idx != head; idx = (idx + 1) % GPU_TIMING_HISTORY) {
+        GpuSample sample = {};
+        for (size_t i = 0; i < num_timers; ++i) {
+            sample.timer_ms[i] = timers[i].history[idx];
+        }
+        md_array_push(ctx.gpu, sample, md_heap_allocator);
+    }
+    ctx.gpu_head = head;
+}
+
+static int compare_float(const void* a, const void* b) {
+    const float x = *(const float*)a;
+    const float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Mean, median, 95th percentile and max of n values, the values are sorted in place
+static void write_summary(md_file_o* file, const char* name, float* values, size_t n, bool last) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += values[i];
+    qsort(values, n, sizeof(float), compare_float);
+    const double mean = n ? sum / n : 0;
+    const double p50 = n ? values[n / 2] : 0;
+    const double p95 = n ? values[MIN(n - 1, (n * 95) / 100)] : 0;
+    const double max = n ? values[n - 1] : 0;
+    md_file_printf(file, "      \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"max\": %.4f}%s\n", name, mean, p50, p95, max, last ? "" : ",");
+}
+
+// Quotes and backslashes are the only characters of a label which can break the JSON
+static void write_string(md_file_o* file, const char* str, size_t len) {
+    md_file_printf(file, "\"");
+    for (size_t i = 0; i < len && str[i]; ++i) {
+        const char c = (str[i] == '"' || str[i] == '\\') ? '_' : str[i];
+        md_file_printf(file, "%c", c);
+    }
+    md_file_printf(file, "\"");
+}
+
+// Path of a GPU timer through the timers which enclose it, e.g. "Fill G-Buffer/Representations"
+static void gpu_timer_path(char* buf, size_t cap, const gpu_timing::Timer* timers, size_t idx) {
+    const char* path[GPU_TIMING_MAX_DEPTH] = {};
+    uint32_t depth = 0;
+    for (uint32_t t = (uint32_t)idx + 1; t && depth < GPU_TIMING_MAX_DEPTH; t = timers[t - 1].parent) {
+        path[depth++] = timers[t - 1].label;
+    }
+    size_t len = 0;
+    buf[0] = '\0';
+    while (depth > 0 && len < cap) {
+        len += snprintf(buf + len, cap - len, "%s%s", path[depth - 1], depth > 1 ? "/" : "");
+        depth -= 1;
+    }
+}
+
+bool write_json(str_t path, const Info& info) {
+    ctx.active = false;
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE);
+    if (!file) {
+        MD_LOG_ERROR("Bench: Failed to open file '%.*s' to write results", (int)path.len, path.ptr);
+        return false;
+    }
+
+    const size_t num_frames = md_array_size(ctx.frames);
+    const size_t num_gpu = md_array_size(ctx.gpu);
+    size_t num_timers = 0;
+    const gpu_timing::Timer* timers = gpu_timing::timers(&num_timers);
+    num_timers = MIN(num_timers, (size_t)GPU_TIMING_MAX_TIMERS);
+
+    md_file_printf(file, "{\n  \"version\": 1,\n  \"session\": ");
+    write_string(file, info.session.ptr, info.session.len);
+    md_file_printf(file, ",\n  \"renderer\": ");
+    write_string(file, info.renderer, SIZE_MAX);
+    md_file_printf(file, ",\n  \"vendor\": ");
+    write_string(file, info.vendor, SIZE_MAX);
+    md_file_printf(file, ",\n  \"gl_version\": ");
+    write_string(file, info.version, SIZE_MAX);
+    md_file_printf(file, ",\n  \"build\": ");
+    write_string(file, info.build, SIZE_MAX);
+    md_file_printf(file, ",\n  \"viewport\": [%i, %i],\n  \"num_atoms\": %zu,\n  \"num_trajectory_frames\": %zu,\n", info.width, info.height, info.num_atoms, info.num_traj_frames);
+
+    // The samples are stored by column, with one row per frame
+    md_file_printf(file, "  \"cpu\": {\n    \"sections\": [\"Frame\"");
+    for (uint32_t i = 0; i < ctx.num_labels; ++i) {
+        md_file_printf(file, ", ");
+        write_string(file, ctx.labels[i], SIZE_MAX);
+    }
+    md_file_printf(file, "],\n    \"frames_ms\": [\n");
+    for (size_t f = 0; f < num_frames; ++f) {
+        md_file_printf(file, "      [%.4f", ctx.frames[f].total_ms);
+        for (uint32_t i = 0; i < ctx.num_labels; ++i) {
+            md_file_printf(file, ", %.4f", ctx.frames[f].section_ms[i]);
+        }
+        md_file_printf(file, "]%s\n", f + 1 < num_frames ? "," : "");
+    }
+    md_file_printf(file, "    ]\n  },\n");
+
+    md_file_printf(file, "  \"gpu\": {\n    \"passes\": [");
+    char label[512];
+    for (size_t i = 0; i < num_timers; ++i) {
+        gpu_timer_path(label, sizeof(label), timers, i);
+        if (i) md_file_printf(file, ", ");
+        write_string(file, label, sizeof(label));
+    }
+    md_file_printf(file, "],\n    \"frames_ms\": [\n");
+    for (size_t f = 0; f < num_gpu; ++f) {
+        md_file_printf(file, "      [");
+        for (size_t i = 0; i < num_timers; ++i) {
+            md_file_printf(file, "%s%.4f", i ? ", " : "", ctx.gpu[f].timer_ms[i]);
+        }
+        md_file_printf(file, "]%s\n", f + 1 < num_gpu ? "," : "");
+    }
+    md_file_printf(file, "    ]\n  },\n");
+
+    // Summaries of each column
+    float* values = (float*)md_alloc(md_heap_allocator, sizeof(float) * MAX(num_frames, num_gpu) + 1);
+    defer { md_free(md_heap_allocator, values, sizeof(float) * MAX(num_frames, num_gpu) + 1); };
+    md_file_printf(file, "  \"summary\": {\n    \"cpu\": {\n");
+    for (uint32_t i = 0; i <= ctx.num_labels; ++i) {
+        for (size_t f = 0; f < num_frames; ++f) {
+            values[f] = i == 0 ? ctx.frames[f].total_ms : ctx.frames[f].section_ms[i - 1];
+        }
+        write_summary(file, i == 0 ? "Frame" : ctx.labels[i - 1], values, num_frames, i == ctx.num_labels);
+    }
+    md_file_printf(file, "    },\n    \"gpu\": {\n");
+    for (size_t i = 0; i < num_timers; ++i) {
+        for (size_t f = 0; f < num_gpu; ++f) {
+            values[f] = ctx.gpu[f].timer_ms[i];
+        }
+        gpu_timer_path(label, sizeof(label), timers, i);
+        for (char* c = label; *c; ++c) {
+            if (*c == '"' || *c == '\\') *c = '_';
+        }
+        write_summary(file, label, values, num_gpu, i + 1 == num_timers);
+    }
+    md_file_printf(file, "    }\n  }\n}\n");
+    md_file_close(file);
+
+    MD_LOG_INFO("Bench: Wrote %zu frames to '%.*s'", num_frames, (int)path.len, path.ptr);
+    return true;
+}
+
+}  // namespace bench
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_str.h>
+#include <core/md_vec_math.h>
+
+struct md_allocator_i;
+
+namespace bench {
+
+/*
+    Replay of a recorded session for reproducible performance measurement (built as the viamd_bench target)
+    A session is a text file with one command per line, '#' starts a comment:
+
+        frames <count>                      Number of frames to replay
+        warmup <count>                      Frames which are replayed before the recording starts (default 30)
+        <frame> camera px py pz qx qy qz qw dist    Camera key, the camera is interpolated between keys
+        <frame> time <t>                    Animation time key, the time is interpolated between keys (frame scrubbing)
+        <frame> show|hide|toggle <rep>      Visibility of the representation with index rep
+        <frame> select <filter expression>  Sets the selection
+        <frame> deselect                    Clears the selection
+
+    The frames of a session count from the first frame after the warmup.
+*/
+
+#define BENCH_MAX_SECTIONS 32
+#define BENCH_DEFAULT_WARMUP 30
+
+enum EventType {
+    Event_Camera = 0,
+    Event_Time,
+    Event_Show,
+    Event_Hide,
+    Event_Toggle,
+    Event_Select,
+    Event_Deselect,
+};
+
+struct Event {
+    uint32_t  frame;
+    EventType type;
+    vec3_t    position;
+    quat_t    orientation;
+    float     distance;
+    double    time;
+    int32_t   rep;
+    char      query[256];
+};
+
+struct Session {
+    Event*   events = nullptr;      // md_array, ordered by frame
+    uint32_t num_frames = 0;
+    uint32_t warmup = BENCH_DEFAULT_WARMUP;
+};
+
+bool load_session(Session* session, str_t path, md_allocator_i* alloc);
+void free_session(Session* session, md_allocator_i* alloc);
+
+// The camera and the time of a frame are interpolated between the keys which surround it, returns false if the session has no such keys
+bool camera_at(const Session* session, double frame, vec3_t* position, quat_t* orientation, float* distance);
+bool time_at(const Session* session, double frame, double* time);
+
+// Timing of the CPU sections (PUSH_CPU_SECTION / POP_CPU_SECTION) and the GPU sections of each frame while recording
+// The label is expected to be a string literal. Sections which occur several times in a frame are summed.
+void begin_recording();
+bool recording();
+void push_section(const char* label);
+void pop_section();
+
+// Closes the recorded frame, including the GPU samples which have been read back since the previous frame
+void end_frame();
+
+struct Info {
+    str_t session;
+    const char* renderer;
+    const char* vendor;
+    const char* version;
+    const char* build;
+    int width;
+    int height;
+    size_t num_atoms;
+    size_t num_traj_frames;
+};
+
+// Writes the recorded frames as JSON and stops the recording
+bool write_json(str_t path, const Info& info);
+
+}  // namespace bench
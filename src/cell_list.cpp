@@ -0,0 +1,333 @@
+#include "cell_list.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_bitfield.h>
+
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+static inline bool is_periodic(const CellList* list) {
+    return list->pbc_ext.x > 0 && list->pbc_ext.y > 0 && list->pbc_ext.z > 0;
+}
+
+static inline float wrap(float v, float ext) {
+    return v - ext * floorf(v / ext);
+}
+
+uint64_t cell_list_fingerprint(const float* x, const float* y, const float* z, size_t count, vec3_t pbc_ext) {
+    // FNV-1a over 32-bit words in four independent lanes, which is fast enough to run over the coordinates of every frame
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t h[4] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL, 0x9e3779b97f4a7c15ULL, 0x7f4a7c159e3779b9ULL};
+    const float* src[3] = {x, y, z};
+    for (int a = 0; a < 3; ++a) {
+        const uint32_t* w = (const uint32_t*)src[a];
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            h[0] = (h[0] ^ w[i + 0]) * prime;
+            h[1] = (h[1] ^ w[i + 1]) * prime;
+            h[2] = (h[2] ^ w[i + 2]) * prime;
+            h[3] = (h[3] ^ w[i + 3]) * prime;
+        }
+        for (; i < count; ++i) {
+            h[0] = (h[0] ^ w[i]) * prime;
+        }
+    }
+    uint64_t key = (uint64_t)count;
+    for (int i = 0; i < 4; ++i) {
+        key = (key ^ h[i]) * prime;
+    }
+    uint32_t ext[3];
+    MEMCPY(ext, &pbc_ext, sizeof(ext));
+    for (int i = 0; i < 3; ++i) {
+        key = (key ^ ext[i]) * prime;
+    }
+    // 0 marks an empty grid
+    return key ? key : 1;
+}
+
+void cell_list_free(CellList* list) {
+    ASSERT(list);
+    if (list->alloc) {
+        md_free(list->alloc, list->cell_offset, sizeof(uint32_t) * (list->num_cells + 1));
+        md_free(list->alloc, list->atom_idx, sizeof(uint32_t) * list->num_atoms);
+        md_free(list->alloc, list->x, sizeof(float) * list->num_atoms * 3);
+    }
+    *list = {};
+}
+
+void cell_list_build(CellList* list, const float* x, const float* y, const float* z, size_t count, vec3_t pbc_ext, float cell_size, md_allocator_i* alloc) {
+    ASSERT(list);
+    ASSERT(alloc);
+    ASSERT(cell_size > 0);
+    cell_list_free(list);
+    if (count == 0) return;
+
+    list->alloc = alloc;
+    list->num_atoms = count;
+    list->pbc_ext = (pbc_ext.x > 0 && pbc_ext.y > 0 && pbc_ext.z > 0) ? pbc_ext : vec3_t{0, 0, 0};
+    const bool periodic = is_periodic(list);
+
+    float ext[3];
+    float org[3] = {0, 0, 0};
+    if (periodic) {
+        ext[0] = pbc_ext.x;
+        ext[1] = pbc_ext.y;
+        ext[2] = pbc_ext.z;
+    } else {
+        float min_box[3] = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+        float max_box[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (size_t i = 0; i < count; ++i) {
+            min_box[0] = MIN(min_box[0], x[i]); max_box[0] = MAX(max_box[0], x[i]);
+            min_box[1] = MIN(min_box[1], y[i]); max_box[1] = MAX(max_box[1], y[i]);
+            min_box[2] = MIN(min_box[2], z[i]); max_box[2] = MAX(max_box[2], z[i]);
+        }
+        for (int a = 0; a < 3; ++a) {
+            org[a] = min_box[a];
+            ext[a] = MAX(max_box[a] - min_box[a], cell_size);
+        }
+    }
+
+    // Enlarge the cells until their number fits
+    int dims[3];
+    while (true) {
+        for (int a = 0; a < 3; ++a) {
+            // A periodic box is tiled exactly, so the cells are at least cell_size
+            dims[a] = periodic ? MAX(1, (int)floorf(ext[a] / cell_size)) : MAX(1, (int)ceilf(ext[a] / cell_size));
+        }
+        if ((size_t)dims[0] * dims[1] * dims[2] <= CELL_LIST_MAX_CELLS) break;
+        cell_size *= 1.25f;
+    }
+
+    list->dims[0] = dims[0];
+    list->dims[1] = dims[1];
+    list->dims[2] = dims[2];
+    list->origin = {org[0], org[1], org[2]};
+    list->cell_ext = periodic ? vec3_t{ext[0] / dims[0], ext[1] / dims[1], ext[2] / dims[2]} : vec3_t{cell_size, cell_size, cell_size};
+    list->num_cells = (size_t)dims[0] * dims[1] * dims[2];
+
+    list->cell_offset = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * (list->num_cells + 1));
+    list->atom_idx    = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * count);
+    list->x = (float*)md_alloc(alloc, sizeof(float) * count * 3);
+    list->y = list->x + count;
+    list->z = list->y + count;
+    MEMSET(list->cell_offset, 0, sizeof(uint32_t) * (list->num_cells + 1));
+
+    // Counting sort by cell, where atom_idx temporarily holds the cell of each atom
+    const float inv_cell[3] = {1.0f / list->cell_ext.x, 1.0f / list->cell_ext.y, 1.0f / list->cell_ext.z};
+    for (size_t i = 0; i < count; ++i) {
+        float p[3] = {x[i] - org[0], y[i] - org[1], z[i] - org[2]};
+        int c[3];
+        for (int a = 0; a < 3; ++a) {
+            if (periodic) p[a] = wrap(p[a], ext[a]);
+            c[a] = CLAMP((int)(p[a] * inv_cell[a]), 0, dims[a] - 1);
+        }
+        const uint32_t cell = (uint32_t)((c[2] * dims[1] + c[1]) * dims[0] + c[0]);
+        list->atom_idx[i] = cell;
+        list->cell_offset[cell + 1] += 1;
+    }
+    for (size_t c = 0; c < list->num_cells; ++c) {
+        list->cell_offset[c + 1] += list->cell_offset[c];
+    }
+
+    // Scatter the atoms, where the final offsets are restored by shifting the running offsets back one cell
+    uint32_t* cursor = list->cell_offset;
+    uint32_t* cells = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * count);
+    MEMCPY(cells, list->atom_idx, sizeof(uint32_t) * count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t dst = cursor[cells[i]]++;
+        list->atom_idx[dst] = (uint32_t)i;
+        list->x[dst] = periodic ? wrap(x[i], ext[0]) : x[i];
+        list->y[dst] = periodic ? wrap(y[i], ext[1]) : y[i];
+        list->z[dst] = periodic ? wrap(z[i], ext[2]) : z[i];
+    }
+    md_free(alloc, cells, sizeof(uint32_t) * count);
+    for (size_t c = list->num_cells; c > 0; --c) {
+        list->cell_offset[c] = list->cell_offset[c - 1];
+    }
+    list->cell_offset[0] = 0;
+
+    list->key = cell_list_fingerprint(x, y, z, count, pbc_ext);
+}
+
+// Cells of one axis which overlap [p - r, p + r]
+// If the range covers the whole periodic axis, every cell is visited once and the distance on the axis is the minimum image
+struct AxisRange {
+    int lo, hi;
+    bool all;
+};
+
+static inline AxisRange axis_range(const CellList* list, int axis, float p, float r) {
+    const float org  = (&list->origin.x)[axis];
+    const float cell = (&list->cell_ext.x)[axis];
+    const int dim = list->dims[axis];
+    AxisRange range = {(int)floorf((p - r - org) / cell), (int)floorf((p + r - org) / cell), false};
+    if (is_periodic(list)) {
+        if (range.hi - range.lo + 1 >= dim) {
+            range = {0, dim - 1, true};
+        }
+    } else {
+        range.lo = MAX(range.lo, 0);
+        range.hi = MIN(range.hi, dim - 1);
+    }
+    return range;
+}
+
+// Cell of the grid, image shift and distance bounds on one axis for the (unwrapped) cell index i of a range
+struct AxisCell {
+    int idx;
+    float shift;
+    float min2, max2;
+};
+
+static inline AxisCell axis_cell(const CellList* list, int axis, const AxisRange& range, int i, float p) {
+    const float org  = (&list->origin.x)[axis];
+    const float cell = (&list->cell_ext.x)[axis];
+    const int dim = list->dims[axis];
+    AxisCell ac;
+    if (range.all) {
+        ac.idx = i;
+        ac.shift = 0;
+        ac.min2 = 0;
+        ac.max2 = FLT_MAX;
+        return ac;
+    }
+    const int wrapped = ((i % dim) + dim) % dim;
+    ac.idx = wrapped;
+    ac.shift = (float)(i - wrapped) * cell;
+    const float beg = org + (float)i * cell;
+    const float end = beg + cell;
+    const float dmin = p < beg ? beg - p : (p > end ? p - end : 0.0f);
+    const float dmax = MAX(fabsf(p - beg), fabsf(end - p));
+    ac.min2 = dmin * dmin;
+    ac.max2 = dmax * dmax;
+    return ac;
+}
+
+static inline float axis_delta(const CellList* list, int axis, const AxisRange& range, const AxisCell& ac, float q, float p) {
+    float d = q + ac.shift - p;
+    if (range.all) {
+        const float ext = (&list->pbc_ext.x)[axis];
+        d -= ext * roundf(d / ext);
+    }
+    return d;
+}
+
+// Visits the cells which overlap the sphere, where visit(cell, ax, ay, az, rx, ry, rz) returns false to stop
+template <typename Fn>
+static void for_each_cell(const CellList* list, const float p[3], float r, Fn visit) {
+    const AxisRange rx = axis_range(list, 0, p[0], r);
+    const AxisRange ry = axis_range(list, 1, p[1], r);
+    const AxisRange rz = axis_range(list, 2, p[2], r);
+    const float r2 = r * r;
+    for (int k = rz.lo; k <= rz.hi; ++k) {
+        const AxisCell az = axis_cell(list, 2, rz, k, p[2]);
+        if (az.min2 > r2) continue;
+        for (int j = ry.lo; j <= ry.hi; ++j) {
+            const AxisCell ay = axis_cell(list, 1, ry, j, p[1]);
+            if (az.min2 + ay.min2 > r2) continue;
+            for (int i = rx.lo; i <= rx.hi; ++i) {
+                const AxisCell ax = axis_cell(list, 0, rx, i, p[0]);
+                if (az.min2 + ay.min2 + ax.min2 > r2) continue;
+                const uint32_t cell = (uint32_t)((az.idx * list->dims[1] + ay.idx) * list->dims[0] + ax.idx);
+                if (!visit(cell, ax, ay, az, rx, ry, rz)) return;
+            }
+        }
+    }
+}
+
+static inline void query_pos(const CellList* list, vec3_t pos, float p[3]) {
+    p[0] = pos.x;
+    p[1] = pos.y;
+    p[2] = pos.z;
+    if (is_periodic(list)) {
+        p[0] = wrap(p[0], list->pbc_ext.x);
+        p[1] = wrap(p[1], list->pbc_ext.y);
+        p[2] = wrap(p[2], list->pbc_ext.z);
+    }
+}
+
+void cell_list_query_radius(const CellList* list, vec3_t pos, float radius, CellListQueryFn fn, void* user_data) {
+    ASSERT(list);
+    ASSERT(fn);
+    if (!list->num_atoms || radius < 0) return;
+
+    float p[3];
+    query_pos(list, pos, p);
+    const float r2 = radius * radius;
+    for_each_cell(list, p, radius, [&](uint32_t cell, const AxisCell& ax, const AxisCell& ay, const AxisCell& az, const AxisRange& rx, const AxisRange& ry, const AxisRange& rz) {
+        for (uint32_t n = list->cell_offset[cell]; n < list->cell_offset[cell + 1]; ++n) {
+            const float dx = axis_delta(list, 0, rx, ax, list->x[n], p[0]);
+            const float dy = axis_delta(list, 1, ry, ay, list->y[n], p[1]);
+            const float dz = axis_delta(list, 2, rz, az, list->z[n], p[2]);
+            const float d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 <= r2 && !fn(list->atom_idx[n], d2, user_data)) return false;
+        }
+        return true;
+    });
+}
+
+void cell_list_grow_mask_by_radius(const CellList* list, md_bitfield_t* mask, float radius, const md_bitfield_t* filter) {
+    ASSERT(list);
+    ASSERT(mask);
+    if (!list->num_atoms || radius <= 0) return;
+
+    md_allocator_i* alloc = md_heap_allocator;
+
+    // The atoms of the mask are gathered first, as the mask grows during the queries
+    const size_t num_src = (size_t)md_bitfield_popcount(mask);
+    if (num_src == 0) return;
+    uint32_t* src = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * num_src);
+    size_t count = 0;
+    md_bitfield_iter_t it = md_bitfield_iter_create(mask);
+    while (md_bitfield_iter_next(&it) && count < num_src) {
+        const uint64_t idx = md_bitfield_iter_idx(&it);
+        if (idx < list->num_atoms) src[count++] = (uint32_t)idx;
+    }
+
+    // Atoms left to add per cell, which lets the queries skip the cells that are exhausted
+    uint32_t* remaining = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * list->num_cells);
+    for (size_t c = 0; c < list->num_cells; ++c) {
+        uint32_t left = 0;
+        for (uint32_t n = list->cell_offset[c]; n < list->cell_offset[c + 1]; ++n) {
+            const uint32_t a = list->atom_idx[n];
+            left += (!filter || md_bitfield_test_bit(filter, a)) && !md_bitfield_test_bit(mask, a);
+        }
+        remaining[c] = left;
+    }
+
+    // The sorted coordinates are looked up through the inverse of atom_idx
+    uint32_t* slot = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * list->num_atoms);
+    for (uint32_t n = 0; n < (uint32_t)list->num_atoms; ++n) {
+        slot[list->atom_idx[n]] = n;
+    }
+
+    const float r2 = radius * radius;
+    for (size_t s = 0; s < count; ++s) {
+        const uint32_t n_src = slot[src[s]];
+        const float p[3] = {list->x[n_src], list->y[n_src], list->z[n_src]};
+        for_each_cell(list, p, radius, [&](uint32_t cell, const AxisCell& ax, const AxisCell& ay, const AxisCell& az, const AxisRange& rx, const AxisRange& ry, const AxisRange& rz) {
+            if (remaining[cell] == 0) return true;
+            // Cells which are entirely within the radius are added without testing their atoms
+            const bool inside = ax.max2 + ay.max2 + az.max2 <= r2;
+            for (uint32_t n = list->cell_offset[cell]; n < list->cell_offset[cell + 1]; ++n) {
+                const uint32_t a = list->atom_idx[n];
+                if (md_bitfield_test_bit(mask, a) || (filter && !md_bitfield_test_bit(filter, a))) continue;
+                if (!inside) {
+                    const float dx = axis_delta(list, 0, rx, ax, list->x[n], p[0]);
+                    const float dy = axis_delta(list, 1, ry, ay, list->y[n], p[1]);
+                    const float dz = axis_delta(list, 2, rz, az, list->z[n], p[2]);
+                    if (dx * dx + dy * dy + dz * dz > r2) continue;
+                }
+                md_bitfield_set_bit(mask, a);
+                remaining[cell] -= 1;
+            }
+            return true;
+        });
+    }
+
+    md_free(alloc, slot, sizeof(uint32_t) * list->num_atoms);
+    md_free(alloc, remaining, sizeof(uint32_t) * list->num_cells);
+    md_free(alloc, src, sizeof(uint32_t) * num_src);
+}
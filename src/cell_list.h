@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <core/md_vec_math.h>
+
+struct md_allocator_i;
+struct md_bitfield_t;
+
+// Uniform grid of the atoms of a frame for radial neighbour queries
+// The atoms are sorted by cell, so the atoms of a cell are contiguous and only the cells which overlap the query radius are visited.
+// With a periodic box the grid tiles the box and the queries wrap around it with the minimum image distance, the box is assumed to be orthorhombic.
+// The cell size is independent of the query radius, so one grid serves every radius of a frame.
+
+#define CELL_LIST_DEFAULT_CELL_SIZE 4.0f
+#define CELL_LIST_MAX_CELLS (1 << 22)
+
+struct CellList {
+    uint64_t key = 0;               // Fingerprint of the coordinates it was built from, 0 if empty
+    size_t num_atoms = 0;
+    size_t num_cells = 0;
+    int dims[3] = {};
+    vec3_t origin = {};
+    vec3_t cell_ext = {};
+    vec3_t pbc_ext = {};            // Zero if the box is not periodic
+    uint32_t* cell_offset = 0;      // num_cells + 1, the atoms of cell c are [cell_offset[c], cell_offset[c+1])
+    uint32_t* atom_idx = 0;         // Index in the molecule of each sorted atom
+    float* x = 0;                   // Sorted coordinates, wrapped into the box if it is periodic
+    float* y = 0;
+    float* z = 0;
+    md_allocator_i* alloc = 0;
+};
+
+// Fingerprint of a set of coordinates and box, which is the key of a grid built from them
+uint64_t cell_list_fingerprint(const float* x, const float* y, const float* z, size_t count, vec3_t pbc_ext);
+
+// The box is periodic if pbc_ext is non zero on every axis, the cells are enlarged if needed to keep their number within CELL_LIST_MAX_CELLS
+void cell_list_build(CellList* list, const float* x, const float* y, const float* z, size_t count, vec3_t pbc_ext, float cell_size, md_allocator_i* alloc);
+void cell_list_free(CellList* list);
+
+// Called for every atom within radius of the position with its index in the molecule and squared distance, return false to stop the query
+typedef bool (*CellListQueryFn)(uint32_t atom_idx, float dist2, void* user_data);
+void cell_list_query_radius(const CellList* list, vec3_t pos, float radius, CellListQueryFn fn, void* user_data);
+
+// Adds the atoms within radius of any atom of mask to mask, only the atoms of filter are added if it is set
+void cell_list_grow_mask_by_radius(const CellList* list, md_bitfield_t* mask, float radius, const md_bitfield_t* filter);
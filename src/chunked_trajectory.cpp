@@ -0,0 +1,589 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "chunked_trajectory.h"
+
+#include <task_system.h>
+
+#include <md_molecule.h>
+#include <md_trajectory.h>
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define file_seek(file, offset) _fseeki64(file, (__int64)(offset), SEEK_SET)
+#else
+#define file_seek(file, offset) fseeko(file, (off_t)(offset), SEEK_SET)
+#endif
+
+#define CHUNKED_TRAJECTORY_MAGIC   0x5443564D   // 'MVCT'
+#define CHUNKED_TRAJECTORY_VERSION 1
+#define PAYLOAD_ALIGN 8
+
+// The time unit and unit cells are stored as they are, their sizes are checked when the file is opened
+struct ChunkedHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_atoms;
+    uint64_t num_frames;
+    uint32_t block_frames;
+    float    precision;
+    uint64_t index_offset;
+    uint64_t max_frame_data_size;
+    uint32_t unit_size;
+    uint32_t cell_size;
+    uint8_t  time_unit[32];
+};
+
+struct ChunkedFrameEntry {
+    uint64_t offset;
+    uint64_t size;
+    double   time;
+};
+
+// Axis of a frame record, which is followed by the num_atoms offsets of the axis (padded to PAYLOAD_ALIGN)
+struct ChunkedAxis {
+    int32_t base;
+    uint32_t width;
+};
+
+// Fetched frame data: The record of the key frame of the block, followed by the record of the frame unless it is the key frame
+struct ChunkedFrameData {
+    int64_t  idx;
+    uint64_t key_size;
+    uint64_t delta_size;
+};
+
+STATIC_ASSERT(sizeof(md_unit_t) <= sizeof(((ChunkedHeader*)0)->time_unit), "Time unit does not fit in the header");
+
+struct ChunkedTrajectory {
+    FILE* file;
+    ChunkedHeader hdr;
+    ChunkedFrameEntry* frames;  // [num_frames]
+    md_unit_cell_t* cells;      // [num_frames]
+    md_array(double) frame_times;
+    md_allocator_i* alloc;
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
+static inline size_t payload_size(size_t num_atoms, uint32_t width) {
+    return ALIGN_TO(num_atoms * width, PAYLOAD_ALIGN);
+}
+
+static inline size_t index_size(size_t num_frames) {
+    return (sizeof(ChunkedFrameEntry) + sizeof(md_unit_cell_t)) * num_frames;
+}
+
+static inline int64_t key_frame(const ChunkedHeader& hdr, int64_t idx) {
+    return idx - idx % hdr.block_frames;
+}
+
+// Encodes the values of each axis as offsets to their minimum, in the smallest width which holds the range
+static size_t encode_record(uint8_t* dst, const int32_t* const src[3], size_t n) {
+    size_t size = 0;
+    for (int c = 0; c < 3; ++c) {
+        int32_t lo = INT32_MAX;
+        int32_t hi = INT32_MIN;
+        for (size_t i = 0; i < n; ++i) {
+            lo = MIN(lo, src[c][i]);
+            hi = MAX(hi, src[c][i]);
+        }
+        const uint64_t range = n ? (uint64_t)((int64_t)hi - (int64_t)lo) : 0;
+        const ChunkedAxis axis = {n ? lo : 0, range <= 0xFF ? 1U : range <= 0xFFFF ? 2U : 4U};
+        MEMCPY(dst + size, &axis, sizeof(axis));
+        size += sizeof(axis);
+
+        uint8_t* out = dst + size;
+        switch (axis.width) {
+        case 1: for (size_t i = 0; i < n; ++i) out[i] = (uint8_t)(src[c][i] - axis.base); break;
+        case 2: for (size_t i = 0; i < n; ++i) ((uint16_t*)out)[i] = (uint16_t)(src[c][i] - axis.base); break;
+        case 4: for (size_t i = 0; i < n; ++i) ((uint32_t*)out)[i] = (uint32_t)((int64_t)src[c][i] - axis.base); break;
+        default: ASSERT(false);
+        }
+        MEMSET(out + n * axis.width, 0, payload_size(n, axis.width) - n * axis.width);
+        size += payload_size(n, axis.width);
+    }
+    return size;
+}
+
+static inline size_t max_record_size(size_t num_atoms) {
+    return 3 * (sizeof(ChunkedAxis) + payload_size(num_atoms, 4));
+}
+
+template <typename K, typename D>
+static void decode_axis(float* dst, const K* key, int32_t key_base, const D* delta, int32_t delta_base, float scale, size_t n) {
+    // The sums wrap in unsigned arithmetic, the result is within the range of int32 again
+    const uint32_t base = (uint32_t)key_base + (uint32_t)delta_base;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (float)(int32_t)(base + (uint32_t)key[i] + (uint32_t)delta[i]) * scale;
+    }
+}
+
+template <typename K>
+static void decode_axis(float* dst, const K* key, int32_t key_base, float scale, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (float)(int32_t)((uint32_t)key_base + (uint32_t)key[i]) * scale;
+    }
+}
+
+template <typename K>
+static void decode_axis_delta(float* dst, const K* key, int32_t key_base, const uint8_t* delta, ChunkedAxis d, float scale, size_t n) {
+    switch (d.width) {
+    case 1: decode_axis(dst, key, key_base, (const uint8_t*)delta, d.base, scale, n); break;
+    case 2: decode_axis(dst, key, key_base, (const uint16_t*)delta, d.base, scale, n); break;
+    case 4: decode_axis(dst, key, key_base, (const uint32_t*)delta, d.base, scale, n); break;
+    default: ASSERT(false);
+    }
+}
+
+// Decodes a frame from the record of its key frame and its own record (NULL for key frames)
+static bool decode_record(float* const dst[3], const uint8_t* key, size_t key_size, const uint8_t* delta, size_t delta_size, size_t n, float scale) {
+    size_t key_pos = 0;
+    size_t delta_pos = 0;
+    for (int c = 0; c < 3; ++c) {
+        ChunkedAxis k, d = {};
+        if (key_pos + sizeof(k) > key_size) return false;
+        MEMCPY(&k, key + key_pos, sizeof(k));
+        key_pos += sizeof(k);
+        if (k.width != 1 && k.width != 2 && k.width != 4) return false;
+        if (key_pos + payload_size(n, k.width) > key_size) return false;
+        const uint8_t* kp = key + key_pos;
+        key_pos += payload_size(n, k.width);
+
+        if (!delta) {
+            switch (k.width) {
+            case 1: decode_axis(dst[c], (const uint8_t*)kp, k.base, scale, n); break;
+            case 2: decode_axis(dst[c], (const uint16_t*)kp, k.base, scale, n); break;
+            case 4: decode_axis(dst[c], (const uint32_t*)kp, k.base, scale, n); break;
+            }
+            continue;
+        }
+
+        if (delta_pos + sizeof(d) > delta_size) return false;
+        MEMCPY(&d, delta + delta_pos, sizeof(d));
+        delta_pos += sizeof(d);
+        if (d.width != 1 && d.width != 2 && d.width != 4) return false;
+        if (delta_pos + payload_size(n, d.width) > delta_size) return false;
+        const uint8_t* dp = delta + delta_pos;
+        delta_pos += payload_size(n, d.width);
+
+        switch (k.width) {
+        case 1: decode_axis_delta(dst[c], (const uint8_t*)kp, k.base, dp, d, scale, n); break;
+        case 2: decode_axis_delta(dst[c], (const uint16_t*)kp, k.base, dp, d, scale, n); break;
+        case 4: decode_axis_delta(dst[c], (const uint32_t*)kp, k.base, dp, d, scale, n); break;
+        }
+    }
+    return true;
+}
+
+// #reader
+static inline void traj_lock(ChunkedTrajectory* ct) {
+    while (ct->lock.test_and_set(std::memory_order_acquire)) {}
+}
+
+static inline void traj_unlock(ChunkedTrajectory* ct) {
+    ct->lock.clear(std::memory_order_release);
+}
+
+static bool read_at(ChunkedTrajectory* ct, uint64_t offset, void* dst, size_t size) {
+    traj_lock(ct);
+    const bool ok = file_seek(ct->file, offset) == 0 && fread(dst, 1, size, ct->file) == size;
+    traj_unlock(ct);
+    return ok;
+}
+
+static bool chunked_get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    ChunkedTrajectory* ct = (ChunkedTrajectory*)inst;
+    ASSERT(header);
+    MEMSET(header, 0, sizeof(md_trajectory_header_t));
+    header->num_frames = ct->hdr.num_frames;
+    header->num_atoms  = ct->hdr.num_atoms;
+    header->max_frame_data_size = ct->hdr.max_frame_data_size;
+    MEMCPY(&header->time_unit, ct->hdr.time_unit, sizeof(md_unit_t));
+    header->frame_times = ct->frame_times;
+    return true;
+}
+
+static size_t chunked_fetch_frame_data(struct md_trajectory_o* inst, int64_t idx, void* data_ptr) {
+    ChunkedTrajectory* ct = (ChunkedTrajectory*)inst;
+    if (idx < 0 || idx >= (int64_t)ct->hdr.num_frames) {
+        MD_LOG_ERROR("Chunked trajectory: Frame index %lld is out of range", (long long)idx);
+        return 0;
+    }
+    const int64_t key = key_frame(ct->hdr, idx);
+    const ChunkedFrameEntry& k = ct->frames[key];
+    const ChunkedFrameEntry& f = ct->frames[idx];
+    const ChunkedFrameData fd = {idx, k.size, key == idx ? 0 : f.size};
+    const size_t size = sizeof(fd) + fd.key_size + fd.delta_size;
+    if (!data_ptr) return size;
+
+    uint8_t* dst = (uint8_t*)data_ptr;
+    MEMCPY(dst, &fd, sizeof(fd));
+    if (!read_at(ct, k.offset, dst + sizeof(fd), fd.key_size)) return 0;
+    if (fd.delta_size && !read_at(ct, f.offset, dst + sizeof(fd) + fd.key_size, fd.delta_size)) return 0;
+    return size;
+}
+
+static bool chunked_decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, size_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    ChunkedTrajectory* ct = (ChunkedTrajectory*)inst;
+    ChunkedFrameData fd;
+    if (!data_ptr || data_size < sizeof(fd)) return false;
+    MEMCPY(&fd, data_ptr, sizeof(fd));
+    if (fd.idx < 0 || fd.idx >= (int64_t)ct->hdr.num_frames || sizeof(fd) + fd.key_size + fd.delta_size > data_size) {
+        MD_LOG_ERROR("Chunked trajectory: Frame data is corrupt");
+        return false;
+    }
+
+    if (header) {
+        header->num_atoms = ct->hdr.num_atoms;
+        header->index = fd.idx;
+        header->timestamp = ct->frames[fd.idx].time;
+        header->unit_cell = ct->cells[fd.idx];
+    }
+
+    if (x && y && z) {
+        const uint8_t* key = (const uint8_t*)data_ptr + sizeof(fd);
+        const uint8_t* delta = fd.delta_size ? key + fd.key_size : NULL;
+        float* dst[3] = {x, y, z};
+        if (!decode_record(dst, key, fd.key_size, delta, fd.delta_size, ct->hdr.num_atoms, ct->hdr.precision)) {
+            MD_LOG_ERROR("Chunked trajectory: Frame %lld is corrupt", (long long)fd.idx);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool chunked_load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    const size_t size = chunked_fetch_frame_data(inst, idx, NULL);
+    if (!size) return false;
+    void* buf = md_alloc(md_heap_allocator, size);
+    defer { md_free(md_heap_allocator, buf, size); };
+    return chunked_fetch_frame_data(inst, idx, buf) == size && chunked_decode_frame_data(inst, buf, size, header, x, y, z);
+}
+
+static void chunked_free(ChunkedTrajectory* ct) {
+    if (ct->file) fclose(ct->file);
+    if (ct->frames) md_free(ct->alloc, ct->frames, sizeof(ChunkedFrameEntry) * ct->hdr.num_frames);
+    if (ct->cells)  md_free(ct->alloc, ct->cells, sizeof(md_unit_cell_t) * ct->hdr.num_frames);
+    md_array_free(ct->frame_times, ct->alloc);
+}
+
+static md_trajectory_i* chunked_create(str_t filename, md_allocator_i* alloc) {
+    ASSERT(alloc);
+    char path[1024];
+    str_copy_to_char_buf(path, sizeof(path), filename);
+
+    ChunkedTrajectory tmp = {};
+    tmp.alloc = alloc;
+    tmp.file = fopen(path, "rb");
+    if (!tmp.file) {
+        MD_LOG_ERROR("Could not open file '%.*s'", (int)filename.len, filename.ptr);
+        return NULL;
+    }
+
+    ChunkedHeader& hdr = tmp.hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, tmp.file) == 1;
+    if (!ok || hdr.magic != CHUNKED_TRAJECTORY_MAGIC || hdr.version != CHUNKED_TRAJECTORY_VERSION) {
+        MD_LOG_ERROR("Chunked trajectory: '%.*s' is not a chunked trajectory of a supported version", (int)filename.len, filename.ptr);
+        hdr = {};
+        chunked_free(&tmp);
+        return NULL;
+    }
+    if (hdr.unit_size != sizeof(md_unit_t) || hdr.cell_size != sizeof(md_unit_cell_t) || !hdr.num_frames || !hdr.block_frames || hdr.precision <= 0) {
+        MD_LOG_ERROR("Chunked trajectory: '%.*s' was written by an incompatible version", (int)filename.len, filename.ptr);
+        hdr = {};
+        chunked_free(&tmp);
+        return NULL;
+    }
+
+    tmp.frames = (ChunkedFrameEntry*)md_alloc(alloc, sizeof(ChunkedFrameEntry) * hdr.num_frames);
+    tmp.cells  = (md_unit_cell_t*)md_alloc(alloc, sizeof(md_unit_cell_t) * hdr.num_frames);
+    ok = file_seek(tmp.file, hdr.index_offset) == 0 &&
+        fread(tmp.frames, sizeof(ChunkedFrameEntry), hdr.num_frames, tmp.file) == hdr.num_frames &&
+        fread(tmp.cells, sizeof(md_unit_cell_t), hdr.num_frames, tmp.file) == hdr.num_frames;
+    for (size_t i = 0; i < hdr.num_frames && ok; ++i) {
+        ok = tmp.frames[i].size > 0 && tmp.frames[i].offset + tmp.frames[i].size <= hdr.index_offset;
+    }
+    if (!ok) {
+        MD_LOG_ERROR("Chunked trajectory: The index of '%.*s' is corrupt", (int)filename.len, filename.ptr);
+        chunked_free(&tmp);
+        return NULL;
+    }
+    md_array_resize(tmp.frame_times, hdr.num_frames, alloc);
+    for (size_t i = 0; i < hdr.num_frames; ++i) {
+        tmp.frame_times[i] = tmp.frames[i].time;
+    }
+
+    void* mem = md_alloc(alloc, sizeof(md_trajectory_i) + sizeof(ChunkedTrajectory));
+    md_trajectory_i* traj = (md_trajectory_i*)mem;
+    ChunkedTrajectory* ct = (ChunkedTrajectory*)(traj + 1);
+    MEMSET(traj, 0, sizeof(md_trajectory_i));
+    PLACEMENT_NEW(ct) ChunkedTrajectory();
+    ct->file  = tmp.file;
+    ct->hdr   = tmp.hdr;
+    ct->frames = tmp.frames;
+    ct->cells = tmp.cells;
+    ct->frame_times = tmp.frame_times;
+    ct->alloc = alloc;
+
+    traj->inst = (md_trajectory_o*)ct;
+    traj->get_header = chunked_get_header;
+    traj->load_frame = chunked_load_frame;
+    traj->fetch_frame_data = chunked_fetch_frame_data;
+    traj->decode_frame_data = chunked_decode_frame_data;
+    return traj;
+}
+
+static void chunked_destroy(md_trajectory_i* traj) {
+    ASSERT(traj);
+    ChunkedTrajectory* ct = (ChunkedTrajectory*)traj->inst;
+    md_allocator_i* alloc = ct->alloc;
+    chunked_free(ct);
+    md_free(alloc, traj, sizeof(md_trajectory_i) + sizeof(ChunkedTrajectory));
+}
+
+static md_trajectory_loader_i chunked_loader = {
+    chunked_create,
+    chunked_destroy,
+};
+
+md_trajectory_loader_i* chunked_trajectory_loader() {
+    return &chunked_loader;
+}
+
+// #writer
+struct ChunkedWriter {
+    const ChunkedTrajectoryWriteDesc* desc;
+    FILE* file;
+    uint64_t end;                   // Where the next record is appended
+    ChunkedFrameEntry* frames;      // [num_frames]
+    md_unit_cell_t* cells;          // [num_frames]
+    size_t num_frames;
+    size_t src_atoms;
+    uint32_t block_beg;             // First block of the wave
+    std::atomic_bool ok;
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
+static bool append_record(ChunkedWriter* w, int64_t idx, const void* data, size_t size) {
+    while (w->lock.test_and_set(std::memory_order_acquire)) {}
+    const uint64_t offset = w->end;
+    const bool ok = fwrite(data, 1, size, w->file) == size;
+    w->end += size;
+    w->lock.clear(std::memory_order_release);
+
+    w->frames[idx].offset = offset;
+    w->frames[idx].size = size;
+    return ok;
+}
+
+static void encode_block(ChunkedWriter* w, uint32_t block) {
+    const ChunkedTrajectoryWriteDesc* desc = w->desc;
+    const size_t n = desc->num_atoms;
+    const int64_t beg = (int64_t)block * desc->block_frames;
+    const int64_t end = MIN(beg + (int64_t)desc->block_frames, (int64_t)w->num_frames);
+    const float inv_precision = 1.0f / desc->precision;
+
+    const size_t src_stride = ALIGN_TO(w->src_atoms, 8);
+    const size_t rec_cap = max_record_size(n);
+    const size_t bytes = sizeof(float) * 3 * src_stride + sizeof(int32_t) * 6 * n + rec_cap;
+    void* mem = md_alloc(md_heap_allocator, bytes);
+    defer { md_free(md_heap_allocator, mem, bytes); };
+
+    float* src[3] = {(float*)mem, (float*)mem + src_stride, (float*)mem + src_stride * 2};
+    int32_t* key[3] = {(int32_t*)(src[2] + src_stride), (int32_t*)(src[2] + src_stride) + n, (int32_t*)(src[2] + src_stride) + n * 2};
+    int32_t* cur[3] = {key[2] + n, key[2] + n * 2, key[2] + n * 3};
+    uint8_t* rec = (uint8_t*)(cur[2] + n);
+
+    for (int64_t idx = beg; idx < end && w->ok; ++idx) {
+        md_trajectory_frame_header_t header = {};
+        if (!md_trajectory_load_frame(desc->src, idx, &header, src[0], src[1], src[2])) {
+            MD_LOG_ERROR("Chunked trajectory: Failed to load frame %lld of the source", (long long)idx);
+            w->ok = false;
+            return;
+        }
+
+        int32_t* const* dst = idx == beg ? key : cur;
+        for (int c = 0; c < 3; ++c) {
+            for (size_t i = 0; i < n; ++i) {
+                const size_t a = desc->atom_indices ? (size_t)desc->atom_indices[i] : i;
+                dst[c][i] = (int32_t)lrintf(src[c][a] * inv_precision);
+            }
+        }
+        if (idx != beg) {
+            for (int c = 0; c < 3; ++c) {
+                for (size_t i = 0; i < n; ++i) {
+                    cur[c][i] -= key[c][i];
+                }
+            }
+        }
+
+        const size_t size = encode_record(rec, dst, n);
+        if (!append_record(w, idx, rec, size)) {
+            w->ok = false;
+            return;
+        }
+        w->frames[idx].time = header.timestamp;
+        w->cells[idx] = header.unit_cell;
+        if (desc->frames_written) desc->frames_written->fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool chunked_trajectory_write(const ChunkedTrajectoryWriteDesc* desc) {
+    ASSERT(desc);
+    ASSERT(desc->src);
+    const size_t num_frames = md_trajectory_num_frames(desc->src);
+    const size_t src_atoms  = md_trajectory_num_atoms(desc->src);
+    if (!num_frames || !desc->num_atoms || desc->block_frames == 0 || desc->precision <= 0) {
+        MD_LOG_ERROR("Chunked trajectory: Nothing to write");
+        return false;
+    }
+    for (size_t i = 0; desc->atom_indices && i < desc->num_atoms; ++i) {
+        if (desc->atom_indices[i] < 0 || (size_t)desc->atom_indices[i] >= src_atoms) {
+            MD_LOG_ERROR("Chunked trajectory: The atom subset is not within the trajectory");
+            return false;
+        }
+    }
+    if (!desc->atom_indices && desc->num_atoms != src_atoms) {
+        MD_LOG_ERROR("Chunked trajectory: The number of atoms does not match the trajectory");
+        return false;
+    }
+
+    char path[1024];
+    str_copy_to_char_buf(path, sizeof(path), desc->path);
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write data.", (int)desc->path.len, desc->path.ptr);
+        return false;
+    }
+    defer { fclose(file); };
+
+    ChunkedHeader hdr = {};
+    hdr.magic = CHUNKED_TRAJECTORY_MAGIC;
+    hdr.version = CHUNKED_TRAJECTORY_VERSION;
+    hdr.num_atoms = desc->num_atoms;
+    hdr.num_frames = num_frames;
+    hdr.block_frames = desc->block_frames;
+    hdr.precision = desc->precision;
+    hdr.unit_size = sizeof(md_unit_t);
+    hdr.cell_size = sizeof(md_unit_cell_t);
+    const md_unit_t time_unit = md_trajectory_time_unit(desc->src);
+    MEMCPY(hdr.time_unit, &time_unit, sizeof(md_unit_t));
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)desc->path.len, desc->path.ptr);
+        return false;
+    }
+
+    ChunkedWriter w = {};
+    w.desc = desc;
+    w.file = file;
+    w.end = sizeof(hdr);
+    w.num_frames = num_frames;
+    w.src_atoms = src_atoms;
+    w.ok = true;
+    w.frames = (ChunkedFrameEntry*)md_alloc(md_heap_allocator, sizeof(ChunkedFrameEntry) * num_frames);
+    w.cells  = (md_unit_cell_t*)md_alloc(md_heap_allocator, sizeof(md_unit_cell_t) * num_frames);
+    MEMSET(w.frames, 0, sizeof(ChunkedFrameEntry) * num_frames);
+    MEMSET(w.cells, 0, sizeof(md_unit_cell_t) * num_frames);
+    defer {
+        md_free(md_heap_allocator, w.frames, sizeof(ChunkedFrameEntry) * num_frames);
+        md_free(md_heap_allocator, w.cells, sizeof(md_unit_cell_t) * num_frames);
+    };
+
+    // The blocks are encoded in waves of one block per thread, which bounds the memory to a few frames per thread
+    // Records are appended in the order they complete, the index tells where each one is
+    const uint32_t num_blocks = (uint32_t)((num_frames + desc->block_frames - 1) / desc->block_frames);
+    const uint32_t blocks_per_wave = task_system::pool_num_threads();
+    bool cancelled = false;
+    for (w.block_beg = 0; w.block_beg < num_blocks && w.ok; w.block_beg += blocks_per_wave) {
+        if (task_system::task_cancelled()) {
+            cancelled = true;
+            break;
+        }
+        const uint32_t count = MIN(blocks_per_wave, num_blocks - w.block_beg);
+        task_system::ID id = task_system::pool_enqueue(STR("##Encode Blocks"), 0, count, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            ChunkedWriter* w = (ChunkedWriter*)user_data;
+            for (uint32_t i = range_beg; i < range_end; ++i) {
+                encode_block(w, w->block_beg + i);
+            }
+        }, &w, 0, task_system::Priority_Interactive);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+    }
+
+    if (cancelled) {
+        MD_LOG_INFO("Export to '%.*s' was cancelled", (int)desc->path.len, desc->path.ptr);
+        return false;
+    }
+
+    size_t max_data_size = 0;
+    for (size_t i = 0; i < num_frames; ++i) {
+        const int64_t key = key_frame(hdr, (int64_t)i);
+        const size_t size = sizeof(ChunkedFrameData) + w.frames[key].size + (key == (int64_t)i ? 0 : w.frames[i].size);
+        max_data_size = MAX(max_data_size, size);
+    }
+    hdr.index_offset = w.end;
+    hdr.max_frame_data_size = max_data_size;
+
+    bool ok = w.ok &&
+        fwrite(w.frames, sizeof(ChunkedFrameEntry), num_frames, file) == num_frames &&
+        fwrite(w.cells, sizeof(md_unit_cell_t), num_frames, file) == num_frames &&
+        file_seek(file, 0) == 0 &&
+        fwrite(&hdr, sizeof(hdr), 1, file) == 1;
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)desc->path.len, desc->path.ptr);
+        return false;
+    }
+
+    const uint64_t raw_size = (uint64_t)num_frames * desc->num_atoms * 3 * sizeof(float);
+    MD_LOG_INFO("Chunked trajectory: Wrote %zu frames to '%.*s' (%.1f%% of the uncompressed coordinates)", num_frames, (int)desc->path.len, desc->path.ptr,
+        raw_size ? 100.0 * (double)(hdr.index_offset + index_size(num_frames)) / (double)raw_size : 0.0);
+    return true;
+}
+
+bool chunked_trajectory_write_subset_structure(str_t path, const md_molecule_t* mol, const int32_t* atom_indices, size_t num_atoms, const float* x, const float* y, const float* z) {
+    ASSERT(mol);
+    ASSERT(x && y && z);
+
+    char buf[1024];
+    str_copy_to_char_buf(buf, sizeof(buf), path);
+    FILE* file = fopen(buf, "wb");
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write data.", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { fclose(file); };
+
+    // GRO is in nm, fixed columns and wraps the numbers of the residues and atoms at 100000
+    fprintf(file, "Subset written by VIAMD\n%5zu\n", num_atoms);
+    for (size_t i = 0; i < num_atoms; ++i) {
+        const int32_t a = atom_indices ? atom_indices[i] : (int32_t)i;
+        const int32_t res_idx = mol->atom.res_idx ? mol->atom.res_idx[a] : -1;
+        const str_t res_name = res_idx >= 0 ? LBL_TO_STR(mol->residue.name[res_idx]) : STR("UNK");
+        const int res_id = res_idx >= 0 ? (int)mol->residue.id[res_idx] : 1;
+        const str_t atom_name = mol->atom.type ? LBL_TO_STR(mol->atom.type[a]) : STR("X");
+        fprintf(file, "%5d%-5.*s%5.*s%5d%8.3f%8.3f%8.3f\n", res_id % 100000, (int)MIN(res_name.len, 5), res_name.ptr, (int)MIN(atom_name.len, 5), atom_name.ptr,
+            (int)((i + 1) % 100000), x[a] * 0.1f, y[a] * 0.1f, z[a] * 0.1f);
+    }
+
+    // v1(x) v2(y) v3(z) v1(y) v1(z) v2(x) v2(z) v3(x) v3(y)
+    const mat3_t& M = mol->unit_cell.basis;
+    fprintf(file, "%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f\n",
+        M.elem[0][0] * 0.1f, M.elem[1][1] * 0.1f, M.elem[2][2] * 0.1f,
+        M.elem[0][1] * 0.1f, M.elem[0][2] * 0.1f, M.elem[1][0] * 0.1f,
+        M.elem[1][2] * 0.1f, M.elem[2][0] * 0.1f, M.elem[2][1] * 0.1f);
+
+    if (ferror(file)) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)path.len, path.ptr);
+        return false;
+    }
+    return true;
+}
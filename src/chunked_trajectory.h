@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include <core/md_str.h>
+
+struct md_trajectory_i;
+struct md_trajectory_loader_i;
+struct md_molecule_t;
+
+// Chunked trajectory (.vct), a repacked copy of a trajectory which can be read frame by frame in any order
+// The frames are grouped into fixed size blocks, where the first frame of each block is the key frame. Coordinates are quantized to a fixed
+// precision and every axis of a frame is stored planar, as offsets to the minimum of the axis in the smallest of 8, 16 or 32 bits which holds
+// them. The key frame stores the quantized coordinates, the other frames of the block their difference to the key frame, so any frame is
+// decoded from at most two records by widening loops which vectorize. The index at the end of the file holds the location, time and unit
+// cell of every frame, which makes opening the file a single read.
+// A subset of the atoms can be written, e.g. to drop the solvent, which is then paired with a structure of the same atoms (written as GRO).
+
+#define CHUNKED_TRAJECTORY_EXT "vct"
+#define CHUNKED_TRAJECTORY_DEFAULT_BLOCK_FRAMES 16
+#define CHUNKED_TRAJECTORY_DEFAULT_PRECISION 0.01f   // Ångström, which is the default precision of XTC
+
+struct ChunkedTrajectoryWriteDesc {
+    str_t path;
+    md_trajectory_i* src;
+    const int32_t* atom_indices;    // Atoms of src to write, all atoms if NULL
+    size_t num_atoms;               // Atoms of src if atom_indices is NULL
+    uint32_t block_frames;
+    float precision;                // Ångström
+    std::atomic_uint32_t* frames_written;
+};
+
+md_trajectory_loader_i* chunked_trajectory_loader();
+
+// Encodes the blocks on the pool and waits for them, stops early if the task which calls it is interrupted
+bool chunked_trajectory_write(const ChunkedTrajectoryWriteDesc* desc);
+
+// Writes the atoms of a subset as a GRO structure, x, y and z are the coordinates of all atoms of the molecule
+bool chunked_trajectory_write_subset_structure(str_t path, const md_molecule_t* mol, const int32_t* atom_indices, size_t num_atoms, const float* x, const float* y, const float* z);
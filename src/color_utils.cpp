@@ -88,106 +88,139 @@ void color_atoms_uniform(uint32_t* colors, size_t count, vec4_t color, const md_
 const float chroma = 0.9f;
 const float luminance = 1.0f;
 
-void color_atoms_cpk(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    for (size_t i = 0; i < count; i++) {
+static inline md_range_t full_range(size_t count) {
+    return {0, (int)count};
+}
+
+// Sets the colors of the atoms of a residue or chain which are within the range
+static inline void set_colors_clipped(uint32_t* colors, md_range_t atoms, md_range_t range, uint32_t color) {
+    const int beg = MAX(atoms.beg, range.beg);
+    const int end = MIN(atoms.end, range.end);
+    if (beg < end) set_colors(colors + beg, (size_t)(end - beg), color);
+}
+
+void color_atoms_uniform(uint32_t* colors, md_range_t range, vec4_t color) {
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), convert_color(color));
+}
+
+void color_atoms_cpk(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_cpk(colors, full_range(count), mol); }
+void color_atoms_cpk(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    for (int i = range.beg; i < range.end; i++) {
         colors[i] = mol.atom.element ? md_util_element_cpk_color(mol.atom.element[i]) : 0xFFFFFFFFU;
     }
 }
 
-void color_atoms_type(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    for (size_t i = 0; i < count; ++i) {
+void color_atoms_type(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_type(colors, full_range(count), mol); }
+void color_atoms_type(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    for (int i = range.beg; i < range.end; ++i) {
         const uint32_t u32 = crc32(mol.atom.type[i].buf, mol.atom.type[i].len);
         colors[i] = u32_to_color(u32);
     }
 }
 
-void color_atoms_idx(uint32_t* colors, size_t count, const md_molecule_t&) {
-    for (size_t i = 0; i < count; ++i) {
+void color_atoms_idx(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_idx(colors, full_range(count), mol); }
+void color_atoms_idx(uint32_t* colors, md_range_t range, const md_molecule_t&) {
+    for (int i = range.beg; i < range.end; ++i) {
         colors[i] = u32_to_color((uint32_t)i);
     }
 }
 
-void color_atoms_res_name(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    set_colors(colors, count, 0xFFFFFFFFU);
+// The residues and chains are ordered by their atoms, so the ones before the range are skipped and the iteration stops after it
+void color_atoms_res_name(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_res_name(colors, full_range(count), mol); }
+void color_atoms_res_name(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), 0xFFFFFFFFU);
     for (size_t i = 0; i < mol.residue.count; i++) {
+        md_range_t atoms = md_residue_atom_range(mol.residue, i);
+        if (atoms.end <= range.beg) continue;
+        if (atoms.beg >= range.end) break;
         str_t str = mol.residue.name[i];
         const uint32_t u32 = crc32(str.ptr, str.len);
-        const uint32_t color = u32_to_color(u32);
-        md_range_t range = md_residue_atom_range(mol.residue, i);
-        set_colors(colors + range.beg, range.end - range.beg, color);
+        set_colors_clipped(colors, atoms, range, u32_to_color(u32));
     }
 }
 
-void color_atoms_res_id(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    set_colors(colors, count, 0xFFFFFFFFU);
+void color_atoms_res_id(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_res_id(colors, full_range(count), mol); }
+void color_atoms_res_id(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), 0xFFFFFFFFU);
     for (size_t i = 0; i < mol.residue.count; i++) {
-        const uint32_t color = u32_to_color(mol.residue.id[i]);
-        md_range_t range = md_residue_atom_range(mol.residue, i);
-        set_colors(colors + range.beg, range.end - range.beg, color);
+        md_range_t atoms = md_residue_atom_range(mol.residue, i);
+        if (atoms.end <= range.beg) continue;
+        if (atoms.beg >= range.end) break;
+        set_colors_clipped(colors, atoms, range, u32_to_color(mol.residue.id[i]));
     }
 }
-void color_atoms_res_idx(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    set_colors(colors, count, 0xFFFFFFFFU);
+
+void color_atoms_res_idx(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_res_idx(colors, full_range(count), mol); }
+void color_atoms_res_idx(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), 0xFFFFFFFFU);
     for (size_t i = 0; i < mol.residue.count; i++) {
-        const uint32_t color = u32_to_color((uint32_t)i);
-        md_range_t range = md_residue_atom_range(mol.residue, i);
-        set_colors(colors + range.beg, range.end - range.beg, color);
+        md_range_t atoms = md_residue_atom_range(mol.residue, i);
+        if (atoms.end <= range.beg) continue;
+        if (atoms.beg >= range.end) break;
+        set_colors_clipped(colors, atoms, range, u32_to_color((uint32_t)i));
     }
 }
 
-void color_atoms_chain_id(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    set_colors(colors, count, 0xFFFFFFFFU);
+void color_atoms_chain_id(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_chain_id(colors, full_range(count), mol); }
+void color_atoms_chain_id(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), 0xFFFFFFFFU);
     for (size_t i = 0; i < mol.chain.count; i++) {
+        md_range_t atoms = md_chain_atom_range(mol.chain, i);
+        if (atoms.end <= range.beg) continue;
+        if (atoms.beg >= range.end) break;
         str_t str = mol.chain.id[i];
         uint32_t u32 = 0;
         for (size_t j = 0; j < str.len; ++j) {
             u32 += str.ptr[j];
         }
-        const uint32_t color = u32_to_color(u32);
-        md_range_t range = md_chain_atom_range(mol.chain, i);
-        set_colors(colors + range.beg, range.end - range.beg, color);
+        set_colors_clipped(colors, atoms, range, u32_to_color(u32));
     }
 }
-void color_atoms_chain_idx(uint32_t* colors, size_t count, const md_molecule_t& mol) {
-    set_colors(colors, count, 0xFFFFFFFFU);
+
+void color_atoms_chain_idx(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_chain_idx(colors, full_range(count), mol); }
+void color_atoms_chain_idx(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), 0xFFFFFFFFU);
     for (size_t i = 0; i < mol.chain.count; i++) {
-        const uint32_t color = u32_to_color((uint32_t)i);
-        md_range_t range = md_chain_atom_range(mol.chain, i);
-        set_colors(colors + range.beg, range.end - range.beg, color);
+        md_range_t atoms = md_chain_atom_range(mol.chain, i);
+        if (atoms.end <= range.beg) continue;
+        if (atoms.beg >= range.end) break;
+        set_colors_clipped(colors, atoms, range, u32_to_color((uint32_t)i));
     }
 }
 
-void color_atoms_sec_str(uint32_t* colors, size_t count, const md_molecule_t& mol) {
+void color_atoms_sec_str(uint32_t* colors, size_t count, const md_molecule_t& mol) { color_atoms_sec_str(colors, full_range(count), mol); }
+void color_atoms_sec_str(uint32_t* colors, md_range_t range, const md_molecule_t& mol) {
     const uint32_t color_unknown = 0x22222222;
     const uint32_t color_coil    = 0xDDDDDDDD;
     const uint32_t color_helix   = 0xFF22DD22;
     const uint32_t color_sheet   = 0xFFDD2222;
 
-    set_colors(colors, count, color_unknown);
+    set_colors(colors + range.beg, (size_t)(range.end - range.beg), color_unknown);
     if (mol.backbone.secondary_structure) {
         for (size_t i = 0; i < mol.backbone.count; i++) {
+            md_residue_idx_t res_idx = mol.backbone.residue_idx[i];
+            md_range_t atoms = md_residue_atom_range(mol.residue, res_idx);
+            if (atoms.end <= range.beg || atoms.beg >= range.end) continue;
             const vec4_t w = convert_color((uint32_t)mol.backbone.secondary_structure[i]);
             const vec4_t rgba = w.x * convert_color(color_coil) + w.y * convert_color(color_helix) + w.z * convert_color(color_sheet);
-            const uint32_t color = convert_color(rgba);
-            md_residue_idx_t res_idx = mol.backbone.residue_idx[i];
-            md_range_t range = md_residue_atom_range(mol.residue, res_idx);
-            set_colors(colors + range.beg, range.end - range.beg, color);
+            set_colors_clipped(colors, atoms, range, convert_color(rgba));
         }
     }
 }
 
-void filter_colors(uint32_t* colors, size_t num_colors, const md_bitfield_t* mask) {
-    size_t beg_bit = mask->beg_bit;
-    size_t end_bit = mask->end_bit;
+void filter_colors(uint32_t* colors, size_t num_colors, const md_bitfield_t* mask) { filter_colors(colors, full_range(num_colors), mask); }
+void filter_colors(uint32_t* colors, md_range_t range, const md_bitfield_t* mask) {
+    const int beg_bit = CLAMP((int)mask->beg_bit, range.beg, range.end);
+    const int end_bit = CLAMP((int)mask->end_bit, beg_bit, range.end);
 
-    for (size_t i = 0; i < beg_bit; ++i) {
+    for (int i = range.beg; i < beg_bit; ++i) {
         colors[i] &= 0x00FFFFFFU;
     }
-    for (size_t i = beg_bit; i < end_bit; ++i) {
+    for (int i = beg_bit; i < end_bit; ++i) {
         const uint32_t m = md_bitfield_test_bit(mask, i) ? 0xFF000000U : 0x00000000U;
         colors[i] = m | (colors[i] & 0x00FFFFFFU);
     }
-    for (size_t i = end_bit; i < num_colors; ++i) {
+    for (int i = end_bit; i < range.end; ++i) {
         colors[i] &= 0x00FFFFFFU;
     }
 }
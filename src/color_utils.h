@@ -180,4 +180,19 @@ void color_atoms_chain_idx  (uint32_t* colors, size_t count, const md_molecule_t
 void color_atoms_sec_str    (uint32_t* colors, size_t count, const md_molecule_t& mol);
 
 void filter_colors(uint32_t* colors, size_t num_colors, const md_bitfield_t* mask);
+
+// Variants which only write the colors of the atoms within range, where colors holds the colors of all atoms
+// The molecule is only read, so disjoint ranges can be colored in parallel
+void color_atoms_uniform    (uint32_t* colors, md_range_t range, vec4_t uniform_color);
+void color_atoms_cpk        (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_type       (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_idx        (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_res_name   (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_res_id     (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_res_idx    (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_chain_id   (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_chain_idx  (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+void color_atoms_sec_str    (uint32_t* colors, md_range_t range, const md_molecule_t& mol);
+
+void filter_colors(uint32_t* colors, md_range_t range, const md_bitfield_t* mask);
 void desaturate_colors(uint32_t* colors, const md_bitfield_t* mask, float scale);
@@ -0,0 +1,498 @@
+#include "contacts.h"
+
+#include <task_system.h>
+
+#include <md_molecule.h>
+#include <md_trajectory.h>
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+
+#include <math.h>
+#include <string.h>
+
+#define CONTACTS_RADIX_BITS 11
+
+static inline bool is_periodic(vec3_t ext) {
+    return ext.x > 0 && ext.y > 0 && ext.z > 0;
+}
+
+static inline float min_image(float d, float ext) {
+    return ext > 0 ? d - ext * roundf(d / ext) : d;
+}
+
+// LSD radix sort of keys, only over the digits which are below max_key
+static void sort_keys(uint64_t* keys, uint64_t* tmp, size_t count, uint64_t max_key) {
+    uint32_t hist[1 << CONTACTS_RADIX_BITS];
+    const uint64_t mask = (1ULL << CONTACTS_RADIX_BITS) - 1;
+    uint64_t* src = keys;
+    uint64_t* dst = tmp;
+    for (uint32_t shift = 0; shift < 64 && (max_key >> shift) != 0; shift += CONTACTS_RADIX_BITS) {
+        MEMSET(hist, 0, sizeof(hist));
+        for (size_t i = 0; i < count; ++i) {
+            hist[(src[i] >> shift) & mask] += 1;
+        }
+        uint32_t sum = 0;
+        for (size_t d = 0; d <= mask; ++d) {
+            const uint32_t n = hist[d];
+            hist[d] = sum;
+            sum += n;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            dst[hist[(src[i] >> shift) & mask]++] = src[i];
+        }
+        uint64_t* t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != keys) {
+        MEMCPY(keys, src, sizeof(uint64_t) * count);
+    }
+}
+
+static inline void write_varint(uint8_t** data, uint64_t v, md_allocator_i* alloc) {
+    while (v >= 0x80) {
+        md_array_push(*data, (uint8_t)(v | 0x80), alloc);
+        v >>= 7;
+    }
+    md_array_push(*data, (uint8_t)v, alloc);
+}
+
+static inline const uint8_t* read_varint(const uint8_t* ptr, const uint8_t* end, uint64_t* v) {
+    uint64_t r = 0;
+    for (uint32_t shift = 0; ptr < end && shift < 64; shift += 7) {
+        const uint8_t b = *ptr++;
+        r |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+    }
+    *v = r;
+    return ptr;
+}
+
+static inline bool frame_bytes(const ContactsEngine* engine, uint32_t frame_idx, const uint8_t** beg, const uint8_t** end) {
+    const ContactsFrame& f = engine->frames[frame_idx];
+    if (f.thread >= engine->num_threads) return false;
+    *beg = engine->threads[f.thread].data + f.offset;
+    *end = *beg + f.size;
+    return true;
+}
+
+bool contacts_init(ContactsEngine* engine, const md_molecule_t* mol, const int32_t* atoms, size_t count, const ContactParams& params, uint32_t num_frames, md_allocator_i* alloc) {
+    ASSERT(engine);
+    ASSERT(mol);
+    ASSERT(alloc);
+    contacts_free(engine);
+    if (!atoms || count == 0 || num_frames == 0) return false;
+
+    engine->alloc = alloc;
+    engine->params = params;
+    engine->num_atoms = mol->atom.count;
+
+    if (params.mode == ContactMode_Residue) {
+        if (!mol->atom.res_idx) return false;
+        engine->count = count;
+        engine->atoms = (int32_t*)md_alloc(alloc, sizeof(int32_t) * count);
+        engine->atom_group = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * count);
+        MEMCPY(engine->atoms, atoms, sizeof(int32_t) * count);
+        // The atoms are in ascending order and so are their residues
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t res = mol->atom.res_idx[atoms[i]];
+            if (engine->num_groups == 0 || engine->group_res[engine->num_groups - 1] != res) {
+                md_array_push(engine->group_res, res, alloc);
+                engine->num_groups = md_array_size(engine->group_res);
+            }
+            engine->atom_group[i] = (uint32_t)(engine->num_groups - 1);
+        }
+        if (engine->num_groups < 2) {
+            contacts_free(engine);
+            return false;
+        }
+    } else {
+        if (!mol->atom.element) return false;
+        uint8_t* in_set = (uint8_t*)md_alloc(alloc, mol->atom.count);
+        MEMSET(in_set, 0, mol->atom.count);
+        for (size_t i = 0; i < count; ++i) {
+            in_set[atoms[i]] = 1;
+            const md_element_t e = mol->atom.element[atoms[i]];
+            if (e == 7 || e == 8) md_array_push(engine->acceptors, atoms[i], alloc);
+        }
+        // The heavy atom of a donor hydrogen may be outside of the set
+        for (size_t i = 0; i < mol->bond.count; ++i) {
+            const int32_t a = mol->bond.pairs[i].idx[0];
+            const int32_t b = mol->bond.pairs[i].idx[1];
+            const md_element_t ea = mol->atom.element[a];
+            const md_element_t eb = mol->atom.element[b];
+            if (ea == 1 && in_set[a] && (eb == 7 || eb == 8)) {
+                md_array_push(engine->donor_h, a, alloc);
+                md_array_push(engine->donor_d, b, alloc);
+            } else if (eb == 1 && in_set[b] && (ea == 7 || ea == 8)) {
+                md_array_push(engine->donor_h, b, alloc);
+                md_array_push(engine->donor_d, a, alloc);
+            }
+        }
+        md_free(alloc, in_set, mol->atom.count);
+        engine->num_donors = md_array_size(engine->donor_h);
+        engine->num_acceptors = md_array_size(engine->acceptors);
+        if (engine->num_donors == 0 || engine->num_acceptors == 0) {
+            contacts_free(engine);
+            return false;
+        }
+    }
+
+    engine->num_frames = num_frames;
+    engine->frames = (ContactsFrame*)md_alloc(alloc, sizeof(ContactsFrame) * num_frames);
+    engine->series = (float*)md_alloc(alloc, sizeof(float) * num_frames);
+    for (uint32_t i = 0; i < num_frames; ++i) {
+        engine->frames[i] = {0, 0, UINT32_MAX};
+    }
+    MEMSET(engine->series, 0, sizeof(float) * num_frames);
+
+    engine->num_threads = task_system::pool_num_threads();
+    engine->threads = (ContactsThread*)md_alloc(alloc, sizeof(ContactsThread) * engine->num_threads);
+    for (uint32_t t = 0; t < engine->num_threads; ++t) {
+        engine->threads[t] = {};
+    }
+    return true;
+}
+
+void contacts_free(ContactsEngine* engine) {
+    ASSERT(engine);
+    md_allocator_i* alloc = engine->alloc;
+    if (alloc) {
+        for (uint32_t t = 0; t < engine->num_threads; ++t) {
+            cell_list_free(&engine->threads[t].list);
+            md_array_free(engine->threads[t].ids, alloc);
+            md_array_free(engine->threads[t].data, alloc);
+        }
+        if (engine->threads) md_free(alloc, engine->threads, sizeof(ContactsThread) * engine->num_threads);
+        if (engine->atoms) md_free(alloc, engine->atoms, sizeof(int32_t) * engine->count);
+        if (engine->atom_group) md_free(alloc, engine->atom_group, sizeof(uint32_t) * engine->count);
+        md_array_free(engine->group_res, alloc);
+        md_array_free(engine->donor_h, alloc);
+        md_array_free(engine->donor_d, alloc);
+        md_array_free(engine->acceptors, alloc);
+        if (engine->frames) md_free(alloc, engine->frames, sizeof(ContactsFrame) * engine->num_frames);
+        if (engine->series) md_free(alloc, engine->series, sizeof(float) * engine->num_frames);
+        if (engine->pair_id) md_free(alloc, engine->pair_id, sizeof(uint64_t) * engine->num_pairs);
+        if (engine->pair_occupancy) md_free(alloc, engine->pair_occupancy, sizeof(float) * engine->num_pairs);
+        if (engine->matrix) md_free(alloc, engine->matrix, sizeof(float) * engine->num_groups * engine->num_groups);
+    }
+    *engine = {};
+}
+
+struct ResidueQuery {
+    const ContactsEngine* engine;
+    ContactsThread* thread;
+    uint32_t group;
+    int32_t res;
+    uint64_t last;
+};
+
+static bool residue_query_fn(uint32_t idx, float, void* user_data) {
+    ResidueQuery* q = (ResidueQuery*)user_data;
+    const ContactsEngine* e = q->engine;
+    const uint32_t group = e->atom_group[idx];
+    // Every pair is found from both ends, it is kept from the lower group
+    if (group <= q->group) return true;
+    const int32_t sep = e->group_res[group] - q->res;
+    if (sep < e->params.min_separation) return true;
+    const uint64_t id = (uint64_t)q->group * e->num_groups + group;
+    // The atoms of a residue are contiguous in the cells, which repeats ids back to back
+    if (id != q->last) {
+        md_array_push(q->thread->ids, id, e->alloc);
+        q->last = id;
+    }
+    return true;
+}
+
+struct HBondQuery {
+    const ContactsEngine* engine;
+    ContactsThread* thread;
+    const float* x;
+    const float* y;
+    const float* z;
+    vec3_t pbc_ext;
+    vec3_t h;
+    vec3_t hd;          // Hydrogen to donor, normalized
+    int32_t d;
+    uint32_t donor;
+    float max_cos;
+};
+
+static bool hbond_query_fn(uint32_t idx, float, void* user_data) {
+    HBondQuery* q = (HBondQuery*)user_data;
+    const ContactsEngine* e = q->engine;
+    const int32_t a = e->acceptors[idx];
+    if (a == q->d) return true;
+    vec3_t ha = {
+        min_image(q->x[a] - q->h.x, q->pbc_ext.x),
+        min_image(q->y[a] - q->h.y, q->pbc_ext.y),
+        min_image(q->z[a] - q->h.z, q->pbc_ext.z),
+    };
+    const float len2 = ha.x * ha.x + ha.y * ha.y + ha.z * ha.z;
+    if (len2 == 0) return true;
+    const float cos_angle = (ha.x * q->hd.x + ha.y * q->hd.y + ha.z * q->hd.z) / sqrtf(len2);
+    if (cos_angle <= q->max_cos) {
+        md_array_push(q->thread->ids, (uint64_t)q->donor * e->num_acceptors + idx, e->alloc);
+    }
+    return true;
+}
+
+void contacts_process_frame(ContactsEngine* engine, uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z) {
+    ASSERT(engine);
+    ASSERT(frame_idx < engine->num_frames);
+    const uint32_t thread_idx = task_system::thread_index();
+    ASSERT(thread_idx < engine->num_threads);
+    if (thread_idx >= engine->num_threads || frame_idx >= engine->num_frames) return;
+
+    ContactsThread& t = engine->threads[thread_idx];
+    md_allocator_i* alloc = engine->alloc;
+    const vec3_t pbc_ext = header ? header->unit_cell.basis * vec3_set1(1.0f) : vec3_t{0, 0, 0};
+    const vec3_t ext = is_periodic(pbc_ext) ? pbc_ext : vec3_t{0, 0, 0};
+    md_array_shrink(t.ids, 0);
+
+    // The cell list is built over the gathered atoms, so the query returns indices into the set
+    const ContactParams& p = engine->params;
+    const bool residue = p.mode == ContactMode_Residue;
+    const size_t count = residue ? engine->count : engine->num_acceptors;
+    const int32_t* indices = residue ? engine->atoms : engine->acceptors;
+    float* gx = (float*)task_system::scratch_alloc(sizeof(float) * count * 3);
+    float* gy = gx + count;
+    float* gz = gy + count;
+    for (size_t i = 0; i < count; ++i) {
+        gx[i] = x[indices[i]];
+        gy[i] = y[indices[i]];
+        gz[i] = z[indices[i]];
+    }
+    cell_list_build(&t.list, gx, gy, gz, count, ext, CELL_LIST_DEFAULT_CELL_SIZE, alloc);
+
+    uint64_t max_id = 0;
+    if (residue) {
+        ResidueQuery q = {engine, &t, 0, 0, UINT64_MAX};
+        for (size_t i = 0; i < count; ++i) {
+            q.group = engine->atom_group[i];
+            q.res = engine->group_res[q.group];
+            q.last = UINT64_MAX;
+            cell_list_query_radius(&t.list, {gx[i], gy[i], gz[i]}, p.cutoff, residue_query_fn, &q);
+        }
+        max_id = (uint64_t)engine->num_groups * engine->num_groups;
+    } else {
+        HBondQuery q = {engine, &t, x, y, z, ext, {0, 0, 0}, {0, 0, 0}, -1, 0, cosf(DEG_TO_RAD(p.hbond_angle))};
+        for (size_t i = 0; i < engine->num_donors; ++i) {
+            const int32_t h = engine->donor_h[i];
+            const int32_t d = engine->donor_d[i];
+            vec3_t hd = {
+                min_image(x[d] - x[h], ext.x),
+                min_image(y[d] - y[h], ext.y),
+                min_image(z[d] - z[h], ext.z),
+            };
+            const float len2 = hd.x * hd.x + hd.y * hd.y + hd.z * hd.z;
+            if (len2 == 0) continue;
+            const float inv_len = 1.0f / sqrtf(len2);
+            q.h  = {x[h], y[h], z[h]};
+            q.hd = {hd.x * inv_len, hd.y * inv_len, hd.z * inv_len};
+            q.d = d;
+            q.donor = (uint32_t)i;
+            cell_list_query_radius(&t.list, {x[d], y[d], z[d]}, p.hbond_cutoff, hbond_query_fn, &q);
+        }
+        max_id = (uint64_t)engine->num_donors * engine->num_acceptors;
+    }
+
+    // Sorted and unique, stored as the deltas between consecutive ids
+    size_t num_ids = md_array_size(t.ids);
+    if (num_ids > 1) {
+        uint64_t* tmp = (uint64_t*)task_system::scratch_alloc(sizeof(uint64_t) * num_ids);
+        sort_keys(t.ids, tmp, num_ids, max_id);
+        size_t n = 1;
+        for (size_t i = 1; i < num_ids; ++i) {
+            if (t.ids[i] != t.ids[n - 1]) t.ids[n++] = t.ids[i];
+        }
+        num_ids = n;
+    }
+
+    const size_t offset = md_array_size(t.data);
+    uint64_t prev = 0;
+    for (size_t i = 0; i < num_ids; ++i) {
+        write_varint(&t.data, t.ids[i] - prev, alloc);
+        prev = t.ids[i];
+    }
+    engine->frames[frame_idx] = {offset, (uint32_t)(md_array_size(t.data) - offset), thread_idx};
+    engine->series[frame_idx] = (float)num_ids;
+}
+
+bool contacts_frame_ids(const ContactsEngine* engine, uint32_t frame_idx, uint64_t** ids, md_allocator_i* alloc) {
+    ASSERT(engine);
+    ASSERT(ids);
+    if (frame_idx >= engine->num_frames) return false;
+    const uint8_t* ptr;
+    const uint8_t* end;
+    if (!frame_bytes(engine, frame_idx, &ptr, &end)) return false;
+    md_array_shrink(*ids, 0);
+    uint64_t id = 0;
+    while (ptr < end) {
+        uint64_t delta;
+        ptr = read_varint(ptr, end, &delta);
+        id += delta;
+        md_array_push(*ids, id, alloc);
+    }
+    return true;
+}
+
+void contacts_pair_series(const ContactsEngine* engine, uint64_t id, float* out) {
+    ASSERT(engine);
+    ASSERT(out);
+    for (uint32_t f = 0; f < engine->num_frames; ++f) {
+        out[f] = 0;
+        const uint8_t* ptr;
+        const uint8_t* end;
+        if (!frame_bytes(engine, f, &ptr, &end)) continue;
+        // The ids are ascending, so the search stops at the first id which is not below
+        uint64_t cur = 0;
+        while (ptr < end) {
+            uint64_t delta;
+            ptr = read_varint(ptr, end, &delta);
+            cur += delta;
+            if (cur >= id) {
+                out[f] = cur == id ? 1.0f : 0.0f;
+                break;
+            }
+        }
+    }
+}
+
+void contacts_pair_ends(const ContactsEngine* engine, uint64_t id, int32_t* a, int32_t* b) {
+    ASSERT(engine);
+    ASSERT(a);
+    ASSERT(b);
+    if (engine->params.mode == ContactMode_Residue) {
+        *a = engine->group_res[id / engine->num_groups];
+        *b = engine->group_res[id % engine->num_groups];
+    } else {
+        *a = engine->donor_h[id / engine->num_acceptors];
+        *b = engine->acceptors[id % engine->num_acceptors];
+    }
+}
+
+// Open addressing from pair id to the number of frames it is in contact
+struct PairCounts {
+    uint64_t* keys;     // UINT64_MAX marks an empty slot
+    uint32_t* counts;
+    size_t cap;
+    size_t size;
+};
+
+static inline size_t pair_hash(uint64_t id) {
+    return (size_t)((id * 0x9E3779B97F4A7C15ULL) >> 17);
+}
+
+static void pair_counts_init(PairCounts* pc, size_t cap, md_allocator_i* alloc) {
+    pc->cap = cap;
+    pc->size = 0;
+    pc->keys = (uint64_t*)md_alloc(alloc, sizeof(uint64_t) * cap);
+    pc->counts = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * cap);
+    MEMSET(pc->keys, 0xFF, sizeof(uint64_t) * cap);
+    MEMSET(pc->counts, 0, sizeof(uint32_t) * cap);
+}
+
+static void pair_counts_free(PairCounts* pc, md_allocator_i* alloc) {
+    md_free(alloc, pc->keys, sizeof(uint64_t) * pc->cap);
+    md_free(alloc, pc->counts, sizeof(uint32_t) * pc->cap);
+    *pc = {};
+}
+
+static void pair_counts_add(PairCounts* pc, uint64_t id, uint32_t n, md_allocator_i* alloc);
+
+static void pair_counts_grow(PairCounts* pc, md_allocator_i* alloc) {
+    PairCounts old = *pc;
+    pair_counts_init(pc, old.cap * 2, alloc);
+    for (size_t i = 0; i < old.cap; ++i) {
+        if (old.keys[i] != UINT64_MAX) pair_counts_add(pc, old.keys[i], old.counts[i], alloc);
+    }
+    pair_counts_free(&old, alloc);
+}
+
+static void pair_counts_add(PairCounts* pc, uint64_t id, uint32_t n, md_allocator_i* alloc) {
+    const size_t mask = pc->cap - 1;
+    size_t i = pair_hash(id) & mask;
+    while (pc->keys[i] != UINT64_MAX && pc->keys[i] != id) {
+        i = (i + 1) & mask;
+    }
+    if (pc->keys[i] == UINT64_MAX) {
+        pc->keys[i] = id;
+        pc->size += 1;
+    }
+    pc->counts[i] += n;
+    if (pc->size * 2 > pc->cap) {
+        pair_counts_grow(pc, alloc);
+    }
+}
+
+void contacts_finalize(ContactsEngine* engine) {
+    ASSERT(engine);
+    md_allocator_i* alloc = engine->alloc;
+    if (!alloc) return;
+    if (engine->pair_id) md_free(alloc, engine->pair_id, sizeof(uint64_t) * engine->num_pairs);
+    if (engine->pair_occupancy) md_free(alloc, engine->pair_occupancy, sizeof(float) * engine->num_pairs);
+    if (engine->matrix) md_free(alloc, engine->matrix, sizeof(float) * engine->num_groups * engine->num_groups);
+    engine->pair_id = nullptr;
+    engine->pair_occupancy = nullptr;
+    engine->matrix = nullptr;
+    engine->num_pairs = 0;
+
+    uint32_t num_processed = 0;
+    engine->data_size = 0;
+    PairCounts pc = {};
+    pair_counts_init(&pc, 1024, alloc);
+    for (uint32_t f = 0; f < engine->num_frames; ++f) {
+        const uint8_t* ptr;
+        const uint8_t* end;
+        if (!frame_bytes(engine, f, &ptr, &end)) continue;
+        num_processed += 1;
+        engine->data_size += end - ptr;
+        uint64_t id = 0;
+        while (ptr < end) {
+            uint64_t delta;
+            ptr = read_varint(ptr, end, &delta);
+            id += delta;
+            pair_counts_add(&pc, id, 1, alloc);
+        }
+    }
+
+    // Ordered by occupancy through keys of (frames not in contact, slot)
+    const size_t num_pairs = pc.size;
+    if (num_pairs > 0 && num_processed > 0) {
+        uint64_t* keys = (uint64_t*)md_alloc(alloc, sizeof(uint64_t) * num_pairs * 2);
+        size_t n = 0;
+        for (size_t i = 0; i < pc.cap; ++i) {
+            if (pc.keys[i] != UINT64_MAX) {
+                keys[n++] = ((uint64_t)(num_processed - pc.counts[i]) << 32) | (uint64_t)i;
+            }
+        }
+        ASSERT(n == num_pairs);
+        sort_keys(keys, keys + num_pairs, num_pairs, (uint64_t)num_processed << 32);
+
+        engine->num_pairs = num_pairs;
+        engine->pair_id = (uint64_t*)md_alloc(alloc, sizeof(uint64_t) * num_pairs);
+        engine->pair_occupancy = (float*)md_alloc(alloc, sizeof(float) * num_pairs);
+        const float inv_frames = 1.0f / (float)num_processed;
+        for (size_t i = 0; i < num_pairs; ++i) {
+            const size_t slot = (size_t)(keys[i] & 0xFFFFFFFFULL);
+            engine->pair_id[i] = pc.keys[slot];
+            engine->pair_occupancy[i] = (float)pc.counts[slot] * inv_frames;
+        }
+        md_free(alloc, keys, sizeof(uint64_t) * num_pairs * 2);
+    }
+    pair_counts_free(&pc, alloc);
+
+    const size_t ng = engine->num_groups;
+    if (engine->params.mode == ContactMode_Residue && ng <= CONTACTS_MAX_MATRIX_GROUPS) {
+        engine->matrix = (float*)md_alloc(alloc, sizeof(float) * ng * ng);
+        MEMSET(engine->matrix, 0, sizeof(float) * ng * ng);
+        for (size_t i = 0; i < engine->num_pairs; ++i) {
+            const size_t a = (size_t)(engine->pair_id[i] / ng);
+            const size_t b = (size_t)(engine->pair_id[i] % ng);
+            engine->matrix[a * ng + b] = engine->pair_occupancy[i];
+            engine->matrix[b * ng + a] = engine->pair_occupancy[i];
+        }
+    }
+}
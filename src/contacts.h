@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <cell_list.h>
+
+struct md_allocator_i;
+struct md_molecule_t;
+struct md_trajectory_frame_header_t;
+
+// Residue contacts and hydrogen bonds of a set of atoms over the frames of a trajectory
+// Every frame is searched with a cell list of the atoms of the set, built by the thread which processes the frame, and yields the sorted
+// ids of the pairs in contact. The ids are stored per frame as delta encoded varints, which typically takes one or two bytes per contact.
+// Finalizing counts the frames of every pair into the occupancy (fraction of frames in contact), the number of contacts per frame is the time series.
+
+#define CONTACTS_MAX_MATRIX_GROUPS 2048     // Above this the residue occupancy is only kept as a list of pairs
+
+enum ContactMode : uint32_t {
+    ContactMode_Residue = 0,    // Residues with any pair of atoms within cutoff, pair (a, b) of groups with a < b
+    ContactMode_HBond   = 1,    // Donor hydrogens and acceptors (N, O), pair (h, a) of donor and acceptor
+};
+
+struct ContactParams {
+    ContactMode mode = ContactMode_Residue;
+    float cutoff = 4.5f;            // Atom distance of residue contacts
+    int   min_separation = 3;       // Residue contacts of residues closer than this in sequence are skipped
+    float hbond_cutoff = 3.5f;      // Donor-acceptor distance
+    float hbond_angle = 150.0f;     // Minimum donor-hydrogen-acceptor angle in degrees
+};
+
+struct ContactsFrame {
+    uint64_t offset;    // In the data of the thread which processed the frame
+    uint32_t size;      // Bytes, 0 if the frame has no contacts
+    uint32_t thread;    // UINT32_MAX until the frame is processed
+};
+
+struct ContactsThread {
+    CellList list = {};
+    uint64_t* ids = nullptr;        // md_array
+    uint8_t*  data = nullptr;       // md_array, encoded frames
+};
+
+struct ContactsEngine {
+    ContactParams params = {};
+    size_t num_atoms = 0;           // Atoms of the molecule
+
+    // Residue mode
+    int32_t*  atoms = nullptr;      // [count] Atoms of the set
+    uint32_t* atom_group = nullptr; // [count] Group of every atom of the set
+    size_t count = 0;
+    int32_t*  group_res = nullptr;  // [num_groups] Residue of every group
+    size_t num_groups = 0;
+
+    // HBond mode
+    int32_t* donor_h = nullptr;     // [num_donors] Hydrogens bonded to N or O
+    int32_t* donor_d = nullptr;     // [num_donors] The heavy atom of each hydrogen
+    size_t num_donors = 0;
+    int32_t* acceptors = nullptr;   // [num_acceptors]
+    size_t num_acceptors = 0;
+
+    uint32_t num_frames = 0;
+    ContactsFrame* frames = nullptr;    // [num_frames]
+    float* series = nullptr;            // [num_frames] Number of contacts of every frame
+
+    ContactsThread* threads = nullptr;  // [num_threads]
+    uint32_t num_threads = 0;
+
+    // Results of contacts_finalize
+    uint64_t* pair_id = nullptr;        // [num_pairs] Sorted by occupancy, highest first
+    float* pair_occupancy = nullptr;    // [num_pairs]
+    size_t num_pairs = 0;
+    float* matrix = nullptr;            // [num_groups][num_groups] Symmetric residue occupancy, if num_groups <= CONTACTS_MAX_MATRIX_GROUPS
+    size_t data_size = 0;               // Bytes of the encoded frames
+
+    md_allocator_i* alloc = nullptr;
+};
+
+// atoms are the atoms of the set in ascending order, the bonds of mol identify the donors
+// The threads of the task system allocate from alloc while frames are processed, so it must be thread safe
+bool contacts_init(ContactsEngine* engine, const md_molecule_t* mol, const int32_t* atoms, size_t count, const ContactParams& params, uint32_t num_frames, md_allocator_i* alloc);
+void contacts_free(ContactsEngine* engine);
+
+// Must be called from a thread of the task system, concurrent calls for different frames are fine
+// x, y and z hold the coordinates of every atom of the molecule, header is used for the periodic box and may be NULL
+void contacts_process_frame(ContactsEngine* engine, uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z);
+
+// Counts the frames of every pair into the occupancy, must not be called while frames are processed
+void contacts_finalize(ContactsEngine* engine);
+
+// The two ends of a pair: residues of the molecule in residue mode, the hydrogen and acceptor atoms in hbond mode
+void contacts_pair_ends(const ContactsEngine* engine, uint64_t id, int32_t* a, int32_t* b);
+
+// Decodes the pair ids of a frame into ids (md_array), returns false if the frame has not been processed
+bool contacts_frame_ids(const ContactsEngine* engine, uint32_t frame_idx, uint64_t** ids, md_allocator_i* alloc);
+
+// 1 for the frames where the pair is in contact, 0 otherwise [num_frames]
+void contacts_pair_series(const ContactsEngine* engine, uint64_t id, float* out);
@@ -0,0 +1,264 @@
+#include "cpu_profiler.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <string.h>
+#include <atomic>
+
+STATIC_ASSERT((CPU_PROFILER_CAPACITY & (CPU_PROFILER_CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+namespace cpu_profiler {
+
+// The sequence is odd while a slot is being written, readers use it to discard torn copies
+struct ZoneSlot {
+    std::atomic_uint64_t seq;
+    Zone zone;
+};
+
+struct OpenZone {
+    char    label[CPU_PROFILER_LABEL_SIZE];
+    int64_t beg_time;       // 0 if the zone was opened while disabled
+};
+
+// Written by its thread only
+struct ThreadState {
+    ZoneSlot ring[CPU_PROFILER_CAPACITY];
+    std::atomic_uint64_t head;
+    OpenZone stack[CPU_PROFILER_MAX_DEPTH];
+    uint32_t depth;
+    uint32_t overflow;      // Levels opened beyond CPU_PROFILER_MAX_DEPTH
+    uint16_t thread_idx;
+};
+
+static std::atomic<ThreadState*> threads[CPU_PROFILER_MAX_THREADS] = {};
+static thread_local ThreadState* thread_state = nullptr;
+static std::atomic_bool initialized = false;
+static std::atomic_bool on = false;
+static std::atomic_int64_t clear_time = 0;     // Zones which began before are hidden
+
+// Main thread only
+static struct {
+    Frame ring[CPU_PROFILER_HISTORY] = {};
+    uint32_t head = 0;
+    uint32_t count = 0;
+    int64_t beg_time = 0;
+} frame_ctx;
+
+static ThreadState* create_thread_state(uint32_t thread_idx) {
+    ThreadState* s = (ThreadState*)md_alloc(md_heap_allocator, sizeof(ThreadState));
+    MEMSET((void*)s, 0, sizeof(ThreadState));
+    s->thread_idx = (uint16_t)thread_idx;
+    return s;
+}
+
+void initialize() {
+    initialized = true;
+    set_thread(0);
+}
+
+void shutdown() {
+    on = false;
+    initialized = false;
+    for (uint32_t i = 0; i < CPU_PROFILER_MAX_THREADS; ++i) {
+        ThreadState* s = threads[i].exchange(nullptr);
+        if (s) md_free(md_heap_allocator, s, sizeof(ThreadState));
+    }
+    thread_state = nullptr;
+    frame_ctx = {};
+}
+
+void set_enabled(bool enabled) {
+    on.store(enabled, std::memory_order_relaxed);
+}
+
+bool enabled() {
+    return on.load(std::memory_order_relaxed);
+}
+
+void clear() {
+    clear_time.store(md_time_current(), std::memory_order_relaxed);
+    frame_ctx.head = 0;
+    frame_ctx.count = 0;
+}
+
+void set_thread(uint32_t thread_idx) {
+    if (thread_state && thread_state->thread_idx == thread_idx) return;
+    if (thread_idx >= CPU_PROFILER_MAX_THREADS || !initialized.load(std::memory_order_relaxed)) {
+        thread_state = nullptr;
+        return;
+    }
+    ThreadState* s = threads[thread_idx].load(std::memory_order_acquire);
+    if (!s) {
+        ThreadState* created = create_thread_state(thread_idx);
+        if (threads[thread_idx].compare_exchange_strong(s, created, std::memory_order_acq_rel)) {
+            s = created;
+        } else {
+            md_free(md_heap_allocator, created, sizeof(ThreadState));
+        }
+    }
+    thread_state = s;
+}
+
+static OpenZone* push_zone(ThreadState* s) {
+    if (s->depth == CPU_PROFILER_MAX_DEPTH) {
+        s->overflow += 1;
+        return nullptr;
+    }
+    OpenZone* z = &s->stack[s->depth++];
+    z->beg_time = on.load(std::memory_order_relaxed) ? md_time_current() : 0;
+    return z->beg_time ? z : nullptr;
+}
+
+void begin_zone(const char* label) {
+    ThreadState* s = thread_state;
+    if (!s) return;
+    if (OpenZone* z = push_zone(s)) {
+        size_t len = 0;
+        while (len < CPU_PROFILER_LABEL_SIZE - 1 && label[len]) {
+            z->label[len] = label[len];
+            len += 1;
+        }
+        z->label[len] = '\0';
+    }
+}
+
+void begin_zone(str_t label) {
+    ThreadState* s = thread_state;
+    if (!s) return;
+    if (OpenZone* z = push_zone(s)) {
+        const size_t len = MIN(label.len, CPU_PROFILER_LABEL_SIZE - 1);
+        MEMCPY(z->label, label.ptr, len);
+        z->label[len] = '\0';
+    }
+}
+
+void end_zone() {
+    ThreadState* s = thread_state;
+    if (!s) return;
+    if (s->overflow) {
+        s->overflow -= 1;
+        return;
+    }
+    if (s->depth == 0) return;
+    const OpenZone& open = s->stack[--s->depth];
+    if (!open.beg_time) return;
+
+    const uint64_t idx = s->head.load(std::memory_order_relaxed);
+    ZoneSlot& slot = s->ring[idx & (CPU_PROFILER_CAPACITY - 1)];
+    slot.seq.store(2 * idx + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Zone& z = slot.zone;
+    MEMCPY(z.label, open.label, sizeof(z.label));
+    z.beg_time = open.beg_time;
+    z.end_time = md_time_current();
+    z.thread_idx = s->thread_idx;
+    z.depth = (uint16_t)s->depth;
+
+    slot.seq.store(2 * idx + 2, std::memory_order_release);
+    s->head.store(idx + 1, std::memory_order_release);
+}
+
+// The frame is the outermost zone of the main thread as well
+void begin_frame() {
+    frame_ctx.beg_time = on.load(std::memory_order_relaxed) ? md_time_current() : 0;
+    begin_zone("Frame");
+}
+
+void end_frame() {
+    end_zone();
+    if (!frame_ctx.beg_time) return;
+    frame_ctx.ring[frame_ctx.head] = {frame_ctx.beg_time, md_time_current()};
+    frame_ctx.head = (frame_ctx.head + 1) % CPU_PROFILER_HISTORY;
+    frame_ctx.count = MIN(frame_ctx.count + 1, CPU_PROFILER_HISTORY);
+    frame_ctx.beg_time = 0;
+}
+
+size_t frames(Frame* out_frames, size_t capacity) {
+    ASSERT(out_frames);
+    const uint32_t count = (uint32_t)MIN((size_t)frame_ctx.count, capacity);
+    const uint32_t beg = (frame_ctx.head + CPU_PROFILER_HISTORY - count) % CPU_PROFILER_HISTORY;
+    for (uint32_t i = 0; i < count; ++i) {
+        out_frames[i] = frame_ctx.ring[(beg + i) % CPU_PROFILER_HISTORY];
+    }
+    return count;
+}
+
+size_t zones(Zone* out_zones, size_t capacity, int64_t beg_time, int64_t end_time) {
+    ASSERT(out_zones);
+    const int64_t cleared = clear_time.load(std::memory_order_relaxed);
+    size_t num_zones = 0;
+    for (uint32_t t = 0; t < CPU_PROFILER_MAX_THREADS; ++t) {
+        const ThreadState* s = threads[t].load(std::memory_order_acquire);
+        if (!s) continue;
+        const uint64_t head  = s->head.load(std::memory_order_acquire);
+        const uint64_t count = MIN(head, (uint64_t)CPU_PROFILER_CAPACITY);
+        for (uint64_t idx = head - count; idx < head; ++idx) {
+            const ZoneSlot& slot = s->ring[idx & (CPU_PROFILER_CAPACITY - 1)];
+            const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq != 2 * idx + 2) continue;
+            Zone z = slot.zone;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+            if (z.beg_time < cleared || z.end_time < beg_time || z.beg_time > end_time) continue;
+            if (num_zones == capacity) return num_zones;
+            out_zones[num_zones++] = z;
+        }
+    }
+    return num_zones;
+}
+
+bool write_chrome_json(str_t filename) {
+    uint32_t num_threads = 0;
+    for (uint32_t t = 0; t < CPU_PROFILER_MAX_THREADS; ++t) {
+        if (threads[t].load(std::memory_order_acquire)) num_threads = t + 1;
+    }
+    const size_t capacity = (size_t)num_threads * CPU_PROFILER_CAPACITY;
+    Zone* zone_buf = (Zone*)md_alloc(md_heap_allocator, sizeof(Zone) * MAX(capacity, (size_t)1));
+    defer { md_free(md_heap_allocator, zone_buf, sizeof(Zone) * MAX(capacity, (size_t)1)); };
+    const size_t num_zones = zones(zone_buf, capacity, 0, INT64_MAX);
+    if (num_zones == 0) {
+        MD_LOG_ERROR("No CPU zones have been recorded");
+        return false;
+    }
+
+    md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write CPU zones", (int)filename.len, filename.ptr);
+        return false;
+    }
+
+    int64_t base = zone_buf[0].beg_time;
+    for (size_t i = 0; i < num_zones; ++i) {
+        base = MIN(base, zone_buf[i].beg_time);
+    }
+
+    md_file_printf(file, "{\"traceEvents\":[\n");
+    for (uint32_t t = 0; t < num_threads; ++t) {
+        if (!threads[t].load(std::memory_order_acquire)) continue;
+        md_file_printf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}},\n", t, t == 0 ? "Main" : "Worker", t);
+    }
+    for (size_t i = 0; i < num_zones; ++i) {
+        const Zone& z = zone_buf[i];
+        // Quotes and backslashes are the only characters of a label which can break the JSON
+        char label[CPU_PROFILER_LABEL_SIZE];
+        size_t len = 0;
+        for (const char* c = z.label; *c; ++c) {
+            label[len++] = (*c == '"' || *c == '\\') ? '_' : *c;
+        }
+        label[len] = '\0';
+
+        const double ts_us  = md_time_as_seconds(z.beg_time - base) * 1.0e6;
+        const double dur_us = md_time_as_seconds(z.end_time - z.beg_time) * 1.0e6;
+        md_file_printf(file, "{\"name\":\"%s\",\"cat\":\"zone\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%u}}%s\n",
+            label, z.thread_idx, ts_us, dur_us, z.depth, i + 1 < num_zones ? "," : "");
+    }
+    md_file_printf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    md_file_close(file);
+    return true;
+}
+
+}  // namespace cpu_profiler
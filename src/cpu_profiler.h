@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_str.h>
+
+#ifndef VIAMD_CPU_PROFILER
+#define VIAMD_CPU_PROFILER 1
+#endif
+
+namespace cpu_profiler {
+
+/*
+    Scoped CPU zones of the main loop and of the tasks, the CPU counterpart of gpu_timing.
+    Every thread which takes part records its completed zones into a ring buffer of its own, so a zone costs two timestamps and no locks.
+    The rings are read from the main thread while the zones are recorded, slots which are overwritten while being copied are skipped.
+    Only threads which have been assigned an index with set_thread record zones, the task system assigns them to its threads (0 is the main thread).
+
+    The zone macros are compiled out with VIAMD_CPU_PROFILER=0, while disabled at runtime a zone costs a check of a flag.
+    Timestamps are md_timestamp_t (see md_os.h).
+*/
+
+#define CPU_PROFILER_MAX_THREADS 64
+#define CPU_PROFILER_CAPACITY 16384     // Zones per thread, must be a power of two
+#define CPU_PROFILER_MAX_DEPTH 32
+#define CPU_PROFILER_LABEL_SIZE 32
+#define CPU_PROFILER_HISTORY 256        // Frames
+
+struct Zone {
+    char     label[CPU_PROFILER_LABEL_SIZE];
+    int64_t  beg_time;
+    int64_t  end_time;
+    uint16_t thread_idx;
+    uint16_t depth;          // Number of enclosing zones on the thread
+};
+
+struct Frame {
+    int64_t beg_time;
+    int64_t end_time;
+};
+
+// Assigns index 0 to the calling (main) thread
+void initialize();
+void shutdown();
+
+void set_enabled(bool enabled);
+bool enabled();
+void clear();
+
+// Assigns the ring of thread_idx to the calling thread, which must be the only running thread with that index
+void set_thread(uint32_t thread_idx);
+
+// Zones are closed in the reverse order they were opened on a thread, labels are copied (up to CPU_PROFILER_LABEL_SIZE - 1 characters)
+void begin_zone(const char* label);
+void begin_zone(str_t label);
+void end_zone();
+
+// Brackets the frames of the main loop, called from the main thread
+void begin_frame();
+void end_frame();
+
+// Copies the recorded frames into out_frames (oldest first) and returns the number of frames written
+size_t frames(Frame* out_frames, size_t capacity);
+
+// Copies the zones of all threads which overlap [beg_time, end_time] into out_zones and returns the number of zones written
+// The zones of each thread are ordered by their end time
+size_t zones(Zone* out_zones, size_t capacity, int64_t beg_time, int64_t end_time);
+
+// Writes all recorded zones as Chrome trace_event JSON (chrome://tracing, Perfetto)
+bool write_chrome_json(str_t filename);
+
+struct ScopedZone {
+    ScopedZone(const char* label) { begin_zone(label); }
+    ~ScopedZone() { end_zone(); }
+};
+
+}  // namespace cpu_profiler
+
+#define CPU_ZONE_CONCAT_(a, b) a##b
+#define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT_(a, b)
+
+#if VIAMD_CPU_PROFILER
+#define CPU_ZONE(lbl) cpu_profiler::ScopedZone CPU_ZONE_CONCAT(cpu_zone_, __LINE__)(lbl)
+#define CPU_ZONE_BEGIN(lbl) cpu_profiler::begin_zone(lbl)
+#define CPU_ZONE_END() cpu_profiler::end_zone()
+#else
+#define CPU_ZONE(lbl)
+#define CPU_ZONE_BEGIN(lbl)
+#define CPU_ZONE_END()
+#endif
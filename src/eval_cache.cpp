@@ -0,0 +1,601 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "eval_cache.h"
+#include "script_fingerprint.h"
+#include "property_store.h"
+
+#include <md_script.h>
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_bitfield.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <string.h>
+#include <sys/stat.h>
+
+#define EVAL_CACHE_MAGIC   0x43454D56   // 'VMEC'
+#define EVAL_CACHE_VERSION 2
+#define EVAL_CACHE_MAX_ENTRIES 256
+
+#define EVAL_SHARD_MAGIC   0x53454D56   // 'VMES'
+#define EVAL_SHARD_VERSION 1
+
+// The property fields are copied as raw bytes, so the layout follows the version of md_script we are built against
+#define PROP_FIELD_SIZE(field) sizeof(((md_script_property_t*)0)->data.field)
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t layout;    // Sizes of the property fields, entries are discarded if they do not match
+};
+
+struct EntryHeader {
+    uint64_t key;
+    uint64_t size;          // Bytes of the payload which follows
+    uint32_t num_values;
+    uint32_t num_frames;    // Length of the aggregate arrays, 0 if the property has no aggregate
+    uint32_t has_weights;
+    uint32_t compressed;    // The values (and weights) are stored as property stores, each preceded by its size
+};
+
+struct Entry {
+    const EntryHeader* hdr;
+    const char* payload;
+};
+
+struct ShardHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout;
+    uint32_t num_entries;
+    uint32_t num_frames;    // Frames of the whole trajectory
+    uint32_t frame_beg;
+    uint32_t frame_end;
+    uint32_t _pad;
+};
+
+struct ShardEntryHeader {
+    uint64_t key;
+    uint64_t size;
+    uint32_t num_values;    // Values of the whole property, the shard only contains the frames of its range for temporal properties
+    uint32_t has_weights;
+    uint32_t has_aggregate;
+    uint32_t temporal;
+};
+
+struct Shard {
+    char* buf;
+    size_t size;
+    const ShardHeader* hdr;
+};
+
+static inline uint32_t layout_hash() {
+    const uint64_t sizes[] = {PROP_FIELD_SIZE(dim), PROP_FIELD_SIZE(min_range), PROP_FIELD_SIZE(max_range), PROP_FIELD_SIZE(min_value), PROP_FIELD_SIZE(max_value)};
+    return (uint32_t)script_hash(sizes, sizeof(sizes));
+}
+
+// Size of the payload without the values and weights
+static size_t payload_base_size(const md_script_property_t* p, uint32_t num_frames) {
+    size_t size = PROP_FIELD_SIZE(dim) + PROP_FIELD_SIZE(min_range) + PROP_FIELD_SIZE(max_range) + PROP_FIELD_SIZE(min_value) + PROP_FIELD_SIZE(max_value);
+    if (p->data.aggregate) {
+        size += num_frames * (sizeof(p->data.aggregate->population_mean[0]) + sizeof(p->data.aggregate->population_var[0]) + sizeof(p->data.aggregate->population_ext[0]));
+    }
+    return size;
+}
+
+static size_t payload_size(const md_script_property_t* p, uint32_t num_frames) {
+    return payload_base_size(p, num_frames) + p->data.num_values * sizeof(float) * (p->data.weights ? 2 : 1);
+}
+
+// The per-frame values of temporal properties are compressed losslessly, which is most effective for properties of many values per frame
+static inline bool compress_values(const md_script_property_t* p, uint32_t num_frames) {
+    return (p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) && num_frames > 0 && p->data.num_values > 0 && p->data.num_values % num_frames == 0;
+}
+
+// Serializes the values as a property store into buf, returns the size
+static size_t compress_array(char** buf, const float* values, const md_script_property_t* p, uint32_t num_frames) {
+    PropertyStore store;
+    *buf = NULL;
+    if (!property_store_init(&store, (uint32_t)(p->data.num_values / num_frames), num_frames, 0, PropertyCodec_Xor, md_heap_allocator)) return 0;
+    defer { property_store_free(&store); };
+    if (!property_store_write(&store, values)) return 0;
+
+    const size_t size = property_store_serialized_size(&store);
+    *buf = (char*)md_alloc(md_heap_allocator, size);
+    if (!property_store_serialize(&store, *buf, size)) {
+        md_free(md_heap_allocator, *buf, size);
+        *buf = NULL;
+        return 0;
+    }
+    return size;
+}
+
+// Checks that src holds a property store of the shape of the values of p and decodes it into dst if it is not NULL, returns the end of it
+static const char* decompress_array(float* dst, const char* src, const char* end, const md_script_property_t* p, uint32_t num_frames) {
+    uint64_t size;
+    if (src + sizeof(size) > end) return NULL;
+    MEMCPY(&size, src, sizeof(size));
+    src += sizeof(size);
+    if (size > (uint64_t)(end - src)) return NULL;
+
+    PropertyStore store;
+    if (!property_store_deserialize(&store, src, size, md_heap_allocator)) return NULL;
+    defer { property_store_free(&store); };
+    if ((size_t)store.stride * store.num_frames != p->data.num_values || store.num_frames != num_frames) return NULL;
+    if (dst && !property_store_read(&store, 0, num_frames, dst)) return NULL;
+    return src + size;
+}
+
+static char* read_file(size_t* out_size, str_t path) {
+    md_file_o* file = md_file_open(path, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return NULL;
+    const size_t size = (size_t)md_file_size(file);
+    char* buf = size ? (char*)md_alloc(md_heap_allocator, size) : NULL;
+    if (buf && md_file_read(file, buf, size) != size) {
+        md_free(md_heap_allocator, buf, size);
+        buf = NULL;
+    }
+    md_file_close(file);
+    *out_size = buf ? size : 0;
+    return buf;
+}
+
+// Fills entries from buf and returns the number of entries, a file of another version or layout has none
+static size_t parse_entries(Entry* entries, size_t capacity, const char* buf, size_t size) {
+    if (size < sizeof(CacheHeader)) return 0;
+    const CacheHeader* hdr = (const CacheHeader*)buf;
+    if (hdr->magic != EVAL_CACHE_MAGIC || hdr->version != EVAL_CACHE_VERSION || hdr->layout != layout_hash()) return 0;
+
+    size_t count = 0;
+    size_t offset = sizeof(CacheHeader);
+    for (uint32_t i = 0; i < hdr->num_entries && count < capacity; ++i) {
+        if (offset + sizeof(EntryHeader) > size) break;
+        const EntryHeader* e = (const EntryHeader*)(buf + offset);
+        offset += sizeof(EntryHeader);
+        if (offset + e->size > size) break;
+        entries[count++] = {e, buf + offset};
+        offset += e->size;
+    }
+    return count;
+}
+
+static const Entry* find_entry(const Entry* entries, size_t count, uint64_t key) {
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].hdr->key == key) return &entries[i];
+    }
+    return NULL;
+}
+
+uint64_t eval_cache_file_identity(str_t path) {
+    char buf[4096];
+    const size_t len = MIN(path.len, sizeof(buf) - 1);
+    MEMCPY(buf, path.ptr, len);
+    buf[len] = '\0';
+
+    struct stat st;
+    if (stat(buf, &st) != 0) return 0;
+    const uint64_t attr[2] = {(uint64_t)st.st_size, (uint64_t)st.st_mtime};
+    return script_hash(attr, sizeof(attr), script_hash(buf, len));
+}
+
+bool eval_cache_write(str_t path, const md_script_eval_t* eval, const uint64_t* keys, size_t num_keys) {
+    ASSERT(eval);
+    const size_t num_props = md_script_eval_num_properties(eval);
+    const uint32_t num_frames = md_script_eval_num_frames_total(eval);
+    if (num_keys != num_props || md_script_eval_num_frames_completed(eval) != num_frames) return false;
+    const md_script_property_t* props = md_script_eval_properties(eval);
+
+    // Keep the entries of other evaluations, which have to be read before the file is truncated
+    size_t old_size = 0;
+    char* old_buf = read_file(&old_size, path);
+    defer { if (old_buf) md_free(md_heap_allocator, old_buf, old_size); };
+
+    Entry* old_entries = (Entry*)md_alloc(md_heap_allocator, sizeof(Entry) * EVAL_CACHE_MAX_ENTRIES);
+    defer { md_free(md_heap_allocator, old_entries, sizeof(Entry) * EVAL_CACHE_MAX_ENTRIES); };
+    const size_t num_old = parse_entries(old_entries, EVAL_CACHE_MAX_ENTRIES, old_buf, old_size);
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open evaluation cache '%.*s' for writing", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    uint32_t num_entries = (uint32_t)num_props;
+    for (size_t i = 0; i < num_old && num_entries < EVAL_CACHE_MAX_ENTRIES; ++i) {
+        bool superseded = false;
+        for (size_t j = 0; j < num_keys; ++j) {
+            superseded |= old_entries[i].hdr->key == keys[j];
+        }
+        if (!superseded) num_entries += 1;
+    }
+
+    const CacheHeader hdr = {EVAL_CACHE_MAGIC, EVAL_CACHE_VERSION, num_entries, layout_hash()};
+    bool ok = md_file_write(file, &hdr, sizeof(hdr)) == sizeof(hdr);
+
+    for (size_t i = 0; i < num_props && ok; ++i) {
+        const md_script_property_t* p = &props[i];
+        const uint32_t agg_frames = p->data.aggregate ? num_frames : 0;
+
+        // values and weights
+        char* packed[2] = {NULL, NULL};
+        uint64_t packed_size[2] = {0, 0};
+        defer {
+            for (int j = 0; j < 2; ++j) {
+                if (packed[j]) md_free(md_heap_allocator, packed[j], packed_size[j]);
+            }
+        };
+        bool compressed = compress_values(p, num_frames);
+        if (compressed) {
+            packed_size[0] = compress_array(&packed[0], p->data.values, p, num_frames);
+            compressed = packed[0] != NULL;
+            if (compressed && p->data.weights) {
+                packed_size[1] = compress_array(&packed[1], p->data.weights, p, num_frames);
+                compressed = packed[1] != NULL;
+            }
+        }
+        const size_t size = compressed ? payload_base_size(p, agg_frames) + sizeof(uint64_t) * (p->data.weights ? 2 : 1) + packed_size[0] + packed_size[1] : payload_size(p, agg_frames);
+
+        const EntryHeader e = {keys[i], size, (uint32_t)p->data.num_values, agg_frames, p->data.weights != NULL, compressed};
+        ok &= md_file_write(file, &e, sizeof(e)) == sizeof(e);
+        ok &= md_file_write(file, &p->data.dim,       PROP_FIELD_SIZE(dim))       == PROP_FIELD_SIZE(dim);
+        ok &= md_file_write(file, &p->data.min_range, PROP_FIELD_SIZE(min_range)) == PROP_FIELD_SIZE(min_range);
+        ok &= md_file_write(file, &p->data.max_range, PROP_FIELD_SIZE(max_range)) == PROP_FIELD_SIZE(max_range);
+        ok &= md_file_write(file, &p->data.min_value, PROP_FIELD_SIZE(min_value)) == PROP_FIELD_SIZE(min_value);
+        ok &= md_file_write(file, &p->data.max_value, PROP_FIELD_SIZE(max_value)) == PROP_FIELD_SIZE(max_value);
+        if (compressed) {
+            for (int j = 0; j < (p->data.weights ? 2 : 1); ++j) {
+                ok &= md_file_write(file, &packed_size[j], sizeof(packed_size[j])) == sizeof(packed_size[j]);
+                ok &= md_file_write(file, packed[j], packed_size[j]) == packed_size[j];
+            }
+        } else {
+            const size_t values_size = p->data.num_values * sizeof(float);
+            ok &= md_file_write(file, p->data.values, values_size) == values_size;
+            if (p->data.weights) {
+                ok &= md_file_write(file, p->data.weights, values_size) == values_size;
+            }
+        }
+        if (agg_frames) {
+            const size_t mean_size = agg_frames * sizeof(p->data.aggregate->population_mean[0]);
+            const size_t var_size  = agg_frames * sizeof(p->data.aggregate->population_var[0]);
+            const size_t ext_size  = agg_frames * sizeof(p->data.aggregate->population_ext[0]);
+            ok &= md_file_write(file, p->data.aggregate->population_mean, mean_size) == mean_size;
+            ok &= md_file_write(file, p->data.aggregate->population_var,  var_size)  == var_size;
+            ok &= md_file_write(file, p->data.aggregate->population_ext,  ext_size)  == ext_size;
+        }
+    }
+
+    uint32_t written = (uint32_t)num_props;
+    for (size_t i = 0; i < num_old && written < num_entries && ok; ++i) {
+        const Entry& e = old_entries[i];
+        bool superseded = false;
+        for (size_t j = 0; j < num_keys; ++j) {
+            superseded |= e.hdr->key == keys[j];
+        }
+        if (superseded) continue;
+        ok &= md_file_write(file, e.hdr, sizeof(EntryHeader)) == sizeof(EntryHeader);
+        ok &= md_file_write(file, e.payload, e.hdr->size) == e.hdr->size;
+        written += 1;
+    }
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write evaluation cache '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
+
+bool eval_cache_read(str_t path, md_script_eval_t* eval, const uint64_t* keys, size_t num_keys) {
+    ASSERT(eval);
+    const size_t num_props = md_script_eval_num_properties(eval);
+    const uint32_t num_frames = md_script_eval_num_frames_total(eval);
+    if (num_keys != num_props || num_props == 0) return false;
+
+    size_t size = 0;
+    char* buf = read_file(&size, path);
+    if (!buf) return false;
+    defer { md_free(md_heap_allocator, buf, size); };
+
+    Entry* entries = (Entry*)md_alloc(md_heap_allocator, sizeof(Entry) * EVAL_CACHE_MAX_ENTRIES);
+    defer { md_free(md_heap_allocator, entries, sizeof(Entry) * EVAL_CACHE_MAX_ENTRIES); };
+    const size_t num_entries = parse_entries(entries, EVAL_CACHE_MAX_ENTRIES, buf, size);
+
+    // The properties are owned by the evaluation, which is only written to once every property has a matching entry
+    md_script_property_t* props = (md_script_property_t*)md_script_eval_properties(eval);
+    const Entry** matches = (const Entry**)md_alloc(md_heap_allocator, sizeof(Entry*) * num_props);
+    defer { md_free(md_heap_allocator, matches, sizeof(Entry*) * num_props); };
+
+    for (size_t i = 0; i < num_props; ++i) {
+        const md_script_property_t* p = &props[i];
+        const Entry* e = keys[i] ? find_entry(entries, num_entries, keys[i]) : NULL;
+        if (!e) return false;
+        const uint32_t agg_frames = p->data.aggregate ? num_frames : 0;
+        if (e->hdr->num_values != p->data.num_values || e->hdr->num_frames != agg_frames || e->hdr->has_weights != (p->data.weights != NULL) ||
+            memcmp(e->payload, &p->data.dim, PROP_FIELD_SIZE(dim)) != 0) {
+            return false;
+        }
+        if (e->hdr->compressed) {
+            // The stores are decoded here without a destination to validate them
+            const char* end = e->payload + e->hdr->size;
+            const char* src = e->payload + payload_base_size(p, 0);
+            src = decompress_array(NULL, src, end, p, num_frames);
+            if (src && e->hdr->has_weights) src = decompress_array(NULL, src, end, p, num_frames);
+            if (!src || (size_t)(end - src) != payload_base_size(p, agg_frames) - payload_base_size(p, 0)) return false;
+        } else if (e->hdr->size != payload_size(p, agg_frames)) {
+            return false;
+        }
+        matches[i] = e;
+    }
+
+    for (size_t i = 0; i < num_props; ++i) {
+        md_script_property_t* p = &props[i];
+        const EntryHeader* hdr = matches[i]->hdr;
+        const char* src = matches[i]->payload + PROP_FIELD_SIZE(dim);
+        MEMCPY(&p->data.min_range, src, PROP_FIELD_SIZE(min_range)); src += PROP_FIELD_SIZE(min_range);
+        MEMCPY(&p->data.max_range, src, PROP_FIELD_SIZE(max_range)); src += PROP_FIELD_SIZE(max_range);
+        MEMCPY(&p->data.min_value, src, PROP_FIELD_SIZE(min_value)); src += PROP_FIELD_SIZE(min_value);
+        MEMCPY(&p->data.max_value, src, PROP_FIELD_SIZE(max_value)); src += PROP_FIELD_SIZE(max_value);
+        if (hdr->compressed) {
+            const char* end = matches[i]->payload + hdr->size;
+            src = decompress_array(p->data.values, src, end, p, num_frames);
+            if (src && hdr->has_weights) src = decompress_array(p->data.weights, src, end, p, num_frames);
+            if (!src) {
+                // Only corrupt blocks fail past the validation, the frames are not marked as completed so they are evaluated again
+                MD_LOG_ERROR("The evaluation cache '%.*s' is corrupt", (int)path.len, path.ptr);
+                return false;
+            }
+        } else {
+            const size_t values_size = hdr->num_values * sizeof(float);
+            MEMCPY(p->data.values, src, values_size); src += values_size;
+            if (hdr->has_weights) {
+                MEMCPY(p->data.weights, src, values_size); src += values_size;
+            }
+        }
+        if (hdr->num_frames) {
+            const size_t mean_size = hdr->num_frames * sizeof(p->data.aggregate->population_mean[0]);
+            const size_t var_size  = hdr->num_frames * sizeof(p->data.aggregate->population_var[0]);
+            const size_t ext_size  = hdr->num_frames * sizeof(p->data.aggregate->population_ext[0]);
+            MEMCPY(p->data.aggregate->population_mean, src, mean_size); src += mean_size;
+            MEMCPY(p->data.aggregate->population_var,  src, var_size);  src += var_size;
+            MEMCPY(p->data.aggregate->population_ext,  src, ext_size);  src += ext_size;
+        }
+        // Consumers (histograms, plots) refresh on a new fingerprint
+        p->data.fingerprint = (uint64_t)md_time_current();
+    }
+
+    md_bitfield_t* completed = (md_bitfield_t*)md_script_eval_completed_frames(eval);
+    md_bitfield_set_range(completed, 0, num_frames);
+    return true;
+}
+
+// Number of values per frame of a temporal property, the values of each dimension are stored consecutively over all frames
+static inline size_t temporal_stride(const md_script_property_t* p, uint32_t num_frames) {
+    return num_frames ? p->data.num_values / num_frames : 0;
+}
+
+static size_t shard_payload_size(const md_script_property_t* p, uint32_t num_frames, uint32_t shard_frames) {
+    const bool temporal = p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL;
+    const size_t num_values = temporal ? temporal_stride(p, num_frames) * shard_frames : p->data.num_values;
+    size_t size = PROP_FIELD_SIZE(dim) + PROP_FIELD_SIZE(min_range) + PROP_FIELD_SIZE(max_range);
+    size += num_values * sizeof(float) * (p->data.weights ? 2 : 1);
+    if (p->data.aggregate) {
+        size += shard_frames * (sizeof(p->data.aggregate->population_mean[0]) + sizeof(p->data.aggregate->population_var[0]) + sizeof(p->data.aggregate->population_ext[0]));
+    }
+    return size;
+}
+
+// Writes the values of frames [beg, end) of a temporal array or the whole array
+static bool write_values(md_file_o* file, const float* values, const md_script_property_t* p, uint32_t num_frames, uint32_t beg, uint32_t end) {
+    if (!(p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL)) {
+        const size_t size = p->data.num_values * sizeof(float);
+        return md_file_write(file, values, size) == size;
+    }
+    bool ok = true;
+    const size_t stride = temporal_stride(p, num_frames);
+    const size_t size = (end - beg) * sizeof(float);
+    for (size_t j = 0; j < stride && ok; ++j) {
+        ok &= md_file_write(file, values + j * num_frames + beg, size) == size;
+    }
+    return ok;
+}
+
+bool eval_cache_write_shard(str_t path, const md_script_eval_t* eval, const uint64_t* keys, size_t num_keys, uint32_t frame_beg, uint32_t frame_end) {
+    ASSERT(eval);
+    const size_t num_props = md_script_eval_num_properties(eval);
+    const uint32_t num_frames = md_script_eval_num_frames_total(eval);
+    if (num_keys != num_props || frame_beg >= frame_end || frame_end > num_frames) return false;
+
+    const md_bitfield_t* completed = md_script_eval_completed_frames(eval);
+    for (uint32_t i = frame_beg; i < frame_end; ++i) {
+        if (!md_bitfield_test_bit(completed, i)) {
+            MD_LOG_ERROR("Shard '%.*s' is incomplete, frame %u has not been evaluated", (int)path.len, path.ptr, i);
+            return false;
+        }
+    }
+    const md_script_property_t* props = md_script_eval_properties(eval);
+    const uint32_t shard_frames = frame_end - frame_beg;
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open shard '%.*s' for writing", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    const ShardHeader hdr = {EVAL_SHARD_MAGIC, EVAL_SHARD_VERSION, layout_hash(), (uint32_t)num_props, num_frames, frame_beg, frame_end, 0};
+    bool ok = md_file_write(file, &hdr, sizeof(hdr)) == sizeof(hdr);
+
+    for (size_t i = 0; i < num_props && ok; ++i) {
+        const md_script_property_t* p = &props[i];
+        const ShardEntryHeader e = {keys[i], shard_payload_size(p, num_frames, shard_frames), (uint32_t)p->data.num_values,
+            p->data.weights != NULL, p->data.aggregate != NULL, (p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) != 0};
+        ok &= md_file_write(file, &e, sizeof(e)) == sizeof(e);
+        ok &= md_file_write(file, &p->data.dim,       PROP_FIELD_SIZE(dim))       == PROP_FIELD_SIZE(dim);
+        ok &= md_file_write(file, &p->data.min_range, PROP_FIELD_SIZE(min_range)) == PROP_FIELD_SIZE(min_range);
+        ok &= md_file_write(file, &p->data.max_range, PROP_FIELD_SIZE(max_range)) == PROP_FIELD_SIZE(max_range);
+        ok &= write_values(file, p->data.values, p, num_frames, frame_beg, frame_end);
+        if (p->data.weights) {
+            ok &= write_values(file, p->data.weights, p, num_frames, frame_beg, frame_end);
+        }
+        if (p->data.aggregate) {
+            const size_t mean_size = shard_frames * sizeof(p->data.aggregate->population_mean[0]);
+            const size_t var_size  = shard_frames * sizeof(p->data.aggregate->population_var[0]);
+            const size_t ext_size  = shard_frames * sizeof(p->data.aggregate->population_ext[0]);
+            ok &= md_file_write(file, p->data.aggregate->population_mean + frame_beg, mean_size) == mean_size;
+            ok &= md_file_write(file, p->data.aggregate->population_var  + frame_beg, var_size)  == var_size;
+            ok &= md_file_write(file, p->data.aggregate->population_ext  + frame_beg, ext_size)  == ext_size;
+        }
+    }
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write shard '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
+
+// Finds the entry of key within a shard and checks that it matches the property, returns the payload
+static const char* find_shard_entry(const Shard& shard, uint64_t key, const md_script_property_t* p) {
+    const uint32_t shard_frames = shard.hdr->frame_end - shard.hdr->frame_beg;
+    size_t offset = sizeof(ShardHeader);
+    for (uint32_t i = 0; i < shard.hdr->num_entries; ++i) {
+        if (offset + sizeof(ShardEntryHeader) > shard.size) break;
+        const ShardEntryHeader* e = (const ShardEntryHeader*)(shard.buf + offset);
+        offset += sizeof(ShardEntryHeader);
+        if (offset + e->size > shard.size) break;
+        if (e->key == key) {
+            const bool match = e->num_values == p->data.num_values && e->has_weights == (p->data.weights != NULL) &&
+                e->has_aggregate == (p->data.aggregate != NULL) && e->temporal == ((p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) != 0) &&
+                e->size == shard_payload_size(p, shard.hdr->num_frames, shard_frames) && memcmp(shard.buf + offset, &p->data.dim, PROP_FIELD_SIZE(dim)) == 0;
+            return match ? shard.buf + offset : NULL;
+        }
+        offset += e->size;
+    }
+    return NULL;
+}
+
+// Copies the frames of a temporal array into their range or accumulates the weighted average of the whole array
+static const char* merge_values(float* dst, const char* src, const md_script_property_t* p, const ShardHeader* hdr) {
+    const uint32_t shard_frames = hdr->frame_end - hdr->frame_beg;
+    if (p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) {
+        const size_t stride = temporal_stride(p, hdr->num_frames);
+        for (size_t j = 0; j < stride; ++j) {
+            MEMCPY(dst + j * hdr->num_frames + hdr->frame_beg, src, shard_frames * sizeof(float));
+            src += shard_frames * sizeof(float);
+        }
+    } else {
+        const float w = (float)shard_frames / (float)hdr->num_frames;
+        const float* values = (const float*)src;
+        for (size_t j = 0; j < p->data.num_values; ++j) {
+            dst[j] += values[j] * w;
+        }
+        src += p->data.num_values * sizeof(float);
+    }
+    return src;
+}
+
+bool eval_cache_merge_shards(const str_t* paths, size_t num_paths, md_script_eval_t* eval, const uint64_t* keys, size_t num_keys) {
+    ASSERT(eval);
+    const size_t num_props = md_script_eval_num_properties(eval);
+    const uint32_t num_frames = md_script_eval_num_frames_total(eval);
+    if (num_keys != num_props || num_props == 0 || num_paths == 0) return false;
+
+    Shard* shards = (Shard*)md_alloc(md_heap_allocator, sizeof(Shard) * num_paths);
+    MEMSET(shards, 0, sizeof(Shard) * num_paths);
+    defer {
+        for (size_t i = 0; i < num_paths; ++i) {
+            if (shards[i].buf) md_free(md_heap_allocator, shards[i].buf, shards[i].size);
+        }
+        md_free(md_heap_allocator, shards, sizeof(Shard) * num_paths);
+    };
+
+    // Every frame has to be covered by exactly one shard
+    md_bitfield_t covered = md_bitfield_create(md_heap_allocator);
+    defer { md_bitfield_free(&covered); };
+
+    for (size_t i = 0; i < num_paths; ++i) {
+        const str_t path = paths[i];
+        shards[i].buf = read_file(&shards[i].size, path);
+        const ShardHeader* hdr = (const ShardHeader*)shards[i].buf;
+        if (shards[i].size < sizeof(ShardHeader) || hdr->magic != EVAL_SHARD_MAGIC || hdr->version != EVAL_SHARD_VERSION || hdr->layout != layout_hash()) {
+            MD_LOG_ERROR("'%.*s' is not a shard of this version of VIAMD", (int)path.len, path.ptr);
+            return false;
+        }
+        if (hdr->num_frames != num_frames || hdr->frame_beg >= hdr->frame_end || hdr->frame_end > num_frames) {
+            MD_LOG_ERROR("Shard '%.*s' was evaluated on a trajectory of %u frames, expected %u", (int)path.len, path.ptr, hdr->num_frames, num_frames);
+            return false;
+        }
+        for (uint32_t f = hdr->frame_beg; f < hdr->frame_end; ++f) {
+            if (md_bitfield_test_bit(&covered, f)) {
+                MD_LOG_ERROR("Shard '%.*s' overlaps another shard at frame %u", (int)path.len, path.ptr, f);
+                return false;
+            }
+        }
+        md_bitfield_set_range(&covered, hdr->frame_beg, hdr->frame_end);
+        shards[i].hdr = hdr;
+    }
+    if (md_bitfield_popcount(&covered) != num_frames) {
+        MD_LOG_ERROR("The shards cover %u of %u frames", (uint32_t)md_bitfield_popcount(&covered), num_frames);
+        return false;
+    }
+
+    // Validate every entry before the evaluation is written to
+    md_script_property_t* props = (md_script_property_t*)md_script_eval_properties(eval);
+    const char** payloads = (const char**)md_alloc(md_heap_allocator, sizeof(char*) * num_props * num_paths);
+    defer { md_free(md_heap_allocator, payloads, sizeof(char*) * num_props * num_paths); };
+    for (size_t i = 0; i < num_props; ++i) {
+        for (size_t j = 0; j < num_paths; ++j) {
+            const char* payload = keys[i] ? find_shard_entry(shards[j], keys[i], &props[i]) : NULL;
+            if (!payload) {
+                MD_LOG_ERROR("Shard '%.*s' has no matching result for property '%.*s', was it evaluated with the same script and dataset?",
+                    (int)paths[j].len, paths[j].ptr, (int)props[i].ident.len, props[i].ident.ptr);
+                return false;
+            }
+            payloads[i * num_paths + j] = payload;
+        }
+    }
+
+    for (size_t i = 0; i < num_props; ++i) {
+        md_script_property_t* p = &props[i];
+        if (!(p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL)) {
+            MEMSET(p->data.values, 0, p->data.num_values * sizeof(float));
+            if (p->data.weights) MEMSET(p->data.weights, 0, p->data.num_values * sizeof(float));
+        }
+        for (size_t j = 0; j < num_paths; ++j) {
+            const ShardHeader* hdr = shards[j].hdr;
+            const uint32_t shard_frames = hdr->frame_end - hdr->frame_beg;
+            const char* src = payloads[i * num_paths + j] + PROP_FIELD_SIZE(dim);
+            // The ranges are given by the script, not by the data, so they are the same in every shard
+            MEMCPY(&p->data.min_range, src, PROP_FIELD_SIZE(min_range)); src += PROP_FIELD_SIZE(min_range);
+            MEMCPY(&p->data.max_range, src, PROP_FIELD_SIZE(max_range)); src += PROP_FIELD_SIZE(max_range);
+            src = merge_values(p->data.values, src, p, hdr);
+            if (p->data.weights) {
+                src = merge_values(p->data.weights, src, p, hdr);
+            }
+            if (p->data.aggregate) {
+                const size_t mean_size = shard_frames * sizeof(p->data.aggregate->population_mean[0]);
+                const size_t var_size  = shard_frames * sizeof(p->data.aggregate->population_var[0]);
+                const size_t ext_size  = shard_frames * sizeof(p->data.aggregate->population_ext[0]);
+                MEMCPY(p->data.aggregate->population_mean + hdr->frame_beg, src, mean_size); src += mean_size;
+                MEMCPY(p->data.aggregate->population_var  + hdr->frame_beg, src, var_size);  src += var_size;
+                MEMCPY(p->data.aggregate->population_ext  + hdr->frame_beg, src, ext_size);  src += ext_size;
+            }
+        }
+
+        float min_value = p->data.num_values ? p->data.values[0] : 0.0f;
+        float max_value = min_value;
+        for (size_t j = 1; j < p->data.num_values; ++j) {
+            min_value = MIN(min_value, p->data.values[j]);
+            max_value = MAX(max_value, p->data.values[j]);
+        }
+        p->data.min_value = min_value;
+        p->data.max_value = max_value;
+        p->data.fingerprint = (uint64_t)md_time_current();
+    }
+
+    md_bitfield_t* completed = (md_bitfield_t*)md_script_eval_completed_frames(eval);
+    md_bitfield_set_range(completed, 0, num_frames);
+    return true;
+}
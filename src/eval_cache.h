@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_str.h>
+
+struct md_script_eval_t;
+
+// On-disk cache of evaluated script properties
+// Each property is stored under a key supplied by the caller, which should combine everything the result depends on
+// (the trajectory, the statement of the property and any external inputs). keys[i] corresponds to the i:th property of the evaluation.
+// Only complete evaluations are written and an evaluation is only restored if every one of its properties is found in the cache.
+
+// Identity of a file from its path, size and modification time, 0 if the file does not exist
+uint64_t eval_cache_file_identity(str_t path);
+
+// Writes the properties of eval, entries of other keys already present in the file are kept (up to a limit)
+bool eval_cache_write(str_t path, const md_script_eval_t* eval, const uint64_t* keys, size_t num_keys);
+
+// Restores the properties of eval and marks all frames as completed, returns false on a miss which leaves eval untouched
+bool eval_cache_read(str_t path, md_script_eval_t* eval, const uint64_t* keys, size_t num_keys);
+
+// Shards: partial results of an evaluation over a subrange of the frames, e.g. computed by separate processes
+// Temporal properties store the values of their frames, every other property (distributions, volumes) its average over the frames of the shard.
+// Merging shards which together cover every frame exactly once restores the evaluation as if it had been computed in one go,
+// the averages are weighted by the number of frames of each shard.
+
+// Writes the properties of eval for the frames [frame_beg, frame_end), which must all be completed
+bool eval_cache_write_shard(str_t path, const md_script_eval_t* eval, const uint64_t* keys, size_t num_keys, uint32_t frame_beg, uint32_t frame_end);
+
+// Merges the shards into the properties of eval and marks all frames as completed, returns false and leaves eval untouched if the shards do not fit
+bool eval_cache_merge_shards(const str_t* paths, size_t num_paths, md_script_eval_t* eval, const uint64_t* keys, size_t num_keys);
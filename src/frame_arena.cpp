@@ -0,0 +1,189 @@
+#include "frame_arena.h"
+#include "memory_tracker.h"
+
+#include <core/md_common.h>
+#include <core/md_log.h>
+
+#include <string.h>
+
+struct FrameArenaBlock {
+    FrameArenaBlock* next;      // Previous (older) block
+    size_t cap;                 // Bytes of data which follow the header
+    size_t used;
+};
+
+#define BLOCK_HEADER_SIZE ALIGN_TO(sizeof(FrameArenaBlock), FRAME_ARENA_ALIGNMENT)
+
+static inline char* block_data(FrameArenaBlock* block) {
+    return (char*)block + BLOCK_HEADER_SIZE;
+}
+
+static FrameArenaBlock* block_create(md_allocator_i* backing, size_t cap, FrameArenaBlock* next) {
+    FrameArenaBlock* block = (FrameArenaBlock*)md_alloc(backing, BLOCK_HEADER_SIZE + cap);
+    block->next = next;
+    block->cap  = cap;
+    block->used = 0;
+    return block;
+}
+
+static void block_free(md_allocator_i* backing, FrameArenaBlock* block) {
+    md_free(backing, block, BLOCK_HEADER_SIZE + block->cap);
+}
+
+static size_t arena_used(const FrameArena* arena) {
+    size_t used = 0;
+    for (const FrameArenaBlock* b = arena->head; b; b = b->next) {
+        used += b->used;
+    }
+    return used;
+}
+
+static void* arena_push(FrameArena* arena, size_t size) {
+    FrameArenaBlock* block = arena->head;
+    size_t offset = block ? ALIGN_TO(block->used, FRAME_ARENA_ALIGNMENT) : 0;
+    if (!block || offset + size > block->cap) {
+        // Chain a block which fits the allocation, the next reset merges the blocks
+        block = block_create(arena->backing, MAX(arena->block_size, ALIGN_TO(size, FRAME_ARENA_ALIGNMENT)), arena->head);
+        arena->head = block;
+        arena->num_grows += 1;
+        offset = 0;
+    }
+    block->used = offset + size;
+    return block_data(block) + offset;
+}
+
+// Returns true if ptr is the most recent allocation of the current block
+static inline bool arena_is_top(const FrameArena* arena, const void* ptr, size_t size) {
+    FrameArenaBlock* block = arena->head;
+    return block && (const char*)ptr + size == block_data(block) + block->used && (const char*)ptr >= block_data(block);
+}
+
+static void* arena_realloc(struct md_allocator_o* inst, void* ptr, size_t old_size, size_t new_size, const char* file, size_t line) {
+    (void)file;
+    (void)line;
+    FrameArena* arena = (FrameArena*)inst;
+
+    if (!ptr) {
+        return new_size ? arena_push(arena, new_size) : NULL;
+    }
+    if (arena_is_top(arena, ptr, old_size)) {
+        FrameArenaBlock* block = arena->head;
+        const size_t beg = (size_t)((char*)ptr - block_data(block));
+        if (beg + new_size <= block->cap) {
+            block->used = beg + new_size;
+            return new_size ? ptr : NULL;
+        }
+    } else if (new_size <= old_size) {
+        return new_size ? ptr : NULL;
+    }
+
+    void* new_ptr = arena_push(arena, new_size);
+    MEMCPY(new_ptr, ptr, MIN(old_size, new_size));
+    return new_ptr;
+}
+
+void frame_arena_init(FrameArena* arena, md_allocator_i* backing, size_t block_size) {
+    ASSERT(arena);
+    ASSERT(backing);
+    ASSERT(block_size > 0);
+    *arena = {};
+    arena->interface.inst = (struct md_allocator_o*)arena;
+    arena->interface.realloc = arena_realloc;
+    arena->backing = backing;
+    arena->block_size = ALIGN_TO(block_size, FRAME_ARENA_ALIGNMENT);
+    arena->head = block_create(backing, arena->block_size, NULL);
+}
+
+void frame_arena_free(FrameArena* arena) {
+    ASSERT(arena);
+    FrameArenaBlock* block = arena->head;
+    while (block) {
+        FrameArenaBlock* next = block->next;
+        block_free(arena->backing, block);
+        block = next;
+    }
+    *arena = {};
+}
+
+md_allocator_i* frame_arena_allocator(FrameArena* arena) {
+    ASSERT(arena);
+    return &arena->interface;
+}
+
+void frame_arena_reset(FrameArena* arena) {
+    ASSERT(arena);
+    const size_t used = arena_used(arena);
+    arena->frame_high_water = used;
+    arena->high_water = MAX(arena->high_water, used);
+
+    if (arena->head && arena->head->next) {
+        // The frame did not fit in one block, the blocks are replaced by one which fits the whole frame
+        FrameArenaBlock* block = arena->head;
+        while (block) {
+            FrameArenaBlock* next = block->next;
+            block_free(arena->backing, block);
+            block = next;
+        }
+        arena->block_size = ALIGN_TO(used + used / 4, MEGABYTES(1));
+        arena->head = block_create(arena->backing, arena->block_size, NULL);
+        MD_LOG_DEBUG("Frame arena: grew to %.1f MB", (double)arena->block_size / (1024.0 * 1024.0));
+    } else if (arena->head) {
+        arena->head->used = 0;
+    }
+}
+
+FrameArenaStats frame_arena_stats(const FrameArena* arena) {
+    ASSERT(arena);
+    FrameArenaStats stats = {};
+    for (const FrameArenaBlock* b = arena->head; b; b = b->next) {
+        stats.used += b->used;
+        stats.capacity += b->cap;
+        stats.num_blocks += 1;
+    }
+    stats.frame_high_water = arena->frame_high_water;
+    stats.high_water = arena->high_water;
+    stats.num_grows = arena->num_grows;
+    return stats;
+}
+
+static struct {
+    void*  ptr = NULL;
+    size_t cap = 0;
+} scratch_slots[FrameScratch_Count];
+
+void* frame_scratch(FrameScratchSlot slot, size_t bytes) {
+    ASSERT(0 <= slot && slot < FrameScratch_Count);
+    auto& s = scratch_slots[slot];
+    if (bytes > s.cap) {
+        md_allocator_i* alloc = memory_tracker_allocator(MemoryTracker_FrameScratch);
+        if (s.ptr) md_free(alloc, s.ptr, s.cap);
+        // Some headroom, so a molecule which grows by a few atoms does not re-allocate
+        const size_t cap = ALIGN_TO(bytes + bytes / 8, 4096);
+        s.ptr = md_alloc(alloc, cap);
+        s.cap = cap;
+    }
+    return s.ptr;
+}
+
+size_t frame_scratch_memory_usage() {
+    size_t bytes = 0;
+    for (int i = 0; i < FrameScratch_Count; ++i) {
+        bytes += scratch_slots[i].cap;
+    }
+    return bytes;
+}
+
+size_t frame_scratch_release() {
+    md_allocator_i* alloc = memory_tracker_allocator(MemoryTracker_FrameScratch);
+    size_t released = 0;
+    for (int i = 0; i < FrameScratch_Count; ++i) {
+        auto& s = scratch_slots[i];
+        if (s.ptr) {
+            md_free(alloc, s.ptr, s.cap);
+            released += s.cap;
+        }
+        s.ptr = NULL;
+        s.cap = 0;
+    }
+    return released;
+}
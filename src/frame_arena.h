@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_allocator.h>
+
+// Growable arena for the allocations which only live for a frame, and persistent scratch slots for large buffers which are needed every frame
+// An allocation which does not fit in the current block chains a new block, so the arena never runs out. On reset the blocks of the frame are
+// merged into a single block which holds the high water mark of the frame, so the following frames allocate from one block again.
+// Freeing (or growing) the most recent allocation pops (or extends) it in place, anything else is reclaimed by the reset.
+// The arena is not thread safe, it is used from the main thread.
+
+#define FRAME_ARENA_ALIGNMENT 16
+
+struct FrameArenaBlock;
+
+struct FrameArenaStats {
+    size_t used;                // Bytes allocated in the current frame
+    size_t capacity;            // Bytes of all blocks
+    size_t frame_high_water;    // Bytes used by the previous frame
+    size_t high_water;          // Maximum bytes used by any frame
+    uint32_t num_blocks;
+    uint64_t num_grows;         // Number of times a block was chained to fit an allocation
+};
+
+struct FrameArena {
+    md_allocator_i interface = {};
+    md_allocator_i* backing = nullptr;
+    FrameArenaBlock* head = nullptr;    // Most recent block, allocations are made from it
+    size_t block_size = 0;
+    size_t frame_high_water = 0;
+    size_t high_water = 0;
+    uint64_t num_grows = 0;
+};
+
+void frame_arena_init(FrameArena* arena, md_allocator_i* backing, size_t block_size);
+void frame_arena_free(FrameArena* arena);
+
+// The allocator interface of the arena, valid until the arena is freed
+md_allocator_i* frame_arena_allocator(FrameArena* arena);
+
+// Drops all allocations, called once the frame is done
+void frame_arena_reset(FrameArena* arena);
+
+FrameArenaStats frame_arena_stats(const FrameArena* arena);
+
+// Persistent, reusable buffers for large per-frame arrays whose size follows the molecule, which are too large to re-allocate every frame
+// The contents are undefined on return, the buffer is valid until the next call with the same slot. A slot must not be used by nested code.
+enum FrameScratchSlot {
+    FrameScratch_AtomFlags = 0,     // Flags uploaded to the GL molecule
+    FrameScratch_HighlightFlags,    // Flags uploaded to the selection/highlight outline
+    FrameScratch_RepColors,         // Colors of the representation being updated
+    FrameScratch_Subset,            // Attributes gathered for a subset representation
+    FrameScratch_Count
+};
+
+void* frame_scratch(FrameScratchSlot slot, size_t bytes);
+
+// Bytes held by the scratch slots
+size_t frame_scratch_memory_usage();
+
+// Frees the slots, they are allocated again on their next use. Returns the number of bytes which were released
+size_t frame_scratch_release();
@@ -0,0 +1,208 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "frame_block_cache.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#include <atomic>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#define file_seek(file, offset) _fseeki64(file, (__int64)(offset), SEEK_SET)
+#define file_size(file) (_fseeki64(file, 0, SEEK_END), (uint64_t)_ftelli64(file))
+#else
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#define file_seek(file, offset) fseeko(file, (off_t)(offset), SEEK_SET)
+#define file_size(file) (fseeko(file, 0, SEEK_END), (uint64_t)ftello(file))
+#endif
+
+#define FRAME_BLOCK_CACHE_MAGIC   0x42464D56   // 'VMFB'
+#define FRAME_BLOCK_CACHE_VERSION 1
+
+struct BlockCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t identity;
+    uint64_t num_frames;
+};
+
+// Location of the block of a frame within the file, offset 0 means the frame is not cached
+struct BlockEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct FrameBlockCache {
+    FILE* file;
+    BlockEntry* index;      // [num_frames], mirrors the index which follows the header in the file
+    size_t num_frames;
+    uint64_t end;           // Where the next block is appended
+    size_t num_cached;
+    size_t bytes_cached;
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
+static char cache_dir[1024] = "";
+
+static inline void cache_lock(FrameBlockCache* cache) {
+    while (cache->lock.test_and_set(std::memory_order_acquire)) {}
+}
+
+static inline void cache_unlock(FrameBlockCache* cache) {
+    cache->lock.clear(std::memory_order_release);
+}
+
+static inline uint64_t index_offset(int64_t idx) {
+    return sizeof(BlockCacheHeader) + (uint64_t)idx * sizeof(BlockEntry);
+}
+
+void frame_block_cache_set_dir(str_t dir) {
+    cache_dir[0] = '\0';
+    if (str_empty(dir)) return;
+    if (dir.len >= sizeof(cache_dir)) {
+        MD_LOG_ERROR("Frame block cache directory path is too long");
+        return;
+    }
+    str_copy_to_char_buf(cache_dir, sizeof(cache_dir), dir);
+
+    // Create each directory along the path, the ones which exist are skipped
+    char buf[1024];
+    const size_t len = strnlen(cache_dir, sizeof(buf) - 1);
+    MEMCPY(buf, cache_dir, len + 1);
+    for (size_t i = 1; i <= len; ++i) {
+        if (buf[i] == '/' || buf[i] == '\\' || buf[i] == '\0') {
+            const char c = buf[i];
+            buf[i] = '\0';
+            make_dir(buf);
+            buf[i] = c;
+        }
+    }
+}
+
+// Reads the index of an existing cache file, entries which do not fit within the file are dropped
+static bool read_index(FrameBlockCache* cache, uint64_t identity, uint64_t bytes) {
+    BlockCacheHeader hdr = {};
+    if (fread(&hdr, sizeof(hdr), 1, cache->file) != 1) return false;
+    if (hdr.magic != FRAME_BLOCK_CACHE_MAGIC || hdr.version != FRAME_BLOCK_CACHE_VERSION || hdr.identity != identity || hdr.num_frames != cache->num_frames) return false;
+    if (fread(cache->index, sizeof(BlockEntry), cache->num_frames, cache->file) != cache->num_frames) return false;
+
+    cache->end = index_offset((int64_t)cache->num_frames);
+    for (size_t i = 0; i < cache->num_frames; ++i) {
+        BlockEntry& e = cache->index[i];
+        if (e.offset < index_offset((int64_t)cache->num_frames) || e.offset + e.size > bytes) {
+            e = {};
+            continue;
+        }
+        cache->end = MAX(cache->end, e.offset + e.size);
+        cache->num_cached += 1;
+        cache->bytes_cached += e.size;
+    }
+    return true;
+}
+
+FrameBlockCache* frame_block_cache_open(uint64_t file_identity, size_t num_frames) {
+    if (cache_dir[0] == '\0' || !file_identity || !num_frames) return NULL;
+
+    char path[1100];
+    const int len = snprintf(path, sizeof(path), "%s/%016llx.frames", cache_dir, (unsigned long long)file_identity);
+    if (len <= 0 || (size_t)len >= sizeof(path)) return NULL;
+
+    FrameBlockCache* cache = (FrameBlockCache*)md_alloc(md_heap_allocator, sizeof(FrameBlockCache));
+    PLACEMENT_NEW(cache) FrameBlockCache();
+    cache->num_frames = num_frames;
+    cache->index = (BlockEntry*)md_alloc(md_heap_allocator, sizeof(BlockEntry) * num_frames);
+    MEMSET(cache->index, 0, sizeof(BlockEntry) * num_frames);
+
+    bool ok = false;
+    cache->file = fopen(path, "r+b");
+    if (cache->file) {
+        const uint64_t size = file_size(cache->file);
+        ok = file_seek(cache->file, 0) == 0 && read_index(cache, file_identity, size);
+        if (!ok) {
+            fclose(cache->file);
+            cache->file = NULL;
+        }
+    }
+    if (!ok) {
+        // The file is missing or was written for another version of the trajectory
+        MEMSET(cache->index, 0, sizeof(BlockEntry) * num_frames);
+        cache->num_cached = 0;
+        cache->bytes_cached = 0;
+        cache->file = fopen(path, "w+b");
+        const BlockCacheHeader hdr = {FRAME_BLOCK_CACHE_MAGIC, FRAME_BLOCK_CACHE_VERSION, file_identity, num_frames};
+        ok = cache->file && fwrite(&hdr, sizeof(hdr), 1, cache->file) == 1 && fwrite(cache->index, sizeof(BlockEntry), num_frames, cache->file) == num_frames;
+        cache->end = index_offset((int64_t)num_frames);
+    }
+    if (!ok) {
+        MD_LOG_ERROR("Failed to open frame block cache '%s'", path);
+        frame_block_cache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void frame_block_cache_close(FrameBlockCache* cache) {
+    if (!cache) return;
+    if (cache->file) fclose(cache->file);
+    md_free(md_heap_allocator, cache->index, sizeof(BlockEntry) * cache->num_frames);
+    cache->~FrameBlockCache();
+    md_free(md_heap_allocator, cache, sizeof(FrameBlockCache));
+}
+
+size_t frame_block_cache_size(FrameBlockCache* cache, int64_t idx) {
+    ASSERT(cache);
+    if (idx < 0 || (size_t)idx >= cache->num_frames) return 0;
+    cache_lock(cache);
+    const size_t size = cache->index[idx].offset ? (size_t)cache->index[idx].size : 0;
+    cache_unlock(cache);
+    return size;
+}
+
+bool frame_block_cache_read(FrameBlockCache* cache, int64_t idx, void* dst, size_t size) {
+    ASSERT(cache);
+    ASSERT(dst);
+    if (idx < 0 || (size_t)idx >= cache->num_frames) return false;
+    cache_lock(cache);
+    const BlockEntry e = cache->index[idx];
+    const bool ok = e.offset && e.size == size && file_seek(cache->file, e.offset) == 0 && fread(dst, 1, size, cache->file) == size;
+    cache_unlock(cache);
+    return ok;
+}
+
+bool frame_block_cache_write(FrameBlockCache* cache, int64_t idx, const void* data, size_t size) {
+    ASSERT(cache);
+    ASSERT(data);
+    if (idx < 0 || (size_t)idx >= cache->num_frames || size == 0) return false;
+    cache_lock(cache);
+    defer { cache_unlock(cache); };
+    if (cache->index[idx].offset) return true;
+    if (cache->end + size > FRAME_BLOCK_CACHE_MAX_BYTES) return false;
+
+    // The block is written before its entry, so an interrupted write never leaves an entry which refers to missing data
+    const BlockEntry e = {cache->end, size};
+    bool ok = file_seek(cache->file, e.offset) == 0 && fwrite(data, 1, size, cache->file) == size;
+    ok = ok && file_seek(cache->file, index_offset(idx)) == 0 && fwrite(&e, sizeof(e), 1, cache->file) == 1;
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write frame %lld to the frame block cache", (long long)idx);
+        return false;
+    }
+    cache->index[idx] = e;
+    cache->end += size;
+    cache->num_cached += 1;
+    cache->bytes_cached += size;
+    return true;
+}
+
+void frame_block_cache_stats(const FrameBlockCache* cache, size_t* num_frames, size_t* num_bytes) {
+    ASSERT(cache);
+    if (num_frames) *num_frames = cache->num_cached;
+    if (num_bytes) *num_bytes = cache->bytes_cached;
+}
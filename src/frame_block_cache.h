@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_str.h>
+
+// Local on-disk cache of the raw frame data of trajectories which live on slow storage, e.g. an object store mounted through s3fs or rclone
+// Each frame is fetched once from the trajectory and stored as a block in a file of the cache directory, later fetches of the frame read the block
+// from the local disk instead. The blocks are the raw (undecoded) frame data, so decoding and the read-ahead pipeline are unchanged.
+// The cache file of a trajectory is keyed by its path, size and modification time (see eval_cache_file_identity) and is reused between sessions.
+
+// Blocks are no longer added to a cache file which has grown beyond this
+#define FRAME_BLOCK_CACHE_MAX_BYTES (64ULL * 1024 * 1024 * 1024)
+
+struct FrameBlockCache;
+
+// The directory is created if it does not exist, an empty directory disables the cache
+void frame_block_cache_set_dir(str_t dir);
+
+// Returns NULL if the cache is disabled or the cache file could not be opened
+FrameBlockCache* frame_block_cache_open(uint64_t file_identity, size_t num_frames);
+void frame_block_cache_close(FrameBlockCache* cache);
+
+// Size of the block of a frame, 0 if it is not in the cache
+size_t frame_block_cache_size(FrameBlockCache* cache, int64_t idx);
+
+// Reads the block of a frame into dst which must hold frame_block_cache_size bytes, returns false on a miss
+bool frame_block_cache_read(FrameBlockCache* cache, int64_t idx, void* dst, size_t size);
+
+// Appends the block of a frame, frames which are already in the cache are skipped
+bool frame_block_cache_write(FrameBlockCache* cache, int64_t idx, const void* data, size_t size);
+
+// Number of cached frames and the bytes of their blocks
+void frame_block_cache_stats(const FrameBlockCache* cache, size_t* num_frames, size_t* num_bytes);
@@ -0,0 +1,393 @@
+#include "frame_similarity.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_SIMILARITY_GATHER 64
+#define FRAME_SIMILARITY_LSH_WIDTH 0.5f     // Bucket width relative to the spread of the projections
+#define FRAME_SIMILARITY_SEED 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t tri_index(uint64_t n, uint64_t a, uint64_t b) {
+    ASSERT(a < b);
+    return a * (2 * n - a - 1) / 2 + (b - a - 1);
+}
+
+static inline uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1]
+static inline double random_unit(uint64_t* state) {
+    return ((splitmix64(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static inline double random_gaussian(uint64_t* state) {
+    const double u = random_unit(state);
+    const double v = random_unit(state);
+    return sqrt(-2.0 * log(u)) * cos(6.283185307179586 * v);
+}
+
+static inline float* frame_coords(const FrameSimilarity* fs, uint32_t frame) {
+    return fs->coords + (size_t)frame * 3 * fs->ref.count;
+}
+
+static inline uint32_t lsh_key(const FrameSimilarity* fs, const float* sketch, uint32_t table) {
+    uint32_t h = 2166136261u;
+    for (uint32_t j = 0; j < FRAME_SIMILARITY_LSH_DIM; ++j) {
+        const uint32_t d = table * FRAME_SIMILARITY_LSH_DIM + j;
+        const int32_t cell = (int32_t)floorf((sketch[d] + fs->lsh_offset[d]) / fs->lsh_width);
+        h = (h ^ (uint32_t)cell) * 16777619u;
+    }
+    return h;
+}
+
+bool frame_similarity_init(FrameSimilarity* fs, const superposition_ref_t* ref, uint32_t num_frames, md_allocator_i* alloc) {
+    ASSERT(fs);
+    ASSERT(ref);
+    ASSERT(alloc);
+    frame_similarity_free(fs);
+    if (num_frames < 2 || !superposition_ref_copy(&fs->ref, ref, alloc)) return false;
+
+    fs->alloc = alloc;
+    fs->num_frames = num_frames;
+    fs->mode = num_frames > FRAME_SIMILARITY_MAX_MATRIX_FRAMES ? FrameSimilarityMode_Sketch : FrameSimilarityMode_Matrix;
+
+    const size_t count = fs->ref.count;
+    if (fs->mode == FrameSimilarityMode_Matrix) {
+        const size_t coord_bytes = sizeof(float) * 3 * count * num_frames;
+        fs->coords = (float*)md_alloc(alloc, coord_bytes);
+        MEMSET(fs->coords, 0, coord_bytes);
+        fs->sum_w_r2 = (double*)md_alloc(alloc, sizeof(double) * num_frames);
+        MEMSET(fs->sum_w_r2, 0, sizeof(double) * num_frames);
+        const size_t num_pairs = (size_t)num_frames * (num_frames - 1) / 2;
+        fs->matrix = (float*)md_alloc(alloc, sizeof(float) * num_pairs);
+        MEMSET(fs->matrix, 0, sizeof(float) * num_pairs);
+    } else {
+        // E |s_a - s_b|^2 = sum w |p_a - p_b|^2 / W, the squared RMSD about the reference
+        fs->proj = (float*)md_alloc(alloc, sizeof(float) * FRAME_SIMILARITY_SKETCH_DIM * 3 * count);
+        uint64_t state = FRAME_SIMILARITY_SEED;
+        for (size_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+            float* p = fs->proj + k * 3 * count;
+            for (size_t i = 0; i < count; ++i) {
+                const double scl = sqrt(fs->ref.w[i] / (fs->ref.sum_w * FRAME_SIMILARITY_SKETCH_DIM));
+                p[i]             = (float)(random_gaussian(&state) * scl);
+                p[i + count]     = (float)(random_gaussian(&state) * scl);
+                p[i + count * 2] = (float)(random_gaussian(&state) * scl);
+            }
+        }
+        const size_t sketch_bytes = sizeof(float) * FRAME_SIMILARITY_SKETCH_DIM * num_frames;
+        fs->sketch = (float*)md_alloc(alloc, sketch_bytes);
+        MEMSET(fs->sketch, 0, sketch_bytes);
+    }
+    return true;
+}
+
+void frame_similarity_free(FrameSimilarity* fs) {
+    ASSERT(fs);
+    if (fs->alloc) {
+        const size_t n = fs->num_frames;
+        const size_t count = fs->ref.count;
+        if (fs->coords)   md_free(fs->alloc, fs->coords, sizeof(float) * 3 * count * n);
+        if (fs->sum_w_r2) md_free(fs->alloc, fs->sum_w_r2, sizeof(double) * n);
+        if (fs->matrix)   md_free(fs->alloc, fs->matrix, sizeof(float) * (n * (n - 1) / 2));
+        if (fs->proj)     md_free(fs->alloc, fs->proj, sizeof(float) * FRAME_SIMILARITY_SKETCH_DIM * 3 * count);
+        if (fs->sketch)   md_free(fs->alloc, fs->sketch, sizeof(float) * FRAME_SIMILARITY_SKETCH_DIM * n);
+        for (uint32_t t = 0; t < FRAME_SIMILARITY_LSH_TABLES; ++t) {
+            if (fs->lsh_table[t]) md_free(fs->alloc, fs->lsh_table[t], sizeof(uint64_t) * n);
+        }
+        superposition_ref_free(&fs->ref);
+    }
+    *fs = {};
+}
+
+void frame_similarity_add_frame(FrameSimilarity* fs, uint32_t frame_idx, const float* x, const float* y, const float* z) {
+    ASSERT(fs);
+    ASSERT(frame_idx < fs->num_frames);
+    const size_t count = fs->ref.count;
+    const int32_t* indices = fs->ref.indices;
+    const float* w = fs->ref.w;
+
+    if (fs->mode == FrameSimilarityMode_Matrix) {
+        float* dx = frame_coords(fs, frame_idx);
+        float* dy = dx + count;
+        float* dz = dy + count;
+        double sx = 0, sy = 0, sz = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t idx = indices[i];
+            dx[i] = x[idx];
+            dy[i] = y[idx];
+            dz[i] = z[idx];
+            sx += w[i] * dx[i];
+            sy += w[i] * dy[i];
+            sz += w[i] * dz[i];
+        }
+        const float cx = (float)(sx / fs->ref.sum_w);
+        const float cy = (float)(sy / fs->ref.sum_w);
+        const float cz = (float)(sz / fs->ref.sum_w);
+        double g = 0;
+        for (size_t i = 0; i < count; ++i) {
+            dx[i] -= cx;
+            dy[i] -= cy;
+            dz[i] -= cz;
+            g += w[i] * (dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i]);
+        }
+        fs->sum_w_r2[frame_idx] = g;
+    } else {
+        const superposition_fit_t fit = superposition_fit(&fs->ref, x, y, z);
+        const quat_t q = fit.rotation;
+        const float r00 = 1 - 2 * (q.y * q.y + q.z * q.z), r01 = 2 * (q.x * q.y - q.z * q.w),     r02 = 2 * (q.x * q.z + q.y * q.w);
+        const float r10 = 2 * (q.x * q.y + q.z * q.w),     r11 = 1 - 2 * (q.x * q.x + q.z * q.z), r12 = 2 * (q.y * q.z - q.x * q.w);
+        const float r20 = 2 * (q.x * q.z - q.y * q.w),     r21 = 2 * (q.y * q.z + q.x * q.w),     r22 = 1 - 2 * (q.x * q.x + q.y * q.y);
+
+        // The superposed coordinates are gathered in blocks, which are projected onto all directions while they are in registers
+        double s[FRAME_SIMILARITY_SKETCH_DIM] = {0};
+        float bx[FRAME_SIMILARITY_GATHER], by[FRAME_SIMILARITY_GATHER], bz[FRAME_SIMILARITY_GATHER];
+        for (size_t beg = 0; beg < count; beg += FRAME_SIMILARITY_GATHER) {
+            const size_t n = MIN(count - beg, (size_t)FRAME_SIMILARITY_GATHER);
+            for (size_t j = 0; j < n; ++j) {
+                const int32_t idx = indices[beg + j];
+                const float px = x[idx] - fit.com.x;
+                const float py = y[idx] - fit.com.y;
+                const float pz = z[idx] - fit.com.z;
+                bx[j] = r00 * px + r01 * py + r02 * pz;
+                by[j] = r10 * px + r11 * py + r12 * pz;
+                bz[j] = r20 * px + r21 * py + r22 * pz;
+            }
+            for (size_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+                const float* gx = fs->proj + k * 3 * count + beg;
+                const float* gy = gx + count;
+                const float* gz = gy + count;
+                float acc = 0;
+                for (size_t j = 0; j < n; ++j) {
+                    acc += gx[j] * bx[j] + gy[j] * by[j] + gz[j] * bz[j];
+                }
+                s[k] += acc;
+            }
+        }
+        float* dst = fs->sketch + (size_t)frame_idx * FRAME_SIMILARITY_SKETCH_DIM;
+        for (size_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+            dst[k] = (float)s[k];
+        }
+    }
+}
+
+// All pairs between two tiles of frames, a tile pair is the unit of work
+static void compute_matrix_tiles(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    FrameSimilarity* fs = (FrameSimilarity*)user_data;
+    const uint32_t n = fs->num_frames;
+    const uint32_t num_tiles = (n + FRAME_SIMILARITY_TILE - 1) / FRAME_SIMILARITY_TILE;
+    const size_t count = fs->ref.count;
+
+    for (uint32_t pair = range_beg; pair < range_end; ++pair) {
+        if (task_system::task_cancelled()) return;
+        // Tile pairs (ti <= tj) are enumerated row by row
+        uint32_t ti = 0;
+        uint32_t p = pair;
+        while (p >= num_tiles - ti) {
+            p -= num_tiles - ti;
+            ti += 1;
+        }
+        const uint32_t tj = ti + p;
+
+        const uint32_t a_beg = ti * FRAME_SIMILARITY_TILE;
+        const uint32_t a_end = MIN(a_beg + FRAME_SIMILARITY_TILE, n);
+        const uint32_t b_beg = tj * FRAME_SIMILARITY_TILE;
+        const uint32_t b_end = MIN(b_beg + FRAME_SIMILARITY_TILE, n);
+        for (uint32_t a = a_beg; a < a_end; ++a) {
+            const float* ax = frame_coords(fs, a);
+            for (uint32_t b = MAX(b_beg, a + 1); b < b_end; ++b) {
+                const float* bx = frame_coords(fs, b);
+                fs->matrix[tri_index(n, a, b)] = superposition_rmsd(ax, ax + count, ax + count * 2, bx, bx + count, bx + count * 2, fs->ref.w, count,
+                                                                    fs->ref.sum_w, fs->sum_w_r2[a], fs->sum_w_r2[b]);
+            }
+        }
+    }
+}
+
+static int compare_u64(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void build_lsh_tables(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    FrameSimilarity* fs = (FrameSimilarity*)user_data;
+    for (uint32_t t = range_beg; t < range_end; ++t) {
+        uint64_t* table = fs->lsh_table[t];
+        for (uint32_t f = 0; f < fs->num_frames; ++f) {
+            table[f] = ((uint64_t)lsh_key(fs, fs->sketch + (size_t)f * FRAME_SIMILARITY_SKETCH_DIM, t) << 32) | f;
+        }
+        qsort(table, fs->num_frames, sizeof(uint64_t), compare_u64);
+    }
+}
+
+task_system::ID frame_similarity_enqueue_build(FrameSimilarity* fs, task_system::ID dependency, task_system::Priority priority) {
+    ASSERT(fs);
+    if (fs->num_frames < 2) return task_system::INVALID_ID;
+
+    if (fs->mode == FrameSimilarityMode_Matrix) {
+        const uint32_t num_tiles = (fs->num_frames + FRAME_SIMILARITY_TILE - 1) / FRAME_SIMILARITY_TILE;
+        const uint32_t num_pairs = num_tiles * (num_tiles + 1) / 2;
+        return task_system::pool_enqueue(STR("Frame RMSD Matrix"), 0, num_pairs, compute_matrix_tiles, fs, dependency, priority);
+    }
+
+    // The bucket width follows the spread of the projections, which is only known once all frames have been added
+    task_system::ID width_task = task_system::pool_enqueue(STR("##Frame Sketch Width"), [](void* user_data) {
+        FrameSimilarity* fs = (FrameSimilarity*)user_data;
+        double sum[FRAME_SIMILARITY_SKETCH_DIM] = {0};
+        double sum_sq[FRAME_SIMILARITY_SKETCH_DIM] = {0};
+        for (uint32_t f = 0; f < fs->num_frames; ++f) {
+            const float* s = fs->sketch + (size_t)f * FRAME_SIMILARITY_SKETCH_DIM;
+            for (uint32_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+                sum[k] += s[k];
+                sum_sq[k] += (double)s[k] * s[k];
+            }
+        }
+        double spread = 0;
+        for (uint32_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+            const double mean = sum[k] / fs->num_frames;
+            spread += sqrt(MAX(sum_sq[k] / fs->num_frames - mean * mean, 0.0));
+        }
+        spread /= FRAME_SIMILARITY_SKETCH_DIM;
+        fs->lsh_width = MAX((float)(spread * FRAME_SIMILARITY_LSH_WIDTH), 1.0e-6f);
+
+        uint64_t state = FRAME_SIMILARITY_SEED ^ fs->num_frames;
+        for (uint32_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+            fs->lsh_offset[k] = (float)(random_unit(&state) * fs->lsh_width);
+        }
+        for (uint32_t t = 0; t < FRAME_SIMILARITY_LSH_TABLES; ++t) {
+            if (!fs->lsh_table[t]) fs->lsh_table[t] = (uint64_t*)md_alloc(fs->alloc, sizeof(uint64_t) * fs->num_frames);
+        }
+    }, fs, dependency, priority);
+
+    return task_system::pool_enqueue(STR("Frame Sketch Index"), 0, FRAME_SIMILARITY_LSH_TABLES, build_lsh_tables, fs, width_task, priority);
+}
+
+float frame_similarity_rmsd(const FrameSimilarity* fs, uint32_t a, uint32_t b) {
+    ASSERT(fs);
+    ASSERT(a < fs->num_frames && b < fs->num_frames);
+    if (a == b) return 0.0f;
+    if (fs->mode == FrameSimilarityMode_Matrix) {
+        return a < b ? fs->matrix[tri_index(fs->num_frames, a, b)] : fs->matrix[tri_index(fs->num_frames, b, a)];
+    }
+    const float* sa = fs->sketch + (size_t)a * FRAME_SIMILARITY_SKETCH_DIM;
+    const float* sb = fs->sketch + (size_t)b * FRAME_SIMILARITY_SKETCH_DIM;
+    float d2 = 0;
+    for (uint32_t k = 0; k < FRAME_SIMILARITY_SKETCH_DIM; ++k) {
+        d2 += (sa[k] - sb[k]) * (sa[k] - sb[k]);
+    }
+    return sqrtf(d2);
+}
+
+// Keeps the k smallest values sorted
+static void top_k_insert(uint32_t* frames, float* values, size_t* num, size_t k, uint32_t frame, float value) {
+    if (*num == k && value >= values[k - 1]) return;
+    size_t i = (*num < k) ? (*num)++ : k - 1;
+    while (i > 0 && values[i - 1] > value) {
+        frames[i] = frames[i - 1];
+        values[i] = values[i - 1];
+        i -= 1;
+    }
+    frames[i] = frame;
+    values[i] = value;
+}
+
+size_t frame_similarity_query(const FrameSimilarity* fs, uint32_t frame, uint32_t* out_frames, float* out_rmsd, size_t k, md_allocator_i* temp_alloc) {
+    ASSERT(fs);
+    ASSERT(out_frames && out_rmsd);
+    ASSERT(temp_alloc);
+    if (k == 0 || frame >= fs->num_frames) return 0;
+
+    size_t num = 0;
+    if (fs->mode == FrameSimilarityMode_Sketch && fs->lsh_table[0]) {
+        uint8_t* visited = (uint8_t*)md_alloc(temp_alloc, fs->num_frames);
+        MEMSET(visited, 0, fs->num_frames);
+        visited[frame] = 1;
+
+        const float* s = fs->sketch + (size_t)frame * FRAME_SIMILARITY_SKETCH_DIM;
+        size_t num_candidates = 0;
+        for (uint32_t t = 0; t < FRAME_SIMILARITY_LSH_TABLES; ++t) {
+            const uint64_t* table = fs->lsh_table[t];
+            const uint64_t key = lsh_key(fs, s, t);
+            // Lower bound of the bucket
+            size_t lo = 0;
+            size_t hi = fs->num_frames;
+            while (lo < hi) {
+                const size_t mid = (lo + hi) / 2;
+                if ((table[mid] >> 32) < key) lo = mid + 1;
+                else hi = mid;
+            }
+            for (size_t i = lo; i < fs->num_frames && (table[i] >> 32) == key; ++i) {
+                const uint32_t f = (uint32_t)table[i];
+                if (visited[f]) continue;
+                visited[f] = 1;
+                num_candidates += 1;
+                top_k_insert(out_frames, out_rmsd, &num, k, f, frame_similarity_rmsd(fs, frame, f));
+            }
+        }
+        md_free(temp_alloc, visited, fs->num_frames);
+        if (num_candidates >= k) return num;
+        num = 0;
+    }
+
+    for (uint32_t f = 0; f < fs->num_frames; ++f) {
+        if (f == frame) continue;
+        top_k_insert(out_frames, out_rmsd, &num, k, f, frame_similarity_rmsd(fs, frame, f));
+    }
+    return num;
+}
+
+size_t frame_similarity_cluster(const FrameSimilarity* fs, float cutoff, int32_t* out_cluster, uint32_t* out_centers, md_allocator_i* temp_alloc) {
+    ASSERT(fs);
+    ASSERT(out_cluster && out_centers);
+    ASSERT(temp_alloc);
+    if (fs->mode != FrameSimilarityMode_Matrix || fs->num_frames == 0) return 0;
+
+    const uint32_t n = fs->num_frames;
+    uint32_t* num_neighbours = (uint32_t*)md_alloc(temp_alloc, sizeof(uint32_t) * n);
+    defer { md_free(temp_alloc, num_neighbours, sizeof(uint32_t) * n); };
+    MEMSET(num_neighbours, 0, sizeof(uint32_t) * n);
+    for (uint32_t a = 0; a < n; ++a) {
+        out_cluster[a] = -1;
+        for (uint32_t b = a + 1; b < n; ++b) {
+            if (fs->matrix[tri_index(n, a, b)] <= cutoff) {
+                num_neighbours[a] += 1;
+                num_neighbours[b] += 1;
+            }
+        }
+    }
+
+    size_t num_clusters = 0;
+    uint32_t num_assigned = 0;
+    while (num_assigned < n) {
+        uint32_t center = UINT32_MAX;
+        for (uint32_t f = 0; f < n; ++f) {
+            if (out_cluster[f] == -1 && (center == UINT32_MAX || num_neighbours[f] > num_neighbours[center])) center = f;
+        }
+        const int32_t c = (int32_t)num_clusters++;
+        out_centers[c] = center;
+        out_cluster[center] = c;
+        num_assigned += 1;
+        for (uint32_t f = 0; f < n; ++f) {
+            if (out_cluster[f] == -1 && frame_similarity_rmsd(fs, center, f) <= cutoff) {
+                out_cluster[f] = c;
+                num_assigned += 1;
+            }
+        }
+        // The members no longer count as neighbours of the remaining frames
+        for (uint32_t m = 0; m < n; ++m) {
+            if (out_cluster[m] != c) continue;
+            for (uint32_t f = 0; f < n; ++f) {
+                if (out_cluster[f] == -1 && frame_similarity_rmsd(fs, m, f) <= cutoff) num_neighbours[f] -= 1;
+            }
+        }
+    }
+    return num_clusters;
+}
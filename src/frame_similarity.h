@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <superposition.h>
+#include <task_system.h>
+
+struct md_allocator_i;
+
+// Similarity between the frames of a trajectory, measured as the RMSD of a structure after superposition
+// The frames are added one by one (e.g. by a consumer of the trajectory sweep), in any order and from any thread.
+//
+// Matrix: For modest frame counts the centered coordinates of every frame are kept and the full pairwise RMSD matrix is computed,
+//         in tiles of frames whose coordinates stay in cache while all pairs between them are evaluated.
+// Sketch: Above FRAME_SIMILARITY_MAX_MATRIX_FRAMES, every frame is superposed onto the reference and reduced to a few random projections
+//         of its weighted coordinates (Johnson-Lindenstrauss), the distance between sketches approximates the RMSD about the common reference.
+//         The sketches are hashed into LSH tables (quantized projections), so the nearest frames are found among the frames which share a bucket.
+
+#define FRAME_SIMILARITY_MAX_MATRIX_FRAMES 4096
+#define FRAME_SIMILARITY_TILE 32            // Frames per tile of the matrix
+#define FRAME_SIMILARITY_SKETCH_DIM 16
+#define FRAME_SIMILARITY_LSH_TABLES 4
+#define FRAME_SIMILARITY_LSH_DIM (FRAME_SIMILARITY_SKETCH_DIM / FRAME_SIMILARITY_LSH_TABLES)   // Projections per hash key
+
+enum FrameSimilarityMode {
+    FrameSimilarityMode_Matrix,
+    FrameSimilarityMode_Sketch,
+};
+
+struct FrameSimilarity {
+    FrameSimilarityMode mode = FrameSimilarityMode_Matrix;
+    uint32_t num_frames = 0;
+    superposition_ref_t ref = {};   // The structure (indices and weights), sketches are taken after superposition onto it
+
+    // Matrix
+    float*  coords = nullptr;       // [num_frames][3][ref.count] Coordinates of each frame relative to its center of mass
+    double* sum_w_r2 = nullptr;     // [num_frames]
+    float*  matrix = nullptr;       // Strict upper triangle, row major, see frame_similarity_rmsd
+
+    // Sketch
+    float*    proj = nullptr;       // [FRAME_SIMILARITY_SKETCH_DIM][3][ref.count] Projection vectors, scaled by the weights
+    float*    sketch = nullptr;     // [num_frames][FRAME_SIMILARITY_SKETCH_DIM]
+    float     lsh_width = 0;
+    float     lsh_offset[FRAME_SIMILARITY_SKETCH_DIM] = {};
+    uint64_t* lsh_table[FRAME_SIMILARITY_LSH_TABLES] = {};     // [num_frames] (key << 32) | frame, sorted
+
+    md_allocator_i* alloc = nullptr;
+};
+
+// The structure and weights are taken from ref. Frame counts above FRAME_SIMILARITY_MAX_MATRIX_FRAMES use the sketch
+bool frame_similarity_init(FrameSimilarity* fs, const superposition_ref_t* ref, uint32_t num_frames, md_allocator_i* alloc);
+void frame_similarity_free(FrameSimilarity* fs);
+
+// Adds the coordinates of a frame (indexed by the atom indices of the structure), frames can be added concurrently
+void frame_similarity_add_frame(FrameSimilarity* fs, uint32_t frame_idx, const float* x, const float* y, const float* z);
+
+// Computes the matrix or the LSH tables once all frames have been added, returns the id of the task which completes when the index is ready
+task_system::ID frame_similarity_enqueue_build(FrameSimilarity* fs, task_system::ID dependency = 0, task_system::Priority priority = task_system::Priority_Background);
+
+// RMSD between two frames, which is approximated by the distance of the sketches in sketch mode
+float frame_similarity_rmsd(const FrameSimilarity* fs, uint32_t a, uint32_t b);
+
+// Writes the (up to) k frames closest to frame, sorted by their RMSD, and returns the number written
+// In sketch mode the candidates are the frames which share an LSH bucket with the frame, all frames are scanned if there are fewer than k candidates
+size_t frame_similarity_query(const FrameSimilarity* fs, uint32_t frame, uint32_t* out_frames, float* out_rmsd, size_t k, md_allocator_i* temp_alloc);
+
+// Clusters the frames of the matrix with the GROMOS algorithm: The frame with the most neighbours within cutoff is the center of a cluster of its neighbours,
+// which are removed before the next center is chosen. Writes the cluster of each frame and the center of each cluster (in the order they are found), returns the number of clusters
+// Only available in matrix mode
+size_t frame_similarity_cluster(const FrameSimilarity* fs, float cutoff, int32_t* out_cluster, uint32_t* out_centers, md_allocator_i* temp_alloc);
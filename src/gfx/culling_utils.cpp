@@ -0,0 +1,449 @@
+#include "culling_utils.h"
+
+#include <gfx/gl.h>
+#include <gfx/gl_utils.h>
+#include <task_system.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#include <shaders.inl>
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+
+namespace culling {
+
+static struct {
+    GLuint vao = 0;
+    GLuint program = 0;
+    GLint uniform_loc_tex_depth = -1;
+    bool initialized = false;   // The program is compiled when the depth is first captured
+} gl;
+
+static constexpr str_t v_shader_src_fs_quad = STR(
+R"(
+#version 150 core
+
+void main() {
+	uint idx = uint(gl_VertexID) % 3U;
+	gl_Position = vec4(
+		(float( idx     &1U)) * 4.0 - 1.0,
+		(float((idx>>1U)&1U)) * 4.0 - 1.0,
+		0, 1.0);
+}
+)");
+
+void initialize() {
+    gl.initialized = true;
+    char defines[64];
+    const int len = snprintf(defines, sizeof(defines), "#define TILE_SIZE %d", CULL_HIZ_TILE_SIZE);
+    const gl::ShaderSource shaders[] = {
+        {GL_VERTEX_SHADER, v_shader_src_fs_quad},
+        {GL_FRAGMENT_SHADER, {(const char*)hiz_reduce_frag, hiz_reduce_frag_size}, {defines, (size_t)len}},
+    };
+
+    if (!gl.program) gl.program = glCreateProgram();
+    if (!gl::link_program_from_sources(gl.program, shaders, (int)ARRAY_SIZE(shaders))) {
+        MD_LOG_ERROR("shader compilation failed, occlusion culling will not be available");
+        return;
+    }
+    gl.uniform_loc_tex_depth = glGetUniformLocation(gl.program, "u_tex_depth");
+
+    if (!gl.vao) glGenVertexArrays(1, &gl.vao);
+}
+
+void shutdown() {
+    if (gl.vao) glDeleteVertexArrays(1, &gl.vao);
+    if (gl.program) glDeleteProgram(gl.program);
+    gl = {};
+}
+
+void init_chunks(ChunkSet* chunks, const uint32_t* range_offset, size_t num_ranges, size_t num_atoms, md_allocator_i* alloc) {
+    ASSERT(chunks);
+    ASSERT(alloc);
+    free_chunks(chunks);
+    chunks->alloc = alloc;
+
+    // Upper bound: every range is a chunk or every chunk is full
+    const size_t cap = (range_offset ? num_ranges : 0) + num_atoms / CULL_CHUNK_MAX_ATOMS + 1;
+    uint32_t* offset = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * (cap + 1));
+    defer { md_free(md_heap_allocator, offset, sizeof(uint32_t) * (cap + 1)); };
+
+    size_t count = 0;
+    offset[0] = 0;
+    if (range_offset) {
+        for (size_t i = 0; i < num_ranges; ++i) {
+            const uint32_t end = range_offset[i + 1];
+            // Close the current chunk if the range does not fit, ranges which are larger than a chunk form a chunk of their own
+            if (offset[count] != range_offset[i]) {
+                if (end - offset[count] > CULL_CHUNK_MAX_ATOMS) {
+                    offset[++count] = range_offset[i];
+                }
+            }
+            if (end - offset[count] >= CULL_CHUNK_MAX_ATOMS) {
+                offset[++count] = end;
+            }
+        }
+        if (offset[count] < num_atoms) {
+            offset[++count] = (uint32_t)num_atoms;
+        }
+    } else {
+        for (size_t beg = 0; beg < num_atoms; beg += CULL_CHUNK_MAX_ATOMS) {
+            offset[++count] = (uint32_t)MIN(beg + CULL_CHUNK_MAX_ATOMS, num_atoms);
+        }
+    }
+    ASSERT(count <= cap);
+
+    chunks->count = count;
+    chunks->atom_offset = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * (count + 1));
+    chunks->aabb_min = (vec3_t*)md_alloc(alloc, sizeof(vec3_t) * count);
+    chunks->aabb_max = (vec3_t*)md_alloc(alloc, sizeof(vec3_t) * count);
+    chunks->state    = (ChunkState*)md_alloc(alloc, sizeof(ChunkState) * count);
+    float** proxy[5] = {&chunks->proxy_x, &chunks->proxy_y, &chunks->proxy_z, &chunks->proxy_r, &chunks->extent};
+    for (float** p : proxy) {
+        *p = (float*)md_alloc(alloc, sizeof(float) * count);
+        MEMSET(*p, 0, sizeof(float) * count);
+    }
+    MEMCPY(chunks->atom_offset, offset, sizeof(uint32_t) * (count + 1));
+    MEMSET(chunks->aabb_min, 0, sizeof(vec3_t) * count);
+    MEMSET(chunks->aabb_max, 0, sizeof(vec3_t) * count);
+    MEMSET(chunks->state, ChunkState_Detail, sizeof(ChunkState) * count);
+    chunks->num_visible = count;
+    chunks->num_proxies = 0;
+}
+
+void free_chunks(ChunkSet* chunks) {
+    ASSERT(chunks);
+    if (!chunks->alloc) return;
+    md_free(chunks->alloc, chunks->atom_offset, sizeof(uint32_t) * (chunks->count + 1));
+    md_free(chunks->alloc, chunks->aabb_min, sizeof(vec3_t) * chunks->count);
+    md_free(chunks->alloc, chunks->aabb_max, sizeof(vec3_t) * chunks->count);
+    md_free(chunks->alloc, chunks->state, sizeof(ChunkState) * chunks->count);
+    float* proxy[5] = {chunks->proxy_x, chunks->proxy_y, chunks->proxy_z, chunks->proxy_r, chunks->extent};
+    for (float* p : proxy) {
+        md_free(chunks->alloc, p, sizeof(float) * chunks->count);
+    }
+    *chunks = {};
+}
+
+struct AabbJob {
+    ChunkSet* chunks;
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* r;
+    float radius_scale;
+    float pad;
+};
+
+void compute_chunk_aabbs(ChunkSet* chunks, const float* x, const float* y, const float* z, const float* radius, float radius_scale, float pad) {
+    ASSERT(chunks);
+    if (chunks->count == 0) return;
+
+    AabbJob job = {chunks, x, y, z, radius, radius_scale, pad};
+    task_system::ID id = task_system::pool_enqueue(STR("##Chunk AABBs"), 0, (uint32_t)chunks->count, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        const AabbJob* job = (const AabbJob*)user_data;
+        ChunkSet* c = job->chunks;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            vec3_t mn = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+            vec3_t mx = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (uint32_t j = c->atom_offset[i]; j < c->atom_offset[i + 1]; ++j) {
+                const float r = (job->r ? job->r[j] * job->radius_scale : 0.0f) + job->pad;
+                mn.x = MIN(mn.x, job->x[j] - r);
+                mn.y = MIN(mn.y, job->y[j] - r);
+                mn.z = MIN(mn.z, job->z[j] - r);
+                mx.x = MAX(mx.x, job->x[j] + r);
+                mx.y = MAX(mx.y, job->y[j] + r);
+                mx.z = MAX(mx.z, job->z[j] + r);
+            }
+            c->aabb_min[i] = mn;
+            c->aabb_max[i] = mx;
+
+            const uint32_t beg = c->atom_offset[i];
+            const uint32_t end = c->atom_offset[i + 1];
+            const float inv_n = 1.0f / (float)MAX(end - beg, 1U);
+            float cx = 0, cy = 0, cz = 0;
+            for (uint32_t j = beg; j < end; ++j) {
+                cx += job->x[j];
+                cy += job->y[j];
+                cz += job->z[j];
+            }
+            cx *= inv_n;
+            cy *= inv_n;
+            cz *= inv_n;
+
+            float sum_d2 = 0, sum_r = 0, max_d = 0;
+            for (uint32_t j = beg; j < end; ++j) {
+                const float dx = job->x[j] - cx;
+                const float dy = job->y[j] - cy;
+                const float dz = job->z[j] - cz;
+                const float d2 = dx * dx + dy * dy + dz * dz;
+                const float r = job->r ? job->r[j] : 0.0f;
+                sum_d2 += d2;
+                sum_r  += r;
+                max_d = MAX(max_d, sqrtf(d2) + r);
+            }
+            // A solid sphere of radius R has a radius of gyration of sqrt(3/5) R
+            c->proxy_x[i] = cx;
+            c->proxy_y[i] = cy;
+            c->proxy_z[i] = cz;
+            c->proxy_r[i] = sqrtf(sum_d2 * inv_n * (5.0f / 3.0f)) + sum_r * inv_n;
+            c->extent[i]  = max_d;
+        }
+    }, &job, 0, task_system::Priority_Interactive);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+}
+
+void hiz_capture(HiZ* hiz, uint32_t depth_tex, int width, int height, const mat4_t& view_proj, uint64_t key) {
+    ASSERT(hiz);
+    if (!gl.initialized) initialize();
+    if (!gl.program || width <= 0 || height <= 0) return;
+
+    const int tiles_x = (width  + CULL_HIZ_TILE_SIZE - 1) / CULL_HIZ_TILE_SIZE;
+    const int tiles_y = (height + CULL_HIZ_TILE_SIZE - 1) / CULL_HIZ_TILE_SIZE;
+
+    if (!hiz->fbo) glGenFramebuffers(1, &hiz->fbo);
+    if (!hiz->pbo[0]) glGenBuffers((int)ARRAY_SIZE(hiz->pbo), hiz->pbo);
+
+    // A slot which is still in flight is overwritten, its capture is dropped
+    const uint32_t slot = hiz->frame++ % ARRAY_SIZE(hiz->pbo);
+    if (hiz->fence[slot]) {
+        glDeleteSync((GLsync)hiz->fence[slot]);
+        hiz->fence[slot] = 0;
+    }
+
+    if (hiz->size[slot][0] != tiles_x || hiz->size[slot][1] != tiles_y) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, hiz->pbo[slot]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float) * tiles_x * tiles_y, NULL, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    int tex_w = 0, tex_h = 0;
+    if (hiz->tex) {
+        glBindTexture(GL_TEXTURE_2D, hiz->tex);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,  &tex_w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &tex_h);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    if (tex_w != tiles_x || tex_h != tiles_y) {
+        gl::init_texture_2D(&hiz->tex, tiles_x, tiles_y, GL_R32F);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, hiz->fbo);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiz->tex, 0);
+    }
+
+    GLint last_viewport[4];
+    GLint last_draw_fbo;
+    glGetIntegerv(GL_VIEWPORT, last_viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &last_draw_fbo);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, hiz->fbo);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, tiles_x, tiles_y);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+
+    glUseProgram(gl.program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depth_tex);
+    glUniform1i(gl.uniform_loc_tex_depth, 0);
+    glBindVertexArray(gl.vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    // Queue the read into the pixel pack buffer, it is mapped once the fence has been passed
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, hiz->fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, hiz->pbo[slot]);
+    glReadPixels(0, 0, tiles_x, tiles_y, GL_RED, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    hiz->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    hiz->key[slot] = key;
+    hiz->view_proj[slot] = view_proj;
+    hiz->size[slot][0] = tiles_x;
+    hiz->size[slot][1] = tiles_y;
+
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, last_draw_fbo);
+    glViewport(last_viewport[0], last_viewport[1], last_viewport[2], last_viewport[3]);
+}
+
+bool hiz_fetch(HiZ* hiz) {
+    ASSERT(hiz);
+    bool fetched = false;
+    // Visit the slots from the oldest capture, so the latest completed one is kept
+    for (uint32_t i = 0; i < ARRAY_SIZE(hiz->pbo); ++i) {
+        const uint32_t slot = (hiz->frame + i) % ARRAY_SIZE(hiz->pbo);
+        if (!hiz->fence[slot]) continue;
+        const GLenum res = glClientWaitSync((GLsync)hiz->fence[slot], 0, 0);
+        if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) continue;
+        glDeleteSync((GLsync)hiz->fence[slot]);
+        hiz->fence[slot] = 0;
+
+        const int w = hiz->size[slot][0];
+        const int h = hiz->size[slot][1];
+        if ((size_t)w * h != (size_t)hiz->width * hiz->height) {
+            if (hiz->depth) md_free(md_heap_allocator, hiz->depth, sizeof(float) * hiz->width * hiz->height);
+            hiz->depth = (float*)md_alloc(md_heap_allocator, sizeof(float) * w * h);
+        }
+        hiz->width = w;
+        hiz->height = h;
+        hiz->valid = false;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, hiz->pbo[slot]);
+        const float* src = (const float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (src) {
+            MEMCPY(hiz->depth, src, sizeof(float) * w * h);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            hiz->depth_key = hiz->key[slot];
+            hiz->depth_view_proj = hiz->view_proj[slot];
+            hiz->valid = true;
+            fetched = true;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    return fetched;
+}
+
+void free_hiz(HiZ* hiz) {
+    ASSERT(hiz);
+    for (uint32_t i = 0; i < ARRAY_SIZE(hiz->fence); ++i) {
+        if (hiz->fence[i]) glDeleteSync((GLsync)hiz->fence[i]);
+    }
+    if (hiz->pbo[0]) glDeleteBuffers((int)ARRAY_SIZE(hiz->pbo), hiz->pbo);
+    if (hiz->fbo) glDeleteFramebuffers(1, &hiz->fbo);
+    if (hiz->tex) gl::free_texture(&hiz->tex);
+    if (hiz->depth) md_free(md_heap_allocator, hiz->depth, sizeof(float) * hiz->width * hiz->height);
+    *hiz = {};
+}
+
+struct CullJob {
+    ChunkSet* chunks;
+    mat4_t view_proj;
+    const HiZ* hiz;     // NULL if the depth is not valid for the view
+    float lod_scale;    // Pixels per unit of diameter at w = 1, 0 if the proxies are disabled
+    std::atomic_uint32_t changed;
+    std::atomic_uint32_t num_visible;
+    std::atomic_uint32_t num_proxies;
+};
+
+// The corners of the box in clip space, the box is visible unless all corners are outside of the same plane
+static bool cull_chunk(const CullJob& job, vec3_t mn, vec3_t mx) {
+    const mat4_t& M = job.view_proj;
+    float clip[8][4];
+    for (int i = 0; i < 8; ++i) {
+        const float x = (i & 1) ? mx.x : mn.x;
+        const float y = (i & 2) ? mx.y : mn.y;
+        const float z = (i & 4) ? mx.z : mn.z;
+        for (int r = 0; r < 4; ++r) {
+            clip[i][r] = M.elem[0][r] * x + M.elem[1][r] * y + M.elem[2][r] * z + M.elem[3][r];
+        }
+    }
+
+    uint32_t out_and = 0x3F;
+    for (int i = 0; i < 8; ++i) {
+        const float* c = clip[i];
+        uint32_t out = 0;
+        out |= (c[0] < -c[3]) << 0;
+        out |= (c[0] >  c[3]) << 1;
+        out |= (c[1] < -c[3]) << 2;
+        out |= (c[1] >  c[3]) << 3;
+        out |= (c[2] < -c[3]) << 4;
+        out |= (c[2] >  c[3]) << 5;
+        out_and &= out;
+    }
+    if (out_and) return false;
+    if (!job.hiz) return true;
+
+    // Boxes which reach behind the near plane cannot be projected and are kept
+    float x_min = FLT_MAX, y_min = FLT_MAX, d_min = FLT_MAX;
+    float x_max = -FLT_MAX, y_max = -FLT_MAX;
+    for (int i = 0; i < 8; ++i) {
+        const float* c = clip[i];
+        if (c[3] <= 1.0e-5f || c[2] < -c[3]) return true;
+        const float inv_w = 1.0f / c[3];
+        x_min = MIN(x_min, c[0] * inv_w);
+        x_max = MAX(x_max, c[0] * inv_w);
+        y_min = MIN(y_min, c[1] * inv_w);
+        y_max = MAX(y_max, c[1] * inv_w);
+        d_min = MIN(d_min, c[2] * inv_w * 0.5f + 0.5f);
+    }
+
+    // The rectangle is grown by a tile to cover the sub-pixel jitter of the frame the depth was captured from
+    const HiZ& hiz = *job.hiz;
+    const int tx0 = CLAMP((int)floorf((x_min * 0.5f + 0.5f) * hiz.width)  - 1, 0, hiz.width  - 1);
+    const int tx1 = CLAMP((int)floorf((x_max * 0.5f + 0.5f) * hiz.width)  + 1, 0, hiz.width  - 1);
+    const int ty0 = CLAMP((int)floorf((y_min * 0.5f + 0.5f) * hiz.height) - 1, 0, hiz.height - 1);
+    const int ty1 = CLAMP((int)floorf((y_max * 0.5f + 0.5f) * hiz.height) + 1, 0, hiz.height - 1);
+    if ((tx1 - tx0 + 1) * (ty1 - ty0 + 1) > CULL_HIZ_MAX_TEST_TILES) return true;
+
+    for (int y = ty0; y <= ty1; ++y) {
+        for (int x = tx0; x <= tx1; ++x) {
+            if (d_min <= hiz.depth[y * hiz.width + x]) return true;
+        }
+    }
+    return false;
+}
+
+static ChunkState chunk_state(const CullJob& job, const ChunkSet& c, size_t i) {
+    if (!cull_chunk(job, c.aabb_min[i], c.aabb_max[i])) return ChunkState_Culled;
+    if (job.lod_scale > 0.0f) {
+        const mat4_t& M = job.view_proj;
+        const float w = M.elem[0][3] * c.proxy_x[i] + M.elem[1][3] * c.proxy_y[i] + M.elem[2][3] * c.proxy_z[i] + M.elem[3][3];
+        if (w > 0.0f && 2.0f * c.extent[i] * job.lod_scale < w) return ChunkState_Proxy;
+    }
+    return ChunkState_Detail;
+}
+
+bool cull_chunks(ChunkSet* chunks, const mat4_t& view_proj, const HiZ* hiz, uint64_t key, float lod_pixels, int viewport_height) {
+    ASSERT(chunks);
+    if (chunks->count == 0) return false;
+
+    CullJob job = {};
+    job.chunks = chunks;
+    job.view_proj = view_proj;
+    // The depth is only valid for the view and scene it was captured from
+    if (hiz && hiz->valid && hiz->depth_key == key && MEMCMP(&hiz->depth_view_proj, &view_proj, sizeof(mat4_t)) == 0) {
+        job.hiz = hiz;
+    }
+    // A diameter d at w spans d * s / w in NDC, where s is the length of the spatial part of the y row (the y scale of the projection, as the view is a rigid transform)
+    if (lod_pixels > 0.0f && viewport_height > 0) {
+        const mat4_t& M = view_proj;
+        const float s = sqrtf(M.elem[0][1] * M.elem[0][1] + M.elem[1][1] * M.elem[1][1] + M.elem[2][1] * M.elem[2][1]);
+        job.lod_scale = s * 0.5f * (float)viewport_height / lod_pixels;
+    }
+
+    task_system::ID id = task_system::pool_enqueue(STR("##Cull Chunks"), 0, (uint32_t)chunks->count, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        CullJob* job = (CullJob*)user_data;
+        ChunkSet* c = job->chunks;
+        uint32_t changed = 0;
+        uint32_t visible = 0;
+        uint32_t proxies = 0;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            const ChunkState s = chunk_state(*job, *c, i);
+            changed |= s != c->state[i];
+            visible += s != ChunkState_Culled;
+            proxies += s == ChunkState_Proxy;
+            c->state[i] = s;
+        }
+        if (changed) job->changed.fetch_add(1, std::memory_order_relaxed);
+        job->num_visible.fetch_add(visible, std::memory_order_relaxed);
+        job->num_proxies.fetch_add(proxies, std::memory_order_relaxed);
+    }, &job, 0, task_system::Priority_Interactive);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+
+    chunks->num_visible = job.num_visible.load();
+    chunks->num_proxies = job.num_proxies.load();
+    return job.changed.load() > 0;
+}
+
+}  // namespace culling
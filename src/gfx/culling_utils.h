@@ -0,0 +1,96 @@
+#pragma once
+
+#include <core/md_vec_math.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct md_allocator_i;
+
+namespace culling {
+
+// Compiles the program, which is otherwise done when the depth is first captured
+void initialize();
+void shutdown();
+
+/*
+    Culling of the representations in chunks of consecutive atoms.
+    Each chunk holds whole residues (up to CULL_CHUNK_MAX_ATOMS atoms) and an AABB which encloses the atoms and what the representations draw of them.
+    The chunks are tested against the view frustum and against the farthest depth per tile of a frame which was read back from the GPU (HiZ).
+    The visibility is expanded into a flag per atom, which the representations are drawn with as atom mask.
+
+    Chunks which cover less than a number of pixels on screen can be drawn as a single proxy sphere instead of their atoms (level of detail).
+    The proxy is centered at the centroid with the radius of a solid sphere with the radius of gyration of the atoms, widened by their mean radius.
+    As a chunk is only replaced when the sphere which encloses its atoms is below the threshold, the error on screen is bounded by the threshold.
+*/
+
+#define CULL_CHUNK_MAX_ATOMS 256
+#define CULL_HIZ_TILE_SIZE 16       // Pixels per side of a HiZ tile
+#define CULL_HIZ_MAX_TEST_TILES 64  // Chunks which cover more tiles than this are not tested for occlusion
+
+typedef uint8_t ChunkState;
+enum ChunkState_ {
+    ChunkState_Culled = 0,
+    ChunkState_Detail = 1,  // Drawn as atoms
+    ChunkState_Proxy  = 2,  // Drawn as proxy sphere
+};
+
+struct ChunkSet {
+    uint32_t* atom_offset = 0;  // count + 1 entries
+    vec3_t* aabb_min = 0;
+    vec3_t* aabb_max = 0;
+    ChunkState* state = 0;
+    float* proxy_x = 0;
+    float* proxy_y = 0;
+    float* proxy_z = 0;
+    float* proxy_r = 0;
+    float* extent = 0;          // Radius around the centroid which encloses the atoms
+    size_t count = 0;
+    size_t num_visible = 0;
+    size_t num_proxies = 0;
+    md_allocator_i* alloc = 0;
+};
+
+// range_offset holds num_ranges + 1 atom offsets of ranges (residues) which are not split, if it is NULL the atoms are chunked by count
+void init_chunks(ChunkSet* chunks, const uint32_t* range_offset, size_t num_ranges, size_t num_atoms, md_allocator_i* alloc);
+void free_chunks(ChunkSet* chunks);
+
+// Each atom contributes its radius scaled by radius_scale plus pad, computed in parallel on the pool along with the proxies
+void compute_chunk_aabbs(ChunkSet* chunks, const float* x, const float* y, const float* z, const float* radius, float radius_scale, float pad);
+
+/*
+    The depth buffer is reduced into tiles on the GPU and read back asynchronously, so the depth of a frame is available some frames later.
+    Every capture is tagged with a key which identifies the scene and view it was rendered with,
+    the read back depth is only used for occlusion while the key of the current frame matches, as it is not valid for any other view.
+*/
+
+struct HiZ {
+    uint32_t tex = 0;
+    uint32_t fbo = 0;
+    uint32_t pbo[2] = {};
+    void* fence[2] = {};
+    uint64_t key[2] = {};
+    mat4_t view_proj[2] = {};
+    int size[2][2] = {};        // Tiles of the captures in flight
+    uint32_t frame = 0;
+
+    // Latest depth which has been read back
+    float* depth = 0;
+    int width = 0;
+    int height = 0;
+    uint64_t depth_key = 0;
+    mat4_t depth_view_proj = {};
+    bool valid = false;
+};
+
+void hiz_capture(HiZ* hiz, uint32_t depth_tex, int width, int height, const mat4_t& view_proj, uint64_t key);
+// Copies the latest capture which has completed on the GPU, returns true if there was one
+bool hiz_fetch(HiZ* hiz);
+void free_hiz(HiZ* hiz);
+
+// Tests the chunks against the frustum of view_proj and if hiz is supplied and matches key, against its depth
+// Visible chunks with a diameter of less than lod_pixels on screen are drawn as proxies, 0 disables the proxies
+// Returns true if the state of any chunk changed
+bool cull_chunks(ChunkSet* chunks, const mat4_t& view_proj, const HiZ* hiz, uint64_t key, float lod_pixels = 0.0f, int viewport_height = 0);
+
+}  // namespace culling
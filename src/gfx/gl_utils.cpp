@@ -3,8 +3,18 @@
 #include <core/md_log.h>
 #include <core/md_allocator.h>
 #include <core/md_str_builder.h>
+#include <core/md_os.h>
 
 #include <string.h>
+#include <stdio.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#endif
 
 #include "gl_utils.h"
 
@@ -62,35 +72,31 @@ bool build_shader_src(md_strb_t* builder, str_t src, str_t base_include_dir) {
     return true;
 }
 
-GLuint gl::compile_shader_from_source(str_t src, GLenum type, str_t defines, str_t base_include_dir) {
-    ASSERT(type == GL_VERTEX_SHADER || type == GL_GEOMETRY_SHADER || type == GL_FRAGMENT_SHADER || type == GL_COMPUTE_SHADER ||
-           type == GL_TESS_CONTROL_SHADER || type == GL_TESS_EVALUATION_SHADER);
-
-    GLuint shader = glCreateShader(type);
-    md_strb_t builder = {0};
-    md_strb_init(&builder, md_temp_allocator);
-    
+// Inserts the defines after the version string and expands the includes
+static bool preprocess_shader_src(md_strb_t* builder, str_t src, str_t defines, str_t base_include_dir) {
     if (defines) {
         str_t version_str = {};
         if (str_eq_cstr_n(src, "#version ", 9)) {
             if (!str_extract_line(&version_str, &src)) {
                 MD_LOG_ERROR("Failed to extract version string!");
-                return 0;
+                return false;
             }
-            md_strb_push_str(&builder, version_str);
-            md_strb_push_char(&builder, '\n');
-            md_strb_push_str(&builder, defines);
-            md_strb_push_char(&builder, '\n');
+            md_strb_push_str(builder, version_str);
+            md_strb_push_char(builder, '\n');
+            md_strb_push_str(builder, defines);
+            md_strb_push_char(builder, '\n');
         }
         else {
-            md_strb_push_str(&builder, defines);
-            md_strb_push_char(&builder, '\n');
+            md_strb_push_str(builder, defines);
+            md_strb_push_char(builder, '\n');
         }
     }
 
-    build_shader_src(&builder, src, base_include_dir);
+    return build_shader_src(builder, src, base_include_dir);
+}
 
-    str_t final_src = md_strb_to_str(&builder);
+static GLuint compile_shader(str_t final_src, GLenum type) {
+    GLuint shader = glCreateShader(type);
     glShaderSource(shader, 1, &final_src.ptr, 0);
 
     glCompileShader(shader);
@@ -101,10 +107,22 @@ GLuint gl::compile_shader_from_source(str_t src, GLenum type, str_t defines, str
         glDeleteShader(shader);
         shader = 0;
     }
+    return shader;
+}
 
-    md_strb_free(&builder);
+GLuint gl::compile_shader_from_source(str_t src, GLenum type, str_t defines, str_t base_include_dir) {
+    ASSERT(type == GL_VERTEX_SHADER || type == GL_GEOMETRY_SHADER || type == GL_FRAGMENT_SHADER || type == GL_COMPUTE_SHADER ||
+           type == GL_TESS_CONTROL_SHADER || type == GL_TESS_EVALUATION_SHADER);
 
-    return shader;
+    md_strb_t builder = {0};
+    md_strb_init(&builder, md_temp_allocator);
+    defer { md_strb_free(&builder); };
+
+    if (!preprocess_shader_src(&builder, src, defines, base_include_dir)) {
+        return 0;
+    }
+
+    return compile_shader(md_strb_to_str(&builder), type);
 }
 
 GLuint gl::compile_shader_from_file(str_t filename, GLenum type, str_t defines) {
@@ -207,6 +225,192 @@ bool gl::attach_link_detach_with_transform_feedback(GLuint program, const GLuint
     return result;
 }
 
+#define PROGRAM_CACHE_MAGIC   0x50474D56   // 'VMGP'
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t size;                  // Bytes of the binary which follows
+};
+
+static struct {
+    char dir[1024] = "";
+    uint64_t driver = 0;            // Hash of the driver strings, 0 until it has been queried
+    bool supported = false;
+} program_cache;
+
+static inline uint64_t hash_bytes(const void* data, size_t len, uint64_t h = 0xcbf29ce484222325ULL) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Creates each directory along the path, the ones which exist are skipped
+static void make_dirs(const char* path) {
+    char buf[1024];
+    const size_t len = strnlen(path, sizeof(buf) - 1);
+    MEMCPY(buf, path, len);
+    buf[len] = '\0';
+    for (size_t i = 1; i <= len; ++i) {
+        if (buf[i] == '/' || buf[i] == '\\' || buf[i] == '\0') {
+            const char c = buf[i];
+            buf[i] = '\0';
+            make_dir(buf);
+            buf[i] = c;
+        }
+    }
+}
+
+void gl::set_program_cache_dir(str_t dir) {
+    program_cache.dir[0] = '\0';
+    if (str_empty(dir)) return;
+    if (dir.len >= sizeof(program_cache.dir)) {
+        MD_LOG_ERROR("Program cache directory path is too long");
+        return;
+    }
+    str_copy_to_char_buf(program_cache.dir, sizeof(program_cache.dir), dir);
+    make_dirs(program_cache.dir);
+}
+
+static bool program_cache_enabled() {
+    if (program_cache.dir[0] == '\0') return false;
+    if (!program_cache.driver) {
+        GLint num_formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+        program_cache.supported = num_formats > 0 && glProgramBinary != NULL && glGetProgramBinary != NULL;
+
+        const GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        const uint32_t version = PROGRAM_CACHE_VERSION;
+        uint64_t h = hash_bytes(&version, sizeof(version));
+        for (GLenum name : names) {
+            const char* str = (const char*)glGetString(name);
+            if (str) h = hash_bytes(str, strlen(str), h);
+        }
+        program_cache.driver = h ? h : 1;
+    }
+    return program_cache.supported;
+}
+
+static size_t program_cache_path(char* buf, size_t cap, uint64_t key) {
+    const int len = snprintf(buf, cap, "%s/%016llx.bin", program_cache.dir, (unsigned long long)key);
+    return (0 < len && (size_t)len < cap) ? (size_t)len : 0;
+}
+
+static bool load_program_binary(GLuint program, uint64_t key) {
+    char path[1100];
+    const size_t path_len = program_cache_path(path, sizeof(path), key);
+    if (!path_len) return false;
+
+    md_file_o* file = md_file_open({path, path_len}, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+    defer { md_file_close(file); };
+
+    ProgramCacheHeader hdr = {};
+    if (md_file_read(file, &hdr, sizeof(hdr)) != sizeof(hdr)) return false;
+    if (hdr.magic != PROGRAM_CACHE_MAGIC || hdr.version != PROGRAM_CACHE_VERSION || hdr.key != key) return false;
+
+    void* binary = md_alloc(md_heap_allocator, hdr.size);
+    defer { md_free(md_heap_allocator, binary, hdr.size); };
+    if (md_file_read(file, binary, hdr.size) != hdr.size) return false;
+
+    // The driver may reject binaries of other builds even if the strings match, in which case the program is compiled
+    glProgramBinary(program, hdr.format, binary, (GLsizei)hdr.size);
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    return status == GL_TRUE;
+}
+
+static void store_program_binary(GLuint program, uint64_t key) {
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return;
+
+    void* binary = md_alloc(md_heap_allocator, (size_t)size);
+    defer { md_free(md_heap_allocator, binary, (size_t)size); };
+
+    GLenum format = 0;
+    GLsizei length = 0;
+    glGetProgramBinary(program, size, &length, &format, binary);
+    if (length <= 0) return;
+
+    char path[1100];
+    const size_t path_len = program_cache_path(path, sizeof(path), key);
+    if (!path_len) return;
+
+    md_file_o* file = md_file_open({path, path_len}, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open program cache file '%s' for writing", path);
+        return;
+    }
+    defer { md_file_close(file); };
+
+    const ProgramCacheHeader hdr = {PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, format, (uint32_t)length};
+    bool ok = md_file_write(file, &hdr, sizeof(hdr)) == sizeof(hdr);
+    ok &= md_file_write(file, binary, (size_t)length) == (size_t)length;
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write program cache file '%s'", path);
+    }
+}
+
+bool gl::link_program_from_sources(GLuint program, const ShaderSource shaders[], int num_shaders) {
+    ASSERT(program);
+    ASSERT(shaders);
+    ASSERT(0 < num_shaders && num_shaders <= 8);
+
+    md_strb_t builder[8] = {};
+    str_t final_src[8] = {};
+    defer {
+        for (int i = 0; i < num_shaders; ++i) md_strb_free(&builder[i]);
+    };
+
+    for (int i = 0; i < num_shaders; ++i) {
+        md_strb_init(&builder[i], md_temp_allocator);
+        if (!preprocess_shader_src(&builder[i], shaders[i].src, shaders[i].defines, shaders[i].base_include_dir)) {
+            return false;
+        }
+        final_src[i] = md_strb_to_str(&builder[i]);
+    }
+
+    const bool cache = program_cache_enabled();
+    uint64_t key = 0;
+    if (cache) {
+        key = program_cache.driver;
+        for (int i = 0; i < num_shaders; ++i) {
+            key = hash_bytes(&shaders[i].type, sizeof(shaders[i].type), key);
+            key = hash_bytes(final_src[i].ptr, final_src[i].len, key);
+        }
+        if (load_program_binary(program, key)) {
+            return true;
+        }
+    }
+
+    GLuint shader_ids[8] = {};
+    bool result = true;
+    for (int i = 0; i < num_shaders; ++i) {
+        shader_ids[i] = compile_shader(final_src[i], shaders[i].type);
+        result &= shader_ids[i] != 0;
+    }
+
+    if (result) {
+        if (cache) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        result = gl::attach_link_detach(program, shader_ids, num_shaders);
+    }
+
+    for (int i = 0; i < num_shaders; ++i) {
+        if (shader_ids[i]) glDeleteShader(shader_ids[i]);
+    }
+
+    if (result && cache) {
+        store_program_binary(program, key);
+    }
+    return result;
+}
+
 bool gl::init_texture_1D(GLuint* texture, int width, GLenum format) {
     ASSERT(texture);    
 
@@ -378,4 +582,84 @@ bool gl::set_texture_3D_data(GLuint texture, const void* data, GLenum format) {
     glBindTexture(GL_TEXTURE_3D, 0);
 
     return true;
-}
\ No newline at end of file
+}
+bool gl::stream_buffer_supported() {
+    return glBufferStorage != NULL && glFenceSync != NULL;
+}
+
+bool gl::init_stream_buffer(StreamBuffer* stream, size_t region_size, uint32_t num_regions) {
+    ASSERT(stream);
+    ASSERT(0 < num_regions && num_regions <= STREAM_BUFFER_MAX_REGIONS);
+    free_stream_buffer(stream);
+
+    if (!stream_buffer_supported()) {
+        MD_LOG_ERROR("Persistent mapped buffers (ARB_buffer_storage) are not supported");
+        return false;
+    }
+
+    // Keep the regions aligned, so they can be bound as storage buffers
+    GLint align = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+    region_size = ALIGN_TO(region_size, (size_t)MAX(align, 16));
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr size = (GLsizeiptr)(region_size * num_regions);
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, stream->buffer);
+    glBufferStorage(GL_COPY_READ_BUFFER, size, NULL, flags);
+    stream->mapped = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    if (!stream->mapped) {
+        MD_LOG_ERROR("Failed to map stream buffer");
+        glDeleteBuffers(1, &stream->buffer);
+        stream->buffer = 0;
+        return false;
+    }
+
+    stream->region_size = region_size;
+    stream->num_regions = num_regions;
+    stream->region = 0;
+    return true;
+}
+
+void gl::free_stream_buffer(StreamBuffer* stream) {
+    ASSERT(stream);
+    for (uint32_t i = 0; i < STREAM_BUFFER_MAX_REGIONS; ++i) {
+        if (stream->fence[i]) glDeleteSync(stream->fence[i]);
+    }
+    if (stream->buffer) {
+        glBindBuffer(GL_COPY_READ_BUFFER, stream->buffer);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &stream->buffer);
+    }
+    *stream = {};
+}
+
+void* gl::stream_buffer_begin(StreamBuffer* stream, size_t* offset) {
+    ASSERT(stream);
+    ASSERT(stream->mapped);
+
+    stream->region = (stream->region + 1) % stream->num_regions;
+    GLsync& fence = stream->fence[stream->region];
+    if (fence) {
+        GLenum res = glClientWaitSync(fence, 0, 0);
+        while (res == GL_TIMEOUT_EXPIRED) {
+            res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    const size_t region_offset = stream->region * stream->region_size;
+    if (offset) *offset = region_offset;
+    return stream->mapped + region_offset;
+}
+
+void gl::stream_buffer_end(StreamBuffer* stream) {
+    ASSERT(stream);
+    GLsync& fence = stream->fence[stream->region];
+    if (fence) glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
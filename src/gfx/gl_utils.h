@@ -13,6 +13,23 @@ GLuint compile_shader_from_file(str_t filename, GLenum shader_type, str_t define
 bool attach_link_detach(GLuint program, const GLuint shaders[], int num_shaders);
 bool attach_link_detach_with_transform_feedback(GLuint program, const GLuint shaders[], int num_shaders, const char* varyings[], int num_varyings, GLenum buffer_capture_mode);
 
+// Program binary cache
+// Linked programs are stored with glGetProgramBinary in a file per program in the cache directory, which is created if it does not exist
+// The key of a program is a hash of its preprocessed sources and the vendor, renderer and version of the driver, so any change to them recompiles it
+// An empty directory disables the cache
+void set_program_cache_dir(str_t dir);
+
+struct ShaderSource {
+    GLenum type = 0;
+    str_t src = {};
+    str_t defines = {};
+    str_t base_include_dir = {};
+};
+
+// Compiles and links the shaders into program, or loads the binary of the program from the cache
+// State which is set through the API after linking (uniform block bindings, uniform values) is not part of the binary and has to be set after this
+bool link_program_from_sources(GLuint program, const ShaderSource shaders[], int num_shaders);
+
 bool init_texture_1D(GLuint* texture, int width, GLenum format);
 bool init_texture_2D(GLuint* texture, int width, int height, GLenum format);
 bool init_texture_3D(GLuint* texture, int width, int height, int depth, GLenum format);
@@ -24,5 +41,28 @@ bool set_texture_1D_data(GLuint texture, const void* data, GLenum format);
 bool set_texture_2D_data(GLuint texture, const void* data, GLenum format);
 bool set_texture_3D_data(GLuint texture, const void* data, GLenum format);
 
+// Streaming uploads through a persistently mapped buffer (ARB_buffer_storage) split into regions which are guarded by fences
+// The CPU writes into one region while the GPU still consumes the previous ones, so with three regions the CPU should never have to wait
+#define STREAM_BUFFER_MAX_REGIONS 4
+
+struct StreamBuffer {
+    GLuint   buffer = 0;
+    char*    mapped = nullptr;
+    size_t   region_size = 0;
+    uint32_t num_regions = 0;
+    uint32_t region = 0;
+    GLsync   fence[STREAM_BUFFER_MAX_REGIONS] = {};
+};
+
+bool stream_buffer_supported();
+bool init_stream_buffer(StreamBuffer* stream, size_t region_size, uint32_t num_regions = 3);
+void free_stream_buffer(StreamBuffer* stream);
+
+// Returns the mapped memory of the next region and its byte offset within the buffer
+// Only waits if the GPU has not yet finished the commands which read the region the last time it was used
+void* stream_buffer_begin(StreamBuffer* stream, size_t* offset);
+// Call after the commands which read from the region returned by begin have been issued
+void stream_buffer_end(StreamBuffer* stream);
+
 
 }  // namespace gl
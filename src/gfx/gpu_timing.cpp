@@ -0,0 +1,187 @@
+#include "gpu_timing.h"
+
+#include <gfx/gl.h>
+
+#include <core/md_common.h>
+
+#include <string.h>
+
+#define AVG_FEEDBACK 0.95f
+
+namespace gpu_timing {
+
+struct Frame {
+    GLuint query[GPU_TIMING_MAX_SECTIONS * 2] = {};     // Timestamp at the begin and end of each section
+    uint16_t timer[GPU_TIMING_MAX_SECTIONS] = {};
+    uint32_t num_sections = 0;
+    int32_t last_query = -1;                            // The last query issued, which completes after all others
+    bool pending = false;
+};
+
+static struct {
+    bool enabled = false;
+    bool recording = false;     // Enabled and the slot of the frame was free
+    uint32_t frame = 0;
+    Frame frames[GPU_TIMING_FRAMES_IN_FLIGHT] = {};
+
+    int32_t stack[GPU_TIMING_MAX_DEPTH] = {};   // Section of each open level, -1 if it is not recorded
+    uint32_t stack_timer[GPU_TIMING_MAX_DEPTH] = {};
+    uint32_t depth = 0;
+    uint32_t overflow = 0;      // Levels pushed beyond GPU_TIMING_MAX_DEPTH
+
+    Timer timers[GPU_TIMING_MAX_TIMERS] = {};
+    uint32_t num_timers = 0;
+    uint32_t head = 0;
+    uint32_t count = 0;
+} ctx;
+
+void initialize() {
+    for (Frame& f : ctx.frames) {
+        if (!f.query[0]) glGenQueries((int)ARRAY_SIZE(f.query), f.query);
+        f.num_sections = 0;
+        f.last_query = -1;
+        f.pending = false;
+    }
+}
+
+void shutdown() {
+    for (Frame& f : ctx.frames) {
+        if (f.query[0]) glDeleteQueries((int)ARRAY_SIZE(f.query), f.query);
+        f = {};
+    }
+}
+
+void set_enabled(bool enabled) {
+    ctx.enabled = enabled;
+}
+
+bool enabled() {
+    return ctx.enabled;
+}
+
+static uint32_t find_timer(const char* label, uint32_t parent) {
+    for (uint32_t i = 0; i < ctx.num_timers; ++i) {
+        const Timer& t = ctx.timers[i];
+        if (t.parent == parent && (t.label == label || strcmp(t.label, label) == 0)) return i;
+    }
+    if (ctx.num_timers == GPU_TIMING_MAX_TIMERS) return UINT32_MAX;
+    Timer& t = ctx.timers[ctx.num_timers];
+    t = {};
+    t.label = label;
+    t.parent = parent;
+    t.depth = parent ? ctx.timers[parent - 1].depth + 1 : 0;
+    return ctx.num_timers++;
+}
+
+static void resolve_frame(Frame& f) {
+    float ms[GPU_TIMING_MAX_TIMERS] = {};
+    for (uint32_t i = 0; i < f.num_sections; ++i) {
+        GLuint64 beg = 0, end = 0;
+        glGetQueryObjectui64v(f.query[i * 2 + 0], GL_QUERY_RESULT, &beg);
+        glGetQueryObjectui64v(f.query[i * 2 + 1], GL_QUERY_RESULT, &end);
+        if (end > beg) ms[f.timer[i]] += (float)((double)(end - beg) * 1.0e-6);
+    }
+    for (uint32_t i = 0; i < ctx.num_timers; ++i) {
+        Timer& t = ctx.timers[i];
+        t.history[ctx.head] = ms[i];
+        t.avg_ms = ctx.count ? t.avg_ms * AVG_FEEDBACK + ms[i] * (1.0f - AVG_FEEDBACK) : ms[i];
+    }
+    ctx.head = (ctx.head + 1) % GPU_TIMING_HISTORY;
+    ctx.count = MIN(ctx.count + 1, GPU_TIMING_HISTORY);
+    f.pending = false;
+}
+
+void begin_frame() {
+    // Visit the slots from the oldest frame, so the samples are recorded in order
+    for (uint32_t i = 0; i < GPU_TIMING_FRAMES_IN_FLIGHT; ++i) {
+        Frame& f = ctx.frames[(ctx.frame + i) % GPU_TIMING_FRAMES_IN_FLIGHT];
+        if (!f.pending) continue;
+        GLint available = 0;
+        glGetQueryObjectiv(f.query[f.last_query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        resolve_frame(f);
+    }
+
+    Frame& f = ctx.frames[ctx.frame % GPU_TIMING_FRAMES_IN_FLIGHT];
+    ctx.recording = ctx.enabled && f.query[0] && !f.pending;
+    ctx.depth = 0;
+    ctx.overflow = 0;
+    if (ctx.recording) {
+        f.num_sections = 0;
+        f.last_query = -1;
+    }
+}
+
+void end_frame() {
+    if (ctx.recording) {
+        Frame& f = ctx.frames[ctx.frame % GPU_TIMING_FRAMES_IN_FLIGHT];
+        // Sections which are still open are closed at the end of the frame
+        while (ctx.depth > 0) pop_section();
+        f.pending = f.num_sections > 0;
+        ctx.recording = false;
+    }
+    ctx.depth = 0;
+    ctx.overflow = 0;
+    ctx.frame += 1;
+}
+
+void push_section(const char* label) {
+    if (ctx.depth == GPU_TIMING_MAX_DEPTH) {
+        ctx.overflow += 1;
+        return;
+    }
+    const uint32_t level = ctx.depth++;
+    ctx.stack[level] = -1;
+    if (!ctx.recording) return;
+
+    Frame& f = ctx.frames[ctx.frame % GPU_TIMING_FRAMES_IN_FLIGHT];
+    const uint32_t parent = level > 0 ? ctx.stack_timer[level - 1] : 0;
+    const uint32_t timer = (parent == UINT32_MAX || f.num_sections == GPU_TIMING_MAX_SECTIONS) ? UINT32_MAX : find_timer(label, parent);
+    // Sections nested in one which is not recorded are not recorded either
+    ctx.stack_timer[level] = timer == UINT32_MAX ? UINT32_MAX : timer + 1;
+    if (timer == UINT32_MAX) return;
+
+    const uint32_t s = f.num_sections++;
+    f.timer[s] = (uint16_t)timer;
+    glQueryCounter(f.query[s * 2 + 0], GL_TIMESTAMP);
+    f.last_query = (int32_t)(s * 2 + 0);
+    ctx.stack[level] = (int32_t)s;
+}
+
+void pop_section() {
+    if (ctx.overflow > 0) {
+        ctx.overflow -= 1;
+        return;
+    }
+    if (ctx.depth == 0) return;
+    const int32_t s = ctx.stack[--ctx.depth];
+    if (!ctx.recording || s < 0) return;
+
+    Frame& f = ctx.frames[ctx.frame % GPU_TIMING_FRAMES_IN_FLIGHT];
+    glQueryCounter(f.query[s * 2 + 1], GL_TIMESTAMP);
+    f.last_query = s * 2 + 1;
+}
+
+const Timer* timers(size_t* count) {
+    if (count) *count = ctx.num_timers;
+    return ctx.timers;
+}
+
+uint32_t history_head() {
+    return ctx.head;
+}
+
+uint32_t history_count() {
+    return ctx.count;
+}
+
+void clear_history() {
+    for (uint32_t i = 0; i < ctx.num_timers; ++i) {
+        MEMSET(ctx.timers[i].history, 0, sizeof(ctx.timers[i].history));
+        ctx.timers[i].avg_ms = 0;
+    }
+    ctx.head = 0;
+    ctx.count = 0;
+}
+
+}  // namespace gpu_timing
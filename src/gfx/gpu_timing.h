@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gpu_timing {
+
+void initialize();
+void shutdown();
+
+/*
+    Timing of the GPU sections (PUSH_GPU_SECTION / POP_GPU_SECTION) with timestamp queries.
+    The queries of a frame are read back when the GPU has completed them, which is some frames later, so the CPU never waits for them.
+    Timestamps are used instead of GL_TIME_ELAPSED as the sections are nested.
+    A frame is not recorded if the slot it would use is still in flight.
+
+    Each section is identified by its label and the section it is nested in, the time of a section which occurs several times in a frame is summed.
+*/
+
+#define GPU_TIMING_MAX_TIMERS 64
+#define GPU_TIMING_MAX_SECTIONS 128     // Per frame
+#define GPU_TIMING_MAX_DEPTH 16
+#define GPU_TIMING_FRAMES_IN_FLIGHT 4
+#define GPU_TIMING_HISTORY 256          // Frames
+
+struct Timer {
+    const char* label = 0;
+    uint32_t parent = 0;                // Index of the enclosing timer + 1, 0 if it is not nested
+    uint32_t depth = 0;
+    float avg_ms = 0;                   // Moving average
+    float history[GPU_TIMING_HISTORY] = {};
+};
+
+void set_enabled(bool enabled);
+bool enabled();
+
+// Brackets the sections of a frame, the completed frames are read back in begin_frame
+void begin_frame();
+void end_frame();
+
+// The label is expected to be a string literal, as it is referenced until shutdown
+void push_section(const char* label);
+void pop_section();
+
+// Timers in the order they were first recorded, which has the enclosing sections before the nested
+const Timer* timers(size_t* count);
+
+// The history is a ring of GPU_TIMING_HISTORY samples shared by all timers, where head is the index of the next sample
+uint32_t history_head();
+uint32_t history_count();   // Samples recorded, up to GPU_TIMING_HISTORY
+void clear_history();
+
+}  // namespace gpu_timing
@@ -16,45 +16,92 @@ struct Vertex {
     vec3_t normal = {0, 0, 1};
     vec2_t uv = {0, 0};
     uint32_t color = DEFAULT_COLOR;
+    uint32_t matrix = 0;            // Index of the matrices in the uniform block
 };
 
 using Index = uint32_t;
 
-struct DrawCommand {
-    uint32_t offset = 0;
-    uint32_t count = 0;
-    int32_t view_matrix_idx = -1;
-    int32_t proj_matrix_idx = -1;
-    GLenum primitive_type;
+// Primitives are batched per type, all vertices of a render are drawn with at most one draw call per type and batch of matrices
+enum {
+    Primitive_Points,
+    Primitive_Lines,
+    Primitive_Triangles,
+    Primitive_Count
+};
+
+static const GLenum primitive_mode[Primitive_Count] = {GL_POINTS, GL_LINES, GL_TRIANGLES};
+
+// Matrices of a uniform block, the normal matrix is stored as the columns of a mat4 to match the std140 layout of mat3
+struct Matrices {
+    mat4_t mvp;
+    mat4_t normal;
+};
+
+// View and projection matrix pair which the vertices refer to, with the first index of each primitive type recorded while it is current
+struct MatrixPair {
+    int32_t view_matrix_idx;
+    int32_t proj_matrix_idx;
+    uint32_t index_offset[Primitive_Count];
+};
+
+// Number of matrix pairs per uniform block, (16 KB is the minimum guaranteed block size)
+#define MATRIX_BATCH_SIZE (16384 / sizeof(Matrices))
+
+#define STREAM_BUFFER_MIN_SIZE (4 * 1024 * 1024)
+
+#define PERSISTENT_REGION_SIZE (4 * 1024 * 1024)
+
+// Fallback when persistent mapping is not supported, or a render does not fit in a region of the persistent buffer
+// The buffer is appended to without synchronization and orphaned when it wraps around
+// The ranges which are written have not been used by any earlier draws, so the driver never has to wait for the GPU
+struct RingBuffer {
+    GLuint id = 0;
+    GLenum target = 0;
+    size_t capacity = 0;
+    size_t offset = 0;
 };
 
 static mat4_t* matrix_stack;
 
-static DrawCommand* commands;
+static MatrixPair* pairs;
 static Vertex* vertices;
-static Index* indices;
+static Index* indices[Primitive_Count];
 
-static GLuint vbo = 0;
-static GLuint ibo = 0;
+// The vertices, indices and matrices of a render are written into one region of the persistent buffer
+static gl::StreamBuffer persistent = {};
+static RingBuffer vbo = {0, GL_ARRAY_BUFFER};
+static RingBuffer ibo = {0, GL_ELEMENT_ARRAY_BUFFER};
+static RingBuffer ubo = {0, GL_UNIFORM_BUFFER};
 static GLuint vao = 0;
 static GLuint default_tex = 0;
 
 static GLuint program = 0;
 
-static GLint uniform_loc_mvp_matrix = -1;
-static GLint uniform_loc_normal_matrix = -1;
+static GLint uniform_loc_matrix_base = -1;
 static GLint uniform_loc_uv_scale = -1;
 static GLint uniform_loc_point_size = -1;
+static GLint ubo_alignment = 256;
 
 static int32_t curr_view_matrix_idx = -1;
 static int32_t curr_proj_matrix_idx = -1;
+static bool    curr_pair_dirty = true;
 
 static const char* v_shader_src = R"(
 #version 150 core
 #extension GL_ARB_explicit_attrib_location : enable
 
-uniform mat4 u_mvp_matrix;
-uniform mat3 u_normal_matrix;
+#define MATRIX_BATCH_SIZE 128
+
+struct Matrices {
+    mat4 mvp;
+    mat4 normal;
+};
+
+layout(std140) uniform MatrixBlock {
+    Matrices u_matrices[MATRIX_BATCH_SIZE];
+};
+
+uniform uint u_matrix_base = 0U;
 uniform vec2 u_uv_scale = vec2(1,1);
 uniform float u_point_size = 1.f;
 
@@ -62,15 +109,17 @@ layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_uv;
 layout(location = 3) in vec4 in_color;
+layout(location = 4) in uint in_matrix;
 
 out vec3 normal;
 out vec2 uv;
 out vec4 color;
 
 void main() {
-	gl_Position = u_mvp_matrix * vec4(in_position, 1);
+    Matrices m = u_matrices[in_matrix - u_matrix_base];
+	gl_Position = m.mvp * vec4(in_position, 1);
     gl_PointSize = max(u_point_size, 200.f / gl_Position.w);
-	normal = u_normal_matrix * in_normal;
+	normal = mat3(m.normal) * in_normal;
 	uv = in_uv * u_uv_scale;
 	color = in_color;
 }
@@ -100,91 +149,89 @@ void main() {
 }
 )";
 
-static inline void append_draw_command(uint32_t count, GLenum primitive_type) {
-    const uint32_t max_size = (sizeof(Index) == 2 ? 0xFFFFU : 0xFFFFFFFFU);
-    ASSERT(md_array_size(indices) + count < max_size);
-    // Can we append data to previous draw command?
-    DrawCommand* last_cmd = md_array_last(commands);
-    if (last_cmd &&
-        last_cmd->primitive_type == primitive_type &&
-        last_cmd->view_matrix_idx == curr_view_matrix_idx &&
-        last_cmd->proj_matrix_idx == curr_proj_matrix_idx) {
-        uint32_t capacity = max_size - last_cmd->count;
-
-        if (count < capacity) {
-            last_cmd->count += count;
-            return;
-        }
-        else {
-            last_cmd->count += capacity;
-            count -= capacity;
+static_assert(MATRIX_BATCH_SIZE == 128, "The batch size has to match the shader");
+
+static inline size_t align_up(size_t offset, size_t align) {
+    return (offset + align - 1) / align * align;
+}
+
+// Copies bytes into the buffer at an offset which is a multiple of align, which is returned
+static size_t ring_upload(RingBuffer& buf, const void* data, size_t bytes, size_t align) {
+    size_t offset = align_up(buf.offset, align);
+    glBindBuffer(buf.target, buf.id);
+    if (offset + bytes > buf.capacity) {
+        // Orphan the storage, the draws which use it keep the previous storage alive
+        if (bytes > buf.capacity) {
+            buf.capacity = MAX(MAX(bytes, buf.capacity * 2), (size_t)STREAM_BUFFER_MIN_SIZE);
         }
+        glBufferData(buf.target, buf.capacity, NULL, GL_STREAM_DRAW);
+        offset = 0;
+    }
+    void* dst = glMapBufferRange(buf.target, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst) {
+        MEMCPY(dst, data, bytes);
+        glUnmapBuffer(buf.target);
     }
-    ASSERT(curr_view_matrix_idx > -1 && "Immediate Mode View Matrix not set!");
-    ASSERT(curr_proj_matrix_idx > -1 && "Immediate Mode Proj Matrix not set!");
+    buf.offset = offset + bytes;
+    return offset;
+}
 
-    const uint32_t offset = (uint32_t)md_array_size(indices) - count;
-    DrawCommand cmd {offset, count, curr_view_matrix_idx, curr_proj_matrix_idx, primitive_type};
-    
-    md_array_push(commands, cmd, md_heap_allocator);
+// The matrix pair is resolved when the first primitive is added after a matrix has been set
+static inline uint32_t current_matrix() {
+    if (curr_pair_dirty) {
+        ASSERT(curr_view_matrix_idx > -1 && "Immediate Mode View Matrix not set!");
+        ASSERT(curr_proj_matrix_idx > -1 && "Immediate Mode Proj Matrix not set!");
+        MatrixPair pair = {curr_view_matrix_idx, curr_proj_matrix_idx};
+        for (int i = 0; i < Primitive_Count; ++i) {
+            pair.index_offset[i] = (uint32_t)md_array_size(indices[i]);
+        }
+        md_array_push(pairs, pair, md_heap_allocator);
+        curr_pair_dirty = false;
+    }
+    return (uint32_t)md_array_size(pairs) - 1;
 }
 
-void initialize() {
-    constexpr int BUFFER_SIZE = 1024;
-    char buffer[BUFFER_SIZE];
-
-    GLuint v_shader = glCreateShader(GL_VERTEX_SHADER);
-    GLuint f_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(v_shader, 1, &v_shader_src, 0);
-    glShaderSource(f_shader, 1, &f_shader_src, 0);
-    glCompileShader(v_shader);
-    if (gl::get_shader_compile_error(buffer, BUFFER_SIZE, v_shader)) {
-        MD_LOG_ERROR("Error while compiling immediate vertex shader:\n%s\n", buffer);
+static inline void append_primitive(int type, const Vertex* v, uint32_t num_vertices, const Index* idx, uint32_t num_indices) {
+    const uint32_t matrix = current_matrix();
+    const Index base = (Index)md_array_size(vertices);
+    for (uint32_t i = 0; i < num_vertices; ++i) {
+        Vertex* dst = md_array_push(vertices, v[i], md_heap_allocator);
+        dst->matrix = matrix;
     }
-    glCompileShader(f_shader);
-    if (gl::get_shader_compile_error(buffer, BUFFER_SIZE, f_shader)) {
-        MD_LOG_ERROR("Error while compiling immediate fragment shader:\n%s\n", buffer);
+    for (uint32_t i = 0; i < num_indices; ++i) {
+        md_array_push(indices[type], base + idx[i], md_heap_allocator);
     }
+}
+
+void initialize() {
+    const gl::ShaderSource shaders[] = {
+        {GL_VERTEX_SHADER, str_from_cstr(v_shader_src)},
+        {GL_FRAGMENT_SHADER, str_from_cstr(f_shader_src)},
+    };
 
     program = glCreateProgram();
-    glAttachShader(program, v_shader);
-    glAttachShader(program, f_shader);
-    glLinkProgram(program);
-    if (gl::get_program_link_error(buffer, BUFFER_SIZE, program)) {
-        MD_LOG_ERROR("Error while linking immediate program:\n%s\n", buffer);
+    if (!gl::link_program_from_sources(program, shaders, (int)ARRAY_SIZE(shaders))) {
+        MD_LOG_ERROR("Error while building immediate program");
     }
 
-    glDetachShader(program, v_shader);
-    glDetachShader(program, f_shader);
-
-    glDeleteShader(v_shader);
-    glDeleteShader(f_shader);
-
-    uniform_loc_mvp_matrix = glGetUniformLocation(program, "u_mvp_matrix");
-    uniform_loc_normal_matrix = glGetUniformLocation(program, "u_normal_matrix");
+    uniform_loc_matrix_base = glGetUniformLocation(program, "u_matrix_base");
     uniform_loc_uv_scale = glGetUniformLocation(program, "u_uv_scale");
     uniform_loc_point_size = glGetUniformLocation(program, "u_point_size");
+    const GLuint block_idx = glGetUniformBlockIndex(program, "MatrixBlock");
+    if (block_idx != GL_INVALID_INDEX) glUniformBlockBinding(program, block_idx, 0);
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ubo_alignment);
 
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ibo);
+    glGenBuffers(1, &vbo.id);
+    glGenBuffers(1, &ibo.id);
+    glGenBuffers(1, &ubo.id);
+    vbo.capacity = ibo.capacity = ubo.capacity = 0;
+    vbo.offset = ibo.offset = ubo.offset = 0;
 
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position));
-
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal));
-
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, uv));
-
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, color));
 
-    glBindVertexArray(0);
+    if (gl::stream_buffer_supported()) {
+        gl::init_stream_buffer(&persistent, PERSISTENT_REGION_SIZE, STREAM_BUFFER_MAX_REGIONS);
+    }
 
     constexpr uint32_t pixel_data = 0xffffffff;
     if (!default_tex) glGenTextures(1, &default_tex);
@@ -197,34 +244,135 @@ void initialize() {
     glBindTexture(GL_TEXTURE_2D, 0);
 
     md_array_ensure(vertices, 100000, md_heap_allocator);
-    md_array_ensure(indices,  100000, md_heap_allocator);
+    for (int i = 0; i < Primitive_Count; ++i) {
+        md_array_ensure(indices[i], 100000, md_heap_allocator);
+    }
 }
 
 void shutdown() {
-    if (vbo) glDeleteBuffers(1, &vbo);
-    if (ibo) glDeleteBuffers(1, &ibo);
+    if (vbo.id) glDeleteBuffers(1, &vbo.id);
+    if (ibo.id) glDeleteBuffers(1, &ibo.id);
+    if (ubo.id) glDeleteBuffers(1, &ubo.id);
     if (vao) glDeleteVertexArrays(1, &vao);
     if (program) glDeleteProgram(program);
+    gl::free_stream_buffer(&persistent);
+    vbo.id = ibo.id = ubo.id = 0;
+    vao = 0;
+    program = 0;
 }
 
 void set_model_view_matrix(mat4_t model_view_matrix) {
     curr_view_matrix_idx = (int)md_array_size(matrix_stack);
     md_array_push(matrix_stack, model_view_matrix, md_heap_allocator);
+    curr_pair_dirty = true;
 }
 
 void set_proj_matrix(mat4_t proj_matrix) {
     curr_proj_matrix_idx = (int)md_array_size(matrix_stack);
     md_array_push(matrix_stack, proj_matrix, md_heap_allocator);
+    curr_pair_dirty = true;
+}
+
+static void reset() {
+    md_array_shrink(vertices, 0);
+    for (int i = 0; i < Primitive_Count; ++i) {
+        md_array_shrink(indices[i], 0);
+    }
+    md_array_shrink(pairs, 0);
+    md_array_shrink(matrix_stack, 0);
+    curr_view_matrix_idx = -1;
+    curr_proj_matrix_idx = -1;
+    curr_pair_dirty = true;
 }
 
 void render() {
+    const size_t num_vertices = md_array_size(vertices);
+    const size_t num_pairs = md_array_size(pairs);
+    if (num_vertices == 0 || num_pairs == 0) {
+        reset();
+        return;
+    }
+
+    // The matrices are padded to whole batches, so that the range of each batch covers the uniform block
+    const size_t num_batches = (num_pairs + MATRIX_BATCH_SIZE - 1) / MATRIX_BATCH_SIZE;
+    const size_t matrix_bytes = num_batches * MATRIX_BATCH_SIZE * sizeof(Matrices);
+    const size_t vertex_bytes = num_vertices * sizeof(Vertex);
+
+    // The index arrays of all primitive types are uploaded as one
+    size_t index_offset[Primitive_Count];
+    size_t num_indices = 0;
+    for (int i = 0; i < Primitive_Count; ++i) {
+        index_offset[i] = num_indices;
+        num_indices += md_array_size(indices[i]);
+    }
+    const size_t index_bytes = num_indices * sizeof(Index);
+
+    GLuint vbo_id = vbo.id;
+    GLuint ibo_id = ibo.id;
+    GLuint ubo_id = ubo.id;
+    size_t vbo_offset = 0;
+    size_t ibo_offset = 0;
+    size_t ubo_offset = 0;
+
+    // Worst case size of the region, including the padding for the alignment of each array
+    const size_t region_bytes = matrix_bytes + (size_t)ubo_alignment + vertex_bytes + sizeof(Vertex) + index_bytes + sizeof(Index);
+    const bool use_persistent = persistent.mapped && region_bytes <= persistent.region_size;
+
+    char* base = 0;
+    if (use_persistent) {
+        size_t region_offset = 0;
+        base = (char*)gl::stream_buffer_begin(&persistent, &region_offset) - region_offset;
+        ubo_offset = align_up(region_offset, (size_t)ubo_alignment);
+        vbo_offset = align_up(ubo_offset + matrix_bytes, sizeof(Vertex));
+        ibo_offset = align_up(vbo_offset + vertex_bytes, sizeof(Index));
+        vbo_id = ibo_id = ubo_id = persistent.buffer;
+    }
+
+    Matrices* matrices = use_persistent ? (Matrices*)(base + ubo_offset) : (Matrices*)md_alloc(md_heap_allocator, matrix_bytes);
+    MEMSET(matrices, 0, matrix_bytes);
+    for (size_t i = 0; i < num_pairs; ++i) {
+        const mat4_t& view = matrix_stack[pairs[i].view_matrix_idx];
+        const mat4_t& proj = matrix_stack[pairs[i].proj_matrix_idx];
+        matrices[i].mvp = mat4_mul(proj, view);
+        matrices[i].normal = mat4_from_mat3(mat3_from_mat4(mat4_transpose(mat4_inverse(view))));
+    }
+
+    Index* index_data = use_persistent ? (Index*)(base + ibo_offset) : (Index*)md_alloc(md_heap_allocator, MAX(index_bytes, sizeof(Index)));
+    for (int i = 0; i < Primitive_Count; ++i) {
+        MEMCPY(index_data + index_offset[i], indices[i], md_array_bytes(indices[i]));
+    }
+
+    if (use_persistent) {
+        MEMCPY(base + vbo_offset, vertices, vertex_bytes);
+    } else {
+        // The vertex offset is a multiple of the vertex size, so it can be given as the base vertex of the draws
+        ubo_offset = ring_upload(ubo, matrices, matrix_bytes, (size_t)ubo_alignment);
+        vbo_offset = ring_upload(vbo, vertices, vertex_bytes, sizeof(Vertex));
+        ibo_offset = ring_upload(ibo, index_data, index_bytes, sizeof(Index));
+        md_free(md_heap_allocator, matrices, matrix_bytes);
+        md_free(md_heap_allocator, index_data, MAX(index_bytes, sizeof(Index)));
+    }
+    const GLint base_vertex = (GLint)(vbo_offset / sizeof(Vertex));
+
     glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position));
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, md_array_bytes(vertices), vertices, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal));
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, md_array_bytes(indices), indices, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, uv));
+
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, color));
+
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, matrix));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_id);
 
     glEnable(GL_PROGRAM_POINT_SIZE);
     // glEnable(GL_BLEND);
@@ -235,41 +383,33 @@ void render() {
 
     glUniform1f(uniform_loc_point_size, 1.f);
 
-    int current_view_matrix_idx = -999;
-    int current_proj_matrix_idx = -999;
-
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, default_tex);
 
     const GLenum index_type = sizeof(Index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
-    for (size_t i = 0; i < md_array_size(commands); ++i) {
-        const auto& cmd = commands[i];
-        bool update_view = false;
-        bool update_mvp = false;
-        if (cmd.view_matrix_idx != current_view_matrix_idx) {
-            current_view_matrix_idx = cmd.view_matrix_idx;
-            update_view = true;
-            update_mvp = true;
-        }
-        if (cmd.proj_matrix_idx != current_proj_matrix_idx) {
-            current_proj_matrix_idx = cmd.proj_matrix_idx;
-            update_mvp = true;
-        }
+    // The vertices of a pair follow those of the previous pair, so each batch of pairs covers a contiguous range of indices of each type
+    for (size_t b = 0; b < num_batches; ++b) {
+        const size_t pair_beg = b * MATRIX_BATCH_SIZE;
+        const size_t pair_end = MIN(pair_beg + MATRIX_BATCH_SIZE, num_pairs);
 
-        if (update_view) {
-            mat3_t normal_matrix = mat3_from_mat4(mat4_transpose(mat4_inverse(matrix_stack[cmd.view_matrix_idx])));
-            glUniformMatrix3fv(uniform_loc_normal_matrix, 1, GL_FALSE, &normal_matrix.elem[0][0]);
-        }
-        if (update_mvp) {
-            mat4_t mvp_matrix = mat4_mul(matrix_stack[cmd.proj_matrix_idx], matrix_stack[cmd.view_matrix_idx]);
-            glUniformMatrix4fv(uniform_loc_mvp_matrix, 1, GL_FALSE, &mvp_matrix.elem[0][0]);
+        glBindBufferRange(GL_UNIFORM_BUFFER, 0, ubo_id, ubo_offset + pair_beg * sizeof(Matrices), MATRIX_BATCH_SIZE * sizeof(Matrices));
+        glUniform1ui(uniform_loc_matrix_base, (GLuint)pair_beg);
+
+        for (int i = 0; i < Primitive_Count; ++i) {
+            const uint32_t beg = pairs[pair_beg].index_offset[i];
+            const uint32_t end = pair_end < num_pairs ? pairs[pair_end].index_offset[i] : (uint32_t)md_array_size(indices[i]);
+            if (beg == end) continue;
+            const size_t offset = ibo_offset + (index_offset[i] + beg) * sizeof(Index);
+            glDrawElementsBaseVertex(primitive_mode[i], (GLsizei)(end - beg), index_type, (const void*)offset, base_vertex);
         }
-        // @TODO: Enable textures to be bound...
+    }
 
-        glDrawElements(cmd.primitive_type, cmd.count, index_type, (const void*)(cmd.offset * sizeof(Index)));
+    if (use_persistent) {
+        gl::stream_buffer_end(&persistent);
     }
 
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0);
     glBindVertexArray(0);
     glUseProgram(0);
 
@@ -278,79 +418,50 @@ void render() {
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    md_array_shrink(vertices, 0);
-    md_array_shrink(indices,  0);
-    md_array_shrink(commands, 0);
-    md_array_shrink(matrix_stack, 0);
-    curr_view_matrix_idx = -1;
-    curr_proj_matrix_idx = -1;
+    reset();
 }
 
 // PRIMITIVES
 void draw_point(vec3_t pos, uint32_t color) {
-    const Index idx = (Index)md_array_size(vertices);
-
-    Vertex v = {pos, {0, 0, 1}, {0, 0}, color};
-    md_array_push(vertices, v, md_heap_allocator);
-    md_array_push(indices, idx, md_heap_allocator);
-
-    append_draw_command(1, GL_POINTS);
+    const Vertex v = {pos, {0, 0, 1}, {0, 0}, color};
+    const Index idx[1] = {0};
+    append_primitive(Primitive_Points, &v, 1, idx, 1);
 }
 
 void draw_line(vec3_t from, vec3_t to, uint32_t color) {
-    const Index idx = (Index)md_array_size(vertices);
-
-    Vertex v[2] = {
+    const Vertex v[2] = {
         {from, {0, 0, 1}, {0, 0}, color},
         {to,   {0, 0, 1}, {0, 0}, color}
     };
-    md_array_push_array(vertices, v, 2, md_heap_allocator);
-
-    md_array_push(indices, idx + 0, md_heap_allocator);
-    md_array_push(indices, idx + 1, md_heap_allocator);
-
-    append_draw_command(2, GL_LINES);
+    const Index idx[2] = {0, 1};
+    append_primitive(Primitive_Lines, v, 2, idx, 2);
 }
 
 void draw_triangle(vec3_t p0, vec3_t p1, vec3_t p2, uint32_t color) {
-    const Index idx = (Index)md_array_size(vertices);
     const vec3_t normal = vec3_normalize(vec3_cross(vec3_sub(p1, p0), vec3_sub(p2, p0)));
 
-    Vertex v[3] = {
+    const Vertex v[3] = {
         {p0, normal, {0, 0}, color},
         {p1, normal, {0, 0}, color},
         {p2, normal, {0, 0}, color},
     };
-    md_array_push_array(vertices, v, 3, md_heap_allocator);
-
-    md_array_push(indices, idx + 0, md_heap_allocator);
-    md_array_push(indices, idx + 1, md_heap_allocator);
-    md_array_push(indices, idx + 2, md_heap_allocator);
-
-    append_draw_command(3, GL_TRIANGLES);
+    const Index idx[3] = {0, 1, 2};
+    append_primitive(Primitive_Triangles, v, 3, idx, 3);
 }
 
 void draw_plane(vec3_t center, vec3_t u, vec3_t v, uint32_t color) {
-    const Index idx = (Index)md_array_size(vertices);
     const vec3_t normal = vec3_normalize(vec3_cross(u, v));
 
-    Vertex vert[4] = {
+    const Vertex vert[4] = {
         {vec3_sub(center, vec3_add(u, v)), normal, {0, 1}, color},
         {vec3_sub(center, vec3_sub(u, v)), normal, {0, 0}, color},
         {vec3_add(center, vec3_add(u, v)), normal, {1, 1}, color},
         {vec3_add(center, vec3_sub(u, v)), normal, {1, 0}, color},
     };
-    md_array_push_array(vertices, vert, 4, md_heap_allocator);
-
-    md_array_push(indices, idx + 0, md_heap_allocator);
-    md_array_push(indices, idx + 1, md_heap_allocator);
-    md_array_push(indices, idx + 2, md_heap_allocator);
-    md_array_push(indices, idx + 2, md_heap_allocator);
-    md_array_push(indices, idx + 1, md_heap_allocator);
-    md_array_push(indices, idx + 3, md_heap_allocator);
-
-    append_draw_command(6, GL_TRIANGLES);
+    const Index idx[6] = {0, 1, 2, 2, 1, 3};
+    append_primitive(Primitive_Triangles, vert, 4, idx, 6);
 }
 
 void draw_plane_wireframe(vec3_t center, vec3_t vec_u, vec3_t vec_v, uint32_t color, int segments_u, int segments_v) {
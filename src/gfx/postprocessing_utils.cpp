@@ -31,6 +31,7 @@
 #include <core/md_log.h>
 
 #include <gfx/gl_utils.h>
+#include <gfx/gpu_timing.h>
 
 #include <halton.h>
 #include <stdio.h>
@@ -42,9 +43,11 @@
 #define PUSH_GPU_SECTION(lbl)                                                                       \
     {                                                                                               \
         if (glPushDebugGroup) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, GL_KHR_debug, -1, lbl); \
+        gpu_timing::push_section(lbl);                                                              \
     }
 #define POP_GPU_SECTION()                       \
     {                                           \
+        gpu_timing::pop_section();              \
         if (glPopDebugGroup) glPopDebugGroup(); \
     }
 
@@ -56,7 +59,6 @@ namespace postprocessing {
 
 static struct {
     GLuint vao = 0;
-    GLuint v_shader_fs_quad = 0;
     GLuint tex_width = 0;
     GLuint tex_height = 0;
 
@@ -106,6 +108,22 @@ static struct {
             GLuint texture = 0;
             GLuint program = 0;
         } blur;
+
+        // Half resolution with accumulation over frames
+        struct {
+            GLuint fbo = 0;
+            GLuint tex_ao = 0;
+            GLuint tex_blur = 0;
+            GLuint tex_history[2] = {0, 0};
+            GLuint program_persp = 0;
+            GLuint program_ortho = 0;
+            GLuint program_accumulate = 0;
+            GLuint program_upsample = 0;
+            int width = 0;
+            int height = 0;
+            int target = 0;
+            bool history_valid = false;
+        } half_res;
     } ssao;
 
     struct {
@@ -246,26 +264,18 @@ void main() {
 )";
 */
 
+// The programs are fullscreen passes of the fragment shader, which are loaded from the program cache when possible
 static GLuint setup_program_from_source(str_t name, str_t f_shader_src, str_t defines = {}) {
-    GLuint f_shader = gl::compile_shader_from_source(f_shader_src, GL_FRAGMENT_SHADER, defines);
-    GLuint program = 0;
-
-    if (f_shader) {
-        char buffer[1024];
-        program = glCreateProgram();
-
-        glAttachShader(program, gl.v_shader_fs_quad);
-        glAttachShader(program, f_shader);
-        glLinkProgram(program);
-        if (gl::get_program_link_error(buffer, sizeof(buffer), program)) {
-            MD_LOG_ERROR("Error while linking %.*s program:\n%s", (int)name.len, name.ptr, buffer);
-            glDeleteProgram(program);
-            return 0;
-        }
+    const gl::ShaderSource shaders[] = {
+        {GL_VERTEX_SHADER, v_shader_src_fs_quad},
+        {GL_FRAGMENT_SHADER, f_shader_src, defines},
+    };
 
-        glDetachShader(program, gl.v_shader_fs_quad);
-        glDetachShader(program, f_shader);
-        glDeleteShader(f_shader);
+    GLuint program = glCreateProgram();
+    if (!gl::link_program_from_sources(program, shaders, (int)ARRAY_SIZE(shaders))) {
+        MD_LOG_ERROR("Error while building %.*s program", (int)name.len, name.ptr);
+        glDeleteProgram(program);
+        return 0;
     }
 
     return program;
@@ -278,6 +288,9 @@ namespace ssao {
 #define AO_RANDOM_TEX_SIZE 4
 #endif
 
+// Weight of the history when accumulating the half resolution ambient occlusion
+#define AO_HALF_RES_FEEDBACK 0.9f
+
 struct HBAOData {
     float radius_to_screen;
     float neg_inv_r2;
@@ -381,6 +394,10 @@ void initialize(int width, int height) {
     gl.ssao.hbao.program_persp = setup_program_from_source(STR("ssao persp"), {(const char*)ssao_frag, ssao_frag_size}, STR("#define AO_PERSPECTIVE 1"));
     gl.ssao.hbao.program_ortho = setup_program_from_source(STR("ssao ortho"), {(const char*)ssao_frag, ssao_frag_size}, STR("#define AO_PERSPECTIVE 0"));
     gl.ssao.blur.program       = setup_program_from_source(STR("ssao blur"),  {(const char*)blur_frag, blur_frag_size});
+    gl.ssao.half_res.program_persp      = setup_program_from_source(STR("ssao half res persp"), {(const char*)ssao_frag, ssao_frag_size}, STR("#define AO_PERSPECTIVE 1\n#define AO_HALF_RES 1"));
+    gl.ssao.half_res.program_ortho      = setup_program_from_source(STR("ssao half res ortho"), {(const char*)ssao_frag, ssao_frag_size}, STR("#define AO_PERSPECTIVE 0\n#define AO_HALF_RES 1"));
+    gl.ssao.half_res.program_accumulate = setup_program_from_source(STR("ssao accumulate"), {(const char*)accumulate_frag, accumulate_frag_size});
+    gl.ssao.half_res.program_upsample   = setup_program_from_source(STR("ssao upsample"), {(const char*)upsample_frag, upsample_frag_size});
     
     if (!gl.ssao.hbao.fbo) glGenFramebuffers(1, &gl.ssao.hbao.fbo);
     if (!gl.ssao.blur.fbo) glGenFramebuffers(1, &gl.ssao.blur.fbo);
@@ -417,6 +434,31 @@ void initialize(int width, int height) {
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // The half resolution textures are 16-bit, as the accumulation would get stuck on the steps of 8-bit
+    auto& half = gl.ssao.half_res;
+    half.width  = (width  + 1) / 2;
+    half.height = (height + 1) / 2;
+    half.history_valid = false;
+
+    if (!half.fbo) glGenFramebuffers(1, &half.fbo);
+    if (!half.tex_ao) glGenTextures(1, &half.tex_ao);
+    if (!half.tex_blur) glGenTextures(1, &half.tex_blur);
+    if (!half.tex_history[0]) glGenTextures(2, half.tex_history);
+
+    const GLuint half_textures[] = {half.tex_ao, half.tex_blur, half.tex_history[0], half.tex_history[1]};
+    glBindFramebuffer(GL_FRAMEBUFFER, half.fbo);
+    for (int i = 0; i < (int)ARRAY_SIZE(half_textures); ++i) {
+        glBindTexture(GL_TEXTURE_2D, half_textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, half.width, half.height, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, half_textures[i], 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
     glBindBuffer(GL_UNIFORM_BUFFER, gl.ssao.ubo_hbao_data);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(HBAOData), nullptr, GL_DYNAMIC_DRAW);
 }
@@ -434,6 +476,16 @@ void shutdown() {
     if (gl.ssao.hbao.program_persp) glDeleteProgram(gl.ssao.hbao.program_persp);
     if (gl.ssao.hbao.program_ortho) glDeleteProgram(gl.ssao.hbao.program_ortho);
     if (gl.ssao.blur.program) glDeleteProgram(gl.ssao.blur.program);
+
+    auto& half = gl.ssao.half_res;
+    if (half.fbo) glDeleteFramebuffers(1, &half.fbo);
+    if (half.tex_ao) glDeleteTextures(1, &half.tex_ao);
+    if (half.tex_blur) glDeleteTextures(1, &half.tex_blur);
+    if (half.tex_history[0]) glDeleteTextures(2, half.tex_history);
+    if (half.program_persp) glDeleteProgram(half.program_persp);
+    if (half.program_ortho) glDeleteProgram(half.program_ortho);
+    if (half.program_accumulate) glDeleteProgram(half.program_accumulate);
+    if (half.program_upsample) glDeleteProgram(half.program_upsample);
 }
 
 }  // namespace ssao
@@ -446,9 +498,10 @@ static struct {
     struct {
         GLint texture_atom_idx = -1;
         GLint buffer_selection = -1;
+        GLint index_offset = -1;
         GLint highlight = -1;
         GLint selection = -1;
-        GLint outline = -1;
+        GLint outline_alpha = -1;
     } uniform_loc;
 } highlight;
 
@@ -457,13 +510,15 @@ void initialize() {
     if (!highlight.selection_texture) glGenTextures(1, &highlight.selection_texture);
     highlight.uniform_loc.texture_atom_idx = glGetUniformLocation(highlight.program, "u_texture_atom_idx");
     highlight.uniform_loc.buffer_selection = glGetUniformLocation(highlight.program, "u_buffer_selection");
+    highlight.uniform_loc.index_offset = glGetUniformLocation(highlight.program, "u_index_offset");
     highlight.uniform_loc.highlight = glGetUniformLocation(highlight.program, "u_highlight");
     highlight.uniform_loc.selection = glGetUniformLocation(highlight.program, "u_selection");
-    highlight.uniform_loc.outline = glGetUniformLocation(highlight.program, "u_outline");
+    highlight.uniform_loc.outline_alpha = glGetUniformLocation(highlight.program, "u_outline_alpha");
 }
 
 void shutdown() {
     if (highlight.program) glDeleteProgram(highlight.program);
+    if (highlight.selection_texture) glDeleteTextures(1, &highlight.selection_texture);
 }
 }  // namespace highlight
 
@@ -956,8 +1011,6 @@ void shutdown() {
 void initialize(int width, int height) {
     if (!gl.vao) glGenVertexArrays(1, &gl.vao);
 
-    gl.v_shader_fs_quad = gl::compile_shader_from_source(v_shader_src_fs_quad, GL_VERTEX_SHADER);
-
     // LINEARIZE DEPTH
 
     gl.linear_depth.program_persp = setup_program_from_source(STR("linearize depth persp"), f_shader_src_linearize_depth, STR("#version 150 core\n#define PERSPECTIVE 1"));
@@ -1082,7 +1135,6 @@ void shutdown() {
 
     if (gl.vao) glDeleteVertexArrays(1, &gl.vao);
     //if (gl.vbo) glDeleteBuffers(1, &gl.vbo);
-    if (gl.v_shader_fs_quad) glDeleteShader(gl.v_shader_fs_quad);
     if (gl.tmp.fbo) glDeleteFramebuffers(1, &gl.tmp.fbo);
     if (gl.tmp.tex_rgba8) glDeleteTextures(1, &gl.tmp.tex_rgba8);
 }
@@ -1113,6 +1165,9 @@ void apply_ssao(GLuint linear_depth_tex, GLuint normal_tex, const mat4_t& proj_m
     const bool ortho = is_orthographic_proj_matrix(proj_matrix);
     const float sharpness = ssao::compute_sharpness(radius);
 
+    // The history of the half resolution is stale once it is not updated
+    gl.ssao.half_res.history_valid = false;
+
     GLint last_fbo;
     GLint last_viewport[4];
     glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &last_fbo);
@@ -1201,6 +1256,130 @@ void apply_ssao(GLuint linear_depth_tex, GLuint normal_tex, const mat4_t& proj_m
     POP_GPU_SECTION()
 }
 
+// HBAO of one pixel per 2x2 quad which is accumulated over frames at half resolution, then blurred and upsampled with respect to the depth
+void apply_ssao_half_res(GLuint linear_depth_tex, GLuint normal_tex, GLuint velocity_tex, const mat4_t& proj_matrix, float intensity, float radius, float bias, unsigned int frame) {
+    ASSERT(glIsTexture(linear_depth_tex));
+    ASSERT(glIsTexture(normal_tex));
+
+    auto& half = gl.ssao.half_res;
+    const bool ortho = is_orthographic_proj_matrix(proj_matrix);
+    const float sharpness = ssao::compute_sharpness(radius);
+
+    GLint last_fbo;
+    GLint last_viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &last_fbo);
+    glGetIntegerv(GL_VIEWPORT, last_viewport);
+
+    const vec2_t inv_res = vec2_t{1.f / half.width, 1.f / half.height};
+
+    glBindVertexArray(gl.vao);
+
+    // The samples are placed in pixels of the full resolution
+    ssao::setup_ubo_hbao_data(gl.ssao.ubo_hbao_data, gl.tex_width, gl.tex_height, proj_matrix, intensity, radius, bias, frame);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, half.fbo);
+    glViewport(0, 0, half.width, half.height);
+
+    PUSH_GPU_SECTION("HBAO Half Res")
+    GLuint program = ortho ? half.program_ortho : half.program_persp;
+    glUseProgram(program);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, linear_depth_tex);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, normal_tex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, gl.ssao.tex_random);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, gl.ssao.ubo_hbao_data);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "u_control_buffer"), 0);
+    glUniform1i(glGetUniformLocation(program, "u_tex_linear_depth"), 0);
+    glUniform1i(glGetUniformLocation(program, "u_tex_normal"), 1);
+    glUniform1i(glGetUniformLocation(program, "u_tex_random"), 2);
+
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    POP_GPU_SECTION()
+
+    // ACCUMULATE
+    PUSH_GPU_SECTION("HBAO Accumulate")
+    const int dst = half.target;
+    const int src = (half.target + 1) % 2;
+    half.target = src;
+
+    // Without velocity the history cannot be reprojected
+    const float feedback = (half.history_valid && velocity_tex) ? AO_HALF_RES_FEEDBACK : 0.0f;
+
+    glUseProgram(half.program_accumulate);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, half.tex_ao);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, half.tex_history[src]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, velocity_tex);
+    glUniform1i(glGetUniformLocation(half.program_accumulate, "u_tex_ao"), 0);
+    glUniform1i(glGetUniformLocation(half.program_accumulate, "u_tex_history"), 1);
+    glUniform1i(glGetUniformLocation(half.program_accumulate, "u_tex_velocity"), 2);
+    glUniform1f(glGetUniformLocation(half.program_accumulate, "u_feedback"), feedback);
+
+    glDrawBuffer(GL_COLOR_ATTACHMENT2 + dst);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    half.history_valid = true;
+    POP_GPU_SECTION()
+
+    glUseProgram(gl.ssao.blur.program);
+    glUniform1i(glGetUniformLocation(gl.ssao.blur.program, "u_tex_linear_depth"), 0);
+    glUniform1i(glGetUniformLocation(gl.ssao.blur.program, "u_tex_ao"), 1);
+    glUniform1f(glGetUniformLocation(gl.ssao.blur.program, "u_sharpness"), sharpness);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, linear_depth_tex);
+    glActiveTexture(GL_TEXTURE1);
+
+    // BLUR FIRST
+    PUSH_GPU_SECTION("BLUR 1st")
+    glUniform2f(glGetUniformLocation(gl.ssao.blur.program, "u_inv_res_dir"), inv_res.x, 0);
+    glBindTexture(GL_TEXTURE_2D, half.tex_history[dst]);
+    glDrawBuffer(GL_COLOR_ATTACHMENT1);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    POP_GPU_SECTION()
+
+    // BLUR SECOND
+    PUSH_GPU_SECTION("BLUR 2nd")
+    glUniform2f(glGetUniformLocation(gl.ssao.blur.program, "u_inv_res_dir"), 0, inv_res.y);
+    glBindTexture(GL_TEXTURE_2D, half.tex_blur);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    POP_GPU_SECTION()
+
+    // UPSAMPLE
+    PUSH_GPU_SECTION("HBAO Upsample")
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, last_fbo);
+    glViewport(last_viewport[0], last_viewport[1], last_viewport[2], last_viewport[3]);
+
+    glUseProgram(half.program_upsample);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, half.tex_ao);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, linear_depth_tex);
+    glUniform1i(glGetUniformLocation(half.program_upsample, "u_tex_ao"), 0);
+    glUniform1i(glGetUniformLocation(half.program_upsample, "u_tex_linear_depth"), 1);
+    glUniform1f(glGetUniformLocation(half.program_upsample, "u_sharpness"), sharpness);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+    glColorMask(1, 1, 1, 0);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glDisable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glColorMask(1, 1, 1, 1);
+    POP_GPU_SECTION()
+
+    glBindVertexArray(0);
+}
+
 void shade_deferred(GLuint depth_tex, GLuint color_tex, GLuint normal_tex, const mat4_t& inv_proj_matrix, float time) {
     ASSERT(glIsTexture(depth_tex));
     ASSERT(glIsTexture(color_tex));
@@ -1225,7 +1404,7 @@ void shade_deferred(GLuint depth_tex, GLuint color_tex, GLuint normal_tex, const
     glUseProgram(0);
 }
 
-void highlight_selection(GLuint atom_idx_tex, GLuint selection_buffer, const vec3_t& highlight, const vec3_t& selection, const vec3_t& outline) {
+void highlight_selection(GLuint atom_idx_tex, GLuint selection_buffer, const uint32_t index_offset[16], const vec4_t& highlight, const vec4_t& selection, float outline_alpha) {
     ASSERT(glIsTexture(atom_idx_tex));
     ASSERT(glIsBuffer(selection_buffer));
 
@@ -1239,9 +1418,10 @@ void highlight_selection(GLuint atom_idx_tex, GLuint selection_buffer, const vec
     glUseProgram(highlight::highlight.program);
     glUniform1i(highlight::highlight.uniform_loc.texture_atom_idx, 0);
     glUniform1i(highlight::highlight.uniform_loc.buffer_selection, 1);
-    glUniform3fv(highlight::highlight.uniform_loc.highlight, 1, &highlight.x);
-    glUniform3fv(highlight::highlight.uniform_loc.selection, 1, &selection.x);
-    glUniform3fv(highlight::highlight.uniform_loc.outline, 1, &outline.x);
+    glUniform1uiv(highlight::highlight.uniform_loc.index_offset, 16, index_offset);
+    glUniform4fv(highlight::highlight.uniform_loc.highlight, 1, &highlight.x);
+    glUniform4fv(highlight::highlight.uniform_loc.selection, 1, &selection.x);
+    glUniform1f(highlight::highlight.uniform_loc.outline_alpha, outline_alpha);
     glBindVertexArray(gl.vao);
     glDrawArrays(GL_TRIANGLES, 0, 3);
     glBindVertexArray(0);
@@ -1758,7 +1938,11 @@ void shade_and_postprocess(const Descriptor& desc, const ViewParam& view_param)
 
     if (desc.ambient_occlusion.enabled) {
         PUSH_GPU_SECTION("SSAO")
+        if (desc.ambient_occlusion.half_res) {
+            apply_ssao_half_res(gl.linear_depth.texture, desc.input_textures.normal, desc.input_textures.velocity, view_param.matrix.current.proj_jittered, desc.ambient_occlusion.intensity, desc.ambient_occlusion.radius, desc.ambient_occlusion.bias, frame);
+        } else {
             apply_ssao(gl.linear_depth.texture, desc.input_textures.normal, view_param.matrix.current.proj_jittered, desc.ambient_occlusion.intensity, desc.ambient_occlusion.radius, desc.ambient_occlusion.bias, frame);
+        }
         POP_GPU_SECTION()
     }
 
@@ -40,6 +40,7 @@ struct Descriptor {
         float radius = 6.0f;
         float intensity = 3.0f;
         float bias = 0.1f;
+        bool half_res = false;  // One pixel per 2x2 quad each frame, accumulated over frames using the velocity
     } ambient_occlusion;
 
     struct {
@@ -80,6 +81,11 @@ void scale_hsv(GLuint color_tex, vec3_t hsv_scale);
 void blit_texture(GLuint tex);
 void blit_color(vec4_t color);
 
+// Tints the visible highlighted and selected atoms and outlines them in one pass from the picking indices in atom_idx_tex
+// selection_buffer holds a byte of flags (1: highlighted, 2: selected) per index, the index spaces are mapped into it by index_offset,
+// which holds an offset per tag (bits 28-30 of the index) and bond bit (bit 31) as tag * 2 + bond, ~0 if the space is not present
+void highlight_selection(GLuint atom_idx_tex, GLuint selection_buffer, const uint32_t index_offset[16], const vec4_t& highlight, const vec4_t& selection, float outline_alpha = 1.0f);
+
 void blur_texture_gaussian(GLuint tex, int num_passes = 1);
 void blur_texture_box(GLuint tex, int num_passes = 1);
 
@@ -0,0 +1,574 @@
+#include "sdf_utils.h"
+
+#include <gfx/gl.h>
+#include <gfx/gl_utils.h>
+#include <task_system.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#include <shaders.inl>
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+
+#define APRON_SIZE (SDF_BRICK_SIZE + 2)
+#define APRON_VOXELS (APRON_SIZE * APRON_SIZE * APRON_SIZE)
+#define BAND_VOXELS 2.0f        // Width of the band around the surface in voxels
+#define MAX_BUILD_ATTEMPTS 8
+
+namespace sdf {
+
+static struct {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint program = 0;
+    struct {
+        GLint view_proj = -1;
+        GLint inv_view_proj = -1;
+        GLint prev_view_proj = -1;
+        GLint view = -1;
+        GLint jitter_uv = -1;
+        GLint inv_res = -1;
+        GLint box_min = -1;
+        GLint box_ext = -1;
+        GLint origin = -1;
+        GLint voxel_size = -1;
+        GLint band = -1;
+        GLint bricks = -1;
+        GLint atlas_dim = -1;
+        GLint tex_dist = -1;
+        GLint tex_atom = -1;
+        GLint tex_indirection = -1;
+        GLint tex_color = -1;
+    } uniform_loc;
+    bool initialized = false;   // The program is compiled when the first field is drawn
+} gl;
+
+void initialize() {
+    gl.initialized = true;
+    char defines[128];
+    const int len = snprintf(defines, sizeof(defines), "#define BRICK_SIZE %d\n#define APRON_SIZE %d", SDF_BRICK_SIZE, APRON_SIZE);
+    const gl::ShaderSource shaders[] = {
+        {GL_VERTEX_SHADER, {(const char*)sdf_raycast_vert, sdf_raycast_vert_size}},
+        {GL_FRAGMENT_SHADER, {(const char*)sdf_raycast_frag, sdf_raycast_frag_size}, {defines, (size_t)len}},
+    };
+
+    if (!gl.program) gl.program = glCreateProgram();
+    if (!gl::link_program_from_sources(gl.program, shaders, (int)ARRAY_SIZE(shaders))) {
+        MD_LOG_ERROR("shader compilation failed, distance field representations will not be available");
+        return;
+    }
+
+    gl.uniform_loc.view_proj       = glGetUniformLocation(gl.program, "u_view_proj");
+    gl.uniform_loc.inv_view_proj   = glGetUniformLocation(gl.program, "u_inv_view_proj");
+    gl.uniform_loc.prev_view_proj  = glGetUniformLocation(gl.program, "u_prev_view_proj");
+    gl.uniform_loc.view            = glGetUniformLocation(gl.program, "u_view");
+    gl.uniform_loc.jitter_uv       = glGetUniformLocation(gl.program, "u_jitter_uv");
+    gl.uniform_loc.inv_res         = glGetUniformLocation(gl.program, "u_inv_res");
+    gl.uniform_loc.box_min         = glGetUniformLocation(gl.program, "u_box_min");
+    gl.uniform_loc.box_ext         = glGetUniformLocation(gl.program, "u_box_ext");
+    gl.uniform_loc.origin          = glGetUniformLocation(gl.program, "u_origin");
+    gl.uniform_loc.voxel_size      = glGetUniformLocation(gl.program, "u_voxel_size");
+    gl.uniform_loc.band            = glGetUniformLocation(gl.program, "u_band");
+    gl.uniform_loc.bricks          = glGetUniformLocation(gl.program, "u_bricks");
+    gl.uniform_loc.atlas_dim       = glGetUniformLocation(gl.program, "u_atlas_dim");
+    gl.uniform_loc.tex_dist        = glGetUniformLocation(gl.program, "u_tex_dist");
+    gl.uniform_loc.tex_atom        = glGetUniformLocation(gl.program, "u_tex_atom");
+    gl.uniform_loc.tex_indirection = glGetUniformLocation(gl.program, "u_tex_indirection");
+    gl.uniform_loc.tex_color       = glGetUniformLocation(gl.program, "u_tex_color");
+
+    if (!gl.vao) {
+        // Unit cube, the back faces are rasterized so the ray can start inside of the field
+        static const float cube[36][3] = {
+            {0,0,0},{0,1,0},{1,1,0}, {0,0,0},{1,1,0},{1,0,0},
+            {0,0,1},{1,0,1},{1,1,1}, {0,0,1},{1,1,1},{0,1,1},
+            {0,0,0},{0,0,1},{0,1,1}, {0,0,0},{0,1,1},{0,1,0},
+            {1,0,0},{1,1,0},{1,1,1}, {1,0,0},{1,1,1},{1,0,1},
+            {0,0,0},{1,0,0},{1,0,1}, {0,0,0},{1,0,1},{0,0,1},
+            {0,1,0},{0,1,1},{1,1,1}, {0,1,0},{1,1,1},{1,1,0},
+        };
+        glGenVertexArrays(1, &gl.vao);
+        glGenBuffers(1, &gl.vbo);
+        glBindVertexArray(gl.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, gl.vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(cube), cube, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void shutdown() {
+    if (gl.vao) glDeleteVertexArrays(1, &gl.vao);
+    if (gl.vbo) glDeleteBuffers(1, &gl.vbo);
+    if (gl.program) glDeleteProgram(gl.program);
+    gl = {};
+}
+
+// The atoms sorted by brick with their scaled radius
+struct BuildJob {
+    const float* ax;
+    const float* ay;
+    const float* az;
+    const float* ar;
+    const uint32_t* aidx;
+    const uint32_t* brick_offset;   // Offset of the atoms of each brick of the grid, nb + 1 entries
+    const uint32_t* candidates;     // Bricks of the grid which are close to atoms
+    uint8_t* stored;                // Classification of each candidate
+    const uint32_t* slot;           // Slot of each stored candidate
+    FieldData* data;
+    vec3_t origin;
+    float h;
+    float band;
+    int bricks[3];
+    std::atomic_uint32_t num_stored;
+};
+
+// Distance of the voxels of a brick and its apron to the union of the spheres, over the atoms of the brick and its neighbours
+static void compute_brick(const BuildJob& job, uint32_t brick, float* dist, uint32_t* atom) {
+    const int bx = (int)(brick % job.bricks[0]);
+    const int by = (int)(brick / job.bricks[0] % job.bricks[1]);
+    const int bz = (int)(brick / ((uint32_t)job.bricks[0] * job.bricks[1]));
+
+    for (int i = 0; i < APRON_VOXELS; ++i) {
+        dist[i] = job.band;
+        atom[i] = 0;
+    }
+
+    const float inv_h = 1.0f / job.h;
+    const int base[3] = {bx * SDF_BRICK_SIZE - 1, by * SDF_BRICK_SIZE - 1, bz * SDF_BRICK_SIZE - 1};
+    for (int nz = MAX(bz - 1, 0); nz <= MIN(bz + 1, job.bricks[2] - 1); ++nz) {
+        for (int ny = MAX(by - 1, 0); ny <= MIN(by + 1, job.bricks[1] - 1); ++ny) {
+            for (int nx = MAX(bx - 1, 0); nx <= MIN(bx + 1, job.bricks[0] - 1); ++nx) {
+                const uint32_t nb = ((uint32_t)nz * job.bricks[1] + ny) * job.bricks[0] + nx;
+                for (uint32_t j = job.brick_offset[nb]; j < job.brick_offset[nb + 1]; ++j) {
+                    // Voxel coordinates of the atom, voxel centers are at +0.5
+                    const float c[3] = {(job.ax[j] - job.origin.x) * inv_h, (job.ay[j] - job.origin.y) * inv_h, (job.az[j] - job.origin.z) * inv_h};
+                    const float r  = job.ar[j] * inv_h;
+                    const float rb = r + job.band * inv_h;
+                    int lo[3], hi[3];
+                    for (int k = 0; k < 3; ++k) {
+                        lo[k] = MAX((int)floorf(c[k] - rb - 0.5f) - base[k], 0);
+                        hi[k] = MIN((int)ceilf (c[k] + rb - 0.5f) - base[k], APRON_SIZE - 1);
+                    }
+                    for (int z = lo[2]; z <= hi[2]; ++z) {
+                        const float dz = (float)(base[2] + z) + 0.5f - c[2];
+                        for (int y = lo[1]; y <= hi[1]; ++y) {
+                            const float dy = (float)(base[1] + y) + 0.5f - c[1];
+                            for (int x = lo[0]; x <= hi[0]; ++x) {
+                                const float dx = (float)(base[0] + x) + 0.5f - c[0];
+                                const float d = (sqrtf(dx * dx + dy * dy + dz * dz) - r) * job.h;
+                                const int v = (z * APRON_SIZE + y) * APRON_SIZE + x;
+                                if (d < dist[v]) {
+                                    dist[v] = d;
+                                    atom[v] = job.aidx[j];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < APRON_VOXELS; ++i) {
+        dist[i] = MAX(dist[i], -job.band);
+    }
+}
+
+// Bricks which hold the surface, bricks which are entirely inside or outside of the band are not stored
+static bool brick_has_surface(const BuildJob& job, const float* dist) {
+    for (int z = 1; z <= SDF_BRICK_SIZE; ++z) {
+        for (int y = 1; y <= SDF_BRICK_SIZE; ++y) {
+            for (int x = 1; x <= SDF_BRICK_SIZE; ++x) {
+                const float d = dist[(z * APRON_SIZE + y) * APRON_SIZE + x];
+                if (-job.band < d && d < job.band) return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool build_field(FieldData* data, const float* x, const float* y, const float* z, const float* radius, const uint32_t* atoms, size_t num_atoms, float radius_scale, float voxel_size) {
+    ASSERT(data);
+    free_field_data(data);
+    if (num_atoms == 0) return false;
+    ASSERT(x && y && z && radius && atoms);
+
+    vec3_t mn = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+    vec3_t mx = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    float r_max = 0;
+    for (size_t i = 0; i < num_atoms; ++i) {
+        const float r = radius[i] * radius_scale;
+        mn.x = MIN(mn.x, x[i] - r);
+        mn.y = MIN(mn.y, y[i] - r);
+        mn.z = MIN(mn.z, z[i] - r);
+        mx.x = MAX(mx.x, x[i] + r);
+        mx.y = MAX(mx.y, y[i] + r);
+        mx.z = MAX(mx.z, z[i] + r);
+        r_max = MAX(r_max, r);
+    }
+
+    // The spheres which reach a voxel of a brick and its apron have to be binned into the brick or one of its neighbours
+    float h = MAX(MAX(voxel_size, r_max / (SDF_BRICK_SIZE - BAND_VOXELS - 2.0f)), 0.01f);
+
+    float* ax = (float*)md_alloc(md_heap_allocator, sizeof(float) * num_atoms);
+    float* ay = (float*)md_alloc(md_heap_allocator, sizeof(float) * num_atoms);
+    float* az = (float*)md_alloc(md_heap_allocator, sizeof(float) * num_atoms);
+    float* ar = (float*)md_alloc(md_heap_allocator, sizeof(float) * num_atoms);
+    uint32_t* aidx  = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * num_atoms);
+    uint32_t* abin  = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * num_atoms);
+    defer {
+        md_free(md_heap_allocator, ax, sizeof(float) * num_atoms);
+        md_free(md_heap_allocator, ay, sizeof(float) * num_atoms);
+        md_free(md_heap_allocator, az, sizeof(float) * num_atoms);
+        md_free(md_heap_allocator, ar, sizeof(float) * num_atoms);
+        md_free(md_heap_allocator, aidx, sizeof(uint32_t) * num_atoms);
+        md_free(md_heap_allocator, abin, sizeof(uint32_t) * num_atoms);
+    };
+
+    for (int attempt = 0; attempt < MAX_BUILD_ATTEMPTS; ++attempt) {
+        if (task_system::task_cancelled()) return false;
+
+        const float band = BAND_VOXELS * h;
+        const float pad  = band + h;
+        const vec3_t origin = {mn.x - pad, mn.y - pad, mn.z - pad};
+        const vec3_t ext = {mx.x - mn.x + 2 * pad, mx.y - mn.y + 2 * pad, mx.z - mn.z + 2 * pad};
+        const float brick_ext = h * SDF_BRICK_SIZE;
+        const float ext_max = MAX(ext.x, MAX(ext.y, ext.z));
+        if (ext_max > brick_ext * SDF_MAX_GRID_BRICKS) {
+            h = ext_max / (SDF_BRICK_SIZE * SDF_MAX_GRID_BRICKS) * 1.01f;
+            continue;
+        }
+        const int bricks[3] = {
+            MAX((int)ceilf(ext.x / brick_ext), 1),
+            MAX((int)ceilf(ext.y / brick_ext), 1),
+            MAX((int)ceilf(ext.z / brick_ext), 1),
+        };
+        const size_t nb = (size_t)bricks[0] * bricks[1] * bricks[2];
+
+        // Counting sort of the atoms into the bricks
+        uint32_t* brick_offset = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * (nb + 1));
+        uint8_t*  near_atoms   = (uint8_t*) md_alloc(md_heap_allocator, sizeof(uint8_t) * nb);
+        defer {
+            md_free(md_heap_allocator, brick_offset, sizeof(uint32_t) * (nb + 1));
+            md_free(md_heap_allocator, near_atoms, sizeof(uint8_t) * nb);
+        };
+        MEMSET(brick_offset, 0, sizeof(uint32_t) * (nb + 1));
+        MEMSET(near_atoms, 0, sizeof(uint8_t) * nb);
+
+        const float inv_brick_ext = 1.0f / brick_ext;
+        for (size_t i = 0; i < num_atoms; ++i) {
+            const int bx = CLAMP((int)((x[i] - origin.x) * inv_brick_ext), 0, bricks[0] - 1);
+            const int by = CLAMP((int)((y[i] - origin.y) * inv_brick_ext), 0, bricks[1] - 1);
+            const int bz = CLAMP((int)((z[i] - origin.z) * inv_brick_ext), 0, bricks[2] - 1);
+            abin[i] = ((uint32_t)bz * bricks[1] + by) * bricks[0] + bx;
+            brick_offset[abin[i] + 1] += 1;
+        }
+        for (size_t i = 0; i < nb; ++i) {
+            brick_offset[i + 1] += brick_offset[i];
+        }
+        {
+            uint32_t* cursor = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * nb);
+            MEMCPY(cursor, brick_offset, sizeof(uint32_t) * nb);
+            for (size_t i = 0; i < num_atoms; ++i) {
+                const uint32_t j = cursor[abin[i]]++;
+                ax[j] = x[i];
+                ay[j] = y[i];
+                az[j] = z[i];
+                ar[j] = radius[i] * radius_scale;
+                aidx[j] = atoms[i];
+            }
+            md_free(md_heap_allocator, cursor, sizeof(uint32_t) * nb);
+        }
+
+        // The bricks which can hold the surface are the bricks with atoms and their neighbours
+        for (int bz = 0; bz < bricks[2]; ++bz) {
+            for (int by = 0; by < bricks[1]; ++by) {
+                for (int bx = 0; bx < bricks[0]; ++bx) {
+                    const size_t b = ((size_t)bz * bricks[1] + by) * bricks[0] + bx;
+                    if (brick_offset[b] == brick_offset[b + 1]) continue;
+                    for (int nz = MAX(bz - 1, 0); nz <= MIN(bz + 1, bricks[2] - 1); ++nz) {
+                        for (int ny = MAX(by - 1, 0); ny <= MIN(by + 1, bricks[1] - 1); ++ny) {
+                            for (int nx = MAX(bx - 1, 0); nx <= MIN(bx + 1, bricks[0] - 1); ++nx) {
+                                near_atoms[((size_t)nz * bricks[1] + ny) * bricks[0] + nx] = 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        uint32_t num_candidates = 0;
+        for (size_t b = 0; b < nb; ++b) {
+            num_candidates += near_atoms[b];
+        }
+        uint32_t* candidates = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * num_candidates);
+        uint8_t*  stored     = (uint8_t*) md_alloc(md_heap_allocator, sizeof(uint8_t)  * num_candidates);
+        uint32_t* slot       = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * num_candidates);
+        defer {
+            md_free(md_heap_allocator, candidates, sizeof(uint32_t) * num_candidates);
+            md_free(md_heap_allocator, stored, sizeof(uint8_t) * num_candidates);
+            md_free(md_heap_allocator, slot, sizeof(uint32_t) * num_candidates);
+        };
+        for (size_t b = 0, i = 0; b < nb; ++b) {
+            if (near_atoms[b]) candidates[i++] = (uint32_t)b;
+        }
+
+        BuildJob job = {};
+        job.ax = ax;
+        job.ay = ay;
+        job.az = az;
+        job.ar = ar;
+        job.aidx = aidx;
+        job.brick_offset = brick_offset;
+        job.candidates = candidates;
+        job.stored = stored;
+        job.slot = slot;
+        job.data = data;
+        job.origin = origin;
+        job.h = h;
+        job.band = band;
+        MEMCPY(job.bricks, bricks, sizeof(job.bricks));
+
+        // The distances are computed twice, once to find the bricks which hold the surface and once to write them, which keeps the memory to the stored bricks
+        task_system::ID id = task_system::pool_enqueue(STR("##Classify SDF Bricks"), 0, num_candidates, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            BuildJob* job = (BuildJob*)user_data;
+            float dist[APRON_VOXELS];
+            uint32_t atom[APRON_VOXELS];
+            uint32_t count = 0;
+            for (uint32_t i = range_beg; i < range_end; ++i) {
+                compute_brick(*job, job->candidates[i], dist, atom);
+                job->stored[i] = brick_has_surface(*job, dist);
+                count += job->stored[i];
+            }
+            job->num_stored.fetch_add(count, std::memory_order_relaxed);
+        }, &job, 0, task_system::Priority_Interactive);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+
+        if (task_system::task_cancelled()) return false;
+
+        const uint32_t num_stored = job.num_stored.load();
+        if (num_stored > SDF_MAX_BRICKS) {
+            // The area of the surface and thereby the number of bricks which hold it scale with 1 / h^2
+            h *= sqrtf((float)num_stored / SDF_MAX_BRICKS) * 1.05f;
+            continue;
+        }
+        if (num_stored == 0) return false;
+
+        for (uint32_t i = 0, s = 0; i < num_candidates; ++i) {
+            slot[i] = s;
+            s += stored[i];
+        }
+
+        data->origin = origin;
+        data->voxel_size = h;
+        data->band = band;
+        MEMCPY(data->bricks, bricks, sizeof(data->bricks));
+        data->num_stored = num_stored;
+        data->brick_coord = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * num_stored);
+        data->distance    = (float*)   md_alloc(md_heap_allocator, sizeof(float)    * num_stored * APRON_VOXELS);
+        data->atom        = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * num_stored * APRON_VOXELS);
+
+        id = task_system::pool_enqueue(STR("##Write SDF Bricks"), 0, num_candidates, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            BuildJob* job = (BuildJob*)user_data;
+            FieldData* data = job->data;
+            for (uint32_t i = range_beg; i < range_end; ++i) {
+                if (!job->stored[i]) continue;
+                const uint32_t s = job->slot[i];
+                const uint32_t b = job->candidates[i];
+                const uint32_t bx = b % job->bricks[0];
+                const uint32_t by = b / job->bricks[0] % job->bricks[1];
+                const uint32_t bz = b / ((uint32_t)job->bricks[0] * job->bricks[1]);
+                data->brick_coord[s] = bx | (by << 10) | (bz << 20);
+                compute_brick(*job, b, data->distance + (size_t)s * APRON_VOXELS, data->atom + (size_t)s * APRON_VOXELS);
+            }
+        }, &job, 0, task_system::Priority_Interactive);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+
+        return true;
+    }
+
+    MD_LOG_ERROR("Failed to fit the distance field of %zu atoms within %d bricks", num_atoms, SDF_MAX_BRICKS);
+    return false;
+}
+
+void free_field_data(FieldData* data) {
+    ASSERT(data);
+    if (data->brick_coord) md_free(md_heap_allocator, data->brick_coord, sizeof(uint32_t) * data->num_stored);
+    if (data->distance)    md_free(md_heap_allocator, data->distance, sizeof(float) * data->num_stored * APRON_VOXELS);
+    if (data->atom)        md_free(md_heap_allocator, data->atom, sizeof(uint32_t) * data->num_stored * APRON_VOXELS);
+    *data = {};
+}
+
+static void init_texture_3D(GLuint* tex, int w, int h, int d, GLenum internal_format, GLenum format, GLenum type, GLenum filter, const void* pixels) {
+    if (*tex) glDeleteTextures(1, tex);
+    glGenTextures(1, tex);
+    glBindTexture(GL_TEXTURE_3D, *tex);
+    glTexImage3D(GL_TEXTURE_3D, 0, internal_format, w, h, d, 0, format, type, pixels);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void upload_field(Field* field, const FieldData* data) {
+    ASSERT(field);
+    ASSERT(data);
+
+    field->num_stored = 0;
+    if (data->num_stored == 0) return;
+
+    // The stored bricks are packed into an atlas, one brick with its apron per cell
+    const uint32_t n = data->num_stored;
+    const int atlas_bricks[3] = {
+        (int)MIN(n, 32U),
+        (int)MIN((n + 31) / 32, 32U),
+        (int)((n + 1023) / 1024),
+    };
+    const int dim[3] = {atlas_bricks[0] * APRON_SIZE, atlas_bricks[1] * APRON_SIZE, atlas_bricks[2] * APRON_SIZE};
+    init_texture_3D(&field->atlas_distance, dim[0], dim[1], dim[2], GL_R16F, GL_RED, GL_FLOAT, GL_LINEAR, NULL);
+    init_texture_3D(&field->atlas_atom, dim[0], dim[1], dim[2], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, GL_NEAREST, NULL);
+
+    const size_t nb = (size_t)data->bricks[0] * data->bricks[1] * data->bricks[2];
+    uint16_t* indirection = (uint16_t*)md_alloc(md_heap_allocator, sizeof(uint16_t) * 4 * nb);
+    defer { md_free(md_heap_allocator, indirection, sizeof(uint16_t) * 4 * nb); };
+    MEMSET(indirection, 0, sizeof(uint16_t) * 4 * nb);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint32_t s = 0; s < n; ++s) {
+        const int cx = (int)(s % 32);
+        const int cy = (int)(s / 32 % 32);
+        const int cz = (int)(s / 1024);
+        glBindTexture(GL_TEXTURE_3D, field->atlas_distance);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, cx * APRON_SIZE, cy * APRON_SIZE, cz * APRON_SIZE, APRON_SIZE, APRON_SIZE, APRON_SIZE, GL_RED, GL_FLOAT, data->distance + (size_t)s * APRON_VOXELS);
+        glBindTexture(GL_TEXTURE_3D, field->atlas_atom);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, cx * APRON_SIZE, cy * APRON_SIZE, cz * APRON_SIZE, APRON_SIZE, APRON_SIZE, APRON_SIZE, GL_RED_INTEGER, GL_UNSIGNED_INT, data->atom + (size_t)s * APRON_VOXELS);
+
+        const uint32_t c = data->brick_coord[s];
+        const size_t b = ((size_t)(c >> 20) * data->bricks[1] + ((c >> 10) & 1023)) * data->bricks[0] + (c & 1023);
+        indirection[b * 4 + 0] = (uint16_t)cx;
+        indirection[b * 4 + 1] = (uint16_t)cy;
+        indirection[b * 4 + 2] = (uint16_t)cz;
+        indirection[b * 4 + 3] = 1;
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    init_texture_3D(&field->indirection, data->bricks[0], data->bricks[1], data->bricks[2], GL_RGBA16UI, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, GL_NEAREST, indirection);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    field->origin = data->origin;
+    field->voxel_size = data->voxel_size;
+    field->band = data->band;
+    MEMCPY(field->bricks, data->bricks, sizeof(field->bricks));
+    MEMCPY(field->atlas_bricks, atlas_bricks, sizeof(field->atlas_bricks));
+    field->num_stored = n;
+}
+
+void set_field_colors(Field* field, const uint32_t* colors, uint32_t num_atoms) {
+    ASSERT(field);
+    if (!field->color_buf) glGenBuffers(1, &field->color_buf);
+    if (!field->color_tex) glGenTextures(1, &field->color_tex);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, field->color_buf);
+    if (field->num_colors != num_atoms) {
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(uint32_t) * num_atoms, colors, GL_DYNAMIC_DRAW);
+        field->num_colors = num_atoms;
+    } else {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(uint32_t) * num_atoms, colors);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, field->color_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, field->color_buf);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void free_field(Field* field) {
+    ASSERT(field);
+    if (field->atlas_distance) glDeleteTextures(1, &field->atlas_distance);
+    if (field->atlas_atom)     glDeleteTextures(1, &field->atlas_atom);
+    if (field->indirection)    glDeleteTextures(1, &field->indirection);
+    if (field->color_tex)      glDeleteTextures(1, &field->color_tex);
+    if (field->color_buf)      glDeleteBuffers(1, &field->color_buf);
+    *field = {};
+}
+
+void draw_field(const Field& field, const ViewParam& view_param) {
+    if (!gl.initialized) initialize();
+    if (!gl.program || field.num_stored == 0 || !field.color_tex) return;
+
+    const mat4_t view_proj      = view_param.matrix.current.proj_jittered * view_param.matrix.current.view;
+    const mat4_t inv_view_proj  = view_param.matrix.inverse.view * view_param.matrix.inverse.proj_jittered;
+    const mat4_t prev_view_proj = view_param.matrix.previous.proj_jittered * view_param.matrix.previous.view;
+
+    const vec2_t res = view_param.resolution;
+    const vec2_t jitter_uv_curr = view_param.jitter.current / res;
+    const vec2_t jitter_uv_prev = view_param.jitter.previous / res;
+    const vec4_t jitter_uv = {jitter_uv_curr.x, jitter_uv_curr.y, jitter_uv_prev.x, jitter_uv_prev.y};
+    const vec2_t inv_res = {1.0f / res.x, 1.0f / res.y};
+
+    const float brick_ext = field.voxel_size * SDF_BRICK_SIZE;
+    const vec3_t box_ext = {field.bricks[0] * brick_ext, field.bricks[1] * brick_ext, field.bricks[2] * brick_ext};
+    const vec3_t atlas_dim = {(float)(field.atlas_bricks[0] * APRON_SIZE), (float)(field.atlas_bricks[1] * APRON_SIZE), (float)(field.atlas_bricks[2] * APRON_SIZE)};
+
+    const GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, field.atlas_distance);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, field.atlas_atom);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, field.indirection);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, field.color_tex);
+
+    glUseProgram(gl.program);
+    glUniformMatrix4fv(gl.uniform_loc.view_proj, 1, GL_FALSE, &view_proj.elem[0][0]);
+    glUniformMatrix4fv(gl.uniform_loc.inv_view_proj, 1, GL_FALSE, &inv_view_proj.elem[0][0]);
+    glUniformMatrix4fv(gl.uniform_loc.prev_view_proj, 1, GL_FALSE, &prev_view_proj.elem[0][0]);
+    glUniformMatrix4fv(gl.uniform_loc.view, 1, GL_FALSE, &view_param.matrix.current.view.elem[0][0]);
+    glUniform4fv(gl.uniform_loc.jitter_uv, 1, &jitter_uv.x);
+    glUniform2fv(gl.uniform_loc.inv_res, 1, &inv_res.x);
+    glUniform3fv(gl.uniform_loc.box_min, 1, &field.origin.x);
+    glUniform3fv(gl.uniform_loc.box_ext, 1, &box_ext.x);
+    glUniform3fv(gl.uniform_loc.origin, 1, &field.origin.x);
+    glUniform1f(gl.uniform_loc.voxel_size, field.voxel_size);
+    glUniform1f(gl.uniform_loc.band, field.band);
+    glUniform3i(gl.uniform_loc.bricks, field.bricks[0], field.bricks[1], field.bricks[2]);
+    glUniform3fv(gl.uniform_loc.atlas_dim, 1, &atlas_dim.x);
+    glUniform1i(gl.uniform_loc.tex_dist, 0);
+    glUniform1i(gl.uniform_loc.tex_atom, 1);
+    glUniform1i(gl.uniform_loc.tex_indirection, 2);
+    glUniform1i(gl.uniform_loc.tex_color, 3);
+
+    glBindVertexArray(gl.vao);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    glCullFace(GL_BACK);
+    if (!cull_face) glDisable(GL_CULL_FACE);
+}
+
+}  // namespace sdf
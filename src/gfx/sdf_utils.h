@@ -0,0 +1,67 @@
+#pragma once
+
+#include <core/md_vec_math.h>
+#include <gfx/view_param.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace sdf {
+
+// Compiles the program, which is otherwise done when the first field is drawn
+void initialize();
+void shutdown();
+
+/*
+    Sparse signed distance field of a union of spheres, which is ray-cast into the G-Buffer as a representation.
+    The atoms are binned into bricks of SDF_BRICK_SIZE^3 voxels, and the distance is computed for the voxels of the bricks close to atoms.
+    Only the bricks which contain the surface are stored, the distance is clamped to a band of a few voxels around it.
+    Each voxel also holds the index of the closest atom, which gives the color and the picking index of the surface.
+    The voxel size is coarsened for large systems, so that the number of stored bricks stays within SDF_MAX_BRICKS.
+*/
+
+#define SDF_BRICK_SIZE 8
+#define SDF_MAX_BRICKS (1 << 15)
+#define SDF_MAX_GRID_BRICKS 192     // Bricks per axis of the grid
+
+// Result of a build on the CPU, which is uploaded on the main thread
+struct FieldData {
+    vec3_t origin = {};
+    float voxel_size = 0;
+    float band = 0;                 // Distances are clamped to [-band, band]
+    int bricks[3] = {};             // Bricks of the grid
+    uint32_t num_stored = 0;
+    uint32_t* brick_coord = 0;      // Packed grid coordinate of each stored brick (x | y << 10 | z << 20)
+    float* distance = 0;            // (SDF_BRICK_SIZE + 2)^3 voxels per stored brick, with a one voxel apron
+    uint32_t* atom = 0;             // Closest atom of each voxel
+};
+
+// Builds the field of num_atoms spheres, where atoms holds the index in the molecule of each sphere and the radii are scaled by radius_scale
+// The voxels are computed in parallel on the pool, returns false if the build was interrupted or there are no atoms
+bool build_field(FieldData* data, const float* x, const float* y, const float* z, const float* radius, const uint32_t* atoms, size_t num_atoms, float radius_scale, float voxel_size);
+void free_field_data(FieldData* data);
+
+struct Field {
+    uint32_t atlas_distance = 0;    // 3D texture of R16F
+    uint32_t atlas_atom = 0;        // 3D texture of R32UI
+    uint32_t indirection = 0;       // 3D texture of RGBA16UI per brick of the grid: atlas brick coordinate in xyz, stored in w
+    uint32_t color_buf = 0;         // Color of each atom of the molecule (RGBA8)
+    uint32_t color_tex = 0;
+    uint32_t num_colors = 0;
+    vec3_t origin = {};
+    float voxel_size = 0;
+    float band = 0;
+    int bricks[3] = {};
+    int atlas_bricks[3] = {};
+    uint32_t num_stored = 0;
+};
+
+void upload_field(Field* field, const FieldData* data);
+void set_field_colors(Field* field, const uint32_t* colors, uint32_t num_atoms);
+void free_field(Field* field);
+
+// Ray-casts the field into the bound framebuffer, which is expected to have the draw buffers color, normal, velocity and picking at locations 0-3
+// The depth is tested and written, the geometry is static so the velocity is that of the camera
+void draw_field(const Field& field, const ViewParam& view_param);
+
+}  // namespace sdf
@@ -6,12 +6,17 @@
 #include <color_utils.h>
 
 #include <core/md_common.h>
+#include <core/md_allocator.h>
 #include <core/md_log.h>
 #include <core/md_os.h>
 #include <core/md_vec_math.h>
 
 #include <shaders.inl>
 
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
 namespace volume {
 
 static struct {
@@ -20,11 +25,12 @@ static struct {
     GLuint ubo = 0;
     GLuint fbo = 0;
 
-    struct {
+    struct Programs {
         GLuint dvr_only = 0;
         GLuint iso_only = 0;
         GLuint dvr_and_iso = 0;
-    } program;
+    } program, program_bricked;
+    bool initialized = false;   // The programs are compiled on the first render
 } gl;
 
 struct UniformData {
@@ -47,38 +53,33 @@ struct UniformData {
     mat4_t gradient_spacing_tex_space;
 };
 
-void initialize() {
-    GLuint v_shader             = gl::compile_shader_from_source({(const char*)raycaster_vert, raycaster_vert_size}, GL_VERTEX_SHADER);
-    GLuint f_shader_dvr_only    = gl::compile_shader_from_source({(const char*)raycaster_frag, raycaster_frag_size}, GL_FRAGMENT_SHADER, STR("#define INCLUDE_DVR"));
-    GLuint f_shader_iso_only    = gl::compile_shader_from_source({(const char*)raycaster_frag, raycaster_frag_size}, GL_FRAGMENT_SHADER, STR("#define INCLUDE_ISO"));
-    GLuint f_shader_dvr_and_iso = gl::compile_shader_from_source({(const char*)raycaster_frag, raycaster_frag_size}, GL_FRAGMENT_SHADER, STR("#define INCLUDE_DVR\n#define INCLUDE_ISO"));
-    defer {
-        glDeleteShader(v_shader);
-        glDeleteShader(f_shader_dvr_only);
-        glDeleteShader(f_shader_iso_only);
-        glDeleteShader(f_shader_dvr_and_iso);
-    };
-
-    if (v_shader == 0u || f_shader_dvr_only == 0u || f_shader_iso_only == 0u || f_shader_dvr_and_iso == 0u) {
-        MD_LOG_ERROR("shader compilation failed, shader program for raycasting will not be updated");
-        return;
+// Builds the three variants of the raycaster with additional defines
+static void init_programs(decltype(gl.program)* programs, str_t defines) {
+    char buf[256];
+    const char* variants[3] = {"#define INCLUDE_DVR", "#define INCLUDE_ISO", "#define INCLUDE_DVR\n#define INCLUDE_ISO"};
+    GLuint* dst[3] = {&programs->dvr_only, &programs->iso_only, &programs->dvr_and_iso};
+    for (int i = 0; i < 3; ++i) {
+        const int len = snprintf(buf, sizeof(buf), "%s\n%.*s", variants[i], (int)defines.len, defines.ptr);
+        const gl::ShaderSource shaders[] = {
+            {GL_VERTEX_SHADER, {(const char*)raycaster_vert, raycaster_vert_size}},
+            {GL_FRAGMENT_SHADER, {(const char*)raycaster_frag, raycaster_frag_size}, {buf, (size_t)len}},
+        };
+        if (!*dst[i]) *dst[i] = glCreateProgram();
+        if (!gl::link_program_from_sources(*dst[i], shaders, (int)ARRAY_SIZE(shaders))) {
+            MD_LOG_ERROR("shader compilation failed, shader program for raycasting will not be updated");
+        }
     }
+}
 
-    if (!gl.program.dvr_only) gl.program.dvr_only = glCreateProgram();
-    if (!gl.program.iso_only) gl.program.iso_only = glCreateProgram();
-    if (!gl.program.dvr_and_iso) gl.program.dvr_and_iso = glCreateProgram();
+void initialize() {
+    gl.initialized = true;
+    init_programs(&gl.program, {});
 
+    // Programs which sample the volume through the brick indirection
     {
-        const GLuint shaders[] = {v_shader, f_shader_dvr_only};
-        gl::attach_link_detach(gl.program.dvr_only, shaders, (int)ARRAY_SIZE(shaders));
-    }
-    {
-        const GLuint shaders[] = {v_shader, f_shader_iso_only};
-        gl::attach_link_detach(gl.program.iso_only, shaders, (int)ARRAY_SIZE(shaders));
-    }
-    {
-        const GLuint shaders[] = {v_shader, f_shader_dvr_and_iso};
-        gl::attach_link_detach(gl.program.dvr_and_iso, shaders, (int)ARRAY_SIZE(shaders));
+        char buf[64];
+        const int len = snprintf(buf, sizeof(buf), "#define BRICKED_VOLUME\n#define BRICK_SIZE %d", VOLUME_BRICK_SIZE);
+        init_programs(&gl.program_bricked, {buf, (size_t)len});
     }
 
     if (!gl.vbo) {
@@ -114,6 +115,231 @@ void initialize() {
 
 void shutdown() {}
 
+bool init_bricked_volume(BrickedVolume* vol, const float* data, int dim_x, int dim_y, int dim_z, uint32_t format, float threshold) {
+    ASSERT(vol);
+    ASSERT(data);
+    ASSERT(format == GL_R16F || format == GL_R8);
+    free_bricked_volume(vol);
+
+    const int B = VOLUME_BRICK_SIZE;
+    const int S = VOLUME_BRICK_SIZE + 2;    // Stride of a brick in the atlas, including the apron
+    const int dim[3] = {dim_x, dim_y, dim_z};
+    const int bricks[3] = {(dim_x + B - 1) / B, (dim_y + B - 1) / B, (dim_z + B - 1) / B};
+    const size_t num_bricks = (size_t)bricks[0] * bricks[1] * bricks[2];
+    if (num_bricks == 0) return false;
+
+    // The apron replicates the edge voxels of the volume, which matches sampling the dense volume with clamp to edge
+    auto voxel = [data, dim](int x, int y, int z) {
+        x = CLAMP(x, 0, dim[0] - 1);
+        y = CLAMP(y, 0, dim[1] - 1);
+        z = CLAMP(z, 0, dim[2] - 1);
+        return data[((size_t)z * dim[1] + y) * dim[0] + x];
+    };
+
+    uint16_t* index = (uint16_t*)md_alloc(md_heap_allocator, sizeof(uint16_t) * 4 * num_bricks);
+    defer { md_free(md_heap_allocator, index, sizeof(uint16_t) * 4 * num_bricks); };
+
+    // A brick is stored if any of the voxels used when sampling within it (including the apron) is above the threshold
+    float max_value = 0.0f;
+    uint32_t num_stored = 0;
+    for (int bz = 0; bz < bricks[2]; ++bz) {
+        for (int by = 0; by < bricks[1]; ++by) {
+            for (int bx = 0; bx < bricks[0]; ++bx) {
+                float brick_max = -FLT_MAX;
+                for (int z = bz * B - 1; z <= (bz + 1) * B; ++z) {
+                    for (int y = by * B - 1; y <= (by + 1) * B; ++y) {
+                        for (int x = bx * B - 1; x <= (bx + 1) * B; ++x) {
+                            brick_max = MAX(brick_max, voxel(x, y, z));
+                        }
+                    }
+                }
+                uint16_t* entry = index + 4 * (((size_t)bz * bricks[1] + by) * bricks[0] + bx);
+                entry[3] = brick_max > threshold ? 1 : 0;
+                if (entry[3]) {
+                    // Store the linear index of the brick for now, it is resolved to atlas coordinates once the layout is known
+                    entry[0] = (uint16_t)(num_stored & 0xFFFF);
+                    entry[1] = (uint16_t)(num_stored >> 16);
+                    num_stored += 1;
+                    max_value = MAX(max_value, brick_max);
+                }
+            }
+        }
+    }
+
+    // Close to cubic layout of the atlas
+    GLint max_dim = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_dim);
+    const int max_bricks = MIN(max_dim / S, 0xFFFF);
+    const uint32_t n = MAX(num_stored, 1);
+    int atlas_bricks[3];
+    atlas_bricks[0] = MIN((int)ceilf(cbrtf((float)n)), max_bricks);
+    atlas_bricks[1] = MIN((int)ceilf(sqrtf((float)n / atlas_bricks[0])), max_bricks);
+    atlas_bricks[2] = (int)((n + atlas_bricks[0] * atlas_bricks[1] - 1) / (atlas_bricks[0] * atlas_bricks[1]));
+    if (atlas_bricks[2] > max_bricks) {
+        MD_LOG_ERROR("Bricked volume: %u bricks do not fit into a 3D texture", num_stored);
+        return false;
+    }
+
+    const int atlas_dim[3] = {atlas_bricks[0] * S, atlas_bricks[1] * S, atlas_bricks[2] * S};
+    const size_t num_texels = (size_t)atlas_dim[0] * atlas_dim[1] * atlas_dim[2];
+    const size_t texel_size = format == GL_R8 ? sizeof(uint8_t) : sizeof(float);
+    void* atlas = md_alloc(md_heap_allocator, num_texels * texel_size);
+    defer { md_free(md_heap_allocator, atlas, num_texels * texel_size); };
+    MEMSET(atlas, 0, num_texels * texel_size);
+
+    const float r8_scale = max_value > 0.0f ? 255.0f / max_value : 0.0f;
+    for (int bz = 0; bz < bricks[2]; ++bz) {
+        for (int by = 0; by < bricks[1]; ++by) {
+            for (int bx = 0; bx < bricks[0]; ++bx) {
+                uint16_t* entry = index + 4 * (((size_t)bz * bricks[1] + by) * bricks[0] + bx);
+                if (!entry[3]) continue;
+                const uint32_t i = entry[0] | ((uint32_t)entry[1] << 16);
+                entry[0] = (uint16_t)(i % atlas_bricks[0]);
+                entry[1] = (uint16_t)((i / atlas_bricks[0]) % atlas_bricks[1]);
+                entry[2] = (uint16_t)(i / (atlas_bricks[0] * atlas_bricks[1]));
+
+                for (int z = 0; z < S; ++z) {
+                    for (int y = 0; y < S; ++y) {
+                        const size_t dst = ((size_t)(entry[2] * S + z) * atlas_dim[1] + entry[1] * S + y) * atlas_dim[0] + entry[0] * S;
+                        for (int x = 0; x < S; ++x) {
+                            const float v = voxel(bx * B - 1 + x, by * B - 1 + y, bz * B - 1 + z);
+                            if (format == GL_R8) {
+                                ((uint8_t*)atlas)[dst + x] = (uint8_t)CLAMP(v * r8_scale + 0.5f, 0.0f, 255.0f);
+                            } else {
+                                ((float*)atlas)[dst + x] = v;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    GLint unpack_alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glGenTextures(1, &vol->atlas);
+    glBindTexture  (GL_TEXTURE_3D, vol->atlas);
+    glTexStorage3D (GL_TEXTURE_3D, 1, format, atlas_dim[0], atlas_dim[1], atlas_dim[2]);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, atlas_dim[0], atlas_dim[1], atlas_dim[2], GL_RED, format == GL_R8 ? GL_UNSIGNED_BYTE : GL_FLOAT, atlas);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &vol->indirection);
+    glBindTexture  (GL_TEXTURE_3D, vol->indirection);
+    glTexStorage3D (GL_TEXTURE_3D, 1, GL_RGBA16UI, bricks[0], bricks[1], bricks[2]);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, bricks[0], bricks[1], bricks[2], GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, index);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture  (GL_TEXTURE_3D, 0);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+    MEMCPY(vol->dim, dim, sizeof(vol->dim));
+    MEMCPY(vol->bricks, bricks, sizeof(vol->bricks));
+    MEMCPY(vol->atlas_bricks, atlas_bricks, sizeof(vol->atlas_bricks));
+    vol->num_stored = num_stored;
+    vol->format = format;
+    vol->value_scale = format == GL_R8 ? max_value : 1.0f;
+    return true;
+}
+
+void free_bricked_volume(BrickedVolume* vol) {
+    ASSERT(vol);
+    if (vol->atlas) glDeleteTextures(1, &vol->atlas);
+    if (vol->indirection) glDeleteTextures(1, &vol->indirection);
+    *vol = {};
+}
+
+void init_macro_cell_grid(MacroCellGrid* grid, const float* data, int dim_x, int dim_y, int dim_z) {
+    ASSERT(grid);
+    ASSERT(data);
+    free_macro_cell_grid(grid);
+
+    const int C = VOLUME_MACRO_CELL_SIZE;
+    const int dim[3] = {dim_x, dim_y, dim_z};
+    const int cells[3] = {(dim_x + C - 1) / C, (dim_y + C - 1) / C, (dim_z + C - 1) / C};
+    const size_t num_cells = (size_t)cells[0] * cells[1] * cells[2];
+    if (num_cells == 0) return;
+
+    // The voxels are reduced along x first, then the (min, max) rows along y and z, each cell covers a one voxel apron around it
+    const size_t row_count = (size_t)cells[0] * dim[1] * dim[2];
+    vec2_t* rows = (vec2_t*)md_alloc(md_heap_allocator, sizeof(vec2_t) * row_count);
+    vec2_t* range = (vec2_t*)md_alloc(md_heap_allocator, sizeof(vec2_t) * num_cells);
+    defer {
+        md_free(md_heap_allocator, rows, sizeof(vec2_t) * row_count);
+        md_free(md_heap_allocator, range, sizeof(vec2_t) * num_cells);
+    };
+
+    for (int z = 0; z < dim[2]; ++z) {
+        for (int y = 0; y < dim[1]; ++y) {
+            const float* src = data + ((size_t)z * dim[1] + y) * dim[0];
+            vec2_t* dst = rows + ((size_t)z * dim[1] + y) * cells[0];
+            for (int cx = 0; cx < cells[0]; ++cx) {
+                const int beg = MAX(cx * C - 1, 0);
+                const int end = MIN((cx + 1) * C + 1, dim[0]);
+                float mn = FLT_MAX, mx = -FLT_MAX;
+                for (int x = beg; x < end; ++x) {
+                    mn = MIN(mn, src[x]);
+                    mx = MAX(mx, src[x]);
+                }
+                dst[cx] = {mn, mx};
+            }
+        }
+    }
+
+    for (int cz = 0; cz < cells[2]; ++cz) {
+        for (int cy = 0; cy < cells[1]; ++cy) {
+            for (int cx = 0; cx < cells[0]; ++cx) {
+                float mn = FLT_MAX, mx = -FLT_MAX;
+                for (int z = MAX(cz * C - 1, 0); z < MIN((cz + 1) * C + 1, dim[2]); ++z) {
+                    for (int y = MAX(cy * C - 1, 0); y < MIN((cy + 1) * C + 1, dim[1]); ++y) {
+                        const vec2_t r = rows[((size_t)z * dim[1] + y) * cells[0] + cx];
+                        mn = MIN(mn, r.x);
+                        mx = MAX(mx, r.y);
+                    }
+                }
+                range[((size_t)cz * cells[1] + cy) * cells[0] + cx] = {mn, mx};
+            }
+        }
+    }
+
+    glGenTextures(1, &grid->texture);
+    glBindTexture  (GL_TEXTURE_3D, grid->texture);
+    glTexStorage3D (GL_TEXTURE_3D, 1, GL_RG32F, cells[0], cells[1], cells[2]);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, cells[0], cells[1], cells[2], GL_RG, GL_FLOAT, range);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture  (GL_TEXTURE_3D, 0);
+
+    MEMCPY(grid->dim, dim, sizeof(grid->dim));
+    MEMCPY(grid->cells, cells, sizeof(grid->cells));
+}
+
+void free_macro_cell_grid(MacroCellGrid* grid) {
+    ASSERT(grid);
+    if (grid->texture) glDeleteTextures(1, &grid->texture);
+    *grid = {};
+}
+
+size_t bricked_volume_bytes(const BrickedVolume* vol) {
+    ASSERT(vol);
+    const size_t S = VOLUME_BRICK_SIZE + 2;
+    const size_t atlas = (size_t)vol->atlas_bricks[0] * vol->atlas_bricks[1] * vol->atlas_bricks[2] * S * S * S * (vol->format == GL_R8 ? 1 : 2);
+    const size_t index = (size_t)vol->bricks[0] * vol->bricks[1] * vol->bricks[2] * 4 * sizeof(uint16_t);
+    return vol->atlas ? atlas + index : 0;
+}
+
 mat4_t compute_model_to_world_matrix(vec3_t min_world_aabb, vec3_t max_world_aabb) {
     vec3_t ext = max_world_aabb - min_world_aabb;
     vec3_t off = min_world_aabb;
@@ -152,6 +378,7 @@ mat4_t compute_texture_to_model_matrix(int dim_x, int dim_y, int dim_z) {
 
 void render_volume(const RenderDesc& desc) {
     if (!desc.direct_volume_rendering_enabled && !desc.isosurface_enabled && !desc.bounding_box.enabled) return;
+    if (!gl.initialized) initialize();
 
     GLint bound_fbo;
     GLint bound_viewport[4];
@@ -210,14 +437,25 @@ void render_volume(const RenderDesc& desc) {
     glBindTexture(GL_TEXTURE_2D, desc.texture.depth);
 
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_3D, desc.texture.volume);
+    glBindTexture(GL_TEXTURE_3D, desc.bricked ? desc.bricked->atlas : desc.texture.volume);
+
+    if (desc.bricked) {
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, desc.bricked->indirection);
+    }
+
+    if (desc.empty_space.grid) {
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_3D, desc.empty_space.grid->texture);
+    }
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, desc.texture.transfer_function);
 
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, gl.ubo);
 
-    const GLuint program = desc.direct_volume_rendering_enabled ? (desc.isosurface_enabled ? gl.program.dvr_and_iso : gl.program.dvr_only) : gl.program.iso_only;
+    const auto& programs = desc.bricked ? gl.program_bricked : gl.program;
+    const GLuint program = desc.direct_volume_rendering_enabled ? (desc.isosurface_enabled ? programs.dvr_and_iso : programs.dvr_only) : programs.iso_only;
 
     const GLint uniform_block_index     = glGetUniformBlockIndex(program, "UniformData");
     const GLint uniform_loc_tex_tf      = glGetUniformLocation(program, "u_tex_tf");
@@ -257,12 +495,39 @@ void render_volume(const RenderDesc& desc) {
     glUniform1i(uniform_loc_iso_count, iso_count);
     glUniformBlockBinding(program, uniform_block_index, 0);
 
+    if (desc.bricked) {
+        const BrickedVolume& b = *desc.bricked;
+        const int S = VOLUME_BRICK_SIZE + 2;
+        glUniform1i(glGetUniformLocation(program, "u_tex_brick_index"), 3);
+        glUniform3f(glGetUniformLocation(program, "u_volume_dim"), (float)b.dim[0], (float)b.dim[1], (float)b.dim[2]);
+        glUniform3f(glGetUniformLocation(program, "u_atlas_inv_dim"), 1.0f / (b.atlas_bricks[0] * S), 1.0f / (b.atlas_bricks[1] * S), 1.0f / (b.atlas_bricks[2] * S));
+        glUniform1f(glGetUniformLocation(program, "u_value_scale"), b.value_scale);
+    }
+
+    // The sampler is assigned its own unit even when unused, samplers of different types must not share a unit
+    glUniform1i(glGetUniformLocation(program, "u_tex_macro_cells"), 4);
+    glUniform1i(glGetUniformLocation(program, "u_empty_space_skipping"), desc.empty_space.grid ? 1 : 0);
+    if (desc.empty_space.grid) {
+        glUniform1f(glGetUniformLocation(program, "u_macro_cell_voxels"), (float)VOLUME_MACRO_CELL_SIZE);
+        glUniform1f(glGetUniformLocation(program, "u_tf_transparent_below"), desc.empty_space.transparent_below);
+    }
+
     glBindVertexArray(gl.vao);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 42);
     glBindVertexArray(0);
 
     glUseProgram(0);
 
+    if (desc.bricked) {
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+    if (desc.empty_space.grid) {
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
     glDisable(GL_CULL_FACE);
     glDisable(GL_BLEND);
 
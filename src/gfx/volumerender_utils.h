@@ -5,6 +5,7 @@
 
 namespace volume {
 
+// Compiles the programs, which is otherwise done on the first render
 void initialize();
 void shutdown();
 
@@ -15,6 +16,49 @@ mat4_t compute_model_to_texture_matrix(int dim_x, int dim_y, int dim_z);
 
 bool write_volume_to_file(const float* data, int64_t dim_x, int64_t dim_y, int64_t dim_z, str_t path_to_file);
 
+/*
+    Sparse bricked representation of a volume.
+    The volume is split into bricks of VOLUME_BRICK_SIZE^3 voxels, only the bricks which contain values above the threshold are stored.
+    The stored bricks are packed with a one voxel apron into an atlas of reduced precision (R16F or R8), so they can be sampled with hardware trilinear filtering.
+    The indirection texture holds the atlas location of each brick, bricks which are not stored sample as zero.
+*/
+
+#define VOLUME_BRICK_SIZE 16
+
+struct BrickedVolume {
+    uint32_t atlas = 0;         // 3D texture of the stored bricks
+    uint32_t indirection = 0;   // 3D texture with one RGBA16UI texel per brick: atlas brick coordinate in xyz, stored in w
+    int dim[3] = {};            // Voxels of the volume
+    int bricks[3] = {};         // Bricks of the volume
+    int atlas_bricks[3] = {};   // Bricks of the atlas
+    uint32_t num_stored = 0;
+    uint32_t format = 0;        // GL_R16F or GL_R8
+    float value_scale = 1.0f;   // Scale from atlas values to volume values, R8 stores the values normalized by the max value
+};
+
+// Returns false if the stored bricks do not fit into a 3D texture, in which case the volume should be kept dense
+bool init_bricked_volume(BrickedVolume* vol, const float* data, int dim_x, int dim_y, int dim_z, uint32_t format, float threshold = 0.0f);
+void free_bricked_volume(BrickedVolume* vol);
+
+// Size of the atlas and indirection textures
+size_t bricked_volume_bytes(const BrickedVolume* vol);
+
+/*
+    Grid of macro cells of VOLUME_MACRO_CELL_SIZE^3 voxels which holds the min and max of the voxels used when sampling within each cell.
+    The raycaster skips the cells whose range of values is not visible (transparent in the transfer function and not containing an isovalue).
+*/
+
+#define VOLUME_MACRO_CELL_SIZE 8
+
+struct MacroCellGrid {
+    uint32_t texture = 0;   // 3D texture of RG32F (min, max) per cell
+    int dim[3] = {};        // Voxels of the volume
+    int cells[3] = {};
+};
+
+void init_macro_cell_grid(MacroCellGrid* grid, const float* data, int dim_x, int dim_y, int dim_z);
+void free_macro_cell_grid(MacroCellGrid* grid);
+
 /*
     Renders a volumetric texture using OpenGL.
     - volume_texture: An OpenGL 3D texture containing the data
@@ -73,6 +117,15 @@ struct RenderDesc {
     bool direct_volume_rendering_enabled = true;
 
     vec3_t voxel_spacing = {};
+
+    // When set, the volume is sampled from the bricked volume instead of texture.volume
+    const BrickedVolume* bricked = nullptr;
+
+    // Empty-space skipping, disabled without a grid
+    struct {
+        const MacroCellGrid* grid = nullptr;
+        float transparent_below = 0.0f;    // Scaled density below which the transfer function is fully transparent
+    } empty_space;
 };
 
 void render_volume(const RenderDesc& desc);
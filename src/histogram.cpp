@@ -0,0 +1,309 @@
+#include "histogram.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_arena_allocator.h>
+#include <core/md_array.h>
+
+#include <math.h>
+#include <string.h>
+
+// Values are binned in blocks, the bin indices of a block are computed without branches (which vectorizes) before they are accumulated
+#define BIN_BLOCK_VALUES 256
+
+struct BinParams {
+    float range_min;
+    float range_max;
+    float scale;    // num_bins / (range_max - range_min)
+    int   num_bins;
+    int   dim;
+    bool  aggregate;
+};
+
+// Bins the values of num_frames consecutive frames
+static void bin_frames(float* counts, uint32_t* totals, const float* values, size_t num_frames, const BinParams& p) {
+    int32_t idx[BIN_BLOCK_VALUES];
+    float   valid[BIN_BLOCK_VALUES];
+
+    const size_t frames_per_block = MAX(1, BIN_BLOCK_VALUES / p.dim);
+    for (size_t f = 0; f < num_frames; f += frames_per_block) {
+        const size_t n = MIN(frames_per_block, num_frames - f) * p.dim;
+        const float* v = values + f * p.dim;
+
+        for (size_t k = 0; k < n; ++k) {
+            // Out of range values (and NaN) are not counted
+            valid[k] = (p.range_min <= v[k] && v[k] <= p.range_max) ? 1.0f : 0.0f;
+            const float t = (v[k] - p.range_min) * p.scale;
+            idx[k] = CLAMP((int32_t)(valid[k] > 0.0f ? t : 0.0f), 0, p.num_bins - 1);
+        }
+
+        if (p.aggregate || p.dim == 1) {
+            for (size_t k = 0; k < n; ++k) {
+                counts[idx[k]] += valid[k];
+                totals[0] += (uint32_t)valid[k];
+            }
+        } else {
+            for (size_t k = 0; k < n; k += p.dim) {
+                for (int i = 0; i < p.dim; ++i) {
+                    counts[i * p.num_bins + idx[k + i]] += valid[k + i];
+                    totals[i] += (uint32_t)valid[k + i];
+                }
+            }
+        }
+    }
+}
+
+static void bin_chunk(HistogramBatch* batch, uint32_t chunk_idx) {
+    // Locate the job of the chunk
+    const size_t num_jobs = md_array_size(batch->jobs);
+    size_t job_idx = 0;
+    while (job_idx + 1 < num_jobs && batch->jobs[job_idx + 1].chunk_beg <= chunk_idx) ++job_idx;
+    const HistogramJob& job = batch->jobs[job_idx];
+
+    const int hist_dim = histogram_job_dim(job);
+    float* counts = batch->partial_counts[chunk_idx];
+    uint32_t* totals = batch->partial_totals[chunk_idx];
+    MEMSET(counts, 0, sizeof(float) * job.num_bins * hist_dim);
+    MEMSET(totals, 0, sizeof(uint32_t) * hist_dim);
+
+    const float ext = job.range_max - job.range_min;
+    const BinParams p = {job.range_min, job.range_max, ext > 0 ? job.num_bins / ext : 0.0f, job.num_bins, job.dim, job.aggregate};
+
+    const uint32_t beg = job.frame_beg + (chunk_idx - job.chunk_beg) * HISTOGRAM_CHUNK_FRAMES;
+    const uint32_t end = MIN(beg + HISTOGRAM_CHUNK_FRAMES, job.frame_end);
+
+    // The mask is mostly made of long runs (completed frames, the filter range), which are binned as contiguous spans
+    for (uint32_t b = beg; b < end; b += 64) {
+        const uint32_t e = MIN(b + 64, end);
+        const uint64_t count = md_bitfield_popcount_range(&job.mask, b, e);
+        if (count == 0) continue;
+        if (count == e - b) {
+            bin_frames(counts, totals, job.values + (size_t)b * job.dim, e - b, p);
+        } else {
+            for (uint32_t f = b; f < e; ++f) {
+                if (md_bitfield_test_bit(&job.mask, f)) {
+                    bin_frames(counts, totals, job.values + (size_t)f * job.dim, 1, p);
+                }
+            }
+        }
+    }
+}
+
+// Silverman: h = 0.9 min(sigma, IQR / 1.34) n^(-1/5), computed from the bin centers
+static float kde_silverman_bandwidth(const float* counts, int num_bins, float range_min, float bin_width, uint32_t total) {
+    if (total < 2) return bin_width;
+    double sum = 0, sum_sq = 0, n = 0;
+    for (int i = 0; i < num_bins; ++i) {
+        const double x = range_min + (i + 0.5) * bin_width;
+        sum    += counts[i] * x;
+        sum_sq += counts[i] * x * x;
+        n      += counts[i];
+    }
+    if (n < 2) return bin_width;
+    const double mean  = sum / n;
+    const double sigma = sqrt(MAX(0.0, sum_sq / n - mean * mean));
+
+    double acc = 0;
+    double q1 = range_min, q3 = range_min;
+    bool found_q1 = false;
+    for (int i = 0; i < num_bins; ++i) {
+        acc += counts[i];
+        if (!found_q1 && acc >= 0.25 * n) {
+            q1 = range_min + (i + 0.5) * bin_width;
+            found_q1 = true;
+        }
+        if (acc >= 0.75 * n) {
+            q3 = range_min + (i + 0.5) * bin_width;
+            break;
+        }
+    }
+    const double iqr = (q3 - q1) / 1.34;
+    const double spread = iqr > 0 ? MIN(sigma, iqr) : sigma;
+    const double h = 0.9 * spread * pow(n, -0.2);
+    return (float)MAX(h, (double)bin_width);
+}
+
+static void kde_histogram(const HistogramKdeJob& job, int d) {
+    const int num_bins = job.num_bins;
+    const float* counts = job.counts + (size_t)d * num_bins;
+    const int num_out = num_bins / job.factor;
+    float* density = job.density + (size_t)d * num_out;
+    const uint32_t total = job.totals[d];
+
+    const float bin_width = (job.range_max - job.range_min) / num_bins;
+    const float h = job.bandwidth > 0 ? job.bandwidth : kde_silverman_bandwidth(counts, num_bins, job.range_min, bin_width, total);
+    job.bandwidth_used[d] = h;
+    if (total == 0 || !(bin_width > 0)) {
+        MEMSET(density, 0, sizeof(float) * num_out);
+        return;
+    }
+
+    // The kernel is normalized over its bins, so each sample contributes its full weight within the grid
+    const int radius = CLAMP((int)ceilf(4.0f * h / bin_width), 0, num_bins - 1);
+    float* kernel = (float*)task_system::scratch_alloc(sizeof(float) * (2 * radius + 1));
+    double kernel_sum = 0;
+    for (int k = -radius; k <= radius; ++k) {
+        const float t = k * bin_width / h;
+        kernel[k + radius] = expf(-0.5f * t * t);
+        kernel_sum += kernel[k + radius];
+    }
+    const float scl = (float)(1.0 / (kernel_sum * total * bin_width * job.factor));
+
+    for (int o = 0; o < num_out; ++o) {
+        double acc = 0;
+        for (int f = 0; f < job.factor; ++f) {
+            const int i = o * job.factor + f;
+            const int beg = MAX(0, i - radius);
+            const int end = MIN(num_bins - 1, i + radius);
+            for (int j = beg; j <= end; ++j) {
+                acc += counts[j] * kernel[j - i + radius];
+            }
+        }
+        density[o] = (float)acc * scl;
+    }
+}
+
+void histogram_batch_init(HistogramBatch* batch, md_allocator_i* alloc) {
+    ASSERT(batch);
+    ASSERT(alloc);
+    batch->arena = md_arena_allocator_create(alloc, MEGABYTES(1));
+    batch->jobs = 0;
+    batch->kde_jobs = 0;
+    batch->num_chunks = 0;
+    batch->partial_counts = 0;
+    batch->partial_totals = 0;
+}
+
+void histogram_batch_free(HistogramBatch* batch) {
+    ASSERT(batch);
+    if (batch->arena) md_arena_allocator_destroy(batch->arena);
+    *batch = {};
+}
+
+void histogram_batch_clear(HistogramBatch* batch) {
+    ASSERT(batch);
+    ASSERT(batch->arena);
+    md_arena_allocator_reset(batch->arena);
+    batch->jobs = 0;
+    batch->kde_jobs = 0;
+    batch->num_chunks = 0;
+    batch->partial_counts = 0;
+    batch->partial_totals = 0;
+}
+
+void histogram_batch_add(HistogramBatch* batch, const float* values, int dim, int num_bins, float range_min, float range_max, bool aggregate,
+                         const md_bitfield_t* mask, uint32_t frame_beg, uint32_t frame_end, float* counts, uint32_t* totals) {
+    ASSERT(batch);
+    ASSERT(batch->arena);
+    ASSERT(values);
+    ASSERT(mask);
+    ASSERT(counts);
+    ASSERT(totals);
+    ASSERT(dim > 0);
+    ASSERT(num_bins > 0);
+    if (frame_beg >= frame_end) return;
+
+    HistogramJob job;
+    job.values = values;
+    job.dim = dim;
+    job.num_bins = num_bins;
+    job.range_min = range_min;
+    job.range_max = range_max;
+    job.aggregate = aggregate;
+    md_bitfield_init(&job.mask, batch->arena);
+    md_bitfield_copy(&job.mask, mask);
+    job.frame_beg = frame_beg;
+    job.frame_end = frame_end;
+    job.counts = counts;
+    job.totals = totals;
+    job.chunk_beg = batch->num_chunks;
+    job.num_chunks = (frame_end - frame_beg + HISTOGRAM_CHUNK_FRAMES - 1) / HISTOGRAM_CHUNK_FRAMES;
+
+    const int hist_dim = histogram_job_dim(job);
+    for (uint32_t i = 0; i < job.num_chunks; ++i) {
+        md_array_push(batch->partial_counts, (float*)md_alloc(batch->arena, sizeof(float) * num_bins * hist_dim), batch->arena);
+        md_array_push(batch->partial_totals, (uint32_t*)md_alloc(batch->arena, sizeof(uint32_t) * hist_dim), batch->arena);
+    }
+    batch->num_chunks += job.num_chunks;
+    md_array_push(batch->jobs, job, batch->arena);
+}
+
+void histogram_batch_add_kde(HistogramBatch* batch, const float* counts, const uint32_t* totals, int dim, int num_bins, float range_min, float range_max,
+                             float bandwidth, int factor, float* density, float* bandwidth_used) {
+    ASSERT(batch);
+    ASSERT(batch->arena);
+    ASSERT(counts);
+    ASSERT(totals);
+    ASSERT(density);
+    ASSERT(bandwidth_used);
+    ASSERT(dim > 0);
+    ASSERT(factor > 0 && num_bins % factor == 0);
+
+    HistogramKdeJob job;
+    job.counts = counts;
+    job.totals = totals;
+    job.dim = dim;
+    job.num_bins = num_bins;
+    job.range_min = range_min;
+    job.range_max = range_max;
+    job.bandwidth = bandwidth;
+    job.factor = factor;
+    job.density = density;
+    job.bandwidth_used = bandwidth_used;
+    md_array_push(batch->kde_jobs, job, batch->arena);
+}
+
+// One range item per histogram of the estimates
+static task_system::ID enqueue_kde(HistogramBatch* batch, task_system::ID dependency, task_system::Priority priority) {
+    uint32_t num_items = 0;
+    for (size_t i = 0; i < md_array_size(batch->kde_jobs); ++i) {
+        num_items += (uint32_t)batch->kde_jobs[i].dim;
+    }
+    if (num_items == 0) return dependency;
+
+    return task_system::pool_enqueue(STR("##Estimate Densities"), 0, num_items, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        HistogramBatch* batch = (HistogramBatch*)user_data;
+        size_t job_idx = 0;
+        uint32_t item_beg = 0;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            while (i >= item_beg + (uint32_t)batch->kde_jobs[job_idx].dim) {
+                item_beg += (uint32_t)batch->kde_jobs[job_idx].dim;
+                job_idx += 1;
+            }
+            kde_histogram(batch->kde_jobs[job_idx], (int)(i - item_beg));
+        }
+    }, batch, dependency, priority);
+}
+
+task_system::ID histogram_batch_enqueue(HistogramBatch* batch, task_system::Priority priority) {
+    ASSERT(batch);
+    if (batch->num_chunks == 0) return enqueue_kde(batch, task_system::INVALID_ID, priority);
+
+    task_system::ID bin_task = task_system::pool_enqueue(STR("##Bin Histograms"), 0, batch->num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        HistogramBatch* batch = (HistogramBatch*)user_data;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            bin_chunk(batch, i);
+        }
+    }, batch, 0, priority);
+
+    const task_system::ID reduce_task = task_system::pool_enqueue(STR("##Reduce Histograms"), [](void* user_data) {
+        HistogramBatch* batch = (HistogramBatch*)user_data;
+        for (size_t i = 0; i < md_array_size(batch->jobs); ++i) {
+            const HistogramJob& job = batch->jobs[i];
+            const int hist_dim = histogram_job_dim(job);
+            const size_t num_counts = (size_t)job.num_bins * hist_dim;
+            for (uint32_t c = job.chunk_beg; c < job.chunk_beg + job.num_chunks; ++c) {
+                const float* counts = batch->partial_counts[c];
+                const uint32_t* totals = batch->partial_totals[c];
+                for (size_t j = 0; j < num_counts; ++j) {
+                    job.counts[j] += counts[j];
+                }
+                for (int j = 0; j < hist_dim; ++j) {
+                    job.totals[j] += totals[j];
+                }
+            }
+        }
+    }, batch, bin_task, priority);
+
+    return enqueue_kde(batch, reduce_task, priority);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <core/md_bitfield.h>
+#include <task_system.h>
+
+struct md_allocator_i;
+
+// Parallel binning of the temporal values of script properties
+// The frames of every job are split into chunks which are binned independently on the pool into partial bins of their own,
+// a final task sums the partial bins into the counts of each job. Nothing is shared between the chunks, so there is no contention.
+// The counts are not normalized, which is left to the caller.
+
+#define HISTOGRAM_CHUNK_FRAMES 16384
+
+// Bins of the grid which kernel density estimates are computed on, the estimate is averaged down to the requested number of bins
+#define HISTOGRAM_KDE_GRID_BINS 2048
+
+struct HistogramJob {
+    // Input, values are frame major with dim values per frame
+    const float* values = nullptr;
+    int dim = 1;
+    int num_bins = 0;
+    float range_min = 0;
+    float range_max = 0;
+    bool aggregate = false;         // Bin all dimensions into one histogram
+    md_bitfield_t mask = {};        // Frames to bin, owned by the batch
+    uint32_t frame_beg = 0;
+    uint32_t frame_end = 0;
+
+    // Output, (aggregate ? 1 : dim) * num_bins counts and the number of binned values per histogram
+    // The counts are added to, so the caller clears them for a fresh histogram
+    float*    counts = nullptr;
+    uint32_t* totals = nullptr;
+
+    uint32_t chunk_beg = 0;
+    uint32_t num_chunks = 0;
+};
+
+// Kernel density estimate of the counts of a histogram (binned KDE)
+// The counts of the grid are convolved with a Gaussian kernel truncated at 4 bandwidths, which costs O(grid bins x kernel bins)
+// per histogram independent of the number of samples. It runs after the counts of the batch have been reduced.
+struct HistogramKdeJob {
+    const float*    counts = nullptr;   // [dim][num_bins] Counts of the grid
+    const uint32_t* totals = nullptr;   // [dim]
+    int dim = 1;
+    int num_bins = 0;
+    float range_min = 0;
+    float range_max = 0;
+    float bandwidth = 0;                // 0 selects the bandwidth by Silverman's rule of thumb
+
+    // Output, [dim][num_bins / factor] normalized densities and the bandwidth which was used for each histogram
+    int factor = 1;
+    float* density = nullptr;
+    float* bandwidth_used = nullptr;    // [dim]
+};
+
+struct HistogramBatch {
+    md_allocator_i* arena = nullptr;
+    HistogramJob* jobs = nullptr;   // md_array
+    HistogramKdeJob* kde_jobs = nullptr; // md_array
+    uint32_t num_chunks = 0;
+    float**    partial_counts = nullptr;
+    uint32_t** partial_totals = nullptr;
+};
+
+static inline int histogram_job_dim(const HistogramJob& job) { return job.aggregate ? 1 : job.dim; }
+
+void histogram_batch_init(HistogramBatch* batch, md_allocator_i* alloc);
+void histogram_batch_free(HistogramBatch* batch);
+
+// Drops all jobs and releases their memory, must not be called while the batch is computed
+void histogram_batch_clear(HistogramBatch* batch);
+
+// Adds a job for the frames of mask within [frame_beg, frame_end), the mask is copied. counts and totals must stay valid until the batch completes.
+void histogram_batch_add(HistogramBatch* batch, const float* values, int dim, int num_bins, float range_min, float range_max, bool aggregate,
+                         const md_bitfield_t* mask, uint32_t frame_beg, uint32_t frame_end, float* counts, uint32_t* totals);
+
+// Adds an estimate of counts (which may be written by a job of the same batch), num_bins must be a multiple of factor
+// counts, totals, density and bandwidth_used must stay valid until the batch completes.
+void histogram_batch_add_kde(HistogramBatch* batch, const float* counts, const uint32_t* totals, int dim, int num_bins, float range_min, float range_max,
+                             float bandwidth, int factor, float* density, float* bandwidth_used);
+
+// Returns the id of the task which completes once all counts (and estimates) have been written
+task_system::ID histogram_batch_enqueue(HistogramBatch* batch, task_system::Priority priority = task_system::Priority_Interactive);
@@ -131,6 +131,201 @@ bool image_write_bmp(const image_t* img, str_t filename) {
     return result;
 }
 
+#define PNG_STORED_BLOCK_SIZE 65535
+
+static uint32_t png_crc_table[256];
+
+static uint32_t png_crc(uint32_t crc, const uint8_t* data, size_t len) {
+    if (png_crc_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            png_crc_table[i] = c;
+        }
+    }
+    for (size_t i = 0; i < len; ++i) {
+        crc = png_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t png_adler(uint32_t adler, const uint8_t* data, size_t len) {
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (len > 0) {
+        // Largest number of bytes before the sums can overflow
+        const size_t n = len < 5552 ? len : 5552;
+        for (size_t i = 0; i < n; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += n;
+        len -= n;
+    }
+    return (b << 16) | a;
+}
+
+static inline void png_put_u32(uint8_t* dst, uint32_t v) {
+    dst[0] = (uint8_t)(v >> 24);
+    dst[1] = (uint8_t)(v >> 16);
+    dst[2] = (uint8_t)(v >> 8);
+    dst[3] = (uint8_t)(v);
+}
+
+// Chunk data is written in pieces, which are accumulated into the crc
+struct PngChunkWriter {
+    FILE* file;
+    uint32_t crc;
+    bool ok;
+};
+
+static void png_chunk_begin(PngChunkWriter* w, const char* type, uint32_t len) {
+    uint8_t hdr[8];
+    png_put_u32(hdr, len);
+    MEMCPY(hdr + 4, type, 4);
+    w->ok = fwrite(hdr, 1, 8, w->file) == 8;
+    w->crc = png_crc(0xFFFFFFFFU, hdr + 4, 4);
+}
+
+static void png_chunk_write(PngChunkWriter* w, const void* data, size_t len) {
+    w->ok &= fwrite(data, 1, len, w->file) == len;
+    w->crc = png_crc(w->crc, (const uint8_t*)data, len);
+}
+
+static bool png_chunk_end(PngChunkWriter* w) {
+    uint8_t crc[4];
+    png_put_u32(crc, w->crc ^ 0xFFFFFFFFU);
+    w->ok &= fwrite(crc, 1, 4, w->file) == 4;
+    return w->ok;
+}
+
+bool image_png_stream_begin(image_png_stream_t* stream, str_t filename, int32_t width, int32_t height) {
+    ASSERT(stream);
+    ASSERT(width > 0);
+    ASSERT(height > 0);
+
+    FILE* file = open_file(filename);
+    if (!file) return false;
+
+    stream->file = file;
+    stream->width = width;
+    stream->height = height;
+    stream->rows_written = 0;
+    stream->adler = 1;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    bool ok = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature);
+
+    uint8_t ihdr[13];
+    png_put_u32(ihdr + 0, (uint32_t)width);
+    png_put_u32(ihdr + 4, (uint32_t)height);
+    ihdr[8]  = 8;   // Bit depth
+    ihdr[9]  = 6;   // RGBA
+    ihdr[10] = 0;   // Deflate
+    ihdr[11] = 0;   // Adaptive filtering
+    ihdr[12] = 0;   // No interlace
+    PngChunkWriter w = {file};
+    png_chunk_begin(&w, "IHDR", sizeof(ihdr));
+    png_chunk_write(&w, ihdr, sizeof(ihdr));
+    ok &= png_chunk_end(&w);
+
+    // Zlib header: deflate with a 32K window, no preset dictionary and the fastest level
+    static const uint8_t zlib_header[2] = {0x78, 0x01};
+    png_chunk_begin(&w, "IDAT", sizeof(zlib_header));
+    png_chunk_write(&w, zlib_header, sizeof(zlib_header));
+    ok &= png_chunk_end(&w);
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write PNG header");
+        fclose(file);
+        stream->file = 0;
+    }
+    return ok;
+}
+
+// The rows of a band are one IDAT chunk of stored deflate blocks, where each row is preceded by its filter type (none)
+bool image_png_stream_write_rows(image_png_stream_t* stream, const uint32_t* rows, int32_t num_rows) {
+    ASSERT(stream);
+    ASSERT(rows);
+    if (!stream->file) return false;
+    num_rows = MIN(num_rows, stream->height - stream->rows_written);
+    if (num_rows <= 0) return true;
+
+    const size_t row_bytes = (size_t)stream->width * sizeof(uint32_t) + 1;
+    const size_t data_bytes = row_bytes * num_rows;
+    const size_t num_blocks = (data_bytes + PNG_STORED_BLOCK_SIZE - 1) / PNG_STORED_BLOCK_SIZE;
+    const size_t chunk_bytes = data_bytes + num_blocks * 5;
+    if (chunk_bytes > 0x7FFFFFFFU) {
+        MD_LOG_ERROR("Too many rows for one PNG chunk");
+        return false;
+    }
+
+    PngChunkWriter w = {(FILE*)stream->file};
+    png_chunk_begin(&w, "IDAT", (uint32_t)chunk_bytes);
+
+    const uint8_t filter = 0;
+    int32_t row = 0;
+    size_t  off = 0;    // Offset within the row, where 0 is the filter byte
+    size_t remaining = data_bytes;
+    while (remaining > 0) {
+        const uint16_t len = (uint16_t)MIN(remaining, PNG_STORED_BLOCK_SIZE);
+        const uint16_t nlen = (uint16_t)~len;
+        const uint8_t hdr[5] = {0x00, (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)nlen, (uint8_t)(nlen >> 8)};
+        png_chunk_write(&w, hdr, sizeof(hdr));
+        size_t left = len;
+        while (left > 0) {
+            if (off == 0) {
+                png_chunk_write(&w, &filter, 1);
+                stream->adler = png_adler(stream->adler, &filter, 1);
+                off = 1;
+                left -= 1;
+                continue;
+            }
+            const uint8_t* src = (const uint8_t*)(rows + (size_t)row * stream->width) + (off - 1);
+            const size_t n = MIN(left, row_bytes - off);
+            png_chunk_write(&w, src, n);
+            stream->adler = png_adler(stream->adler, src, n);
+            off += n;
+            left -= n;
+            if (off == row_bytes) {
+                row += 1;
+                off = 0;
+            }
+        }
+        remaining -= len;
+    }
+
+    if (!png_chunk_end(&w)) {
+        MD_LOG_ERROR("Failed to write PNG rows");
+        return false;
+    }
+    stream->rows_written += num_rows;
+    return true;
+}
+
+bool image_png_stream_end(image_png_stream_t* stream) {
+    ASSERT(stream);
+    if (!stream->file) return false;
+    FILE* file = (FILE*)stream->file;
+
+    // Final empty stored block, followed by the checksum of the zlib stream
+    uint8_t tail[9] = {0x01, 0x00, 0x00, 0xFF, 0xFF};
+    png_put_u32(tail + 5, stream->adler);
+    PngChunkWriter w = {file};
+    png_chunk_begin(&w, "IDAT", sizeof(tail));
+    png_chunk_write(&w, tail, sizeof(tail));
+    bool ok = png_chunk_end(&w);
+
+    png_chunk_begin(&w, "IEND", 0);
+    ok &= png_chunk_end(&w);
+
+    fclose(file);
+    stream->file = 0;
+    return ok && stream->rows_written == stream->height;
+}
+
 // All this is ported and stolen from here and needs to be verified
 // http://blog.ivank.net/fastest-gaussian-blur.html
 
@@ -24,4 +24,20 @@ bool image_write_jpg(const image_t* img, str_t filename, int quality);
 bool image_write_png(const image_t* img, str_t filename);
 bool image_write_bmp(const image_t* img, str_t filename);
 
+// PNG (RGBA8) which is written a band of rows at a time, for images which do not fit in memory
+// The rows are stored without compression, as the deflate stream can not be split over bands
+typedef struct image_png_stream_t {
+    void* file;
+    int32_t width;
+    int32_t height;
+    int32_t rows_written;
+    uint32_t adler;
+} image_png_stream_t;
+
+bool image_png_stream_begin(image_png_stream_t* stream, str_t filename, int32_t width, int32_t height);
+// Rows are top to bottom with width pixels each
+bool image_png_stream_write_rows(image_png_stream_t* stream, const uint32_t* rows, int32_t num_rows);
+// Returns false if not all rows were written
+bool image_png_stream_end(image_png_stream_t* stream);
+
 void image_gaussian_blur(image_t* img, int32_t kernel_width_in_pixels = 4);
@@ -1,6 +1,7 @@
 #include "loader.h"
 
 #include <core/md_allocator.h>
+#include <core/md_arena_allocator.h>
 #include <core/md_array.h>
 #include <core/md_log.h>
 #include <core/md_simd.h>
@@ -18,9 +19,302 @@
 #include <md_frame_cache.h>
 #include <md_util.h>
 
+#include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <atomic_queue.h>
 
 #include "task_system.h"
+#include "frame_block_cache.h"
+#include "eval_cache.h"
+#include "memory_tracker.h"
+#include "chunked_trajectory.h"
+#include "numa_memory.h"
+
+#define READ_AHEAD_MAX_SLOTS 256
+#define READ_AHEAD_DEFAULT_IO_DEPTH 32
+#define READ_AHEAD_DEFAULT_DECODE_DEPTH 64
+#define READ_AHEAD_MIN_DEPTH 16
+
+// Deperiodization of frames reuses the images of recently deperiodized frames which are at most this many frames away
+#define DEPERIODIZE_HINT_SLOTS 4
+#define DEPERIODIZE_HINT_MAX_FRAMES 16
+
+#ifndef VIAMD_FRAME_CACHE_COMPRESSED
+#define VIAMD_FRAME_CACHE_COMPRESSED 0
+#endif
+
+// Fraction of the frame cache budget which is used for the derived (transformed) tier, the rest goes to the raw tier
+#if VIAMD_FRAME_CACHE_COMPRESSED
+#define DERIVED_CACHE_FRACTION 0.125
+#else
+#define DERIVED_CACHE_FRACTION 0.25
+#endif
+
+// Chunked parsing of large structure files (PDB and GRO)
+// The records of the atoms are split on line boundaries into chunks which are parsed in parallel on the pool. The parsed records are
+// concatenated in file order and the molecule is initialized from them once, as if the file had been parsed in one go.
+// Files smaller than CHUNKED_PARSE_MIN_BYTES, or which cannot be split, are passed on to the regular loader.
+#define CHUNKED_PARSE_MIN_BYTES   MEGABYTES(32)
+#define CHUNKED_PARSE_CHUNK_BYTES MEGABYTES(8)
+#define CHUNKED_PARSE_MAX_CHUNKS  256
+
+struct ParseChunk {
+    str_t text;
+    md_allocator_i* arena;
+    md_pdb_data_t pdb;
+    md_gro_data_t gro;
+    bool ok;
+};
+
+struct ChunkedParse {
+    ParseChunk* chunks;
+    size_t num_chunks;
+    str_t gro_box;          // Last line of a GRO file, which every chunk needs to be a valid file of its own
+};
+
+static inline size_t next_line(str_t str, size_t pos) {
+    while (pos < str.len && str.ptr[pos] != '\n') ++pos;
+    return MIN(pos + 1, str.len);
+}
+
+static inline bool pdb_atom_record(str_t str, size_t pos) {
+    return pos + 6 <= str.len && (strncmp(str.ptr + pos, "ATOM  ", 6) == 0 || strncmp(str.ptr + pos, "HETATM", 6) == 0);
+}
+
+// Splits [beg, end) into chunks which start at lines that pass the predicate, returns the number of bounds written (chunks + 1)
+static size_t split_lines(size_t* bounds, str_t str, size_t beg, size_t end, bool (*starts_chunk)(str_t, size_t)) {
+    const size_t by_size = (end - beg) / CHUNKED_PARSE_CHUNK_BYTES;
+    const size_t by_threads = (size_t)task_system::pool_num_threads() * 4;
+    const size_t n = CLAMP(MIN(by_size, by_threads), 1, CHUNKED_PARSE_MAX_CHUNKS);
+
+    size_t count = 0;
+    bounds[count++] = beg;
+    for (size_t i = 1; i < n; ++i) {
+        size_t pos = beg + (end - beg) / n * i;
+        if (pos <= bounds[count - 1]) continue;
+        if (str.ptr[pos - 1] != '\n') pos = next_line(str, pos);
+        while (pos < end && starts_chunk && !starts_chunk(str, pos)) pos = next_line(str, pos);
+        if (pos < end) bounds[count++] = pos;
+    }
+    bounds[count++] = end;
+    return count;
+}
+
+static void free_chunked_parse(ChunkedParse* parse) {
+    for (size_t i = 0; i < parse->num_chunks; ++i) {
+        if (parse->chunks[i].arena) md_arena_allocator_destroy(parse->chunks[i].arena);
+    }
+    if (parse->chunks) md_free(md_heap_allocator, parse->chunks, sizeof(ParseChunk) * parse->num_chunks);
+    *parse = {};
+}
+
+// With include_ends, the text before the first bound goes with the first chunk and the text after the last bound with the last chunk
+static void init_chunked_parse(ChunkedParse* parse, const size_t* bounds, size_t num_bounds, str_t str, bool include_ends) {
+    parse->num_chunks = num_bounds - 1;
+    parse->chunks = (ParseChunk*)md_alloc(md_heap_allocator, sizeof(ParseChunk) * parse->num_chunks);
+    MEMSET(parse->chunks, 0, sizeof(ParseChunk) * parse->num_chunks);
+    for (size_t i = 0; i < parse->num_chunks; ++i) {
+        const size_t beg = (include_ends && i == 0) ? 0 : bounds[i];
+        const size_t end = (include_ends && i == parse->num_chunks - 1) ? str.len : bounds[i + 1];
+        parse->chunks[i].text = {str.ptr + beg, end - beg};
+        parse->chunks[i].arena = md_arena_allocator_create(md_heap_allocator, MEGABYTES(4));
+    }
+}
+
+static bool run_chunked_parse(ChunkedParse* parse, task_system::RangeTask task) {
+    task_system::ID id = task_system::pool_enqueue(STR("##Parse Chunks"), 0, (uint32_t)parse->num_chunks, task, parse, 0, task_system::Priority_Interactive);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+    for (size_t i = 0; i < parse->num_chunks; ++i) {
+        if (!parse->chunks[i].ok) return false;
+    }
+    return true;
+}
+
+static void pdb_parse_chunk_task(uint32_t beg, uint32_t end, void* user_data) {
+    ChunkedParse* parse = (ChunkedParse*)user_data;
+    for (uint32_t i = beg; i < end; ++i) {
+        ParseChunk* c = &parse->chunks[i];
+        c->ok = md_pdb_data_parse_str(&c->pdb, c->text, c->arena);
+    }
+}
+
+static void gro_parse_chunk_task(uint32_t beg, uint32_t end, void* user_data) {
+    ChunkedParse* parse = (ChunkedParse*)user_data;
+    for (uint32_t i = beg; i < end; ++i) {
+        ParseChunk* c = &parse->chunks[i];
+        // Every chunk is given a header with its own number of atoms and the box of the file
+        size_t num_lines = 0;
+        for (size_t j = 0; j < c->text.len; ++j) {
+            num_lines += c->text.ptr[j] == '\n';
+        }
+        char header[64];
+        const int header_len = snprintf(header, sizeof(header), "chunk\n%zu\n", num_lines);
+        const size_t len = (size_t)header_len + c->text.len + parse->gro_box.len;
+        char* buf = (char*)md_alloc(c->arena, len);
+        MEMCPY(buf, header, header_len);
+        MEMCPY(buf + header_len, c->text.ptr, c->text.len);
+        MEMCPY(buf + header_len + c->text.len, parse->gro_box.ptr, parse->gro_box.len);
+        c->ok = md_gro_data_parse_str(&c->gro, {buf, len}, c->arena);
+    }
+}
+
+static bool pdb_chunked_init_from_str(md_molecule_t* mol, str_t str, const void* arg, md_allocator_i* alloc) {
+    if (str.len < CHUNKED_PARSE_MIN_BYTES) {
+        return md_pdb_molecule_api()->init_from_str(mol, str, arg, alloc);
+    }
+
+    // The atom block runs from the first atom record to the last line which belongs to an atom (TER and ANISOU follow their atom)
+    size_t head_end = 0;
+    while (head_end < str.len && !pdb_atom_record(str, head_end)) head_end = next_line(str, head_end);
+    size_t tail_beg = str.len;
+    while (tail_beg > head_end) {
+        size_t line = tail_beg - 1;
+        while (line > head_end && str.ptr[line - 1] != '\n') --line;
+        if (pdb_atom_record(str, line) || (line + 3 <= str.len && strncmp(str.ptr + line, "TER", 3) == 0) || (line + 6 <= str.len && strncmp(str.ptr + line, "ANISOU", 6) == 0)) break;
+        tail_beg = line;
+    }
+
+    size_t bounds[CHUNKED_PARSE_MAX_CHUNKS + 1];
+    const size_t num_bounds = split_lines(bounds, str, head_end, tail_beg, pdb_atom_record);
+    if (num_bounds < 3) {
+        return md_pdb_molecule_api()->init_from_str(mol, str, arg, alloc);
+    }
+
+    // The header records go with the first chunk and the trailing records (CONECT) with the last
+    ChunkedParse parse = {};
+    init_chunked_parse(&parse, bounds, num_bounds, str, true);
+    defer { free_chunked_parse(&parse); };
+
+    // Models refer to the atoms by index within their chunk, so files with MODEL records are parsed in one go
+    bool ok = run_chunked_parse(&parse, pdb_parse_chunk_task);
+    size_t num_coords = 0;
+    size_t num_connections = 0;
+    for (size_t i = 0; i < parse.num_chunks && ok; ++i) {
+        ok = parse.chunks[i].pdb.num_models == 0;
+        num_coords += parse.chunks[i].pdb.num_atom_coordinates;
+        num_connections += parse.chunks[i].pdb.num_connections;
+    }
+    if (!ok) {
+        MD_LOG_INFO("PDB: The file could not be parsed in chunks, parsing it in one go");
+        return md_pdb_molecule_api()->init_from_str(mol, str, arg, alloc);
+    }
+
+    md_allocator_i* arena = parse.chunks[0].arena;
+    md_pdb_data_t merged = parse.chunks[0].pdb;
+    merged.atom_coordinates = 0;
+    merged.connections = 0;
+    md_array_resize(merged.atom_coordinates, num_coords, arena);
+    md_array_resize(merged.connections, num_connections, arena);
+    num_coords = 0;
+    num_connections = 0;
+    for (size_t i = 0; i < parse.num_chunks; ++i) {
+        const md_pdb_data_t* pdb = &parse.chunks[i].pdb;
+        MEMCPY(merged.atom_coordinates + num_coords, pdb->atom_coordinates, pdb->num_atom_coordinates * sizeof(pdb->atom_coordinates[0]));
+        MEMCPY(merged.connections + num_connections, pdb->connections, pdb->num_connections * sizeof(pdb->connections[0]));
+        num_coords += pdb->num_atom_coordinates;
+        num_connections += pdb->num_connections;
+    }
+    merged.num_atom_coordinates = num_coords;
+    merged.num_connections = num_connections;
+
+    return md_pdb_molecule_init(mol, &merged, MD_PDB_OPTION_NONE, alloc);
+}
+
+static bool gro_chunked_init_from_str(md_molecule_t* mol, str_t str, const void* arg, md_allocator_i* alloc) {
+    if (str.len < CHUNKED_PARSE_MIN_BYTES) {
+        return md_gro_molecule_api()->init_from_str(mol, str, arg, alloc);
+    }
+
+    // Title and number of atoms, followed by one line per atom and the box vectors on the last (non empty) line
+    const size_t head_end = next_line(str, next_line(str, 0));
+    size_t end = str.len;
+    while (end > head_end && (str.ptr[end - 1] == '\n' || str.ptr[end - 1] == '\r' || str.ptr[end - 1] == ' ')) --end;
+    size_t tail_beg = end;
+    while (tail_beg > head_end && str.ptr[tail_beg - 1] != '\n') --tail_beg;
+
+    size_t bounds[CHUNKED_PARSE_MAX_CHUNKS + 1];
+    const size_t num_bounds = (tail_beg > head_end) ? split_lines(bounds, str, head_end, tail_beg, NULL) : 0;
+    if (num_bounds < 3) {
+        return md_gro_molecule_api()->init_from_str(mol, str, arg, alloc);
+    }
+
+    // The chunks only contain atom lines here, the header is added by the parse task
+    ChunkedParse parse = {};
+    init_chunked_parse(&parse, bounds, num_bounds, str, false);
+    parse.gro_box = {str.ptr + tail_beg, str.len - tail_beg};
+    defer { free_chunked_parse(&parse); };
+
+    if (!run_chunked_parse(&parse, gro_parse_chunk_task)) {
+        MD_LOG_INFO("GRO: The file could not be parsed in chunks, parsing it in one go");
+        return md_gro_molecule_api()->init_from_str(mol, str, arg, alloc);
+    }
+
+    size_t num_atoms = 0;
+    for (size_t i = 0; i < parse.num_chunks; ++i) {
+        num_atoms += parse.chunks[i].gro.num_atoms;
+    }
+
+    md_allocator_i* arena = parse.chunks[0].arena;
+    md_gro_data_t merged = parse.chunks[0].gro;
+    merged.atom_data = 0;
+    md_array_resize(merged.atom_data, num_atoms, arena);
+    num_atoms = 0;
+    for (size_t i = 0; i < parse.num_chunks; ++i) {
+        const md_gro_data_t* gro = &parse.chunks[i].gro;
+        MEMCPY(merged.atom_data + num_atoms, gro->atom_data, gro->num_atoms * sizeof(gro->atom_data[0]));
+        num_atoms += gro->num_atoms;
+    }
+    merged.num_atoms = num_atoms;
+
+    return md_gro_molecule_init(mol, &merged, alloc);
+}
+
+// Reads the whole file and parses it from memory, small files go straight to the regular loader
+static bool chunked_init_from_file(md_molecule_t* mol, str_t filename, const void* arg, md_allocator_i* alloc, md_molecule_loader_i* serial, bool (*init_from_str)(md_molecule_t*, str_t, const void*, md_allocator_i*)) {
+    md_file_o* file = md_file_open(filename, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Could not open file '%.*s'", (int)filename.len, filename.ptr);
+        return false;
+    }
+    const size_t size = (size_t)md_file_size(file);
+    if (size < CHUNKED_PARSE_MIN_BYTES) {
+        md_file_close(file);
+        return serial->init_from_file(mol, filename, arg, alloc);
+    }
+
+    char* buf = (char*)md_alloc(md_heap_allocator, size);
+    const bool read = md_file_read(file, buf, size) == size;
+    md_file_close(file);
+    defer { md_free(md_heap_allocator, buf, size); };
+    if (!read) {
+        MD_LOG_ERROR("Failed to read file '%.*s'", (int)filename.len, filename.ptr);
+        return false;
+    }
+    return init_from_str(mol, {buf, size}, arg, alloc);
+}
+
+static bool pdb_chunked_init_from_file(md_molecule_t* mol, str_t filename, const void* arg, md_allocator_i* alloc) {
+    return chunked_init_from_file(mol, filename, arg, alloc, md_pdb_molecule_api(), pdb_chunked_init_from_str);
+}
+
+static bool gro_chunked_init_from_file(md_molecule_t* mol, str_t filename, const void* arg, md_allocator_i* alloc) {
+    return chunked_init_from_file(mol, filename, arg, alloc, md_gro_molecule_api(), gro_chunked_init_from_str);
+}
+
+static md_molecule_loader_i pdb_chunked_api = {
+    pdb_chunked_init_from_str,
+    pdb_chunked_init_from_file,
+};
+
+static md_molecule_loader_i gro_chunked_api = {
+    gro_chunked_init_from_str,
+    gro_chunked_init_from_file,
+};
 
 enum mol_loader_t {
     MOL_LOADER_UNKNOWN,
@@ -52,8 +346,8 @@ static const str_t mol_loader_ext[] {
 
 static md_molecule_loader_i* mol_loader_api[] = {
     NULL,
-    md_pdb_molecule_api(),
-    md_gro_molecule_api(),
+    &pdb_chunked_api,
+    &gro_chunked_api,
     md_xyz_molecule_api(),
     md_mmcif_molecule_api(),
     md_lammps_molecule_api(),
@@ -65,6 +359,7 @@ enum traj_loader_t {
     TRAJ_LOADER_XTC,
     TRAJ_LOADER_TRR,
     TRAJ_LOADER_XYZ,
+    TRAJ_LOADER_VCT,
     TRAJ_LOADER_COUNT,
 };
 
@@ -74,6 +369,7 @@ static str_t traj_loader_name[] {
 	STR("Gromacs Compressed Trajectory (xtc)"),
 	STR("Gromacs Lossless Trajectory (trr)"),
 	STR("XYZ"),
+	STR("VIAMD Chunked Trajectory (vct)"),
 };
 
 static str_t traj_loader_ext[] {
@@ -82,6 +378,7 @@ static str_t traj_loader_ext[] {
 	STR("xtc"),
 	STR("trr"),
 	STR("xyz;xmol;arc"),
+	STR(CHUNKED_TRAJECTORY_EXT),
 };
 
 static md_trajectory_loader_i* traj_loader_api[] = {
@@ -90,6 +387,7 @@ static md_trajectory_loader_i* traj_loader_api[] = {
 	md_xtc_trajectory_loader(),
 	md_trr_trajectory_loader(),
 	md_xyz_trajectory_loader(),
+	chunked_trajectory_loader(),
 };
 
 struct LoadedMolecule {
@@ -97,6 +395,101 @@ struct LoadedMolecule {
     md_allocator_i* alloc;
 };
 
+// Raw (undecoded) frame data fetched by the I/O stage of the read-ahead pipeline
+struct RawFrameSlot {
+    int64_t frame_idx;
+    void*   data;
+    size_t  size;
+    size_t  cap;
+};
+
+struct ReadAhead {
+    RawFrameSlot slots[READ_AHEAD_MAX_SLOTS];
+    atomic_queue::AtomicQueue<uint32_t, READ_AHEAD_MAX_SLOTS, 0xFFFFFFFF> free_slots;
+    atomic_queue::AtomicQueue<uint32_t, READ_AHEAD_MAX_SLOTS, 0xFFFFFFFF> ready_slots;
+
+    uint32_t io_depth;
+    uint32_t decode_depth;
+
+    // Ordered window of frames to fetch, claimed through the cursor by both stages
+    int64_t frame_beg;
+    int64_t frame_count;
+    int     direction;
+    int64_t wrap_beg;       // Range which the window wraps around within (when looping)
+    int64_t wrap_len;
+    std::atomic_int64_t cursor;
+    std::atomic_bool    cancel;
+
+    task_system::ID io_task;
+    task_system::ID decode_task;
+
+    // Residency hint: A ring of the most recently decoded frame indices (sized to the cache capacity)
+    // This mirrors the eviction in the frame cache approximately and is only used to avoid redundant I/O
+    md_bitfield_t resident;
+    int64_t* resident_ring;
+    int64_t  resident_cap;
+    int64_t  resident_head;
+    std::atomic_flag resident_lock = ATOMIC_FLAG_INIT;
+
+    std::atomic_uint64_t frames_fetched;
+    std::atomic_uint64_t frames_decoded;
+    std::atomic_uint64_t frames_stolen;
+    std::atomic_uint64_t bytes_fetched;
+    std::atomic_uint64_t fetch_ticks;
+    std::atomic_uint64_t decode_ticks;
+};
+
+// Raw tier of the frame cache: Decoded frames before the recenter and deperiodize transforms are applied.
+// The (uncompressed) md_frame_cache holds the derived tier, which is computed lazily per frame from the raw tier.
+// Changing the transform only invalidates the derived tier, thus no frames need to be read from disk again.
+// With VIAMD_FRAME_CACHE_COMPRESSED, coordinates are stored as 16-bit fixed point relative to the (per frame) axis aligned bounding box.
+// The precision is then extent / 65535, i.e. ~0.5 pm for a 30 nm box, which is on par with what XTC stores.
+#if VIAMD_FRAME_CACHE_COMPRESSED
+typedef uint16_t raw_coord_t;
+#else
+typedef float raw_coord_t;
+#endif
+
+// Per trajectory view into a (shared) raw tier
+struct RawFrameOwner {
+    int32_t* lookup;        // [num_traj_frames] -> index into frames of the raw tier or -1
+    int64_t  num_traj_frames;
+    load::traj::PlaybackHint hint;
+    bool     has_hint;
+};
+
+struct RawFrame {
+    md_trajectory_frame_header_t header;
+    RawFrameOwner* owner;   // NULL if the slot is empty
+    int64_t  frame_idx;
+    uint64_t last_access;
+    float    offset[3];
+    float    scale[3];
+    uint32_t pins;          // Fetches which copy out of the slot
+    bool     writing;       // A store is copying into the slot, it is mapped in the lookup but not readable yet
+};
+
+// The raw tier is shared between all open trajectories with the same number of atoms (e.g. replicas of an ensemble),
+// which keeps the total memory within a single budget and makes eviction global (LRU, guided by playback hints).
+struct RawFrameCache {
+    RawFrame*    frames;
+    raw_coord_t* data;      // [capacity][3][num_atoms] (planar)
+    int64_t      capacity;
+    int64_t      head;      // Clock hand for sampled eviction
+    // Placement of data, see numa_memory.h. If the slots are partitioned, frames are stored into the slots of the node which decodes them
+    bool         os_data;   // data is allocated through numa_alloc rather than the tracked heap
+    bool         huge_pages;
+    NumaPolicy   numa_policy;
+    int64_t      num_nodes;
+    int64_t      node_slots[NUMA_MAX_NODES + 1];     // Slots [node_slots[i], node_slots[i + 1]) are on node i
+    int64_t      node_head[NUMA_MAX_NODES];         // Clock hand within the slots of each node
+    int64_t      num_atoms;
+    int64_t      ref_count;
+    uint64_t     tick;
+    int64_t      busy;      // Slots which are pinned or written, the frames are copied outside of the lock
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
 struct LoadedTrajectory {
     uint64_t key;
     const md_molecule_t* mol;
@@ -106,12 +499,25 @@ struct LoadedTrajectory {
     md_allocator_i* alloc;
     md_bitfield_t recenter_target;
     bool deperiodize;
+    ReadAhead* read_ahead;
+    RawFrameCache* raw_cache;
+    RawFrameOwner* raw_owner;
+    load::traj::PlaybackHint hint;  // Set through set_playback_hint, gives the window of the read-ahead
+    uint64_t transform_key;         // Fingerprint of the recenter target and deperiodize flag which the derived tier was computed with
+    md_array(int32_t) loose_atoms;  // Atoms which are not part of any structure (wrapped individually when deperiodizing)
+    uint64_t file_identity;         // Path, size and modification time of the file, which keys its block cache
+    FrameBlockCache* block_cache;   // Local copy of the raw frame data, see frame_block_cache.h
+    struct DeperiodizeHint* deperiodize_hints;   // [DEPERIODIZE_HINT_SLOTS] Images of recently deperiodized frames, NULL without structures
 };
 
+#define MAX_LOADED_TRAJECTORIES 64
+
 static LoadedMolecule loaded_molecules[8] = {};
 static int64_t num_loaded_molecules = 0;
 
-static LoadedTrajectory loaded_trajectories[8] = {};
+// The slots are stable, since md_trajectory_i::inst and the tasks of the read-ahead pipeline refer to an entry by its address
+// A removed entry leaves an empty slot (key 0) which is reused by the next allocation, num_loaded_trajectories is one past the last used slot
+static LoadedTrajectory loaded_trajectories[MAX_LOADED_TRAJECTORIES] = {};
 static int64_t num_loaded_trajectories = 0;
 
 static inline LoadedMolecule* find_loaded_molecule(uint64_t key) {
@@ -138,6 +544,7 @@ static inline void remove_loaded_molecule(uint64_t key) {
 }
 
 static inline LoadedTrajectory* find_loaded_trajectory(uint64_t key) {
+    ASSERT(key != 0);
     for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
         if (loaded_trajectories[i].key == key) return &loaded_trajectories[i];
     }
@@ -146,20 +553,37 @@ static inline LoadedTrajectory* find_loaded_trajectory(uint64_t key) {
 
 static inline LoadedTrajectory* alloc_loaded_trajectory(uint64_t key) {
     ASSERT(find_loaded_trajectory(key) == NULL);
-    ASSERT(num_loaded_trajectories < (int64_t)ARRAY_SIZE(loaded_trajectories));
-    LoadedTrajectory* traj = &loaded_trajectories[num_loaded_trajectories++];
+    int64_t i = 0;
+    while (i < num_loaded_trajectories && loaded_trajectories[i].key != 0) ++i;
+    ASSERT(i < (int64_t)ARRAY_SIZE(loaded_trajectories));
+    if (i == num_loaded_trajectories) num_loaded_trajectories += 1;
+    LoadedTrajectory* traj = &loaded_trajectories[i];
     *traj = {0}; // Clear
     traj->key = key;
     return traj;
 }
 
+static void free_deperiodize_hints(struct DeperiodizeHint* hints, md_allocator_i* alloc);
+
+namespace load::traj {
+    static void read_ahead_stop(ReadAhead* ra);
+    static void read_ahead_free(ReadAhead* ra, md_allocator_i* alloc);
+    static void raw_cache_release(RawFrameCache* rc, RawFrameOwner* owner, md_allocator_i* alloc);
+}
+
 static inline void remove_loaded_trajectory(uint64_t key) {
     for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
         if (loaded_trajectories[i].key == key) {
+            load::traj::read_ahead_free(loaded_trajectories[i].read_ahead, loaded_trajectories[i].alloc);
+            load::traj::raw_cache_release(loaded_trajectories[i].raw_cache, loaded_trajectories[i].raw_owner, loaded_trajectories[i].alloc);
+            md_array_free(loaded_trajectories[i].loose_atoms, loaded_trajectories[i].alloc);
             md_frame_cache_free(&loaded_trajectories[i].cache);
+            frame_block_cache_close(loaded_trajectories[i].block_cache);
+            free_deperiodize_hints(loaded_trajectories[i].deperiodize_hints, loaded_trajectories[i].alloc);
             loaded_trajectories[i].loader->destroy(loaded_trajectories[i].traj);
-            // Swap back and pop
-            loaded_trajectories[i] = loaded_trajectories[--num_loaded_trajectories];
+            // The other entries stay in place, trailing empty slots are trimmed
+            loaded_trajectories[i] = {};
+            while (num_loaded_trajectories > 0 && loaded_trajectories[num_loaded_trajectories - 1].key == 0) --num_loaded_trajectories;
             return;
         }
     }
@@ -195,7 +619,7 @@ static void traj_loader_preload_check(load::LoaderState*, traj_loader_t, str_t,
 
 namespace load {
 
-#define NUM_ENTRIES 9
+#define NUM_ENTRIES 10
 struct table_entry_t {
     str_t name[NUM_ENTRIES];
     str_t ext[NUM_ENTRIES];
@@ -220,6 +644,7 @@ static const table_entry_t table = {
         STR("xyz (arc)"),
         STR("PDBx/mmCIF (cif)"),
         STR("LAMMPS (data)"),
+        STR("VIAMD Chunked Trajectory (vct)"),
     },
     {
         STR("pdb"),
@@ -231,10 +656,11 @@ static const table_entry_t table = {
         STR("arc"),
         STR("cif"),
         STR("data"),
+        STR(CHUNKED_TRAJECTORY_EXT),
     },
     { 
-        md_pdb_molecule_api(),
-        md_gro_molecule_api(),  
+        &pdb_chunked_api,
+        &gro_chunked_api,
         NULL,
         NULL,
         md_xyz_molecule_api(),
@@ -242,6 +668,7 @@ static const table_entry_t table = {
         md_xyz_molecule_api(),
         md_mmcif_molecule_api(),
         md_lammps_molecule_api(),
+        NULL,
     },
 	{ 
         md_pdb_trajectory_loader(),
@@ -253,6 +680,7 @@ static const table_entry_t table = {
     	md_xyz_trajectory_loader(),
     	NULL,
         NULL,
+        chunked_trajectory_loader(),
     }
 };
 
@@ -376,6 +804,704 @@ size_t fetch_frame_data(struct md_trajectory_o*, int64_t idx, void* data_ptr) {
     return sizeof(int64_t);
 }
 
+static inline bool is_ortho(const md_unit_cell_t* cell) {
+    const mat3_t& M = cell->basis;
+    return M.elem[0][1] == 0.0f && M.elem[0][2] == 0.0f &&
+           M.elem[1][0] == 0.0f && M.elem[1][2] == 0.0f &&
+           M.elem[2][0] == 0.0f && M.elem[2][1] == 0.0f;
+}
+
+// Images of the atoms of the structures for one frame, which predict the unwrap of nearby frames (see translate_deperiodize_ortho)
+struct DeperiodizeHint {
+    int8_t* image;          // [3][num_indices] Per atom of structures->indices, the unwrapped position is raw - image * ext
+    int64_t num_indices;
+    std::atomic_int64_t frame_idx;  // -1 if the images are not set
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
+static inline int8_t image_i8(float n) {
+    return (int8_t)CLAMP(n, -127.0f, 127.0f);
+}
+
+// Fused translate + structure unwrap + wrap for orthorhombic cells.
+// Each structure is unwrapped along its atom order (relative to the previous atom) while accumulating its center of mass,
+// then the structure is shifted so its center of mass ends up within the cell, while the atoms are still hot in cache.
+// Atoms which are not part of any structure are translated and wrapped individually.
+// This replaces the separate passes of vec3_batch_translate_inplace and md_util_deperiodize_system.
+// With a hint, the images of the previous frame are tried first: If every atom of a structure ends up within half a box of the atom before it,
+// the result equals that of the unwrap, without its dependency from atom to atom. Only structures which moved further are unwrapped again.
+// The images of this frame are written to the hint.
+static void translate_deperiodize_ortho(float* x, float* y, float* z, const float* w, vec3_t t, vec3_t ext, const md_index_data_t* structures, const int32_t* loose, int64_t num_loose, DeperiodizeHint* hint, bool predict) {
+    const float ext_x = ext.x, ext_y = ext.y, ext_z = ext.z;
+    const float inv_x = ext_x > 0.0f ? 1.0f / ext_x : 0.0f;
+    const float inv_y = ext_y > 0.0f ? 1.0f / ext_y : 0.0f;
+    const float inv_z = ext_z > 0.0f ? 1.0f / ext_z : 0.0f;
+
+    const int64_t num_structures = md_index_data_count(*structures);
+    int8_t* img_x = hint ? hint->image + hint->num_indices * 0 : NULL;
+    int8_t* img_y = hint ? hint->image + hint->num_indices * 1 : NULL;
+    int8_t* img_z = hint ? hint->image + hint->num_indices * 2 : NULL;
+
+    for (int64_t s = 0; s < num_structures; ++s) {
+        const int64_t beg = structures->offsets[s];
+        const int64_t end = structures->offsets[s + 1];
+        if (beg == end) continue;
+
+        double cx = 0, cy = 0, cz = 0, sw = 0;
+
+        bool predicted = false;
+        if (predict) {
+            // The translation is common to all atoms and cancels in the differences
+            int32_t miss = 0;
+            for (int64_t j = beg + 1; j < end; ++j) {
+                const int32_t a = structures->indices[j - 1];
+                const int32_t b = structures->indices[j];
+                const float dx = (x[b] - ext_x * img_x[j]) - (x[a] - ext_x * img_x[j - 1]);
+                const float dy = (y[b] - ext_y * img_y[j]) - (y[a] - ext_y * img_y[j - 1]);
+                const float dz = (z[b] - ext_z * img_z[j]) - (z[a] - ext_z * img_z[j - 1]);
+                miss |= (floorf(dx * inv_x + 0.5f) != 0.0f) | (floorf(dy * inv_y + 0.5f) != 0.0f) | (floorf(dz * inv_z + 0.5f) != 0.0f);
+            }
+            predicted = !miss;
+        }
+
+        if (predicted) {
+            for (int64_t j = beg; j < end; ++j) {
+                const int32_t i = structures->indices[j];
+                const float px = x[i] + t.x - ext_x * img_x[j];
+                const float py = y[i] + t.y - ext_y * img_y[j];
+                const float pz = z[i] + t.z - ext_z * img_z[j];
+                x[i] = px;
+                y[i] = py;
+                z[i] = pz;
+
+                const float wi = w ? w[i] : 1.0f;
+                cx += wi * px;
+                cy += wi * py;
+                cz += wi * pz;
+                sw += wi;
+            }
+        } else {
+            float px = x[structures->indices[beg]] + t.x;
+            float py = y[structures->indices[beg]] + t.y;
+            float pz = z[structures->indices[beg]] + t.z;
+
+            for (int64_t j = beg; j < end; ++j) {
+                const int32_t i = structures->indices[j];
+                float dx = (x[i] + t.x) - px;
+                float dy = (y[i] + t.y) - py;
+                float dz = (z[i] + t.z) - pz;
+                const float nx = floorf(dx * inv_x + 0.5f);
+                const float ny = floorf(dy * inv_y + 0.5f);
+                const float nz = floorf(dz * inv_z + 0.5f);
+                dx -= ext_x * nx;
+                dy -= ext_y * ny;
+                dz -= ext_z * nz;
+                px += dx;
+                py += dy;
+                pz += dz;
+                x[i] = px;
+                y[i] = py;
+                z[i] = pz;
+                if (hint) {
+                    img_x[j] = image_i8(nx);
+                    img_y[j] = image_i8(ny);
+                    img_z[j] = image_i8(nz);
+                }
+
+                const float wi = w ? w[i] : 1.0f;
+                cx += wi * px;
+                cy += wi * py;
+                cz += wi * pz;
+                sw += wi;
+            }
+        }
+
+        if (sw == 0) {
+            sw = (double)(end - beg);
+        }
+        const float com_x = (float)(cx / sw);
+        const float com_y = (float)(cy / sw);
+        const float com_z = (float)(cz / sw);
+        const float sx = ext_x * floorf(com_x * inv_x);
+        const float sy = ext_y * floorf(com_y * inv_y);
+        const float sz = ext_z * floorf(com_z * inv_z);
+
+        if (sx != 0.0f || sy != 0.0f || sz != 0.0f) {
+            for (int64_t j = beg; j < end; ++j) {
+                const int32_t i = structures->indices[j];
+                x[i] -= sx;
+                y[i] -= sy;
+                z[i] -= sz;
+            }
+        }
+    }
+
+    for (int64_t j = 0; j < num_loose; ++j) {
+        const int32_t i = loose[j];
+        const float px = x[i] + t.x;
+        const float py = y[i] + t.y;
+        const float pz = z[i] + t.z;
+        x[i] = px - ext_x * floorf(px * inv_x);
+        y[i] = py - ext_y * floorf(py * inv_y);
+        z[i] = pz - ext_z * floorf(pz * inv_z);
+    }
+}
+
+static DeperiodizeHint* create_deperiodize_hints(const md_molecule_t* mol, md_allocator_i* alloc) {
+    const int64_t num_structures = md_index_data_count(mol->structures);
+    if (num_structures == 0) return NULL;
+    DeperiodizeHint* hints = (DeperiodizeHint*)md_alloc(alloc, sizeof(DeperiodizeHint) * DEPERIODIZE_HINT_SLOTS);
+    for (int i = 0; i < DEPERIODIZE_HINT_SLOTS; ++i) {
+        new (&hints[i]) DeperiodizeHint();
+        hints[i].image = NULL;
+        hints[i].num_indices = mol->structures.offsets[num_structures];
+        hints[i].frame_idx = -1;
+    }
+    return hints;
+}
+
+static void free_deperiodize_hints(DeperiodizeHint* hints, md_allocator_i* alloc) {
+    if (!hints) return;
+    for (int i = 0; i < DEPERIODIZE_HINT_SLOTS; ++i) {
+        if (hints[i].image) md_free(md_heap_allocator, hints[i].image, 3 * hints[i].num_indices);
+    }
+    md_free(alloc, hints, sizeof(DeperiodizeHint) * DEPERIODIZE_HINT_SLOTS);
+}
+
+// Claims the free hint which is closest to the frame, returns NULL if all hints are in use
+// predict is set if the images of the hint are recent enough to be tried for the frame
+static DeperiodizeHint* claim_deperiodize_hint(LoadedTrajectory* loaded_traj, int64_t idx, bool* predict) {
+    *predict = false;
+    if (!loaded_traj->deperiodize_hints) return NULL;
+    DeperiodizeHint* best = NULL;
+    int64_t best_dist = INT64_MAX;
+    for (int i = 0; i < DEPERIODIZE_HINT_SLOTS; ++i) {
+        DeperiodizeHint* hint = &loaded_traj->deperiodize_hints[i];
+        if (hint->lock.test_and_set(std::memory_order_acquire)) continue;
+        if (!hint->image) {
+            // The images are allocated on first use, which is when deperiodization is enabled
+            hint->image = (int8_t*)md_alloc(md_heap_allocator, 3 * hint->num_indices);
+        }
+        const int64_t f = hint->frame_idx.load(std::memory_order_relaxed);
+        const int64_t dist = f == -1 ? INT64_MAX - 1 : (f > idx ? f - idx : idx - f);
+        if (!best || dist < best_dist) {
+            if (best) best->lock.clear(std::memory_order_release);
+            best = hint;
+            best_dist = dist;
+        } else {
+            hint->lock.clear(std::memory_order_release);
+        }
+    }
+    *predict = best && best_dist <= DEPERIODIZE_HINT_MAX_FRAMES;
+    return best;
+}
+
+// Applies the recenter and deperiodize transforms to decoded frame data
+static void apply_frame_transform(LoadedTrajectory* loaded_traj, int64_t idx, md_frame_data_t* frame_data) {
+    const md_unit_cell_t* cell = &frame_data->header.unit_cell;
+    const bool have_cell = cell->flags != 0;
+
+    const md_molecule_t* mol = loaded_traj->mol;
+    float* x = frame_data->x;
+    float* y = frame_data->y;
+    float* z = frame_data->z;
+    const size_t num_atoms = frame_data->header.num_atoms;
+
+    vec3_t trans = {0};
+    bool translate = false;
+
+    // If we have a recenter target, then compute the com which defines the translation
+    if (!md_bitfield_empty(&loaded_traj->recenter_target)) {
+        const md_bitfield_t* bf = &loaded_traj->recenter_target;
+        const size_t count = md_bitfield_popcount(bf);
+            
+        if (count > 0) {
+            task_system::ScratchMark mark = task_system::scratch_mark();
+            defer { task_system::scratch_rewind(mark); };
+            int32_t* indices = (int32_t*)task_system::scratch_alloc(sizeof(int32_t) * count);
+                    
+            size_t num_indices = md_bitfield_extract_indices(indices, count, bf);
+            ASSERT(num_indices == count);
+            (void)num_indices;
+
+            const vec3_t box_ext = mat3_mul_vec3(cell->basis, vec3_set1(1.0f));
+
+            vec3_t com = {0};
+            if (count == 1) {
+                const int32_t i = indices[0];
+                com = vec3_set(x[i], y[i], z[i]);
+            }
+            else {
+                com = have_cell ?
+                    vec3_deperiodize(md_util_compute_com_ortho(x, y, z, mol->atom.mass, indices, count, box_ext), box_ext * 0.5f, box_ext) :
+                    md_util_com_compute(x, y, z, mol->atom.mass, indices, count);
+            }
+
+            trans = have_cell ? box_ext * 0.5f - com : -com;
+            translate = true;
+        }
+    }
+
+    const bool deperiodize = loaded_traj->deperiodize && have_cell;
+    if (deperiodize && is_ortho(cell)) {
+        // Translate, unwrap and wrap in a single pass
+        const vec3_t box_ext = mat3_mul_vec3(cell->basis, vec3_set1(1.0f));
+        bool predict = false;
+        DeperiodizeHint* hint = claim_deperiodize_hint(loaded_traj, idx, &predict);
+        translate_deperiodize_ortho(x, y, z, mol->atom.mass, trans, box_ext, &mol->structures, loaded_traj->loose_atoms, md_array_size(loaded_traj->loose_atoms), hint, predict);
+        if (hint) {
+            hint->frame_idx.store(idx, std::memory_order_relaxed);
+            hint->lock.clear(std::memory_order_release);
+        }
+    } else {
+        if (translate) {
+            vec3_batch_translate_inplace(x, y, z, num_atoms, trans);
+        }
+        if (deperiodize) {
+            md_util_deperiodize_system(x, y, z, mol->atom.mass, mol->atom.count, cell, mol->structures.offsets, mol->structures.indices, md_index_data_count(mol->structures));
+        }
+    }
+}
+
+static inline void spin_lock(std::atomic_flag* flag) {
+    while (flag->test_and_set(std::memory_order_acquire)) {}
+}
+
+static inline void spin_unlock(std::atomic_flag* flag) {
+    flag->clear(std::memory_order_release);
+}
+
+static RawFrameCache* raw_caches[MAX_LOADED_TRAJECTORIES] = {};
+static int64_t num_raw_caches = 0;
+
+static bool cache_huge_pages = false;
+static NumaPolicy cache_numa_policy = NumaPolicy_FirstTouch;
+
+// The coordinates are only taken from the OS if they are placed or backed by huge pages, they are accounted for by cache_memory_usage
+static raw_coord_t* raw_cache_alloc_data(const RawFrameCache* rc, int64_t capacity, bool* out_os_data) {
+    const size_t size = sizeof(raw_coord_t) * 3 * rc->num_atoms * capacity;
+    if (rc->huge_pages || rc->numa_policy != NumaPolicy_FirstTouch) {
+        if (void* ptr = numa_alloc(size, rc->huge_pages, rc->numa_policy)) {
+            *out_os_data = true;
+            return (raw_coord_t*)ptr;
+        }
+        MD_LOG_DEBUG("Failed to map %.1f MB for the raw frame cache, using the heap", (double)size / (1024.0 * 1024.0));
+    }
+    *out_os_data = false;
+    return (raw_coord_t*)md_alloc(memory_tracker_allocator(MemoryTracker_LoaderCache), size);
+}
+
+static void raw_cache_free_data(const RawFrameCache* rc, raw_coord_t* data, int64_t capacity, bool os_data) {
+    const size_t size = sizeof(raw_coord_t) * 3 * rc->num_atoms * capacity;
+    if (os_data) {
+        numa_free(data, size, rc->huge_pages);
+    } else {
+        md_free(memory_tracker_allocator(MemoryTracker_LoaderCache), data, size);
+    }
+}
+
+// Splits the slots between the nodes which the parts of data are bound to, a slot belongs to the node of its first byte
+static void raw_cache_partition(RawFrameCache* rc) {
+    rc->num_nodes = 1;
+    rc->node_slots[0] = 0;
+    rc->node_slots[1] = rc->capacity;
+    rc->node_head[0] = 0;
+    const int64_t num_nodes = numa_num_nodes();
+    if (!rc->os_data || rc->numa_policy != NumaPolicy_Partition || num_nodes < 2) return;
+
+    const size_t slot_bytes = sizeof(raw_coord_t) * 3 * rc->num_atoms;
+    const size_t part = numa_partition_size(slot_bytes * rc->capacity, rc->huge_pages);
+    for (int64_t i = 0; i < num_nodes; ++i) {
+        rc->node_slots[i] = MIN(rc->capacity, (int64_t)((i * part + slot_bytes - 1) / slot_bytes));
+        rc->node_head[i] = 0;
+    }
+    rc->node_slots[num_nodes] = rc->capacity;
+    rc->num_nodes = num_nodes;
+}
+
+// Returns the shared raw tier for the number of atoms (creating it with capacity if it does not exist) and registers an owner for it
+static RawFrameCache* raw_cache_acquire(RawFrameOwner** out_owner, int64_t capacity, int64_t num_atoms, int64_t num_traj_frames, md_allocator_i* alloc) {
+    RawFrameCache* rc = NULL;
+    for (int64_t i = 0; i < num_raw_caches; ++i) {
+        if (raw_caches[i]->num_atoms == num_atoms) {
+            rc = raw_caches[i];
+            break;
+        }
+    }
+
+    if (!rc) {
+        if (capacity <= 0) return NULL;
+        ASSERT(num_raw_caches < (int64_t)ARRAY_SIZE(raw_caches));
+        md_allocator_i* heap = memory_tracker_allocator(MemoryTracker_LoaderCache);
+        rc = (RawFrameCache*)md_alloc(heap, sizeof(RawFrameCache));
+        new (rc) RawFrameCache();
+        rc->capacity  = capacity;
+        rc->num_atoms = num_atoms;
+        rc->head      = 0;
+        rc->ref_count = 0;
+        rc->tick      = 0;
+        rc->busy      = 0;
+        rc->huge_pages  = cache_huge_pages;
+        rc->numa_policy = cache_numa_policy;
+        rc->frames = (RawFrame*)md_alloc(heap, sizeof(RawFrame) * capacity);
+        rc->data   = raw_cache_alloc_data(rc, capacity, &rc->os_data);
+        raw_cache_partition(rc);
+        for (int64_t i = 0; i < capacity; ++i) {
+            rc->frames[i].owner = NULL;
+            rc->frames[i].frame_idx = -1;
+            rc->frames[i].last_access = 0;
+            rc->frames[i].pins = 0;
+            rc->frames[i].writing = false;
+        }
+        raw_caches[num_raw_caches++] = rc;
+    }
+
+    RawFrameOwner* owner = (RawFrameOwner*)md_alloc(alloc, sizeof(RawFrameOwner));
+    owner->num_traj_frames = num_traj_frames;
+    owner->lookup = (int32_t*)md_alloc(alloc, sizeof(int32_t) * num_traj_frames);
+    for (int64_t i = 0; i < num_traj_frames; ++i) {
+        owner->lookup[i] = -1;
+    }
+    owner->hint = {0, 1, 0, 0, 0, num_traj_frames, false};
+    owner->has_hint = false;
+
+    spin_lock(&rc->lock);
+    rc->ref_count += 1;
+    spin_unlock(&rc->lock);
+
+    *out_owner = owner;
+    return rc;
+}
+
+// Takes the lock once no frame is copied into or out of a slot, for changes which move or drop slots
+static void raw_cache_lock_idle(RawFrameCache* rc) {
+    while (true) {
+        spin_lock(&rc->lock);
+        if (rc->busy == 0) return;
+        spin_unlock(&rc->lock);
+        std::this_thread::yield();
+    }
+}
+
+static void raw_cache_release(RawFrameCache* rc, RawFrameOwner* owner, md_allocator_i* alloc) {
+    if (!rc) return;
+    ASSERT(owner);
+
+    raw_cache_lock_idle(rc);
+    for (int64_t i = 0; i < rc->capacity; ++i) {
+        if (rc->frames[i].owner == owner) {
+            rc->frames[i].owner = NULL;
+            rc->frames[i].frame_idx = -1;
+        }
+    }
+    const int64_t ref_count = --rc->ref_count;
+    spin_unlock(&rc->lock);
+
+    md_free(alloc, owner->lookup, sizeof(int32_t) * owner->num_traj_frames);
+    md_free(alloc, owner, sizeof(RawFrameOwner));
+
+    if (ref_count == 0) {
+        for (int64_t i = 0; i < num_raw_caches; ++i) {
+            if (raw_caches[i] == rc) {
+                raw_caches[i] = raw_caches[--num_raw_caches];
+                break;
+            }
+        }
+        md_allocator_i* heap = memory_tracker_allocator(MemoryTracker_LoaderCache);
+        md_free(heap, rc->frames, sizeof(RawFrame) * rc->capacity);
+        raw_cache_free_data(rc, rc->data, rc->capacity, rc->os_data);
+        rc->~RawFrameCache();
+        md_free(heap, rc, sizeof(RawFrameCache));
+    }
+}
+
+#define RAW_CACHE_MIN_FRAMES 2
+
+static inline size_t raw_frame_bytes(const RawFrameCache* rc) {
+    return sizeof(raw_coord_t) * 3 * rc->num_atoms + sizeof(RawFrame);
+}
+
+// Drops the frames of the slots beyond capacity, the frames of the remaining slots stay where they are
+static void raw_cache_shrink(RawFrameCache* rc, int64_t capacity) {
+    ASSERT(RAW_CACHE_MIN_FRAMES <= capacity && capacity < rc->capacity);
+    md_allocator_i* heap = memory_tracker_allocator(MemoryTracker_LoaderCache);
+    const size_t coords_per_frame = 3 * rc->num_atoms;
+    RawFrame*    frames = (RawFrame*)md_alloc(heap, sizeof(RawFrame) * capacity);
+    bool os_data = false;
+    raw_coord_t* data   = raw_cache_alloc_data(rc, capacity, &os_data);
+
+    raw_cache_lock_idle(rc);
+    for (int64_t i = capacity; i < rc->capacity; ++i) {
+        if (rc->frames[i].owner) {
+            rc->frames[i].owner->lookup[rc->frames[i].frame_idx] = -1;
+        }
+    }
+    MEMCPY(frames, rc->frames, sizeof(RawFrame) * capacity);
+    MEMCPY(data, rc->data, sizeof(raw_coord_t) * coords_per_frame * capacity);
+    RawFrame*    old_frames = rc->frames;
+    raw_coord_t* old_data   = rc->data;
+    const int64_t old_capacity = rc->capacity;
+    const bool old_os_data = rc->os_data;
+    rc->frames   = frames;
+    rc->data     = data;
+    rc->os_data  = os_data;
+    rc->capacity = capacity;
+    rc->head     = rc->head % capacity;
+    raw_cache_partition(rc);
+    spin_unlock(&rc->lock);
+
+    md_free(heap, old_frames, sizeof(RawFrame) * old_capacity);
+    raw_cache_free_data(rc, old_data, old_capacity, old_os_data);
+}
+
+// The loops are kept branch free over planar data so they vectorize
+static inline void encode_coords(uint16_t* out, float* out_offset, float* out_scale, const float* in, int64_t count) {
+    float min_v = count > 0 ? in[0] : 0.0f;
+    float max_v = min_v;
+    for (int64_t i = 0; i < count; ++i) {
+        min_v = MIN(min_v, in[i]);
+        max_v = MAX(max_v, in[i]);
+    }
+    const float ext = max_v - min_v;
+    const float scale = ext > 0.0f ? ext / 65535.0f : 1.0f;
+    const float inv_scale = 1.0f / scale;
+    for (int64_t i = 0; i < count; ++i) {
+        out[i] = (uint16_t)((in[i] - min_v) * inv_scale + 0.5f);
+    }
+    *out_offset = min_v;
+    *out_scale = scale;
+}
+
+static inline void decode_coords(float* out, const uint16_t* in, float offset, float scale, int64_t count) {
+    for (int64_t i = 0; i < count; ++i) {
+        out[i] = offset + (float)in[i] * scale;
+    }
+}
+
+static inline void encode_coords(float* out, float* out_offset, float* out_scale, const float* in, int64_t count) {
+    MEMCPY(out, in, sizeof(float) * count);
+    *out_offset = 0.0f;
+    *out_scale = 1.0f;
+}
+
+static inline void decode_coords(float* out, const float* in, float, float, int64_t count) {
+    MEMCPY(out, in, sizeof(float) * count);
+}
+
+// Higher score means evict sooner
+// The base is the age (in accesses) of the frame, i.e. LRU over all owners of the raw tier.
+// Owners which are played back push frames outside of the range and behind the playhead in front of everything else.
+static inline double eviction_score(const RawFrameCache* rc, const RawFrame* frame) {
+    const double age = (double)(rc->tick - frame->last_access);
+    const RawFrameOwner* owner = frame->owner;
+    if (!owner->has_hint) {
+        return age;
+    }
+
+    const load::traj::PlaybackHint& hint = owner->hint;
+    const int64_t frame_idx = frame->frame_idx;
+    const double capacity = (double)rc->capacity;
+    if (frame_idx < hint.range_beg || hint.range_end <= frame_idx || hint.range_end <= hint.range_beg) {
+        return age + 2 * capacity;
+    }
+
+    const double dir = hint.fps < 0 ? -1.0 : 1.0;
+    const double rel = ((double)frame_idx - hint.frame) * dir;
+    if (rel < -hint.support_beg && !hint.loop) {
+        // Behind the playhead and will not be reached again
+        return age + capacity;
+    }
+    return age;
+}
+
+// Sampled eviction: Among a window of slots starting at the clock hand, the frame with the highest score is evicted.
+// Empty slots are always taken first, slots which are being copied are never taken.
+#define RAW_CACHE_EVICTION_SAMPLES 64
+
+// If the slots are partitioned, only the slots of node are sampled so the frame is written to (and later read from) local memory
+// Returns -1 if every sampled slot is being copied
+static int64_t raw_cache_pick_victim(RawFrameCache* rc, uint32_t node) {
+    int64_t beg = 0;
+    int64_t count = rc->capacity;
+    int64_t* head = &rc->head;
+    if (rc->num_nodes > 1 && node < rc->num_nodes && rc->node_slots[node + 1] > rc->node_slots[node]) {
+        beg = rc->node_slots[node];
+        count = rc->node_slots[node + 1] - beg;
+        head = &rc->node_head[node];
+    }
+
+    const int64_t num_samples = MIN(count, RAW_CACHE_EVICTION_SAMPLES);
+    int64_t victim = -1;
+    double  victim_score = -1.0;
+    for (int64_t i = 0; i < num_samples; ++i) {
+        const int64_t slot = beg + (*head + i) % count;
+        const RawFrame* frame = &rc->frames[slot];
+        if (frame->pins || frame->writing) {
+            continue;
+        }
+        if (!frame->owner) {
+            victim = slot;
+            break;
+        }
+        const double score = eviction_score(rc, frame);
+        if (score > victim_score) {
+            victim = slot;
+            victim_score = score;
+        }
+    }
+    *head = (*head + 1) % count;
+    return victim;
+}
+
+// The slot is reserved under the lock and the frame is encoded into it outside of the lock
+// The slot is mapped while it is written, so a concurrent store of the same frame is skipped and a fetch of it misses
+static void raw_cache_store(RawFrameCache* rc, RawFrameOwner* owner, int64_t idx, const md_frame_data_t* frame_data) {
+    if (!rc || idx < 0 || idx >= owner->num_traj_frames) return;
+    const int64_t n = rc->num_atoms;
+    const uint32_t node = rc->num_nodes > 1 ? numa_current_node() : 0;
+    spin_lock(&rc->lock);
+    if (owner->lookup[idx] != -1) {
+        spin_unlock(&rc->lock);
+        return;
+    }
+    const int64_t slot = raw_cache_pick_victim(rc, node);
+    if (slot == -1) {
+        spin_unlock(&rc->lock);
+        return;
+    }
+    RawFrame* frame = &rc->frames[slot];
+    if (frame->owner) {
+        frame->owner->lookup[frame->frame_idx] = -1;
+    }
+    frame->owner = owner;
+    frame->frame_idx = idx;
+    frame->last_access = ++rc->tick;
+    frame->header = frame_data->header;
+    frame->writing = true;
+    owner->lookup[idx] = (int32_t)slot;
+    rc->busy += 1;
+    raw_coord_t* data = rc->data + slot * 3 * n;
+    spin_unlock(&rc->lock);
+
+    float offset[3], scale[3];
+    encode_coords(data + 0 * n, &offset[0], &scale[0], frame_data->x, n);
+    encode_coords(data + 1 * n, &offset[1], &scale[1], frame_data->y, n);
+    encode_coords(data + 2 * n, &offset[2], &scale[2], frame_data->z, n);
+
+    spin_lock(&rc->lock);
+    MEMCPY(frame->offset, offset, sizeof(offset));
+    MEMCPY(frame->scale, scale, sizeof(scale));
+    frame->writing = false;
+    rc->busy -= 1;
+    spin_unlock(&rc->lock);
+}
+
+// The slot is pinned under the lock and decoded outside of it, a pinned slot is not evicted
+static bool raw_cache_fetch(RawFrameCache* rc, RawFrameOwner* owner, int64_t idx, md_frame_data_t* frame_data) {
+    if (!rc || idx < 0 || idx >= owner->num_traj_frames) return false;
+    const int64_t n = rc->num_atoms;
+    spin_lock(&rc->lock);
+    const int32_t slot = owner->lookup[idx];
+    if (slot == -1 || rc->frames[slot].writing) {
+        spin_unlock(&rc->lock);
+        return false;
+    }
+    RawFrame* frame = &rc->frames[slot];
+    frame->last_access = ++rc->tick;
+    frame->pins += 1;
+    rc->busy += 1;
+    frame_data->header = frame->header;
+    float offset[3], scale[3];
+    MEMCPY(offset, frame->offset, sizeof(offset));
+    MEMCPY(scale, frame->scale, sizeof(scale));
+    const raw_coord_t* data = rc->data + slot * 3 * n;
+    spin_unlock(&rc->lock);
+
+    decode_coords(frame_data->x, data + 0 * n, offset[0], scale[0], n);
+    decode_coords(frame_data->y, data + 1 * n, offset[1], scale[1], n);
+    decode_coords(frame_data->z, data + 2 * n, offset[2], scale[2], n);
+
+    spin_lock(&rc->lock);
+    frame->pins -= 1;
+    rc->busy -= 1;
+    spin_unlock(&rc->lock);
+    return true;
+}
+
+// Raw frame data is fetched into a per-thread buffer which is kept between frames,
+// this avoids an allocation and free on the heap for every cache miss.
+struct FetchBuffer {
+    void*  ptr = NULL;
+    size_t cap = 0;
+    ~FetchBuffer() {
+        if (ptr) md_free(memory_tracker_allocator(MemoryTracker_LoaderCache), ptr, cap);
+    }
+};
+
+static thread_local FetchBuffer fetch_buffer;
+
+static void* fetch_buffer_reserve(size_t size) {
+    if (size > fetch_buffer.cap) {
+        md_allocator_i* alloc = memory_tracker_allocator(MemoryTracker_LoaderCache);
+        if (fetch_buffer.ptr) md_free(alloc, fetch_buffer.ptr, fetch_buffer.cap);
+        // Grow with some headroom since frame sizes vary slightly for compressed formats
+        const size_t cap = ALIGN_TO(size + size / 8, 4096);
+        fetch_buffer.ptr = md_alloc(alloc, cap);
+        fetch_buffer.cap = cap;
+    }
+    return fetch_buffer.ptr;
+}
+
+// Number of frames which can be held in memory without going back to disk (the raw tier, or the derived tier if there is no raw tier)
+static inline size_t cache_capacity(const LoadedTrajectory* loaded_traj) {
+    const size_t num_derived = md_frame_cache_num_frames(&loaded_traj->cache);
+    // The raw tier may be shared, so only count the fair share of it
+    const RawFrameCache* rc = loaded_traj->raw_cache;
+    const size_t num_raw = rc ? (size_t)(rc->capacity / MAX(1, rc->ref_count)) : 0;
+    return MAX(num_derived, num_raw);
+}
+
+// md_trajectory_fetch_frame_data which goes through the block cache of the trajectory if it has one, fetched frames are added to it
+static size_t fetch_raw_frame(LoadedTrajectory* loaded_traj, int64_t idx, void* dst) {
+    FrameBlockCache* block_cache = loaded_traj->block_cache;
+    if (block_cache) {
+        const size_t size = frame_block_cache_size(block_cache, idx);
+        if (size && (!dst || frame_block_cache_read(block_cache, idx, dst, size))) return size;
+    }
+    const size_t size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, dst);
+    if (block_cache && dst && size) {
+        frame_block_cache_write(block_cache, idx, dst, size);
+    }
+    return size;
+}
+
+// Fills a reserved slot in the (derived) frame cache, either from the raw tier or by decoding the raw frame data
+// If raw_ptr is NULL, the raw frame data is fetched from the underlying trajectory when needed
+static bool fill_frame(LoadedTrajectory* loaded_traj, int64_t idx, md_frame_data_t* frame_data, const void* raw_ptr, size_t raw_size) {
+    bool result = raw_cache_fetch(loaded_traj->raw_cache, loaded_traj->raw_owner, idx, frame_data);
+
+    if (!result) {
+        if (raw_ptr) {
+            result = md_trajectory_decode_frame_data(loaded_traj->traj, raw_ptr, raw_size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
+        } else {
+            const size_t frame_data_size = fetch_raw_frame(loaded_traj, idx, 0);
+            void* frame_data_ptr = fetch_buffer_reserve(frame_data_size);
+            fetch_raw_frame(loaded_traj, idx, frame_data_ptr);
+            result = md_trajectory_decode_frame_data(loaded_traj->traj, frame_data_ptr, frame_data_size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
+        }
+        if (result) {
+            raw_cache_store(loaded_traj->raw_cache, loaded_traj->raw_owner, idx, frame_data);
+        }
+    }
+
+    if (result) {
+        apply_frame_transform(loaded_traj, idx, frame_data);
+    }
+    return result;
+}
+
+static void read_ahead_mark_resident(ReadAhead* ra, int64_t idx);
+
 bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, [[maybe_unused]] size_t data_size, md_trajectory_frame_header_t* header, float* out_x, float* out_y, float* out_z) {
     LoadedTrajectory* loaded_traj = (LoadedTrajectory*)inst;
     ASSERT(loaded_traj);
@@ -389,60 +1515,10 @@ bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, [[may
     bool result = true;
     bool in_cache = md_frame_cache_find_or_reserve(&loaded_traj->cache, idx, &frame_data, &lock);
     if (!in_cache) {
-        md_allocator_i* alloc = md_heap_allocator;
-        const int64_t frame_data_size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, 0);
-        void* frame_data_ptr = md_alloc(alloc, frame_data_size);
-        md_trajectory_fetch_frame_data(loaded_traj->traj, idx, frame_data_ptr);
-        result = md_trajectory_decode_frame_data(loaded_traj->traj, frame_data_ptr, frame_data_size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
-
+        result = fill_frame(loaded_traj, idx, frame_data, NULL, 0);
         if (result) {
-            const md_unit_cell_t* cell = &frame_data->header.unit_cell;
-            const bool have_cell = cell->flags != 0;
-
-            const md_molecule_t* mol = loaded_traj->mol;
-            float* x = frame_data->x;
-            float* y = frame_data->y;
-            float* z = frame_data->z;
-            const size_t num_atoms = frame_data->header.num_atoms;
-
-            // If we have a recenter target, then compute the com and apply that transformation
-            if (!md_bitfield_empty(&loaded_traj->recenter_target)) {
-                const md_bitfield_t* bf = &loaded_traj->recenter_target;
-                const size_t count = md_bitfield_popcount(bf);
-                
-                if (count > 0) {
-                    int32_t* indices = (int32_t*)md_alloc(alloc, sizeof(int32_t) * count);
-                    defer { md_free(alloc, indices, sizeof(int32_t) * count); };
-                        
-                    size_t num_indices = md_bitfield_extract_indices(indices, count, bf);
-                    ASSERT(num_indices == count);
-                    (void)num_indices;
-
-                    const vec3_t box_ext = mat3_mul_vec3(cell->basis, vec3_set1(1.0f));
-
-                    vec3_t com = {0};
-                    if (count == 1) {
-                    	const int32_t i = indices[0];
-						com = vec3_set(x[i], y[i], z[i]);
-					}
-					else {
-						com = have_cell ?
-							vec3_deperiodize(md_util_compute_com_ortho(x, y, z, mol->atom.mass, indices, count, box_ext), box_ext * 0.5f, box_ext) :
-							md_util_com_compute(x, y, z, mol->atom.mass, indices, count);
-                    }
-
-                    // Translate all
-                    const vec3_t trans = have_cell ? box_ext * 0.5f - com : -com;
-                    vec3_batch_translate_inplace(x, y, z, num_atoms, trans);
-                }
-            }
-
-            if (loaded_traj->deperiodize && have_cell) {
-                md_util_deperiodize_system(x, y, z, mol->atom.mass, mol->atom.count, cell, mol->structures.offsets, mol->structures.indices, md_index_data_count(mol->structures));
-            }
+            read_ahead_mark_resident(loaded_traj->read_ahead, idx);
         }
-
-        md_free(alloc, frame_data_ptr, frame_data_size);
     }
 
     if (result) {
@@ -460,15 +1536,219 @@ bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, [[may
     return result;
 }
 
+static ReadAhead* read_ahead_create(int64_t num_cache_frames, md_allocator_i* alloc) {
+    ReadAhead* ra = (ReadAhead*)md_alloc(alloc, sizeof(ReadAhead));
+    new (ra) ReadAhead();
+    ra->io_task = task_system::INVALID_ID;
+    ra->decode_task = task_system::INVALID_ID;
+    ra->io_depth = READ_AHEAD_DEFAULT_IO_DEPTH;
+    ra->decode_depth = READ_AHEAD_DEFAULT_DECODE_DEPTH;
+    ra->cursor = 0;
+    ra->cancel = false;
+    md_bitfield_init(&ra->resident, alloc);
+    ra->resident_cap = MAX(1, num_cache_frames);
+    ra->resident_ring = (int64_t*)md_alloc(alloc, sizeof(int64_t) * ra->resident_cap);
+    for (int64_t i = 0; i < ra->resident_cap; ++i) {
+        ra->resident_ring[i] = -1;
+    }
+    for (uint32_t i = 0; i < READ_AHEAD_MAX_SLOTS; ++i) {
+        ra->slots[i] = {};
+    }
+    return ra;
+}
+
+static void read_ahead_stop(ReadAhead* ra) {
+    if (!ra) return;
+    ra->cancel = true;
+    task_system::task_wait_for(ra->io_task);
+    task_system::task_wait_for(ra->decode_task);
+}
+
+static void read_ahead_free(ReadAhead* ra, md_allocator_i* alloc) {
+    if (!ra) return;
+    read_ahead_stop(ra);
+    for (uint32_t i = 0; i < READ_AHEAD_MAX_SLOTS; ++i) {
+        if (ra->slots[i].data) {
+            md_free(alloc, ra->slots[i].data, ra->slots[i].cap);
+        }
+    }
+    md_bitfield_free(&ra->resident);
+    md_free(alloc, ra->resident_ring, sizeof(int64_t) * ra->resident_cap);
+    ra->~ReadAhead();
+    md_free(alloc, ra, sizeof(ReadAhead));
+}
+
+static inline void read_ahead_lock(ReadAhead* ra) {
+    spin_lock(&ra->resident_lock);
+}
+
+static inline void read_ahead_unlock(ReadAhead* ra) {
+    spin_unlock(&ra->resident_lock);
+}
+
+static void read_ahead_mark_resident(ReadAhead* ra, int64_t idx) {
+    if (!ra) return;
+    read_ahead_lock(ra);
+    const int64_t evicted = ra->resident_ring[ra->resident_head];
+    if (evicted >= 0) {
+        md_bitfield_clear_bit(&ra->resident, evicted);
+    }
+    ra->resident_ring[ra->resident_head] = idx;
+    ra->resident_head = (ra->resident_head + 1) % ra->resident_cap;
+    md_bitfield_set_bit(&ra->resident, idx);
+    read_ahead_unlock(ra);
+}
+
+static bool read_ahead_is_resident(ReadAhead* ra, int64_t idx) {
+    read_ahead_lock(ra);
+    const bool resident = md_bitfield_test_bit(&ra->resident, idx);
+    read_ahead_unlock(ra);
+    return resident;
+}
+
+static void read_ahead_clear_resident(ReadAhead* ra) {
+    if (!ra) return;
+    read_ahead_lock(ra);
+    md_bitfield_clear(&ra->resident);
+    for (int64_t i = 0; i < ra->resident_cap; ++i) {
+        ra->resident_ring[i] = -1;
+    }
+    ra->resident_head = 0;
+    read_ahead_unlock(ra);
+}
+
+// Claims the next frame within the window which is not already resident, returns -1 when the window is exhausted
+static int64_t read_ahead_claim(ReadAhead* ra) {
+    while (!ra->cancel) {
+        const int64_t i = ra->cursor.fetch_add(1);
+        if (i >= ra->frame_count) break;
+        int64_t idx = ra->frame_beg + i * ra->direction;
+        if (ra->wrap_len > 0) {
+            idx = ra->wrap_beg + (((idx - ra->wrap_beg) % ra->wrap_len) + ra->wrap_len) % ra->wrap_len;
+        }
+        if (!read_ahead_is_resident(ra, idx)) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+static void read_ahead_fetch(ReadAhead* ra, RawFrameSlot* slot, LoadedTrajectory* loaded_traj, int64_t idx, md_allocator_i* alloc) {
+    const md_timestamp_t t0 = md_time_current();
+    const size_t size = fetch_raw_frame(loaded_traj, idx, 0);
+    if (size > slot->cap) {
+        if (slot->data) md_free(alloc, slot->data, slot->cap);
+        slot->data = md_alloc(alloc, size);
+        slot->cap = size;
+    }
+    slot->size = fetch_raw_frame(loaded_traj, idx, slot->data);
+    slot->frame_idx = idx;
+    const md_timestamp_t t1 = md_time_current();
+
+    ra->fetch_ticks += (uint64_t)(t1 - t0);
+    ra->bytes_fetched += slot->size;
+    ra->frames_fetched += 1;
+}
+
+// Moves a fetched raw frame into the frame cache, frames which got there by other means are skipped
+static void read_ahead_commit(LoadedTrajectory* loaded_traj, const RawFrameSlot* slot) {
+    ReadAhead* ra = loaded_traj->read_ahead;
+    const md_timestamp_t t0 = md_time_current();
+
+    md_frame_data_t* frame_data;
+    md_frame_cache_lock_t* lock = 0;
+    if (!md_frame_cache_find_or_reserve(&loaded_traj->cache, slot->frame_idx, &frame_data, &lock)) {
+        if (fill_frame(loaded_traj, slot->frame_idx, frame_data, slot->data, slot->size)) {
+            read_ahead_mark_resident(ra, slot->frame_idx);
+        }
+    }
+    if (lock) {
+        md_frame_cache_frame_lock_release(lock);
+    }
+
+    const md_timestamp_t t1 = md_time_current();
+    ra->decode_ticks += (uint64_t)(t1 - t0);
+    ra->frames_decoded += 1;
+}
+
+static void read_ahead_drain(LoadedTrajectory* loaded_traj) {
+    ReadAhead* ra = loaded_traj->read_ahead;
+    uint32_t slot_idx;
+    while (ra->ready_slots.try_pop(slot_idx)) {
+        if (!ra->cancel) {
+            read_ahead_commit(loaded_traj, &ra->slots[slot_idx]);
+        }
+        ra->free_slots.push(slot_idx);
+    }
+}
+
+// I/O stage: Fetches raw frames in playback order into the ring of free slots.
+// When the ring is full, the stage decodes a ready frame itself rather than waiting for the decode stage.
+static void read_ahead_io_task(void* user_data) {
+    LoadedTrajectory* loaded_traj = (LoadedTrajectory*)user_data;
+    ReadAhead* ra = loaded_traj->read_ahead;
+
+    int64_t idx;
+    while ((idx = read_ahead_claim(ra)) != -1) {
+        uint32_t slot_idx;
+        bool have_slot = true;
+        while (!ra->free_slots.try_pop(slot_idx)) {
+            if (ra->cancel) {
+                have_slot = false;
+                break;
+            }
+            uint32_t ready_idx;
+            if (ra->ready_slots.try_pop(ready_idx)) {
+                read_ahead_commit(loaded_traj, &ra->slots[ready_idx]);
+                ra->free_slots.push(ready_idx);
+            } else {
+                // Every slot is being decoded by the other stage
+                std::this_thread::yield();
+            }
+        }
+        if (!have_slot) break;
+        read_ahead_fetch(ra, &ra->slots[slot_idx], loaded_traj, idx, loaded_traj->alloc);
+        ra->ready_slots.push(slot_idx);
+    }
+
+    read_ahead_drain(loaded_traj);
+}
+
+// Decode stage: Drains the ring of fetched frames.
+// If the ring is empty and the I/O stage lags behind, frames are claimed and fetched directly (work-stealing).
+static void read_ahead_decode_task(uint32_t, uint32_t, void* user_data) {
+    LoadedTrajectory* loaded_traj = (LoadedTrajectory*)user_data;
+    ReadAhead* ra = loaded_traj->read_ahead;
+
+    while (!ra->cancel) {
+        uint32_t slot_idx;
+        if (ra->ready_slots.try_pop(slot_idx)) {
+            read_ahead_commit(loaded_traj, &ra->slots[slot_idx]);
+            ra->free_slots.push(slot_idx);
+            continue;
+        }
+
+        const int64_t idx = read_ahead_claim(ra);
+        if (idx == -1) break;
+
+        const size_t size = fetch_raw_frame(loaded_traj, idx, 0);
+        RawFrameSlot local = {};
+        local.data = fetch_buffer_reserve(size);
+        local.cap  = fetch_buffer.cap;
+        read_ahead_fetch(ra, &local, loaded_traj, idx, md_heap_allocator);
+        read_ahead_commit(loaded_traj, &local);
+        ra->frames_stolen += 1;
+    }
+
+    read_ahead_drain(loaded_traj);
+}
+
 bool load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
     void* frame_data = &idx;
     return decode_frame_data(inst, frame_data, sizeof(int64_t), header, x, y, z);
 }
 
-md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc) {
-    ASSERT(mol);
-    ASSERT(alloc);
-
+static md_trajectory_loader_i* resolve_loader(str_t filename, md_trajectory_loader_i* loader) {
     if (!loader) {
         str_t ext;
         if (extract_ext(&ext, filename)) {
@@ -477,14 +1757,18 @@ md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const
     }
     if (!loader) {
         MD_LOG_ERROR("Unsupported file extension: '%.*s'", filename.len, filename.ptr);
-        return NULL;
     }
+    return loader;
+}
+
+// Takes ownership of internal_traj, num_shares is the number of trajectories which share the frame cache budget
+static md_trajectory_i* open_internal(str_t filename, md_trajectory_i* internal_traj, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, int64_t num_shares) {
+    ASSERT(internal_traj);
+    ASSERT(loader);
+    ASSERT(mol);
+    ASSERT(alloc);
+    ASSERT(num_shares > 0);
 
-    md_trajectory_i* internal_traj = loader->create(filename, alloc);
-    if (!internal_traj) {
-        return NULL;
-    }
-    
     if (md_trajectory_num_atoms(internal_traj) != mol->atom.count) {
         MD_LOG_ERROR("Trajectory is not compatible with the loaded molecule.");
         loader->destroy(internal_traj);
@@ -497,6 +1781,7 @@ md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const
     LoadedTrajectory* inst = alloc_loaded_trajectory((uint64_t)traj);
     inst->mol = mol;
     inst->loader = loader;
+    inst->file_identity = eval_cache_file_identity(filename);
     inst->traj = internal_traj;
     inst->cache = {0};
     inst->recenter_target = {0};
@@ -506,13 +1791,43 @@ md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const
     const uint64_t num_traj_frames      = md_trajectory_num_frames(internal_traj);
     const uint64_t frame_cache_size     = CLAMP(MEGABYTES(VIAMD_FRAME_CACHE_SIZE), MEGABYTES(4), md_os_physical_ram() / 4);
     const uint64_t approx_frame_size    = (uint64_t)mol->atom.count * 3 * sizeof(float);
-    const uint64_t max_num_cache_frames = frame_cache_size / approx_frame_size;
 
-    const int64_t num_cache_frames   = MIN(num_traj_frames, max_num_cache_frames);
-    
+    // A small portion of the budget is used for the derived (transformed) tier, the rest is spent on the raw tier
+    // The derived tier is private and split between the shares, the raw tier is shared between all trajectories of the molecule
+    const uint64_t raw_frame_size    = (uint64_t)mol->atom.count * 3 * sizeof(raw_coord_t) + sizeof(RawFrame);
+    const uint64_t derived_size      = (uint64_t)(frame_cache_size * DERIVED_CACHE_FRACTION);
+    const int64_t num_cache_frames   = MIN(num_traj_frames, MAX(2, derived_size / num_shares / approx_frame_size));
+    const uint64_t used_cache_size   = num_cache_frames * approx_frame_size * num_shares;
+    const uint64_t free_cache_size   = frame_cache_size > used_cache_size ? frame_cache_size - used_cache_size : 0;
+    const int64_t num_raw_frames     = MIN(num_traj_frames * num_shares, free_cache_size / raw_frame_size);
+    inst->raw_cache = raw_cache_acquire(&inst->raw_owner, num_raw_frames, mol->atom.count, num_traj_frames, alloc);
+
+    MD_LOG_DEBUG("Initializing raw frame cache with %i frames (%i users).", (int)(inst->raw_cache ? inst->raw_cache->capacity : 0), (int)(inst->raw_cache ? inst->raw_cache->ref_count : 0));
     MD_LOG_DEBUG("Initializing frame cache with %i frames.", (int)num_cache_frames);
     md_frame_cache_init(&inst->cache, inst->traj, alloc, num_cache_frames);
     md_bitfield_init(&inst->recenter_target, alloc);
+    inst->read_ahead = read_ahead_create(MAX(num_cache_frames, num_raw_frames), alloc);
+    inst->transform_key = transform_fingerprint(&inst->recenter_target, inst->deperiodize);
+    inst->hint = {0, 1, 0, 0, 0, (int64_t)num_traj_frames, false};
+    inst->deperiodize_hints = create_deperiodize_hints(mol, alloc);
+
+    inst->loose_atoms = 0;
+    {
+        md_bitfield_t in_structure = {0};
+        md_bitfield_init(&in_structure, md_heap_allocator);
+        defer { md_bitfield_free(&in_structure); };
+        const int64_t num_structures = md_index_data_count(mol->structures);
+        for (int64_t s = 0; s < num_structures; ++s) {
+            for (int64_t j = mol->structures.offsets[s]; j < (int64_t)mol->structures.offsets[s + 1]; ++j) {
+                md_bitfield_set_bit(&in_structure, mol->structures.indices[j]);
+            }
+        }
+        for (int64_t i = 0; i < (int64_t)mol->atom.count; ++i) {
+            if (!md_bitfield_test_bit(&in_structure, i)) {
+                md_array_push(inst->loose_atoms, (int32_t)i, alloc);
+            }
+        }
+    }
 
     // We only overload load frame and decode frame data to apply PBC upon loading data
     traj->inst = (md_trajectory_o*)inst;
@@ -524,6 +1839,61 @@ md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const
     return traj;
 }
 
+static md_trajectory_i* open_shared(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, int64_t num_shares) {
+    ASSERT(mol);
+    loader = resolve_loader(filename, loader);
+    if (!loader) return NULL;
+
+    md_trajectory_i* internal_traj = loader->create(filename, alloc);
+    if (!internal_traj) return NULL;
+
+    return open_internal(filename, internal_traj, loader, mol, alloc, num_shares);
+}
+
+md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc) {
+    return open_shared(filename, loader, mol, alloc, 1);
+}
+
+md_trajectory_i* scan_file(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc) {
+    ASSERT(alloc);
+    loader = resolve_loader(filename, loader);
+    if (!loader) return NULL;
+    return loader->create(filename, alloc);
+}
+
+md_trajectory_i* open_scanned(str_t filename, md_trajectory_i* scan, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc) {
+    ASSERT(scan);
+    ASSERT(loader);
+    return open_internal(filename, scan, loader, mol, alloc, 1);
+}
+
+void free_scan(md_trajectory_i* scan, md_trajectory_loader_i* loader) {
+    if (scan && loader) {
+        loader->destroy(scan);
+    }
+}
+
+size_t open_ensemble(md_trajectory_i** out_trajs, const str_t* filenames, size_t count, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc) {
+    ASSERT(out_trajs);
+    ASSERT(filenames);
+
+    if (count > MAX_LOADED_TRAJECTORIES) {
+        MD_LOG_ERROR("Ensemble exceeds the maximum number of loaded trajectories (%i).", MAX_LOADED_TRAJECTORIES);
+        return 0;
+    }
+
+    size_t num_opened = 0;
+    for (size_t i = 0; i < count; ++i) {
+        md_trajectory_i* traj = open_shared(filenames[i], loader, mol, alloc, (int64_t)count);
+        if (!traj) {
+            MD_LOG_ERROR("Failed to open ensemble member '%.*s'.", (int)filenames[i].len, filenames[i].ptr);
+            continue;
+        }
+        out_trajs[num_opened++] = traj;
+    }
+    return num_opened;
+}
+
 bool close(md_trajectory_i* traj) {
     ASSERT(traj);
 
@@ -538,6 +1908,26 @@ bool close(md_trajectory_i* traj) {
     return false;
 }
 
+static uint64_t transform_fingerprint(const md_bitfield_t* recenter_target, bool deperiodize) {
+    // FNV-1a over the set bits
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    md_bitfield_iter_t it = md_bitfield_iter_create(recenter_target);
+    while (md_bitfield_iter_next(&it)) {
+        hash = (hash ^ md_bitfield_iter_idx(&it)) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ (deperiodize ? 1 : 0)) * 0x100000001b3ULL;
+    return hash;
+}
+
+// The derived tier is only invalidated if the transform actually changed, the raw tier is kept
+static void update_transform_key(LoadedTrajectory* loaded_traj) {
+    const uint64_t key = transform_fingerprint(&loaded_traj->recenter_target, loaded_traj->deperiodize);
+    if (key != loaded_traj->transform_key) {
+        md_frame_cache_clear(&loaded_traj->cache);
+        loaded_traj->transform_key = key;
+    }
+}
+
 bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask) {
     ASSERT(traj);
 
@@ -549,6 +1939,7 @@ bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask)
         else {
             md_bitfield_clear(&loaded_traj->recenter_target);
         }
+        update_transform_key(loaded_traj);
         return true;
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
@@ -561,12 +1952,46 @@ bool set_deperiodize(md_trajectory_i* traj, bool deperiodize) {
 	LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
 	if (loaded_traj) {
     	loaded_traj->deperiodize = deperiodize;
+        update_transform_key(loaded_traj);
     	return true;
     }
 	MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
 	return false;
 }
 
+uint64_t transform_key(const md_trajectory_i* traj) {
+    ASSERT(traj);
+    const LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    return loaded_traj ? loaded_traj->transform_key : 0;
+}
+
+uint64_t file_identity(const md_trajectory_i* traj) {
+    ASSERT(traj);
+    const LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    return loaded_traj ? loaded_traj->file_identity : 0;
+}
+
+bool set_block_cache(md_trajectory_i* traj, bool enable) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+    if (enable == (loaded_traj->block_cache != NULL)) return true;
+
+    // The fetches of the read-ahead pipeline go through the block cache
+    read_ahead_stop(loaded_traj->read_ahead);
+    if (enable) {
+        loaded_traj->block_cache = frame_block_cache_open(loaded_traj->file_identity, md_trajectory_num_frames(loaded_traj->traj));
+        return loaded_traj->block_cache != NULL;
+    }
+    frame_block_cache_close(loaded_traj->block_cache);
+    loaded_traj->block_cache = NULL;
+    return true;
+}
+
 bool clear_cache(md_trajectory_i* traj) {
     ASSERT(traj);
 
@@ -584,12 +2009,207 @@ size_t num_cache_frames(md_trajectory_i* traj) {
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
-        return md_frame_cache_num_frames(&loaded_traj->cache);
+        return cache_capacity(loaded_traj);
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
     return 0;
 }
 
+size_t cache_memory_usage() {
+    size_t bytes = 0;
+    for (int64_t i = 0; i < num_raw_caches; ++i) {
+        bytes += (size_t)raw_caches[i]->capacity * raw_frame_bytes(raw_caches[i]);
+    }
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        const LoadedTrajectory* loaded_traj = &loaded_trajectories[i];
+        if (!loaded_traj->key) continue;
+        bytes += md_frame_cache_num_frames(&loaded_traj->cache) * loaded_traj->mol->atom.count * 3 * sizeof(float);
+    }
+    return bytes;
+}
+
+size_t cache_release_memory(size_t bytes) {
+    size_t released = 0;
+    for (int64_t i = 0; i < num_raw_caches && released < bytes; ++i) {
+        RawFrameCache* rc = raw_caches[i];
+        const size_t frame_bytes = raw_frame_bytes(rc);
+        const int64_t num_frames = (int64_t)((bytes - released + frame_bytes - 1) / frame_bytes);
+        const int64_t capacity = MAX(RAW_CACHE_MIN_FRAMES, rc->capacity - num_frames);
+        if (capacity >= rc->capacity) continue;
+        released += (size_t)(rc->capacity - capacity) * frame_bytes;
+        raw_cache_shrink(rc, capacity);
+    }
+    return released;
+}
+
+void set_cache_memory(bool huge_pages, NumaPolicy numa_policy) {
+    cache_huge_pages = huge_pages;
+    cache_numa_policy = numa_policy;
+}
+
+bool set_read_ahead_depth(md_trajectory_i* traj, size_t io_depth, size_t decode_depth) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        ReadAhead* ra = loaded_traj->read_ahead;
+        // The depths are picked up by the next launch of the pipeline
+        ra->io_depth = (uint32_t)CLAMP(io_depth, 1, READ_AHEAD_MAX_SLOTS);
+        ra->decode_depth = (uint32_t)MAX(decode_depth, 1);
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+bool get_read_ahead_stats(ReadAheadStats* stats, const md_trajectory_i* traj) {
+    ASSERT(stats);
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        const ReadAhead* ra = loaded_traj->read_ahead;
+        const double fetch_sec  = md_time_as_seconds((md_timestamp_t)ra->fetch_ticks.load());
+        const double decode_sec = md_time_as_seconds((md_timestamp_t)ra->decode_ticks.load());
+
+        stats->io_depth       = ra->io_depth;
+        stats->decode_depth   = ra->decode_depth;
+        stats->frames_fetched = ra->frames_fetched;
+        stats->frames_decoded = ra->frames_decoded;
+        stats->frames_stolen  = ra->frames_stolen;
+        stats->bytes_fetched  = ra->bytes_fetched;
+        stats->fetch_mb_per_sec      = fetch_sec  > 0 ? (double)ra->bytes_fetched / (1024.0 * 1024.0) / fetch_sec : 0;
+        stats->decode_frames_per_sec = decode_sec > 0 ? (double)ra->frames_decoded / decode_sec : 0;
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+bool read_ahead_stop(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        read_ahead_stop(loaded_traj->read_ahead);
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+bool set_playback_hint(md_trajectory_i* traj, const PlaybackHint& hint) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        loaded_traj->hint = hint;
+        if (RawFrameCache* rc = loaded_traj->raw_cache) {
+            spin_lock(&rc->lock);
+            loaded_traj->raw_owner->hint = hint;
+            loaded_traj->raw_owner->has_hint = true;
+            spin_unlock(&rc->lock);
+        }
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+size_t read_ahead_depth_for_playback(const md_trajectory_i* traj, double fps) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return 0;
+    }
+
+    const ReadAhead* ra = loaded_traj->read_ahead;
+    const uint64_t num_fetched = ra->frames_fetched;
+    const uint64_t num_decoded = ra->frames_decoded;
+
+    // Latency of a single frame through both stages, before anything is measured we assume something conservative
+    double latency = 0.1;
+    if (num_fetched > 0 && num_decoded > 0) {
+        latency = md_time_as_seconds((md_timestamp_t)ra->fetch_ticks.load()) / num_fetched + md_time_as_seconds((md_timestamp_t)ra->decode_ticks.load()) / num_decoded;
+    }
+
+    // Frames in flight are spread over the decoders, but a frame has to be started at least its latency before it is displayed.
+    // Use a factor of two as a margin, since the window is only relaunched once the previous one has completed.
+    const double frames = fabs(fps) * latency * 2.0 + READ_AHEAD_MIN_DEPTH;
+    return (size_t)CLAMP(ceil(frames), (double)READ_AHEAD_MIN_DEPTH, (double)cache_capacity(loaded_traj));
+}
+
+task_system::ID read_ahead(md_trajectory_i* traj, int64_t frame_idx, int direction) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return task_system::INVALID_ID;
+    }
+
+    ReadAhead* ra = loaded_traj->read_ahead;
+    // Both stages are launched when enqueued below, so they read as running until they have completed
+    if (task_system::task_is_running(ra->io_task) || task_system::task_is_running(ra->decode_task)) {
+        return ra->decode_task;
+    }
+
+    const int64_t num_frames = (int64_t)md_trajectory_num_frames(loaded_traj->traj);
+    if (num_frames == 0) {
+        return task_system::INVALID_ID;
+    }
+
+    // The window can never be larger than what the cache holds, otherwise we evict the frames we just decoded
+    const int64_t depth = MIN((int64_t)ra->decode_depth, (int64_t)cache_capacity(loaded_traj));
+    frame_idx = CLAMP(frame_idx, 0, num_frames - 1);
+    direction = direction < 0 ? -1 : 1;
+
+    const PlaybackHint& hint = loaded_traj->hint;
+    const int64_t range_beg = CLAMP(hint.range_beg, 0, num_frames);
+    const int64_t range_end = CLAMP(hint.range_end, range_beg, num_frames);
+
+    ra->frame_beg   = frame_idx;
+    ra->direction   = direction;
+    if (hint.loop && range_end > range_beg) {
+        ra->wrap_beg    = range_beg;
+        ra->wrap_len    = range_end - range_beg;
+        ra->frame_count = MIN(depth, ra->wrap_len);
+    } else {
+        ra->wrap_beg    = 0;
+        ra->wrap_len    = 0;
+        ra->frame_count = direction > 0 ? MIN(depth, num_frames - frame_idx) : MIN(depth, frame_idx + 1);
+    }
+    ra->cursor      = 0;
+    ra->cancel      = false;
+
+    // Reset the ring with the current io depth
+    uint32_t slot_idx;
+    while (ra->free_slots.try_pop(slot_idx)) {}
+    while (ra->ready_slots.try_pop(slot_idx)) {}
+    for (uint32_t i = 0; i < READ_AHEAD_MAX_SLOTS; ++i) {
+        if (i < ra->io_depth) {
+            ra->free_slots.push(i);
+        }
+        else if (ra->slots[i].data) {
+            md_free(loaded_traj->alloc, ra->slots[i].data, ra->slots[i].cap);
+            ra->slots[i] = {};
+        }
+    }
+
+    // A single I/O thread keeps the access pattern sequential, the remaining workers decode
+    const uint32_t num_decoders = MAX(1, (int)task_system::pool_num_threads() - 1);
+    ra->decode_task = task_system::pool_enqueue(STR("##Read-ahead Decode"), 0, num_decoders, read_ahead_decode_task, loaded_traj);
+    ra->io_task     = task_system::pool_enqueue(STR("##Read-ahead I/O"), read_ahead_io_task, loaded_traj);
+
+    // Launched now rather than with the queue of the frame, otherwise the guard above and read_ahead_stop would not see them
+    task_system::execute_task(ra->decode_task);
+    task_system::execute_task(ra->io_task);
+
+    return ra->decode_task;
+}
+
 }  // namespace traj
 
 }  // namespace load
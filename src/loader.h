@@ -1,6 +1,8 @@
 #pragma once
 
 #include <core/md_str.h>
+#include <task_system.h>
+#include <numa_memory.h>
 
 struct md_allocator_i;
 struct md_molecule_t;
@@ -43,13 +45,96 @@ namespace traj {
     md_trajectory_loader_i* loader_from_ext(str_t ext);
 
     md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc);
+
+    // Opening is split in two so the frame index can be built before the molecule is loaded
+    // scan_file only reads the file and builds its frame index, which is the expensive part of opening a trajectory
+    // open_scanned takes ownership of the scan and checks it against the molecule, the scan is freed if it is not compatible
+    // loader must be the one which created the scan, resolve it with loader_from_ext beforehand if it is not known
+    md_trajectory_i* scan_file(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc);
+    md_trajectory_i* open_scanned(str_t filename, md_trajectory_i* scan, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc);
+    void free_scan(md_trajectory_i* scan, md_trajectory_loader_i* loader);
     bool close(md_trajectory_i* traj);
 
+    // Open an ensemble of trajectories (e.g. replicas) of the same molecule which share one frame cache budget
+    // Eviction of raw frames is global over the ensemble, frames of members which are not played back are evicted first
+    // Each member is a regular trajectory which is closed individually and can be evaluated concurrently with the others
+    // Returns the number of trajectories written to out_trajs, members which fail to open are skipped
+    size_t open_ensemble(md_trajectory_i** out_trajs, const str_t* filenames, size_t count, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc);
+
+    // The cache is split into a raw tier (decoded frames) and a derived tier (recentered and deperiodized frames)
+    // Changing the transform only invalidates the derived tier if the transform actually changed
     bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask);
     bool set_deperiodize(md_trajectory_i* traj, bool deperiodize);
 
+    // Fingerprint of the transform which is applied to the frames (recenter target and deperiodize flag), stable between sessions
+    // 0 if the trajectory was not loaded with the loader
+    uint64_t transform_key(const md_trajectory_i* traj);
+    // Identity of the file as it was when the trajectory was opened (see eval_cache_file_identity), 0 if the trajectory was not loaded with the loader
+    uint64_t file_identity(const md_trajectory_i* traj);
+
+    // Keeps a copy of the raw frame data in the local block cache (see frame_block_cache.h), for trajectories which are read from slow storage
+    // This is meant to be set right after opening, frames must not be loaded concurrently while it changes
+    bool set_block_cache(md_trajectory_i* traj, bool enable);
+
+    // Clears the derived tier, the raw tier is kept
     bool clear_cache(md_trajectory_i* traj);
+    // Number of frames which can be held in memory
     size_t num_cache_frames(md_trajectory_i* traj);
+
+    // Bytes held by the frame caches of all open trajectories
+    size_t cache_memory_usage();
+    // Shrinks the raw tiers by at least bytes if they are large enough, returns the number of bytes released
+    // The derived tiers keep their size, the raw tiers keep a minimum number of frames
+    size_t cache_release_memory(size_t bytes);
+
+    // Memory of the raw tiers which are created after the call (see numa_memory.h)
+    // Huge pages cut the TLB misses of sweeps over large caches, numa_policy places the frames on the nodes of the machine. With
+    // NumaPolicy_Partition the slots are split between the nodes and decoded frames are stored on the node of the worker which decodes them.
+    void set_cache_memory(bool huge_pages, NumaPolicy numa_policy);
+
+    // Read-ahead pipeline
+    // The I/O stage fetches raw frame blobs in playback order into a bounded ring of io_depth slots.
+    // The decode stage drains the ring on the thread-pool and fills the frame cache.
+    // decode_depth is the number of frames ahead of the playhead which the pipeline tries to keep resident.
+    struct ReadAheadStats {
+        size_t io_depth;
+        size_t decode_depth;
+        size_t frames_fetched;
+        size_t frames_decoded;
+        size_t frames_stolen;       // Frames which the decode stage had to fetch itself since the I/O stage lagged behind
+        size_t bytes_fetched;
+        double fetch_mb_per_sec;    // I/O stage throughput
+        double decode_frames_per_sec;
+    };
+
+    bool set_read_ahead_depth(md_trajectory_i* traj, size_t io_depth, size_t decode_depth);
+    bool get_read_ahead_stats(ReadAheadStats* stats, const md_trajectory_i* traj);
+
+    // Launch the pipeline starting at frame_idx in the direction given by the sign of direction
+    // If the playback hint has loop set, the window wraps around within its range
+    // Returns the id of the decode stage, which completes when the window is resident (or the pipeline is stopped)
+    // If the pipeline is already running, the id of the running decode stage is returned
+    task_system::ID read_ahead(md_trajectory_i* traj, int64_t frame_idx, int direction);
+
+    // Cancel the pipeline and wait for both stages to finish
+    bool read_ahead_stop(md_trajectory_i* traj);
+
+    // Playback state which is used to prioritize frames in the cache and to shape the read-ahead window
+    // Frames outside of [range_beg, range_end) are evicted first, then frames behind the playhead, then the least recently used
+    struct PlaybackHint {
+        double  frame;          // Playhead
+        double  fps;            // The sign gives the direction of playback
+        int32_t support_beg;    // Number of frames needed before the playhead for interpolation (e.g. 1 for cubic)
+        int32_t support_end;    // Number of frames needed after the playhead for interpolation (e.g. 2 for cubic)
+        int64_t range_beg;
+        int64_t range_end;
+        bool    loop;           // Playback wraps around within the range
+    };
+
+    bool set_playback_hint(md_trajectory_i* traj, const PlaybackHint& hint);
+
+    // Number of frames the read-ahead needs to stay ahead of the playhead to cover the measured fetch and decode latency at fps
+    size_t read_ahead_depth_for_playback(const md_trajectory_i* traj, double fps);
 }
 
 }  // namespace load
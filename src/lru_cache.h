@@ -0,0 +1,394 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+
+#include <memory_budget.h>
+
+// Least recently used cache of derived data, with O(1) lookup, insertion and eviction
+// The entries are kept in a fixed pool, indexed by a chained hash table and linked in the order of their use.
+// Every entry carries the number of bytes it holds, and entries are evicted from the least recently used end
+// whenever the number of entries or the total of the bytes exceeds the limits of the cache.
+// Evicted values are handed to the release callback, which frees what the value owns. It is called with the cache locked and must not use the cache.
+//
+// All functions are thread safe (a spinlock guards the index, lookups are short). A value returned by lru_cache_acquire
+// is pinned and is not evicted until it is released, lru_cache_get copies the value instead, which suits handles and small values.
+//
+// A cache can be registered with the memory budget, so all caches share one budget and are released in the same order (least recently used first).
+
+#define LRU_CACHE_NIL UINT32_MAX
+
+// Keys are hashed with lru_cache_hash, which is overloaded for the integer keys (fingerprints)
+// Other keys are hashed by their bytes and must not contain padding, or supply an overload of their own
+template <typename Key>
+static inline uint64_t lru_cache_hash(const Key& key) {
+    // FNV-1a
+    const uint8_t* p = (const uint8_t*)&key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(Key); ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static inline uint64_t lru_cache_hash(const uint64_t& key) {
+    // Fingerprints are often timestamps, which differ mostly in the low bits
+    uint64_t z = key;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t lru_cache_hash(const uint32_t& key) {
+    const uint64_t k = key;
+    return lru_cache_hash(k);
+}
+
+struct LruCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t   count;
+    size_t   bytes;
+};
+
+template <typename Key, typename Value>
+struct LruCache {
+    typedef Key   KeyType;
+    typedef Value ValueType;
+    typedef void (*ReleaseFn)(const Key& key, Value* value, void* user_data);
+
+    struct Entry {
+        Key      key;
+        Value    value;
+        size_t   bytes;
+        uint32_t prev;          // Towards the most recently used
+        uint32_t next;          // Towards the least recently used, also links the free entries
+        uint32_t chain;         // Next entry of the bucket
+        uint32_t pins;
+    };
+
+    Entry*    entries = nullptr;    // [capacity]
+    uint32_t* buckets = nullptr;    // [bucket_mask + 1] First entry of each bucket
+    uint32_t  bucket_mask = 0;
+    uint32_t  capacity = 0;
+    uint32_t  count = 0;
+    uint32_t  head = LRU_CACHE_NIL; // Most recently used
+    uint32_t  tail = LRU_CACHE_NIL; // Least recently used
+    uint32_t  free_list = LRU_CACHE_NIL;
+    size_t    bytes = 0;
+    size_t    max_bytes = 0;        // 0 for no limit other than the capacity
+
+    ReleaseFn release = nullptr;
+    void*     user_data = nullptr;
+
+    uint64_t  hits = 0;
+    uint64_t  misses = 0;
+    uint64_t  evictions = 0;
+    uint32_t  budget_id = 0;
+
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    md_allocator_i* alloc = nullptr;
+};
+
+namespace lru_cache_detail {
+
+template <typename Key, typename Value>
+static inline void lock(LruCache<Key, Value>* c) {
+    while (c->lock.test_and_set(std::memory_order_acquire)) {}
+}
+
+template <typename Key, typename Value>
+static inline void unlock(LruCache<Key, Value>* c) {
+    c->lock.clear(std::memory_order_release);
+}
+
+template <typename Key, typename Value>
+static inline uint32_t* bucket(LruCache<Key, Value>* c, const Key& key) {
+    return &c->buckets[lru_cache_hash(key) & c->bucket_mask];
+}
+
+template <typename Key, typename Value>
+static uint32_t find(LruCache<Key, Value>* c, const Key& key) {
+    for (uint32_t i = *bucket(c, key); i != LRU_CACHE_NIL; i = c->entries[i].chain) {
+        if (c->entries[i].key == key) return i;
+    }
+    return LRU_CACHE_NIL;
+}
+
+template <typename Key, typename Value>
+static void unlink(LruCache<Key, Value>* c, uint32_t i) {
+    auto& e = c->entries[i];
+    if (e.prev != LRU_CACHE_NIL) c->entries[e.prev].next = e.next; else c->head = e.next;
+    if (e.next != LRU_CACHE_NIL) c->entries[e.next].prev = e.prev; else c->tail = e.prev;
+    e.prev = e.next = LRU_CACHE_NIL;
+}
+
+template <typename Key, typename Value>
+static void push_front(LruCache<Key, Value>* c, uint32_t i) {
+    auto& e = c->entries[i];
+    e.prev = LRU_CACHE_NIL;
+    e.next = c->head;
+    if (c->head != LRU_CACHE_NIL) c->entries[c->head].prev = i; else c->tail = i;
+    c->head = i;
+}
+
+template <typename Key, typename Value>
+static void touch(LruCache<Key, Value>* c, uint32_t i) {
+    if (c->head == i) return;
+    unlink(c, i);
+    push_front(c, i);
+}
+
+// Removes the entry from the index and the list, and hands the value to the release callback
+template <typename Key, typename Value>
+static void remove(LruCache<Key, Value>* c, uint32_t i) {
+    auto& e = c->entries[i];
+    uint32_t* link = bucket(c, e.key);
+    while (*link != i) link = &c->entries[*link].chain;
+    *link = e.chain;
+    unlink(c, i);
+
+    if (c->release) c->release(e.key, &e.value, c->user_data);
+    c->bytes -= e.bytes;
+    c->count -= 1;
+    e = {};
+    e.next = c->free_list;
+    c->free_list = i;
+}
+
+// Evicts unpinned entries from the least recently used end until extra entries and bytes fit, returns the bytes released
+template <typename Key, typename Value>
+static size_t evict(LruCache<Key, Value>* c, uint32_t extra_count, size_t extra_bytes, size_t min_release = 0) {
+    size_t released = 0;
+    uint32_t i = c->tail;
+    while (i != LRU_CACHE_NIL) {
+        const bool over_count = c->count + extra_count > c->capacity;
+        const bool over_bytes = c->max_bytes && c->bytes + extra_bytes > c->max_bytes;
+        if (!over_count && !over_bytes && released >= min_release) break;
+        const uint32_t prev = c->entries[i].prev;
+        if (c->entries[i].pins == 0) {
+            released += c->entries[i].bytes;
+            c->evictions += 1;
+            remove(c, i);
+        }
+        i = prev;
+    }
+    return released;
+}
+
+}  // namespace lru_cache_detail
+
+// capacity is the maximum number of entries, max_bytes the maximum of their total bytes (0 for no limit)
+template <typename Key, typename Value>
+void lru_cache_init(LruCache<Key, Value>* c, uint32_t capacity, size_t max_bytes, md_allocator_i* alloc,
+                    typename LruCache<Key, Value>::ReleaseFn release = nullptr, void* user_data = nullptr) {
+    ASSERT(c);
+    ASSERT(alloc);
+    ASSERT(capacity > 0 && capacity < LRU_CACHE_NIL);
+    using Entry = typename LruCache<Key, Value>::Entry;
+
+    uint32_t num_buckets = 1;
+    while (num_buckets < capacity * 2) num_buckets <<= 1;
+
+    c->alloc = alloc;
+    c->capacity = capacity;
+    c->max_bytes = max_bytes;
+    c->release = release;
+    c->user_data = user_data;
+    c->bucket_mask = num_buckets - 1;
+    c->entries = (Entry*)md_alloc(alloc, sizeof(Entry) * capacity);
+    c->buckets = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * num_buckets);
+    for (uint32_t i = 0; i < capacity; ++i) {
+        c->entries[i] = {};
+        c->entries[i].next = (i + 1 < capacity) ? i + 1 : LRU_CACHE_NIL;
+    }
+    MEMSET(c->buckets, 0xFF, sizeof(uint32_t) * num_buckets);
+    c->free_list = 0;
+    c->head = c->tail = LRU_CACHE_NIL;
+    c->count = 0;
+    c->bytes = 0;
+    c->hits = c->misses = c->evictions = 0;
+}
+
+// Releases every entry, pinned or not
+template <typename Key, typename Value>
+void lru_cache_clear(LruCache<Key, Value>* c) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    while (c->tail != LRU_CACHE_NIL) {
+        lru_cache_detail::remove(c, c->tail);
+    }
+    lru_cache_detail::unlock(c);
+}
+
+template <typename Key, typename Value>
+void lru_cache_free(LruCache<Key, Value>* c) {
+    ASSERT(c);
+    using Entry = typename LruCache<Key, Value>::Entry;
+    if (!c->alloc) return;
+    if (c->budget_id) memory_budget_unregister(c->budget_id);
+    lru_cache_clear(c);
+    md_free(c->alloc, c->entries, sizeof(Entry) * c->capacity);
+    md_free(c->alloc, c->buckets, sizeof(uint32_t) * (c->bucket_mask + 1));
+    c->entries = nullptr;
+    c->buckets = nullptr;
+    c->capacity = 0;
+    c->budget_id = 0;
+    c->alloc = nullptr;
+}
+
+// Copies the value of key to out and marks it as the most recently used, returns false on a miss
+template <typename Key, typename Value>
+bool lru_cache_get(LruCache<Key, Value>* c, const typename LruCache<Key, Value>::KeyType& key, Value* out) {
+    ASSERT(c);
+    ASSERT(out);
+    lru_cache_detail::lock(c);
+    const uint32_t i = lru_cache_detail::find(c, key);
+    if (i != LRU_CACHE_NIL) {
+        lru_cache_detail::touch(c, i);
+        *out = c->entries[i].value;
+        c->hits += 1;
+    } else {
+        c->misses += 1;
+    }
+    lru_cache_detail::unlock(c);
+    return i != LRU_CACHE_NIL;
+}
+
+// Returns true if key is cached, without marking it as used
+template <typename Key, typename Value>
+bool lru_cache_contains(LruCache<Key, Value>* c, const typename LruCache<Key, Value>::KeyType& key) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    const bool found = lru_cache_detail::find(c, key) != LRU_CACHE_NIL;
+    lru_cache_detail::unlock(c);
+    return found;
+}
+
+// Returns the value of key, which is pinned until lru_cache_release is called for key, NULL on a miss
+template <typename Key, typename Value>
+Value* lru_cache_acquire(LruCache<Key, Value>* c, const typename LruCache<Key, Value>::KeyType& key) {
+    ASSERT(c);
+    Value* value = nullptr;
+    lru_cache_detail::lock(c);
+    const uint32_t i = lru_cache_detail::find(c, key);
+    if (i != LRU_CACHE_NIL) {
+        lru_cache_detail::touch(c, i);
+        c->entries[i].pins += 1;
+        value = &c->entries[i].value;
+        c->hits += 1;
+    } else {
+        c->misses += 1;
+    }
+    lru_cache_detail::unlock(c);
+    return value;
+}
+
+template <typename Key, typename Value>
+void lru_cache_release(LruCache<Key, Value>* c, const typename LruCache<Key, Value>::KeyType& key) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    const uint32_t i = lru_cache_detail::find(c, key);
+    ASSERT(i != LRU_CACHE_NIL && c->entries[i].pins > 0);
+    if (i != LRU_CACHE_NIL && c->entries[i].pins > 0) {
+        c->entries[i].pins -= 1;
+    }
+    lru_cache_detail::unlock(c);
+}
+
+// Inserts the value of key as the most recently used entry, replacing (and releasing) a previous value of the key
+// Least recently used entries are evicted to make room. Returns false if there is no room, in which case the value is not taken and the caller keeps what it owns
+template <typename Key, typename Value>
+bool lru_cache_put(LruCache<Key, Value>* c, const typename LruCache<Key, Value>::KeyType& key, const typename LruCache<Key, Value>::ValueType& value, size_t bytes) {
+    ASSERT(c);
+    ASSERT(c->entries);
+    if (c->max_bytes && bytes > c->max_bytes) return false;
+
+    lru_cache_detail::lock(c);
+    uint32_t i = lru_cache_detail::find(c, key);
+    if (i != LRU_CACHE_NIL) {
+        if (c->entries[i].pins > 0) {
+            lru_cache_detail::unlock(c);
+            return false;
+        }
+        lru_cache_detail::remove(c, i);
+    }
+    lru_cache_detail::evict(c, 1, bytes);
+
+    i = c->free_list;
+    const bool fits = i != LRU_CACHE_NIL && !(c->max_bytes && c->bytes + bytes > c->max_bytes);
+    if (fits) {
+        auto& e = c->entries[i];
+        c->free_list = e.next;
+        e.key = key;
+        e.value = value;
+        e.bytes = bytes;
+        e.pins = 0;
+        uint32_t* b = lru_cache_detail::bucket(c, key);
+        e.chain = *b;
+        *b = i;
+        lru_cache_detail::push_front(c, i);
+        c->count += 1;
+        c->bytes += bytes;
+    }
+    lru_cache_detail::unlock(c);
+    return fits;
+}
+
+// Removes (and releases) the entry of key, returns false on a miss or if the entry is pinned
+template <typename Key, typename Value>
+bool lru_cache_erase(LruCache<Key, Value>* c, const typename LruCache<Key, Value>::KeyType& key) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    const uint32_t i = lru_cache_detail::find(c, key);
+    const bool erased = i != LRU_CACHE_NIL && c->entries[i].pins == 0;
+    if (erased) lru_cache_detail::remove(c, i);
+    lru_cache_detail::unlock(c);
+    return erased;
+}
+
+// Evicts least recently used entries until at least bytes are released (or only pinned entries remain), returns the bytes released
+template <typename Key, typename Value>
+size_t lru_cache_release_memory(LruCache<Key, Value>* c, size_t bytes) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    const size_t released = lru_cache_detail::evict(c, 0, 0, bytes);
+    lru_cache_detail::unlock(c);
+    return released;
+}
+
+template <typename Key, typename Value>
+size_t lru_cache_bytes(LruCache<Key, Value>* c) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    const size_t bytes = c->bytes;
+    lru_cache_detail::unlock(c);
+    return bytes;
+}
+
+template <typename Key, typename Value>
+LruCacheStats lru_cache_stats(LruCache<Key, Value>* c) {
+    ASSERT(c);
+    lru_cache_detail::lock(c);
+    const LruCacheStats stats = {c->hits, c->misses, c->evictions, c->count, c->bytes};
+    lru_cache_detail::unlock(c);
+    return stats;
+}
+
+// Accounts the bytes of the cache in the memory budget, which evicts from it when the budget is exceeded. The cache is unregistered by lru_cache_free
+// The name must stay valid while the cache is registered
+template <typename Key, typename Value>
+bool lru_cache_register_budget(LruCache<Key, Value>* c, const char* name, MemoryPriority priority = MemoryPriority_Cache) {
+    ASSERT(c);
+    if (c->budget_id) memory_budget_unregister(c->budget_id);
+    c->budget_id = memory_budget_register(name, priority,
+        [](void* user_data) { return lru_cache_bytes((LruCache<Key, Value>*)user_data); },
+        [](size_t bytes, void* user_data) { return lru_cache_release_memory((LruCache<Key, Value>*)user_data, bytes); }, c);
+    return c->budget_id != 0;
+}
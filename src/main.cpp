@@ -25,7 +25,6 @@
 #include <core/md_array.h>
 #include <core/md_allocator.h>
 #include <core/md_arena_allocator.h>
-#include <core/md_linear_allocator.h>
 #include <core/md_tracking_allocator.h>
 #include <core/md_simd.h>
 #include <core/md_os.h>
@@ -41,6 +40,9 @@
 #include <gfx/immediate_draw_utils.h>
 #include <gfx/postprocessing_utils.h>
 #include <gfx/volumerender_utils.h>
+#include <gfx/culling_utils.h>
+#include <gfx/sdf_utils.h>
+#include <gfx/gpu_timing.h>
 
 #include <halton.h>
 #include <imgui_widgets.h>
@@ -48,6 +50,34 @@
 #include <task_system.h>
 #include <color_utils.h>
 #include <loader.h>
+#include <progressive.h>
+#include <trajectory_sweep.h>
+#include <superposition.h>
+#include <frame_similarity.h>
+#include <atom_statistics.h>
+#include <contacts.h>
+#include <scrub_proxy.h>
+#include <vis_cache.h>
+#include <lru_cache.h>
+#include <histogram.h>
+#include <timeline_lod.h>
+#include <cell_list.h>
+#include <picking_bvh.h>
+#include <versioned_bitfield.h>
+#include <table_export.h>
+#include <volume_export.h>
+#include <chunked_trajectory.h>
+#include <backbone_data.h>
+#include <script_fingerprint.h>
+#include <eval_cache.h>
+#include <mol_snapshot.h>
+#include <mol_postprocess.h>
+#include <frame_block_cache.h>
+#include <memory_budget.h>
+#include <memory_tracker.h>
+#include <frame_arena.h>
+#include <bench.h>
+#include <cpu_profiler.h>
 #include <ramachandran.h>
 #include <image.h>
 #include <application/application.h>
@@ -62,7 +92,11 @@
 #include <imgui_notify.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
 #include <bitset>
+#include <atomic>
+#include <new>
 
 #define MAX_POPULATION_SIZE 256
 #define MAX_TEMPORAL_SUBPLOTS 10
@@ -70,9 +104,17 @@
 #define EXPERIMENTAL_GFX_API 0
 #define PICKING_JITTER_HACK 0
 #define COMPILATION_TIME_DELAY_IN_SECONDS 1.0
+#define EVALUATION_DEBOUNCE_IN_SECONDS 0.25
+#define FILTER_EVALUATION_DEBOUNCE_IN_SECONDS 0.05
+#define EVAL_CACHE_KEY_VERSION 2
 #define IR_SEMAPHORE_MAX_COUNT 3
 #define JITTER_SEQUENCE_SIZE 32
 #define MEASURE_EVALUATION_TIME 1
+#define SIMILAR_FRAMES 8  // Frames listed as similar to the current frame
+
+#ifndef VIAMD_BENCH
+#define VIAMD_BENCH 0     // Set by the viamd_bench target, which replays a session and records the frame timings (see bench.h)
+#endif
 
 #define GL_COLOR_ATTACHMENT_COLOR        GL_COLOR_ATTACHMENT0
 #define GL_COLOR_ATTACHMENT_NORMAL       GL_COLOR_ATTACHMENT1
@@ -80,26 +122,39 @@
 #define GL_COLOR_ATTACHMENT_PICKING      GL_COLOR_ATTACHMENT3
 #define GL_COLOR_ATTACHMENT_POST_TONEMAP GL_COLOR_ATTACHMENT4
 
-// For cpu profiling
-#define PUSH_CPU_SECTION(lbl) {};
-#define POP_CPU_SECTION() {};
+// For cpu profiling, the sections are recorded as zones (see cpu_profiler.h) and by the benchmark
+#if VIAMD_BENCH
+#define PUSH_CPU_SECTION(lbl) { CPU_ZONE_BEGIN(lbl); bench::push_section(lbl); };
+#define POP_CPU_SECTION() { bench::pop_section(); CPU_ZONE_END(); };
+#else
+#define PUSH_CPU_SECTION(lbl) { CPU_ZONE_BEGIN(lbl); };
+#define POP_CPU_SECTION() { CPU_ZONE_END(); };
+#endif
 
 // For gpu profiling
 #define PUSH_GPU_SECTION(lbl)                                                                   \
 {                                                                                               \
     if (glPushDebugGroup) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, GL_KHR_debug, -1, lbl); \
+    gpu_timing::push_section(lbl);                                                              \
 }
 #define POP_GPU_SECTION()                   \
 {                                           \
+    gpu_timing::pop_section();              \
     if (glPopDebugGroup) glPopDebugGroup(); \
 }
 
 #define LOG_INFO  MD_LOG_INFO
 #define LOG_DEBUG MD_LOG_DEBUG
 #define LOG_ERROR MD_LOG_ERROR
-#define LOG_SUCCESS(...) ImGui::InsertNotification(ImGuiToast(ImGuiToastType_Success, 6000, __VA_ARGS__))
+// Notifications are shown by the GUI, in headless mode they go to the log
+static bool headless_mode = false;
+#define LOG_SUCCESS(...) do { if (headless_mode) { MD_LOG_INFO(__VA_ARGS__); } else { ImGui::InsertNotification(ImGuiToast(ImGuiToastType_Success, 6000, __VA_ARGS__)); } } while (0)
 
 constexpr str_t shader_output_snippet = STR(R"(
+#ifndef ATOM_INDEX_TAG
+#define ATOM_INDEX_TAG 0U
+#endif
+
 layout(location = 0) out vec4 out_color;
 layout(location = 1) out vec4 out_normal;
 layout(location = 2) out vec4 out_velocity;
@@ -133,7 +188,7 @@ void write_fragment(vec3 view_coord, vec3 view_vel, vec3 view_normal, vec4 color
    out_color  = color;
    out_normal = vec4(encode_normal(view_normal), 0, 0);
    out_velocity = vec4(compute_ss_vel(view_coord, view_vel), 0, 0);
-   out_atom_index = encode_index(atom_index);
+   out_atom_index = encode_index(atom_index | ATOM_INDEX_TAG);
 }
 )");
 
@@ -179,7 +234,7 @@ enum class InterpolationMode { Nearest, Linear, CubicSpline };
 enum class SelectionLevel { Atom, Residue, Chain };
 enum class SelectionOperator { Or, And, AndNot, Set, Clear };
 enum class SelectionGrowth { CovalentBond, Radial };
-enum class RepresentationType { SpaceFill = MD_GL_REP_SPACE_FILL, Licorice = MD_GL_REP_LICORICE, BallAndStick = MD_GL_REP_BALL_AND_STICK, Ribbons = MD_GL_REP_RIBBONS, Cartoon = MD_GL_REP_CARTOON };
+enum class RepresentationType { SpaceFill = MD_GL_REP_SPACE_FILL, Licorice = MD_GL_REP_LICORICE, BallAndStick = MD_GL_REP_BALL_AND_STICK, Ribbons = MD_GL_REP_RIBBONS, Cartoon = MD_GL_REP_CARTOON, Sdf };
 enum class TrackingMode { Absolute, Relative };
 enum class CameraMode { Perspective, Orthographic };
 
@@ -193,7 +248,18 @@ enum class ColorMapping {
     ChainId,
     ChainIndex,
     SecondaryStructure,
-    Property
+    Property,
+    Fluctuation     // RMSF of the atoms (see ApplicationData::fluctuation)
+};
+
+// Slots of the consumers of the shared trajectory sweep
+enum SweepConsumer_ {
+    SweepConsumer_Backbone   = 0,
+    SweepConsumer_ShapeSpace = 1,
+    SweepConsumer_Tracking   = 2,
+    SweepConsumer_Similarity = 3,
+    SweepConsumer_Fluctuation = 4,
+    SweepConsumer_Contacts   = 5,
 };
 
 enum LegendColorMapMode_ {
@@ -207,6 +273,8 @@ enum AtomBit_ {
     AtomBit_Highlighted = 1,
     AtomBit_Selected    = 2,
     AtomBit_Visible     = 4,
+    AtomBit_InView      = 8,    // Within a chunk which passed the culling of representations
+    AtomBit_Detail      = 16,   // Within a chunk which is drawn as atoms and not as a proxy
 };
 
 enum MolBit_ {
@@ -246,6 +314,12 @@ struct GBuffer {
         GLuint fbo = 0;
     } deferred;
 
+    // Copy of the final image (without GUI), which is recomposited when the scene has not changed
+    struct {
+        GLuint tex = 0;
+        GLuint fbo = 0;
+    } composite;
+
     struct {
         // @NOTE: Many of each, we submit the read and use it some frame(s) later
         // This means that we read with N-1 frames latency
@@ -258,6 +332,165 @@ struct GBuffer {
     int height = 0;
 };
 
+// Distance field of a representation, which is built on the pool and ray-cast instead of drawn through md_gl
+// It is allocated separately, as the build refers to it while the representations move in memory
+struct SdfRepresentation {
+    sdf::Field field = {};
+    sdf::FieldData build = {};
+    task_system::ID task = 0;
+    bool build_ok = false;
+    bool dirty = true;
+    uint64_t key = 0;                   // Atoms and parameters of the field
+    md_array(uint32_t) atoms = 0;       // Atoms which are shown by the representation
+
+    // Copies of the spheres and parameters the build runs on, as the molecule is written while it runs
+    md_array(uint32_t) build_atoms = 0;
+    float radius_scale = 1.0f;
+    float voxel_size = 1.0f;
+    md_array(float) x = 0;
+    md_array(float) y = 0;
+    md_array(float) z = 0;
+    md_array(float) r = 0;
+};
+
+// Representations which show a small part of the atoms are drawn from a compacted molecule which only holds their atoms
+// The picking indices of a compacted molecule are tagged with its slot, which maps them back to indices of the molecule
+#define SUBSET_MAX_SLOTS 7
+#define SUBSET_INDEX_BITS 28            // Bits of the local index below the tag, the tag is kept clear of the bit of bond indices
+#define SUBSET_MAX_FRACTION 0.5f        // Representations which show more of the atoms use the molecule as is
+
+#define SCREENSHOT_MAX_IN_FLIGHT 2
+
+#define MOVIE_EXPORT_IN_FLIGHT 4
+
+#define TILED_RENDER_TILE_SIZE 2048
+#define TILED_RENDER_TILE_PAD  128      // Pixels rendered around each tile and cropped, which the screen space effects sample across the borders
+#define TILED_RENDER_MAX_SIZE  65536
+
+// The back buffer is read back into a PBO, which is mapped once its fence has signaled and then flipped and encoded on the pool
+struct ScreenshotCapture {
+    GLuint pbo = 0;
+    void* fence = 0;
+    const uint32_t* mapped = 0;     // Mapped while the task is running
+    int width = 0;
+    int height = 0;
+    image_t img = {};               // Flipped copy of the pixels, which the task encodes
+    str_t path = {};
+    task_system::ID task = 0;
+    bool written = false;
+};
+
+enum class MovieOutput {
+    ImageSequence,
+    Pipe,           // Raw RGBA frames are written to the standard input of an external encoder
+};
+
+// A frame of the movie export, which is read back and encoded as a screenshot, several frames are in flight
+struct MovieCapture {
+    GLuint pbo = 0;
+    void* fence = 0;
+    const uint32_t* mapped = 0;
+    int width = 0;
+    int height = 0;
+    int64_t index = -1;             // Frame of the movie
+    image_t img = {};
+    str_t path = {};                // File of the frame for image sequences
+    FILE* pipe = 0;
+    task_system::ID task = 0;
+    bool written = false;
+    std::atomic_bool done = false;  // Set by the task once it has run
+};
+
+struct SubsetRepresentation {
+    md_gl_molecule_t gl_mol = {};
+    md_gl_representation_t gl_rep = {};
+    bool gl_valid = false;
+    uint32_t slot = 0;
+    uint64_t key = 0;                   // Atoms of the subset
+    md_array(uint32_t) atom_src = 0;    // Index in the molecule of each atom
+    md_array(uint32_t) bond_src = 0;    // Index in the molecule of each bond
+    md_array(uint32_t) colors = 0;
+};
+
+// Filter expression which is evaluated on the pool into a staging bitfield, the result replaces the target once it is complete
+// The positions and secondary structures of the molecule are copied when the evaluation is launched, so the main thread is free to interpolate
+// md_filter can not be interrupted, so a request which arrives while an evaluation is running is held and launched when it completes,
+// where the result of the running evaluation is dropped, and further requests replace the held one
+struct AsyncFilter {
+    task_system::ID task = 0;
+    std::atomic_bool done = false;  // Set by the task once it has run
+    bool pending = false;
+    char pending_expr[256] = "";
+
+    // Owned by the running evaluation
+    ApplicationData* data = nullptr;
+    char expr[256] = "";
+    md_molecule_t mol = {};
+    float* coords = nullptr;
+    size_t coord_bytes = 0;
+    md_bitfield_t mask = {};
+    bool ok = false;
+    bool is_dynamic = false;
+    char error[256] = "";
+};
+
+// Once the first pass of the full evaluation is complete, cheap scripts are evaluated over runs of consecutive frames in one call
+// The run is sized so that a call takes about the target time, which amortizes the setup of md_script_eval_frame_range over the frames
+#define EVAL_BATCH_TARGET_MS 2.0
+#define EVAL_BATCH_MAX_FRAMES 64
+
+#define DYNAMIC_FILTER_LOOKAHEAD 64                 // Frames ahead of the playhead which are evaluated in the background
+#define DYNAMIC_FILTER_BATCH 8                      // Frames per task
+#define DYNAMIC_FILTER_CACHE_BUDGET MEGABYTES(128)  // Serialized masks of all representations
+#define DYNAMIC_FILTER_CACHE_CAPACITY (1 << 16)     // Frames of all representations
+
+struct DynamicFilterFrame {
+    void*    data = nullptr;    // Serialized (compressed) bitfield, null if the frame is not evaluated
+    uint32_t size = 0;
+    uint32_t cap = 0;
+};
+
+// Key of the mask of a frame in the shared cache of the masks (ApplicationData::representation::filter_masks)
+struct DynamicFilterKey {
+    uint64_t key;               // Expression, IR, trajectory and PBC mode the mask was evaluated with
+    int64_t  frame;
+};
+
+static inline bool operator==(const DynamicFilterKey& a, const DynamicFilterKey& b) {
+    return a.key == b.key && a.frame == b.frame;
+}
+
+// Masks of a dynamically evaluated filter per frame of the trajectory, which are swapped in during playback instead of evaluating the filter
+// The masks are kept in a cache shared by all representations, the frames ahead of the playhead are evaluated in batches on the pool
+struct DynamicFilterCache {
+    uint64_t key = 0;                       // Key of the mask which is shown
+    int64_t shown = -1;                     // Frame whose mask is in the atom mask of the representation
+
+    // Batch in flight
+    task_system::ID task = 0;
+    ApplicationData* data = nullptr;
+    uint64_t batch_key = 0;
+    char expr[256] = "";
+    bool apply_pbc = false;
+    md_molecule_t mol = {};
+    float* coords = nullptr;
+    size_t coord_bytes = 0;
+    uint32_t num_batch = 0;
+    int64_t batch[DYNAMIC_FILTER_BATCH] = {};
+    DynamicFilterFrame results[DYNAMIC_FILTER_BATCH] = {};
+};
+
+// Entries of the table the colormap of a representation colored by property is sampled into
+#define PROPERTY_COLOR_LUT_SIZE 256
+
+// Colors of a mapping before they are filtered, shared by the representations with the same color key (see representation_color_key)
+#define REP_COLOR_CACHE_CAPACITY 64
+
+struct RepColors {
+    uint32_t* colors;
+    size_t    count;
+};
+
 struct Representation {
     struct PropertyColorMapping {
         char ident[32] = ""; // property identifier
@@ -274,16 +507,25 @@ struct Representation {
     ColorMapping color_mapping = ColorMapping::Cpk;
     md_bitfield_t atom_mask{};
     md_gl_representation_t md_rep{};
+    md_gl_representation_t lod_rep{};    // Colors of the proxies which replace distant chunks
+    SdfRepresentation* sdf = nullptr;
+    SubsetRepresentation* subset = nullptr;    // If set, md_rep is not allocated
+    AsyncFilter* filter = nullptr;
+    DynamicFilterCache* filter_cache = nullptr;
+    md_array(uint32_t) uploaded_colors = nullptr;  // Colors as they were last uploaded to md_rep, used to only upload ranges which changed
+    uint64_t color_key = 0;                        // Key of the colors which were last computed, the colors are cached in ApplicationData::representation::colors
 #if EXPERIMENTAL_GFX_API
     md_gfx_handle_t gfx_rep = {};
 #endif
 
     bool enabled = true;
+    bool lod_rep_valid = false;
     bool type_is_valid = false;
     bool filt_is_dirty = true;
     bool filt_is_valid = false;
     bool filt_is_dynamic = false;
     bool dynamic_evaluation = false;
+    bool deferred = false;              // Restored from a workspace and not updated yet, hidden representations are updated when they are shown
     //bool prop_is_valid = false;
 
     // User defined color used in uniform mode
@@ -291,6 +533,8 @@ struct Representation {
 
     // For colormapping the property
     ImPlotColormap color_map = ImPlotColormap_Plasma;
+    ImPlotColormap prop_lut_map = -1;   // Colormap prop_lut was sampled from
+    uint32_t prop_lut[PROPERTY_COLOR_LUT_SIZE] = {};
     float map_beg = 0;
     float map_end = 1;
     float map_min = 0;
@@ -353,6 +597,20 @@ struct DisplayProperty {
         double y_min;
         double y_max;
         md_allocator_i* alloc;
+
+        // Unnormalized counts of temporal histograms, frames which complete are added to them as the evaluation progresses
+        // The counts are only recomputed from scratch when binned_key (bins, range, filter) changes
+        md_array(float) counts = 0;
+        md_array(uint32_t) totals = 0;
+        md_bitfield_t binned = {};
+        uint64_t binned_key = 0;
+
+        // Kernel density estimate of the counts (see HistogramKdeJob), published in place of the normalized counts
+        bool kde = false;
+        float kde_bandwidth = 0;                // As requested
+        md_array(float) density = 0;
+        md_array(float) bandwidth_used = 0;     // [dim]
+        uint64_t density_key = 0;               // binned_key, bandwidth and the number of binned frames
     };
 
     Type type = Type_Temporal;
@@ -381,12 +639,19 @@ struct DisplayProperty {
 
     int num_bins = 128;         // Requested number of bins for histogram
 
+    // Show a kernel density estimate of temporal properties instead of the histogram
+    bool kde = false;
+    float kde_bandwidth = 0;    // 0 selects the bandwidth from the samples
+
     md_unit_t unit = {};
     char unit_str[32] = "";
 
     const md_script_eval_t* eval = NULL;
     const md_script_property_t* prop = NULL;
 
+    // Corresponding per-frame property of the full evaluation, the filtered distribution is derived from it by masking the frames
+    const md_script_property_t* full_prop = NULL;
+
     uint64_t prop_fingerprint = 0;
 
     // Encodes which temporal subplots this property is visible in
@@ -404,6 +669,9 @@ struct DisplayProperty {
     STATIC_ASSERT(MAX_DISTRIBUTION_SUBPLOTS <= sizeof(distribution_subplot_mask) * 8, "Cannot fit distribution subplot mask");
 
     Histogram hist = {};
+
+    // Decimated series of temporal properties, created on demand when there are more frames than pixels (see timeline_lod.h)
+    TimelineLod* lod = nullptr;
 };
 
 struct AtomElementMapping {
@@ -430,6 +698,16 @@ struct LoadParam {
     const void* mol_loader_arg = NULL;
 };
 
+// Frame index of a trajectory which is built on the pool while its molecule is loaded (see load::traj::scan_file)
+// The scan is NULL if it failed or was skipped by an interrupt, the trajectory is then opened from the file as usual
+struct TrajectoryScan {
+    task_system::ID task = task_system::INVALID_ID;
+    md_trajectory_loader_i* loader = NULL;
+    md_trajectory_i* scan = NULL;
+    bool deperiodize = false;
+    char path[1024] = "";
+};
+
 struct LoadDatasetWindowState {
     char path_buf[1024] = "";
     char atom_format_buf[128] = "";
@@ -470,6 +748,9 @@ struct FileQueue {
     md_allocator_i* alloc = NULL;
 };
 
+struct VolumeExport;
+struct TrajectoryRepack;
+
 struct ApplicationData {
     // --- APPLICATION ---
     application::Context ctx {};
@@ -485,6 +766,9 @@ struct ApplicationData {
 
         bool coarse_grained = false;
         bool deperiodize    = false;
+
+        // Identity of the molecule file when it was loaded (see eval_cache_file_identity)
+        uint64_t molecule_identity = 0;
     } files;
 
     // The idea for the file load queue is to fill it with files that are dropped onto the application
@@ -514,23 +798,118 @@ struct ApplicationData {
     struct {
         bool  hide_gui = true;
         str_t path_to_file = {};
+        ScreenshotCapture captures[SCREENSHOT_MAX_IN_FLIGHT];
+
+        // Offscreen image of arbitrary size, rendered in tiles
+        struct {
+            int width = 8192;
+            int height = 8192;
+            int samples = 4;
+            str_t path = {};
+        } tiled;
     } screenshot;
 
+    // Export of the trajectory playback, which steps the animation by a fixed number of frames for each frame of the movie
+    struct {
+        MovieOutput output = MovieOutput::ImageSequence;
+        double beg_frame = 0;
+        double end_frame = 0;
+        double frame_step = 1.0;        // Trajectory frames per frame of the movie, fractional steps are interpolated
+        float fps = 30.0f;
+        char encoder[256] = "ffmpeg";
+        char encoder_args[256] = "-c:v libx264 -pix_fmt yuv420p -crf 18";
+
+        // Export in progress
+        bool active = false;
+        bool capture = false;           // The animation has been stepped and the frame is captured once it is rendered
+        bool failed = false;
+        bool cancel = false;
+        int64_t next = 0;               // Next frame to step to
+        int64_t next_encode = 0;        // Next frame to hand to the pool, the frames are piped in order
+        int64_t count = 0;
+        int64_t written = 0;
+        int width = 0;
+        int height = 0;
+        str_t path = {};
+        FILE* pipe = 0;
+        task_system::ID last_task = 0;
+        PlaybackMode mode = PlaybackMode::Stopped;
+        double frame = 0;
+        MovieCapture captures[MOVIE_EXPORT_IN_FLIGHT];
+    } movie;
+
+    // Rendering without a window (--offscreen), which exports a movie or an image once the files of the command line have been loaded
+    struct {
+        bool active = false;
+        int width  = 1920;
+        int height = 1080;
+        int device = 0;                 // GPU of the EGL context
+        str_t movie_path = {};
+        str_t screenshot_path = {};
+        bool frame_range = false;
+        double beg_frame = 0;
+        double end_frame = 0;
+        double frame_step = 1.0;
+        uint32_t loaded_frames = 0;     // Frames rendered since the files were loaded
+        bool started = false;
+        int result = 0;
+    } offscreen;
+
+#if VIAMD_BENCH
+    // Replay of the session given on the command line
+    struct {
+        bench::Session session = {};
+        str_t session_path = {};
+        str_t out_path = {};
+        bool active = false;
+        bool started = false;           // The files have been loaded and the warmup has started
+        int64_t frame = 0;              // Frame of the session, negative during the warmup
+        size_t next_event = 0;
+    } bench;
+#endif
+
     // --- MOLD DATA ---
     struct {
         md_allocator_i*     mol_alloc = nullptr;
         md_gl_shaders_t     gl_shaders = {};
         md_gl_shaders_t     gl_shaders_lean_and_mean = {};
+        bool                gl_shaders_valid = false;                   // The shaders are compiled when they are first drawn with
+        bool                gl_shaders_lean_and_mean_valid = false;
         md_gl_molecule_t    gl_mol = {};
 #if EXPERIMENTAL_GFX_API
         md_gfx_handle_t     gfx_structure = {};
 #endif
+        // Persistent ring of the keyframes which make up the interpolation support, keyed by frame index
+        // Only the slots whose frame changed are fetched from the trajectory
+        struct {
+            float*  mem = nullptr;  // [4][3][stride]
+            int64_t stride = 0;
+            int64_t frame[4] = {-1, -1, -1, -1};
+            md_trajectory_frame_header_t header[4] = {};
+        } keyframes;
         md_molecule_t       mol = {};
+        bool                snapshot_enabled = true;    // Large molecules are restored from a snapshot (.molcache) of the postprocessed molecule
+        bool                block_cache_enabled = false;    // Raw frames of trajectories are kept in the local block cache (see frame_block_cache.h)
+        bool                cache_huge_pages = false;       // Memory of the frame cache, see load::traj::set_cache_memory
+        NumaPolicy          cache_numa_policy = NumaPolicy_FirstTouch;
         md_trajectory_i*    traj = nullptr;
+        md_array(uint8_t)   atom_flags = 0;    // Flags as they were last uploaded to gl_mol, used to only upload ranges which changed
 
         vec3_t              mol_aabb_min = {};
         vec3_t              mol_aabb_max = {};
 
+        // Cell lists of recent coordinates for radial queries, built on the pool and cached by the fingerprint of the coordinates
+        struct {
+            LruCache<uint64_t, CellList> lists;
+            uint64_t pinned = 0;        // Key of the list which was last returned, which is kept until another one is requested
+            CellList staging;           // Written by the build task
+            task_system::ID task = 0;
+            float* coords = nullptr;    // Snapshot of the coordinates of the build in flight
+            size_t coord_bytes = 0;
+            size_t count = 0;
+            vec3_t pbc_ext = {};
+        } cell_list;
+
         struct {
             // A bit confusing and a bit of a hack,
             // But we want to preserve the ir while evaluating it (visualizing it etc)
@@ -540,7 +919,8 @@ struct ApplicationData {
 
             md_script_eval_t* full_eval = nullptr;
             md_script_eval_t* filt_eval = nullptr;
-            md_script_vis_t vis = {};
+            const md_script_vis_t* vis = nullptr;   // Visualization drawn this frame, owned by vis_cache
+            VisCache vis_cache;
 
             // Semaphore to control access to IR
             md_semaphore_t ir_semaphore = {};
@@ -549,16 +929,55 @@ struct ApplicationData {
             bool eval_init = false;
             bool evaluate_full = false;
             bool evaluate_filt = false;
+            ProgressiveSweep full_sweep;
             double time_since_last_change = 0.0;
             uint64_t ir_fingerprint = 0;
+
+            // Evaluation requests are tagged with a generation and debounced, so a burst of requests yields a single sweep of the latest IR
+            uint64_t eval_generation = 0;   // Latest requested evaluation
+            uint64_t full_generation = 0;   // Generation of the launched full evaluation, it is cancelled once superseded
+            double time_since_eval_request = 0.0;
+            double time_since_filt_request = 0.0;
+
+            // Source fingerprints of the compiled IR and of the evaluation, an evaluation is kept if nothing it depends on has changed
+            ScriptStatementFingerprint* ir_statements = nullptr;
+            ScriptStatementFingerprint* eval_statements = nullptr;
+            uint64_t ir_source_fingerprint = 0;
+            uint64_t eval_source_fingerprint = 0;
+
+            // Completed full evaluations are stored next to the trajectory, keyed per property
+            bool cache_enabled = true;
+            uint64_t* cache_keys = nullptr;
         } script;
         uint32_t dirty_buffers = {0};
+        // Backbone segments whose secondary structure changed since it was last uploaded, all segments if it is empty
+        size_t ss_dirty_beg = SIZE_MAX;
+        size_t ss_dirty_end = 0;
 
         md_unit_base_t unit_base = {};
     } mold;
 
     DisplayProperty* display_properties = nullptr;
     str_t hovered_display_property_label = STR("");
+
+    // Temporal histograms of the display properties are binned on the pool and published once the batch has completed
+    struct HistogramRequest {
+        size_t   dp_idx;
+        uint64_t fingerprint;
+        int      num_bins;
+        int      dim;
+        float    x_min;
+        float    x_max;
+        float*   counts;
+        uint32_t* totals;
+        float*   density;       // Estimate of the counts (if not NULL), [dim][num_bins / kde_factor]
+        int      kde_factor;
+        float    kde_bandwidth;
+    };
+    struct {
+        HistogramBatch batch;
+        md_array(HistogramRequest) requests = 0;
+    } histograms;
     int   hovered_display_property_pop_idx = -1;
 
     // --- ASYNC TASKS HANDLES ---
@@ -567,11 +986,62 @@ struct ApplicationData {
         task_system::ID prefetch_frames = task_system::INVALID_ID;
         task_system::ID evaluate_full = task_system::INVALID_ID;
         task_system::ID evaluate_filt = task_system::INVALID_ID;
+        task_system::ID write_eval_cache = task_system::INVALID_ID;
         task_system::ID shape_space_evaluate = task_system::INVALID_ID;
+        task_system::ID tracking_compute = task_system::INVALID_ID;
+        task_system::ID similarity_sweep = task_system::INVALID_ID;
+        task_system::ID similarity_build = task_system::INVALID_ID;
+        task_system::ID fluctuation = task_system::INVALID_ID;
+        task_system::ID contacts = task_system::INVALID_ID;
         task_system::ID ramachandran_compute_full_density = task_system::INVALID_ID;
         task_system::ID ramachandran_compute_filt_density = task_system::INVALID_ID;
+        task_system::ID compute_histograms = task_system::INVALID_ID;
+        task_system::ID export_volume = task_system::INVALID_ID;
+        task_system::ID repack_trajectory = task_system::INVALID_ID;
+        float main_budget_ms = 4.0f;    // Time per frame for completing tasks on the main thread, the rest are carried over
     } tasks;
 
+    // The volume export which is written by tasks.export_volume
+    VolumeExport* volume_export = nullptr;
+
+    // Conversion of the trajectory into a chunked trajectory (see chunked_trajectory.h), which is written by tasks.repack_trajectory
+    struct {
+        bool subset = false;
+        char filter[256] = "not water";
+        int block_frames = CHUNKED_TRAJECTORY_DEFAULT_BLOCK_FRAMES;
+        float precision = CHUNKED_TRAJECTORY_DEFAULT_PRECISION;
+        TrajectoryRepack* job = nullptr;
+    } repack;
+
+    // Molecule which is parsed and postprocessed on the pool into an allocator of its own, the current dataset stays in place
+    // until a main thread task swaps the new one in (see load_dataset_async)
+    struct {
+        task_system::ID task = task_system::INVALID_ID;
+        bool active = false;                // From the start of the load until it has been swapped in
+        bool success = false;
+        bool interrupted = false;           // The load was interrupted by interrupt_async_tasks and is started again
+        bool use_snapshot = false;
+        bool smooth_view = false;
+        std::atomic<float> progress = {0};
+        LoadParam param = {};
+        char path[1024] = "";
+        md_lammps_molecule_loader_arg_t lammps_arg = {};  // Copy of the loader argument, which is the only one there is
+        md_molecule_t mol = {};
+        md_allocator_i* alloc = nullptr;    // Swapped with mold.mol_alloc when the molecule is swapped in
+        TrajectoryScan traj = {};           // Trajectory which is opened with the molecule, scanned alongside it
+    } async_load;
+
+    // Frames loaded for one consumer (backbone, shape space) are handed to the others, see trajectory_sweep.h
+    TrajectorySweep trajectory_sweep;
+
+    // --- WORKER POOL ---
+    struct {
+        int   num_threads = 0;      // Including the main thread, 0 uses the number of processors
+        int   requested_threads = 0;// Applied once the pool is idle
+        int   memory_budget_mb = 0; // Budget for the estimated memory of executing frame range tasks, 0 disables throttling
+        int   memory_limit_mb = 0;  // Total budget of the caches and analysis buffers (see memory_budget.h), 0 disables the limit
+    } worker_pool;
+
     // --- ATOM SELECTION ---
     struct {
         SelectionLevel granularity = SelectionLevel::Atom;
@@ -588,8 +1058,8 @@ struct ApplicationData {
 
         SingleSelectionSequence single_selection_sequence;
 
-        md_bitfield_t current_selection_mask{};
-        md_bitfield_t current_highlight_mask{};
+        VersionedBitfield current_selection_mask{};
+        VersionedBitfield current_highlight_mask{};
         Selection* stored_selections = NULL;
 
         struct {
@@ -606,6 +1076,48 @@ struct ApplicationData {
             float saturation = 0.5f;
         } color;
 
+        // Highlight and selection drawn in screen space from the picking indices instead of drawing the representations again
+        struct {
+            bool enabled = false;
+            bool dirty = true;
+            GLuint buffer = 0;
+            md_array(uint8_t) flags = 0;        // Highlight and selection bits per picking index, as uploaded to buffer
+            uint32_t index_offset[16] = {};     // See postprocessing::highlight_selection
+        } screen_space;
+
+        // Region selections which are read from the picking buffer, the pixels are read back asynchronously and collected on the pool
+        struct {
+            bool from_picking = true;       // Select what is visible within the region, instead of projecting every atom
+            bool include_occluded = false;  // Also select the atoms hidden behind others, through the picking hierarchy (or projection)
+            md_array(vec2_t) lasso = 0;     // Points of the lasso being drawn, in window coordinates
+
+            // Latest region which has not been read yet
+            struct {
+                bool valid = false;
+                bool remove = false;
+                bool commit = false;        // Applied to the selection once read, rather than to the highlight
+                int32_t rect[4] = {};       // x, y, width, height in pixels of the G-Buffer
+                md_array(vec2_t) polygon = 0;   // Lasso in pixels of the G-Buffer, the whole rectangle if empty
+            } want;
+
+            // Region being read
+            struct {
+                bool remove = false;
+                bool commit = false;
+                int32_t rect[4] = {};
+                md_array(vec2_t) polygon = 0;
+            } read;
+
+            GLuint pbo = 0;
+            size_t pbo_size = 0;
+            void* fence = 0;
+            const uint32_t* mapped = 0;     // Mapped while the task is running
+            task_system::ID task = 0;
+            md_bitfield_t atoms = {0};      // Output of the task, atoms and bonds by index and the indices of compacted representations
+            md_bitfield_t bonds = {0};
+            md_array(uint32_t) tagged = 0;
+        } region;
+
         bool selecting = false;
 
         struct {
@@ -615,6 +1127,7 @@ struct ApplicationData {
             bool query_ok = false;
             bool query_invalid = true;
             bool show_window = false;
+            AsyncFilter filter;
         } query;
 
         struct {
@@ -631,6 +1144,22 @@ struct ApplicationData {
 
     PickingData picking {};
 
+    // Ray cast picking against a hierarchy over the representations, which is current in the same frame and does not need the picking buffer
+    // The hierarchy is built on the pool when the represented atoms change and refit on the main thread when they move
+    struct {
+        bool enabled = false;
+        bool refit = false;             // The coordinates have changed since the last refit
+        PickingBvh bvh;                 // Latest completed build
+        PickingBvh staging;             // Written by the build task
+        task_system::ID task = 0;
+        uint64_t epoch = 0;             // Incremented when the visibility, the radii or the bonds change
+        uint64_t key = 0;               // Key of the build in flight
+        md_array(PickingPrimitive) prims = nullptr;     // Input of the build in flight
+        float* coords = nullptr;        // Snapshot of the coordinates of the build in flight
+        size_t coord_bytes = 0;
+        size_t count = 0;
+    } cpu_picking;
+
     // --- ANIMATION ---
     struct {
         double frame = 0.f;  // double precision for long trajectories
@@ -639,10 +1168,96 @@ struct ApplicationData {
         InterpolationMode interpolation = InterpolationMode::CubicSpline;
         PlaybackMode mode = PlaybackMode::Stopped;
         bool apply_pbc = false;
+        bool loop = false;      // Wrap around within the timeline filter range (if enabled) or the full trajectory
+
+        // Depths of the trajectory read-ahead pipeline (in frames)
+        struct {
+            int io_depth = 32;
+            int decode_depth = 64;
+            bool auto_depth = true; // Derive the decode depth from the measured latency and playback speed
+        } read_ahead;
 
         bool show_window = true;
     } animation;
 
+    // --- SCRUBBING ---
+    // While the timeline is dragged, large systems are shown as a trace of one bead per residue instead of the representations
+    struct {
+        bool enabled = true;
+        bool active = false;
+        ScrubProxy proxy = {};
+    } scrub;
+
+    // --- STRUCTURE TRACKING ---
+    // The superposition of a structure onto its reference is computed for every frame in the background
+    // Absolute aligns the system to the reference, Relative moves the camera along with the structure
+    struct {
+        bool active = false;                // A structure is tracked
+        bool enabled = true;                // Apply the tracking to the view
+        TrackingMode mode = TrackingMode::Relative;
+        superposition_ref_t ref = {};
+        superposition_fit_t* fits = nullptr; // [num_frames] Valid for the frames which are complete in the sweep
+        uint32_t num_frames = 0;
+        ProgressiveSweep sweep;
+
+        bool aligned = false;               // The coordinates have been aligned since they were last interpolated (Absolute)
+        bool camera_valid = false;          // camera_fit holds the transform the camera follows from (Relative)
+        superposition_fit_t camera_fit = {};
+        float rmsd = 0;                     // At the current frame
+
+        // Similarity of the frames by the RMSD of the tracked structure (see frame_similarity.h)
+        struct {
+            bool active = false;            // The index is built or ready
+            bool ready = false;
+            FrameSimilarity index = {};
+            ProgressiveSweep sweep;
+
+            uint32_t query_frame = UINT32_MAX;
+            uint32_t similar[SIMILAR_FRAMES] = {};
+            float similar_rmsd[SIMILAR_FRAMES] = {};
+            size_t num_similar = 0;
+
+            float cluster_cutoff = 1.0f;
+            int32_t* clusters = nullptr;    // [num_frames] Cluster of each frame, only in matrix mode
+            uint32_t* centers = nullptr;    // [num_frames] Center frame of each cluster
+            size_t num_clusters = 0;
+        } similarity;
+    } tracking;
+
+    // --- FLUCTUATIONS ---
+    // Average structure and RMSF of a set of atoms, accumulated in one pass over the trajectory
+    struct {
+        bool show_window = false;
+        bool use_selection = true;          // The selected atoms, otherwise all atoms
+        bool superpose = true;              // Superpose the frames onto the tracked structure (if any)
+        bool show_average = false;          // Show the average structure in place of the atoms of the set
+        bool active = false;
+        bool ready = false;
+        bool average_applied = false;       // The average has been applied since the coordinates were last interpolated
+        AtomStatistics stats = {};
+        ProgressiveSweep sweep;
+        float* rmsf = nullptr;              // [atom.count] Zero for the atoms which are not in the set
+        float max_rmsf = 0;
+        uint64_t fingerprint = 0;           // Changes with the values of rmsf
+    } fluctuation;
+
+    // --- CONTACTS ---
+    // Residue contacts or hydrogen bonds of a set of atoms over the trajectory, with their occupancy and the number of contacts per frame
+    struct {
+        bool show_window = false;
+        bool use_selection = true;          // The selected atoms, otherwise all atoms
+        bool active = false;
+        bool finalizing = false;            // The occupancy is being counted
+        std::atomic_bool finalized = false;
+        bool ready = false;
+        ContactParams params = {};
+        ContactsEngine engine = {};
+        ProgressiveSweep sweep;
+        int64_t selected_pair = -1;         // Index into the pairs of the engine
+        float* pair_series = nullptr;       // [num_frames] Contact of the selected pair in every frame
+        uint32_t num_frames = 0;
+    } contacts;
+
     // --- TIMELINE---
     struct {
         struct {
@@ -688,6 +1303,7 @@ struct ApplicationData {
                 float alpha_scale = 1.f;
                 ImPlotColormap colormap = ImPlotColormap_Plasma;
                 bool dirty = true;
+                float transparent_below = 0.f;  // Density below which the transfer function is fully transparent
             } tf;
         } dvr;
 
@@ -708,6 +1324,15 @@ struct ApplicationData {
             float max_value = 1.f;
         } volume_texture;
 
+        struct {
+            bool enabled = true;        // Store only the non-empty bricks of the volume
+            bool half_precision = true; // R16F atlas, otherwise R8 normalized by the max value
+            volume::BrickedVolume volume = {};
+        } bricks;
+
+        bool empty_space_skipping = true;
+        volume::MacroCellGrid macro_cells = {};
+
         GBuffer fbo = {0};
 
         struct {
@@ -743,8 +1368,15 @@ struct ApplicationData {
             vec4_t color = {1,1,1,1};
         } rep;
 
-        md_gl_representation_t* gl_reps = nullptr;
-        mat4_t* rep_model_mats = nullptr;
+        // The structures of the SDF, transformed onto the reference and concatenated into one molecule which is drawn with a single representation
+        struct {
+            md_gl_molecule_t gl_mol = {};
+            md_gl_representation_t gl_rep = {};
+            uint32_t* atom_src = nullptr;   // Index in the molecule of each atom of the ensemble
+            uint32_t num_atoms = 0;
+            uint32_t num_bonds = 0;
+            uint32_t num_atoms_first = 0;   // Atoms of the first structure, which is shown alone unless the whole ensemble is shown
+        } ensemble;
         mat4_t model_mat = {0};
 
         Camera camera = {};
@@ -762,6 +1394,7 @@ struct ApplicationData {
             float intensity = 6.0f;
             float radius = 6.0f;
             float bias = 0.1f;
+            bool half_res = false;
         } ssao;
 
 #if EXPERIMENTAL_CONE_TRACED_AO == 1
@@ -807,6 +1440,47 @@ struct ApplicationData {
         bool enabled = false;
         vec4_t color = {0, 0, 0, 0.5f};
     } simulation_box;
+
+    // --- RENDER ON DEMAND ---
+    // The scene is only rendered when something which affects the image has changed, otherwise the last image is recomposited
+    struct {
+        bool enabled = true;
+        bool dirty = true;              // Set for changes which are not covered by the tracked state below
+        uint32_t settle_frames = 0;     // Frames left to render after the last change, e.g. for the temporal accumulation to converge
+        uint32_t idle_frames = 0;       // Consecutive frames without any input or change
+        mat4_t view = {};
+        mat4_t proj = {};
+        double frame = -1.0;
+        decltype(visuals) visuals = {};
+        decltype(simulation_box) simulation_box = {};
+    } render;
+
+    // --- DYNAMIC RESOLUTION ---
+    // While the view is moving or the animation is playing, the scene is rendered into a G-Buffer of reduced resolution
+    // which is upscaled into the full G-Buffer, the temporal reprojection accumulates the detail and the full resolution is restored when idle
+    struct {
+        bool enabled = false;
+        float min_scale = 0.5f;
+        float target_ms = 0.0f;         // Frame time which the scale adapts to, 0 always uses min_scale
+        float scale = 1.0f;
+        float frame_ms = 0.0f;          // Smoothed frame time
+        uint32_t idle_frames = 0;
+        uint32_t hold_frames = 0;       // Frames left before the scale is adapted again
+        bool active = false;            // The scene is rendered into the reduced G-Buffer this frame
+        GBuffer gbuffer {};
+    } dynamic_resolution;
+
+    // --- QUALITY GOVERNOR ---
+    // Steps the cost of the postprocessing down while the GPU time of the rendered frames is above the target and back up with headroom
+    // The steps are applied to the descriptor of the postprocessing, the settings of the visuals are left as they are
+    struct {
+        bool enabled = false;
+        float target_ms = 16.7f;
+        int level = 0;                  // Index into QUALITY_LEVELS, 0 is the quality of the settings
+        float gpu_ms = 0.0f;            // Smoothed GPU time of the rendered frames
+        uint32_t hold_samples = 0;      // Samples left before the level is adapted again
+        uint32_t head = 0;              // History head of the GPU timing at the last sample
+    } quality;
    
     // --- RAMACHANDRAN ---
     struct {
@@ -822,6 +1496,7 @@ struct ApplicationData {
         uint64_t filt_fingerprint = 0;
 
         rama_data_t data = {0};
+        bool data_valid = false;         // rama_init is deferred until the window is shown
         uint32_t* rama_type_indices[4] = {};
 
         struct {
@@ -834,6 +1509,14 @@ struct ApplicationData {
         } style;
 
         float blur_sigma = 5.0f;
+
+        bool gpu_density = true;            // Compute the densities in compute shaders when supported
+        rama_gpu_angles_t gpu_angles = {};
+        // Prefix grids by the fingerprint of the backbone angles, which compose the densities of frame ranges
+        LruCache<uint64_t, rama_chunk_cache_t> chunk_caches;
+        rama_chunk_cache_t chunk_build = {};    // Rebuilt by the full density in flight, handed to chunk_caches once it completes
+        uint64_t chunk_build_key = 0;
+        uint64_t chunk_pinned[2] = {};          // Entries read by the full and the filtered density in flight
     } ramachandran;
 
     struct {
@@ -849,11 +1532,22 @@ struct ApplicationData {
         size_t num_structures;
 
         vec3_t* weights = nullptr;
-        vec2_t* coords  = nullptr;
+        vec2_t* coords  = nullptr;   // NaN for frames which are not evaluated yet
 
         md_array(md_bitfield_t) bitfields = 0;
+        int32_t* indices = nullptr;  // Atom indices of all structures, concatenated
+        size_t*  offsets = nullptr;  // [num_structures + 1] Offsets of each structure into indices
+        ProgressiveSweep sweep;
 
         float marker_size = 1.4f;
+        bool  density_mode = true;   // Bin the points into a density image when there are too many to draw individually
+
+        struct {
+            uint32_t tex = 0;
+            uint64_t key = 0;        // Key of the content which was last binned
+            task_system::ID task = task_system::INVALID_ID;
+            float bounds[4] = {};   // x_min, y_min, x_max, y_max of the image
+        } density;
     } shape_space;
 
     // --- REPRESENTATIONS ---
@@ -862,6 +1556,42 @@ struct ApplicationData {
         md_bitfield_t atom_visibility_mask = {0};
         bool atom_visibility_mask_dirty = false;
         bool show_window = false;
+
+        // Chunks of atoms which are outside of the view or occluded are masked out when drawing the representations
+        struct {
+            bool enabled = true;
+            bool occlusion = true;
+            bool active = false;            // The flags of the atoms hold the culled state
+            culling::ChunkSet chunks = {};
+            culling::HiZ hiz = {};
+            uint64_t epoch = 0;             // Incremented for changes of the scene which invalidate the captured depth
+            uint64_t key = 0;               // Key of the view and scene of the current frame
+            float radius_scale = 0.0f;      // Scale of the radii the AABBs were computed with
+        } culling;
+
+        // Space-fill and licorice draw chunks which cover less than a few pixels as one proxy sphere each
+        struct {
+            bool enabled = true;
+            float pixels = 2.0f;            // Diameter on screen below which a chunk is replaced
+            md_gl_molecule_t gl_mol = {};   // One atom per chunk
+            uint32_t num_proxies = 0;
+        } lod;
+
+        struct {
+            bool enabled = true;
+            uint32_t slots_used = 0;        // Bit per slot
+            md_gl_shaders_t shaders[SUBSET_MAX_SLOTS] = {};   // Compiled on first use
+            bool shaders_valid[SUBSET_MAX_SLOTS] = {};
+        } subset;
+
+        // Neighbouring lattice images of the unit cell, drawn from the same buffers with a translation each
+        struct {
+            bool enabled = false;
+            int extent = 1;                 // Images per direction on each side, 1 gives 3x3x3 cells
+        } periodic_images;
+
+        LruCache<DynamicFilterKey, DynamicFilterFrame> filter_masks;
+        LruCache<uint64_t, RepColors> colors;
     } representation;
 
     struct {
@@ -878,14 +1608,21 @@ struct ApplicationData {
             size_t stride = 0; // = mol.backbone.count. Multiply frame idx with this to get the data
             size_t count = 0;  // = mol.backbone.count * num_frames. Defines the end of the data for assertions
             md_secondary_structure_t* data = nullptr;
+            uint8_t* packed = nullptr;  // Compact storage, 2-bit classes (see backbone_data.h)
+            size_t packed_stride = 0;   // Bytes per frame of packed
             uint64_t fingerprint = 0;
         } secondary_structure;
         struct {
             size_t stride = 0; // = mol.backbone.count. Multiply frame idx with this to get the data
             size_t count = 0;  // = mol.backbone.count * num_frames. Defines the end of the data for assertions
             md_backbone_angles_t* data = nullptr;
+            backbone_angles_q16_t* q16 = nullptr; // Compact storage, int16 quantized
             uint64_t fingerprint = 0;
         } backbone_angles;
+        ProgressiveSweep sweep; // Tracks which frames of the secondary structure and backbone angles are computed
+        bool background_fill = true; // Compute all frames, otherwise only the frames around the playhead and within the filter
+        bool compact = true;         // Store quantized angles and packed secondary structure, applied when the trajectory is (re)loaded
+        bool window_complete = false;
     } trajectory_data;
 
     struct {
@@ -960,6 +1697,17 @@ static inline FileQueue::Entry file_queue_front(const FileQueue* queue) {
     return queue->arr[queue->tail];
 }
 
+// The entry after the front, returns false if there is none
+static inline bool file_queue_next(const FileQueue* queue, FileQueue::Entry* entry) {
+    ASSERT(queue);
+    ASSERT(entry);
+    if (file_queue_empty(queue)) return false;
+    const uint64_t i = (queue->tail + 1) % ARRAY_SIZE(queue->arr);
+    if (i == queue->head) return false;
+    *entry = queue->arr[i];
+    return true;
+}
+
 static inline uint64_t generate_fingerprint() {
     return (uint64_t)md_time_current();
 }
@@ -969,6 +1717,19 @@ static void free_histogram(DisplayProperty::Histogram* hist) {
     ASSERT(hist->alloc);
     md_array_free(hist->bins, hist->alloc);
     hist->bins = 0;
+    if (hist->counts) {
+        md_array_free(hist->counts, hist->alloc);
+        md_array_free(hist->totals, hist->alloc);
+        md_bitfield_free(&hist->binned);
+        hist->counts = 0;
+        hist->totals = 0;
+    }
+    if (hist->density) {
+        md_array_free(hist->density, hist->alloc);
+        md_array_free(hist->bandwidth_used, hist->alloc);
+        hist->density = 0;
+        hist->bandwidth_used = 0;
+    }
 }
 
 static void compute_histogram(float* bins, int num_bins, float bin_range_min, float bin_range_max, const float* values, int num_values, float* bin_val_min, float* bin_val_max) {
@@ -1004,66 +1765,6 @@ static void compute_histogram(float* bins, int num_bins, float bin_range_min, fl
     if (bin_val_max) *bin_val_max = max_val;
 }
 
-static void compute_histogram_masked(DisplayProperty::Histogram* hist, int num_bins, float value_range_min, float value_range_max, const float* values, int dim, const md_bitfield_t* mask, bool aggregate = false) {
-    ASSERT(hist);
-    ASSERT(values);
-    ASSERT(mask);
-    ASSERT(dim > 0);
-
-    hist->dim = aggregate ? 1 : dim;
-    md_array_resize(hist->bins, (size_t)(hist->dim * num_bins), hist->alloc);;
-    MEMSET(hist->bins, 0, md_array_bytes(hist->bins));
-
-    const size_t num_samples = md_bitfield_popcount(mask) * dim;
-    if (num_samples == 0) return;
-
-    const float range_ext = value_range_max - value_range_min;
-    const float inv_range = 1.0f / range_ext;
-
-    md_array(int) count = md_array_create(int, hist->dim, md_heap_allocator);
-    MEMSET(count, 0, md_array_bytes(count));
-
-    // We evaluate each frame, one at a time
-    md_bitfield_iter_t it = md_bitfield_iter_create(mask);
-    while (md_bitfield_iter_next(&it)) {
-        const int val_idx = dim * (int)md_bitfield_iter_idx(&it);
-        for (int i = 0; i < dim; ++i) {
-            const float val = values[val_idx + i];
-            if (val < value_range_min || value_range_max < val) continue;
-            const int bin_idx = CLAMP((int)(((val - value_range_min) * inv_range) * num_bins), 0, num_bins - 1);
-
-            if (aggregate) {
-                hist->bins[bin_idx] += 1.0f;
-                count[0] += 1;
-            } else {
-                hist->bins[num_bins * i + bin_idx] += 1.0f;
-                count[i] += 1;
-            }
-        }
-    }
-
-    float min_bin = FLT_MAX;
-    float max_bin = -FLT_MAX;
-    const float width = range_ext / num_bins;
-    for (int i = 0; i < hist->dim; ++i) {
-        const float scl = 1.0f / (width * count[i]);
-        for (int j = 0; j < num_bins; ++j) {
-            float& val = hist->bins[num_bins * i + j];
-            val *= scl;
-            min_bin = MIN(min_bin, val);
-            max_bin = MAX(max_bin, val);
-        }
-    }
-
-    hist->num_bins = num_bins;
-    hist->x_min = value_range_min;
-    hist->x_max = value_range_max;
-    hist->y_min = min_bin;
-    hist->y_max = max_bin;
-    
-    md_array_free(count, md_heap_allocator);
-}
-
 static void downsample_histogram(float* dst_bins, int num_dst_bins, const float* src_bins, const float* src_weights, int num_src_bins) {
     ASSERT(dst_bins);
     ASSERT(src_bins);
@@ -1211,9 +1912,11 @@ static void clear_dataset_items(ApplicationData* data);
 
 static void init_display_properties(ApplicationData* data);
 static void update_display_properties(ApplicationData* data);
+static void clear_histogram_requests(ApplicationData* data);
 
 static void update_density_volume(ApplicationData* data);
 static void clear_density_volume(ApplicationData* data);
+static void update_density_volume_ensemble(ApplicationData* data, const md_script_vis_t* vis);
 
 static void interpolate_atomic_properties(ApplicationData* data);
 static void update_view_param(ApplicationData* data);
@@ -1226,8 +1929,57 @@ static void handle_camera_animation(ApplicationData* data);
 //static void update_density_volume_texture(ApplicationData* data);
 static void handle_picking(ApplicationData* data);
 
-static void fill_gbuffer(ApplicationData* data);
+static void fill_gbuffer(ApplicationData* data, GBuffer* gbuf);
 static void apply_postprocessing(const ApplicationData& data);
+static postprocessing::Descriptor postprocessing_descriptor(const ApplicationData& data, const GBuffer& gbuf);
+
+// Reduced scales above this are rendered at full resolution
+#define DYNAMIC_RES_MAX_SCALE 0.8f
+#define DYNAMIC_RES_SCALE_STEP 0.125f
+// Frames between adaptations of the scale, for the smoothed frame time to respond
+#define DYNAMIC_RES_HOLD_FRAMES 8
+
+static void update_dynamic_resolution(ApplicationData* data);
+
+// Reductions of the quality governor, a level includes the reductions of the levels before it
+static const char* QUALITY_LEVELS[] = {
+    "Full",
+    "Half resolution SSAO",
+    "Reduced SSAO radius",
+    "No depth of field",
+    "No motion blur",
+    "No SSAO",
+    "No temporal AA",
+};
+// GPU samples between adaptations, the samples trail the frames by GPU_TIMING_FRAMES_IN_FLIGHT
+#define QUALITY_HOLD_SAMPLES 16
+// Quality is restored below this fraction of the target, which leaves room for the cost of the level
+#define QUALITY_RESTORE_FRACTION 0.6f
+
+static void update_quality_governor(ApplicationData* data);
+static bool temporal_reprojection_enabled(const ApplicationData& data);
+static GBuffer* scene_gbuffer(ApplicationData* data);
+static void upscale_gbuffer(GBuffer* dst, const GBuffer* src);
+
+static bool scene_needs_render(ApplicationData* data);
+static bool update_scrub(ApplicationData* data, bool time_changed);
+static void draw_scrub_proxy(ApplicationData* data);
+static void blit_composite(GBuffer* gbuf, bool store);
+static void update_event_wait(ApplicationData* data);
+
+static void   update_worker_pool(ApplicationData* data);
+
+static void request_evaluation(ApplicationData* data);
+static void request_filt_evaluation(ApplicationData* data);
+static uint64_t script_inputs_fingerprint(const ApplicationData* data);
+static uint64_t script_context_fingerprint(const ApplicationData* data);
+
+static size_t eval_cache_path(char* buf, size_t cap, const ApplicationData* data);
+static bool read_eval_cache(ApplicationData* data);
+static void compute_eval_cache_keys(ApplicationData* data);
+static bool filt_eval_required(const ApplicationData* data);
+static void write_eval_cache(ApplicationData* data);
+static size_t estimate_eval_range_memory(const ApplicationData* data);
 
 static void draw_representations(ApplicationData* data);
 static void draw_representations_lean_and_mean(ApplicationData* data, uint32_t mask = 0xFFFFFFFFU);
@@ -1258,31 +2010,106 @@ static void destroy_gbuffer(GBuffer* gbuf);
 static PickingData read_picking_data(GBuffer* fbo, int32_t x, int32_t y);
 
 static void update_md_buffers(ApplicationData* data);
+static void update_representation_culling(ApplicationData* data);
+static void init_representation_lod(ApplicationData* data);
+static void free_representation_lod(ApplicationData* data);
+static void update_representation_lod_colors(ApplicationData* data, Representation* rep, const uint32_t* colors);
+static void update_representation_sdf(ApplicationData* data, Representation* rep, const uint32_t* colors);
+static void update_representation_sdfs(ApplicationData* data);
+static void free_representation_sdf(Representation* rep);
+static void draw_representation_sdfs(ApplicationData* data);
+static void update_representation_subset(ApplicationData* data, Representation* rep, const uint32_t* colors);
+static void free_representation_subset(ApplicationData* data, Representation* rep, bool restore_md_rep);
+static void free_representation_subset_shaders(ApplicationData* data);
+static const md_gl_shaders_t* representation_shaders(ApplicationData* data);
+static const md_gl_shaders_t* representation_shaders_lean_and_mean(ApplicationData* data);
+static void zero_molecule_velocity(ApplicationData* data);
+static uint32_t resolve_picking_idx(const ApplicationData* data, uint32_t idx);
+static void update_selection_buffer(ApplicationData* data);
 
 static void init_molecule_data(ApplicationData* data);
 static void init_trajectory_data(ApplicationData* data);
+static void launch_backbone_computation(ApplicationData* data, str_t label, uint32_t num_frames, task_system::Priority priority);
+static void update_evaluation_priority(ApplicationData* data);
+static void process_backbone_frame(uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, void* user_data);
+static void init_scrub_proxy(ApplicationData* data, uint32_t num_frames);
+static void process_shape_space_frame(uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, void* user_data);
+static void process_tracking_frame(uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, void* user_data);
+static bool start_tracking(ApplicationData* data, const md_bitfield_t* mask);
+static void stop_tracking(ApplicationData* data);
+static void apply_tracking(ApplicationData* data);
+static bool start_frame_similarity(ApplicationData* data);
+static bool start_fluctuation(ApplicationData* data);
+static void stop_fluctuation(ApplicationData* data);
+static void apply_average_structure(ApplicationData* data);
+static void draw_fluctuation_window(ApplicationData* data);
+static bool start_contacts(ApplicationData* data);
+static void stop_contacts(ApplicationData* data);
+static void draw_contacts_window(ApplicationData* data);
+static bool export_table(str_t path, str_t ext, str_t title, str_t x_label, str_t y_label, const float* const* columns, const str_t* labels, size_t num_columns, size_t num_rows, const str_t* legends, size_t num_legends);
+static void stop_frame_similarity(ApplicationData* data);
+static void draw_frame_similarity(ApplicationData* data);
+static void update_backbone_computation(ApplicationData* data);
 
 static void interrupt_async_tasks(ApplicationData* data);
+static void register_memory_consumers(ApplicationData* data);
+static void update_vram_estimate(const ApplicationData* data);
 
 static bool load_dataset_from_file(ApplicationData* data, const LoadParam& param);
+static void load_dataset_async(ApplicationData* data, const LoadParam& param, bool smooth_view, const LoadParam* traj_param = nullptr);
 
 static void load_workspace(ApplicationData* data, str_t file);
 static void save_workspace(ApplicationData* data, str_t file);
 
 static bool export_xvg(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename);
+static int  run_headless(int argc, char** argv);
+#if VIAMD_BENCH
+static int  run_microbench(int argc, char** argv);
+static int  run_perf(int argc, char** argv);
+#endif
 static bool export_csv(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename);
 
 static void create_screenshot(ApplicationData* data);
+static void update_screenshot_captures(ApplicationData* data, bool wait = false);
+static void free_screenshot_captures(ApplicationData* data);
+static void request_region_selection(ApplicationData* data, vec2_t min_p, vec2_t max_p, bool remove, bool commit);
+static void update_region_selection(ApplicationData* data, bool wait = false);
+static void free_region_selection(ApplicationData* data);
+static bool render_tiled_image(ApplicationData* data, str_t path, int width, int height, int num_samples);
+static bool start_movie_export(ApplicationData* data, str_t path);
+static void step_movie_export(ApplicationData* data);
+static void capture_movie_frame(ApplicationData* data);
+static void update_movie_captures(ApplicationData* data, bool wait = false);
+static void finish_movie_export(ApplicationData* data);
+static void free_movie_captures(ApplicationData* data);
+static void launch_trajectory_repack(ApplicationData* data, str_t path);
+static float repack_fraction_complete(const TrajectoryRepack* job);
+
+static int  offscreen_arg_values(const char* arg);
+static bool parse_offscreen_args(ApplicationData* data, int argc, char** argv);
+static void step_offscreen(ApplicationData* data);
+
+#if VIAMD_BENCH
+static void step_bench(ApplicationData* data);
+static void end_bench_frame(ApplicationData* data);
+#endif
 
 // Representations
 static Representation* create_representation(ApplicationData* data, RepresentationType type = RepresentationType::SpaceFill,
                                              ColorMapping color_mapping = ColorMapping::Cpk, str_t filter = STR("all"));
 static Representation* clone_representation(ApplicationData* data, const Representation& rep);
 static void remove_representation(ApplicationData* data, int idx);
-static void update_representation(ApplicationData* data, Representation* rep);
+static void update_representation(ApplicationData* data, Representation* rep, bool evaluate_filter = true);
+static void update_representation_filters(ApplicationData* data, bool wait = false);
+static bool apply_cached_dynamic_filter(ApplicationData* data, Representation* rep);
+static void update_dynamic_filter_caches(ApplicationData* data);
+static void free_dynamic_filter_cache(DynamicFilterCache* cache);
+static void free_dynamic_filter_frame(DynamicFilterFrame* frame);
+static void clear_dynamic_filter_masks(ApplicationData* data);
 static void update_all_representations(ApplicationData* data);
 static void init_representation(ApplicationData* data, Representation* rep);
 static void init_all_representations(ApplicationData* data);
+static void update_deferred_representations(ApplicationData* data);
 static void clear_representations(ApplicationData* data);
 static void create_default_representations(ApplicationData* data);
 
@@ -1294,6 +2121,18 @@ static void remove_selection(ApplicationData* data, int idx);
 static void clear_selections(ApplicationData* data);
 
 static bool filter_expression(ApplicationData* data, str_t expr, md_bitfield_t* mask, bool* is_dynamic, char* error_str, int error_cap);
+static void request_async_filter(ApplicationData* data, AsyncFilter* filter, str_t expr);
+static bool poll_async_filter(ApplicationData* data, AsyncFilter* filter, bool wait = false);
+static void wait_async_filter(AsyncFilter* filter);
+static void free_async_filter(AsyncFilter* filter);
+static const CellList* request_cell_list(ApplicationData* data);
+static void free_cell_list(ApplicationData* data);
+static void init_derived_caches(ApplicationData* data);
+static void free_derived_caches(ApplicationData* data);
+static void update_rama_chunk_caches(ApplicationData* data);
+static void update_picking_bvh(ApplicationData* data);
+static bool cpu_pick(ApplicationData* data, vec2_t coord, PickingData* out);
+static void free_picking_bvh(ApplicationData* data);
 
 static void modify_field(md_bitfield_t* bf, const md_bitfield_t* mask, SelectionOperator op) {
     switch(op) {
@@ -1340,13 +2179,13 @@ static void modify_field(md_bitfield_t* bf, md_range_t range, SelectionOperator
 
 static void modify_selection(ApplicationData* data, md_bitfield_t* atom_mask, SelectionOperator op = SelectionOperator::Set) {
     ASSERT(data);
-    modify_field(&data->selection.current_selection_mask, atom_mask, op);
+    modify_field(versioned_bitfield_modify(&data->selection.current_selection_mask), atom_mask, op);
     data->mold.dirty_buffers |= MolBit_DirtyFlags;
 }
 
 static void modify_selection(ApplicationData* data, md_range_t range, SelectionOperator op = SelectionOperator::Set) {
     ASSERT(data);
-    modify_field(&data->selection.current_selection_mask, range, op);
+    modify_field(versioned_bitfield_modify(&data->selection.current_selection_mask), range, op);
     data->mold.dirty_buffers |= MolBit_DirtyFlags;
 }
 
@@ -1356,7 +2195,7 @@ static void set_hovered_property(ApplicationData* data, str_t label, int populat
 }
 
 // Global data for application
-static md_linear_allocator_t* linear_allocator = 0;
+static FrameArena frame_arena = {};
 static md_allocator_i* frame_allocator = 0;
 
 static TextEditor editor {};    // We do not want this within the application data since it messes up the layout and therefore the usage of offset_of
@@ -1378,15 +2217,24 @@ uint32_t djb2_hash(const char *str) {
     return hash;
 }
 
+// Time of each phase of the startup, which is logged to the console
+struct StartupTimer {
+    md_timestamp_t beg = 0;
+    md_timestamp_t last = 0;
+};
+
+static void startup_phase(StartupTimer* t, const char* name) {
+    const md_timestamp_t now = md_time_current();
+    LOG_INFO("Startup: %s took %.1f ms", name, md_time_as_seconds(now - t->last) * 1000.0);
+    t->last = now;
+}
+
 int main(int argc, char** argv) {
-    const int64_t linear_size = MEGABYTES(256);
-    void* linear_mem = md_alloc(md_heap_allocator, linear_size);
-    md_linear_allocator_t linear_alloc {};
-    md_linear_allocator_init(&linear_alloc, linear_mem, linear_size);
-    md_allocator_i linear_interface = md_linear_allocator_create_interface(&linear_alloc);
-    
-	linear_allocator = &linear_alloc;
-    frame_allocator = &linear_interface;
+    memory_tracker_init(persistent_allocator);
+
+    // The arena grows to the high water mark of the frames, the initial block covers typical datasets
+    frame_arena_init(&frame_arena, memory_tracker_allocator(MemoryTracker_FrameScratch), MEGABYTES(256));
+    frame_allocator = frame_arena_allocator(&frame_arena);
 
     md_logger_i notification_logger = {
         NULL,
@@ -1423,25 +2271,70 @@ int main(int argc, char** argv) {
         }
     };
 
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            return run_headless(argc, argv);
+        }
+#if VIAMD_BENCH
+        if (strcmp(argv[i], "--micro") == 0) {
+            return run_microbench(argc, argv);
+        }
+        if (strcmp(argv[i], "--perf") == 0) {
+            return run_perf(argc, argv);
+        }
+#endif
+    }
+
     md_logger_add(&notification_logger);
 
     ApplicationData data;
     data.file_queue.alloc = persistent_allocator;
 
-    data.mold.mol_alloc = md_arena_allocator_create(persistent_allocator, MEGABYTES(1));
+    if (!parse_offscreen_args(&data, argc, argv)) {
+        return -1;
+    }
+
+#if VIAMD_BENCH
+    for (int i = 1; i < argc - 1; ++i) {
+        if (strcmp(argv[i], "--session") == 0) data.bench.session_path = str_from_cstr(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0) data.bench.out_path = str_from_cstr(argv[++i]);
+    }
+    if (str_empty(data.bench.session_path) || str_empty(data.bench.out_path)) {
+        printf("Usage: viamd_bench <workspace.via | files> --session <file> --out <file.json>\n");
+        printf("       viamd_bench --micro [--molecule <file>] [--trajectory <file>] [--max-atoms <n>] [--threads <n>,<n>,...] [--out <file.json>]\n");
+        printf("       viamd_bench --perf <open|script|histogram|rama> --baseline <dir> [--tolerance <fraction>] [--update]\n");
+        return -1;
+    }
+    if (!bench::load_session(&data.bench.session, data.bench.session_path, persistent_allocator)) {
+        return -1;
+    }
+    data.bench.active = true;
+#endif
+
+    data.mold.mol_alloc = md_arena_allocator_create(memory_tracker_allocator(MemoryTracker_Molecule), MEGABYTES(1));
 
-    md_bitfield_init(&data.selection.current_selection_mask, persistent_allocator);
-    md_bitfield_init(&data.selection.current_highlight_mask, persistent_allocator);
+    versioned_bitfield_init(&data.selection.current_selection_mask, persistent_allocator);
+    versioned_bitfield_init(&data.selection.current_highlight_mask, persistent_allocator);
     md_bitfield_init(&data.selection.query.mask, persistent_allocator);
     md_bitfield_init(&data.selection.grow.mask, persistent_allocator);
+    md_bitfield_init(&data.selection.region.atoms, md_heap_allocator);
+    md_bitfield_init(&data.selection.region.bonds, md_heap_allocator);
 
     md_bitfield_init(&data.representation.atom_visibility_mask, persistent_allocator);
 
     md_semaphore_init(&data.mold.script.ir_semaphore, IR_SEMAPHORE_MAX_COUNT);
+    vis_cache_init(&data.mold.script.vis_cache, md_heap_allocator);
+    init_derived_caches(&data);
+    histogram_batch_init(&data.histograms.batch, persistent_allocator);
+
+    StartupTimer startup = {};
+    startup.beg = startup.last = md_time_current();
 
     // Init platform
     LOG_DEBUG("Initializing GL...");
-    if (!application::initialize(&data.ctx, 0, 0, "VIAMD")) {
+    const bool app_init = data.offscreen.active ? application::initialize_offscreen(&data.ctx, data.offscreen.width, data.offscreen.height, data.offscreen.device) :
+                                                  application::initialize(&data.ctx, 0, 0, "VIAMD");
+    if (!app_init) {
         LOG_ERROR("Could not initialize application...\n");
         return -1;
     }
@@ -1457,32 +2350,87 @@ int main(int argc, char** argv) {
         }
     };
 
+    startup_phase(&startup, "application");
+
     LOG_DEBUG("Initializing framebuffer...");
     init_gbuffer(&data.gbuffer, data.ctx.framebuffer.width, data.ctx.framebuffer.height);
+    startup_phase(&startup, "framebuffer");
 
     for (int i = 0; i < (int)ARRAY_SIZE(data.view.jitter.sequence); ++i) {
         data.view.jitter.sequence[i].x = halton(i + 1, 2);
         data.view.jitter.sequence[i].y = halton(i + 1, 3);
     }
 
+    // Linked programs are cached in the cache directory of the user unless it is overridden through the environment (an empty value disables the cache)
+    {
+        char cache_dir[1024] = "";
+        if (const char* env = getenv("VIAMD_SHADER_CACHE_DIR")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s", env);
+#if defined(_WIN32)
+        } else if (const char* local = getenv("LOCALAPPDATA")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s/VIAMD/shader_cache", local);
+#else
+        } else if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s/viamd/shaders", xdg);
+        } else if (const char* home = getenv("HOME")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/viamd/shaders", home);
+#endif
+        }
+        gl::set_program_cache_dir(str_from_cstr(cache_dir));
+    }
+
+    // Raw frames of trajectories on slow storage are copied to the frame cache directory, which is overridden in the same way
+    {
+        char cache_dir[1024] = "";
+        if (const char* env = getenv("VIAMD_FRAME_CACHE_DIR")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s", env);
+#if defined(_WIN32)
+        } else if (const char* local = getenv("LOCALAPPDATA")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s/VIAMD/frame_cache", local);
+#else
+        } else if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s/viamd/frames", xdg);
+        } else if (const char* home = getenv("HOME")) {
+            snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/viamd/frames", home);
+#endif
+        }
+        frame_block_cache_set_dir(str_from_cstr(cache_dir));
+    }
+
     // Init subsystems
+    // Ramachandran, volume, culling and distance fields compile their programs on first use, as do the shaders of the representations
     LOG_DEBUG("Initializing immediate draw...");
     immediate::initialize();
-    LOG_DEBUG("Initializing ramachandran...");
-    ramachandran::initialize();
+    startup_phase(&startup, "immediate draw");
     LOG_DEBUG("Initializing post processing...");
     postprocessing::initialize(data.gbuffer.width, data.gbuffer.height);
-    LOG_DEBUG("Initializing volume...");
-    volume::initialize();
+    startup_phase(&startup, "post processing");
+    LOG_DEBUG("Initializing gpu timing...");
+    gpu_timing::initialize();
     LOG_DEBUG("Initializing task system...");
-    const size_t num_threads = VIAMD_NUM_WORKER_THREADS == 0 ? md_os_num_processors() : VIAMD_NUM_WORKER_THREADS;
-    task_system::initialize(CLAMP(num_threads, 2, (uint32_t)md_os_num_processors()));
-
-    rama_init(&data.ramachandran.data);
+    // The CPU profiler is initialized first, so the threads of the pool record their zones from the start
+    cpu_profiler::initialize();
+    // The build setting is the default, which can be overridden through the environment
+    data.worker_pool.num_threads = VIAMD_NUM_WORKER_THREADS;
+    if (const char* env = getenv("VIAMD_NUM_WORKER_THREADS")) {
+        data.worker_pool.num_threads = MAX(0, atoi(env));
+    }
+    if (const char* env = getenv("VIAMD_MEMORY_BUDGET_MB")) {
+        data.worker_pool.memory_budget_mb = MAX(0, atoi(env));
+    }
+    if (const char* env = getenv("VIAMD_MEMORY_LIMIT_MB")) {
+        data.worker_pool.memory_limit_mb = MAX(0, atoi(env));
+    }
+    task_system::initialize(data.worker_pool.num_threads);
+    task_system::pool_set_memory_budget((size_t)data.worker_pool.memory_budget_mb * MEGABYTES(1));
+    memory_budget_set((size_t)data.worker_pool.memory_limit_mb * MEGABYTES(1));
+    register_memory_consumers(&data);
+    data.worker_pool.num_threads = (int)task_system::pool_num_threads();
+    data.worker_pool.requested_threads = data.worker_pool.num_threads;
+    startup_phase(&startup, "task system");
 
     md_gl_initialize();
-    md_gl_shaders_init(&data.mold.gl_shaders, shader_output_snippet.ptr, shader_output_snippet.len);
-    md_gl_shaders_init(&data.mold.gl_shaders_lean_and_mean, shader_output_snippet_lean_and_mean.ptr, shader_output_snippet_lean_and_mean.len);
+    startup_phase(&startup, "md_gl");
 
 #if EXPERIMENTAL_GFX_API
     md_gfx_initialize(data.gbuffer.width, data.gbuffer.height, 0);
@@ -1496,7 +2444,8 @@ int main(int argc, char** argv) {
     {
         char exe[1024];
         size_t len = md_path_write_exe(exe, sizeof(exe));
-        if (len) {
+        // The benchmark only loads the files it is given
+        if (len && !VIAMD_BENCH) {
             md_strb_t sb = md_strb_create(frame_allocator);
             str_t folder;
             extract_folder_path(&folder, {exe, len});
@@ -1511,9 +2460,21 @@ int main(int argc, char** argv) {
         }
         if (argc > 1) {
             // Assume argv[1..] are files to load
-            // Currently we do not support any command line flags
-            // So anything here which is a file path is assumed to be a file to load
+            // The only command line flags are --headless (see run_headless), --micro (see run_microbench) and --perf (see run_perf), which never reach this point,
+            // and the flags of the offscreen rendering (see parse_offscreen_args), which are skipped along with their values
+            // So anything else here which is a file path is assumed to be a file to load
             for (int i = 1; i < argc; ++i) {
+                const int num_values = offscreen_arg_values(argv[i]);
+                if (num_values >= 0) {
+                    i += num_values;
+                    continue;
+                }
+#if VIAMD_BENCH
+                if (strcmp(argv[i], "--session") == 0 || strcmp(argv[i], "--out") == 0) {
+                    i += 1;
+                    continue;
+                }
+#endif
                 str_t path = str_from_cstr(argv[i]);
                 if (md_path_is_valid(path)) {
 					file_queue_push(&data.file_queue, path);
@@ -1534,9 +2495,15 @@ int main(int argc, char** argv) {
 
     //bool demo_window = true;
 
+    startup_phase(&startup, "setup");
+    LOG_INFO("Startup: total %.1f ms before the first frame", md_time_as_seconds(startup.last - startup.beg) * 1000.0);
+    bool first_frame = true;
+
     // Main loop
     while (!data.ctx.window.should_close) {
         application::update(&data.ctx);
+        gpu_timing::begin_frame();
+        cpu_profiler::begin_frame();
         
         // This needs to happen first (in imgui events) to enable docking of imgui windows
 #if VIAMD_IMGUI_ENABLE_DOCKSPACE
@@ -1547,9 +2514,13 @@ int main(int argc, char** argv) {
         const int64_t last_frame = MAX(0, num_frames - 1);
         const double   max_frame = (double)last_frame;
 
-        md_bitfield_clear(&data.selection.current_highlight_mask);
+        md_bitfield_clear(versioned_bitfield_modify(&data.selection.current_highlight_mask));
 
-        if (!file_queue_empty(&data.file_queue) && !data.load_dataset.show_window) {
+        memory_budget_enforce();
+        update_vram_estimate(&data);
+        memory_tracker_update();
+
+        if (!file_queue_empty(&data.file_queue) && !data.load_dataset.show_window && !data.async_load.active) {
         	FileQueue::Entry e = file_queue_front(&data.file_queue);
             str_t ext;
             extract_ext(&ext, e.path);
@@ -1599,17 +2570,27 @@ int main(int argc, char** argv) {
                     param.coarse_grained = e.flags & FileFlags_CoarseGrained;
                     param.deperiodize    = e.flags & FileFlags_Deperiodize;
                     param.mol_loader_arg = state.mol_loader_arg;
-                    if (load_dataset_from_file(&data, param)) {
-                        data.animation = {};
-                        if (param.mol_loader) {
-                            if (!(e.flags & FileFlags_KeepRepresentations)) {
-                                clear_representations(&data);
-                                create_default_representations(&data);
-                            }
-                            recompute_atom_visibility_mask(&data);
-                            interpolate_atomic_properties(&data);
-                            reset_view(&data, true, false);
+                    param.keep_representations = e.flags & FileFlags_KeepRepresentations;
+                    if (param.mol_loader) {
+                        // A trajectory which follows the molecule in the queue is scanned while the molecule loads
+                        FileQueue::Entry next = {};
+                        load::LoaderState next_state = {};
+                        if (file_queue_next(&data.file_queue, &next) && !(next.flags & FileFlags_ShowDialogue) &&
+                            load::init_loader_state(&next_state, next.path, frame_allocator) && !next_state.mol_loader && next_state.traj_loader &&
+                            !(next_state.flags & LoaderStateFlag_RequiresDialogue))
+                        {
+                            LoadParam traj_param = {};
+                            traj_param.traj_loader = next_state.traj_loader;
+                            traj_param.file_path   = next.path;
+                            traj_param.deperiodize = next.flags & FileFlags_Deperiodize;
+                            load_dataset_async(&data, param, false, &traj_param);
+                            // The molecule entry is popped here, which leaves the trajectory entry to the pop below
+                            file_queue_pop(&data.file_queue);
+                        } else {
+                            load_dataset_async(&data, param, false);
                         }
+                    } else if (load_dataset_from_file(&data, param)) {
+                        data.animation = {};
                     }
                 }
             }
@@ -1618,19 +2599,32 @@ int main(int argc, char** argv) {
         }
 
         // GUI
+        PUSH_CPU_SECTION("Draw Windows")
         if (data.show_script_window) draw_script_editor_window(&data);
         if (data.load_dataset.show_window) draw_load_dataset_window(&data);
         if (data.representation.show_window) draw_representations_window(&data);
         if (data.density_volume.show_window) draw_density_volume_window(&data);
         if (data.distributions.show_window) draw_distribution_window(&data);
         if (data.timeline.show_window) draw_timeline_window(&data);
-        if (data.ramachandran.show_window) draw_ramachandran_window(&data);
+        if (data.ramachandran.show_window) {
+            // The reference densities are resampled the first time the window is shown
+            if (!data.ramachandran.data_valid) {
+                const md_timestamp_t t0 = md_time_current();
+                rama_init(&data.ramachandran.data);
+                data.ramachandran.data_valid = true;
+                LOG_INFO("Initialized ramachandran reference densities in %.1f ms", md_time_as_seconds(md_time_current() - t0) * 1000.0);
+            }
+            draw_ramachandran_window(&data);
+        }
         if (data.shape_space.show_window) draw_shape_space_window(&data);
+        if (data.fluctuation.show_window) draw_fluctuation_window(&data);
+        if (data.contacts.show_window) draw_contacts_window(&data);
         if (data.dataset.show_window) draw_dataset_window(&data);
         if (data.selection.query.show_window) draw_selection_query_window(&data);
         if (data.selection.grow.show_window) draw_selection_grow_window(&data);
         if (data.show_property_export_window) draw_property_export_window(&data);
         if (data.show_debug_window) draw_debug_window(&data);
+        POP_CPU_SECTION()
 
         data.selection.selecting = false;
 
@@ -1638,6 +2632,11 @@ int main(int argc, char** argv) {
 
         handle_camera_interaction(&data);
         handle_camera_animation(&data);
+#if VIAMD_BENCH
+        step_bench(&data);
+#endif
+        update_dynamic_resolution(&data);
+        update_quality_governor(&data);
         update_view_param(&data);
 
         ImGuiWindow* win = ImGui::GetCurrentContext()->HoveredWindow;
@@ -1659,7 +2658,7 @@ int main(int argc, char** argv) {
             }
 #endif
             if (ImGui::IsKeyDown(KEY_SCRIPT_EVALUATE_MOD) && ImGui::IsKeyPressed(KEY_SCRIPT_EVALUATE)) {
-                data.mold.script.eval_init = true;
+                request_evaluation(&data);
             }
 
             if (ImGui::IsKeyPressed(KEY_SHOW_DEBUG_WINDOW)) {
@@ -1671,8 +2670,14 @@ int main(int argc, char** argv) {
                 postprocessing::initialize(data.gbuffer.width, data.gbuffer.height);
                 ramachandran::initialize();
                 volume::initialize();
-                md_gl_shaders_free(&data.mold.gl_shaders);
-                md_gl_shaders_init(&data.mold.gl_shaders, shader_output_snippet.ptr, shader_output_snippet.len);
+                culling::initialize();
+                sdf::initialize();
+                // Compiled again when they are next drawn
+                if (data.mold.gl_shaders_valid) {
+                    md_gl_shaders_free(&data.mold.gl_shaders);
+                    data.mold.gl_shaders_valid = false;
+                }
+                free_representation_subset_shaders(&data);
             }
 
             if (ImGui::IsKeyPressed(KEY_PLAY_PAUSE)) {
@@ -1710,41 +2715,59 @@ int main(int argc, char** argv) {
             data.representation.atom_visibility_mask_dirty = false;
         }
 
+        step_offscreen(&data);
+        step_movie_export(&data);
+
         if (data.animation.mode == PlaybackMode::Playing) {
+            const bool   use_filter = data.animation.loop && data.timeline.filter.enabled;
+            const double loop_beg   = use_filter ? data.timeline.filter.beg_frame : 0.0;
+            const double loop_end   = use_filter ? data.timeline.filter.end_frame : max_frame;
+
             data.animation.frame += data.ctx.timing.delta_s * data.animation.fps;
-            data.animation.frame = CLAMP(data.animation.frame, 0.0, max_frame);
-            if (data.animation.frame >= max_frame) {
-                data.animation.mode = PlaybackMode::Stopped;
-                data.animation.frame = max_frame;
-            } else if (data.animation.frame <= 0) {
-                data.animation.mode = PlaybackMode::Stopped;
-                data.animation.frame = 0;
-            }
-
-            if (!task_system::task_is_running(data.tasks.prefetch_frames)) {
-                uint32_t traj_frames = (uint32_t)md_trajectory_num_frames(data.mold.traj);
-                if (traj_frames > 0 && load::traj::num_cache_frames(data.mold.traj) < traj_frames) {
-                    uint32_t frame_beg = 0;
-                    uint32_t frame_end = 0;
-                    // @NOTE: This is certainly something which can be improved upon.
-                    // It prefetches frames in the direction of the animation.
-                    // In a more optimal case, it should never yield until it catches up with the number of frames it expects to have as a buffer.
-                    
-                    if (data.animation.fps > 0) {
-                        frame_beg = CLAMP((uint32_t)data.animation.frame, 0, traj_frames - 1);
-                        frame_end = CLAMP((uint32_t)data.animation.frame + 20, 0, traj_frames);
-                    } else {
-                        frame_beg = CLAMP((uint32_t)data.animation.frame - 20, 0, traj_frames - 1);
-                        frame_end = CLAMP((uint32_t)data.animation.frame, 0, traj_frames);
-                    }
-                    if (frame_beg != frame_end) {
-                        data.tasks.prefetch_frames = task_system::pool_enqueue(STR("##Prefetch Frames"), frame_beg, frame_end, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
-                            ApplicationData* data = (ApplicationData*)user_data;
-                            for (uint32_t i = frame_beg; i < frame_end; ++i) {
-                                md_trajectory_load_frame(data->mold.traj, i, 0, 0, 0, 0);
-                            }
-                        }, &data);
+            if (data.animation.loop && loop_end > loop_beg) {
+                const double ext = loop_end - loop_beg;
+                data.animation.frame = loop_beg + fmod(fmod(data.animation.frame - loop_beg, ext) + ext, ext);
+            } else {
+                data.animation.frame = CLAMP(data.animation.frame, 0.0, max_frame);
+                if (data.animation.frame >= max_frame) {
+                    data.animation.mode = PlaybackMode::Stopped;
+                    data.animation.frame = max_frame;
+                } else if (data.animation.frame <= 0) {
+                    data.animation.mode = PlaybackMode::Stopped;
+                    data.animation.frame = 0;
+                }
+            }
+
+            uint32_t traj_frames = (uint32_t)md_trajectory_num_frames(data.mold.traj);
+            if (traj_frames > 0) {
+                // Let the cache know where we are heading, so it evicts frames behind the playhead first
+                // Cubic interpolation needs the frames [-1, +2] around the playhead, linear [0, +1]
+                const InterpolationMode interp = data.animation.interpolation;
+                const int32_t support_beg = interp == InterpolationMode::CubicSpline ? 1 : 0;
+                const int32_t support_end = interp == InterpolationMode::CubicSpline ? 2 : interp == InterpolationMode::Linear ? 1 : 0;
+                const bool filter = data.timeline.filter.enabled;
+
+                load::traj::PlaybackHint hint = {};
+                hint.frame       = data.animation.frame;
+                hint.fps         = data.animation.fps;
+                hint.support_beg = support_beg;
+                hint.support_end = support_end;
+                hint.range_beg   = filter ? (int64_t)data.timeline.filter.beg_frame : 0;
+                hint.range_end   = filter ? (int64_t)data.timeline.filter.end_frame + 1 : (int64_t)traj_frames;
+                hint.loop        = data.animation.loop;
+                load::traj::set_playback_hint(data.mold.traj, hint);
+
+                if (!task_system::task_is_running(data.tasks.prefetch_frames) && load::traj::num_cache_frames(data.mold.traj) < traj_frames) {
+                    // Keep the frames ahead of the playhead (in the direction of the animation) resident
+                    int decode_depth = data.animation.read_ahead.decode_depth;
+                    if (data.animation.read_ahead.auto_depth) {
+                        decode_depth = (int)load::traj::read_ahead_depth_for_playback(data.mold.traj, data.animation.fps) + support_end;
+                        data.animation.read_ahead.decode_depth = decode_depth;
                     }
+                    const int dir = data.animation.fps > 0 ? 1 : -1;
+                    const int64_t start = (int64_t)data.animation.frame - dir * support_beg;
+                    load::traj::set_read_ahead_depth(data.mold.traj, data.animation.read_ahead.io_depth, decode_depth);
+                    data.tasks.prefetch_frames = load::traj::read_ahead(data.mold.traj, start, dir);
                 }
             }
         }
@@ -1767,7 +2790,7 @@ int main(int argc, char** argv) {
             data.timeline.filter.beg_frame = CLAMP(round(data.animation.frame - half_window_ext), 0.0, max_frame);
             data.timeline.filter.end_frame = CLAMP(round(data.animation.frame + half_window_ext), 0.0, max_frame);
             if (data.mold.script.ir && (data.timeline.filter.beg_frame != pre_beg || data.timeline.filter.end_frame != pre_end)) {
-                data.mold.script.evaluate_filt = true;
+                request_filt_evaluation(&data);
             }
         }
 
@@ -1781,7 +2804,14 @@ int main(int argc, char** argv) {
             }
         }
 
-        if (time_changed) {
+        // The full update is deferred until the scrubbing ends, which then counts as a change of time
+        if (update_scrub(&data, time_changed)) {
+            time_changed = true;
+        }
+
+        if (data.scrub.active) {
+            data.render.dirty |= time_changed;
+        } else if (time_changed) {
             time_stopped = false;
 
             PUSH_CPU_SECTION("Interpolate Position")
@@ -1799,7 +2829,13 @@ int main(int argc, char** argv) {
                 auto& rep = data.representation.reps[i];
                 if (!rep.enabled) continue;
                 if (rep.dynamic_evaluation || rep.color_mapping == ColorMapping::SecondaryStructure) {
-                    update_representation(&data, &rep);
+                    // The mask of a dynamic filter is swapped in from the cache if the frame has been evaluated ahead of time
+                    const bool cached = rep.dynamic_evaluation && apply_cached_dynamic_filter(&data, &rep);
+                    // A filter which does not depend on the coordinates gives the same mask for every frame
+                    const bool evaluate_filter = !cached && (rep.filt_is_dynamic || rep.filt_is_dirty);
+                    // Without a new mask only the colors can change, which is skipped if the mapping gives the colors which are shown
+                    if (!cached && !evaluate_filter && rep.color_key && rep.color_key == representation_color_key(&data, &rep)) continue;
+                    update_representation(&data, &rep, evaluate_filter);
                 }
             }
             POP_CPU_SECTION()
@@ -1810,17 +2846,26 @@ int main(int argc, char** argv) {
             }
         }
 
+        // Also when the time is unchanged, the transform of the frame may have been computed since
+        if (data.tracking.active && !data.scrub.active) {
+            apply_tracking(&data);
+        }
+        if (data.fluctuation.show_average && data.fluctuation.ready && !data.fluctuation.average_applied && !data.scrub.active) {
+            apply_average_structure(&data);
+        }
+
+        data.mold.script.time_since_eval_request += data.ctx.timing.delta_s;
+        data.mold.script.time_since_filt_request += data.ctx.timing.delta_s;
+
         if (data.mold.script.compile_ir) {
             data.mold.script.time_since_last_change += data.ctx.timing.delta_s;
 
             editor.ClearMarkers();
             editor.ClearErrorMarkers();
 
-            if (data.mold.script.time_since_last_change > COMPILATION_TIME_DELAY_IN_SECONDS) {
-                // We cannot recompile while it is evaluating.
-                // Need to interrupt and wait for tasks to finish.
-                if (data.mold.script.full_eval) md_script_eval_interrupt(data.mold.script.full_eval);
-                if (data.mold.script.filt_eval) md_script_eval_interrupt(data.mold.script.filt_eval);
+            // A pending evaluation request compiles right away, since it would otherwise wait for the IR to settle
+            if (data.mold.script.time_since_last_change > COMPILATION_TIME_DELAY_IN_SECONDS || data.mold.script.eval_init) {
+                // Running evaluations work on eval_ir, which is left untouched by the compilation, so there is no need to interrupt them
 
                 // Try aquire all semaphores
                 if (md_semaphore_try_aquire_n(&data.mold.script.ir_semaphore, IR_SEMAPHORE_MAX_COUNT)) {
@@ -1833,7 +2878,10 @@ int main(int argc, char** argv) {
                     data.mold.script.compile_ir = false;
                     data.mold.script.time_since_last_change = 0;
                     
-                    data.mold.script.ir = md_script_ir_create(persistent_allocator);
+                    if (data.mold.script.ir != data.mold.script.eval_ir) {
+                        md_script_ir_free(data.mold.script.ir);
+                    }
+                    data.mold.script.ir = md_script_ir_create(memory_tracker_allocator(MemoryTracker_ScriptEval));
 
                     std::string src = editor.GetText();
                     str_t src_str {src.data(), src.length()};
@@ -1931,6 +2979,9 @@ int main(int argc, char** argv) {
                             if (data.mold.script.ir_fingerprint != ir_figerprint) {
                                 data.mold.script.ir_fingerprint = ir_figerprint;
                             }
+                            md_array_free(data.mold.script.ir_statements, persistent_allocator);
+                            data.mold.script.ir_statements = script_statement_fingerprints(src_str, persistent_allocator);
+                            data.mold.script.ir_source_fingerprint = script_context_fingerprint(&data);
                         } else {
                             md_script_ir_free(data.mold.script.ir);
                             data.mold.script.ir = nullptr;
@@ -1941,13 +2992,37 @@ int main(int argc, char** argv) {
         }
 
         if (num_frames > 0) {
-            if (data.mold.script.eval_init) {
-                if (task_system::task_is_running(data.tasks.evaluate_full)) md_script_eval_interrupt(data.mold.script.full_eval);
+            // Superseded evaluations are cancelled right away, the remaining ranges of the task are skipped
+            // A request for the same source as the running evaluation does not supersede it
+            const bool eval_source_changed = data.mold.script.ir_source_fingerprint != data.mold.script.eval_source_fingerprint;
+            if (data.mold.script.full_generation != data.mold.script.eval_generation && !data.mold.script.compile_ir && eval_source_changed &&
+                task_system::task_is_running(data.tasks.evaluate_full)) {
+                task_system::task_interrupt(data.tasks.evaluate_full);
+                md_script_eval_interrupt(data.mold.script.full_eval);
+            }
+
+            // The new evaluation starts once the requests and the IR have settled
+            if (data.mold.script.eval_init && !data.mold.script.compile_ir && data.mold.script.time_since_eval_request > EVALUATION_DEBOUNCE_IN_SECONDS) {
+                // Keep the evaluation if it is complete (or still running) and no statement or input has changed
+                const md_script_eval_t* full_eval = data.mold.script.full_eval;
+                if (full_eval && !eval_source_changed && md_script_ir_valid(data.mold.script.ir) &&
+                    (task_system::task_is_running(data.tasks.evaluate_full) || md_script_eval_num_frames_completed(full_eval) == md_script_eval_num_frames_total(full_eval)))
+                {
+                    data.mold.script.eval_init = false;
+                    data.mold.script.full_generation = data.mold.script.eval_generation;
+                    LOG_INFO("No properties have changed, keeping the current evaluation");
+                }
+            }
+
+            if (data.mold.script.eval_init && !data.mold.script.compile_ir && data.mold.script.time_since_eval_request > EVALUATION_DEBOUNCE_IN_SECONDS) {
                 if (task_system::task_is_running(data.tasks.evaluate_filt)) md_script_eval_interrupt(data.mold.script.filt_eval);
                     
                 if (task_system::task_is_running(data.tasks.evaluate_full) == false &&
-                    task_system::task_is_running(data.tasks.evaluate_filt) == false) {
+                    task_system::task_is_running(data.tasks.evaluate_filt) == false &&
+                    task_system::task_is_running(data.tasks.write_eval_cache) == false) {
                     data.mold.script.eval_init = false;
+                    // The histograms are binned directly from the values of the properties
+                    clear_histogram_requests(&data);
 
                     if (data.mold.script.full_eval) {
                         md_script_eval_free(data.mold.script.full_eval);
@@ -1958,17 +3033,29 @@ int main(int argc, char** argv) {
                 
                     if (md_script_ir_valid(data.mold.script.ir)) {
                         if (data.mold.script.ir != data.mold.script.eval_ir) {
+                            vis_cache_clear(&data.mold.script.vis_cache);
+                            data.mold.script.vis = nullptr;
                             md_script_ir_free(data.mold.script.eval_ir);
                             data.mold.script.eval_ir = data.mold.script.ir;
                         }
-                        data.mold.script.full_eval = md_script_eval_create(num_frames, data.mold.script.ir, STR(""), persistent_allocator);
-                        data.mold.script.filt_eval = md_script_eval_create(num_frames, data.mold.script.ir, STR("filt"), persistent_allocator);
+                        data.mold.script.full_eval = md_script_eval_create(num_frames, data.mold.script.ir, STR(""), memory_tracker_allocator(MemoryTracker_ScriptEval));
+                        data.mold.script.filt_eval = md_script_eval_create(num_frames, data.mold.script.ir, STR("filt"), memory_tracker_allocator(MemoryTracker_ScriptEval));
+
+                        const ScriptStatementFingerprint* curr = data.mold.script.ir_statements;
+                        const ScriptStatementFingerprint* prev = data.mold.script.eval_statements;
+                        const size_t num_changed = script_statements_changed(curr, md_array_size(curr), prev, md_array_size(prev));
+                        LOG_INFO("Evaluating script, %zu of %zu statements are new or modified", num_changed, md_array_size(curr));
+
+                        md_array_resize(data.mold.script.eval_statements, md_array_size(curr), persistent_allocator);
+                        MEMCPY(data.mold.script.eval_statements, curr, md_array_size(curr) * sizeof(ScriptStatementFingerprint));
+                        data.mold.script.eval_source_fingerprint = data.mold.script.ir_source_fingerprint;
                     }
 
                     init_display_properties(&data);
 
                     data.mold.script.evaluate_filt = true;
                     data.mold.script.evaluate_full = true;
+                    data.mold.script.full_generation = data.mold.script.eval_generation;
                 }
             }
 
@@ -1983,10 +3070,35 @@ int main(int argc, char** argv) {
                             data.mold.script.evaluate_full = false;
                             md_script_eval_clear(data.mold.script.full_eval);
 
-                            data.tasks.evaluate_full = task_system::pool_enqueue(STR("Eval Full"), 0, (uint32_t)num_frames, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
+                            if (read_eval_cache(&data)) {
+                                LOG_INFO("Restored evaluation from cache");
+                            } else {
+                            // Coarse to fine, so the timeline and distributions are populated early
+                            if (data.mold.script.full_sweep.num_frames != (uint32_t)num_frames) {
+                                progressive_init(&data.mold.script.full_sweep, (uint32_t)num_frames, persistent_allocator);
+                            } else {
+                                progressive_reset(&data.mold.script.full_sweep);
+                            }
+
+                            data.tasks.evaluate_full = task_system::pool_enqueue(STR("Eval Full"), 0, (uint32_t)num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
                                 ApplicationData* data = (ApplicationData*)user_data;
-                                md_script_eval_frame_range(data->mold.script.full_eval, data->mold.script.eval_ir, &data->mold.mol, data->mold.traj, frame_beg, frame_end);
-                            }, &data);
+                                ProgressiveSweep* sweep = &data->mold.script.full_sweep;
+                                uint32_t frame_idx;
+                                uint32_t batch = 1;
+                                for (uint32_t i = range_beg; i < range_end && !task_system::task_cancelled() && progressive_next(sweep, &frame_idx);) {
+                                    const uint32_t end = batch > 1 ? progressive_claim_run(sweep, frame_idx, MIN(batch, range_end - i)) : frame_idx + 1;
+                                    const md_timestamp_t t0 = md_time_current();
+                                    md_script_eval_frame_range(data->mold.script.full_eval, data->mold.script.eval_ir, &data->mold.mol, data->mold.traj, frame_idx, end);
+                                    const double ms_per_frame = md_time_as_seconds(md_time_current() - t0) * 1000.0 / (end - frame_idx);
+                                    for (uint32_t f = frame_idx; f < end; ++f) {
+                                        progressive_complete(sweep, f);
+                                    }
+                                    i += end - frame_idx;
+                                    if (progressive_passes_completed(sweep) > 0) {
+                                        batch = (uint32_t)CLAMP(EVAL_BATCH_TARGET_MS / MAX(ms_per_frame, 1.0e-3), 1.0, (double)EVAL_BATCH_MAX_FRAMES);
+                                    }
+                                }
+                            }, &data, 0, task_system::Priority_Background, estimate_eval_range_memory(&data));
                             
 #if MEASURE_EVALUATION_TIME
                             uint64_t time = (uint64_t)md_time_current();
@@ -1997,14 +3109,25 @@ int main(int argc, char** argv) {
                                 LOG_INFO("Evaluation completed in: %.3fs", s);
                             }, (void*)time, data.tasks.evaluate_full);
 #endif
+                            if (data.mold.script.cache_enabled) {
+                                data.tasks.write_eval_cache = task_system::pool_enqueue(STR("##Write Eval Cache"), [](void* user_data) {
+                                    write_eval_cache((ApplicationData*)user_data);
+                                }, &data, data.tasks.evaluate_full, task_system::Priority_Background);
+                            }
+                            }
                         }
                 }
             }
 
+            // Filtered distributions of per-frame properties are derived from the full evaluation, a sweep is only needed for range dependent properties
+            if (data.mold.script.filt_eval && data.mold.script.evaluate_filt && !filt_eval_required(&data)) {
+                data.mold.script.evaluate_filt = false;
+            }
+
             if (data.mold.script.filt_eval && data.mold.script.evaluate_filt && data.timeline.filter.enabled) {
                 if (task_system::task_is_running(data.tasks.evaluate_filt)) {
                     md_script_eval_interrupt(data.mold.script.filt_eval);
-                } else {
+                } else if (data.mold.script.time_since_filt_request > FILTER_EVALUATION_DEBOUNCE_IN_SECONDS) {
                     //if (md_semaphore_try_aquire(&data.mold.script.ir_semaphore)) {
                         if (md_script_ir_valid(data.mold.script.eval_ir) &&
                             md_script_eval_ir_fingerprint(data.mold.script.filt_eval) == md_script_ir_fingerprint(data.mold.script.eval_ir))
@@ -2019,7 +3142,7 @@ int main(int argc, char** argv) {
                                 {
                                     ApplicationData* data = (ApplicationData*)user_data;
                                     md_script_eval_frame_range(data->mold.script.filt_eval, data->mold.script.eval_ir, &data->mold.mol, data->mold.traj, beg, end);
-                                }, &data);
+                                }, &data, 0, task_system::Priority_Interactive, estimate_eval_range_memory(&data));
                             
                             /*
                             task_system::pool_enqueue(STR("##Release IR Semaphore"), [](void* user_data)
@@ -2054,9 +3177,26 @@ int main(int argc, char** argv) {
             (data.ctx.framebuffer.width != 0 && data.ctx.framebuffer.height != 0)) {
             init_gbuffer(&data.gbuffer, data.ctx.framebuffer.width, data.ctx.framebuffer.height);
             postprocessing::initialize(data.gbuffer.width, data.gbuffer.height);
+            data.render.dirty = true;
         }
 
+        // Publish the backbone data of each completed pass of the progressive sweep, the final pass is published by the task itself
+        if (progressive_pass_published(&data.trajectory_data.sweep)) {
+            data.trajectory_data.backbone_angles.fingerprint = generate_fingerprint();
+            data.trajectory_data.secondary_structure.fingerprint = generate_fingerprint();
+        }
+        PUSH_CPU_SECTION("Update Analysis")
+        update_backbone_computation(&data);
+        update_evaluation_priority(&data);
+
+        update_representation_culling(&data);
+        update_representation_sdfs(&data);
+        update_picking_bvh(&data);
+        POP_CPU_SECTION()
+        const bool render_scene = scene_needs_render(&data);
+        PUSH_CPU_SECTION("Update MD Buffers")
         update_md_buffers(&data);
+        POP_CPU_SECTION()
         update_display_properties(&data);
 
         if (data.mold.mol.backbone.count > 0 && data.ramachandran.show_window) {
@@ -2079,10 +3219,39 @@ int main(int argc, char** argv) {
                 }
             }
 
-            if (data.ramachandran.full_fingerprint != data.trajectory_data.backbone_angles.fingerprint) {
-                if (!task_system::task_is_running(data.tasks.ramachandran_compute_full_density)) {
-                    data.ramachandran.full_fingerprint = data.trajectory_data.backbone_angles.fingerprint;
-                    const uint32_t* indices[4] = {
+            // The GPU path executes immediately, so it is only used if the angles fit on the GPU and no CPU computation is in flight
+            bool gpu_density = data.ramachandran.gpu_density && rama_gpu_supported() &&
+                !task_system::task_is_running(data.tasks.ramachandran_compute_full_density) &&
+                !task_system::task_is_running(data.tasks.ramachandran_compute_filt_density);
+            if (gpu_density && data.ramachandran.gpu_angles.fingerprint != data.trajectory_data.backbone_angles.fingerprint) {
+                gpu_density = rama_gpu_upload_angles(&data.ramachandran.gpu_angles, data.trajectory_data.backbone_angles.data, data.trajectory_data.backbone_angles.q16,
+                    (uint32_t)num_frames, (uint32_t)data.trajectory_data.backbone_angles.stride, data.trajectory_data.backbone_angles.fingerprint);
+            }
+
+            if (gpu_density) {
+                const uint32_t* indices[4] = {
+                    data.ramachandran.rama_type_indices[0],
+                    data.ramachandran.rama_type_indices[1],
+                    data.ramachandran.rama_type_indices[2],
+                    data.ramachandran.rama_type_indices[3],
+                };
+                if (data.ramachandran.full_fingerprint != data.trajectory_data.backbone_angles.fingerprint) {
+                    data.ramachandran.full_fingerprint = data.trajectory_data.backbone_angles.fingerprint;
+                    rama_rep_compute_density_gpu(&data.ramachandran.data.full, &data.ramachandran.gpu_angles, indices, 0, (uint32_t)num_frames, data.ramachandran.blur_sigma);
+                }
+                if (data.ramachandran.filt_fingerprint != data.timeline.filter.fingerprint) {
+                    data.ramachandran.filt_fingerprint = data.timeline.filter.fingerprint;
+                    rama_rep_compute_density_gpu(&data.ramachandran.data.filt, &data.ramachandran.gpu_angles, indices, (uint32_t)data.timeline.filter.beg_frame, (uint32_t)data.timeline.filter.end_frame);
+                }
+            }
+
+            update_rama_chunk_caches(&data);
+
+            if (data.ramachandran.full_fingerprint != data.trajectory_data.backbone_angles.fingerprint) {
+                if (!task_system::task_is_running(data.tasks.ramachandran_compute_full_density)) {
+                    const uint64_t fingerprint = data.trajectory_data.backbone_angles.fingerprint;
+                    data.ramachandran.full_fingerprint = fingerprint;
+                    const uint32_t* indices[4] = {
                         data.ramachandran.rama_type_indices[0],
                         data.ramachandran.rama_type_indices[1],
                         data.ramachandran.rama_type_indices[2],
@@ -2093,8 +3262,24 @@ int main(int argc, char** argv) {
                     const uint32_t frame_end = (uint32_t)num_frames;
                     const uint32_t frame_stride = (uint32_t)data.trajectory_data.backbone_angles.stride;
 
-                    data.tasks.ramachandran_compute_full_density = rama_rep_compute_density(&data.ramachandran.data.full, data.trajectory_data.backbone_angles.data, indices, frame_beg, frame_end, frame_stride, data.ramachandran.blur_sigma);
-                } else {
+                    // The density is composed from the cached grids of the angles if there are any, otherwise the grids are rebuilt along with it
+                    rama_chunk_cache_t* cache = lru_cache_acquire(&data.ramachandran.chunk_caches, fingerprint);
+                    const bool rebuild = !cache;
+                    if (cache) {
+                        data.ramachandran.chunk_pinned[0] = fingerprint;
+                    } else {
+                        cache = &data.ramachandran.chunk_build;
+                        data.ramachandran.chunk_build_key = fingerprint;
+                    }
+
+                    if (data.trajectory_data.backbone_angles.q16) {
+                        data.tasks.ramachandran_compute_full_density = rama_rep_compute_density(&data.ramachandran.data.full, data.trajectory_data.backbone_angles.q16, indices, frame_beg, frame_end, frame_stride, data.ramachandran.blur_sigma, cache, rebuild);
+                    } else {
+                        data.tasks.ramachandran_compute_full_density = rama_rep_compute_density(&data.ramachandran.data.full, data.trajectory_data.backbone_angles.data, indices, frame_beg, frame_end, frame_stride, data.ramachandran.blur_sigma, cache, rebuild);
+                    }
+                    // Launched now, so the grids are not released (or published) before the task has run
+                    task_system::execute_task(data.tasks.ramachandran_compute_full_density);
+                } else if (task_system::task_is_running(data.tasks.ramachandran_compute_full_density)) {
                     task_system::task_interrupt(data.tasks.ramachandran_compute_full_density);
                 }
             }
@@ -2114,7 +3299,17 @@ int main(int argc, char** argv) {
                     const uint32_t frame_end = (uint32_t)data.timeline.filter.end_frame;
                     const uint32_t frame_stride = (uint32_t)data.trajectory_data.backbone_angles.stride;
 
-                    data.tasks.ramachandran_compute_filt_density = rama_rep_compute_density(&data.ramachandran.data.filt, data.trajectory_data.backbone_angles.data, indices, frame_beg, frame_end, frame_stride);
+                    // Only grids of the current angles are used, which are not cached yet while they are rebuilt
+                    const uint64_t fingerprint = data.trajectory_data.backbone_angles.fingerprint;
+                    rama_chunk_cache_t* cache = lru_cache_acquire(&data.ramachandran.chunk_caches, fingerprint);
+                    if (cache) data.ramachandran.chunk_pinned[1] = fingerprint;
+
+                    if (data.trajectory_data.backbone_angles.q16) {
+                        data.tasks.ramachandran_compute_filt_density = rama_rep_compute_density(&data.ramachandran.data.filt, data.trajectory_data.backbone_angles.q16, indices, frame_beg, frame_end, frame_stride, 5.0f, cache);
+                    } else {
+                        data.tasks.ramachandran_compute_filt_density = rama_rep_compute_density(&data.ramachandran.data.filt, data.trajectory_data.backbone_angles.data, indices, frame_beg, frame_end, frame_stride, 5.0f, cache);
+                    }
+                    task_system::execute_task(data.tasks.ramachandran_compute_filt_density);
                 }
                 else {
                     task_system::task_interrupt(data.tasks.ramachandran_compute_filt_density);
@@ -2122,19 +3317,52 @@ int main(int argc, char** argv) {
             }
         }
 
+        // Frames of the movie export are rendered with the filters of their time
+        PUSH_CPU_SECTION("Update Filters")
+        update_representation_filters(&data, data.movie.capture);
+        update_dynamic_filter_caches(&data);
+        POP_CPU_SECTION()
+
         handle_picking(&data);
-        clear_gbuffer(&data.gbuffer);
-        fill_gbuffer(&data);
-        immediate::render();
+        if (render_scene) {
+            GBuffer* gbuf = scene_gbuffer(&data);
+            PUSH_CPU_SECTION("Fill G-Buffer")
+            clear_gbuffer(gbuf);
+            fill_gbuffer(&data, gbuf);
+            immediate::render();
+            POP_CPU_SECTION()
+            if (gbuf != &data.gbuffer) {
+                PUSH_GPU_SECTION("Upscale G-Buffer")
+                upscale_gbuffer(&data.gbuffer, gbuf);
+                POP_GPU_SECTION()
+            }
+        }
 
         // Activate backbuffer
         glDisable(GL_DEPTH_TEST);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        application::bind_default_framebuffer(GL_DRAW_FRAMEBUFFER);
         glViewport(0, 0, data.ctx.framebuffer.width, data.ctx.framebuffer.height);
-        glDrawBuffer(GL_BACK);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        apply_postprocessing(data);
+        if (render_scene) {
+            PUSH_CPU_SECTION("Postprocessing")
+            apply_postprocessing(data);
+            blit_composite(&data.gbuffer, true);
+            POP_CPU_SECTION()
+        } else {
+            blit_composite(&data.gbuffer, false);
+        }
+
+        capture_movie_frame(&data);
+
+        if (!str_empty(data.screenshot.tiled.path)) {
+            const auto& t = data.screenshot.tiled;
+            render_tiled_image(&data, t.path, t.width, t.height, t.samples);
+            str_free(data.screenshot.tiled.path, persistent_allocator);
+            data.screenshot.tiled.path = {};
+            application::bind_default_framebuffer(GL_DRAW_FRAMEBUFFER);
+            glViewport(0, 0, data.ctx.framebuffer.width, data.ctx.framebuffer.height);
+        }
 
         // Render Screenshot of backbuffer without GUI here
         if (data.screenshot.hide_gui && !str_empty(data.screenshot.path_to_file)) {
@@ -2143,43 +3371,89 @@ int main(int argc, char** argv) {
             data.screenshot.path_to_file = {};
         }
 
+        PUSH_CPU_SECTION("Imgui render")
         PUSH_GPU_SECTION("Imgui render")
         application::render_imgui(&data.ctx);
         POP_GPU_SECTION()
+        POP_CPU_SECTION()
 
         if (!data.screenshot.hide_gui && !str_empty(data.screenshot.path_to_file)) {
             create_screenshot(&data);
-            data.screenshot.path_to_file = {};
             str_free(data.screenshot.path_to_file, persistent_allocator);
+            data.screenshot.path_to_file = {};
         }
 
+        gpu_timing::end_frame();
+
         // Swap buffers
+        PUSH_CPU_SECTION("Swap Buffers")
         application::swap_buffers(&data.ctx);
+        POP_CPU_SECTION()
+        cpu_profiler::end_frame();
+        if (first_frame) {
+            startup_phase(&startup, "first frame");
+            first_frame = false;
+        }
+#if VIAMD_BENCH
+        end_bench_frame(&data);
+#endif
+
+        update_screenshot_captures(&data);
+        update_movie_captures(&data);
+        update_region_selection(&data);
+        update_event_wait(&data);
 
-        task_system::execute_queued_tasks();
+        update_worker_pool(&data);
+        task_system::execute_queued_tasks(data.tasks.main_budget_ms);
 
         // Reset frame allocator
-        md_linear_allocator_reset(&linear_alloc);
+        frame_arena_reset(&frame_arena);
     }
 
     interrupt_async_tasks(&data);
+    free_screenshot_captures(&data);
+    free_movie_captures(&data);
+    free_region_selection(&data);
+    free_async_filter(&data.selection.query.filter);
+    free_cell_list(&data);
+    free_picking_bvh(&data);
+    vis_cache_free(&data.mold.script.vis_cache);
+    free_derived_caches(&data);
+    histogram_batch_free(&data.histograms.batch);
+    if (data.shape_space.density.tex) glDeleteTextures(1, &data.shape_space.density.tex);
+    if (data.selection.screen_space.buffer) glDeleteBuffers(1, &data.selection.screen_space.buffer);
+    md_array_free(data.selection.screen_space.flags, persistent_allocator);
 
     // shutdown subsystems
     LOG_DEBUG("Shutting down immediate draw...");
     immediate::shutdown();
     LOG_DEBUG("Shutting down ramachandran...");
+    rama_gpu_free_angles(&data.ramachandran.gpu_angles);
     ramachandran::shutdown();
     LOG_DEBUG("Shutting down post processing...");
     postprocessing::shutdown();
     LOG_DEBUG("Shutting down volume...");
+    volume::free_bricked_volume(&data.density_volume.bricks.volume);
+    volume::free_macro_cell_grid(&data.density_volume.macro_cells);
     volume::shutdown();
+    LOG_DEBUG("Shutting down culling...");
+    free_representation_lod(&data);
+    culling::free_chunks(&data.representation.culling.chunks);
+    culling::free_hiz(&data.representation.culling.hiz);
+    culling::shutdown();
+    LOG_DEBUG("Shutting down distance fields...");
+    sdf::shutdown();
+    LOG_DEBUG("Shutting down gpu timing...");
+    gpu_timing::shutdown();
     LOG_DEBUG("Shutting down task system...");
     task_system::shutdown();
+    cpu_profiler::shutdown();
 
     destroy_gbuffer(&data.gbuffer);
+    destroy_gbuffer(&data.dynamic_resolution.gbuffer);
     application::shutdown(&data.ctx);
 
-    return 0;
+    return data.offscreen.result;
 }
 
 static void init_dataset_items(ApplicationData* data) {
@@ -2268,12 +3542,21 @@ static void display_property_copy_param_from_old(DisplayProperty& item, const Di
             item.distribution_subplot_mask  = old_items[i].distribution_subplot_mask;
             item.show_in_volume             = old_items[i].show_in_volume;
             item.plot_type                  = old_items[i].plot_type;
+            item.kde                        = old_items[i].kde;
+            item.kde_bandwidth              = old_items[i].kde_bandwidth;
             break;
         }
     }
 }
 
+// Frames which are not evaluated yet are plotted as gaps, the full evaluation fills the timeline out of order
+static inline double evaluated_value(const DisplayProperty* dp, int sample_idx, float value) {
+    return md_bitfield_test_bit(md_script_eval_completed_frames(dp->eval), sample_idx) ? (double)value : NAN;
+}
+
 static void init_display_properties(ApplicationData* data) {
+    clear_histogram_requests(data);
+
     DisplayProperty* new_items = 0;
     DisplayProperty* old_items = data->display_properties;
 
@@ -2282,6 +3565,10 @@ static void init_display_properties(ApplicationData* data) {
         data->mold.script.filt_eval
     };
 
+    // Both evaluations are created from the same IR, so their properties correspond by index
+    const int64_t num_full_props = md_script_eval_num_properties(evals[0]);
+    const md_script_property_t* full_props = md_script_eval_properties(evals[0]);
+
     for (const md_script_eval_t* eval : evals) {
         const int64_t num_props = md_script_eval_num_properties(eval);
         const md_script_property_t* props = md_script_eval_properties(eval);
@@ -2303,6 +3590,7 @@ static void init_display_properties(ApplicationData* data) {
             item.unit = props[i].data.unit;
             item.prop = &props[i];
             item.eval = eval;
+            item.full_prop = (!is_full_eval && (prop.flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) && i < num_full_props) ? &full_props[i] : NULL;
             item.prop_fingerprint = 0;
             item.population_mask.set();
             item.temporal_subplot_mask = 0;
@@ -2368,7 +3656,7 @@ static void init_display_properties(ApplicationData* data) {
                         int dim = data->display_prop->dim;
                         const float* y_values = data->display_prop->prop->data.values;
                         const float* x_values = data->display_prop->x_values;
-                        return ImPlotPoint(x_values[sample_idx], y_values[sample_idx * dim + dim_idx]);
+                        return ImPlotPoint(x_values[sample_idx], evaluated_value(data->display_prop, sample_idx, y_values[sample_idx * dim + dim_idx]));
                         };
                     display_property_copy_param_from_old(item_raw, old_items, md_array_size(old_items));
                     md_array_push(new_items, item_raw, frame_allocator);
@@ -2383,7 +3671,7 @@ static void init_display_properties(ApplicationData* data) {
                             DisplayProperty* data = ((DisplayProperty::Payload*)payload)->display_prop;
                             const float* y_values = data->prop->data.aggregate->population_mean;
                             const float* x_values = data->x_values;
-                            return ImPlotPoint(x_values[sample_idx], y_values[sample_idx]);
+                            return ImPlotPoint(x_values[sample_idx], evaluated_value(data, sample_idx, y_values[sample_idx]));
                             };
                         item_mean.print_value = [](char* buf, size_t cap, int sample_idx, DisplayProperty::Payload* payload) -> int {
                             const float* y_mean = payload->display_prop->prop->data.aggregate->population_mean;
@@ -2402,14 +3690,14 @@ static void init_display_properties(ApplicationData* data) {
                             const float* y_mean = data->prop->data.aggregate->population_mean;
                             const float* y_var  = data->prop->data.aggregate->population_var;
                             const float* x_values = data->x_values;
-                            return ImPlotPoint(x_values[sample_idx], y_mean[sample_idx] - y_var[sample_idx]);
+                            return ImPlotPoint(x_values[sample_idx], evaluated_value(data, sample_idx, y_mean[sample_idx] - y_var[sample_idx]));
                             };
                         item_var.getter[1] = [](int sample_idx, void* payload) -> ImPlotPoint {
                             DisplayProperty* data = ((DisplayProperty::Payload*)payload)->display_prop;
                             const float* y_mean = data->prop->data.aggregate->population_mean;
                             const float* y_var  = data->prop->data.aggregate->population_var;
                             const float* x_values = data->x_values;
-                            return ImPlotPoint(x_values[sample_idx], y_mean[sample_idx] + y_var[sample_idx]);
+                            return ImPlotPoint(x_values[sample_idx], evaluated_value(data, sample_idx, y_mean[sample_idx] + y_var[sample_idx]));
                             };
                         item_var.print_value = [](char* buf, size_t cap, int sample_idx, DisplayProperty::Payload* payload) -> int {
                             const float* y_var = payload->display_prop->prop->data.aggregate->population_var;
@@ -2427,13 +3715,13 @@ static void init_display_properties(ApplicationData* data) {
                             DisplayProperty* data = ((DisplayProperty::Payload*)payload)->display_prop;
                             const vec2_t* y_ext = data->prop->data.aggregate->population_ext;
                             const float* x_values = data->x_values;
-                            return ImPlotPoint(x_values[sample_idx], y_ext[sample_idx].x);
+                            return ImPlotPoint(x_values[sample_idx], evaluated_value(data, sample_idx, y_ext[sample_idx].x));
                             };
                         item_ext.getter[1] = [](int sample_idx, void* payload) -> ImPlotPoint {
                             DisplayProperty* data = ((DisplayProperty::Payload*)payload)->display_prop;
                             const vec2_t* y_ext = data->prop->data.aggregate->population_ext;
                             const float* x_values = data->x_values;
-                            return ImPlotPoint(x_values[sample_idx], y_ext[sample_idx].y);
+                            return ImPlotPoint(x_values[sample_idx], evaluated_value(data, sample_idx, y_ext[sample_idx].y));
                             };
                         item_ext.print_value = [](char* buf, size_t cap, int sample_idx, DisplayProperty::Payload* payload) -> int {
                             const vec2_t* y_ext = payload->display_prop->prop->data.aggregate->population_ext;
@@ -2483,27 +3771,174 @@ static void init_display_properties(ApplicationData* data) {
 
     for (size_t i = 0; i < md_array_size(old_items); ++i) {
         free_histogram(&old_items[i].hist);
+        if (old_items[i].lod) {
+            timeline_lod_free(old_items[i].lod);
+            md_free(persistent_allocator, old_items[i].lod, sizeof(TimelineLod));
+        }
     }
 
     md_array_resize(data->display_properties, md_array_size(new_items), persistent_allocator);
     MEMCPY(data->display_properties, new_items, md_array_size(new_items) * sizeof(DisplayProperty));
 }
 
+// Waits for the histograms which are being binned and discards them
+static void clear_histogram_requests(ApplicationData* data) {
+    ASSERT(data);
+    task_system::task_wait_for(data->tasks.compute_histograms);
+    data->tasks.compute_histograms = task_system::INVALID_ID;
+    histogram_batch_clear(&data->histograms.batch);
+    md_array_shrink(data->histograms.requests, 0);
+}
+
+// Normalizes the counts of a completed request into the histogram of its display property
+static void publish_histogram(DisplayProperty& dp, const ApplicationData::HistogramRequest& req) {
+    DisplayProperty::Histogram& hist = dp.hist;
+    const int num_bins = req.density ? req.num_bins / req.kde_factor : req.num_bins;
+    hist.dim = req.dim;
+    md_array_resize(hist.bins, (size_t)(req.dim * num_bins), hist.alloc);
+
+    float min_bin = FLT_MAX;
+    float max_bin = -FLT_MAX;
+    const float width = (req.x_max - req.x_min) / req.num_bins;
+    for (int i = 0; i < req.dim; ++i) {
+        const float scl = req.totals[i] > 0 ? 1.0f / (width * req.totals[i]) : 0.0f;
+        for (int j = 0; j < num_bins; ++j) {
+            const float val = req.density ? req.density[num_bins * i + j] : req.counts[num_bins * i + j] * scl;
+            hist.bins[num_bins * i + j] = val;
+            min_bin = MIN(min_bin, val);
+            max_bin = MAX(max_bin, val);
+        }
+    }
+
+    hist.kde = req.density != nullptr;
+    hist.kde_bandwidth = req.kde_bandwidth;
+    hist.num_bins = num_bins;
+    hist.x_min = req.x_min;
+    hist.x_max = req.x_max;
+    hist.y_min = min_bin;
+    hist.y_max = max_bin;
+    dp.prop_fingerprint = req.fingerprint;
+}
+
 static void update_display_properties(ApplicationData* data) {
     ASSERT(data);
 
+    // Temporal histograms are binned on the pool, while a batch is running stale histograms are left for the next one
+    const bool binning = task_system::task_is_running(data->tasks.compute_histograms);
+    if (!binning && md_array_size(data->histograms.requests) > 0) {
+        for (size_t i = 0; i < md_array_size(data->histograms.requests); ++i) {
+            const ApplicationData::HistogramRequest& req = data->histograms.requests[i];
+            publish_histogram(data->display_properties[req.dp_idx], req);
+        }
+        histogram_batch_clear(&data->histograms.batch);
+        md_array_shrink(data->histograms.requests, 0);
+    }
+
+    // Frames of the filter which have been evaluated by the full evaluation, built on demand
+    md_bitfield_t filter_mask = {};
+    bool filter_mask_valid = false;
+
     for (size_t i = 0; i < md_array_size(data->display_properties); ++i) {
         DisplayProperty& dp = data->display_properties[i];
         if (dp.type == DisplayProperty::Type_Distribution) {
-            if (dp.prop_fingerprint != dp.prop->data.fingerprint || dp.num_bins != dp.hist.num_bins) {
-                dp.prop_fingerprint = dp.prop->data.fingerprint;
-        
-                const md_script_property_t* p = dp.prop;
-                if (p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) {
+            const bool derived = dp.full_prop && data->mold.script.full_eval;
+            const md_script_property_t* p = derived ? dp.full_prop : dp.prop;
+            const uint64_t fingerprint = derived ? p->data.fingerprint ^ data->timeline.filter.fingerprint : p->data.fingerprint;
+            const bool temporal = (p->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) != 0;
+            const bool kde_changed = temporal && (dp.kde != dp.hist.kde || (dp.kde && dp.kde_bandwidth != dp.hist.kde_bandwidth));
+            if (dp.prop_fingerprint != fingerprint || dp.num_bins != dp.hist.num_bins || kde_changed) {
+                if (temporal) {
+                    if (binning) continue;
+
+                    const md_script_eval_t* eval = derived ? data->mold.script.full_eval : dp.eval;
+                    const md_bitfield_t* mask = md_script_eval_completed_frames(eval);
+                    const uint32_t num_frames = (uint32_t)md_script_eval_num_frames_total(eval);
+                    if (derived) {
+                        if (!filter_mask_valid) {
+                            const int64_t beg = CLAMP((int64_t)data->timeline.filter.beg_frame, 0, (int64_t)num_frames);
+                            const int64_t end = CLAMP((int64_t)data->timeline.filter.end_frame + 1, beg, (int64_t)num_frames);
+                            md_bitfield_init(&filter_mask, frame_allocator);
+                            md_bitfield_set_range(&filter_mask, beg, end);
+                            md_bitfield_and_inplace(&filter_mask, md_script_eval_completed_frames(data->mold.script.full_eval));
+                            filter_mask_valid = true;
+                        }
+                        mask = &filter_mask;
+                    }
+
                     DisplayProperty::Histogram& hist = dp.hist;
-                    compute_histogram_masked(&hist, dp.num_bins, p->data.min_range[0], p->data.max_range[0], p->data.values, p->data.dim[0], md_script_eval_completed_frames(dp.eval), dp.aggregate_histogram);
+                    ApplicationData::HistogramRequest req = {};
+                    req.dp_idx = i;
+                    req.fingerprint = fingerprint;
+                    // The estimate is computed on a finer grid than it is shown on
+                    req.kde_factor = dp.kde ? MAX(1, HISTOGRAM_KDE_GRID_BINS / dp.num_bins) : 1;
+                    req.kde_bandwidth = dp.kde ? dp.kde_bandwidth : 0.0f;
+                    req.num_bins = dp.num_bins * req.kde_factor;
+                    req.dim = dp.aggregate_histogram ? 1 : p->data.dim[0];
+                    req.x_min = p->data.min_range[0];
+                    req.x_max = p->data.max_range[0];
+
+                    // Everything the binned counts depend on besides the frames
+                    const uint64_t key_data[4] = {(uint64_t)req.num_bins, (uint64_t)req.dim, (uint64_t)(uintptr_t)p->data.values, derived ? data->timeline.filter.fingerprint : 0};
+                    uint64_t key = script_hash(key_data, sizeof(key_data));
+                    key = script_hash(&req.x_min, sizeof(req.x_min), key);
+                    key = script_hash(&req.x_max, sizeof(req.x_max), key);
+                    if (!hist.counts) {
+                        md_bitfield_init(&hist.binned, hist.alloc);
+                    }
+                    // Frames which are no longer completed (the evaluation has been reset) cannot be removed from the counts
+                    md_bitfield_t dropped = {};
+                    md_bitfield_init(&dropped, frame_allocator);
+                    md_bitfield_andnot(&dropped, &hist.binned, mask);
+                    if (!hist.counts || hist.binned_key != key || md_bitfield_popcount(&dropped) > 0) {
+                        md_array_resize(hist.counts, (size_t)(req.num_bins * req.dim), hist.alloc);
+                        md_array_resize(hist.totals, (size_t)req.dim, hist.alloc);
+                        MEMSET(hist.counts, 0, md_array_bytes(hist.counts));
+                        MEMSET(hist.totals, 0, md_array_bytes(hist.totals));
+                        md_bitfield_clear(&hist.binned);
+                        hist.binned_key = key;
+                    }
+                    req.counts = hist.counts;
+                    req.totals = hist.totals;
+                    req.density = nullptr;
+
+                    // Only the frames which have completed since the last update are binned, they are added to the counts by the batch
+                    md_bitfield_t new_frames = {};
+                    md_bitfield_init(&new_frames, frame_allocator);
+                    md_bitfield_andnot(&new_frames, mask, &hist.binned);
+                    const bool has_new_frames = md_bitfield_popcount(&new_frames) > 0;
+                    if (has_new_frames) {
+                        md_bitfield_or_inplace(&hist.binned, &new_frames);
+                        const uint32_t frame_beg = MIN((uint32_t)new_frames.beg_bit, num_frames);
+                        const uint32_t frame_end = MIN((uint32_t)new_frames.end_bit, num_frames);
+                        histogram_batch_add(&data->histograms.batch, p->data.values, p->data.dim[0], req.num_bins, req.x_min, req.x_max, dp.aggregate_histogram,
+                                            &new_frames, frame_beg, frame_end, req.counts, req.totals);
+                    }
+
+                    // The estimate is kept for as long as the counts and the bandwidth it was computed from
+                    bool estimate = false;
+                    if (dp.kde) {
+                        const uint64_t num_binned = md_bitfield_popcount(&hist.binned);
+                        uint64_t density_key = script_hash(&num_binned, sizeof(num_binned), hist.binned_key);
+                        density_key = script_hash(&req.kde_bandwidth, sizeof(req.kde_bandwidth), density_key);
+                        md_array_resize(hist.density, (size_t)(dp.num_bins * req.dim), hist.alloc);
+                        md_array_resize(hist.bandwidth_used, (size_t)req.dim, hist.alloc);
+                        req.density = hist.density;
+                        if (has_new_frames || hist.density_key != density_key) {
+                            histogram_batch_add_kde(&data->histograms.batch, req.counts, req.totals, req.dim, req.num_bins, req.x_min, req.x_max,
+                                                    req.kde_bandwidth, req.kde_factor, req.density, hist.bandwidth_used);
+                            hist.density_key = density_key;
+                            estimate = true;
+                        }
+                    }
+
+                    if (!has_new_frames && !estimate) {
+                        publish_histogram(dp, req);
+                        continue;
+                    }
+                    md_array_push(data->histograms.requests, req, persistent_allocator);
                 }
                 else if (p->flags & MD_SCRIPT_PROPERTY_FLAG_DISTRIBUTION) {
+                    dp.prop_fingerprint = fingerprint;
                     DisplayProperty::Histogram& hist = dp.hist;
                     md_array_resize(hist.bins, (size_t)dp.num_bins, hist.alloc);
                     hist.num_bins = dp.num_bins;
@@ -2517,6 +3952,10 @@ static void update_display_properties(ApplicationData* data) {
             }
         }
     }
+
+    if (!binning && md_array_size(data->histograms.requests) > 0) {
+        data->tasks.compute_histograms = histogram_batch_enqueue(&data->histograms.batch);
+    }
 }
 
 static void update_density_volume(ApplicationData* data) {
@@ -2524,6 +3963,7 @@ static void update_density_volume(ApplicationData* data) {
         data->density_volume.dvr.tf.dirty = false;
 
         uint32_t pixel_data[128];
+        int first_visible = -1;
 
         for (size_t i = 0; i < ARRAY_SIZE(pixel_data); ++i) {
             float t = (float)i / (float)(ARRAY_SIZE(pixel_data) - 1);
@@ -2533,8 +3973,12 @@ static void update_density_volume(ApplicationData* data) {
             col.w = ImMin(160 * t*t, 0.341176f);
             col.w = ImClamp(col.w * data->density_volume.dvr.tf.alpha_scale, 0.0f, 1.0f);
             pixel_data[i] = ImGui::ColorConvertFloat4ToU32(col);
+            if (first_visible == -1 && (pixel_data[i] >> IM_COL32_A_SHIFT) & 0xFF) first_visible = (int)i;
         }
 
+        // With linear filtering, the alpha becomes non zero past the center of the texel before the first visible one
+        data->density_volume.dvr.tf.transparent_below = first_visible == -1 ? FLT_MAX : MAX(first_visible - 0.5f, 0.0f) / ARRAY_SIZE(pixel_data);
+
         gl::init_texture_2D(&data->density_volume.dvr.tf.id, (int)ARRAY_SIZE(pixel_data), 1, GL_RGBA8);
         gl::set_texture_2D_data(data->density_volume.dvr.tf.id, pixel_data, GL_RGBA8);
     }
@@ -2586,51 +4030,32 @@ static void update_density_volume(ApplicationData* data) {
     if (data->density_volume.dirty_rep) {
         if (prop) {
             data->density_volume.dirty_rep = false;
-            size_t num_reps = 0;
-            bool result = false;
-            md_script_vis_t vis = {};
+            const md_script_vis_t* vis = nullptr;
 
             //if (md_semaphore_aquire(&data->mold.script.ir_semaphore)) {
             //    defer { md_semaphore_release(&data->mold.script.ir_semaphore); };
                 if (md_script_ir_valid(data->mold.script.eval_ir)) {
-                    md_script_vis_init(&vis, frame_allocator);
                     md_script_vis_ctx_t ctx = {
                         .ir = data->mold.script.eval_ir,
                         .mol = &data->mold.mol,
                         .traj = data->mold.traj,
                     };
-                    result = md_script_vis_eval_payload(&vis, prop->vis_payload, 0, &ctx, MD_SCRIPT_VISUALIZE_SDF);
+                    const VisCacheKey key = vis_cache_key(data, data->mold.script.eval_ir, prop->vis_payload, 0, MD_SCRIPT_VISUALIZE_SDF);
+                    vis = vis_cache_get(&data->mold.script.vis_cache, key, &ctx);
                 }
             //}
 
-            if (result) {
-                if (vis.sdf.extent) {
-                    const float s = vis.sdf.extent;
+            if (vis) {
+                if (vis->sdf.extent) {
+                    const float s = vis->sdf.extent;
                     vec3_t min_aabb = { -s, -s, -s };
                     vec3_t max_aabb = { s, s, s };
                     data->density_volume.model_mat = volume::compute_model_to_world_matrix(min_aabb, max_aabb);
                     data->density_volume.voxel_spacing = vec3_t{2*s / prop->data.dim[0], 2*s / prop->data.dim[1], 2*s / prop->data.dim[2]};
                 }
-                num_reps = md_array_size(vis.sdf.structures);
-            }
-
-            // We need to limit this for performance reasons
-            num_reps = MIN(num_reps, 100);
-
-            const size_t old_size = md_array_size(data->density_volume.gl_reps);
-            if (data->density_volume.gl_reps) {
-                // Only free superflous entries
-                for (size_t i = num_reps; i < old_size; ++i) {
-                    md_gl_representation_free(&data->density_volume.gl_reps[i]);
-                }
             }
-            md_array_resize(data->density_volume.gl_reps, num_reps, persistent_allocator);
-            md_array_resize(data->density_volume.rep_model_mats, num_reps, persistent_allocator);
 
-            for (size_t i = old_size; i < num_reps; ++i) {
-                // Only init new entries
-                md_gl_representation_init(&data->density_volume.gl_reps[i], &data->mold.gl_mol);
-            }
+            update_density_volume_ensemble(data, vis);
 
             const auto& mol = data->mold.mol;
             auto& rep = data->density_volume.rep;
@@ -2670,130 +4095,290 @@ static void update_density_volume(ApplicationData* data) {
                 break;
             }
 
-            for (size_t i = 0; i < num_reps; ++i) {
-                filter_colors(colors, num_colors, &vis.sdf.structures[i]);
-                md_gl_representation_set_color(&data->density_volume.gl_reps[i], 0, (uint32_t)num_colors, colors, 0);
-                data->density_volume.rep_model_mats[i] = vis.sdf.matrices[i];
+            auto& ens = data->density_volume.ensemble;
+            if (ens.num_atoms > 0) {
+                uint32_t* ens_colors = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * ens.num_atoms);
+                for (uint32_t i = 0; i < ens.num_atoms; ++i) {
+                    ens_colors[i] = colors[ens.atom_src[i]];
+                    if (!data->density_volume.show_reference_ensemble && i >= ens.num_atoms_first) {
+                        ens_colors[i] &= 0x00FFFFFFU;
+                    }
+                }
+                md_gl_representation_set_color(&ens.gl_rep, 0, ens.num_atoms, ens_colors, 0);
             }
         }
     }
 
+    // The evaluation accumulates the frames of a volume property into a single grid, so this is the only copy, whatever the number of frames
     if (data->density_volume.dirty_vol) {
         if (prop) {
             data->density_volume.dirty_vol = false;
-            if (!data->density_volume.volume_texture.id) {
-                gl::init_texture_3D(&data->density_volume.volume_texture.id, prop->data.dim[0], prop->data.dim[1], prop->data.dim[2], GL_R32F);
-                data->density_volume.volume_texture.dim_x = prop->data.dim[0];
-                data->density_volume.volume_texture.dim_y = prop->data.dim[1];
-                data->density_volume.volume_texture.dim_z = prop->data.dim[2];
+            volume::init_macro_cell_grid(&data->density_volume.macro_cells, prop->data.values, prop->data.dim[0], prop->data.dim[1], prop->data.dim[2]);
+            auto& bricks = data->density_volume.bricks;
+            const GLenum brick_format = bricks.half_precision ? GL_R16F : GL_R8;
+            if (bricks.enabled && volume::init_bricked_volume(&bricks.volume, prop->data.values, prop->data.dim[0], prop->data.dim[1], prop->data.dim[2], brick_format)) {
+                gl::free_texture(&data->density_volume.volume_texture.id);
                 data->density_volume.volume_texture.max_value = prop->data.max_value;
+            } else {
+                volume::free_bricked_volume(&bricks.volume);
+                if (!data->density_volume.volume_texture.id) {
+                    gl::init_texture_3D(&data->density_volume.volume_texture.id, prop->data.dim[0], prop->data.dim[1], prop->data.dim[2], GL_R32F);
+                    data->density_volume.volume_texture.dim_x = prop->data.dim[0];
+                    data->density_volume.volume_texture.dim_y = prop->data.dim[1];
+                    data->density_volume.volume_texture.dim_z = prop->data.dim[2];
+                    data->density_volume.volume_texture.max_value = prop->data.max_value;
+                }
+                gl::set_texture_3D_data(data->density_volume.volume_texture.id, prop->data.values, GL_R32F);
+            }
+        }
+    }
+}
+
+static void free_density_volume_ensemble(ApplicationData* data) {
+    auto& ens = data->density_volume.ensemble;
+    if (ens.num_atoms > 0) {
+        md_gl_representation_free(&ens.gl_rep);
+        md_gl_molecule_free(&ens.gl_mol);
+    }
+    md_array_free(ens.atom_src, persistent_allocator);
+    ens = {};
+}
+
+// Concatenates the atoms of the structures, transformed by the matrices which superimpose them on the reference, into the ensemble
+// The GL molecule is only recreated when the number of atoms or bonds changes, otherwise the positions and bonds are updated in place
+static void update_density_volume_ensemble(ApplicationData* data, const md_script_vis_t* vis) {
+    auto& ens = data->density_volume.ensemble;
+    const md_molecule_t& mol = data->mold.mol;
+    const size_t num_structures = vis ? md_array_size(vis->sdf.structures) : 0;
+
+    md_array_shrink(ens.atom_src, 0);
+    md_array(float) x = 0;
+    md_array(float) y = 0;
+    md_array(float) z = 0;
+    md_array(float) r = 0;
+    md_array(md_bond_pair_t) bonds = 0;
+    uint32_t num_atoms_first = 0;
+
+    if (num_structures > 0) {
+        // Bonds of each atom, to find the bonds within a structure without visiting all bonds for every structure
+        uint32_t* bond_offset = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * (mol.atom.count + 1));
+        uint32_t* bond_other  = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * mol.bond.count * 2);
+        uint32_t* local_idx   = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * mol.atom.count);
+        MEMSET(bond_offset, 0, sizeof(uint32_t) * (mol.atom.count + 1));
+        for (size_t i = 0; i < mol.bond.count; ++i) {
+            bond_offset[mol.bond.pairs[i].idx[0] + 1] += 1;
+            bond_offset[mol.bond.pairs[i].idx[1] + 1] += 1;
+        }
+        for (size_t i = 0; i < mol.atom.count; ++i) {
+            bond_offset[i + 1] += bond_offset[i];
+        }
+        uint32_t* fill = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * mol.atom.count);
+        MEMCPY(fill, bond_offset, sizeof(uint32_t) * mol.atom.count);
+        for (size_t i = 0; i < mol.bond.count; ++i) {
+            const uint32_t a = (uint32_t)mol.bond.pairs[i].idx[0];
+            const uint32_t b = (uint32_t)mol.bond.pairs[i].idx[1];
+            bond_other[fill[a]++] = b;
+            bond_other[fill[b]++] = a;
+        }
+
+        for (size_t s = 0; s < num_structures; ++s) {
+            const md_bitfield_t* bf = &vis->sdf.structures[s];
+            const mat4_t& M = vis->sdf.matrices[s];
+            const uint32_t base = (uint32_t)md_array_size(ens.atom_src);
+
+            md_bitfield_iter_t it = md_bitfield_iter_create(bf);
+            while (md_bitfield_iter_next(&it)) {
+                const uint32_t a = (uint32_t)md_bitfield_iter_idx(&it);
+                if (a >= mol.atom.count) break;
+                local_idx[a] = (uint32_t)md_array_size(ens.atom_src) - base;
+                const vec3_t p = mat4_mul_vec3(M, vec3_t{mol.atom.x[a], mol.atom.y[a], mol.atom.z[a]}, 1.0f);
+                md_array_push(ens.atom_src, a, persistent_allocator);
+                md_array_push(x, p.x, frame_allocator);
+                md_array_push(y, p.y, frame_allocator);
+                md_array_push(z, p.z, frame_allocator);
+                md_array_push(r, mol.atom.radius[a], frame_allocator);
             }
-            gl::set_texture_3D_data(data->density_volume.volume_texture.id, prop->data.values, GL_R32F);
+
+            it = md_bitfield_iter_create(bf);
+            while (md_bitfield_iter_next(&it)) {
+                const uint32_t a = (uint32_t)md_bitfield_iter_idx(&it);
+                if (a >= mol.atom.count) break;
+                for (uint32_t j = bond_offset[a]; j < bond_offset[a + 1]; ++j) {
+                    const uint32_t b = bond_other[j];
+                    if (b > a && md_bitfield_test_bit(bf, b)) {
+                        md_bond_pair_t pair = {};
+                        pair.idx[0] = base + local_idx[a];
+                        pair.idx[1] = base + local_idx[b];
+                        md_array_push(bonds, pair, frame_allocator);
+                    }
+                }
+            }
+
+            if (s == 0) num_atoms_first = (uint32_t)md_array_size(ens.atom_src);
+        }
+    }
+
+    const uint32_t num_atoms = (uint32_t)md_array_size(ens.atom_src);
+    const uint32_t num_bonds = (uint32_t)md_array_size(bonds);
+    if (num_atoms != ens.num_atoms || num_bonds != ens.num_bonds) {
+        if (ens.num_atoms > 0) {
+            md_gl_representation_free(&ens.gl_rep);
+            md_gl_molecule_free(&ens.gl_mol);
         }
+        if (num_atoms > 0) {
+            md_molecule_t ens_mol = {};
+            ens_mol.atom.count = num_atoms;
+            ens_mol.atom.x = x;
+            ens_mol.atom.y = y;
+            ens_mol.atom.z = z;
+            ens_mol.atom.radius = r;
+            ens_mol.bond.count = num_bonds;
+            ens_mol.bond.pairs = bonds;
+            md_gl_molecule_init(&ens.gl_mol, &ens_mol);
+            md_gl_representation_init(&ens.gl_rep, &ens.gl_mol);
+        }
+    } else if (num_atoms > 0) {
+        md_gl_molecule_set_atom_position(&ens.gl_mol, 0, num_atoms, x, y, z, 0);
+        md_gl_molecule_set_atom_radius(&ens.gl_mol, 0, num_atoms, r, 0);
+        md_gl_molecule_set_bonds(&ens.gl_mol, 0, num_bonds, bonds, sizeof(md_bond_pair_t));
     }
+    ens.num_atoms = num_atoms;
+    ens.num_bonds = num_bonds;
+    ens.num_atoms_first = num_atoms_first;
 }
 
 static void clear_density_volume(ApplicationData* data) {
-    md_array_shrink(data->density_volume.gl_reps, 0);
-    md_array_shrink(data->density_volume.rep_model_mats, 0);
+    free_density_volume_ensemble(data);
     data->density_volume.model_mat = {0};
 }
 
-static void interpolate_atomic_properties(ApplicationData* data) {
-    ASSERT(data);
-    const auto& mol = data->mold.mol;
-    const auto& traj = data->mold.traj;
+static void clear_keyframes(ApplicationData* data) {
+    for (int i = 0; i < 4; ++i) {
+        data->mold.keyframes.frame[i] = -1;
+    }
+}
 
-    if (!mol.atom.count || !md_trajectory_num_frames(traj)) return;
+static void free_keyframes(ApplicationData* data) {
+    if (data->mold.keyframes.mem) {
+        md_free(persistent_allocator, data->mold.keyframes.mem, data->mold.keyframes.stride * 3 * 4 * sizeof(float));
+    }
+    data->mold.keyframes.mem = nullptr;
+    data->mold.keyframes.stride = 0;
+    clear_keyframes(data);
+}
 
-    const int64_t last_frame = MAX(0LL, (int64_t)md_trajectory_num_frames(traj) - 1);
-    // This is not actually time, but the fractional frame representation
-    const double time = CLAMP(data->animation.frame, 0.0, double(last_frame));
+// Returns the slot of the keyframe ring which holds frame_idx, fetching it into a slot which is not part of the support (frames) if it is not resident
+static int fetch_keyframe(ApplicationData* data, int64_t frame_idx, const int64_t frames[4]) {
+    auto& ring = data->mold.keyframes;
+    for (int i = 0; i < 4; ++i) {
+        if (ring.frame[i] == frame_idx) return i;
+    }
 
-    // Scaling factor for cubic spline
-    const float s = 1.0f - CLAMP(data->animation.tension, 0.0f, 1.0f);
-    const float t = (float)fractf(time);
-    const int64_t frame = (int64_t)time;
-    const int64_t nearest_frame = CLAMP((int64_t)(time + 0.5), 0LL, last_frame);
+    int slot = -1;
+    for (int i = 0; i < 4; ++i) {
+        const int64_t f = ring.frame[i];
+        if (f != frames[0] && f != frames[1] && f != frames[2] && f != frames[3]) {
+            slot = i;
+            break;
+        }
+    }
+    ASSERT(slot != -1);
 
-    const int64_t frames[4] = {
-        MAX(0LL, frame - 1),
-        MAX(0LL, frame),
-        MIN(frame + 1, last_frame),
-        MIN(frame + 2, last_frame)
-    };
+    float* dst = ring.mem + ring.stride * 3 * slot;
+    md_trajectory_load_frame(data->mold.traj, frame_idx, &ring.header[slot], dst + ring.stride * 0, dst + ring.stride * 1, dst + ring.stride * 2);
+    ring.frame[slot] = frame_idx;
+    return slot;
+}
 
-    int64_t stride = ALIGN_TO(mol.atom.count, 8);    // The interploation uses SIMD vectorization without bounds, so we make sure there is no overlap between the data segments
-    int64_t bytes = stride * sizeof(float) * 3 * 4;
-    void* mem = md_alloc(frame_allocator, bytes);
-    defer { md_free(frame_allocator, mem, bytes); };
-
-    md_vec3_soa_t src[4] = {
-        {(float*)mem + stride * 0, (float*)mem + stride *  1, (float*)mem + stride *  2},
-        {(float*)mem + stride * 3, (float*)mem + stride *  4, (float*)mem + stride *  5},
-        {(float*)mem + stride * 6, (float*)mem + stride *  7, (float*)mem + stride *  8},
-        {(float*)mem + stride * 9, (float*)mem + stride * 10, (float*)mem + stride * 11},
-    };
+// Interpolation is split into fixed chunks of atoms and backbone segments which are processed on the pool
+// Atom chunks are a multiple of the SIMD width, so the unbounded vector loops of neighbouring chunks never overlap
+#define INTERPOLATION_ATOM_CHUNK (64 * 1024)
+#define INTERPOLATION_BACKBONE_CHUNK (16 * 1024)
+#define DIV_UP_CHUNK(x, chunk) (((x) + (chunk) - 1) / (chunk))
+
+struct InterpolationJob {
+    InterpolationMode mode;
+    float t;
+    float s;
+    vec3_t pbc_ext;
+
+    md_vec3_soa_t dst;
+    md_vec3_soa_t src[4];
+    const float* radius;
+    size_t num_atoms;
+    uint32_t num_atom_chunks;
+    vec3_t* aabb_min;   // [num_atom_chunks]
+    vec3_t* aabb_max;   // [num_atom_chunks]
+
+    md_backbone_angles_t* dst_angles;
+    const md_backbone_angles_t* src_angles[4];
+    md_secondary_structure_t* dst_ss;
+    const md_secondary_structure_t* src_ss[4];
+    // Compact sources, which are decoded per chunk into src_angles and src_ss
+    const backbone_angles_q16_t* src_angles_q16[4];
+    const uint8_t* src_ss_packed[4];
+    md_secondary_structure_t* prev_ss;  // [num_backbone] Output of the previous frame, compared per chunk
+    uint8_t* ss_changed;                // [num_backbone_chunks]
+    size_t num_backbone;
+    uint32_t num_backbone_chunks;
+};
 
-    md_vec3_soa_t dst = {
-        data->mold.mol.atom.x, data->mold.mol.atom.y, data->mold.mol.atom.z,
-    };
+static inline md_vec3_soa_t vec3_soa_offset(md_vec3_soa_t soa, size_t offset) {
+    return {soa.x + offset, soa.y + offset, soa.z + offset};
+}
 
-    const InterpolationMode mode = (frames[1] != frames[2]) ? data->animation.interpolation : InterpolationMode::Nearest;
-    switch (mode) {
+static void interpolate_atom_range(const InterpolationJob* job, size_t beg, size_t end) {
+    const size_t count = end - beg;
+    const md_vec3_soa_t dst = vec3_soa_offset(job->dst, beg);
+    switch (job->mode) {
         case InterpolationMode::Nearest:
-        {
-            md_trajectory_frame_header_t header = {0};
-            md_trajectory_load_frame(data->mold.traj, nearest_frame, &header, mol.atom.x, mol.atom.y, mol.atom.z);
-            data->mold.mol.unit_cell = header.unit_cell;
+            MEMCPY(dst.x, job->src[0].x + beg, count * sizeof(float));
+            MEMCPY(dst.y, job->src[0].y + beg, count * sizeof(float));
+            MEMCPY(dst.z, job->src[0].z + beg, count * sizeof(float));
             break;
-        }
         case InterpolationMode::Linear:
         {
-            md_trajectory_frame_header_t header[2] = {0};
-            md_trajectory_load_frame(data->mold.traj, frames[1], &header[0], src[0].x, src[0].y, src[0].z);
-            md_trajectory_load_frame(data->mold.traj, frames[2], &header[1], src[1].x, src[1].y, src[1].z);
-            data->mold.mol.unit_cell.basis = lerp(header[0].unit_cell.basis, header[1].unit_cell.basis, t);
-            const vec3_t pbc_ext = data->mold.mol.unit_cell.basis * vec3_set1(1);
-
-            md_util_linear_interpolation(dst, src, mol.atom.count, pbc_ext, t);
-        }
+            const md_vec3_soa_t src[2] = {vec3_soa_offset(job->src[1], beg), vec3_soa_offset(job->src[2], beg)};
+            md_util_linear_interpolation(dst, src, count, job->pbc_ext, job->t);
             break;
+        }
         case InterpolationMode::CubicSpline:
         {
-            md_trajectory_frame_header_t header[4] = {0};
-            md_trajectory_load_frame(data->mold.traj, frames[0], &header[0], src[0].x, src[0].y, src[0].z);
-            md_trajectory_load_frame(data->mold.traj, frames[1], &header[1], src[1].x, src[1].y, src[1].z);
-            md_trajectory_load_frame(data->mold.traj, frames[2], &header[2], src[2].x, src[2].y, src[2].z);
-            md_trajectory_load_frame(data->mold.traj, frames[3], &header[3], src[3].x, src[3].y, src[3].z);
-            data->mold.mol.unit_cell.basis = cubic_spline(header[0].unit_cell.basis, header[1].unit_cell.basis, header[2].unit_cell.basis, header[3].unit_cell.basis, t, s);
-            const vec3_t pbc_ext = data->mold.mol.unit_cell.basis * vec3_set1(1);
-
-            md_util_cubic_spline_interpolation(dst, src, mol.atom.count, pbc_ext, t, s);
-        }
+            const md_vec3_soa_t src[4] = {vec3_soa_offset(job->src[0], beg), vec3_soa_offset(job->src[1], beg), vec3_soa_offset(job->src[2], beg), vec3_soa_offset(job->src[3], beg)};
+            md_util_cubic_spline_interpolation(dst, src, count, job->pbc_ext, job->t, job->s);
             break;
+        }
         default:
             ASSERT(false);
     }
+}
 
-    md_util_aabb_compute(&data->mold.mol_aabb_min, &data->mold.mol_aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.radius, 0, mol.atom.count);
+static void interpolate_backbone_range(const InterpolationJob* job, size_t beg, size_t end) {
+    const float t = job->t;
+    const float s = job->s;
 
-    if (mol.backbone.angle) {
-        const md_backbone_angles_t* src_angles[4] = {
-            data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frames[0],
-            data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frames[1],
-            data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frames[2],
-            data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frames[3]
-        };
+    // The decode targets are owned by the job, each chunk only touches its own range
+    ASSERT(beg % 4 == 0);
+    for (int i = 0; i < 4; ++i) {
+        if (job->dst_angles && job->src_angles_q16[i]) {
+            backbone_angles_decode((md_backbone_angles_t*)job->src_angles[i] + beg, job->src_angles_q16[i] + beg, end - beg);
+        }
+        if (job->dst_ss && job->src_ss_packed[i]) {
+            secondary_structure_unpack((md_secondary_structure_t*)job->src_ss[i] + beg, job->src_ss_packed[i] + beg / 4, end - beg);
+        }
+    }
 
-        switch (mode) {
+    if (job->dst_angles) {
+        const md_backbone_angles_t* const* src_angles = job->src_angles;
+        md_backbone_angles_t* angle = job->dst_angles;
+        switch (job->mode) {
         case InterpolationMode::Nearest: {
             const md_backbone_angles_t* src_angle = t < 0.5f ? src_angles[1] : src_angles[2];
-            memcpy(mol.backbone.angle, src_angle, mol.backbone.count * sizeof(md_backbone_angles_t));
+            memcpy(angle + beg, src_angle + beg, (end - beg) * sizeof(md_backbone_angles_t));
             break;
         }
         case InterpolationMode::Linear: {
-            for (size_t i = 0; i < mol.backbone.count; ++i) {
+            for (size_t i = beg; i < end; ++i) {
                 float phi[2] = {src_angles[1][i].phi, src_angles[2][i].phi};
                 float psi[2] = {src_angles[1][i].psi, src_angles[2][i].psi};
 
@@ -2802,12 +4387,12 @@ static void interpolate_atomic_properties(ApplicationData* data) {
 
                 float final_phi = lerp(phi[0], phi[1], t);
                 float final_psi = lerp(psi[0], psi[1], t);
-                mol.backbone.angle[i] = {deperiodizef(final_phi, 0, (float)TWO_PI), deperiodizef(final_psi, 0, (float)TWO_PI)};
+                angle[i] = {deperiodizef(final_phi, 0, (float)TWO_PI), deperiodizef(final_psi, 0, (float)TWO_PI)};
             }
             break;
         }
         case InterpolationMode::CubicSpline: {
-            for (size_t i = 0; i < mol.backbone.count; ++i) {
+            for (size_t i = beg; i < end; ++i) {
                 float phi[4] = {src_angles[0][i].phi, src_angles[1][i].phi, src_angles[2][i].phi, src_angles[3][i].phi};
                 float psi[4] = {src_angles[0][i].psi, src_angles[1][i].psi, src_angles[2][i].psi, src_angles[3][i].psi};
 
@@ -2821,7 +4406,7 @@ static void interpolate_atomic_properties(ApplicationData* data) {
 
                 float final_phi = cubic_spline(phi[0], phi[1], phi[2], phi[3], t, s);
                 float final_psi = cubic_spline(psi[0], psi[1], psi[2], psi[3], t, s);
-                mol.backbone.angle[i] = {deperiodizef(final_phi, 0, (float)TWO_PI), deperiodizef(final_psi, 0, (float)TWO_PI)};
+                angle[i] = {deperiodizef(final_phi, 0, (float)TWO_PI), deperiodizef(final_psi, 0, (float)TWO_PI)};
             }
             break;
         }
@@ -2830,33 +4415,29 @@ static void interpolate_atomic_properties(ApplicationData* data) {
         }
     }
 
-    if (mol.backbone.secondary_structure) {
-        const md_secondary_structure_t* src_ss[4] = {
-            (md_secondary_structure_t*)data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frames[0],
-            (md_secondary_structure_t*)data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frames[1],
-            (md_secondary_structure_t*)data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frames[2],
-            (md_secondary_structure_t*)data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frames[3]
-        };
-
-        switch (mode) {
+    if (job->dst_ss) {
+        const md_secondary_structure_t* const* src_ss = job->src_ss;
+        md_secondary_structure_t* ss_dst = job->dst_ss;
+        MEMCPY(job->prev_ss + beg, ss_dst + beg, (end - beg) * sizeof(md_secondary_structure_t));
+        switch (job->mode) {
         case InterpolationMode::Nearest: {
             const md_secondary_structure_t* ss = t < 0.5f ? src_ss[1] : src_ss[2];
-            memcpy(mol.backbone.secondary_structure, ss, mol.backbone.count * sizeof(md_secondary_structure_t));
+            memcpy(ss_dst + beg, ss + beg, (end - beg) * sizeof(md_secondary_structure_t));
             break;
         }
         case InterpolationMode::Linear: {
-            for (size_t i = 0; i < mol.backbone.count; ++i) {
+            for (size_t i = beg; i < end; ++i) {
                 const vec4_t ss_f[2] = {
-                    convert_color((uint32_t)src_ss[0][i]),
                     convert_color((uint32_t)src_ss[1][i]),
+                    convert_color((uint32_t)src_ss[2][i]),
                 };
                 const vec4_t ss_res = vec4_lerp(ss_f[0], ss_f[1], t);
-                mol.backbone.secondary_structure[i] = (md_secondary_structure_t)convert_color(ss_res);
+                ss_dst[i] = (md_secondary_structure_t)convert_color(ss_res);
             }
             break;
         }
         case InterpolationMode::CubicSpline: {
-            for (size_t i = 0; i < mol.backbone.count; ++i) {
+            for (size_t i = beg; i < end; ++i) {
                 const vec4_t ss_f[4] = {
                     convert_color((uint32_t)src_ss[0][i]),
                     convert_color((uint32_t)src_ss[1][i]),
@@ -2864,17 +4445,185 @@ static void interpolate_atomic_properties(ApplicationData* data) {
                     convert_color((uint32_t)src_ss[3][i]),
                 };
                 const vec4_t ss_res = cubic_spline(ss_f[0], ss_f[1], ss_f[2], ss_f[3], t, s);
-                mol.backbone.secondary_structure[i] = (md_secondary_structure_t)convert_color(ss_res);
+                ss_dst[i] = (md_secondary_structure_t)convert_color(ss_res);
             }
             break;
         }
         default:
             ASSERT(false);
         }
+        // Most segments keep their secondary structure from one frame to the next, only the ones which change are uploaded
+        job->ss_changed[beg / INTERPOLATION_BACKBONE_CHUNK] = memcmp(job->prev_ss + beg, ss_dst + beg, (end - beg) * sizeof(md_secondary_structure_t)) != 0;
+    }
+}
+
+// Chunk indices [0, num_atom_chunks) are atoms, the remaining ones are backbone segments
+static void interpolate_chunks(uint32_t chunk_beg, uint32_t chunk_end, void* user_data) {
+    InterpolationJob* job = (InterpolationJob*)user_data;
+    for (uint32_t chunk = chunk_beg; chunk < chunk_end; ++chunk) {
+        if (chunk < job->num_atom_chunks) {
+            const size_t beg = (size_t)chunk * INTERPOLATION_ATOM_CHUNK;
+            const size_t end = MIN(beg + INTERPOLATION_ATOM_CHUNK, job->num_atoms);
+            interpolate_atom_range(job, beg, end);
+            md_util_aabb_compute(&job->aabb_min[chunk], &job->aabb_max[chunk], job->dst.x + beg, job->dst.y + beg, job->dst.z + beg, job->radius ? job->radius + beg : NULL, 0, end - beg);
+        } else {
+            const size_t beg = (size_t)(chunk - job->num_atom_chunks) * INTERPOLATION_BACKBONE_CHUNK;
+            const size_t end = MIN(beg + INTERPOLATION_BACKBONE_CHUNK, job->num_backbone);
+            interpolate_backbone_range(job, beg, end);
+        }
+    }
+}
+
+static void execute_interpolation_job(InterpolationJob* job) {
+    const uint32_t num_chunks = job->num_atom_chunks + job->num_backbone_chunks;
+    if (num_chunks > 1) {
+        // Split into chunks on the pool and join before the buffers are updated, the main thread takes part in the work while waiting
+        task_system::ID id = task_system::pool_enqueue(STR("##Interpolate"), 0, num_chunks, interpolate_chunks, job);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+    } else {
+        interpolate_chunks(0, num_chunks, job);
+    }
+}
+
+static void interpolate_atomic_properties(ApplicationData* data) {
+    ASSERT(data);
+    const auto& mol = data->mold.mol;
+    const auto& traj = data->mold.traj;
+
+    if (!mol.atom.count || !md_trajectory_num_frames(traj)) return;
+
+    const int64_t last_frame = MAX(0LL, (int64_t)md_trajectory_num_frames(traj) - 1);
+    // This is not actually time, but the fractional frame representation
+    const double time = CLAMP(data->animation.frame, 0.0, double(last_frame));
+
+    // Scaling factor for cubic spline
+    const float s = 1.0f - CLAMP(data->animation.tension, 0.0f, 1.0f);
+    const float t = (float)fractf(time);
+    const int64_t frame = (int64_t)time;
+    const int64_t nearest_frame = CLAMP((int64_t)(time + 0.5), 0LL, last_frame);
+
+    const int64_t frames[4] = {
+        MAX(0LL, frame - 1),
+        MAX(0LL, frame),
+        MIN(frame + 1, last_frame),
+        MIN(frame + 2, last_frame)
+    };
+
+    int64_t stride = ALIGN_TO(mol.atom.count, 8);    // The interploation uses SIMD vectorization without bounds, so we make sure there is no overlap between the data segments
+    auto& ring = data->mold.keyframes;
+    if (ring.stride != stride) {
+        free_keyframes(data);
+        ring.mem = (float*)md_alloc(persistent_allocator, stride * 3 * 4 * sizeof(float));
+        ring.stride = stride;
+    }
+
+    const InterpolationMode mode = (frames[1] != frames[2]) ? data->animation.interpolation : InterpolationMode::Nearest;
+
+    // The frames which are actually needed for the interpolation mode
+    int64_t support[4] = {frames[1], frames[1], frames[2], frames[2]};
+    switch (mode) {
+        case InterpolationMode::Nearest:     support[0] = support[1] = support[2] = support[3] = nearest_frame; break;
+        case InterpolationMode::Linear:      break;
+        case InterpolationMode::CubicSpline: MEMCPY(support, frames, sizeof(support)); break;
+        default: ASSERT(false);
+    }
+
+    int slots[4];
+    for (int i = 0; i < 4; ++i) {
+        slots[i] = fetch_keyframe(data, support[i], support);
+    }
+
+    md_vec3_soa_t src[4];
+    const md_trajectory_frame_header_t* header[4];
+    for (int i = 0; i < 4; ++i) {
+        float* base = ring.mem + stride * 3 * slots[i];
+        src[i] = {base + stride * 0, base + stride * 1, base + stride * 2};
+        header[i] = &ring.header[slots[i]];
+    }
+
+    md_vec3_soa_t dst = {
+        data->mold.mol.atom.x, data->mold.mol.atom.y, data->mold.mol.atom.z,
+    };
+
+    InterpolationJob job = {};
+    job.mode = mode;
+    job.t = t;
+    job.s = s;
+    job.dst = dst;
+    MEMCPY(job.src, src, sizeof(src));
+    job.radius = mol.atom.radius;
+    job.num_atoms = mol.atom.count;
+
+    switch (mode) {
+        case InterpolationMode::Nearest:
+            data->mold.mol.unit_cell = header[0]->unit_cell;
+            break;
+        case InterpolationMode::Linear:
+            data->mold.mol.unit_cell.basis = lerp(header[1]->unit_cell.basis, header[2]->unit_cell.basis, t);
+            break;
+        case InterpolationMode::CubicSpline:
+            data->mold.mol.unit_cell.basis = cubic_spline(header[0]->unit_cell.basis, header[1]->unit_cell.basis, header[2]->unit_cell.basis, header[3]->unit_cell.basis, t, s);
+            break;
+        default:
+            ASSERT(false);
+    }
+    job.pbc_ext = data->mold.mol.unit_cell.basis * vec3_set1(1);
+
+    if (mol.backbone.count > 0 && (mol.backbone.angle || mol.backbone.secondary_structure)) {
+        job.num_backbone = mol.backbone.count;
+        job.dst_angles = mol.backbone.angle;
+        job.dst_ss = mol.backbone.secondary_structure;
+        const size_t n = mol.backbone.count;
+        for (int i = 0; i < 4; ++i) {
+            if (data->trajectory_data.backbone_angles.q16) {
+                job.src_angles_q16[i] = data->trajectory_data.backbone_angles.q16 + data->trajectory_data.backbone_angles.stride * frames[i];
+                job.src_angles[i] = (md_backbone_angles_t*)md_alloc(frame_allocator, sizeof(md_backbone_angles_t) * n);
+            } else {
+                job.src_angles[i] = data->trajectory_data.backbone_angles.data ? data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frames[i] : nullptr;
+            }
+            if (data->trajectory_data.secondary_structure.packed) {
+                job.src_ss_packed[i] = data->trajectory_data.secondary_structure.packed + data->trajectory_data.secondary_structure.packed_stride * frames[i];
+                job.src_ss[i] = (md_secondary_structure_t*)md_alloc(frame_allocator, sizeof(md_secondary_structure_t) * n);
+            } else {
+                job.src_ss[i] = data->trajectory_data.secondary_structure.data ? data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frames[i] : nullptr;
+            }
+        }
+        if (!job.src_angles[0]) job.dst_angles = nullptr;
+        if (!job.src_ss[0]) job.dst_ss = nullptr;
+    }
+
+    job.num_atom_chunks     = (uint32_t)DIV_UP_CHUNK(job.num_atoms, INTERPOLATION_ATOM_CHUNK);
+    job.num_backbone_chunks = (uint32_t)DIV_UP_CHUNK(job.num_backbone, INTERPOLATION_BACKBONE_CHUNK);
+    job.aabb_min = (vec3_t*)md_alloc(frame_allocator, sizeof(vec3_t) * job.num_atom_chunks);
+    job.aabb_max = (vec3_t*)md_alloc(frame_allocator, sizeof(vec3_t) * job.num_atom_chunks);
+    if (job.dst_ss) {
+        job.prev_ss    = (md_secondary_structure_t*)md_alloc(frame_allocator, sizeof(md_secondary_structure_t) * job.num_backbone);
+        job.ss_changed = (uint8_t*)md_alloc(frame_allocator, job.num_backbone_chunks);
+    }
+
+    execute_interpolation_job(&job);
+
+    vec3_t aabb_min = vec3_set1( FLT_MAX);
+    vec3_t aabb_max = vec3_set1(-FLT_MAX);
+    for (uint32_t i = 0; i < job.num_atom_chunks; ++i) {
+        aabb_min = vec3_min(aabb_min, job.aabb_min[i]);
+        aabb_max = vec3_max(aabb_max, job.aabb_max[i]);
     }
+    data->mold.mol_aabb_min = aabb_min;
+    data->mold.mol_aabb_max = aabb_max;
 
     data->mold.dirty_buffers |= MolBit_DirtyPosition;
-    data->mold.dirty_buffers |= MolBit_DirtySecondaryStructure;
+    for (uint32_t i = 0; job.dst_ss && i < job.num_backbone_chunks; ++i) {
+        if (!job.ss_changed[i]) continue;
+        const size_t beg = (size_t)i * INTERPOLATION_BACKBONE_CHUNK;
+        const size_t end = MIN(beg + INTERPOLATION_BACKBONE_CHUNK, job.num_backbone);
+        data->mold.ss_dirty_beg = MIN(data->mold.ss_dirty_beg, beg);
+        data->mold.ss_dirty_end = MAX(data->mold.ss_dirty_end, end);
+        data->mold.dirty_buffers |= MolBit_DirtySecondaryStructure;
+    }
+    data->tracking.aligned = false;
+    data->fluctuation.average_applied = false;
 }
 
 // #misc
@@ -2883,10 +4632,14 @@ static void update_view_param(ApplicationData* data) {
     param.matrix.previous = param.matrix.current;
     param.jitter.previous = param.jitter.current;
 
+    // The resolution and jitter are those of the G-Buffer which the scene is rendered into, which is reduced with dynamic resolution
+    // The aspect ratio is always that of the full G-Buffer, which the reduced one is upscaled into
+    const GBuffer* gbuf = scene_gbuffer(data);
+
     param.clip_planes.near = data->view.camera.near_plane;
     param.clip_planes.far = data->view.camera.far_plane;
     param.fov_y = data->view.camera.fov_y;
-    param.resolution = {(float)data->gbuffer.width, (float)data->gbuffer.height};
+    param.resolution = {(float)gbuf->width, (float)gbuf->height};
 
     param.matrix.current.view = camera_world_to_view_matrix(data->view.camera);
     param.matrix.inverse.view = camera_view_to_world_matrix(data->view.camera);
@@ -2905,22 +4658,22 @@ static void update_view_param(ApplicationData* data) {
     }
     param.matrix.current.proj_jittered = param.matrix.current.proj;
 
-    if (data->visuals.temporal_reprojection.enabled && data->visuals.temporal_reprojection.jitter) {
+    if (temporal_reprojection_enabled(*data) && data->visuals.temporal_reprojection.jitter) {
         static uint32_t i = 0;
         i = (i+1) % ARRAY_SIZE(data->view.jitter.sequence);
         param.jitter.next    = data->view.jitter.sequence[(i + 1) % ARRAY_SIZE(data->view.jitter.sequence)] - 0.5f;
         param.jitter.current = data->view.jitter.sequence[i] - 0.5f;
         if (data->view.mode == CameraMode::Perspective) {
             const vec2_t j = param.jitter.current;
-            const int w = data->gbuffer.width;
-            const int h = data->gbuffer.height;
+            const int w = gbuf->width;
+            const int h = gbuf->height;
             param.matrix.current.proj_jittered = camera_perspective_projection_matrix(data->view.camera, w, h, j.x, j.y);
             param.matrix.inverse.proj_jittered = camera_inverse_perspective_projection_matrix(data->view.camera, w, h, j.x, j.y);
         } else {
             const float aspect_ratio = (float)data->gbuffer.width / (float)data->gbuffer.height;
             const float h = data->view.camera.focus_distance * tanf(data->view.camera.fov_y * 0.5f);
             const float w = aspect_ratio * h;
-            const vec2_t scl = {w / data->gbuffer.width * 2.0f, h / data->gbuffer.height * 2.0f};
+            const vec2_t scl = {w / gbuf->width * 2.0f, h / gbuf->height * 2.0f};
             const vec2_t j = param.jitter.current * scl;
             param.matrix.current.proj_jittered = camera_orthographic_projection_matrix(-w + j.x, w + j.x, -h + j.y, h + j.y, data->view.camera.near_plane, data->view.camera.far_plane);
             param.matrix.inverse.proj_jittered = camera_inverse_orthographic_projection_matrix(-w + j.x, w + j.x, -h + j.y, h + j.y, data->view.camera.near_plane, data->view.camera.far_plane);
@@ -2939,14 +4692,14 @@ static void reset_view(ApplicationData* data, bool move_camera, bool smooth_tran
     vec3_t aabb_min, aabb_max;
     
     if (0 < popcount && popcount < mol.atom.count) {
-        int32_t* indices = (int32_t*)md_linear_allocator_push(linear_allocator, popcount * sizeof(int32_t));
+        int32_t* indices = (int32_t*)md_alloc(frame_allocator, popcount * sizeof(int32_t));
         size_t len = md_bitfield_extract_indices(indices, popcount, &data->representation.atom_visibility_mask);
         if (len > popcount || len > mol.atom.count) {
             MD_LOG_DEBUG("Error: Invalid number of indices");
             len = MIN(popcount, mol.atom.count);
         }
 		md_util_aabb_compute(&aabb_min, &aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, nullptr, indices, len);
-        md_linear_allocator_pop(linear_allocator, popcount * sizeof(int32_t));
+        md_free(frame_allocator, indices, popcount * sizeof(int32_t));
     } else {
         md_util_aabb_compute(&aabb_min, &aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, nullptr, nullptr, mol.atom.count);
     }
@@ -3092,16 +4845,437 @@ static bool filter_expression(ApplicationData* data, str_t expr, md_bitfield_t*
     return success;
 }
 
-// ### DRAW WINDOWS ###
-static void draw_main_menu(ApplicationData* data) {
+static void cell_list_task(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    auto& cl = data->mold.cell_list;
+    const float* x = cl.coords + cl.count * 0;
+    const float* y = cl.coords + cl.count * 1;
+    const float* z = cl.coords + cl.count * 2;
+    cell_list_build(&cl.staging, x, y, z, cl.count, cl.pbc_ext, CELL_LIST_DEFAULT_CELL_SIZE, persistent_allocator);
+}
+
+static inline size_t cell_list_bytes(const CellList* list) {
+    return (list->num_cells + 1) * sizeof(uint32_t) + list->num_atoms * (sizeof(uint32_t) + 3 * sizeof(float));
+}
+
+// Returns the cell list of the current coordinates, or NULL while it is being built, in which case the caller is expected to ask again later
+// The grid is only rebuilt when the fingerprint of the coordinates is not cached, so repeated queries of a frame (e.g. with different radii) share it
+// The list stays valid until a list of other coordinates is requested
+static const CellList* request_cell_list(ApplicationData* data) {
     ASSERT(data);
-    bool new_clicked = false;
-    char path_buf[2048] = "";
+    auto& cl = data->mold.cell_list;
+    const md_molecule_t& mol = data->mold.mol;
+    if (mol.atom.count == 0) return NULL;
+
+    if (cl.task) {
+        if (task_system::task_is_running(cl.task)) return NULL;
+        cl.task = 0;
+        if (!cl.staging.key || !lru_cache_put(&cl.lists, cl.staging.key, cl.staging, cell_list_bytes(&cl.staging))) {
+            cell_list_free(&cl.staging);
+        }
+        cl.staging = {};
+    }
 
-    if (ImGui::BeginMainMenuBar()) {
-        if (ImGui::BeginMenu("File")) {
-            if (ImGui::MenuItem("Load Data", "CTRL+L")) {
-                data->load_dataset.show_window = true;
+    const vec3_t pbc_ext = mol.unit_cell.basis * vec3_set1(1);
+    const uint64_t key = cell_list_fingerprint(mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.count, pbc_ext);
+    const CellList* list = lru_cache_acquire(&cl.lists, key);
+    if (cl.pinned) lru_cache_release(&cl.lists, cl.pinned);
+    cl.pinned = list ? key : 0;
+    if (list) return list;
+
+    const size_t count = mol.atom.count;
+    const size_t bytes = count * 3 * sizeof(float);
+    if (bytes > cl.coord_bytes) {
+        if (cl.coords) md_free(persistent_allocator, cl.coords, cl.coord_bytes);
+        cl.coords = (float*)md_alloc(persistent_allocator, bytes);
+        cl.coord_bytes = bytes;
+    }
+    MEMCPY(cl.coords + count * 0, mol.atom.x, count * sizeof(float));
+    MEMCPY(cl.coords + count * 1, mol.atom.y, count * sizeof(float));
+    MEMCPY(cl.coords + count * 2, mol.atom.z, count * sizeof(float));
+    cl.count = count;
+    cl.pbc_ext = pbc_ext;
+    cl.task = task_system::pool_enqueue(STR("Build Cell List"), cell_list_task, data, 0, task_system::Priority_Interactive);
+    return NULL;
+}
+
+static void free_cell_list(ApplicationData* data) {
+    ASSERT(data);
+    auto& cl = data->mold.cell_list;
+    if (cl.task) {
+        task_system::task_wait_for(cl.task);
+        cl.task = 0;
+    }
+    if (cl.pinned) lru_cache_release(&cl.lists, cl.pinned);
+    cl.pinned = 0;
+    lru_cache_free(&cl.lists);
+    cell_list_free(&cl.staging);
+    if (cl.coords) md_free(persistent_allocator, cl.coords, cl.coord_bytes);
+    cl.coords = nullptr;
+    cl.coord_bytes = 0;
+    cl.count = 0;
+}
+
+// Approximations of the geometry of the representations, the picking buffer remains exact for the shapes which are not covered
+#define PICKING_LICORICE_RADIUS 0.25f      // Radius of the licorice cylinders and caps per unit of scale
+#define PICKING_BALL_SCALE      0.25f      // Ball and stick spheres relative to the atom radius
+#define PICKING_STICK_RADIUS    0.1f       // Ball and stick cylinders per unit of bond scale
+
+// Key of the primitives of the enabled representations, the masks are covered by the epoch which is bumped when the visibility is recomputed
+static uint64_t picking_bvh_key(const ApplicationData* data) {
+    const auto& mol = data->mold.mol;
+    const auto& cp = data->cpu_picking;
+    uint64_t key = script_hash(&cp.epoch, sizeof(cp.epoch));
+    key = script_hash(&mol.atom.count, sizeof(mol.atom.count), key);
+    key = script_hash(&mol.bond.count, sizeof(mol.bond.count), key);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const Representation& rep = data->representation.reps[i];
+        key = script_hash(&rep.enabled, sizeof(rep.enabled), key);
+        key = script_hash(&rep.type, sizeof(rep.type), key);
+        key = script_hash(&rep.scale, sizeof(rep.scale), key);
+    }
+    return key ? key : 1;
+}
+
+// Spheres for the atoms and capsules for the bonds of every enabled representation, an atom or bond which is in several takes the largest radius
+// Atoms of ribbons and cartoons get a zero radius, they cannot be hit by rays but are found by region queries like every visible atom
+static void collect_picking_primitives(const ApplicationData* data, md_array(PickingPrimitive)* prims) {
+    const auto& mol = data->mold.mol;
+    const size_t num_atoms = mol.atom.count;
+    const size_t num_bonds = mol.bond.count;
+    md_array_shrink(*prims, 0);
+
+    float* atom_r = (float*)md_alloc(frame_allocator, sizeof(float) * num_atoms);
+    float* bond_r = num_bonds ? (float*)md_alloc(frame_allocator, sizeof(float) * num_bonds) : NULL;
+    defer {
+        md_free(frame_allocator, atom_r, sizeof(float) * num_atoms);
+        if (bond_r) md_free(frame_allocator, bond_r, sizeof(float) * num_bonds);
+    };
+    for (size_t i = 0; i < num_atoms; ++i) atom_r[i] = -1.0f;
+    for (size_t i = 0; i < num_bonds; ++i) bond_r[i] = -1.0f;
+
+    for (size_t r = 0; r < md_array_size(data->representation.reps); ++r) {
+        const Representation& rep = data->representation.reps[r];
+        if (!rep.enabled) continue;
+
+        md_bitfield_iter_t it = md_bitfield_iter_create(&rep.atom_mask);
+        while (md_bitfield_iter_next(&it)) {
+            const size_t i = md_bitfield_iter_idx(&it);
+            if (i >= num_atoms) break;
+            float radius = 0.0f;
+            switch (rep.type) {
+            case RepresentationType::SpaceFill:
+            case RepresentationType::Sdf:
+                radius = mol.atom.radius[i] * rep.scale.x;
+                break;
+            case RepresentationType::Licorice:
+                radius = PICKING_LICORICE_RADIUS * rep.scale.x;
+                break;
+            case RepresentationType::BallAndStick:
+                radius = mol.atom.radius[i] * rep.scale.x * PICKING_BALL_SCALE;
+                break;
+            default:
+                break;
+            }
+            atom_r[i] = MAX(atom_r[i], radius);
+        }
+
+        float radius = 0.0f;
+        if (rep.type == RepresentationType::Licorice) {
+            radius = PICKING_LICORICE_RADIUS * rep.scale.x;
+        } else if (rep.type == RepresentationType::BallAndStick) {
+            radius = PICKING_STICK_RADIUS * rep.scale.y;
+        } else {
+            continue;
+        }
+        for (size_t i = 0; i < num_bonds; ++i) {
+            const md_bond_pair_t pair = mol.bond.pairs[i];
+            if (md_bitfield_test_bit(&rep.atom_mask, pair.idx[0]) && md_bitfield_test_bit(&rep.atom_mask, pair.idx[1])) {
+                bond_r[i] = MAX(bond_r[i], radius);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < num_atoms; ++i) {
+        if (atom_r[i] < 0) continue;
+        const PickingPrimitive p = {(uint32_t)i, {(uint32_t)i, (uint32_t)i}, atom_r[i]};
+        md_array_push(*prims, p, persistent_allocator);
+    }
+    for (size_t i = 0; i < num_bonds; ++i) {
+        if (bond_r[i] <= 0) continue;
+        const md_bond_pair_t pair = mol.bond.pairs[i];
+        const PickingPrimitive p = {(uint32_t)i | PICKING_BVH_BOND_BIT, {(uint32_t)pair.idx[0], (uint32_t)pair.idx[1]}, bond_r[i]};
+        md_array_push(*prims, p, persistent_allocator);
+    }
+}
+
+static void picking_bvh_task(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    auto& cp = data->cpu_picking;
+    const float* x = cp.coords + cp.count * 0;
+    const float* y = cp.coords + cp.count * 1;
+    const float* z = cp.coords + cp.count * 2;
+    picking_bvh_build(&cp.staging, cp.prims, md_array_size(cp.prims), x, y, z, cp.count, persistent_allocator);
+    cp.staging.key = cp.key;
+}
+
+// Has to run before update_md_buffers, as the refit relies on the dirty state of the positions
+static void update_picking_bvh(ApplicationData* data) {
+    ASSERT(data);
+    auto& cp = data->cpu_picking;
+    const md_molecule_t& mol = data->mold.mol;
+
+    if (data->mold.dirty_buffers & (MolBit_DirtyRadius | MolBit_DirtyBonds)) {
+        cp.epoch += 1;
+    }
+    if (data->mold.dirty_buffers & MolBit_DirtyPosition) {
+        cp.refit = true;
+    }
+
+    if (cp.task) {
+        if (task_system::task_is_running(cp.task)) return;
+        cp.task = 0;
+        picking_bvh_free(&cp.bvh);
+        cp.bvh = cp.staging;
+        cp.staging = {};
+        // The coordinates may have moved on since the snapshot
+        cp.refit = true;
+    }
+
+    if ((!cp.enabled && !headless_mode) || mol.atom.count == 0) return;
+
+    const uint64_t key = picking_bvh_key(data);
+    if (cp.bvh.key == key) return;
+
+    collect_picking_primitives(data, &cp.prims);
+
+    const size_t count = mol.atom.count;
+    const size_t bytes = count * 3 * sizeof(float);
+    if (bytes > cp.coord_bytes) {
+        if (cp.coords) md_free(persistent_allocator, cp.coords, cp.coord_bytes);
+        cp.coords = (float*)md_alloc(persistent_allocator, bytes);
+        cp.coord_bytes = bytes;
+    }
+    MEMCPY(cp.coords + count * 0, mol.atom.x, count * sizeof(float));
+    MEMCPY(cp.coords + count * 1, mol.atom.y, count * sizeof(float));
+    MEMCPY(cp.coords + count * 2, mol.atom.z, count * sizeof(float));
+    cp.count = count;
+    cp.key = key;
+    cp.task = task_system::pool_enqueue(STR("Build Picking BVH"), picking_bvh_task, data, 0, task_system::Priority_Interactive);
+}
+
+// Returns the hierarchy refit to the current coordinates, or NULL if there is none for the current molecule yet
+static const PickingBvh* current_picking_bvh(ApplicationData* data) {
+    auto& cp = data->cpu_picking;
+    const md_molecule_t& mol = data->mold.mol;
+    if (cp.bvh.key == 0 || cp.bvh.num_atoms != mol.atom.count) return NULL;
+    if (cp.refit) {
+        picking_bvh_refit(&cp.bvh, mol.atom.x, mol.atom.y, mol.atom.z);
+        cp.refit = false;
+    }
+    return &cp.bvh;
+}
+
+// Casts a ray through the pixel coordinate (origin at the lower left corner of the G-buffer) and fills out as the picking buffer would
+// Returns false if there is no hierarchy to cast the ray against
+static bool cpu_pick(ApplicationData* data, vec2_t coord, PickingData* out) {
+    ASSERT(data);
+    ASSERT(out);
+    const PickingBvh* bvh = current_picking_bvh(data);
+    if (!bvh) return false;
+
+    const md_molecule_t& mol = data->mold.mol;
+    const vec4_t viewport = {0, 0, (float)data->gbuffer.width, (float)data->gbuffer.height};
+    const mat4_t inv_VP = data->view.param.matrix.inverse.view * data->view.param.matrix.inverse.proj;
+    const vec3_t p0 = mat4_unproject({coord.x, coord.y, 0.0f}, inv_VP, viewport);
+    const vec3_t p1 = mat4_unproject({coord.x, coord.y, 1.0f}, inv_VP, viewport);
+    const float len = vec3_length(p1 - p0);
+
+    *out = {};
+    out->screen_coord = coord;
+    if (len <= 0) return true;
+
+    PickingHit hit = {};
+    if (picking_bvh_cast_ray(bvh, mol.atom.x, mol.atom.y, mol.atom.z, p0, vec3_mul_f(p1 - p0, 1.0f / len), len, &hit)) {
+        const mat4_t VP = data->view.param.matrix.current.proj * data->view.param.matrix.current.view;
+        const vec4_t clip = mat4_mul_vec4(VP, vec4_from_vec3(hit.pos, 1.0f));
+        out->idx = hit.idx;
+        out->world_coord = hit.pos;
+        out->depth = CLAMP(clip.z / clip.w * 0.5f + 0.5f, 0.0f, 1.0f);
+    }
+    return true;
+}
+
+struct PickingRegion {
+    md_bitfield_t* mask;
+};
+
+static bool picking_region_fn(uint32_t idx, vec3_t, void* user_data) {
+    PickingRegion* region = (PickingRegion*)user_data;
+    if (!(idx & PICKING_BVH_BOND_BIT)) {
+        md_bitfield_set_bit(region->mask, idx);
+    }
+    return true;
+}
+
+// Sets the atoms whose centers project inside the rectangle given in normalized device coordinates, returns false if there is no hierarchy
+static bool cpu_pick_region(ApplicationData* data, md_bitfield_t* mask, const mat4_t& mvp, vec2_t ndc_min, vec2_t ndc_max) {
+    ASSERT(data);
+    ASSERT(mask);
+    const PickingBvh* bvh = current_picking_bvh(data);
+    if (!bvh) return false;
+
+    // Planes from the rows of the matrix, a point is inside if x_clip >= ndc_min.x * w_clip etc. and in front of the camera
+    auto plane = [&mvp](int row, float sign, float w_scale) {
+        return vec4_set(
+            sign * mvp.elem[0][row] - w_scale * mvp.elem[0][3],
+            sign * mvp.elem[1][row] - w_scale * mvp.elem[1][3],
+            sign * mvp.elem[2][row] - w_scale * mvp.elem[2][3],
+            sign * mvp.elem[3][row] - w_scale * mvp.elem[3][3]);
+    };
+    const vec4_t planes[5] = {
+        plane(0,  1.0f,  ndc_min.x),
+        plane(0, -1.0f, -ndc_max.x),
+        plane(1,  1.0f,  ndc_min.y),
+        plane(1, -1.0f, -ndc_max.y),
+        plane(3,  0.0f, -1.0f),
+    };
+
+    const md_molecule_t& mol = data->mold.mol;
+    PickingRegion region = {mask};
+    picking_bvh_query_planes(bvh, mol.atom.x, mol.atom.y, mol.atom.z, planes, ARRAY_SIZE(planes), picking_region_fn, &region);
+    return true;
+}
+
+static void free_picking_bvh(ApplicationData* data) {
+    ASSERT(data);
+    auto& cp = data->cpu_picking;
+    if (cp.task) {
+        task_system::task_wait_for(cp.task);
+        cp.task = 0;
+    }
+    picking_bvh_free(&cp.bvh);
+    picking_bvh_free(&cp.staging);
+    md_array_free(cp.prims, persistent_allocator);
+    cp.prims = nullptr;
+    if (cp.coords) md_free(persistent_allocator, cp.coords, cp.coord_bytes);
+    cp.coords = nullptr;
+    cp.coord_bytes = 0;
+    cp.count = 0;
+}
+
+static void async_filter_task(void* user_data) {
+    AsyncFilter* f = (AsyncFilter*)user_data;
+    ApplicationData* data = f->data;
+    f->ok = false;
+    f->is_dynamic = false;
+    f->error[0] = '\0';
+    md_bitfield_clear(&f->mask);
+
+    // The compilation of the script replaces the IR only while it holds all counts of the semaphore
+    if (md_semaphore_aquire(&data->mold.script.ir_semaphore)) {
+        defer { md_semaphore_release(&data->mold.script.ir_semaphore); };
+        f->ok = md_filter(&f->mask, str_from_cstr(f->expr), &f->mol, data->mold.script.ir, &f->is_dynamic, f->error, (int)sizeof(f->error));
+    }
+    f->done.store(true, std::memory_order_release);
+}
+
+static void launch_async_filter(ApplicationData* data, AsyncFilter* f) {
+    ASSERT(!f->task);
+    ASSERT(f->pending);
+    f->pending = false;
+    MEMCPY(f->expr, f->pending_expr, sizeof(f->expr));
+    f->data = data;
+
+    const md_molecule_t& mol = data->mold.mol;
+    const size_t num_atoms = mol.atom.count;
+    const size_t num_ss = mol.backbone.secondary_structure ? mol.backbone.count : 0;
+    const size_t bytes = num_atoms * 3 * sizeof(float) + num_ss * sizeof(md_secondary_structure_t);
+    if (bytes > f->coord_bytes) {
+        if (f->coords) md_free(persistent_allocator, f->coords, f->coord_bytes);
+        f->coords = (float*)md_alloc(persistent_allocator, bytes);
+        f->coord_bytes = bytes;
+    }
+
+    f->mol = mol;
+    f->mol.atom.x = f->coords + num_atoms * 0;
+    f->mol.atom.y = f->coords + num_atoms * 1;
+    f->mol.atom.z = f->coords + num_atoms * 2;
+    MEMCPY(f->mol.atom.x, mol.atom.x, num_atoms * sizeof(float));
+    MEMCPY(f->mol.atom.y, mol.atom.y, num_atoms * sizeof(float));
+    MEMCPY(f->mol.atom.z, mol.atom.z, num_atoms * sizeof(float));
+    if (num_ss) {
+        f->mol.backbone.secondary_structure = (md_secondary_structure_t*)(f->coords + num_atoms * 3);
+        MEMCPY(f->mol.backbone.secondary_structure, mol.backbone.secondary_structure, num_ss * sizeof(md_secondary_structure_t));
+    }
+
+    if (!f->mask.alloc) md_bitfield_init(&f->mask, persistent_allocator);
+    f->done = false;
+    f->task = task_system::pool_enqueue(STR("Filter Expression"), async_filter_task, f, 0, task_system::Priority_Interactive);
+    // Launched now, the result is usually polled within the same frame
+    task_system::execute_task(f->task);
+}
+
+static void request_async_filter(ApplicationData* data, AsyncFilter* f, str_t expr) {
+    ASSERT(data);
+    ASSERT(f);
+    str_copy_to_char_buf(f->pending_expr, sizeof(f->pending_expr), expr);
+    f->pending = true;
+    if (!f->task && data->mold.mol.atom.count > 0) {
+        launch_async_filter(data, f);
+    }
+}
+
+// Returns true when the evaluation of the latest request has completed, where the result is found in mask, ok, is_dynamic and error
+static bool poll_async_filter(ApplicationData* data, AsyncFilter* f, bool wait) {
+    ASSERT(data);
+    ASSERT(f);
+    while (true) {
+        if (f->task) {
+            if (!f->done) {
+                if (!wait) return false;
+                while (!f->done) task_system::task_wait_for(f->task);
+            }
+            f->task = 0;
+            if (!f->pending) return true;
+        }
+        // The result of the completed evaluation has been superseded
+        if (!f->pending || data->mold.mol.atom.count == 0) return false;
+        launch_async_filter(data, f);
+        if (!wait) return false;
+    }
+}
+
+static void wait_async_filter(AsyncFilter* f) {
+    ASSERT(f);
+    if (f->task) {
+        while (!f->done) task_system::task_wait_for(f->task);
+        f->task = 0;
+    }
+    f->pending = false;
+}
+
+static void free_async_filter(AsyncFilter* f) {
+    ASSERT(f);
+    wait_async_filter(f);
+    if (f->coords) md_free(persistent_allocator, f->coords, f->coord_bytes);
+    md_bitfield_free(&f->mask);
+    f->coords = nullptr;
+    f->coord_bytes = 0;
+    f->mask = {};
+    f->data = nullptr;
+}
+
+// ### DRAW WINDOWS ###
+static void draw_main_menu(ApplicationData* data) {
+    ASSERT(data);
+    bool new_clicked = false;
+    char path_buf[2048] = "";
+
+    if (ImGui::BeginMainMenuBar()) {
+        if (ImGui::BeginMenu("File")) {
+            if (ImGui::MenuItem("Load Data", "CTRL+L")) {
+                data->load_dataset.show_window = true;
             }
             if (ImGui::MenuItem("Open Workspace", "CTRL+O")) {
                 if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Open, str_ptr(WORKSPACE_FILE_EXTENSION))) {
@@ -3207,6 +5381,10 @@ static void draw_main_menu(ApplicationData* data) {
                 ImGui::SliderFloat("Intensity", &data->visuals.ssao.intensity, 0.5f, 12.f);
                 ImGui::SliderFloat("Radius", &data->visuals.ssao.radius, 1.f, 30.f);
                 ImGui::SliderFloat("Bias", &data->visuals.ssao.bias, 0.0f, 1.0f);
+                ImGui::Checkbox("Half Resolution", &data->visuals.ssao.half_res);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Compute the ambient occlusion at half resolution and accumulate it over frames");
+                }
             }
             ImGui::PopID();
             ImGui::EndGroup();
@@ -3273,19 +5451,21 @@ ImGui::EndGroup();
             ImGui::Checkbox("Density Volumes", &data->density_volume.show_window);
             ImGui::Checkbox("Ramachandran", &data->ramachandran.show_window);
             ImGui::Checkbox("Shape Space", &data->shape_space.show_window);
+            ImGui::Checkbox("Fluctuations", &data->fluctuation.show_window);
+            ImGui::Checkbox("Contacts", &data->contacts.show_window);
             ImGui::Checkbox("Dataset", &data->dataset.show_window);
 
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Selection")) {
             ImGui::Combo("Granularity", (int*)(&data->selection.granularity), "Atom\0Residue\0Chain\0\0");
-            int64_t num_selected_atoms = md_bitfield_popcount(&data->selection.current_selection_mask);
+            int64_t num_selected_atoms = versioned_bitfield_popcount(&data->selection.current_selection_mask);
             if (ImGui::MenuItem("Invert")) {
-                md_bitfield_not_inplace(&data->selection.current_selection_mask, 0, data->mold.mol.atom.count);
+                md_bitfield_not_inplace(versioned_bitfield_modify(&data->selection.current_selection_mask), 0, data->mold.mol.atom.count);
                 data->mold.dirty_buffers |= MolBit_DirtyFlags;
             }
             if (ImGui::IsItemHovered()) {
-                md_bitfield_not(&data->selection.current_highlight_mask, &data->selection.current_selection_mask, 0, data->mold.mol.atom.count);
+                md_bitfield_not(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.current_selection_mask.bits, 0, data->mold.mol.atom.count);
                 data->mold.dirty_buffers |= MolBit_DirtyFlags;
             }
             if (ImGui::MenuItem("Query")) data->selection.query.show_window = true;
@@ -3293,7 +5473,7 @@ ImGui::EndGroup();
             if (ImGui::MenuItem("Grow"))  data->selection.grow.show_window = true;
             if (num_selected_atoms == 0) ImGui::PopDisabled();
             if (ImGui::MenuItem("Clear")) {
-                md_bitfield_clear(&data->selection.current_selection_mask);
+                md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_selection_mask));
                 data->mold.dirty_buffers |= MolBit_DirtyFlags;
             }
             ImGui::Spacing();
@@ -3326,18 +5506,18 @@ ImGui::EndGroup();
                     ImGui::InputQuery("##label", sel.name, sizeof(sel.name), is_valid, error);
                     ImGui::SameLine();
                     if (ImGui::Button("Load")) {
-                        md_bitfield_copy(&data->selection.current_selection_mask, &sel.atom_mask);
+                        md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_selection_mask), &sel.atom_mask);
                         update_all_representations(data);
                     }
                     if (ImGui::IsItemHovered()) {
                         ImGui::SetTooltip("Load the stored selection into the active selection");
-                        md_bitfield_copy(&data->selection.current_highlight_mask, &sel.atom_mask);
+                        md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &sel.atom_mask);
                         data->mold.dirty_buffers |= MolBit_DirtyFlags;
                     }
                     ImGui::SameLine();
                     if (ImGui::Button("Store")) {
                         ImGui::SetTooltip("Store the active selection into the stored selection");
-                        md_bitfield_copy(&sel.atom_mask, &data->selection.current_selection_mask);
+                        md_bitfield_copy(&sel.atom_mask, &data->selection.current_selection_mask.bits);
                         data->mold.script.compile_ir = true;
                         update_all_representations(data);
                     }
@@ -3352,7 +5532,7 @@ ImGui::EndGroup();
                 if (ImGui::Button("Create New")) {
                     char name_buf[64];
                     snprintf(name_buf, sizeof(name_buf), "sel%i", (int)md_array_size(data->selection.stored_selections) + 1);
-                    create_selection(data, str_from_cstr(name_buf), &data->selection.current_selection_mask);
+                    create_selection(data, str_from_cstr(name_buf), &data->selection.current_selection_mask.bits);
                 }
 
                 //ImGui::PopItemFlag();
@@ -3378,6 +5558,99 @@ ImGui::EndGroup();
                 }
                 ImGui::GetCurrentWindow()->Hidden = true;
             }
+            ImGui::Separator();
+            ImGui::Text("High Resolution");
+            ImGui::InputInt("Width", &data->screenshot.tiled.width, 1024, 4096);
+            ImGui::InputInt("Height", &data->screenshot.tiled.height, 1024, 4096);
+            data->screenshot.tiled.width  = CLAMP(data->screenshot.tiled.width,  1, TILED_RENDER_MAX_SIZE);
+            data->screenshot.tiled.height = CLAMP(data->screenshot.tiled.height, 1, TILED_RENDER_MAX_SIZE);
+            ImGui::SliderInt("Samples", &data->screenshot.tiled.samples, 1, 16);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Number of jittered renders which are averaged per pixel");
+            }
+            if (ImGui::MenuItem("Render High Resolution Image")) {
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "png")) {
+                    size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                    if (!extract_ext(NULL, {path_buf, path_len})) {
+                        path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".png");
+                    }
+                    data->screenshot.tiled.path = str_copy({path_buf, path_len}, persistent_allocator);
+                }
+                ImGui::GetCurrentWindow()->Hidden = true;
+            }
+            ImGui::Separator();
+            ImGui::Text("Movie");
+            auto& movie = data->movie;
+            if (movie.active) {
+                ImGui::Text("Exporting frame %lld / %lld", (long long)movie.next, (long long)movie.count);
+                if (ImGui::MenuItem("Cancel Export")) {
+                    movie.cancel = true;
+                }
+            } else {
+                const double max_frame = (double)MAX(0LL, (int64_t)md_trajectory_num_frames(data->mold.traj) - 1);
+                const double min_frame = 0.0;
+                const double min_step = 0.01;
+                const double max_step = 100.0;
+                if (movie.end_frame <= movie.beg_frame) movie.end_frame = max_frame;
+                ImGui::SliderScalar("Begin Frame", ImGuiDataType_Double, &movie.beg_frame, &min_frame, &max_frame, "%.0f");
+                ImGui::SliderScalar("End Frame", ImGuiDataType_Double, &movie.end_frame, &min_frame, &max_frame, "%.0f");
+                ImGui::SliderScalar("Frame Step", ImGuiDataType_Double, &movie.frame_step, &min_step, &max_step, "%.2f", ImGuiSliderFlags_Logarithmic);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Trajectory frames per frame of the movie, fractional steps are interpolated");
+                }
+                const char* outputs[] = {"Image Sequence", "Encoder"};
+                int output = (int)movie.output;
+                if (ImGui::Combo("Output", &output, outputs, (int)ARRAY_SIZE(outputs))) {
+                    movie.output = (MovieOutput)output;
+                }
+                if (movie.output == MovieOutput::Pipe) {
+                    ImGui::InputText("Encoder", movie.encoder, sizeof(movie.encoder));
+                    ImGui::InputText("Arguments", movie.encoder_args, sizeof(movie.encoder_args));
+                    ImGui::SliderFloat("FPS", &movie.fps, 1.0f, 120.0f, "%.0f");
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("Raw RGBA frames are written to the standard input of the encoder");
+                    }
+                }
+                if (ImGui::MenuItem("Export Movie", 0, false, md_trajectory_num_frames(data->mold.traj) > 0)) {
+                    const bool images = movie.output == MovieOutput::ImageSequence;
+                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, images ? "png,jpg,bmp" : "mp4,mkv,mov,avi")) {
+                        size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                        if (!extract_ext(NULL, {path_buf, path_len})) {
+                            path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, images ? ".png" : ".mp4");
+                        }
+                        start_movie_export(data, {path_buf, path_len});
+                    }
+                    ImGui::GetCurrentWindow()->Hidden = true;
+                }
+            }
+            ImGui::Separator();
+            ImGui::Text("Repack Trajectory");
+            if (data->repack.job) {
+                ImGui::Text("Repacking frame %u / %zu", data->repack.job->frames_written.load(std::memory_order_relaxed), data->repack.job->num_frames);
+            } else {
+                ImGui::SliderInt("Block Frames", &data->repack.block_frames, 1, 64);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Frames per block, which are stored relative to the first frame of the block");
+                }
+                ImGui::SliderFloat("Precision", &data->repack.precision, 0.001f, 0.1f, "%.3f Å", ImGuiSliderFlags_Logarithmic);
+                ImGui::Checkbox("Subset", &data->repack.subset);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Only write the atoms which pass the filter, a GRO structure of them is written next to the trajectory");
+                }
+                if (data->repack.subset) {
+                    ImGui::InputText("Filter", data->repack.filter, sizeof(data->repack.filter));
+                }
+                if (ImGui::MenuItem("Repack", 0, false, md_trajectory_num_frames(data->mold.traj) > 0)) {
+                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, CHUNKED_TRAJECTORY_EXT)) {
+                        size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                        if (!extract_ext(NULL, {path_buf, path_len})) {
+                            path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, "." CHUNKED_TRAJECTORY_EXT);
+                        }
+                        launch_trajectory_repack(data, {path_buf, path_len});
+                    }
+                    ImGui::GetCurrentWindow()->Hidden = true;
+                }
+            }
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Settings")) {
@@ -3396,6 +5669,145 @@ ImGui::EndGroup();
                 ImGui::EndCombo();
             }
 
+            ImGui::Checkbox("Compute Backbone for All Frames", &data->trajectory_data.background_fill);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("If disabled, backbone angles and secondary structure are only computed around the playhead and within the timeline filter");
+            }
+            ImGui::Checkbox("Render on Demand", &data->render.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Only render the scene when something has changed and wait for events while idle");
+            }
+            ImGui::Checkbox("Dynamic Resolution", &data->dynamic_resolution.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Render the scene at a reduced resolution while the view is moving or the animation is playing.\nThe full resolution is restored when idle");
+            }
+            ImGui::BeginDisabled(!data->dynamic_resolution.enabled);
+            ImGui::SliderFloat("Min Scale", &data->dynamic_resolution.min_scale, 0.25f, DYNAMIC_RES_MAX_SCALE, "%.2f");
+            ImGui::SliderFloat("Target (ms)", &data->dynamic_resolution.target_ms, 0.0f, 100.0f, "%.1f");
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("The scale adapts between the minimum and full resolution to keep the frame time below the target.\nIf 0, the minimum scale is always used");
+            }
+            ImGui::EndDisabled();
+            ImGui::Checkbox("Quality Governor", &data->quality.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Reduce the postprocessing (SSAO, depth of field, motion blur, temporal AA) in steps to keep the GPU time of a frame below the target.\nThe quality is restored when there is headroom, the GPU timings are recorded while enabled");
+            }
+            ImGui::BeginDisabled(!data->quality.enabled);
+            ImGui::SliderFloat("GPU Target (ms)", &data->quality.target_ms, 4.0f, 100.0f, "%.1f");
+            ImGui::Text("Level: %s (%.1f ms)", QUALITY_LEVELS[data->quality.level], data->quality.gpu_ms);
+            ImGui::EndDisabled();
+            ImGui::Checkbox("Cull Representations", &data->representation.culling.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Skip drawing chunks of residues which are outside of the view");
+            }
+            ImGui::BeginDisabled(!data->representation.culling.enabled);
+            ImGui::Checkbox("Occlusion Culling", &data->representation.culling.occlusion);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Also skip chunks which are hidden behind others, applied while the view and the scene are unchanged");
+            }
+            ImGui::Checkbox("Level of Detail", &data->representation.lod.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Draw chunks of residues which cover less than the given size on screen as one sphere in space-fill and licorice");
+            }
+            ImGui::BeginDisabled(!data->representation.lod.enabled);
+            ImGui::SliderFloat("LOD Size (px)", &data->representation.lod.pixels, 0.5f, 16.0f, "%.1f");
+            ImGui::EndDisabled();
+            ImGui::EndDisabled();
+            ImGui::Checkbox("Periodic Images", &data->representation.periodic_images.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Draw the representations in the neighbouring cells of the lattice, images outside of the view are skipped");
+            }
+            ImGui::BeginDisabled(!data->representation.periodic_images.enabled);
+            ImGui::SliderInt("Image Extent", &data->representation.periodic_images.extent, 1, 4);
+            ImGui::EndDisabled();
+            if (ImGui::Checkbox("Compact Representations", &data->representation.subset.enabled)) {
+                update_all_representations(data);
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Draw representations which show a small part of the atoms from buffers which only hold their atoms");
+            }
+            ImGui::Checkbox("CPU Picking", &data->cpu_picking.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Pick by casting rays against a hierarchy of the atoms and bonds instead of reading back the picking buffer.\nThe result is available in the same frame, ribbons and cartoons are only covered by region selection");
+            }
+            if (ImGui::Checkbox("Screen Space Selection", &data->selection.screen_space.enabled)) {
+                data->selection.screen_space.dirty = true;
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Tint and outline the selection in one pass over the picking buffer instead of drawing the representations again.\nSelected atoms which are hidden behind others are not shown");
+            }
+            ImGui::Checkbox("Region Selection from Picking", &data->selection.region.from_picking);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Select what is visible within a region (Shift + Drag, or Shift + Alt + Drag for a lasso) from the picking buffer.\nThe pixels are read back asynchronously, so the highlight trails the region by a frame or two");
+            }
+            ImGui::Checkbox("Include Occluded", &data->selection.region.include_occluded);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Also select the atoms within a region which are hidden behind others, by projecting the atoms instead of reading the picking buffer");
+            }
+            ImGui::Checkbox("Compact Backbone Storage", &data->trajectory_data.compact);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Store backbone angles as 16-bit integers and secondary structure as 2-bit classes.\nApplied when a trajectory is loaded");
+            }
+
+            ImGui::Checkbox("Cache Parsed Molecules", &data->mold.snapshot_enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Store large molecules after postprocessing next to the file (.molcache) and restore them instead of parsing the file when it is opened again");
+            }
+
+            ImGui::Checkbox("Cache Trajectory Frames Locally", &data->mold.block_cache_enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Keep a copy of the frames which are read in the local frame cache directory, for trajectories on network or object storage.\nApplied when a trajectory is loaded");
+            }
+
+            bool cache_memory_changed = ImGui::Checkbox("Frame Cache Huge Pages", &data->mold.cache_huge_pages);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Back the frame cache with huge pages (hugetlb if the system has reserved them, transparent huge pages otherwise) to cut TLB misses.\nApplied when a trajectory is loaded");
+            }
+            if (numa_num_nodes() > 1) {
+                if (ImGui::Combo("Frame Cache NUMA Policy", (int*)(&data->mold.cache_numa_policy), "First Touch\0Interleave\0Partition\0\0")) {
+                    cache_memory_changed = true;
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Placement of the frame cache on the %u NUMA nodes.\nInterleave spreads it evenly, Partition stores decoded frames on the node of the worker which decoded them.\nApplied when a trajectory is loaded", numa_num_nodes());
+                }
+            }
+            if (cache_memory_changed) {
+                load::traj::set_cache_memory(data->mold.cache_huge_pages, data->mold.cache_numa_policy);
+            }
+
+            ImGui::Checkbox("Cache Evaluation Results", &data->mold.script.cache_enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Store the results of completed evaluations next to the trajectory (.evalcache) and restore them when the same script is evaluated again");
+            }
+
+            ImGui::SliderInt("Worker Threads", &data->worker_pool.requested_threads, 2, MAX(2, (int)md_os_num_processors()));
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Number of threads used for evaluation (including the main thread).\nApplied once the running tasks have completed");
+            }
+            ImGui::SliderFloat("Main Task Budget (ms)", &data->tasks.main_budget_ms, 0.0f, 16.0f, "%.1f");
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Time per frame for completing tasks on the main thread (uploads of results), the rest continue in the next frame.\n0 completes all of them within the frame");
+            }
+            if (ImGui::SliderInt("Task Memory Budget (MB)", &data->worker_pool.memory_budget_mb, 0, 65536, "%d", ImGuiSliderFlags_Logarithmic)) {
+                task_system::pool_set_memory_budget((size_t)data->worker_pool.memory_budget_mb * MEGABYTES(1));
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Limits the number of frame range tasks which execute at once by their estimated memory, 0 disables the limit.\nIn flight: %.1f MB", (double)task_system::pool_memory_in_flight() / (double)MEGABYTES(1));
+            }
+            if (ImGui::SliderInt("Memory Limit (MB)", &data->worker_pool.memory_limit_mb, 0, 262144, "%d", ImGuiSliderFlags_Logarithmic)) {
+                memory_budget_set((size_t)data->worker_pool.memory_limit_mb * MEGABYTES(1));
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::BeginTooltip();
+                ImGui::TextUnformatted("Total memory of the caches and analysis buffers, caches are shrunk to stay within it. 0 disables the limit.");
+                MemoryConsumerStats stats[MEMORY_BUDGET_MAX_CONSUMERS];
+                const size_t num_stats = memory_budget_stats(stats, ARRAY_SIZE(stats));
+                for (size_t i = 0; i < num_stats; ++i) {
+                    ImGui::Text("%s: %.1f MB%s", stats[i].name, (double)stats[i].usage / (double)MEGABYTES(1), stats[i].releasable ? "" : " (fixed)");
+                }
+                ImGui::EndTooltip();
+            }
+
             /*
             ImGui::Text("Units");
             char buf[64];
@@ -3629,6 +6041,9 @@ void draw_load_dataset_window(ApplicationData* data) {
 		};
         Action action = Action_None;
 
+        if (data->async_load.active) {
+            load_enabled = false;
+        }
         if (!load_enabled) ImGui::PushDisabled();
         if (ImGui::Button("Load")) {
             action = Action_Load;
@@ -3657,11 +6072,9 @@ void draw_load_dataset_window(ApplicationData* data) {
                 param.mol_loader_arg = &lammps_arg;
             }
 
-            if (load_dataset_from_file(data, param)) {
-                if (mol_loader && !state.keep_representations) {
-                    clear_representations(data);
-                    create_default_representations(data);
-                }
+            if (mol_loader) {
+                load_dataset_async(data, param, true);
+            } else if (load_dataset_from_file(data, param)) {
                 data->animation = {};
                 recompute_atom_visibility_mask(data);
                 reset_view(data, true, true);
@@ -3735,7 +6148,7 @@ void apply_atom_elem_mappings(ApplicationData* data) {
     md_index_data_free(&mol->structures, data->mold.mol_alloc);
     md_index_data_free(&mol->rings, data->mold.mol_alloc);
     
-    md_util_molecule_postprocess(mol, data->mold.mol_alloc, MD_UTIL_POSTPROCESS_BOND_BIT | MD_UTIL_POSTPROCESS_CONNECTIVITY_BIT | MD_UTIL_POSTPROCESS_STRUCTURE_BIT);
+    mol_postprocess(mol, data->mold.mol_alloc, MD_UTIL_POSTPROCESS_BOND_BIT | MD_UTIL_POSTPROCESS_CONNECTIVITY_BIT | MD_UTIL_POSTPROCESS_STRUCTURE_BIT);
     data->mold.dirty_buffers |= MolBit_DirtyBonds;
 
     update_all_representations(data);
@@ -4070,7 +6483,7 @@ void draw_context_popup(ApplicationData* data) {
 
     const int64_t sss_count = single_selection_sequence_count(&data->selection.single_selection_sequence);
     const int64_t num_frames = md_trajectory_num_frames(data->mold.traj);
-    const int64_t num_atoms_selected = md_bitfield_popcount(&data->selection.current_selection_mask);
+    const int64_t num_atoms_selected = versioned_bitfield_popcount(&data->selection.current_selection_mask);
 
 #if 0
     // FOR DEBUGGING
@@ -4235,7 +6648,7 @@ void draw_context_popup(ApplicationData* data) {
                 }
             }
             if (num_atoms_selected >= 1) {
-                const md_bitfield_t* bf = &data->selection.current_selection_mask;
+                const md_bitfield_t* bf = &data->selection.current_selection_mask.bits;
                 str_t ident = create_unique_identifier(data->mold.script.ir, STR("sel"), frame_allocator);
                 
                 md_array(str_t) suggestions = generate_script_selection_suggestions(ident, bf, &data->mold.mol);
@@ -4324,69 +6737,120 @@ void draw_context_popup(ApplicationData* data) {
                 if (num_atoms_selected > 0) {
                     apply |= ImGui::MenuItem("on Selection");
                     if (ImGui::IsItemHovered()) {
-                        md_bitfield_copy(&mask, &data->selection.current_selection_mask);
+                        md_bitfield_copy(&mask, &data->selection.current_selection_mask.bits);
                     }
                 }
 
                 if (!md_bitfield_empty(&mask)) {
-                    md_bitfield_copy(&data->selection.current_highlight_mask, &mask);
+                    md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &mask);
                     data->mold.dirty_buffers |= MolBit_DirtyFlags;
 
                     if (apply) {
                         load::traj::set_recenter_target(data->mold.traj, &mask);
                         load::traj::clear_cache(data->mold.traj);
+                        clear_keyframes(data);
                         interpolate_atomic_properties(data);
                         data->mold.dirty_buffers |= MolBit_DirtyPosition;
                         update_md_buffers(data);
-                        md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
+                        zero_molecule_velocity(data); // Do this explicitly to update the previous position to avoid motion blur trails
                         ImGui::CloseCurrentPopup();
                     }
                 }
                 ImGui::EndMenu();
             }
-        }
-        if (ImGui::BeginMenu("Selection")) {
-            if (ImGui::MenuItem("Invert")) {
-                md_bitfield_not_inplace(&data->selection.current_selection_mask, 0, data->mold.mol.atom.count);
-                data->mold.dirty_buffers |= MolBit_DirtyFlags;
-                ImGui::CloseCurrentPopup();
-            }
-            if (ImGui::IsItemHovered()) {
-                md_bitfield_not(&data->selection.current_highlight_mask, &data->selection.current_selection_mask, 0, data->mold.mol.atom.count);
-                data->mold.dirty_buffers |= MolBit_DirtyFlags;
-            }
-            if (ImGui::MenuItem("Query")) {
-                data->selection.query.show_window = true;
-                ImGui::CloseCurrentPopup();
-            }
-            if (num_atoms_selected > 0) {
-                if (ImGui::MenuItem("Grow")) {
-                    data->selection.grow.show_window = true;
-                    ImGui::CloseCurrentPopup();
-                }
-                if (ImGui::MenuItem("Clear")) {
-                    md_bitfield_clear(&data->selection.current_selection_mask);
-                    data->mold.dirty_buffers |= MolBit_DirtyFlags;
-                }
-            }
-            ImGui::EndMenu();
-        }
-        ImGui::EndPopup();
-    }
-}
+            if (ImGui::BeginMenu("Track Structure...")) {
+                const int idx = data->selection.atom_idx.right_click;
 
+                md_bitfield_t mask = {0};
+                md_bitfield_init(&mask, frame_allocator);
+                bool apply = false;
 
-static void draw_selection_grow_window(ApplicationData* data) {
-    ImGui::SetNextWindowSize(ImVec2(300,150), ImGuiCond_Always);
-    if (ImGui::Begin("Selection Grow", &data->selection.grow.show_window, ImGuiWindowFlags_NoDocking | ImGuiWindowFlags_NoCollapse)) {
-        ImGui::PushItemWidth(-1);
-        static uint64_t sel_popcount = 0;
-        const uint64_t popcount = md_bitfield_popcount(&data->selection.current_selection_mask);
+                if (data->mold.mol.residue.count > 0 && data->mold.mol.atom.res_idx && data->mold.mol.atom.res_idx[idx] != -1) {
+                    apply |= ImGui::MenuItem("Residue");
+                    if (ImGui::IsItemHovered()) {
+                        const md_range_t range = md_residue_atom_range(data->mold.mol.residue, data->mold.mol.atom.res_idx[idx]);
+                        md_bitfield_set_range(&mask, range.beg, range.end);
+                    }
+                }
+
+                if (data->mold.mol.chain.count > 0 && data->mold.mol.atom.chain_idx && data->mold.mol.atom.chain_idx[idx] != -1) {
+                    apply |= ImGui::MenuItem("Chain");
+                    if (ImGui::IsItemHovered()) {
+                        const auto range = md_chain_atom_range(data->mold.mol.chain, data->mold.mol.atom.chain_idx[idx]);
+                        md_bitfield_set_range(&mask, range.beg, range.end);
+                    }
+                }
+
+                if (num_atoms_selected > 0) {
+                    apply |= ImGui::MenuItem("Selection");
+                    if (ImGui::IsItemHovered()) {
+                        md_bitfield_copy(&mask, &data->selection.current_selection_mask.bits);
+                    }
+                }
+
+                if (data->tracking.active) {
+                    ImGui::Separator();
+                    if (ImGui::MenuItem("Stop Tracking")) {
+                        stop_tracking(data);
+                        interpolate_atomic_properties(data);
+                        ImGui::CloseCurrentPopup();
+                    }
+                }
+
+                if (!md_bitfield_empty(&mask)) {
+                    md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &mask);
+                    data->mold.dirty_buffers |= MolBit_DirtyFlags;
+
+                    if (apply) {
+                        start_tracking(data, &mask);
+                        ImGui::CloseCurrentPopup();
+                    }
+                }
+                ImGui::EndMenu();
+            }
+        }
+        if (ImGui::BeginMenu("Selection")) {
+            if (ImGui::MenuItem("Invert")) {
+                md_bitfield_not_inplace(versioned_bitfield_modify(&data->selection.current_selection_mask), 0, data->mold.mol.atom.count);
+                data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                ImGui::CloseCurrentPopup();
+            }
+            if (ImGui::IsItemHovered()) {
+                md_bitfield_not(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.current_selection_mask.bits, 0, data->mold.mol.atom.count);
+                data->mold.dirty_buffers |= MolBit_DirtyFlags;
+            }
+            if (ImGui::MenuItem("Query")) {
+                data->selection.query.show_window = true;
+                ImGui::CloseCurrentPopup();
+            }
+            if (num_atoms_selected > 0) {
+                if (ImGui::MenuItem("Grow")) {
+                    data->selection.grow.show_window = true;
+                    ImGui::CloseCurrentPopup();
+                }
+                if (ImGui::MenuItem("Clear")) {
+                    md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_selection_mask));
+                    data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                }
+            }
+            ImGui::EndMenu();
+        }
+        ImGui::EndPopup();
+    }
+}
+
+
+static void draw_selection_grow_window(ApplicationData* data) {
+    ImGui::SetNextWindowSize(ImVec2(300,150), ImGuiCond_Always);
+    if (ImGui::Begin("Selection Grow", &data->selection.grow.show_window, ImGuiWindowFlags_NoDocking | ImGuiWindowFlags_NoCollapse)) {
+        ImGui::PushItemWidth(-1);
+        static uint64_t sel_version = 0;
+        const uint64_t version = data->selection.current_selection_mask.version;
         const bool mode_changed = ImGui::Combo("##Mode", (int*)(&data->selection.grow.mode), "Covalent Bond\0Radial\0\0");
         const char* fmt = (data->selection.grow.mode == SelectionGrowth::CovalentBond) ? "%.0f" : "%.2f";
         const bool extent_changed = ImGui::SliderFloat("##Extent", &data->selection.grow.extent, 1.0f, 20.f, fmt);
         const bool appearing = ImGui::IsWindowAppearing();
-        const bool sel_changed = popcount != sel_popcount;
+        const bool sel_changed = version != sel_version;
         ImGui::PopItemWidth();
 
         const bool apply = ImGui::Button("Apply");
@@ -4394,17 +6858,23 @@ static void draw_selection_grow_window(ApplicationData* data) {
         // Need to invalidate when selection changes
         data->selection.grow.mask_invalid |= (mode_changed || extent_changed || appearing || sel_changed);
 
-        if (data->selection.grow.mask_invalid) {
-            sel_popcount = popcount;
+        // The radial growth waits for the cell list of the current coordinates, the previous mask is kept until it is ready
+        const CellList* cell_list = NULL;
+        if (data->selection.grow.mask_invalid && data->selection.grow.mode == SelectionGrowth::Radial) {
+            cell_list = request_cell_list(data);
+        }
+
+        if (data->selection.grow.mask_invalid && (data->selection.grow.mode != SelectionGrowth::Radial || cell_list)) {
+            sel_version = version;
             data->selection.grow.mask_invalid = false;
-            md_bitfield_copy(&data->selection.grow.mask, &data->selection.current_selection_mask);
+            md_bitfield_copy(&data->selection.grow.mask, &data->selection.current_selection_mask.bits);
 
             switch (data->selection.grow.mode) {
             case SelectionGrowth::CovalentBond:
                 md_util_mask_grow_by_bonds(&data->selection.grow.mask, &data->mold.mol, (int)data->selection.grow.extent, &data->representation.atom_visibility_mask);
                 break;
             case SelectionGrowth::Radial: {
-                md_util_mask_grow_by_radius(&data->selection.grow.mask, &data->mold.mol, data->selection.grow.extent, &data->representation.atom_visibility_mask);
+                cell_list_grow_mask_by_radius(cell_list, &data->selection.grow.mask, data->selection.grow.extent, &data->representation.atom_visibility_mask);
                 break;
             }
             default:
@@ -4419,11 +6889,11 @@ static void draw_selection_grow_window(ApplicationData* data) {
                                     (ImGui::GetHoveredID() == ImGui::GetID("Apply"));
 
         if (show_preview) {
-            md_bitfield_copy(&data->selection.current_highlight_mask, &data->selection.grow.mask);
+            md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.grow.mask);
             data->mold.dirty_buffers |= MolBit_DirtyFlags;
         }
         if (apply) {
-            md_bitfield_copy(&data->selection.current_selection_mask, &data->selection.grow.mask);
+            md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_selection_mask), &data->selection.grow.mask);
             data->selection.grow.mask_invalid = true;
         }
     }
@@ -4460,25 +6930,32 @@ static void draw_selection_query_window(ApplicationData* data) {
 
         preview |= ImGui::IsItemHovered();
 
-        if (data->selection.query.query_invalid) {
-            data->selection.query.query_invalid = false;
-            data->selection.query.query_ok = filter_expression(data, str_from_cstr(data->selection.query.buf), &data->selection.query.mask, NULL, data->selection.query.error, sizeof(data->selection.query.error));
+        // The query is evaluated on the pool, the previous result is shown until the evaluation of the latest query completes
+        auto& query = data->selection.query;
+        if (query.query_invalid) {
+            query.query_invalid = false;
+            request_async_filter(data, &query.filter, str_from_cstr(query.buf));
             query_frame = data->animation.frame;
+        }
 
-            if (data->selection.query.query_ok) {
-                grow_mask_by_current_selection_granularity(&data->selection.query.mask, *data);
+        if (poll_async_filter(data, &query.filter)) {
+            query.query_ok = query.filter.ok;
+            MEMCPY(query.error, query.filter.error, sizeof(query.error));
+            if (query.query_ok) {
+                md_bitfield_copy(&query.mask, &query.filter.mask);
+                grow_mask_by_current_selection_granularity(&query.mask, *data);
             } else {
-                md_bitfield_clear(&data->selection.query.mask);
+                md_bitfield_clear(&query.mask);
             }
         }
 
         if (preview) {
-            md_bitfield_copy(&data->selection.current_highlight_mask, &data->selection.query.mask);
+            md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.query.mask);
             data->mold.dirty_buffers |= MolBit_DirtyFlags;
         }
 
         if (apply && data->selection.query.query_ok) {
-            md_bitfield_copy(&data->selection.current_selection_mask, &data->selection.query.mask);
+            md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_selection_mask), &data->selection.query.mask);
             data->mold.dirty_buffers |= MolBit_DirtyFlags;
             data->selection.query.show_window = false;
         }
@@ -4533,6 +7010,41 @@ static void draw_animation_window(ApplicationData* data) {
             }
         }
         ImGui::Checkbox("Apply PBC", &data->animation.apply_pbc);
+        ImGui::Checkbox("Loop", &data->animation.loop);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Wrap around within the timeline filter range (if enabled) or the full trajectory");
+        }
+        if (data->scrub.proxy.num_slots) {
+            ImGui::Checkbox("Scrub Proxy", &data->scrub.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Show a trace of the residues while the time is dragged, the full structure is shown when it is released");
+            }
+        }
+        if (data->tracking.active) {
+            // Either change starts from the interpolated coordinates and the current camera
+            bool changed = ImGui::Checkbox("Track Structure", &data->tracking.enabled);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Follow the tracked structure (right click on an atom to track another structure)");
+            }
+            changed |= ImGui::Combo("Tracking", (int*)(&data->tracking.mode), "Absolute\0Relative\0\0");
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Absolute: Align the system to the reference structure\nRelative: Move the camera along with the structure");
+            }
+            if (changed) {
+                interpolate_atomic_properties(data);
+                data->tracking.camera_valid = false;
+            }
+            ImGui::Text("RMSD: %.3f", data->tracking.rmsd);
+            ImGui::SameLine();
+            if (ImGui::Button("Stop Tracking")) {
+                stop_tracking(data);
+                interpolate_atomic_properties(data);
+            }
+            if (data->tracking.active && ImGui::TreeNode("Similar Frames")) {
+                draw_frame_similarity(data);
+                ImGui::TreePop();
+            }
+        }
         switch (data->animation.mode) {
             case PlaybackMode::Playing:
                 if (ImGui::Button((const char*)ICON_FA_PAUSE)) data->animation.mode = PlaybackMode::Stopped;
@@ -4593,6 +7105,9 @@ static void draw_representations_window(ApplicationData* data) {
         const ImVec2 btn_size = {size, size};
         if (ImGui::Button(eye_icon, btn_size)) {
             rep.enabled = !rep.enabled;
+            if (rep.enabled && rep.deferred) {
+                update_representation(data, &rep);
+            }
             data->representation.atom_visibility_mask_dirty = true;
         }
         if (ImGui::IsItemHovered()) {
@@ -4620,13 +7135,13 @@ static void draw_representations_window(ApplicationData* data) {
                 update_rep = true;
             }
             if (!rep.type_is_valid) ImGui::PushInvalid();
-            if (ImGui::Combo("type", (int*)(&rep.type), "Space Fill\0Licorice\0Ball & Stick\0Ribbons\0Cartoon\0")) {
+            if (ImGui::Combo("type", (int*)(&rep.type), "Space Fill\0Licorice\0Ball & Stick\0Ribbons\0Cartoon\0Distance Field\0")) {
                 update_rep = true;
             }
             if (!rep.type_is_valid) ImGui::PopInvalid();
 
             if (ImGui::Combo("color", (int*)(&rep.color_mapping),
-                             "Uniform Color\0CPK\0Atom Label\0Atom Idx\0Res Id\0Res Idx\0Chain Id\0Chain Idx\0Secondary Structure\0Property\0")) {
+                             "Uniform Color\0CPK\0Atom Label\0Atom Idx\0Res Id\0Res Idx\0Chain Id\0Chain Idx\0Secondary Structure\0Property\0RMSF\0")) {
                 update_rep = true;
             }
             if (rep.color_mapping == ColorMapping::Property) {
@@ -4682,6 +7197,26 @@ static void draw_representations_window(ApplicationData* data) {
                     }
                 }
             }
+            if (rep.color_mapping == ColorMapping::Fluctuation) {
+                if (!data->fluctuation.ready) {
+                    ImGui::TextDisabled("Compute the RMSF in the Fluctuations window");
+                } else {
+                    if (ImPlot::ColormapButton(ImPlot::GetColormapName(rep.color_map), ImVec2(item_width,0), rep.color_map)) {
+                        ImGui::OpenPopup("Color Map Selector");
+                    }
+                    update_rep |= ImGui::DragFloatRange2("Min / Max", &rep.map_beg, &rep.map_end, 0.01f, 0.0f, data->fluctuation.max_rmsf);
+                    if (ImGui::BeginPopup("Color Map Selector")) {
+                        for (int map = 0; map < ImPlot::GetColormapCount(); ++map) {
+                            if (ImPlot::ColormapButton(ImPlot::GetColormapName(map), ImVec2(item_width,0), map)) {
+                                rep.color_map = map;
+                                update_rep = true;
+                                ImGui::CloseCurrentPopup();
+                            }
+                        }
+                        ImGui::EndPopup();
+                    }
+                }
+            }
             if (rep.filt_is_dynamic || rep.color_mapping == ColorMapping::Property) {
                 ImGui::Checkbox("auto-update", &rep.dynamic_evaluation);
                 if (!rep.dynamic_evaluation) {
@@ -4719,6 +7254,13 @@ static void draw_representations_window(ApplicationData* data) {
                 update_rep |= ImGui::SliderFloat("sheet scale", &rep.scale[1], 0.1f, 3.f);
                 update_rep |= ImGui::SliderFloat("helix scale", &rep.scale[2], 0.1f, 3.f);
                 break;
+            case RepresentationType::Sdf:
+                update_rep |= ImGui::SliderFloat("scale", &rep.scale[0], 0.1f, 4.f);
+                update_rep |= ImGui::SliderFloat("voxel size", &rep.scale[1], 0.1f, 4.f);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Finest voxel size of the field in Angstrom, it is coarsened for large systems");
+                }
+                break;
             default:
                 ASSERT(false);
             }
@@ -4863,6 +7405,13 @@ static void draw_async_task_window(ApplicationData* data) {
             const auto id = tasks[i];
             str_t label = task_system::task_label(id);
             float fract = task_system::task_fraction_complete(id);
+            if (id == data->tasks.export_volume && data->volume_export && data->volume_export->num_slabs > 0) {
+                fract = (float)data->volume_export->slabs_written.load(std::memory_order_relaxed) / (float)data->volume_export->num_slabs;
+            } else if (id == data->tasks.repack_trajectory && data->repack.job) {
+                fract = repack_fraction_complete(data->repack.job);
+            } else if (id == data->async_load.task) {
+                fract = data->async_load.progress.load(std::memory_order_relaxed);
+            }
 
             /*
             if (id == data->tasks.evaluate_filt) {
@@ -5206,24 +7755,108 @@ static float distance_to_linesegment(vec2_t line_beg, vec2_t line_end, vec2_t po
     }
 }
 
+// Key of the visualization of payload for the current atom positions
+static VisCacheKey vis_cache_key(const ApplicationData* data, const md_script_ir_t* ir, const md_script_vis_payload_o* payload, int subidx, md_script_vis_flags_t flags) {
+    uint64_t context = script_hash(&data->mold.traj, sizeof(data->mold.traj));
+    context = script_hash(&data->animation.interpolation, sizeof(data->animation.interpolation), context);
+    context = script_hash(&data->animation.tension, sizeof(data->animation.tension), context);
+
+    VisCacheKey key;
+    key.ir_fingerprint = md_script_ir_fingerprint(ir);
+    key.context = context;
+    key.payload = payload;
+    key.subidx = subidx;
+    key.flags = flags;
+    // Nearest interpolation shows the positions of the nearest frame
+    key.frame = data->animation.interpolation == InterpolationMode::Nearest ? (double)(int64_t)(data->animation.frame + 0.5) : data->animation.frame;
+    return key;
+}
+
 static void visualize_payload(ApplicationData* data, const md_script_vis_payload_o* payload, int subidx, md_script_vis_flags_t flags) {
     md_script_vis_ctx_t ctx = {
         .ir   = data->mold.script.eval_ir,
         .mol  = &data->mold.mol,
         .traj = data->mold.traj,
     };
-    data->mold.script.vis = {0};
-    md_script_vis_init(&data->mold.script.vis, frame_allocator);
+    const VisCacheKey key = vis_cache_key(data, data->mold.script.eval_ir, payload, subidx, flags);
+    data->mold.script.vis = vis_cache_get(&data->mold.script.vis_cache, key, &ctx);
 
-    if (md_script_vis_eval_payload(&data->mold.script.vis, payload, subidx, &ctx, flags)) {
-        if (!md_bitfield_empty(&data->mold.script.vis.atom_mask)) {
-            md_bitfield_copy(&data->selection.current_highlight_mask, &data->mold.script.vis.atom_mask);
+    if (data->mold.script.vis) {
+        if (!md_bitfield_empty(&data->mold.script.vis->atom_mask)) {
+            md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->mold.script.vis->atom_mask);
             data->mold.dirty_buffers |= MolBit_DirtyFlags;
         }
     }
+
+    // During playback the upcoming frames are evaluated ahead on the pool, only exact frames can be reused
+    if (data->animation.mode == PlaybackMode::Playing && key.frame == (double)(int64_t)key.frame) {
+        const uint32_t frame = (uint32_t)key.frame;
+        vis_cache_prefetch(&data->mold.script.vis_cache, key, frame + 1, frame + 1 + VIS_CACHE_BATCH_FRAMES, &ctx);
+    }
 }
 
 // #timeline
+// #timelinelod
+// Timelines with more frames than this number of points per pixel are drawn from the decimation pyramid
+#define TIMELINE_LOD_POINTS_PER_PIXEL 2
+
+// The series of a display property are its population indices, each with one (line) or two (area) getters
+static float timeline_lod_value(uint32_t frame_idx, uint32_t series_idx, void* user_data) {
+    DisplayProperty* dp = (DisplayProperty*)user_data;
+    const uint32_t num_getters = dp->getter[1] ? 2 : 1;
+    DisplayProperty::Payload payload = {
+        .display_prop = dp,
+        .dim_idx = (int)(series_idx / num_getters),
+    };
+    return (float)dp->getter[series_idx % num_getters]((int)frame_idx, &payload).y;
+}
+
+// Brings the pyramid of a temporal property up to date with its completed frames
+static void update_timeline_lod(DisplayProperty& dp) {
+    if (!dp.eval || !dp.getter[0] || dp.num_samples <= 0) return;
+    const uint32_t num_getters = dp.getter[1] ? 2 : 1;
+    const uint32_t num_series = (uint32_t)CLAMP(dp.dim, 1, MAX_POPULATION_SIZE) * num_getters;
+    if (!dp.lod) {
+        dp.lod = (TimelineLod*)md_alloc(persistent_allocator, sizeof(TimelineLod));
+        *dp.lod = {};
+        timeline_lod_init(dp.lod, (uint32_t)dp.num_samples, num_series, persistent_allocator);
+    }
+    timeline_lod_update(dp.lod, md_script_eval_completed_frames(dp.eval), timeline_lod_value, &dp);
+}
+
+struct TimelineLodPayload {
+    const TimelineLodLevel* level;
+    const float* x_values;
+    uint32_t num_frames;
+    uint32_t block_beg;
+    uint32_t series;
+};
+
+static inline double timeline_lod_x(const TimelineLodPayload* p, uint32_t block) {
+    const uint32_t frame = MIN(block * p->level->block_size + p->level->block_size / 2, p->num_frames - 1);
+    return p->x_values[frame];
+}
+
+// Two points per block (minimum and maximum), which draws the vertical extent of every block as a line does at full resolution
+static ImPlotPoint timeline_lod_envelope(int idx, void* user_data) {
+    const TimelineLodPayload* p = (const TimelineLodPayload*)user_data;
+    const uint32_t block = p->block_beg + idx / 2;
+    const size_t offset = (size_t)p->series * p->level->num_blocks + block;
+    return ImPlotPoint(timeline_lod_x(p, block), (idx & 1) ? p->level->max[offset] : p->level->min[offset]);
+}
+
+static ImPlotPoint timeline_lod_min(int idx, void* user_data) {
+    const TimelineLodPayload* p = (const TimelineLodPayload*)user_data;
+    const uint32_t block = p->block_beg + idx;
+    return ImPlotPoint(timeline_lod_x(p, block), p->level->min[(size_t)p->series * p->level->num_blocks + block]);
+}
+
+static ImPlotPoint timeline_lod_max(int idx, void* user_data) {
+    const TimelineLodPayload* p = (const TimelineLodPayload*)user_data;
+    const uint32_t block = p->block_beg + idx;
+    return ImPlotPoint(timeline_lod_x(p, block), p->level->max[(size_t)p->series * p->level->num_blocks + block]);
+}
+
 static void draw_timeline_window(ApplicationData* data) {
     ASSERT(data);
     ImGui::SetNextWindowSize(ImVec2(600, 300), ImGuiCond_FirstUseEver);
@@ -5671,7 +8304,26 @@ static void draw_timeline_window(ApplicationData* data) {
                             ImPlot::EndLegendPopup();
                         }
 
-                        auto plot = [j, &prop, hovered_prop_idx, hovered_pop_idx](int k) {
+                        // Select the level of the pyramid which matches the pixel width of the visible frames
+                        const TimelineLodLevel* lod_level = NULL;
+                        uint32_t lod_block_beg = 0;
+                        uint32_t lod_num_blocks = 0;
+                        const uint32_t max_points = (uint32_t)(ImPlot::GetPlotSize().x * TIMELINE_LOD_POINTS_PER_PIXEL);
+                        if (prop.plot_type != DisplayProperty::PlotType_Scatter && (uint32_t)prop.num_samples > max_points && max_points > 0) {
+                            update_timeline_lod(prop);
+                            if (prop.lod) {
+                                const ImPlotRect limits = ImPlot::GetPlotLimits();
+                                const uint32_t frame_beg = (uint32_t)CLAMP(time_to_frame(limits.X.Min, data->timeline.x_values), 0.0, (double)prop.num_samples);
+                                const uint32_t frame_end = (uint32_t)CLAMP(time_to_frame(limits.X.Max, data->timeline.x_values) + 2.0, (double)frame_beg, (double)prop.num_samples);
+                                lod_level = timeline_lod_select(prop.lod, frame_beg, frame_end, max_points / 2);
+                                if (lod_level) {
+                                    lod_block_beg = frame_beg / lod_level->block_size;
+                                    lod_num_blocks = MIN((frame_end + lod_level->block_size - 1) / lod_level->block_size, lod_level->num_blocks) - lod_block_beg;
+                                }
+                            }
+                        }
+
+                        auto plot = [j, &prop, hovered_prop_idx, hovered_pop_idx, lod_level, lod_block_beg, lod_num_blocks](int k) {
                             const float  hov_fill_alpha  = 1.25f;
                             const float  hov_line_weight = 2.0f;
                             const float  hov_col_scl = 1.5f;
@@ -5717,14 +8369,28 @@ static void draw_timeline_window(ApplicationData* data) {
                                 .dim_idx = k,
                             };
 
+                            const uint32_t num_getters = prop.getter[1] ? 2 : 1;
+                            TimelineLodPayload lod_payload[2] = {
+                                {lod_level, prop.x_values, (uint32_t)prop.num_samples, lod_block_beg, (uint32_t)k * num_getters},
+                                {lod_level, prop.x_values, (uint32_t)prop.num_samples, lod_block_beg, (uint32_t)k * num_getters + num_getters - 1},
+                            };
+
                             switch (prop.plot_type) {
                             case DisplayProperty::PlotType_Line:
                                 ImPlot::SetNextLineStyle(color, weight);
-                                ImPlot::PlotLineG(prop.label, prop.getter[0], &payload, prop.num_samples);
+                                if (lod_level) {
+                                    ImPlot::PlotLineG(prop.label, timeline_lod_envelope, &lod_payload[0], (int)lod_num_blocks * 2);
+                                } else {
+                                    ImPlot::PlotLineG(prop.label, prop.getter[0], &payload, prop.num_samples);
+                                }
                                 break;
                             case DisplayProperty::PlotType_Area:
                                 ImPlot::SetNextFillStyle(color, fill_alpha);
-                                ImPlot::PlotShadedG(prop.label, prop.getter[0], &payload, prop.getter[1], &payload, prop.num_samples);
+                                if (lod_level) {
+                                    ImPlot::PlotShadedG(prop.label, timeline_lod_min, &lod_payload[0], timeline_lod_max, &lod_payload[1], (int)lod_num_blocks);
+                                } else {
+                                    ImPlot::PlotShadedG(prop.label, prop.getter[0], &payload, prop.getter[1], &payload, prop.num_samples);
+                                }
                                 break;
                             case DisplayProperty::PlotType_Scatter:
                                 ImPlot::SetNextMarkerStyle(prop.marker_type, prop.marker_size, color, marker_line_weight, marker_line_color);
@@ -5824,7 +8490,7 @@ static void draw_timeline_window(ApplicationData* data) {
         }
         
         if (data->timeline.filter.enabled && (data->timeline.filter.beg_frame != pre_filter_min || data->timeline.filter.end_frame != pre_filter_max)) {
-            data->mold.script.evaluate_filt = true;
+            request_filt_evaluation(data);
         }
 
         // Try to handle the case when the user is dragging a payload and not dropping it within a valid target zone.
@@ -6170,6 +8836,23 @@ static void draw_distribution_window(ApplicationData* data) {
                                 break;
                             } 
 
+                            if (prop.prop && (prop.prop->flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL)) {
+                                ImGui::Checkbox("Density Estimate", &prop.kde);
+                                if (ImGui::IsItemHovered()) {
+                                    ImGui::SetTooltip("Show a kernel density estimate of the values instead of the histogram");
+                                }
+                                if (prop.kde) {
+                                    const float ext = (float)(prop.hist.x_max - prop.hist.x_min);
+                                    const float used = md_array_size(prop.hist.bandwidth_used) > 0 ? prop.hist.bandwidth_used[0] : 0.0f;
+                                    char fmt[32];
+                                    snprintf(fmt, sizeof(fmt), prop.kde_bandwidth > 0 ? "%%.3f" : "Auto (%.3f)", used);
+                                    ImGui::SliderFloat("Bandwidth", &prop.kde_bandwidth, 0.0f, ext > 0 ? ext * 0.1f : 1.0f, fmt);
+                                    if (ImGui::IsItemHovered()) {
+                                        ImGui::SetTooltip("Standard deviation of the Gaussian kernel, zero selects it from the samples (Silverman's rule)");
+                                    }
+                                }
+                            }
+
                             const int MIN_BINS = 32;
                             const int MAX_BINS = 1024;
                             if (ImGui::SliderInt("Num Bins", &prop.num_bins, MIN_BINS, MAX_BINS)) {
@@ -6441,6 +9124,131 @@ static void export_shape_space(ApplicationData* data, const char* ext) {
     }
 }
 
+// #shapespacedensity
+// The points of the shown structures are binned in parallel into partial grids, which are reduced, colormapped and uploaded on the main thread
+
+#define SHAPE_SPACE_DENSITY_DIM 256
+#define SHAPE_SPACE_DENSITY_MIN_POINTS 100000
+#define SHAPE_SPACE_DENSITY_MAX_PARTIALS 16
+
+struct ShapeSpaceDensityJob {
+    size_t alloc_size;
+    ApplicationData* data;
+    const vec2_t* coords;
+    size_t num_frames;
+    uint32_t frame_beg;
+    uint32_t frame_end;
+    uint32_t* structures;       // Indices of the shown structures
+    uint32_t num_structures;
+    float bounds[4];
+    uint32_t num_partials;
+    uint32_t* partial[SHAPE_SPACE_DENSITY_MAX_PARTIALS];
+};
+
+static void bin_shape_space_points(ShapeSpaceDensityJob* job, uint32_t* grid, size_t beg, size_t end) {
+    const size_t frames = job->frame_end - job->frame_beg;
+    const float sx = SHAPE_SPACE_DENSITY_DIM / (job->bounds[2] - job->bounds[0]);
+    const float sy = SHAPE_SPACE_DENSITY_DIM / (job->bounds[3] - job->bounds[1]);
+    for (size_t i = beg; i < end; ++i) {
+        const size_t structure = job->structures[i / frames];
+        const vec2_t c = job->coords[structure * job->num_frames + job->frame_beg + i % frames];
+        // NaN (not evaluated) fails the range test
+        const float u = (c.x - job->bounds[0]) * sx;
+        const float v = (c.y - job->bounds[1]) * sy;
+        if (!(0.0f <= u && u < SHAPE_SPACE_DENSITY_DIM && 0.0f <= v && v < SHAPE_SPACE_DENSITY_DIM)) continue;
+        grid[(uint32_t)v * SHAPE_SPACE_DENSITY_DIM + (uint32_t)u] += 1;
+    }
+}
+
+static void update_shape_space_density(ApplicationData* data, const bool* shown, uint32_t frame_beg, uint32_t frame_end, const float bounds[4], uint64_t key) {
+    if (task_system::task_is_running(data->shape_space.density.task)) return;
+    if (!data->shape_space.density.tex) {
+        glGenTextures(1, &data->shape_space.density.tex);
+        glBindTexture(GL_TEXTURE_2D, data->shape_space.density.tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SHAPE_SPACE_DENSITY_DIM, SHAPE_SPACE_DENSITY_DIM, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    data->shape_space.density.key = key;
+
+    uint32_t num_structures = 0;
+    for (size_t i = 0; i < data->shape_space.num_structures; ++i) {
+        num_structures += shown[i] ? 1 : 0;
+    }
+    const size_t num_points = (size_t)num_structures * (frame_end - frame_beg);
+    const uint32_t num_partials = (uint32_t)CLAMP(num_points / SHAPE_SPACE_DENSITY_MIN_POINTS, (size_t)1, (size_t)MIN(task_system::pool_num_threads(), (uint32_t)SHAPE_SPACE_DENSITY_MAX_PARTIALS));
+
+    const size_t grid_size = sizeof(uint32_t) * SHAPE_SPACE_DENSITY_DIM * SHAPE_SPACE_DENSITY_DIM;
+    const size_t alloc_size = sizeof(ShapeSpaceDensityJob) + sizeof(uint32_t) * num_structures + grid_size * num_partials + 16;
+    ShapeSpaceDensityJob* job = (ShapeSpaceDensityJob*)md_alloc(persistent_allocator, alloc_size);
+    job->alloc_size = alloc_size;
+    job->data = data;
+    job->coords = data->shape_space.coords;
+    job->num_frames = data->shape_space.num_frames;
+    job->frame_beg = frame_beg;
+    job->frame_end = frame_end;
+    job->structures = (uint32_t*)(job + 1);
+    job->num_structures = 0;
+    for (uint32_t i = 0; i < (uint32_t)data->shape_space.num_structures; ++i) {
+        if (shown[i]) job->structures[job->num_structures++] = i;
+    }
+    MEMCPY(job->bounds, bounds, sizeof(job->bounds));
+    job->num_partials = num_partials;
+    uint32_t* grids = (uint32_t*)NEXT_ALIGNED_ADDRESS(job->structures + num_structures, 16);
+    MEMSET(grids, 0, grid_size * num_partials);
+    for (uint32_t p = 0; p < num_partials; ++p) {
+        job->partial[p] = grids + (size_t)p * SHAPE_SPACE_DENSITY_DIM * SHAPE_SPACE_DENSITY_DIM;
+    }
+
+    data->shape_space.density.task = task_system::pool_enqueue(STR("##Shape Space Density"), 0, num_partials, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ShapeSpaceDensityJob* job = (ShapeSpaceDensityJob*)user_data;
+        const size_t num_points = (size_t)job->num_structures * (job->frame_end - job->frame_beg);
+        for (uint32_t p = range_beg; p < range_end; ++p) {
+            bin_shape_space_points(job, job->partial[p], num_points * p / job->num_partials, num_points * (p + 1) / job->num_partials);
+        }
+    }, job, 0, task_system::Priority_Interactive);
+
+    task_system::main_enqueue(STR("##Update Shape Space Density"), [](void* user_data) {
+        ShapeSpaceDensityJob* job = (ShapeSpaceDensityJob*)user_data;
+        const size_t num_texels = SHAPE_SPACE_DENSITY_DIM * SHAPE_SPACE_DENSITY_DIM;
+        uint32_t* counts = job->partial[0];
+        uint32_t max_count = 0;
+        for (size_t i = 0; i < num_texels; ++i) {
+            for (uint32_t p = 1; p < job->num_partials; ++p) {
+                counts[i] += job->partial[p][i];
+            }
+            max_count = MAX(max_count, counts[i]);
+        }
+
+        // Logarithmic colormap, empty bins are transparent
+        uint32_t lut[256];
+        for (int i = 0; i < 256; ++i) {
+            lut[i] = ImGui::ColorConvertFloat4ToU32(ImPlot::SampleColormap(i / 255.0f, ImPlotColormap_Viridis));
+        }
+        const float scl = max_count > 1 ? 255.0f / logf((float)max_count) : 0.0f;
+        uint32_t* pixels = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * num_texels);
+        for (uint32_t y = 0; y < SHAPE_SPACE_DENSITY_DIM; ++y) {
+            // The image is drawn with the first row at the top
+            const uint32_t* src = counts + (size_t)(SHAPE_SPACE_DENSITY_DIM - 1 - y) * SHAPE_SPACE_DENSITY_DIM;
+            uint32_t* dst = pixels + (size_t)y * SHAPE_SPACE_DENSITY_DIM;
+            for (uint32_t x = 0; x < SHAPE_SPACE_DENSITY_DIM; ++x) {
+                dst[x] = src[x] ? lut[(int)CLAMP(logf((float)src[x]) * scl, 0.0f, 255.0f)] : 0;
+            }
+        }
+
+        ApplicationData* data = job->data;
+        MEMCPY(data->shape_space.density.bounds, job->bounds, sizeof(job->bounds));
+        glBindTexture(GL_TEXTURE_2D, data->shape_space.density.tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SHAPE_SPACE_DENSITY_DIM, SHAPE_SPACE_DENSITY_DIM, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        md_free(persistent_allocator, job, job->alloc_size);
+    }, job, data->shape_space.density.task);
+}
+
 static void draw_shape_space_window(ApplicationData* data) {
     ImGui::SetNextWindowSize({300,350}, ImGuiCond_FirstUseEver);
     ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(2, 2));
@@ -6461,6 +9269,10 @@ static void draw_shape_space_window(ApplicationData* data) {
                 static constexpr float marker_min_size = 0.01f;
                 static constexpr float marker_max_size = 10.0f;
                 ImGui::SliderFloat("Marker Size", &data->shape_space.marker_size, marker_min_size, marker_max_size);
+                ImGui::Checkbox("Density Rendering", &data->shape_space.density_mode);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Draw large numbers of points as a density image, unless zoomed in");
+                }
                 ImGui::EndMenu();
             }
             ImGui::EndMenuBar();
@@ -6472,9 +9284,9 @@ static void draw_shape_space_window(ApplicationData* data) {
         ImGui::PopItemWidth();
         if (ImGui::IsItemHovered()) {
             if (data->shape_space.input_valid) {
-                md_bitfield_clear(&data->selection.current_highlight_mask);
+                md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_highlight_mask));
                 for (size_t i = 0; i < md_array_size(data->shape_space.bitfields); ++i) {
-                    md_bitfield_or_inplace(&data->selection.current_highlight_mask, &data->shape_space.bitfields[i]);
+                    md_bitfield_or_inplace(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->shape_space.bitfields[i]);
                 }
             } else if (data->shape_space.error[0] != '\0') {
                 ImGui::SetTooltip("%s", data->shape_space.error);
@@ -6548,6 +9360,16 @@ static void draw_shape_space_window(ApplicationData* data) {
             const float scl = (float)lim.X.Max - (float)lim.X.Min;
             const float MAX_D2 = 0.0001f * scl * scl;
 
+            // Beyond a number of points, the unzoomed view draws a density image instead of the individual points
+            const uint32_t frame_beg = data->timeline.filter.enabled ? (uint32_t)data->timeline.filter.beg_frame : 0;
+            const uint32_t frame_end = data->timeline.filter.enabled ? (uint32_t)MAX(data->timeline.filter.end_frame, data->timeline.filter.beg_frame) : (uint32_t)data->shape_space.num_frames;
+            const size_t num_points = data->shape_space.num_structures * (frame_end - frame_beg);
+            const bool zoomed = scl < 0.5f * (x_reset[1] - x_reset[0]);
+            const bool draw_density = data->shape_space.density_mode && !zoomed && num_points >= SHAPE_SPACE_DENSITY_MIN_POINTS;
+
+            bool* shown = (bool*)md_alloc(frame_allocator, sizeof(bool) * MAX(data->shape_space.num_structures, 1));
+            uint64_t density_key = 0;
+
             ImPlot::PushStyleVar(ImPlotStyleVar_MarkerSize, data->shape_space.marker_size);
             ImPlot::PushStyleVar(ImPlotStyleVar_Marker, ImPlotMarker_Square);
             for (int i = 0; i < (int)data->shape_space.num_structures; ++i) {
@@ -6564,15 +9386,21 @@ static void draw_shape_space_window(ApplicationData* data) {
                 } else {
                     snprintf(buf, sizeof(buf), "%i", i+1);
                 }
-                ImPlot::PlotScatterG(buf, getter, coordinates, count);
+                if (draw_density) {
+                    // Keeps the legend entry, which toggles and highlights the structure
+                    ImPlot::PlotDummy(buf);
+                } else {
+                    ImPlot::PlotScatterG(buf, getter, coordinates, count);
+                }
 
                 auto item = ImPlot::GetItem(buf);
+                shown[i] = item ? item->Show : true;
                 if (item) {
                     if (item->LegendHovered) {
                         hovered_structure_idx = i;
                     }
 
-                    if (item->Show) {
+                    if (item->Show && !draw_density) {
                         for (int32_t j = offset; j < offset + count; ++j ) {
                             vec2_t delta = mouse_coord - data->shape_space.coords[j];
                             float d2 = vec2_dot(delta, delta);
@@ -6586,6 +9414,24 @@ static void draw_shape_space_window(ApplicationData* data) {
             }
             ImPlot::PopStyleVar(2);
 
+            if (draw_density) {
+                const float bounds[4] = {x_reset[0], y_reset[0], x_reset[1], y_reset[1]};
+                uint32_t completed = 0;
+                for (uint32_t p = 0; p < data->shape_space.sweep.num_passes; ++p) {
+                    completed += data->shape_space.sweep.pass_completed[p].load(std::memory_order_relaxed);
+                }
+                const uint64_t range = ((uint64_t)frame_beg << 32) | frame_end;
+                density_key = script_hash(shown, sizeof(bool) * data->shape_space.num_structures, script_hash(&range, sizeof(range)));
+                density_key = script_hash(&completed, sizeof(completed), density_key ^ (uint64_t)(uintptr_t)data->shape_space.coords);
+                if (density_key != data->shape_space.density.key) {
+                    update_shape_space_density(data, shown, frame_beg, frame_end, bounds, density_key);
+                }
+                if (data->shape_space.density.tex) {
+                    const float* b = data->shape_space.density.bounds;
+                    ImPlot::PlotImage("##density", (ImTextureID)(intptr_t)data->shape_space.density.tex, ImPlotPoint(b[0], b[1]), ImPlotPoint(b[2], b[3]));
+                }
+            }
+
             // Redraw hovered index
             ImPlot::PushStyleVar(ImPlotStyleVar_Marker, ImPlotMarker_Square);
             ImPlot::PushStyleVar(ImPlotStyleVar_MarkerSize, data->shape_space.marker_size * 1.1f);
@@ -6599,7 +9445,7 @@ static void draw_shape_space_window(ApplicationData* data) {
                 }
                 vec2_t* coordinates = data->shape_space.coords + offset;
                 ImPlot::PlotScatterG("##hovered structure", getter, coordinates, count);
-                md_bitfield_copy(&data->selection.current_highlight_mask, &data->shape_space.bitfields[hovered_structure_idx]);
+                md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->shape_space.bitfields[hovered_structure_idx]);
                 data->mold.dirty_buffers |= MolBit_DirtyFlags;
             }
             if (hovered_point_idx != -1) {
@@ -6612,7 +9458,7 @@ static void draw_shape_space_window(ApplicationData* data) {
                 vec3_t w = data->shape_space.weights[hovered_point_idx];
                 if (data->shape_space.num_structures > 1) {
                     len += snprintf(buf, sizeof(buf), "Structure: %i, ", structure_idx + 1);
-                    md_bitfield_copy(&data->selection.current_highlight_mask, &data->shape_space.bitfields[structure_idx]);
+                    md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->shape_space.bitfields[structure_idx]);
                     data->mold.dirty_buffers |= MolBit_DirtyFlags;
                 }
                 len += snprintf(buf + len, sizeof(buf) - len, "Frame: %i, lin: %.2f, plan: %.2f, iso: %.2f", frame_idx, w.x, w.y, w.z);
@@ -6640,7 +9486,13 @@ static void draw_shape_space_window(ApplicationData* data) {
             else if (md_semaphore_try_aquire(&data->mold.script.ir_semaphore)) {
                 defer { md_semaphore_release(&data->mold.script.ir_semaphore); };
                 
+                // Frames may still be handed to the shape space by the backbone computations
+                trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_ShapeSpace);
+
                 data->shape_space.evaluate = false;
+                // The density binning reads the coordinates
+                task_system::task_wait_for(data->shape_space.density.task);
+                data->shape_space.density.key = 0;
                 md_array_shrink(data->shape_space.coords, 0);
                 md_array_shrink(data->shape_space.weights, 0);
 
@@ -6658,41 +9510,37 @@ static void draw_shape_space_window(ApplicationData* data) {
                     if (data->shape_space.num_structures > 0) {
                         data->shape_space.num_frames = num_frames;
                         md_array_resize(data->shape_space.coords,  num_frames * data->shape_space.num_structures, persistent_allocator);
-                        MEMSET(data->shape_space.coords, 0, md_array_bytes(data->shape_space.coords));
+                        for (size_t i = 0; i < md_array_size(data->shape_space.coords); ++i) {
+                            data->shape_space.coords[i] = {NAN, NAN};
+                        }
                         md_array_resize(data->shape_space.weights, num_frames * data->shape_space.num_structures, persistent_allocator);
                         MEMSET(data->shape_space.weights, 0, md_array_bytes(data->shape_space.weights));
 
-                        data->tasks.shape_space_evaluate = task_system::pool_enqueue(STR("Eval Shape Space"), 0, (uint32_t)num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
-                            ApplicationData* data = (ApplicationData*)user_data;
-                            int64_t stride = ALIGN_TO(data->mold.mol.atom.count, 8);
-                            const int64_t bytes = stride * 3 * sizeof(float);
-                            float* coords = (float*)md_alloc(md_heap_allocator, bytes);
-                            defer { md_free(md_heap_allocator, coords, bytes); };
-                            float* x = coords + stride * 0;
-                            float* y = coords + stride * 1;
-                            float* z = coords + stride * 2;
-                            const float* w = data->mold.mol.atom.mass;
-
-                            const vec2_t p[3] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.5f, 0.86602540378f}};
-
-                            md_array(int32_t) indices = 0;
-                            for (uint32_t frame_idx = range_beg; frame_idx < range_end; ++frame_idx) {
-                                md_trajectory_load_frame(data->mold.traj, frame_idx, NULL, x, y, z);
-                                for (size_t i = 0; i < md_array_size(data->shape_space.bitfields); ++i) {
-                                    md_array_resize(indices, md_bitfield_popcount(&data->shape_space.bitfields[i]), md_heap_allocator);
-                                    md_bitfield_extract_indices(indices, md_array_size(indices), &data->shape_space.bitfields[i]);
-
-                                    const vec3_t com = md_util_com_compute(x, y, z, w, indices, md_array_size(indices));
-                                    const mat3_t M = mat3_covariance_matrix(x, y, z, w, indices, com, md_array_size(indices));
-                                    const vec3_t weights = md_util_shape_weights(&M);
-
-                                    const int64_t dst_idx = data->shape_space.num_frames * i + frame_idx;
-                                    data->shape_space.weights[dst_idx] = weights;
-                                    data->shape_space.coords[dst_idx] = p[0] * weights[0] + p[1] * weights[1] + p[2] * weights[2];
-                                }
-                            }
-                            md_array_free(indices, md_heap_allocator);
-                        }, data);
+                        if (data->shape_space.sweep.num_frames != (uint32_t)num_frames) {
+                            progressive_init(&data->shape_space.sweep, (uint32_t)num_frames, persistent_allocator);
+                        } else {
+                            progressive_reset(&data->shape_space.sweep);
+                        }
+
+                        // Extract the indices of all structures once, they are read for every frame
+                        const size_t num_structures = data->shape_space.num_structures;
+                        md_array_resize(data->shape_space.offsets, num_structures + 1, persistent_allocator);
+                        size_t total = 0;
+                        for (size_t i = 0; i < num_structures; ++i) {
+                            data->shape_space.offsets[i] = total;
+                            total += md_bitfield_popcount(&data->shape_space.bitfields[i]);
+                        }
+                        data->shape_space.offsets[num_structures] = total;
+                        md_array_resize(data->shape_space.indices, total, persistent_allocator);
+                        for (size_t i = 0; i < num_structures; ++i) {
+                            const size_t offset = data->shape_space.offsets[i];
+                            md_bitfield_extract_indices(data->shape_space.indices + offset, data->shape_space.offsets[i + 1] - offset, &data->shape_space.bitfields[i]);
+                        }
+
+                        // Frames which are loaded for the backbone computations are shared with the shape space
+                        trajectory_sweep_set_consumer(&data->trajectory_sweep, SweepConsumer_ShapeSpace, &data->shape_space.sweep, process_shape_space_frame, data);
+                        trajectory_sweep_activate(&data->trajectory_sweep, SweepConsumer_ShapeSpace);
+                        data->tasks.shape_space_evaluate = trajectory_sweep_enqueue(&data->trajectory_sweep, SweepConsumer_ShapeSpace, STR("Eval Shape Space"), (uint32_t)num_frames);
                     } else {
                         snprintf(data->shape_space.error, sizeof(data->shape_space.error), "Expression did not evaluate into any bitfields");
                     }
@@ -6705,454 +9553,1288 @@ static void draw_shape_space_window(ApplicationData* data) {
     }
 }
 
-static void draw_ramachandran_window(ApplicationData* data) {
+#define SHAPE_SPACE_GATHER 64
+
+// Weighted covariance about the center of mass in a single pass over the atoms (instead of one for the com and one for the covariance)
+// The atoms are gathered in blocks into contiguous arrays, relative to the first atom to keep the raw moments well conditioned,
+// which lets the moment sums vectorize. Equivalent to md_util_com_compute followed by mat3_covariance_matrix.
+static mat3_t shape_space_covariance(const float* x, const float* y, const float* z, const float* w, const int32_t* indices, size_t count) {
+    mat3_t M = {0};
+    if (count == 0) return M;
+
+    const float rx = x[indices[0]];
+    const float ry = y[indices[0]];
+    const float rz = z[indices[0]];
+
+    // sw, sx, sy, sz, sxx, syy, szz, sxy, sxz, syz
+    double S[10] = {0};
+    float bx[SHAPE_SPACE_GATHER], by[SHAPE_SPACE_GATHER], bz[SHAPE_SPACE_GATHER], bw[SHAPE_SPACE_GATHER];
+    for (size_t beg = 0; beg < count; beg += SHAPE_SPACE_GATHER) {
+        const size_t n = MIN(count - beg, (size_t)SHAPE_SPACE_GATHER);
+        for (size_t j = 0; j < n; ++j) {
+            const int32_t idx = indices[beg + j];
+            bx[j] = x[idx] - rx;
+            by[j] = y[idx] - ry;
+            bz[j] = z[idx] - rz;
+            bw[j] = w ? w[idx] : 1.0f;
+        }
+        float s[10] = {0};
+        for (size_t j = 0; j < n; ++j) {
+            const float wx = bw[j] * bx[j];
+            const float wy = bw[j] * by[j];
+            const float wz = bw[j] * bz[j];
+            s[0] += bw[j];
+            s[1] += wx;
+            s[2] += wy;
+            s[3] += wz;
+            s[4] += wx * bx[j];
+            s[5] += wy * by[j];
+            s[6] += wz * bz[j];
+            s[7] += wx * by[j];
+            s[8] += wx * bz[j];
+            s[9] += wy * bz[j];
+        }
+        for (int k = 0; k < 10; ++k) {
+            S[k] += s[k];
+        }
+    }
 
-    ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(2, 2));
-    defer { ImGui::PopStyleVar(1); };
+    if (S[0] == 0.0) return M;
+    const double mx = S[1] / S[0];
+    const double my = S[2] / S[0];
+    const double mz = S[3] / S[0];
+    // sum w (p - com)(p - com)^T = sum w p p^T - W com com^T
+    M.elem[0][0] = (float)(S[4] - S[0] * mx * mx);
+    M.elem[1][1] = (float)(S[5] - S[0] * my * my);
+    M.elem[2][2] = (float)(S[6] - S[0] * mz * mz);
+    M.elem[0][1] = M.elem[1][0] = (float)(S[7] - S[0] * mx * my);
+    M.elem[0][2] = M.elem[2][0] = (float)(S[8] - S[0] * mx * mz);
+    M.elem[1][2] = M.elem[2][1] = (float)(S[9] - S[0] * my * mz);
+    return M;
+}
 
-    ImGui::SetNextWindowSize({300,350}, ImGuiCond_FirstUseEver);
-    if (ImGui::Begin("Ramachandran", &data->ramachandran.show_window, ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_MenuBar)) {
-        enum RamachandranDisplayMode {
-            IsoLevels,
-            IsoLines,
-            Colormap,
-        };
+static void process_shape_space_frame(uint32_t frame_idx, const md_trajectory_frame_header_t*, const float* x, const float* y, const float* z, void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    const float* w = data->mold.mol.atom.mass;
+    const vec2_t p[3] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.5f, 0.86602540378f}};
+
+    // All structures are evaluated in one pass over the concatenated indices
+    for (size_t i = 0; i < data->shape_space.num_structures; ++i) {
+        const int32_t* indices = data->shape_space.indices + data->shape_space.offsets[i];
+        const size_t count = data->shape_space.offsets[i + 1] - data->shape_space.offsets[i];
+        const mat3_t M = shape_space_covariance(x, y, z, w, indices, count);
+        const vec3_t weights = md_util_shape_weights(&M);
+
+        const int64_t dst_idx = data->shape_space.num_frames * i + frame_idx;
+        data->shape_space.weights[dst_idx] = weights;
+        data->shape_space.coords[dst_idx] = p[0] * weights[0] + p[1] * weights[1] + p[2] * weights[2];
+    }
+}
 
-        constexpr const char* plot_labels[4] = {"##General", "##Glycine", "##Proline", "##Pre-Proline"};
-        constexpr const char* layer_labels[3] = { "Reference", "Full Trajectory", "Filtered Trajectory" };
-        constexpr const char* option_labels[3] = { "IsoLevels", "IsoLines", "Colormap" };
+// #tracking
+#define TRACKING_WINDOW_EXTENT 16 // Frames on each side of the playhead which are computed first
 
-        constexpr const float min_ext = -180.0f;
-        constexpr const float max_ext = 180.0f;
-        constexpr const float reset_coords[2] = { min_ext, max_ext };
-        constexpr const char* x_lbl = "\xc2\xb0\xcf\x86";   // utf8 Degree Phi
-        constexpr const char* y_lbl = "\xc2\xb0\xcf\x88";   // utf8 Degree Psi
+static void process_tracking_frame(uint32_t frame_idx, const md_trajectory_frame_header_t*, const float* x, const float* y, const float* z, void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    data->tracking.fits[frame_idx] = superposition_fit(&data->tracking.ref, x, y, z);
+}
 
-        constexpr const ImPlotFlags flags = ImPlotFlags_Equal | ImPlotFlags_NoMenus | ImPlotFlags_NoBoxSelect; // | ImPlotFlags_AntiAliased;
-        constexpr const ImPlotFlags subplotflags = ImPlotSubplotFlags_NoResize | ImPlotSubplotFlags_NoMenus;
-        constexpr const ImPlotAxisFlags axis_flags = ImPlotAxisFlags_Foreground | ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickLabels;
+static void stop_tracking(ApplicationData* data) {
+    ASSERT(data);
+    stop_frame_similarity(data);
+    task_system::task_interrupt_and_wait_for(data->tasks.tracking_compute);
+    trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Tracking);
 
-        static ImPlotRect selection_rect;
-        static SelectionOperator op = SelectionOperator::Or;
-        static bool is_selecting[4] = {false, false, false, false};
-        
-        static float ref_alpha  = 0.85f;
-        static float full_alpha = 0.85f;
-        static float filt_alpha = 0.85f;
+    if (data->tracking.fits) {
+        md_free(persistent_allocator, data->tracking.fits, sizeof(superposition_fit_t) * data->tracking.num_frames);
+        data->tracking.fits = nullptr;
+    }
+    data->tracking.num_frames = 0;
+    superposition_ref_free(&data->tracking.ref);
+    progressive_free(&data->tracking.sweep);
+
+    data->tracking.active = false;
+    data->tracking.aligned = false;
+    data->tracking.camera_valid = false;
+    data->tracking.rmsd = 0;
+}
 
-        static RamachandranDisplayMode display_mode[3] = { IsoLevels, IsoLines, IsoLines };
-        static ImPlotColormap colormap[3] = { ImPlotColormap_Hot, ImPlotColormap_Plasma, ImPlotColormap_Viridis };
-        static vec4_t isoline_colors[3]   = { {1,1,1,1}, {1,1,1,1}, {1,1,1,1} };
+// The structure as it is currently shown is the reference, which every frame is fitted onto
+static bool start_tracking(ApplicationData* data, const md_bitfield_t* mask) {
+    ASSERT(data);
+    ASSERT(mask);
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(data->mold.traj);
+    const size_t count = md_bitfield_popcount(mask);
+    if (num_frames == 0 || count == 0) return false;
 
-        static int layout_mode = 0;
-        static bool show_layer[4] = {true, true, true, true};
+    stop_tracking(data);
 
-        static ImPlotRect viewrect = ImPlotRect(min_ext, max_ext, min_ext, max_ext);
-        
-        if (viewrect.Size().x < 1) {
-            viewrect.X.Max = viewrect.X.Min + 1;
-        }
-        if (viewrect.Size().y < 1) {
-            viewrect.Y.Max = viewrect.Y.Min + 1;
-        }
+    const md_molecule_t& mol = data->mold.mol;
+    int32_t* indices = (int32_t*)md_alloc(frame_allocator, sizeof(int32_t) * count);
+    md_bitfield_extract_indices(indices, count, mask);
+    if (!superposition_ref_init(&data->tracking.ref, mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.mass, indices, count, persistent_allocator)) {
+        LOG_ERROR("Failed to track the structure: The atoms have no mass");
+        return false;
+    }
 
-        if (ImGui::BeginMenuBar()) {
-            if (ImGui::BeginMenu("Layers")) {
+    data->tracking.fits = (superposition_fit_t*)md_alloc(persistent_allocator, sizeof(superposition_fit_t) * num_frames);
+    data->tracking.num_frames = num_frames;
+    progressive_init(&data->tracking.sweep, num_frames, persistent_allocator);
+    const uint32_t frame = (uint32_t)CLAMP(data->animation.frame, 0.0, (double)(num_frames - 1));
+    progressive_prioritize(&data->tracking.sweep, frame - MIN(frame, TRACKING_WINDOW_EXTENT), frame + TRACKING_WINDOW_EXTENT + 1);
 
-                ImGui::Separator();
-                ImGui::Text("Layers");
-                for (int i = 0; i < 3; ++i) {
-                    ImGui::Checkbox(layer_labels[i], &show_layer[i]);
-                    if (show_layer[i]) {
-                        ImGui::PushID(i);
-                        if (ImGui::BeginCombo(layer_labels[i], option_labels[display_mode[i]])) {
-                            if (ImGui::Selectable(option_labels[IsoLevels], display_mode[i] == IsoLevels)) display_mode[i] = IsoLevels;
-                            if (ImGui::Selectable(option_labels[IsoLines],  display_mode[i] == IsoLines))  display_mode[i] = IsoLines;
-                            if (ImGui::Selectable(option_labels[Colormap],  display_mode[i] == Colormap))  display_mode[i] = Colormap;
-                            ImGui::EndCombo();
-                        }
-                        if (display_mode[i] == Colormap) {
-                            ImPlot::ColormapSelection("Color Map", &colormap[i]);
-                        } else if (display_mode[i] == IsoLines) {
-                            ImGui::ColorEdit4Minimal("Line Color", isoline_colors[i].elem);
-                        }
-                        ImGui::PopID();
-                    }
-                    ImGui::Separator();
-                }
-                ImGui::Checkbox("Current", &show_layer[3]);
-                if (show_layer[3]) {
-                    ImGui::SliderFloat("Point Size", &data->ramachandran.style.base_radius, 1.0f, 10.0f);
-                    ImGui::ColorEdit4Minimal("Point Color", data->ramachandran.style.base_color.elem);
-                }
-                ImGui::Separator();
-                if (ImGui::SliderFloat("Density Blur Sigma", &data->ramachandran.blur_sigma, 0.1f, 10.0f)) {
-                    data->ramachandran.full_fingerprint = 0;
-                    data->ramachandran.filt_fingerprint = 0;
-                }
-                ImGui::EndMenu();
-            }
-            if (ImGui::BeginMenu("View")) {
-                if (ImGui::Selectable("Side-By-Side", layout_mode == 0)) layout_mode = 0;
-                if (ImGui::Selectable("General",      layout_mode == 1)) layout_mode = 1;
-                if (ImGui::Selectable("Glycine",      layout_mode == 2)) layout_mode = 2;
-                if (ImGui::Selectable("Proline",      layout_mode == 3)) layout_mode = 3;
-                if (ImGui::Selectable("Preproline",   layout_mode == 4)) layout_mode = 4;
-                ImGui::EndMenu();
-            }
-            ImGui::EndMenuBar();
-        }
+    data->tracking.active = true;
+    data->tracking.aligned = false;
+    data->tracking.camera_valid = false;
 
-        const auto& mol = data->mold.mol;
-        md_bitfield_t* selection_mask = &data->selection.current_selection_mask;
-        md_bitfield_t* highlight_mask = &data->selection.current_highlight_mask;
+    // Frames which are loaded for the backbone computations or the shape space are shared with the tracking
+    trajectory_sweep_set_consumer(&data->trajectory_sweep, SweepConsumer_Tracking, &data->tracking.sweep, process_tracking_frame, data);
+    trajectory_sweep_activate(&data->trajectory_sweep, SweepConsumer_Tracking);
+    data->tasks.tracking_compute = trajectory_sweep_enqueue(&data->trajectory_sweep, SweepConsumer_Tracking, STR("Track Structure"), num_frames);
+    return true;
+}
 
-        const int plot_offset = MAX(0, layout_mode - 1);
-        const int plot_cols = (layout_mode == 0) ? 2 : 1;
-        const int plot_rows = (layout_mode == 0) ? 2 : 1;
-        const int num_plots = plot_cols * plot_rows;
+// Transform at a fractional frame, interpolated between the fits of the neighbouring frames
+// Returns false if the fits are not computed yet, in which case the frames around it are prioritized
+static bool tracking_fit_at(ApplicationData* data, double frame, superposition_fit_t* out_fit) {
+    auto& t = data->tracking;
+    if (!t.fits || t.num_frames == 0) return false;
+
+    const double f = CLAMP(frame, 0.0, (double)(t.num_frames - 1));
+    const uint32_t i0 = (uint32_t)f;
+    const uint32_t i1 = MIN(i0 + 1, t.num_frames - 1);
+    if (!progressive_frame_complete(&t.sweep, i0) || !progressive_frame_complete(&t.sweep, i1)) {
+        progressive_prioritize(&t.sweep, i0 - MIN(i0, TRACKING_WINDOW_EXTENT), i1 + TRACKING_WINDOW_EXTENT + 1);
+        return false;
+    }
 
-        ImPlotInputMap& map = ImPlot::GetInputMap();
-        map.OverrideMod = ImGuiMod_Shift;
+    const superposition_fit_t& a = t.fits[i0];
+    const superposition_fit_t& b = t.fits[i1];
+    const float s = (float)(f - i0);
+    // Take the short way around
+    quat_t qb = b.rotation;
+    if (a.rotation.x * qb.x + a.rotation.y * qb.y + a.rotation.z * qb.z + a.rotation.w * qb.w < 0) {
+        qb = {-qb.x, -qb.y, -qb.z, -qb.w};
+    }
+    out_fit->com = vec3_lerp(a.com, b.com, s);
+    out_fit->rotation = quat_normalize(quat_slerp(a.rotation, qb, s));
+    out_fit->rmsd = lerp(a.rmsd, b.rmsd, s);
+    return true;
+}
 
-        auto formatter = [](double value, char* buff, int size, void* user_data) -> int {
-            const char* suffix = (const char*)user_data;
-            value = deperiodize(value, 0, 360.0);
-            return snprintf(buff, size, "%g%s", value, suffix);
-        };
+// Absolute: The coordinates are aligned to the reference once after they have been interpolated
+// Relative: The camera is moved with the change of the transform, which leaves the coordinates untouched
+static void apply_tracking(ApplicationData* data) {
+    ASSERT(data);
+    auto& t = data->tracking;
+    superposition_fit_t fit;
+    if (!tracking_fit_at(data, data->animation.frame, &fit)) return;
+    t.rmsd = fit.rmsd;
 
-        ImVec2 plot_size = {0,0};
+    if (!t.enabled) {
+        t.camera_valid = false;
+        return;
+    }
 
-        ImPlot::PushStyleVar(ImPlotStyleVar_PlotPadding, ImVec2(2,2));
-        defer { ImPlot::PopStyleVar(); };
+    if (t.mode == TrackingMode::Absolute) {
+        t.camera_valid = false;
+        if (t.aligned) return;
+
+        md_molecule_t& mol = data->mold.mol;
+        superposition_transform(mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.count, fit.com, fit.rotation, t.ref.com);
+
+        // Bounds of the transformed box, which encloses the transformed atoms
+        const vec3_t box_min = data->mold.mol_aabb_min;
+        const vec3_t box_max = data->mold.mol_aabb_max;
+        vec3_t aabb_min = vec3_set1( FLT_MAX);
+        vec3_t aabb_max = vec3_set1(-FLT_MAX);
+        for (int i = 0; i < 8; ++i) {
+            const vec3_t c = {(i & 1) ? box_max.x : box_min.x, (i & 2) ? box_max.y : box_min.y, (i & 4) ? box_max.z : box_min.z};
+            const vec3_t p = t.ref.com + fit.rotation * (c - fit.com);
+            aabb_min = vec3_min(aabb_min, p);
+            aabb_max = vec3_max(aabb_max, p);
+        }
+        data->mold.mol_aabb_min = aabb_min;
+        data->mold.mol_aabb_max = aabb_max;
 
-        if (ImPlot::BeginSubplots("##Ramaplots", plot_rows, plot_cols, ImVec2(-1, -1), subplotflags | ImPlotSubplotFlags_ShareItems)) {
-            for (int plot_idx = plot_offset; plot_idx < plot_offset + num_plots; ++plot_idx) {
-                if (ImPlot::BeginPlot(plot_labels[plot_idx], ImVec2(), flags)) {
-                    ImPlotPoint view_mid = { (viewrect.X.Min + viewrect.X.Max) * 0.5, (viewrect.Y.Min + viewrect.Y.Max) * 0.5 };
+        t.aligned = true;
+        data->mold.dirty_buffers |= MolBit_DirtyPosition;
+    } else {
+        if (t.camera_valid) {
+            // The camera keeps its pose relative to the structure
+            const quat_t d = quat_normalize(quat_conj(fit.rotation) * t.camera_fit.rotation);
+            data->view.camera.position = fit.com + d * (data->view.camera.position - t.camera_fit.com);
+            data->view.camera.orientation = quat_normalize(d * data->view.camera.orientation);
+            data->view.animation.target_position = fit.com + d * (data->view.animation.target_position - t.camera_fit.com);
+            data->view.animation.target_orientation = quat_normalize(d * data->view.animation.target_orientation);
+        }
+        t.camera_fit = fit;
+        t.camera_valid = true;
+    }
+}
 
-					ImPlot::SetupAxesLimits(min_ext, max_ext, min_ext, max_ext, ImPlotCond_Once);
-                    ImPlot::SetupAxisLinks(ImAxis_X1, &viewrect.X.Min, &viewrect.X.Max);
-                    ImPlot::SetupAxisLinks(ImAxis_Y1, &viewrect.Y.Min, &viewrect.Y.Max);
-                    // @NOTE(Robin): This wont work out of the box due to the periodic domain.
-                    //ImPlot::SetupAxisLimitsConstraints(ImAxis_X1, -720, +720);
-                    //ImPlot::SetupAxisLimitsConstraints(ImAxis_Y1, -720, +720);
-                    ImPlot::SetupAxes(x_lbl, y_lbl, axis_flags, axis_flags);
-                    
-                    ImPlot::SetupAxisFormat(ImAxis_X1, formatter, (void*)x_lbl);
-                    ImPlot::SetupAxisFormat(ImAxis_Y1, formatter, (void*)y_lbl);
+static void process_similarity_frame(uint32_t frame_idx, const md_trajectory_frame_header_t*, const float* x, const float* y, const float* z, void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    frame_similarity_add_frame(&data->tracking.similarity.index, frame_idx, x, y, z);
+}
 
-                    ImPlot::SetupFinish();
+static void clear_frame_clusters(ApplicationData* data) {
+    auto& sim = data->tracking.similarity;
+    if (sim.clusters) md_free(persistent_allocator, sim.clusters, sizeof(int32_t) * sim.index.num_frames);
+    if (sim.centers)  md_free(persistent_allocator, sim.centers, sizeof(uint32_t) * sim.index.num_frames);
+    sim.clusters = nullptr;
+    sim.centers = nullptr;
+    sim.num_clusters = 0;
+}
 
-                    viewrect = ImPlot::GetPlotLimits();
+static void stop_frame_similarity(ApplicationData* data) {
+    ASSERT(data);
+    auto& sim = data->tracking.similarity;
+    task_system::task_interrupt_and_wait_for(data->tasks.similarity_sweep);
+    task_system::task_interrupt_and_wait_for(data->tasks.similarity_build);
+    trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Similarity);
+
+    clear_frame_clusters(data);
+    frame_similarity_free(&sim.index);
+    progressive_free(&sim.sweep);
+    sim.active = false;
+    sim.ready = false;
+    sim.query_frame = UINT32_MAX;
+    sim.num_similar = 0;
+}
 
-                    ImPlot::PushStyleVar(ImPlotStyleVar_Marker, ImPlotMarker_Square);
-                    ImPlot::PushStyleColor(ImPlotCol_MarkerFill, ImVec4(0,0,0,0));
-                    ImPlot::PushStyleColor(ImPlotCol_MarkerOutline, ImVec4(0,0,0,0));
-                    ImPlot::PlotScatter("##Hidden reset helper", reset_coords, reset_coords, 2);
-                    ImPlot::PopStyleColor(2);
-                    ImPlot::PopStyleVar();
+// The frames are streamed through the trajectory sweep, after which the matrix or the sketch index is built
+static bool start_frame_similarity(ApplicationData* data) {
+    ASSERT(data);
+    stop_frame_similarity(data);
+    auto& sim = data->tracking.similarity;
+    if (!data->tracking.active) return false;
 
-                    //ImPlot::PlotDummy("Reference");
-                    //ImPlot::PlotDummy("Full");
-                    //ImPlot::PlotDummy("Filtered");
-                    //ImPlot::PlotDummy("Current");
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(data->mold.traj);
+    if (!frame_similarity_init(&sim.index, &data->tracking.ref, num_frames, persistent_allocator)) {
+        LOG_ERROR("Failed to compute the frame similarity: At least two frames are required");
+        return false;
+    }
+    progressive_init(&sim.sweep, num_frames, persistent_allocator);
+    sim.active = true;
 
-                    //ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(3)->Color = 0xFFFFFFFF;
+    trajectory_sweep_set_consumer(&data->trajectory_sweep, SweepConsumer_Similarity, &sim.sweep, process_similarity_frame, data);
+    trajectory_sweep_activate(&data->trajectory_sweep, SweepConsumer_Similarity);
+    data->tasks.similarity_sweep = trajectory_sweep_enqueue(&data->trajectory_sweep, SweepConsumer_Similarity, STR("Frame Similarity"), num_frames);
+    data->tasks.similarity_build = frame_similarity_enqueue_build(&sim.index, data->tasks.similarity_sweep);
 
-                    //bool show_ref  = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(0)->Show;
-                    //bool show_full = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(1)->Show;
-                    //bool show_filt = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(2)->Show;
-                    //bool show_curr = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(3)->Show;
-                    const bool show_ref  = show_layer[0];
-                    const bool show_full = show_layer[1];
-                    const bool show_filt = show_layer[2];
-                    const bool show_curr = show_layer[3];
+    task_system::main_enqueue(STR("##Frame Similarity Ready"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        auto& sim = data->tracking.similarity;
+        // An interrupted sweep leaves frames out, in which case the index is not used
+        if (sim.active && !task_system::task_is_running(data->tasks.similarity_build) && progressive_range_complete(&sim.sweep, 0, sim.index.num_frames)) {
+            sim.ready = true;
+            sim.query_frame = UINT32_MAX;
+        }
+    }, data, data->tasks.similarity_build);
+    return true;
+}
 
-                    ImVec2 plot_min = ImPlot::PlotToPixels(viewrect.Min());
-                    ImVec2 plot_max = ImPlot::PlotToPixels(viewrect.Max());
-                    plot_size = { fabsf(plot_max.x - plot_min.x), fabsf(plot_max.y - plot_min.y) };
+static void draw_frame_similarity(ApplicationData* data) {
+    auto& sim = data->tracking.similarity;
+    if (!sim.active) {
+        if (ImGui::Button("Compute")) {
+            start_frame_similarity(data);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Pairwise RMSD of the tracked structure between all frames\nAbove %i frames an approximate index is built instead", FRAME_SIMILARITY_MAX_MATRIX_FRAMES);
+        }
+        return;
+    }
+    if (!sim.ready) {
+        ImGui::Text("Computing...");
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel")) {
+            stop_frame_similarity(data);
+        }
+        return;
+    }
 
-                    if (show_ref || show_full || show_filt) {
-                        ImPlot::PushPlotClipRect();
-                        ImDrawList* dl = ImPlot::GetPlotDrawList();
+    const bool matrix = sim.index.mode == FrameSimilarityMode_Matrix;
+    const uint32_t frame = (uint32_t)CLAMP(data->animation.frame + 0.5, 0.0, (double)(sim.index.num_frames - 1));
+    if (frame != sim.query_frame) {
+        sim.query_frame = frame;
+        sim.num_similar = frame_similarity_query(&sim.index, frame, sim.similar, sim.similar_rmsd, SIMILAR_FRAMES, frame_allocator);
+    }
 
-                        const uint32_t ref_tex  = display_mode[0] == Colormap ? data->ramachandran.data.ref.map_tex[plot_idx]  : data->ramachandran.data.ref.iso_tex[plot_idx];
-                        const uint32_t full_tex = display_mode[1] == Colormap ? data->ramachandran.data.full.map_tex[plot_idx] : data->ramachandran.data.full.iso_tex[plot_idx];
-                        const uint32_t filt_tex = display_mode[2] == Colormap ? data->ramachandran.data.filt.map_tex[plot_idx] : data->ramachandran.data.filt.iso_tex[plot_idx];
+    ImGui::Text(matrix ? "Closest frames" : "Closest frames (approximate RMSD)");
+    for (size_t i = 0; i < sim.num_similar; ++i) {
+        char label[64];
+        snprintf(label, sizeof(label), "Frame %u: %.3f", sim.similar[i], sim.similar_rmsd[i]);
+        if (ImGui::Selectable(label)) {
+            data->animation.mode = PlaybackMode::Stopped;
+            data->animation.frame = (double)sim.similar[i];
+        }
+    }
 
-                        if (show_ref)  dl->AddImage((ImTextureID)(intptr_t)ref_tex,  plot_min, plot_max, {0,0}, {1,1}, ImColor(1.0f, 1.0f, 1.0f, ref_alpha));
-                        if (show_full) dl->AddImage((ImTextureID)(intptr_t)full_tex, plot_min, plot_max, {0,0}, {1,1}, ImColor(1.0f, 1.0f, 1.0f, full_alpha));
-                        if (show_filt) dl->AddImage((ImTextureID)(intptr_t)filt_tex, plot_min, plot_max, {0,0}, {1,1}, ImColor(1.0f, 1.0f, 1.0f, filt_alpha));
+    if (matrix) {
+        ImGui::SliderFloat("Cutoff", &sim.cluster_cutoff, 0.1f, 10.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("RMSD within which frames belong to the same cluster");
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Cluster")) {
+            clear_frame_clusters(data);
+            sim.clusters = (int32_t*)md_alloc(persistent_allocator, sizeof(int32_t) * sim.index.num_frames);
+            sim.centers  = (uint32_t*)md_alloc(persistent_allocator, sizeof(uint32_t) * sim.index.num_frames);
+            sim.num_clusters = frame_similarity_cluster(&sim.index, sim.cluster_cutoff, sim.clusters, sim.centers, frame_allocator);
+        }
+        if (sim.clusters) {
+            const int32_t c = sim.clusters[frame];
+            ImGui::Text("%i clusters, the frame is in cluster %i", (int)sim.num_clusters, c);
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Center")) {
+                data->animation.mode = PlaybackMode::Stopped;
+                data->animation.frame = (double)sim.centers[c];
+            }
+        }
+    }
+    if (ImGui::Button("Clear")) {
+        stop_frame_similarity(data);
+    }
+}
 
-                        ImPlot::PopPlotClipRect();
-                    }
+// #fluctuation
+static void process_fluctuation_frame(uint32_t, const md_trajectory_frame_header_t*, const float* x, const float* y, const float* z, void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    atom_statistics_add_frame(&data->fluctuation.stats, x, y, z);
+}
 
-                    const bool hovered = ImPlot::IsPlotHovered();
-                    const bool shift   = ImGui::GetIO().KeyShift;
-                    ImPlotPoint mouse_coord = ImPlot::GetPlotMousePos();
+static void stop_fluctuation(ApplicationData* data) {
+    ASSERT(data);
+    auto& fl = data->fluctuation;
+    task_system::task_interrupt_and_wait_for(data->tasks.fluctuation);
+    trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Fluctuation);
+
+    const bool was_applied = fl.average_applied;
+    atom_statistics_free(&fl.stats);
+    progressive_free(&fl.sweep);
+    if (fl.rmsf) {
+        md_free(persistent_allocator, fl.rmsf, sizeof(float) * data->mold.mol.atom.count);
+        fl.rmsf = nullptr;
+    }
+    fl.active = false;
+    fl.ready = false;
+    fl.average_applied = false;
+    fl.max_rmsf = 0;
+    fl.fingerprint = generate_fingerprint();
+    if (was_applied) {
+        interpolate_atomic_properties(data);
+    }
+}
 
-                    if (is_selecting[plot_idx]) {
-                        data->mold.dirty_buffers |= MolBit_DirtyFlags;
-                        selection_rect.X.Max = mouse_coord.x;
-                        selection_rect.Y.Max = mouse_coord.y;
-                        if (selection_rect.Size().x != 0 && selection_rect.Size().y != 0) {
-                            md_bitfield_copy(highlight_mask, selection_mask);
-                            ImPlot::DragRect(0, &selection_rect.X.Min, &selection_rect.Y.Min, &selection_rect.X.Max, &selection_rect.Y.Max, ImVec4(1,1,1,0.5f), ImPlotDragToolFlags_NoInputs);
-                        }
+static bool start_fluctuation(ApplicationData* data) {
+    ASSERT(data);
+    stop_fluctuation(data);
+    auto& fl = data->fluctuation;
+
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(data->mold.traj);
+    const md_bitfield_t* selection = &data->selection.current_selection_mask.bits;
+    const bool use_selection = fl.use_selection && !md_bitfield_empty(selection);
+    const size_t count = use_selection ? md_bitfield_popcount(selection) : data->mold.mol.atom.count;
+    if (num_frames == 0 || count == 0) return false;
+
+    int32_t* indices = (int32_t*)md_alloc(frame_allocator, sizeof(int32_t) * count);
+    if (use_selection) {
+        md_bitfield_extract_indices(indices, count, selection);
+    } else {
+        for (size_t i = 0; i < count; ++i) indices[i] = (int32_t)i;
+    }
+    const superposition_ref_t* ref = (fl.superpose && data->tracking.active) ? &data->tracking.ref : nullptr;
+    if (!atom_statistics_init(&fl.stats, indices, count, ref, persistent_allocator)) {
+        return false;
+    }
+    progressive_init(&fl.sweep, num_frames, persistent_allocator);
+    fl.active = true;
 
-                        if (!shift) {
-                            is_selecting[plot_idx] = false;
-                        }
-                    } else if (hovered && shift && (ImGui::IsMouseClicked(0) || ImGui::IsMouseClicked(1))) {
-                        is_selecting[plot_idx] = true;
-                        selection_rect = ImPlotRect(mouse_coord.x, mouse_coord.x, mouse_coord.y, mouse_coord.y);
-                        op = ImGui::IsMouseClicked(0) ? SelectionOperator::Or : SelectionOperator::AndNot;
-                    }
+    trajectory_sweep_set_consumer(&data->trajectory_sweep, SweepConsumer_Fluctuation, &fl.sweep, process_fluctuation_frame, data);
+    trajectory_sweep_activate(&data->trajectory_sweep, SweepConsumer_Fluctuation);
+    data->tasks.fluctuation = trajectory_sweep_enqueue(&data->trajectory_sweep, SweepConsumer_Fluctuation, STR("Fluctuations"), num_frames);
 
-                    const double cut_d2 = fabs(ImPlot::PixelsToPlot(9,0).x - ImPlot::PixelsToPlot(0,0).x);
-                    double min_d2 = DBL_MAX;
-                    int64_t mouse_hover_idx = -1;
+    task_system::main_enqueue(STR("##Fluctuations Ready"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        auto& fl = data->fluctuation;
+        // An interrupted sweep leaves frames out, which would bias the result
+        if (!fl.active || fl.ready || !progressive_range_complete(&fl.sweep, 0, fl.sweep.num_frames)) return;
+        trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Fluctuation);
+        atom_statistics_finalize(&fl.stats);
+
+        const size_t num_atoms = data->mold.mol.atom.count;
+        fl.rmsf = (float*)md_alloc(persistent_allocator, sizeof(float) * num_atoms);
+        MEMSET(fl.rmsf, 0, sizeof(float) * num_atoms);
+        fl.max_rmsf = 0;
+        for (size_t i = 0; i < fl.stats.count; ++i) {
+            fl.rmsf[fl.stats.indices[i]] = fl.stats.rmsf[i];
+            fl.max_rmsf = MAX(fl.max_rmsf, fl.stats.rmsf[i]);
+        }
+        fl.ready = true;
+        fl.fingerprint = generate_fingerprint();
+
+        for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+            Representation& rep = data->representation.reps[i];
+            if (rep.color_mapping != ColorMapping::Fluctuation) continue;
+            rep.map_beg = 0;
+            rep.map_end = fl.max_rmsf;
+            if (rep.enabled) update_representation(data, &rep);
+        }
+    }, data, data->tasks.fluctuation);
+    return true;
+}
 
-                    if (show_curr && mol.backbone.angle) {
-                        const uint32_t* indices = data->ramachandran.rama_type_indices[plot_idx];
+// Replaces the coordinates of the atoms of the set with their average, once after the coordinates have been interpolated
+static void apply_average_structure(ApplicationData* data) {
+    auto& fl = data->fluctuation;
+    md_molecule_t& mol = data->mold.mol;
+    const AtomStatistics& stats = fl.stats;
+    for (size_t i = 0; i < stats.count; ++i) {
+        const int32_t idx = stats.indices[i];
+        mol.atom.x[idx] = stats.mean_x[i];
+        mol.atom.y[idx] = stats.mean_y[i];
+        mol.atom.z[idx] = stats.mean_z[i];
+    }
+    fl.average_applied = true;
+    data->mold.dirty_buffers |= MolBit_DirtyPosition;
+}
 
-                        double min_x = MIN(selection_rect.X.Min, selection_rect.X.Max);
-                        double max_x = MAX(selection_rect.X.Min, selection_rect.X.Max);
-                        double min_y = MIN(selection_rect.Y.Min, selection_rect.Y.Max);
-                        double max_y = MAX(selection_rect.Y.Min, selection_rect.Y.Max);
+static void draw_fluctuation_window(ApplicationData* data) {
+    ImGui::SetNextWindowSize({300,300}, ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("Fluctuations", &data->fluctuation.show_window)) {
+        auto& fl = data->fluctuation;
+        const bool has_traj = md_trajectory_num_frames(data->mold.traj) > 0;
 
-                        double ref_x = (min_x + max_x) * 0.5;
-                        double ref_y = (min_y + max_y) * 0.5;
+        ImGui::Checkbox("Selected Atoms", &fl.use_selection);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Compute the fluctuations of the selected atoms, otherwise of all atoms");
+        }
+        if (!data->tracking.active) ImGui::PushDisabled();
+        ImGui::Checkbox("Superpose", &fl.superpose);
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+            ImGui::SetTooltip("Superpose the frames onto the tracked structure before they are accumulated\n(right click on an atom to track a structure)");
+        }
+        if (!data->tracking.active) ImGui::PopDisabled();
 
-                        mouse_coord.x = deperiodize(mouse_coord.x, ref_x, 360.0);
-                        mouse_coord.y = deperiodize(mouse_coord.y, ref_y, 360.0);
+        if (!has_traj) ImGui::PushDisabled();
+        if (ImGui::Button("Compute")) {
+            start_fluctuation(data);
+        }
+        if (!has_traj) ImGui::PopDisabled();
 
-                        for (size_t i = 0; i < md_array_size(indices); ++i) {
-                            uint32_t idx = indices[i];
+        if (fl.active && !fl.ready) {
+            ImGui::SameLine();
+            ImGui::Text("Computing...");
+        }
+        if (fl.ready) {
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) {
+                stop_fluctuation(data);
+            }
+        }
 
-                            if (mol.backbone.angle[idx].phi == 0 && mol.backbone.angle[idx].psi == 0) continue;
+        if (fl.ready) {
+            ImGui::Text("%i atoms over %i frames, max RMSF: %.3f", (int)fl.stats.count, (int)fl.stats.num_frames, fl.max_rmsf);
+            if (ImGui::Checkbox("Show Average Structure", &fl.show_average) && !fl.show_average) {
+                interpolate_atomic_properties(data);
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Show the average structure in place of the atoms of the set\n(in the frame of the tracked structure if the frames were superposed)");
+            }
+            if (ImPlot::BeginPlot("##RMSF", ImVec2(-1, -1))) {
+                ImPlot::SetupAxes("Atom", "RMSF", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+                ImPlot::PlotLine("RMSF", fl.stats.rmsf, (int)fl.stats.count);
+                ImPlot::EndPlot();
+            }
+        }
+    }
+    ImGui::End();
+}
 
-                            ImPlotPoint coord = ImPlotPoint(RAD_TO_DEG(mol.backbone.angle[idx].phi), RAD_TO_DEG(mol.backbone.angle[idx].psi));
-                            coord.x = deperiodize(coord.x, ref_x, 360.0);
-                            coord.y = deperiodize(coord.y, ref_y, 360.0);
-                            
-                            if (is_selecting[plot_idx]) {
-                                if (min_x <= coord.x && coord.x <= max_x && min_y <= coord.y && coord.y <= max_y) {
-                                    md_residue_idx_t res_idx = mol.backbone.residue_idx[idx];
-                                    if (res_idx < (int)mol.residue.count) {
-                                        md_range_t range = md_residue_atom_range(mol.residue, res_idx);
-                                        modify_field(highlight_mask, range, op);
-                                    }
-                                }
-                            }
-                            if (hovered) {
-                                double d2 = (coord.x - mouse_coord.x) * (coord.x - mouse_coord.x) + (coord.y - mouse_coord.y) * (coord.y - mouse_coord.y);
-                                if (d2 < cut_d2 && d2 < min_d2) {
-                                    min_d2 = d2;
-                                    mouse_hover_idx = idx;
-                                }
-                            }
-                        }
+// #contacts
+static void process_contacts_frame(uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    contacts_process_frame(&data->contacts.engine, frame_idx, header, x, y, z);
+}
 
-                        if (is_selecting[plot_idx]) {
-                            grow_mask_by_current_selection_granularity(highlight_mask, *data);
-                            data->mold.dirty_buffers |= MolBit_DirtyFlags;
-                        }
+static void free_contacts_pair_series(ApplicationData* data) {
+    auto& ct = data->contacts;
+    if (ct.pair_series) {
+        md_free(persistent_allocator, ct.pair_series, sizeof(float) * ct.num_frames);
+        ct.pair_series = nullptr;
+    }
+    ct.selected_pair = -1;
+}
 
-                        if (mouse_hover_idx != -1) {
-                            if (mouse_hover_idx < (int64_t)mol.backbone.count) {
-                                md_residue_idx_t res_idx = mol.backbone.residue_idx[mouse_hover_idx];
-                                if (res_idx < (int)mol.residue.count) {
-                                    md_range_t range = md_residue_atom_range(mol.residue, res_idx);
-                                    modify_field(highlight_mask, range, SelectionOperator::Or);
-                                    grow_mask_by_current_selection_granularity(highlight_mask, *data);
-                                    data->mold.dirty_buffers |= MolBit_DirtyFlags;
-                                }
-                                str_t lbl = LBL_TO_STR(mol.residue.name[res_idx]);
-                                ImGui::SetTooltip("res[%d]: %.*s %d", res_idx + 1, (int)lbl.len, lbl.ptr, mol.residue.id[res_idx]);
-                            }
-                        }
+static void stop_contacts(ApplicationData* data) {
+    ASSERT(data);
+    auto& ct = data->contacts;
+    task_system::task_interrupt_and_wait_for(data->tasks.contacts);
+    trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Contacts);
+
+    free_contacts_pair_series(data);
+    contacts_free(&ct.engine);
+    progressive_free(&ct.sweep);
+    ct.active = false;
+    ct.finalizing = false;
+    ct.finalized = false;
+    ct.ready = false;
+    ct.num_frames = 0;
+}
 
-                        uint32_t* selection_indices = 0;
-                        uint32_t* highlight_indices = 0;
+// Publishes the occupancy once the pool task has counted it, and waits for the task again otherwise
+static void contacts_occupancy_ready(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    auto& ct = data->contacts;
+    // Also reached by the tasks of a computation which has been stopped or restarted
+    if (!ct.active || !ct.finalizing || ct.ready) return;
+    if (!ct.finalized) {
+        task_system::main_enqueue(STR("##Contacts Occupancy Ready"), contacts_occupancy_ready, data, data->tasks.contacts);
+        return;
+    }
+    ct.ready = true;
+    LOG_INFO("Contacts: %zu pairs over %u frames, %.1f KB of contact lists", ct.engine.num_pairs, ct.num_frames, (double)ct.engine.data_size / 1024.0);
+}
 
-                        for (uint32_t i = 0; i < (uint32_t)md_array_size(indices); ++i) {
-                            uint32_t idx = indices[i];
-                            if (mol.backbone.angle[idx].phi == 0 && mol.backbone.angle[idx].psi == 0) continue;
+static bool start_contacts(ApplicationData* data) {
+    ASSERT(data);
+    stop_contacts(data);
+    auto& ct = data->contacts;
+
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(data->mold.traj);
+    const md_bitfield_t* selection = &data->selection.current_selection_mask.bits;
+    const bool use_selection = ct.use_selection && !md_bitfield_empty(selection);
+    const size_t count = use_selection ? md_bitfield_popcount(selection) : data->mold.mol.atom.count;
+    if (num_frames == 0 || count == 0) return false;
+
+    int32_t* indices = (int32_t*)md_alloc(frame_allocator, sizeof(int32_t) * count);
+    if (use_selection) {
+        md_bitfield_extract_indices(indices, count, selection);
+    } else {
+        for (size_t i = 0; i < count; ++i) indices[i] = (int32_t)i;
+    }
+    // The frames are processed by the threads of the pool, which allocate from the engine
+    if (!contacts_init(&ct.engine, &data->mold.mol, indices, count, ct.params, num_frames, md_heap_allocator)) {
+        LOG_ERROR("Contacts: The set has no %s", ct.params.mode == ContactMode_Residue ? "pair of residues" : "donors or acceptors");
+        return false;
+    }
+    progressive_init(&ct.sweep, num_frames, persistent_allocator);
+    ct.num_frames = num_frames;
+    ct.active = true;
 
-                            int64_t atom_idx = mol.backbone.atoms[idx].ca;
-                            if (md_bitfield_test_bit(highlight_mask, atom_idx)) {
-                                md_array_push(highlight_indices, idx, frame_allocator);
-                            }
+    trajectory_sweep_set_consumer(&data->trajectory_sweep, SweepConsumer_Contacts, &ct.sweep, process_contacts_frame, data, TrajectorySweepFlag_Header);
+    trajectory_sweep_activate(&data->trajectory_sweep, SweepConsumer_Contacts);
+    data->tasks.contacts = trajectory_sweep_enqueue(&data->trajectory_sweep, SweepConsumer_Contacts, STR("Contacts"), num_frames);
 
-                            if (md_bitfield_test_bit(selection_mask, atom_idx)) {
-                                md_array_push(selection_indices, idx, frame_allocator);
-                            }
-                        }
+    task_system::main_enqueue(STR("##Contacts Ready"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        auto& ct = data->contacts;
+        if (!ct.active || ct.finalizing || !progressive_range_complete(&ct.sweep, 0, ct.sweep.num_frames)) return;
+        trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Contacts);
+        ct.finalizing = true;
+
+        // Counting the pairs decodes every frame, which is left to the pool
+        data->tasks.contacts = task_system::pool_enqueue(STR("Contacts Occupancy"), [](void* user_data) {
+            ApplicationData* data = (ApplicationData*)user_data;
+            contacts_finalize(&data->contacts.engine);
+            data->contacts.finalized = true;
+        }, data);
+        task_system::execute_task(data->tasks.contacts);
+        task_system::main_enqueue(STR("##Contacts Occupancy Ready"), contacts_occupancy_ready, data, data->tasks.contacts);
+    }, data, data->tasks.contacts);
+    return true;
+}
 
-                        struct UserData {
-                            const vec2_t* coords;
-                            const uint32_t* indices;
-                            ImPlotPoint     view_center; // We use this to deperiodize the coordinates
-                        };
+static str_t contacts_pair_label(const ApplicationData* data, uint64_t id, md_allocator_i* alloc) {
+    const md_molecule_t& mol = data->mold.mol;
+    int32_t a, b;
+    contacts_pair_ends(&data->contacts.engine, id, &a, &b);
+    if (data->contacts.engine.params.mode == ContactMode_Residue) {
+        str_t na = LBL_TO_STR(mol.residue.name[a]);
+        str_t nb = LBL_TO_STR(mol.residue.name[b]);
+        return alloc_printf(alloc, STR_FMT "%i - " STR_FMT "%i", STR_ARG(na), mol.residue.id[a], STR_ARG(nb), mol.residue.id[b]);
+    }
+    str_t ta = LBL_TO_STR(mol.atom.type[a]);
+    str_t tb = LBL_TO_STR(mol.atom.type[b]);
+    str_t ra = mol.atom.res_idx ? LBL_TO_STR(mol.residue.name[mol.atom.res_idx[a]]) : STR("");
+    str_t rb = mol.atom.res_idx ? LBL_TO_STR(mol.residue.name[mol.atom.res_idx[b]]) : STR("");
+    return alloc_printf(alloc, STR_FMT ":" STR_FMT "(%i) - " STR_FMT ":" STR_FMT "(%i)", STR_ARG(ra), STR_ARG(ta), a + 1, STR_ARG(rb), STR_ARG(tb), b + 1);
+}
 
-                        auto index_getter = [](int i, void* user_data) -> ImPlotPoint {
-                            const UserData* data = (UserData*)user_data;
-                            uint32_t idx = data->indices[i];
+static void select_contacts_pair(ApplicationData* data, int64_t pair_idx) {
+    auto& ct = data->contacts;
+    free_contacts_pair_series(data);
+    if (pair_idx < 0 || pair_idx >= (int64_t)ct.engine.num_pairs) return;
+    ct.selected_pair = pair_idx;
+    ct.pair_series = (float*)md_alloc(persistent_allocator, sizeof(float) * ct.num_frames);
+    contacts_pair_series(&ct.engine, ct.engine.pair_id[pair_idx], ct.pair_series);
+}
 
-                            if (data->coords[idx].x == 0 && data->coords[idx].y == 0) {
-                                return { INFINITY, INFINITY }; // Hide by INF!
-                            }
+// The occupancy is written as the residue matrix if there is one, otherwise as columns of the pair ends and occupancy
+// The time series is written as columns of time, the number of contacts and the contact of the selected pair
+static void export_contacts(ApplicationData* data, const char* file_extension, bool occupancy) {
+    auto& ct = data->contacts;
+    char path_buf[1024];
+    if (!application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, file_extension)) return;
+    size_t path_len = strnlen(path_buf, sizeof(path_buf));
+    if (!extract_ext(NULL, {path_buf, path_len})) {
+        path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".%s", file_extension);
+    }
+    const str_t path = {path_buf, path_len};
+    const str_t ext = str_from_cstr(file_extension);
+    const ContactsEngine& e = ct.engine;
+    const bool residue = e.params.mode == ContactMode_Residue;
+
+    md_array(const float*) column_data = 0;
+    md_array(str_t) column_labels = 0;
+    bool exported = false;
+    if (occupancy && e.matrix) {
+        const size_t ng = e.num_groups;
+        for (size_t i = 0; i < ng; ++i) {
+            const int32_t r = e.group_res[i];
+            md_array_push(column_data, e.matrix + i * ng, frame_allocator);
+            md_array_push(column_labels, alloc_printf(frame_allocator, STR_FMT "%i", STR_ARG(LBL_TO_STR(data->mold.mol.residue.name[r])), data->mold.mol.residue.id[r]), frame_allocator);
+        }
+        exported = export_table(path, ext, STR("Contact Occupancy"), STR("Residue"), STR("Residue"), column_data, column_labels, ng, ng, column_labels, ng);
+    } else if (occupancy) {
+        float* ends = (float*)md_alloc(frame_allocator, sizeof(float) * e.num_pairs * 2);
+        for (size_t i = 0; i < e.num_pairs; ++i) {
+            int32_t a, b;
+            contacts_pair_ends(&e, e.pair_id[i], &a, &b);
+            // Residue ids, or serial atom numbers
+            ends[i]               = residue ? (float)data->mold.mol.residue.id[a] : (float)(a + 1);
+            ends[i + e.num_pairs] = residue ? (float)data->mold.mol.residue.id[b] : (float)(b + 1);
+        }
+        const float* columns[3] = {ends, ends + e.num_pairs, e.pair_occupancy};
+        const str_t labels[3] = {residue ? STR("Residue A") : STR("Hydrogen"), residue ? STR("Residue B") : STR("Acceptor"), STR("Occupancy")};
+        exported = export_table(path, ext, STR("Contact Occupancy"), STR("Pair"), STR("Occupancy"), columns, labels, 3, e.num_pairs, labels + 2, 1);
+    } else {
+        const double* traj_times = md_trajectory_frame_times(data->mold.traj);
+        float* time = (float*)md_alloc(frame_allocator, sizeof(float) * ct.num_frames);
+        for (uint32_t i = 0; i < ct.num_frames; ++i) {
+            time[i] = traj_times ? (float)traj_times[i] : (float)i;
+        }
+        str_t x_label = STR("Frame");
+        md_unit_t time_unit = md_trajectory_time_unit(data->mold.traj);
+        if (!md_unit_empty(time_unit)) {
+            char time_buf[64];
+            size_t len = md_unit_print(time_buf, sizeof(time_buf), time_unit);
+            x_label = alloc_printf(frame_allocator, "Time (" STR_FMT ")", len, time_buf);
+        }
+        md_array_push(column_data, time, frame_allocator);
+        md_array_push(column_labels, x_label, frame_allocator);
+        md_array_push(column_data, e.series, frame_allocator);
+        md_array_push(column_labels, residue ? STR("Contacts") : STR("Hydrogen Bonds"), frame_allocator);
+        if (ct.pair_series) {
+            md_array_push(column_data, ct.pair_series, frame_allocator);
+            md_array_push(column_labels, contacts_pair_label(data, e.pair_id[ct.selected_pair], frame_allocator), frame_allocator);
+        }
+        exported = export_table(path, ext, column_labels[1], x_label, STR("Count"), column_data, column_labels, md_array_size(column_data), ct.num_frames, column_labels + 1, md_array_size(column_labels) - 1);
+    }
+    if (exported) {
+        LOG_SUCCESS("Successfully exported contacts to '" STR_FMT "'", STR_ARG(path));
+    }
+}
 
-                            float x = deperiodizef(RAD_TO_DEG(data->coords[idx].x), data->view_center.x, 360.0f);
-                            float y = deperiodizef(RAD_TO_DEG(data->coords[idx].y), data->view_center.y, 360.0f);
-                            return { x, y };
-                        };
+static void draw_contacts_window(ApplicationData* data) {
+    ImGui::SetNextWindowSize({400,500}, ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("Contacts", &data->contacts.show_window, ImGuiWindowFlags_MenuBar)) {
+        auto& ct = data->contacts;
+        const bool has_traj = md_trajectory_num_frames(data->mold.traj) > 0;
 
-                        ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, data->ramachandran.style.base_radius, vec_cast(data->ramachandran.style.base_color), 1.2f, vec_cast(data->ramachandran.style.border_color));
-                        ImPlot::SetNextLineStyle(ImVec4(1, 1, 1, 1));
-                        if (md_array_size(indices) > 0) {
-                            UserData user_data = { (const vec2_t*)(mol.backbone.angle), indices, view_mid };
-                            ImPlot::PlotScatterG("##Current", index_getter, &user_data, (int)md_array_size(indices));
-                        }
+        if (ImGui::BeginMenuBar()) {
+            if (!ct.ready) ImGui::PushDisabled();
+            if (ImGui::BeginMenu("Export")) {
+                if (ImGui::BeginMenu("Occupancy")) {
+                    if (ImGui::MenuItem("NPY")) export_contacts(data, "npy", true);
+                    if (ImGui::MenuItem("CSV")) export_contacts(data, "csv", true);
+                    if (ImGui::MenuItem("XVG")) export_contacts(data, "xvg", true);
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Time Series")) {
+                    if (ImGui::MenuItem("NPY")) export_contacts(data, "npy", false);
+                    if (ImGui::MenuItem("CSV")) export_contacts(data, "csv", false);
+                    if (ImGui::MenuItem("XVG")) export_contacts(data, "xvg", false);
+                    ImGui::EndMenu();
+                }
+                ImGui::EndMenu();
+            }
+            if (!ct.ready) ImGui::PopDisabled();
+            ImGui::EndMenuBar();
+        }
 
-                        if (md_array_size(selection_indices) > 0) {
-                            UserData user_data = { (const vec2_t*)(mol.backbone.angle), selection_indices, view_mid };
-                            ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, data->ramachandran.style.base_radius + 1, vec_cast(data->ramachandran.style.selection_color), 2.0f, vec_cast(data->ramachandran.style.border_color));
-                            ImPlot::PlotScatterG("##Selection", index_getter, &user_data, (int)md_array_size(selection_indices));
-                        }
+        ImGui::Combo("Mode", (int*)&ct.params.mode, "Residue Contacts\0Hydrogen Bonds\0\0");
+        if (ct.params.mode == ContactMode_Residue) {
+            ImGui::SliderFloat("Cutoff", &ct.params.cutoff, 2.0f, 10.0f, "%.1f \xc3\x85");
+            ImGui::SliderInt("Min Separation", &ct.params.min_separation, 0, 10);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Residues closer than this in the sequence are not counted as contacts");
+            }
+        } else {
+            ImGui::SliderFloat("Donor-Acceptor Cutoff", &ct.params.hbond_cutoff, 2.5f, 4.5f, "%.2f \xc3\x85");
+            ImGui::SliderFloat("Min Angle", &ct.params.hbond_angle, 90.0f, 180.0f, "%.0f\xc2\xb0");
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Minimum donor-hydrogen-acceptor angle");
+            }
+        }
+        ImGui::Checkbox("Selected Atoms", &ct.use_selection);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Compute the contacts of the selected atoms, otherwise of all atoms");
+        }
 
-                        if (md_array_size(highlight_indices) > 0) {
-                            UserData user_data = { (const vec2_t*)(mol.backbone.angle), highlight_indices, view_mid };
-                            ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, data->ramachandran.style.base_radius + 1, vec_cast(data->ramachandran.style.highlight_color), 2.0f, vec_cast(data->ramachandran.style.border_color));
-                            ImPlot::PlotScatterG("##Highlight", index_getter, &user_data, (int)md_array_size(highlight_indices));
-                        }
-                    }
+        if (!has_traj) ImGui::PushDisabled();
+        if (ImGui::Button("Compute")) {
+            start_contacts(data);
+        }
+        if (!has_traj) ImGui::PopDisabled();
 
-                    if (ImGui::IsMouseReleased(0) || ImGui::IsMouseReleased(1)) {
-                        if (is_selecting[plot_idx]) {
-                            is_selecting[plot_idx] = false;
-                            auto size = selection_rect.Size();
-                            if (size.x == 0 && size.y == 0) {
-                                if (mouse_hover_idx != -1) {
-                                    modify_field(selection_mask, highlight_mask, op);
-                                } else {
-                                    if (ImGui::IsMouseReleased(1)) {
-                                        md_bitfield_clear(selection_mask);
+        if (ct.active && !ct.ready) {
+            ImGui::SameLine();
+            ImGui::Text("Computing...");
+        }
+        if (ct.ready) {
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) {
+                stop_contacts(data);
+            }
+        }
+
+        if (ct.ready) {
+            const ContactsEngine& e = ct.engine;
+            ImGui::Text("%zu pairs over %u frames, %.1f KB", e.num_pairs, ct.num_frames, (double)e.data_size / 1024.0);
+
+            if (e.matrix) {
+                const int ng = (int)e.num_groups;
+                if (ImPlot::BeginPlot("##Occupancy", ImVec2(-1, ImGui::GetContentRegionAvail().y * 0.5f), ImPlotFlags_Equal | ImPlotFlags_NoLegend)) {
+                    ImPlot::SetupAxes("Residue", "Residue", ImPlotAxisFlags_NoTickLabels, ImPlotAxisFlags_NoTickLabels);
+                    ImPlot::SetupAxesLimits(0, ng, 0, ng);
+                    ImPlot::PushColormap(ImPlotColormap_Viridis);
+                    ImPlot::PlotHeatmap("##Occupancy", e.matrix, ng, ng, 0.0, 1.0, nullptr, ImPlotPoint(0, 0), ImPlotPoint(ng, ng));
+                    ImPlot::PopColormap();
+                    if (ImPlot::IsPlotHovered()) {
+                        // Row 0 of the heatmap is at the top
+                        const ImPlotPoint p = ImPlot::GetPlotMousePos();
+                        const int col = (int)floor(p.x);
+                        const int row = ng - 1 - (int)floor(p.y);
+                        if (0 <= col && col < ng && 0 <= row && row < ng && row != col) {
+                            const uint64_t id = (uint64_t)MIN(row, col) * e.num_groups + MAX(row, col);
+                            ImGui::SetTooltip("%s: %.2f", contacts_pair_label(data, id, frame_allocator).ptr, e.matrix[row * ng + col]);
+                            if (ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+                                for (size_t i = 0; i < e.num_pairs; ++i) {
+                                    if (e.pair_id[i] == id) {
+                                        select_contacts_pair(data, (int64_t)i);
+                                        break;
                                     }
                                 }
                             }
-                            else {
-                                // Commit whatever is in the highlight mask
-                                modify_field(selection_mask, highlight_mask, SelectionOperator::Set);
-                            }
-                        } 
+                        }
                     }
-
                     ImPlot::EndPlot();
                 }
+            } else {
+                // Sorted by occupancy, highest first
+                ImGui::BeginChild("##Pairs", ImVec2(-1, ImGui::GetContentRegionAvail().y * 0.5f), true);
+                ImGuiListClipper clipper;
+                clipper.Begin((int)e.num_pairs);
+                while (clipper.Step()) {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                        str_t label = contacts_pair_label(data, e.pair_id[i], frame_allocator);
+                        char buf[256];
+                        snprintf(buf, sizeof(buf), "%5.1f%%  " STR_FMT "##%i", e.pair_occupancy[i] * 100.0f, STR_ARG(label), i);
+                        if (ImGui::Selectable(buf, ct.selected_pair == i)) {
+                            select_contacts_pair(data, i);
+                        }
+                    }
+                }
+                ImGui::EndChild();
             }
 
-            if (viewrect.X.Max < viewrect.X.Min) {
-                ImSwap(viewrect.X.Min, viewrect.X.Max);
-            }
-            if (viewrect.Y.Max < viewrect.Y.Min) {
-                ImSwap(viewrect.Y.Min, viewrect.Y.Max);
-            }
-
-            const double ratio = viewrect.Size().x / viewrect.Size().y;
-            const double mid_x = (viewrect.X.Min + viewrect.X.Max) * 0.5;
-            const double mid_y = (viewrect.Y.Min + viewrect.Y.Max) * 0.5;
-
-            if (viewrect.Size().x > 360) {
-                viewrect.X.Min = mid_x - 180;
-                viewrect.X.Max = mid_x + 180;
-                viewrect.Y.Min = mid_y - 0.5 * viewrect.Size().x / ratio;
-                viewrect.Y.Max = mid_y + 0.5 * viewrect.Size().x / ratio;
-            } else if (viewrect.Size().x < 10) {
-                viewrect.X.Min = mid_x - 5;
-                viewrect.X.Max = mid_x + 5;
-                viewrect.Y.Min = mid_y - 0.5 * viewrect.Size().x / ratio;
-                viewrect.Y.Max = mid_y + 0.5 * viewrect.Size().x / ratio;
-            }
-
-            if (viewrect.Size().y > 360) {
-                viewrect.Y.Min = mid_y - 180;
-                viewrect.Y.Max = mid_y + 180;
-                viewrect.X.Min = mid_x - 0.5 * viewrect.Size().y * ratio;
-                viewrect.X.Max = mid_x + 0.5 * viewrect.Size().y * ratio;
-            } else if (viewrect.Size().y < 10) {
-                viewrect.Y.Min = mid_y - 5;
-                viewrect.Y.Max = mid_y + 5;
-                viewrect.X.Min = mid_x - 0.5 * viewrect.Size().y * ratio;
-                viewrect.X.Max = mid_x + 0.5 * viewrect.Size().y * ratio;
+            if (ImPlot::BeginPlot("##Contacts Series", ImVec2(-1, -1))) {
+                const float* x_values = md_array_size(data->timeline.x_values) == ct.num_frames ? data->timeline.x_values : nullptr;
+                ImPlot::SetupAxes("Time", e.params.mode == ContactMode_Residue ? "Contacts" : "Hydrogen Bonds", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+                if (ct.pair_series) {
+                    ImPlot::SetupAxis(ImAxis_Y2, "Pair", ImPlotAxisFlags_AuxDefault | ImPlotAxisFlags_NoTickLabels);
+                    ImPlot::SetupAxisLimits(ImAxis_Y2, 0, 1, ImPlotCond_Always);
+                }
+                if (x_values) {
+                    ImPlot::PlotLine("Count", x_values, e.series, (int)ct.num_frames);
+                } else {
+                    ImPlot::PlotLine("Count", e.series, (int)ct.num_frames);
+                }
+                if (ct.pair_series) {
+                    // The frames where the selected pair is in contact are shaded on an axis of their own
+                    ImPlot::SetAxes(ImAxis_X1, ImAxis_Y2);
+                    ImPlot::SetNextFillStyle(IMPLOT_AUTO_COL, 0.3f);
+                    str_t label = contacts_pair_label(data, e.pair_id[ct.selected_pair], frame_allocator);
+                    if (x_values) {
+                        ImPlot::PlotShaded(label.ptr, x_values, ct.pair_series, (int)ct.num_frames);
+                    } else {
+                        ImPlot::PlotShaded(label.ptr, ct.pair_series, (int)ct.num_frames);
+                    }
+                }
+                ImPlot::EndPlot();
             }
-
-            ImPlot::EndSubplots();
         }
+    }
+    ImGui::End();
+}
 
-        vec4_t viewport = { (float)viewrect.X.Min / 180.0f, (float)viewrect.Y.Min / 180.0f, (float)viewrect.X.Max / 180.0f, (float)viewrect.Y.Max / 180.0f };
-        viewport = viewport * 0.5f + 0.5f;
+static void draw_ramachandran_window(ApplicationData* data) {
 
-        const float* ref_sum = data->ramachandran.data.ref.den_sum;
-        const float* full_sum = data->ramachandran.data.full.den_sum;
-        const float* filt_sum = data->ramachandran.data.filt.den_sum;
+    ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(2, 2));
+    defer { ImGui::PopStyleVar(1); };
 
-        const float ref_iso_values[4][3] = {
-            {0, 0.0005f, 0.02f},  // 99.95%, 98% for General
-            {0, 0.0020f, 0.02f},  // 99.80%, 98% for Others
-            {0, 0.0020f, 0.02f},
-            {0, 0.0020f, 0.02f},
+    ImGui::SetNextWindowSize({300,350}, ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("Ramachandran", &data->ramachandran.show_window, ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_MenuBar)) {
+        enum RamachandranDisplayMode {
+            IsoLevels,
+            IsoLines,
+            Colormap,
         };
 
-        const uint32_t ref_iso_level_colors[4][3] = {
-            {0x00000000, 0xFFFFE8B3, 0xFFFFD97F},
-            {0x00000000, 0xFFC5E8FF, 0xFF7FCCFF},
-            {0x00000000, 0xFFC5FFD0, 0xFF8CFF7F},
-            {0x00000000, 0xFFFFE8B3, 0xFFFFD97F}
-        };
+        constexpr const char* plot_labels[4] = {"##General", "##Glycine", "##Proline", "##Pre-Proline"};
+        constexpr const char* layer_labels[3] = { "Reference", "Full Trajectory", "Filtered Trajectory" };
+        constexpr const char* option_labels[3] = { "IsoLevels", "IsoLines", "Colormap" };
 
-        PUSH_GPU_SECTION("RENDER RAMA");
+        constexpr const float min_ext = -180.0f;
+        constexpr const float max_ext = 180.0f;
+        constexpr const float reset_coords[2] = { min_ext, max_ext };
+        constexpr const char* x_lbl = "\xc2\xb0\xcf\x86";   // utf8 Degree Phi
+        constexpr const char* y_lbl = "\xc2\xb0\xcf\x88";   // utf8 Degree Psi
 
-        uint32_t tex_dim = (uint32_t)MAX(plot_size.x, plot_size.y);
+        constexpr const ImPlotFlags flags = ImPlotFlags_Equal | ImPlotFlags_NoMenus | ImPlotFlags_NoBoxSelect; // | ImPlotFlags_AntiAliased;
+        constexpr const ImPlotFlags subplotflags = ImPlotSubplotFlags_NoResize | ImPlotSubplotFlags_NoMenus;
+        constexpr const ImPlotAxisFlags axis_flags = ImPlotAxisFlags_Foreground | ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickLabels;
 
-        rama_rep_t* reps[3] = {
-            &data->ramachandran.data.ref,
-            &data->ramachandran.data.full,
-            &data->ramachandran.data.filt
-        };
+        static ImPlotRect selection_rect;
+        static SelectionOperator op = SelectionOperator::Or;
+        static bool is_selecting[4] = {false, false, false, false};
+        
+        static float ref_alpha  = 0.85f;
+        static float full_alpha = 0.85f;
+        static float filt_alpha = 0.85f;
 
-        const float scl[3][4] = {
-            { 1.0f, 1.0f, 1.0f, 1.0f },
-            { full_sum[0] / ref_sum[0], full_sum[1] / ref_sum[1], full_sum[2] / ref_sum[2], full_sum[3] / ref_sum[3] },
-            { filt_sum[0] / ref_sum[0], filt_sum[1] / ref_sum[1], filt_sum[2] / ref_sum[2], filt_sum[3] / ref_sum[3] },
-        };
+        static RamachandranDisplayMode display_mode[3] = { IsoLevels, IsoLines, IsoLines };
+        static ImPlotColormap colormap[3] = { ImPlotColormap_Hot, ImPlotColormap_Plasma, ImPlotColormap_Viridis };
+        static vec4_t isoline_colors[3]   = { {1,1,1,1}, {1,1,1,1}, {1,1,1,1} };
 
-        for (uint32_t i = 0; i < 3; ++i) {
-            if (display_mode[i] == IsoLevels || display_mode[i] == IsoLines) {
-                const uint32_t count = 3;
-                uint32_t colors[4][count] = {0};
-                uint32_t lines[4][count] = {0};
-                float values[4][count] = {0};
+        static int layout_mode = 0;
+        static bool show_layer[4] = {true, true, true, true};
 
-                MEMCPY(values, ref_iso_values, sizeof(ref_iso_values));
-                for (uint32_t j = 0; j < count; ++j) {
-                    values[0][j] *= MAX(scl[i][0], FLT_EPSILON);
-                    values[1][j] *= MAX(scl[i][1], FLT_EPSILON);
-                    values[2][j] *= MAX(scl[i][2], FLT_EPSILON);
-                    values[3][j] *= MAX(scl[i][3], FLT_EPSILON);
-                }
+        static ImPlotRect viewrect = ImPlotRect(min_ext, max_ext, min_ext, max_ext);
+        
+        if (viewrect.Size().x < 1) {
+            viewrect.X.Max = viewrect.X.Min + 1;
+        }
+        if (viewrect.Size().y < 1) {
+            viewrect.Y.Max = viewrect.Y.Min + 1;
+        }
 
-                if (display_mode[i] == IsoLevels) {
-                    MEMCPY(colors, ref_iso_level_colors, sizeof(colors));
-                    MEMCPY(lines,  ref_iso_level_colors, sizeof(lines));
-                }
-                else {
-                    uint32_t line_colors[3] = {
-                        0,
-                        convert_color(vec4_from_vec3(hcl_to_rgb(rgb_to_hcl(vec3_from_vec4(isoline_colors[i])) * vec3_t { 1.0f, 0.5f, 1.0f }), isoline_colors[i].w)),
-                        convert_color(vec4_from_vec3(hcl_to_rgb(rgb_to_hcl(vec3_from_vec4(isoline_colors[i])) * vec3_t { 1.0f, 1.0f, 1.0f }), isoline_colors[i].w))
+        if (ImGui::BeginMenuBar()) {
+            if (ImGui::BeginMenu("Layers")) {
+
+                ImGui::Separator();
+                ImGui::Text("Layers");
+                for (int i = 0; i < 3; ++i) {
+                    ImGui::Checkbox(layer_labels[i], &show_layer[i]);
+                    if (show_layer[i]) {
+                        ImGui::PushID(i);
+                        if (ImGui::BeginCombo(layer_labels[i], option_labels[display_mode[i]])) {
+                            if (ImGui::Selectable(option_labels[IsoLevels], display_mode[i] == IsoLevels)) display_mode[i] = IsoLevels;
+                            if (ImGui::Selectable(option_labels[IsoLines],  display_mode[i] == IsoLines))  display_mode[i] = IsoLines;
+                            if (ImGui::Selectable(option_labels[Colormap],  display_mode[i] == Colormap))  display_mode[i] = Colormap;
+                            ImGui::EndCombo();
+                        }
+                        if (display_mode[i] == Colormap) {
+                            ImPlot::ColormapSelection("Color Map", &colormap[i]);
+                        } else if (display_mode[i] == IsoLines) {
+                            ImGui::ColorEdit4Minimal("Line Color", isoline_colors[i].elem);
+                        }
+                        ImGui::PopID();
+                    }
+                    ImGui::Separator();
+                }
+                ImGui::Checkbox("Current", &show_layer[3]);
+                if (show_layer[3]) {
+                    ImGui::SliderFloat("Point Size", &data->ramachandran.style.base_radius, 1.0f, 10.0f);
+                    ImGui::ColorEdit4Minimal("Point Color", data->ramachandran.style.base_color.elem);
+                }
+                ImGui::Separator();
+                if (ImGui::SliderFloat("Density Blur Sigma", &data->ramachandran.blur_sigma, 0.1f, 10.0f)) {
+                    data->ramachandran.full_fingerprint = 0;
+                    data->ramachandran.filt_fingerprint = 0;
+                }
+                ImGui::BeginDisabled(!rama_gpu_supported());
+                if (ImGui::Checkbox("Compute Density on GPU", &data->ramachandran.gpu_density)) {
+                    data->ramachandran.full_fingerprint = 0;
+                    data->ramachandran.filt_fingerprint = 0;
+                }
+                ImGui::EndDisabled();
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("View")) {
+                if (ImGui::Selectable("Side-By-Side", layout_mode == 0)) layout_mode = 0;
+                if (ImGui::Selectable("General",      layout_mode == 1)) layout_mode = 1;
+                if (ImGui::Selectable("Glycine",      layout_mode == 2)) layout_mode = 2;
+                if (ImGui::Selectable("Proline",      layout_mode == 3)) layout_mode = 3;
+                if (ImGui::Selectable("Preproline",   layout_mode == 4)) layout_mode = 4;
+                ImGui::EndMenu();
+            }
+            ImGui::EndMenuBar();
+        }
+
+        const auto& mol = data->mold.mol;
+        md_bitfield_t* selection_mask = &data->selection.current_selection_mask.bits;
+        md_bitfield_t* highlight_mask = versioned_bitfield_modify(&data->selection.current_highlight_mask);
+
+        const int plot_offset = MAX(0, layout_mode - 1);
+        const int plot_cols = (layout_mode == 0) ? 2 : 1;
+        const int plot_rows = (layout_mode == 0) ? 2 : 1;
+        const int num_plots = plot_cols * plot_rows;
+
+        ImPlotInputMap& map = ImPlot::GetInputMap();
+        map.OverrideMod = ImGuiMod_Shift;
+
+        auto formatter = [](double value, char* buff, int size, void* user_data) -> int {
+            const char* suffix = (const char*)user_data;
+            value = deperiodize(value, 0, 360.0);
+            return snprintf(buff, size, "%g%s", value, suffix);
+        };
+
+        ImVec2 plot_size = {0,0};
+
+        ImPlot::PushStyleVar(ImPlotStyleVar_PlotPadding, ImVec2(2,2));
+        defer { ImPlot::PopStyleVar(); };
+
+        if (ImPlot::BeginSubplots("##Ramaplots", plot_rows, plot_cols, ImVec2(-1, -1), subplotflags | ImPlotSubplotFlags_ShareItems)) {
+            for (int plot_idx = plot_offset; plot_idx < plot_offset + num_plots; ++plot_idx) {
+                if (ImPlot::BeginPlot(plot_labels[plot_idx], ImVec2(), flags)) {
+                    ImPlotPoint view_mid = { (viewrect.X.Min + viewrect.X.Max) * 0.5, (viewrect.Y.Min + viewrect.Y.Max) * 0.5 };
+
+					ImPlot::SetupAxesLimits(min_ext, max_ext, min_ext, max_ext, ImPlotCond_Once);
+                    ImPlot::SetupAxisLinks(ImAxis_X1, &viewrect.X.Min, &viewrect.X.Max);
+                    ImPlot::SetupAxisLinks(ImAxis_Y1, &viewrect.Y.Min, &viewrect.Y.Max);
+                    // @NOTE(Robin): This wont work out of the box due to the periodic domain.
+                    //ImPlot::SetupAxisLimitsConstraints(ImAxis_X1, -720, +720);
+                    //ImPlot::SetupAxisLimitsConstraints(ImAxis_Y1, -720, +720);
+                    ImPlot::SetupAxes(x_lbl, y_lbl, axis_flags, axis_flags);
+                    
+                    ImPlot::SetupAxisFormat(ImAxis_X1, formatter, (void*)x_lbl);
+                    ImPlot::SetupAxisFormat(ImAxis_Y1, formatter, (void*)y_lbl);
+
+                    ImPlot::SetupFinish();
+
+                    viewrect = ImPlot::GetPlotLimits();
+
+                    ImPlot::PushStyleVar(ImPlotStyleVar_Marker, ImPlotMarker_Square);
+                    ImPlot::PushStyleColor(ImPlotCol_MarkerFill, ImVec4(0,0,0,0));
+                    ImPlot::PushStyleColor(ImPlotCol_MarkerOutline, ImVec4(0,0,0,0));
+                    ImPlot::PlotScatter("##Hidden reset helper", reset_coords, reset_coords, 2);
+                    ImPlot::PopStyleColor(2);
+                    ImPlot::PopStyleVar();
+
+                    //ImPlot::PlotDummy("Reference");
+                    //ImPlot::PlotDummy("Full");
+                    //ImPlot::PlotDummy("Filtered");
+                    //ImPlot::PlotDummy("Current");
+
+                    //ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(3)->Color = 0xFFFFFFFF;
+
+                    //bool show_ref  = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(0)->Show;
+                    //bool show_full = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(1)->Show;
+                    //bool show_filt = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(2)->Show;
+                    //bool show_curr = ImPlot::GetCurrentContext()->CurrentSubplot->Items.GetLegendItem(3)->Show;
+                    const bool show_ref  = show_layer[0];
+                    const bool show_full = show_layer[1];
+                    const bool show_filt = show_layer[2];
+                    const bool show_curr = show_layer[3];
+
+                    ImVec2 plot_min = ImPlot::PlotToPixels(viewrect.Min());
+                    ImVec2 plot_max = ImPlot::PlotToPixels(viewrect.Max());
+                    plot_size = { fabsf(plot_max.x - plot_min.x), fabsf(plot_max.y - plot_min.y) };
+
+                    if (show_ref || show_full || show_filt) {
+                        ImPlot::PushPlotClipRect();
+                        ImDrawList* dl = ImPlot::GetPlotDrawList();
+
+                        const uint32_t ref_tex  = display_mode[0] == Colormap ? data->ramachandran.data.ref.map_tex[plot_idx]  : data->ramachandran.data.ref.iso_tex[plot_idx];
+                        const uint32_t full_tex = display_mode[1] == Colormap ? data->ramachandran.data.full.map_tex[plot_idx] : data->ramachandran.data.full.iso_tex[plot_idx];
+                        const uint32_t filt_tex = display_mode[2] == Colormap ? data->ramachandran.data.filt.map_tex[plot_idx] : data->ramachandran.data.filt.iso_tex[plot_idx];
+
+                        if (show_ref)  dl->AddImage((ImTextureID)(intptr_t)ref_tex,  plot_min, plot_max, {0,0}, {1,1}, ImColor(1.0f, 1.0f, 1.0f, ref_alpha));
+                        if (show_full) dl->AddImage((ImTextureID)(intptr_t)full_tex, plot_min, plot_max, {0,0}, {1,1}, ImColor(1.0f, 1.0f, 1.0f, full_alpha));
+                        if (show_filt) dl->AddImage((ImTextureID)(intptr_t)filt_tex, plot_min, plot_max, {0,0}, {1,1}, ImColor(1.0f, 1.0f, 1.0f, filt_alpha));
+
+                        ImPlot::PopPlotClipRect();
+                    }
+
+                    const bool hovered = ImPlot::IsPlotHovered();
+                    const bool shift   = ImGui::GetIO().KeyShift;
+                    ImPlotPoint mouse_coord = ImPlot::GetPlotMousePos();
+
+                    if (is_selecting[plot_idx]) {
+                        data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                        selection_rect.X.Max = mouse_coord.x;
+                        selection_rect.Y.Max = mouse_coord.y;
+                        if (selection_rect.Size().x != 0 && selection_rect.Size().y != 0) {
+                            md_bitfield_copy(highlight_mask, selection_mask);
+                            ImPlot::DragRect(0, &selection_rect.X.Min, &selection_rect.Y.Min, &selection_rect.X.Max, &selection_rect.Y.Max, ImVec4(1,1,1,0.5f), ImPlotDragToolFlags_NoInputs);
+                        }
+
+                        if (!shift) {
+                            is_selecting[plot_idx] = false;
+                        }
+                    } else if (hovered && shift && (ImGui::IsMouseClicked(0) || ImGui::IsMouseClicked(1))) {
+                        is_selecting[plot_idx] = true;
+                        selection_rect = ImPlotRect(mouse_coord.x, mouse_coord.x, mouse_coord.y, mouse_coord.y);
+                        op = ImGui::IsMouseClicked(0) ? SelectionOperator::Or : SelectionOperator::AndNot;
+                    }
+
+                    const double cut_d2 = fabs(ImPlot::PixelsToPlot(9,0).x - ImPlot::PixelsToPlot(0,0).x);
+                    double min_d2 = DBL_MAX;
+                    int64_t mouse_hover_idx = -1;
+
+                    if (show_curr && mol.backbone.angle) {
+                        const uint32_t* indices = data->ramachandran.rama_type_indices[plot_idx];
+
+                        double min_x = MIN(selection_rect.X.Min, selection_rect.X.Max);
+                        double max_x = MAX(selection_rect.X.Min, selection_rect.X.Max);
+                        double min_y = MIN(selection_rect.Y.Min, selection_rect.Y.Max);
+                        double max_y = MAX(selection_rect.Y.Min, selection_rect.Y.Max);
+
+                        double ref_x = (min_x + max_x) * 0.5;
+                        double ref_y = (min_y + max_y) * 0.5;
+
+                        mouse_coord.x = deperiodize(mouse_coord.x, ref_x, 360.0);
+                        mouse_coord.y = deperiodize(mouse_coord.y, ref_y, 360.0);
+
+                        for (size_t i = 0; i < md_array_size(indices); ++i) {
+                            uint32_t idx = indices[i];
+
+                            if (mol.backbone.angle[idx].phi == 0 && mol.backbone.angle[idx].psi == 0) continue;
+
+                            ImPlotPoint coord = ImPlotPoint(RAD_TO_DEG(mol.backbone.angle[idx].phi), RAD_TO_DEG(mol.backbone.angle[idx].psi));
+                            coord.x = deperiodize(coord.x, ref_x, 360.0);
+                            coord.y = deperiodize(coord.y, ref_y, 360.0);
+                            
+                            if (is_selecting[plot_idx]) {
+                                if (min_x <= coord.x && coord.x <= max_x && min_y <= coord.y && coord.y <= max_y) {
+                                    md_residue_idx_t res_idx = mol.backbone.residue_idx[idx];
+                                    if (res_idx < (int)mol.residue.count) {
+                                        md_range_t range = md_residue_atom_range(mol.residue, res_idx);
+                                        modify_field(highlight_mask, range, op);
+                                    }
+                                }
+                            }
+                            if (hovered) {
+                                double d2 = (coord.x - mouse_coord.x) * (coord.x - mouse_coord.x) + (coord.y - mouse_coord.y) * (coord.y - mouse_coord.y);
+                                if (d2 < cut_d2 && d2 < min_d2) {
+                                    min_d2 = d2;
+                                    mouse_hover_idx = idx;
+                                }
+                            }
+                        }
+
+                        if (is_selecting[plot_idx]) {
+                            grow_mask_by_current_selection_granularity(highlight_mask, *data);
+                            data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                        }
+
+                        if (mouse_hover_idx != -1) {
+                            if (mouse_hover_idx < (int64_t)mol.backbone.count) {
+                                md_residue_idx_t res_idx = mol.backbone.residue_idx[mouse_hover_idx];
+                                if (res_idx < (int)mol.residue.count) {
+                                    md_range_t range = md_residue_atom_range(mol.residue, res_idx);
+                                    modify_field(highlight_mask, range, SelectionOperator::Or);
+                                    grow_mask_by_current_selection_granularity(highlight_mask, *data);
+                                    data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                                }
+                                str_t lbl = LBL_TO_STR(mol.residue.name[res_idx]);
+                                ImGui::SetTooltip("res[%d]: %.*s %d", res_idx + 1, (int)lbl.len, lbl.ptr, mol.residue.id[res_idx]);
+                            }
+                        }
+
+                        uint32_t* selection_indices = 0;
+                        uint32_t* highlight_indices = 0;
+
+                        for (uint32_t i = 0; i < (uint32_t)md_array_size(indices); ++i) {
+                            uint32_t idx = indices[i];
+                            if (mol.backbone.angle[idx].phi == 0 && mol.backbone.angle[idx].psi == 0) continue;
+
+                            int64_t atom_idx = mol.backbone.atoms[idx].ca;
+                            if (md_bitfield_test_bit(highlight_mask, atom_idx)) {
+                                md_array_push(highlight_indices, idx, frame_allocator);
+                            }
+
+                            if (md_bitfield_test_bit(selection_mask, atom_idx)) {
+                                md_array_push(selection_indices, idx, frame_allocator);
+                            }
+                        }
+
+                        struct UserData {
+                            const vec2_t* coords;
+                            const uint32_t* indices;
+                            ImPlotPoint     view_center; // We use this to deperiodize the coordinates
+                        };
+
+                        auto index_getter = [](int i, void* user_data) -> ImPlotPoint {
+                            const UserData* data = (UserData*)user_data;
+                            uint32_t idx = data->indices[i];
+
+                            if (data->coords[idx].x == 0 && data->coords[idx].y == 0) {
+                                return { INFINITY, INFINITY }; // Hide by INF!
+                            }
+
+                            float x = deperiodizef(RAD_TO_DEG(data->coords[idx].x), data->view_center.x, 360.0f);
+                            float y = deperiodizef(RAD_TO_DEG(data->coords[idx].y), data->view_center.y, 360.0f);
+                            return { x, y };
+                        };
+
+                        ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, data->ramachandran.style.base_radius, vec_cast(data->ramachandran.style.base_color), 1.2f, vec_cast(data->ramachandran.style.border_color));
+                        ImPlot::SetNextLineStyle(ImVec4(1, 1, 1, 1));
+                        if (md_array_size(indices) > 0) {
+                            UserData user_data = { (const vec2_t*)(mol.backbone.angle), indices, view_mid };
+                            ImPlot::PlotScatterG("##Current", index_getter, &user_data, (int)md_array_size(indices));
+                        }
+
+                        if (md_array_size(selection_indices) > 0) {
+                            UserData user_data = { (const vec2_t*)(mol.backbone.angle), selection_indices, view_mid };
+                            ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, data->ramachandran.style.base_radius + 1, vec_cast(data->ramachandran.style.selection_color), 2.0f, vec_cast(data->ramachandran.style.border_color));
+                            ImPlot::PlotScatterG("##Selection", index_getter, &user_data, (int)md_array_size(selection_indices));
+                        }
+
+                        if (md_array_size(highlight_indices) > 0) {
+                            UserData user_data = { (const vec2_t*)(mol.backbone.angle), highlight_indices, view_mid };
+                            ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, data->ramachandran.style.base_radius + 1, vec_cast(data->ramachandran.style.highlight_color), 2.0f, vec_cast(data->ramachandran.style.border_color));
+                            ImPlot::PlotScatterG("##Highlight", index_getter, &user_data, (int)md_array_size(highlight_indices));
+                        }
+                    }
+
+                    if (ImGui::IsMouseReleased(0) || ImGui::IsMouseReleased(1)) {
+                        if (is_selecting[plot_idx]) {
+                            is_selecting[plot_idx] = false;
+                            auto size = selection_rect.Size();
+                            if (size.x == 0 && size.y == 0) {
+                                if (mouse_hover_idx != -1) {
+                                    modify_field(selection_mask, highlight_mask, op);
+                                } else {
+                                    if (ImGui::IsMouseReleased(1)) {
+                                        md_bitfield_clear(selection_mask);
+                                    }
+                                }
+                            }
+                            else {
+                                // Commit whatever is in the highlight mask
+                                modify_field(selection_mask, highlight_mask, SelectionOperator::Set);
+                            }
+                        } 
+                    }
+
+                    ImPlot::EndPlot();
+                }
+            }
+
+            if (viewrect.X.Max < viewrect.X.Min) {
+                ImSwap(viewrect.X.Min, viewrect.X.Max);
+            }
+            if (viewrect.Y.Max < viewrect.Y.Min) {
+                ImSwap(viewrect.Y.Min, viewrect.Y.Max);
+            }
+
+            const double ratio = viewrect.Size().x / viewrect.Size().y;
+            const double mid_x = (viewrect.X.Min + viewrect.X.Max) * 0.5;
+            const double mid_y = (viewrect.Y.Min + viewrect.Y.Max) * 0.5;
+
+            if (viewrect.Size().x > 360) {
+                viewrect.X.Min = mid_x - 180;
+                viewrect.X.Max = mid_x + 180;
+                viewrect.Y.Min = mid_y - 0.5 * viewrect.Size().x / ratio;
+                viewrect.Y.Max = mid_y + 0.5 * viewrect.Size().x / ratio;
+            } else if (viewrect.Size().x < 10) {
+                viewrect.X.Min = mid_x - 5;
+                viewrect.X.Max = mid_x + 5;
+                viewrect.Y.Min = mid_y - 0.5 * viewrect.Size().x / ratio;
+                viewrect.Y.Max = mid_y + 0.5 * viewrect.Size().x / ratio;
+            }
+
+            if (viewrect.Size().y > 360) {
+                viewrect.Y.Min = mid_y - 180;
+                viewrect.Y.Max = mid_y + 180;
+                viewrect.X.Min = mid_x - 0.5 * viewrect.Size().y * ratio;
+                viewrect.X.Max = mid_x + 0.5 * viewrect.Size().y * ratio;
+            } else if (viewrect.Size().y < 10) {
+                viewrect.Y.Min = mid_y - 5;
+                viewrect.Y.Max = mid_y + 5;
+                viewrect.X.Min = mid_x - 0.5 * viewrect.Size().y * ratio;
+                viewrect.X.Max = mid_x + 0.5 * viewrect.Size().y * ratio;
+            }
+
+            ImPlot::EndSubplots();
+        }
+
+        vec4_t viewport = { (float)viewrect.X.Min / 180.0f, (float)viewrect.Y.Min / 180.0f, (float)viewrect.X.Max / 180.0f, (float)viewrect.Y.Max / 180.0f };
+        viewport = viewport * 0.5f + 0.5f;
+
+        const float* ref_sum = data->ramachandran.data.ref.den_sum;
+        const float* full_sum = data->ramachandran.data.full.den_sum;
+        const float* filt_sum = data->ramachandran.data.filt.den_sum;
+
+        const float ref_iso_values[4][3] = {
+            {0, 0.0005f, 0.02f},  // 99.95%, 98% for General
+            {0, 0.0020f, 0.02f},  // 99.80%, 98% for Others
+            {0, 0.0020f, 0.02f},
+            {0, 0.0020f, 0.02f},
+        };
+
+        const uint32_t ref_iso_level_colors[4][3] = {
+            {0x00000000, 0xFFFFE8B3, 0xFFFFD97F},
+            {0x00000000, 0xFFC5E8FF, 0xFF7FCCFF},
+            {0x00000000, 0xFFC5FFD0, 0xFF8CFF7F},
+            {0x00000000, 0xFFFFE8B3, 0xFFFFD97F}
+        };
+
+        PUSH_GPU_SECTION("RENDER RAMA");
+
+        uint32_t tex_dim = (uint32_t)MAX(plot_size.x, plot_size.y);
+
+        rama_rep_t* reps[3] = {
+            &data->ramachandran.data.ref,
+            &data->ramachandran.data.full,
+            &data->ramachandran.data.filt
+        };
+
+        const float scl[3][4] = {
+            { 1.0f, 1.0f, 1.0f, 1.0f },
+            { full_sum[0] / ref_sum[0], full_sum[1] / ref_sum[1], full_sum[2] / ref_sum[2], full_sum[3] / ref_sum[3] },
+            { filt_sum[0] / ref_sum[0], filt_sum[1] / ref_sum[1], filt_sum[2] / ref_sum[2], filt_sum[3] / ref_sum[3] },
+        };
+
+        for (uint32_t i = 0; i < 3; ++i) {
+            if (display_mode[i] == IsoLevels || display_mode[i] == IsoLines) {
+                const uint32_t count = 3;
+                uint32_t colors[4][count] = {0};
+                uint32_t lines[4][count] = {0};
+                float values[4][count] = {0};
+
+                MEMCPY(values, ref_iso_values, sizeof(ref_iso_values));
+                for (uint32_t j = 0; j < count; ++j) {
+                    values[0][j] *= MAX(scl[i][0], FLT_EPSILON);
+                    values[1][j] *= MAX(scl[i][1], FLT_EPSILON);
+                    values[2][j] *= MAX(scl[i][2], FLT_EPSILON);
+                    values[3][j] *= MAX(scl[i][3], FLT_EPSILON);
+                }
+
+                if (display_mode[i] == IsoLevels) {
+                    MEMCPY(colors, ref_iso_level_colors, sizeof(colors));
+                    MEMCPY(lines,  ref_iso_level_colors, sizeof(lines));
+                }
+                else {
+                    uint32_t line_colors[3] = {
+                        0,
+                        convert_color(vec4_from_vec3(hcl_to_rgb(rgb_to_hcl(vec3_from_vec4(isoline_colors[i])) * vec3_t { 1.0f, 0.5f, 1.0f }), isoline_colors[i].w)),
+                        convert_color(vec4_from_vec3(hcl_to_rgb(rgb_to_hcl(vec3_from_vec4(isoline_colors[i])) * vec3_t { 1.0f, 1.0f, 1.0f }), isoline_colors[i].w))
                     };
                     for (int j = 0; j < 4; ++j) {
                         lines[j][0] = line_colors[0];
@@ -7161,1379 +10843,2794 @@ static void draw_ramachandran_window(ApplicationData* data) {
                     }
                 }
 
-                rama_isomap_t maps[4] = {
-                    {
-                        .values = values[0],
-                        .level_colors = colors[0],
-                        .contour_colors = lines[0],
-                        .count = count,
+                rama_isomap_t maps[4] = {
+                    {
+                        .values = values[0],
+                        .level_colors = colors[0],
+                        .contour_colors = lines[0],
+                        .count = count,
+                    },
+                    {
+                        .values = values[1],
+                        .level_colors = colors[1],
+                        .contour_colors = lines[1],
+                        .count = count,
+                    },
+                    {
+                        .values = values[2],
+                        .level_colors = colors[2],
+                        .contour_colors = lines[2],
+                        .count = count,
+                    },
+                    {
+                        .values = values[3],
+                        .level_colors = colors[3],
+                        .contour_colors = lines[3],
+                        .count = count,
+                    },
+                };
+
+                rama_rep_render_iso(reps[i], viewport.elem, maps, tex_dim);
+            } else if (display_mode[i] == Colormap){
+                // Fill in colors based on active color_map
+                uint32_t colors[32] = {0};
+                uint32_t num_colors = ImPlot::GetColormapSize(colormap[i]);
+                for (uint32_t j = 0; j < num_colors; ++j) {
+                    colors[j] = ImPlot::GetColormapColorU32(j, colormap[i]);
+                }
+                // Mask off the first color to be transparent
+                colors[0] = colors[0] & 0x00FFFFFFU;
+
+                rama_colormap_t maps[4] = {
+                    {
+                        .colors = colors,
+                        .count = num_colors,
+                        .min_value = 0,
+                        .max_value = 0.5f * scl[i][0],
+                    },
+                    {
+                        .colors = colors,
+                        .count = num_colors,
+                        .min_value = 0,
+                        .max_value = 0.5f * scl[i][1],
+                    },
+                    {
+                        .colors = colors,
+                        .count = num_colors,
+                        .min_value = 0,
+                        .max_value = 0.5f * scl[i][2],
+                    },
+                    {
+                        .colors = colors,
+                        .count = num_colors,
+                        .min_value = 0,
+                        .max_value = 0.5f * scl[i][3],
+                    },
+                };
+                rama_rep_render_map(reps[i], viewport.elem, maps, tex_dim);
+            }
+        }
+
+        POP_GPU_SECTION();
+
+        ImPlot::MapInputDefault();
+    }
+    ImGui::End();
+}
+
+static void draw_density_volume_window(ApplicationData* data) {
+    ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("Density Volume", &data->density_volume.show_window, ImGuiWindowFlags_MenuBar)) {
+        const ImVec2 button_size = {160, 0};
+
+        if (ImGui::IsWindowFocused() && ImGui::IsKeyPressed(KEY_PLAY_PAUSE, false)) {
+            data->animation.mode = data->animation.mode == PlaybackMode::Playing ? PlaybackMode::Stopped : PlaybackMode::Playing;
+        }
+
+        if (ImGui::BeginMenuBar()) {
+            if (ImGui::BeginMenu("Property")) {
+                int64_t selected_index = -1;
+                int64_t candidate_count = 0;
+                for (int64_t i = 0; i < (int64_t)md_array_size(data->display_properties); ++i) {
+                    DisplayProperty& dp = data->display_properties[i];
+                    if (dp.type != DisplayProperty::Type_Volume) continue;
+                    // @TODO(Robin): This is a hack to hide the filter property when not enabled. This should not be hardcoded in the future...
+                    if (!data->timeline.filter.enabled && str_eq(md_script_eval_label(dp.eval), STR("filt"))) {
+                        continue;
+                    }
+                    ImPlot::ItemIcon(dp.color); ImGui::SameLine();
+                    if (ImGui::Selectable(dp.label, dp.show_in_volume)) {
+                        selected_index = i;
+                    }
+                    if (ImGui::IsItemHovered()) {
+                        visualize_payload(data, dp.prop->vis_payload, 0, MD_SCRIPT_VISUALIZE_DEFAULT);
+                        set_hovered_property(data,  str_from_cstr(dp.label));
+                    }
+                    candidate_count += 1;
+                }
+
+                if (candidate_count == 0) {
+                    ImGui::Text("No volume properties available.");
+                }
+
+                // Currently we only support viewing one volume at a time.
+                // This will probably change over time but not now.
+                if (selected_index != -1) {
+                    for (int64_t i = 0; i < (int64_t)md_array_size(data->display_properties); ++i) {
+                        if (selected_index == i) {
+                            // Toggle bool
+                            data->display_properties[i].show_in_volume = !data->display_properties[i].show_in_volume;
+                        } else {
+                            data->display_properties[i].show_in_volume = false;
+                        }
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Render")) {
+                ImGui::SliderFloat("Density Scaling", &data->density_volume.density_scale, 0.001f, 10000.f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                ImGui::Checkbox("Empty Space Skipping", &data->density_volume.empty_space_skipping);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Rays skip the regions of the volume which are neither visible in the transfer function nor contain an isovalue");
+                }
+                if (ImGui::Checkbox("Sparse Bricks", &data->density_volume.bricks.enabled)) {
+                    data->density_volume.dirty_vol = true;
+                }
+                if (ImGui::IsItemHovered()) {
+                    const auto& vol = data->density_volume.bricks.volume;
+                    if (vol.atlas) {
+                        const uint32_t total = (uint32_t)(vol.bricks[0] * vol.bricks[1] * vol.bricks[2]);
+                        ImGui::SetTooltip("Only the non-empty bricks are stored\n%u of %u bricks, %.1f MB", vol.num_stored, total, volume::bricked_volume_bytes(&vol) / (1024.0 * 1024.0));
+                    } else {
+                        ImGui::SetTooltip("Only the non-empty bricks are stored");
+                    }
+                }
+                if (data->density_volume.bricks.enabled) {
+                    ImGui::Indent();
+                    if (ImGui::Checkbox("Half Precision", &data->density_volume.bricks.half_precision)) {
+                        data->density_volume.dirty_vol = true;
+                    }
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("16-bit float voxels, otherwise 8-bit normalized by the max value");
+                    }
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Direct Volume Rendering", &data->density_volume.dvr.enabled);
+                if (data->density_volume.dvr.enabled) {
+                    ImGui::Indent();
+                    if (ImPlot::ColormapButton(ImPlot::GetColormapName(data->density_volume.dvr.tf.colormap), button_size, data->density_volume.dvr.tf.colormap)) {
+                        ImGui::OpenPopup("Colormap Selector");
+                    }
+                    if (ImGui::BeginPopup("Colormap Selector")) {
+                        for (int map = 4; map < ImPlot::GetColormapCount(); ++map) {
+                            if (ImPlot::ColormapButton(ImPlot::GetColormapName(map), button_size, map)) {
+                                data->density_volume.dvr.tf.colormap = map;
+                                data->density_volume.dvr.tf.dirty = true;
+                                ImGui::CloseCurrentPopup();
+                            }
+                        }
+                        ImGui::EndPopup();
+                    }
+                    if (ImGui::SliderFloat("Alpha Scaling", &data->density_volume.dvr.tf.alpha_scale, 0.001f, 10.f, "%.3f", ImGuiSliderFlags_Logarithmic)) {
+                        data->density_volume.dvr.tf.dirty = true;
+                    }
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Iso Surfaces", &data->density_volume.iso.enabled);
+                if (data->density_volume.iso.enabled) {
+                    ImGui::Indent();
+                    for (int i = 0; i < data->density_volume.iso.count; ++i) {
+                        ImGui::PushID(i);
+                        ImGui::SliderFloat("##Isovalue", &data->density_volume.iso.values[i], 0.0f, 10.f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                        if (ImGui::IsItemDeactivatedAfterEdit()) {
+                            // @TODO(Robin): Sort?
+                        }
+                        ImGui::SameLine();
+                        ImGui::ColorEdit4Minimal("##Color", data->density_volume.iso.colors[i].elem);
+                        ImGui::SameLine();
+                        if (ImGui::DeleteButton(ICON_FA_XMARK)) {
+                            for (int j = i; j < data->density_volume.iso.count - 1; ++j) {
+                                data->density_volume.iso.colors[j] = data->density_volume.iso.colors[j+1];
+                                data->density_volume.iso.values[j] = data->density_volume.iso.values[j+1];
+                            }
+                            data->density_volume.iso.count -= 1;
+                        }
+                        ImGui::PopID();
+                    }
+                    if ((data->density_volume.iso.count < (int)ARRAY_SIZE(data->density_volume.iso.values)) && ImGui::Button("Add", button_size)) {
+                        int idx = data->density_volume.iso.count++;
+                        data->density_volume.iso.values[idx] = 0.1f;
+                        data->density_volume.iso.colors[idx] = { 0.2f, 0.1f, 0.9f, 1.0f };
+                        // @TODO(Robin): Sort?
+                    }
+                        ImGui::SameLine();
+                    if (ImGui::Button("Clear", button_size)) {
+                        data->density_volume.iso.count = 0;
+                    }
+                    ImGui::Unindent();
+                }
+                ImGui::EndMenu();
+            }
+
+            if (ImGui::BeginMenu("Clip planes")) {
+                ImGui::RangeSliderFloat("x", &data->density_volume.clip_volume.min.x, &data->density_volume.clip_volume.max.x, 0.0f, 1.0f);
+                ImGui::RangeSliderFloat("y", &data->density_volume.clip_volume.min.y, &data->density_volume.clip_volume.max.y, 0.0f, 1.0f);
+                ImGui::RangeSliderFloat("z", &data->density_volume.clip_volume.min.z, &data->density_volume.clip_volume.max.z, 0.0f, 1.0f);
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Show")) {
+                ImGui::Checkbox("Bounding Box", &data->density_volume.show_bounding_box);
+                if (data->density_volume.show_bounding_box) {
+                    ImGui::Indent();
+                    ImGui::ColorEdit4("Color", data->density_volume.bounding_box_color.elem);
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Reference Structure", &data->density_volume.show_reference_structures);
+                if (data->density_volume.show_reference_structures) {
+                    ImGui::Indent();
+                    auto& rep = data->density_volume.rep;
+                    if (ImGui::Checkbox("Show Superimposed Structures", &data->density_volume.show_reference_ensemble)) {
+                        data->density_volume.dirty_rep = true;
+                    }
+                    if (ImGui::Combo("type", (int*)(&rep.type), "Space Fill\0Licorice\0Ball & Stick\0Ribbons\0Cartoon\0")) {
+                        data->density_volume.dirty_rep = true;
+                    }
+                    if (ImGui::Combo("color", (int*)(&rep.colormap), "Uniform Color\0CPK\0Atom Label\0Atom Idx\0Res Id\0Res Idx\0Chain Id\0Chain Idx\0Secondary Structure\0")) {
+                        data->density_volume.dirty_rep = true;
+                    }
+                    if (rep.colormap == ColorMapping::Uniform) {
+                        data->density_volume.dirty_rep |= ImGui::ColorEdit4("color", rep.color.elem, ImGuiColorEditFlags_NoInputs);
+                    }
+                    if (rep.type == RepresentationType::SpaceFill || rep.type == RepresentationType::Licorice) {
+                        data->density_volume.dirty_rep |= ImGui::SliderFloat("scale", &rep.param[0], 0.1f, 2.f);
+                    }
+                    if (rep.type == RepresentationType::Ribbons) {
+                        data->density_volume.dirty_rep |= ImGui::SliderFloat("width", &rep.param[0], 0.1f, 2.f);
+                        data->density_volume.dirty_rep |= ImGui::SliderFloat("thickness", &rep.param[1], 0.1f, 2.f);
+                    }
+                    if (rep.type == RepresentationType::Cartoon) {
+                        data->density_volume.dirty_rep |= ImGui::SliderFloat("coil scale",  &rep.param[0], 0.1f, 3.f);
+                        data->density_volume.dirty_rep |= ImGui::SliderFloat("sheet scale", &rep.param[1], 0.1f, 3.f);
+                        data->density_volume.dirty_rep |= ImGui::SliderFloat("helix scale", &rep.param[2], 0.1f, 3.f);
+                    }
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Legend", &data->density_volume.legend.enabled);
+                if (data->density_volume.legend.enabled) {
+                    ImGui::Indent();
+                    const char* colormap_modes[] = {"Opaque", "Transparent", "Split"};
+                    if (ImGui::BeginCombo("Colormap", colormap_modes[data->density_volume.legend.colormap_mode])) {
+                        for (int i = 0; i < IM_ARRAYSIZE(colormap_modes); ++i) {
+                            if (ImGui::Selectable(colormap_modes[i])) {
+                                data->density_volume.legend.colormap_mode = i;
+                            }
+                        }
+                        ImGui::EndCombo();
+                    }
+                    ImGui::Checkbox("Use Checkerboard", &data->density_volume.legend.checkerboard);
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("Use a checkerboard background for transparent parts in the legend.");
+                    }
+                    ImGui::Unindent();
+                }
+                ImGui::EndMenu();
+            }
+
+            ImGui::EndMenuBar();
+        }
+
+        update_density_volume(data);
+
+        /*
+        // Canvas
+        // Using InvisibleButton() as a convenience 1) it will advance the layout cursor and 2) allows us to use IsItemHovered()/IsItemActive()
+        ImVec2 canvas_p0 = ImGui::GetCursorScreenPos();      // ImDrawList API uses screen coordinates!
+        ImVec2 canvas_p1 = ImVec2(canvas_p0.x + canvas_sz.x, canvas_p0.y + canvas_sz.y);
+        */
+        ImVec2 canvas_sz = ImGui::GetContentRegionAvail();   // Resize canvas to what's available
+        canvas_sz.x = MAX(canvas_sz.x, 50.0f);
+        canvas_sz.y = MAX(canvas_sz.y, 50.0f);
+
+        // This will catch our interactions
+        ImGui::InvisibleButton("canvas", canvas_sz, ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonRight);
+
+        // Draw border and background color
+        ImGuiIO& io = ImGui::GetIO();
+
+        ImVec2 canvas_p0 = ImGui::GetItemRectMin();
+        ImVec2 canvas_p1 = ImGui::GetItemRectMax();
+
+        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        draw_list->AddImage((ImTextureID)(intptr_t)data->density_volume.fbo.deferred.post_tonemap, canvas_p0, canvas_p1, { 0,1 }, { 1,0 });
+        draw_list->AddRect(canvas_p0, canvas_p1, IM_COL32(50, 50, 50, 255));
+
+        if (data->density_volume.dvr.enabled && data->density_volume.legend.enabled) {
+            ImVec2 canvas_ext = canvas_p1 - canvas_p0;
+            ImVec2 cmap_ext = {MIN(canvas_ext.x * 0.5f, 250.0f), MIN(canvas_ext.y * 0.25f, 30.0f)};
+            ImVec2 cmap_pad = {10, 10};
+            ImVec2 cmap_pos = canvas_p1 - ImVec2(cmap_ext.x, cmap_ext.y) - cmap_pad;
+            ImPlotColormap cmap = data->density_volume.dvr.tf.colormap;
+            ImPlotContext& gp = *ImPlot::GetCurrentContext();
+            ImU32 checker_bg = IM_COL32(255, 255, 255, 255);
+            ImU32 checker_fg = IM_COL32(128, 128, 128, 255);
+            float checker_size = 8.0f;
+            ImVec2 checker_offset = ImVec2(0,0);
+
+            int mode = data->density_volume.legend.colormap_mode;
+
+            ImVec2 opaque_scl = ImVec2(1,1);
+            ImVec2 transp_scl = ImVec2(0,0);
+
+            if (mode == LegendColorMapMode_Split) {
+                opaque_scl = ImVec2(1.0f, 0.5f);
+                transp_scl = ImVec2(0.0f, 0.5f);
+            }
+
+            ImRect opaque_rect = ImRect(cmap_pos, cmap_pos + cmap_ext * opaque_scl);
+            ImRect transp_rect = ImRect(cmap_pos + cmap_ext * transp_scl, cmap_pos + cmap_ext);
+            
+            // Opaque
+            if (mode == LegendColorMapMode_Opaque || mode == LegendColorMapMode_Split) {
+                ImPlot::RenderColorBar(gp.ColormapData.GetKeys(cmap),gp.ColormapData.GetKeyCount(cmap),*draw_list,opaque_rect,false,false,!gp.ColormapData.IsQual(cmap));
+            }
+            
+            if (mode == LegendColorMapMode_Transparent || mode == LegendColorMapMode_Split) {
+                if (data->density_volume.legend.checkerboard) {
+                    // Checkerboard
+                    ImGui::DrawCheckerboard(draw_list, transp_rect.Min, transp_rect.Max, checker_bg, checker_fg, checker_size, checker_offset);
+                }
+                // Transparent
+                draw_list->AddImage((ImTextureID)(intptr_t)data->density_volume.dvr.tf.id, transp_rect.Min, transp_rect.Max);
+            }
+            
+            // Boarder
+            draw_list->AddRect(cmap_pos, cmap_pos + cmap_ext, IM_COL32(0, 0, 0, 255));
+        }
+
+        const bool is_hovered = ImGui::IsItemHovered();
+        const bool is_active = ImGui::IsItemActive();
+        const ImVec2 origin(canvas_p0.x, canvas_p0.y);  // Lock scrolled origin
+        const ImVec2 mouse_pos_in_canvas(io.MousePos.x - origin.x, io.MousePos.y - origin.y);
+
+        auto& gbuf = data->density_volume.fbo;
+        if (gbuf.width != canvas_sz.x || gbuf.height != canvas_sz.y) {
+            init_gbuffer(&gbuf, canvas_sz.x, canvas_sz.y);
+        }
+
+        static bool init = true;
+        if (init) {
+            const vec3_t ext = {10,10,10};
+            const vec3_t cen = {0.5f,0.5f,0.5f};
+            const vec3_t pos = cen + ext * vec3_t{1.0f,0.5f,0.7f} * 2.f;
+            const vec3_t up = {0,1,0};
+
+            data->density_volume.camera.position = pos;
+            data->density_volume.camera.focus_distance = vec3_length(pos - cen);
+            data->density_volume.camera.orientation = quat_from_mat4(mat4_look_at(data->density_volume.camera.position, cen, up));
+            init = false;
+        }
+
+        if (is_active || is_hovered) {
+            static const TrackballControllerParam param = {
+                .min_distance = 1.0,
+                .max_distance = 1000.0,
+            };
+
+            vec2_t delta = { io.MouseDelta.x, io.MouseDelta.y };
+            vec2_t curr = {mouse_pos_in_canvas.x, mouse_pos_in_canvas.y};
+            vec2_t prev = curr - delta;
+            float  wheel_delta = io.MouseWheel;
+
+            TrackballControllerInput input = {
+                .rotate_button = is_active && ImGui::IsMouseDown(ImGuiMouseButton_Left),
+                .pan_button    = is_active && ImGui::IsMouseDown(ImGuiMouseButton_Right),
+                .dolly_button  = is_active && ImGui::IsMouseDown(ImGuiMouseButton_Middle),
+                .dolly_delta   = is_hovered ? wheel_delta : 0.0f,
+                .mouse_coord_prev = prev,
+                .mouse_coord_curr = curr,
+                .screen_size = {canvas_sz.x, canvas_sz.y},
+                .fov_y = data->density_volume.camera.fov_y,
+            };
+            camera_controller_trackball(&data->density_volume.camera.position, &data->density_volume.camera.orientation, &data->density_volume.camera.focus_distance, input, param);
+        }
+
+        mat4_t view_mat = camera_world_to_view_matrix(data->density_volume.camera);
+        mat4_t proj_mat = camera_perspective_projection_matrix(data->density_volume.camera, (float)canvas_sz.x / (float)canvas_sz.y);
+        mat4_t inv_proj_mat = camera_inverse_perspective_projection_matrix(data->density_volume.camera, (float)canvas_sz.x / (float)canvas_sz.y);
+
+        clear_gbuffer(&gbuf);
+
+        glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
+        glClearColor(1, 1, 1, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+
+        const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY,
+            GL_COLOR_ATTACHMENT_PICKING, GL_COLOR_ATTACHMENT_POST_TONEMAP };
+
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf.deferred.fbo);
+        glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+        glViewport(0, 0, gbuf.width, gbuf.height);
+
+        const auto& ensemble = data->density_volume.ensemble;
+        if (data->density_volume.show_reference_structures && ensemble.num_atoms > 0) {
+            // The structures are already transformed onto the reference, so they are drawn as one
+            const mat4_t model_mat = mat4_ident();
+            md_gl_draw_op_t op = {};
+            op.type = (md_gl_representation_type_t)data->density_volume.rep.type;
+            MEMCPY(&op.args, data->density_volume.rep.param, sizeof(op.args));
+            op.rep = &ensemble.gl_rep;
+            op.model_matrix = &model_mat.elem[0][0];
+
+            md_gl_draw_args_t draw_args = {
+                .shaders = representation_shaders(data),
+                .draw_operations = {
+                    .count = 1,
+                    .ops = &op
+                },
+                .view_transform = {
+                    .view_matrix = &view_mat.elem[0][0],
+                    .projection_matrix = &proj_mat.elem[0][0],
+                },
+            };
+
+            md_gl_draw(&draw_args);
+
+            if (is_hovered) {
+                vec2_t coord = {mouse_pos_in_canvas.x, (float)gbuf.height - mouse_pos_in_canvas.y};
+                PickingData pd = read_picking_data(&gbuf, (int)coord.x, (int)coord.y);
+                if (pd.idx != INVALID_PICKING_IDX && pd.idx < ensemble.num_atoms) {
+                    draw_info_window(*data, ensemble.atom_src[pd.idx]);
+                }
+            }
+
+            glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
+
+            PUSH_GPU_SECTION("Postprocessing")
+                postprocessing::Descriptor postprocess_desc = {
+                .background = {
+                        .intensity = data->visuals.background.color * data->visuals.background.intensity,
+                },
+                .bloom = {
+                            .enabled = false,
+                },
+                .tonemapping = {
+                            .enabled = data->visuals.tonemapping.enabled,
+                            .mode = data->visuals.tonemapping.tonemapper,
+                            .exposure = data->visuals.tonemapping.exposure,
+                            .gamma = data->visuals.tonemapping.gamma,
+                },
+                .ambient_occlusion = {
+                            .enabled = data->visuals.ssao.enabled,
+                            .radius = data->visuals.ssao.radius,
+                            .intensity = data->visuals.ssao.intensity,
+                            .bias = data->visuals.ssao.bias,
+                },
+                .depth_of_field = {
+                            .enabled = data->visuals.dof.enabled,
+                            .focus_depth = data->visuals.dof.focus_depth,
+                            .focus_scale = data->visuals.dof.focus_scale,
+                },
+                .temporal_reprojection = {
+                            .enabled = false,
+                },
+                .input_textures = {
+                            .depth = gbuf.deferred.depth,
+                            .color = gbuf.deferred.color,
+                            .normal = gbuf.deferred.normal,
+                            .velocity = gbuf.deferred.velocity,
+                }
+            };
+
+            ViewParam view_param = {
+                .matrix = {
+                    .current = {
+                    .view = view_mat,
+                    .proj = proj_mat,
+                    .norm = view_mat,
+                },
+                .inverse = {
+                    .proj = inv_proj_mat,
+                }
+                },
+                .clip_planes = {
+                    .near = data->density_volume.camera.near_plane,
+                    .far = data->density_volume.camera.far_plane,
+                },
+                .fov_y = data->density_volume.camera.fov_y,
+                .resolution = {canvas_sz.x, canvas_sz.y}
+            };
+
+            postprocessing::shade_and_postprocess(postprocess_desc, view_param);
+            POP_GPU_SECTION()
+        }
+
+        glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+
+        if (data->density_volume.show_bounding_box) {
+            if (data->density_volume.model_mat != mat4_t{0}) {
+                const vec3_t min_box = {0,0,0};
+                const vec3_t max_box = {1,1,1};
+
+                immediate::set_model_view_matrix(mat4_mul(view_mat, data->density_volume.model_mat));
+                immediate::set_proj_matrix(proj_mat);
+
+                uint32_t box_color = convert_color(data->density_volume.bounding_box_color);
+                uint32_t clip_color = convert_color(data->density_volume.clip_volume_color);
+                immediate::draw_box_wireframe(min_box, max_box, box_color);
+                immediate::draw_box_wireframe(data->density_volume.clip_volume.min, data->density_volume.clip_volume.max, clip_color);
+
+                immediate::render();
+            }
+        }
+
+        if (data->density_volume.show_density_volume) {
+            if (data->density_volume.model_mat != mat4_t{ 0 }) {
+                volume::RenderDesc vol_desc = {
+                    .render_target = {
+                        .texture = gbuf.deferred.post_tonemap,
+                        .width   = gbuf.width,
+                        .height  = gbuf.height,
                     },
-                    {
-                        .values = values[1],
-                        .level_colors = colors[1],
-                        .contour_colors = lines[1],
-                        .count = count,
+                    .texture = {
+                        .volume = data->density_volume.volume_texture.id,
+                        .transfer_function = data->density_volume.dvr.tf.id,
+                        .depth = gbuf.deferred.depth,
                     },
-                    {
-                        .values = values[2],
-                        .level_colors = colors[2],
-                        .contour_colors = lines[2],
-                        .count = count,
+                    .matrix = {
+                        .model = data->density_volume.model_mat,
+                        .view = view_mat,
+                        .proj = proj_mat,
                     },
-                    {
-                        .values = values[3],
-                        .level_colors = colors[3],
-                        .contour_colors = lines[3],
-                        .count = count,
+                    .clip_volume = {
+                        .min = data->density_volume.clip_volume.min,
+                        .max = data->density_volume.clip_volume.max,
+                    },
+                    .bounding_box = {
+                        .color = data->density_volume.bounding_box_color,
+                        .enabled = data->density_volume.show_bounding_box,
+                    },
+                    .global_scaling = {
+                        .density = data->density_volume.density_scale,
+                    },
+                    .iso_surface = {
+                        .count = data->density_volume.iso.count,
+                        .values = data->density_volume.iso.values,
+                        .colors = data->density_volume.iso.colors,
+                    },
+                    .isosurface_enabled = data->density_volume.iso.enabled,
+                    .direct_volume_rendering_enabled = data->density_volume.dvr.enabled,
+
+                    .voxel_spacing = data->density_volume.voxel_spacing,
+                    .bricked = data->density_volume.bricks.volume.atlas ? &data->density_volume.bricks.volume : nullptr,
+                    .empty_space = {
+                        .grid = data->density_volume.empty_space_skipping && data->density_volume.macro_cells.texture ? &data->density_volume.macro_cells : nullptr,
+                        .transparent_below = data->density_volume.dvr.tf.transparent_below,
                     },
                 };
+                volume::render_volume(vol_desc);
+            }
+        }
 
-                rama_rep_render_iso(reps[i], viewport.elem, maps, tex_dim);
-            } else if (display_mode[i] == Colormap){
-                // Fill in colors based on active color_map
-                uint32_t colors[32] = {0};
-                uint32_t num_colors = ImPlot::GetColormapSize(colormap[i]);
-                for (uint32_t j = 0; j < num_colors; ++j) {
-                    colors[j] = ImPlot::GetColormapColorU32(j, colormap[i]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glDrawBuffer(GL_BACK);
+    }
+
+    ImGui::End();
+}
+
+static void draw_dataset_window(ApplicationData* data) {
+    ASSERT(data);
+
+    ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("Dataset", &data->dataset.show_window)) {
+        ImGui::Text("Molecular data: %s", data->files.molecule);
+        ImGui::Text("Num atoms:    %9i", (int)data->mold.mol.atom.count);
+        ImGui::Text("Num residues: %9i", (int)data->mold.mol.residue.count);
+        ImGui::Text("Num chains:   %9i", (int)data->mold.mol.chain.count);
+
+        if (data->files.trajectory[0] != '\0') {
+            ImGui::Separator();
+            ImGui::Text("Trajectory data: %s", data->files.trajectory);
+            ImGui::Text("Num frames:    %9i", (int)md_trajectory_num_frames(data->mold.traj));
+            ImGui::Text("Num atoms:     %9i", (int)md_trajectory_num_atoms(data->mold.traj));
+        }
+
+        const char* lbls[] = {"Chains", "Residue Names", "Atom Labels"};
+        const md_array(DatasetItem) items[] = {data->dataset.chains, data->dataset.residue_names, data->dataset.atom_types};
+        STATIC_ASSERT(ARRAY_SIZE(lbls) == ARRAY_SIZE(items));
+
+        const ImVec2 item_size = ImVec2(ImGui::GetFontSize() * 1.8f, ImGui::GetFontSize() * 1.1f);
+        const float window_x_max = ImGui::GetWindowPos().x + ImGui::GetWindowContentRegionMax().x;
+        for (size_t i = 0; i < ARRAY_SIZE(lbls); ++i) {
+            const size_t count = md_array_size(items[i]);
+            if (count) {
+                if (ImGui::CollapsingHeader(lbls[i])) {
+                    for (size_t j = 0; j < count; ++j) {
+                        const DatasetItem& item = items[i][j];
+                        const float t = powf(item.fraction, 0.2f) * 0.5f;
+                        ImGui::PushStyleColor(ImGuiCol_Header, ImPlot::SampleColormap(t, ImPlotColormap_Plasma));
+                        ImGui::Selectable(item.label, true, 0, item_size);
+                        ImGui::PopStyleColor();
+
+                        if (ImGui::IsItemHovered()) {
+                            ImGui::SetTooltip("%s: count %d", item.label, item.count);
+                            if (filter_expression(data, str_from_cstr(item.query), versioned_bitfield_modify(&data->selection.current_highlight_mask))) {
+                                data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                            }
+                        }
+
+                        float last_item_x = ImGui::GetItemRectMax().x;
+                        float next_button_x = last_item_x + item_size.x;
+                        if (j + 1 < count && next_button_x < window_x_max) {
+                            ImGui::SameLine();
+                        }
+                    }
+                }
+            }
+        }
+
+        const size_t num_mappings = md_array_size(data->dataset.atom_element_remappings);
+        if (num_mappings) {
+            if (ImGui::CollapsingHeader("Atom Element Mappings")) {
+                for (size_t i = 0; i < num_mappings; ++i) {
+                    const auto& mapping = data->dataset.atom_element_remappings[i];
+                    ImGui::Text("%s -> %s (%s)", mapping.lbl, md_util_element_name(mapping.elem).ptr, md_util_element_symbol(mapping.elem).ptr);
                 }
-                // Mask off the first color to be transparent
-                colors[0] = colors[0] & 0x00FFFFFFU;
-
-                rama_colormap_t maps[4] = {
-                    {
-                        .colors = colors,
-                        .count = num_colors,
-                        .min_value = 0,
-                        .max_value = 0.5f * scl[i][0],
-                    },
-                    {
-                        .colors = colors,
-                        .count = num_colors,
-                        .min_value = 0,
-                        .max_value = 0.5f * scl[i][1],
-                    },
-                    {
-                        .colors = colors,
-                        .count = num_colors,
-                        .min_value = 0,
-                        .max_value = 0.5f * scl[i][2],
-                    },
-                    {
-                        .colors = colors,
-                        .count = num_colors,
-                        .min_value = 0,
-                        .max_value = 0.5f * scl[i][3],
-                    },
-                };
-                rama_rep_render_map(reps[i], viewport.elem, maps, tex_dim);
             }
         }
+    }
+    ImGui::End();
+}
 
-        POP_GPU_SECTION();
+// One column per timer, labeled with the path of sections it is nested in, and one row per frame from the oldest
+static bool write_gpu_timings_csv(str_t path) {
+    size_t num_timers = 0;
+    const gpu_timing::Timer* timers = gpu_timing::timers(&num_timers);
+    const uint32_t num_rows = gpu_timing::history_count();
+    if (num_timers == 0 || num_rows == 0) {
+        LOG_ERROR("No GPU timings have been recorded");
+        return false;
+    }
 
-        ImPlot::MapInputDefault();
+    str_t* labels = (str_t*)md_alloc(frame_allocator, sizeof(str_t) * num_timers);
+    float** columns = (float**)md_alloc(frame_allocator, sizeof(float*) * num_timers);
+    const uint32_t beg = (gpu_timing::history_head() + GPU_TIMING_HISTORY - num_rows) % GPU_TIMING_HISTORY;
+    for (size_t i = 0; i < num_timers; ++i) {
+        md_strb_t sb = md_strb_create(frame_allocator);
+        const char* path_labels[GPU_TIMING_MAX_DEPTH] = {};
+        uint32_t depth = 0;
+        for (uint32_t t = (uint32_t)i + 1; t && depth < GPU_TIMING_MAX_DEPTH; t = timers[t - 1].parent) {
+            path_labels[depth++] = timers[t - 1].label;
+        }
+        while (depth > 0) {
+            md_strb_fmt(&sb, "%s%s", path_labels[depth - 1], depth > 1 ? "/" : "");
+            depth -= 1;
+        }
+        labels[i] = md_strb_to_str(&sb);
+
+        columns[i] = (float*)md_alloc(frame_allocator, sizeof(float) * num_rows);
+        for (uint32_t j = 0; j < num_rows; ++j) {
+            columns[i][j] = timers[i].history[(beg + j) % GPU_TIMING_HISTORY];
+        }
     }
-    ImGui::End();
+    return table_write_text(path, table_csv_header(labels, num_timers, frame_allocator), columns, num_timers, num_rows, TableTextFormat_CSV);
 }
 
-static void draw_density_volume_window(ApplicationData* data) {
+static void draw_debug_window(ApplicationData* data) {
+    ASSERT(data);
+
     ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
-    if (ImGui::Begin("Density Volume", &data->density_volume.show_window, ImGuiWindowFlags_MenuBar)) {
-        const ImVec2 button_size = {160, 0};
+    if (ImGui::Begin("Debug", &data->show_debug_window)) {
+        size_t sema_count = 0;
+        if (md_semaphore_query_count(&data->mold.script.ir_semaphore, &sema_count)) {
+            ImGui::Text("Script IR semaphore count: %zu", sema_count);
+        }
+        
+        task_system::ID* tasks = task_system::pool_running_tasks(md_heap_allocator);
+        int64_t num_tasks = md_array_size(tasks);
+        if (num_tasks > 0) {
+            ImGui::Text("Running Pool Tasks:");
+            for (size_t i = 0; i < md_array_size(tasks); ++i) {
+                str_t lbl = task_system::task_label(tasks[i]);
+                ImGui::Text("[%i]: %.*s", (int)i, (int)lbl.len, lbl.ptr);
+            }
+        }
 
-        if (ImGui::IsWindowFocused() && ImGui::IsKeyPressed(KEY_PLAY_PAUSE, false)) {
-            data->animation.mode = data->animation.mode == PlaybackMode::Playing ? PlaybackMode::Stopped : PlaybackMode::Playing;
+        if (data->mold.traj) {
+            load::traj::ReadAheadStats stats = {};
+            if (load::traj::get_read_ahead_stats(&stats, data->mold.traj)) {
+                ImGui::Separator();
+                ImGui::Text("Frame cache: %zu frames", load::traj::num_cache_frames(data->mold.traj));
+                ImGui::SliderInt("Read-ahead I/O depth", &data->animation.read_ahead.io_depth, 1, 256);
+                ImGui::Checkbox("Auto read-ahead depth", &data->animation.read_ahead.auto_depth);
+                ImGui::BeginDisabled(data->animation.read_ahead.auto_depth);
+                ImGui::SliderInt("Read-ahead decode depth", &data->animation.read_ahead.decode_depth, 1, 1024);
+                ImGui::EndDisabled();
+                ImGui::Text("Fetched: %zu frames (%.2f MB), %.2f MB/s", stats.frames_fetched, (double)stats.bytes_fetched / (1024.0 * 1024.0), stats.fetch_mb_per_sec);
+                ImGui::Text("Decoded: %zu frames, %.2f frames/s", stats.frames_decoded, stats.decode_frames_per_sec);
+                ImGui::Text("Stolen by decode stage: %zu frames", stats.frames_stolen);
+                ImGui::Separator();
+            }
         }
 
-        if (ImGui::BeginMenuBar()) {
-            if (ImGui::BeginMenu("Property")) {
-                int64_t selected_index = -1;
-                int64_t candidate_count = 0;
-                for (int64_t i = 0; i < (int64_t)md_array_size(data->display_properties); ++i) {
-                    DisplayProperty& dp = data->display_properties[i];
-                    if (dp.type != DisplayProperty::Type_Volume) continue;
-                    // @TODO(Robin): This is a hack to hide the filter property when not enabled. This should not be hardcoded in the future...
-                    if (!data->timeline.filter.enabled && str_eq(md_script_eval_label(dp.eval), STR("filt"))) {
-                        continue;
+        if (ImGui::TreeNode("Memory")) {
+            MemoryTrackerStats stats[MemoryTracker_Count];
+            memory_tracker_stats(stats);
+            if (ImGui::BeginTable("##memory", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+                ImGui::TableSetupColumn("Subsystem");
+                ImGui::TableSetupColumn("Current (MB)");
+                ImGui::TableSetupColumn("Peak (MB)");
+                ImGui::TableSetupColumn("Rate (MB/s)");
+                ImGui::TableHeadersRow();
+                for (int i = 0; i < MemoryTracker_Count; ++i) {
+                    const MemoryTrackerStats& s = stats[i];
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(s.name);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", (double)s.current / (1024.0 * 1024.0));
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", (double)s.peak / (1024.0 * 1024.0));
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", s.bytes_per_sec / (1024.0 * 1024.0));
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("%llu allocations, %.1f allocations/s", (unsigned long long)s.num_allocs, s.allocs_per_sec);
                     }
-                    ImPlot::ItemIcon(dp.color); ImGui::SameLine();
-                    if (ImGui::Selectable(dp.label, dp.show_in_volume)) {
-                        selected_index = i;
+                }
+                ImGui::EndTable();
+            }
+            const FrameArenaStats arena = frame_arena_stats(&frame_arena);
+            ImGui::Text("Frame arena: %.2f / %.2f MB in %u block(s), high water %.2f MB (last frame %.2f MB), grown %llu times",
+                (double)arena.used / (1024.0 * 1024.0), (double)arena.capacity / (1024.0 * 1024.0), arena.num_blocks,
+                (double)arena.high_water / (1024.0 * 1024.0), (double)arena.frame_high_water / (1024.0 * 1024.0), (unsigned long long)arena.num_grows);
+            ImGui::Text("Frame scratch slots: %.2f MB", (double)frame_scratch_memory_usage() / (1024.0 * 1024.0));
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("GPU Timings")) {
+            bool record = gpu_timing::enabled();
+            if (ImGui::Checkbox("Record", &record)) {
+                gpu_timing::set_enabled(record);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) {
+                gpu_timing::clear_history();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Export CSV")) {
+                char path_buf[1024] = "";
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "csv")) {
+                    size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                    if (!extract_ext(NULL, {path_buf, path_len})) {
+                        path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".csv");
                     }
-                    if (ImGui::IsItemHovered()) {
-                        visualize_payload(data, dp.prop->vis_payload, 0, MD_SCRIPT_VISUALIZE_DEFAULT);
-                        set_hovered_property(data,  str_from_cstr(dp.label));
+                    if (write_gpu_timings_csv({path_buf, path_len})) {
+                        LOG_SUCCESS("Wrote GPU timings to '%.*s'", (int)path_len, path_buf);
                     }
-                    candidate_count += 1;
                 }
+            }
 
-                if (candidate_count == 0) {
-                    ImGui::Text("No volume properties available.");
+            size_t num_timers = 0;
+            const gpu_timing::Timer* timers = gpu_timing::timers(&num_timers);
+            const uint32_t count = gpu_timing::history_count();
+            // The oldest sample is at the head once the ring is full, otherwise at 0
+            const int offset = count == GPU_TIMING_HISTORY ? (int)gpu_timing::history_head() : 0;
+            if (num_timers > 0 && count > 0 && ImGui::BeginTable("##gpu timings", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+                ImGui::TableSetupColumn("Section");
+                ImGui::TableSetupColumn("Avg (ms)");
+                ImGui::TableSetupColumn("History");
+                ImGui::TableHeadersRow();
+                for (size_t i = 0; i < num_timers; ++i) {
+                    const gpu_timing::Timer& t = timers[i];
+                    float max_ms = 0.0f;
+                    for (uint32_t j = 0; j < count; ++j) max_ms = MAX(max_ms, t.history[j]);
+                    ImGui::PushID((int)i);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Indent(t.depth * ImGui::GetStyle().IndentSpacing + 1.0f);
+                    ImGui::TextUnformatted(t.label);
+                    ImGui::Unindent(t.depth * ImGui::GetStyle().IndentSpacing + 1.0f);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3f", t.avg_ms);
+                    ImGui::TableNextColumn();
+                    ImGui::SetNextItemWidth(-1.0f);
+                    ImGui::PlotLines("##history", t.history, (int)count, offset, NULL, 0.0f, MAX(max_ms, 0.01f), ImVec2(0, ImGui::GetTextLineHeight() * 1.5f));
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("Max: %.3f ms", max_ms);
+                    }
+                    ImGui::PopID();
                 }
+                ImGui::EndTable();
+            }
+            ImGui::TreePop();
+        }
 
-                // Currently we only support viewing one volume at a time.
-                // This will probably change over time but not now.
-                if (selected_index != -1) {
-                    for (int64_t i = 0; i < (int64_t)md_array_size(data->display_properties); ++i) {
-                        if (selected_index == i) {
-                            // Toggle bool
-                            data->display_properties[i].show_in_volume = !data->display_properties[i].show_in_volume;
-                        } else {
-                            data->display_properties[i].show_in_volume = false;
-                        }
+        if (ImGui::TreeNode("CPU Zones")) {
+#if VIAMD_CPU_PROFILER
+            // Beginning of the inspected frame, 0 follows the latest frame
+            static int64_t selected_beg = 0;
+            bool record = cpu_profiler::enabled();
+            if (ImGui::Checkbox("Record", &record)) {
+                cpu_profiler::set_enabled(record);
+                if (record) selected_beg = 0;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) {
+                cpu_profiler::clear();
+                selected_beg = 0;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Save trace")) {
+                char path_buf[1024] = "";
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "json")) {
+                    size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                    if (!extract_ext(NULL, {path_buf, path_len})) {
+                        path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".json");
+                    }
+                    if (cpu_profiler::write_chrome_json({path_buf, path_len})) {
+                        LOG_SUCCESS("Wrote CPU zones to '%.*s'", (int)path_len, path_buf);
                     }
                 }
-                ImGui::EndMenu();
             }
-            if (ImGui::BeginMenu("Render")) {
-                ImGui::SliderFloat("Density Scaling", &data->density_volume.density_scale, 0.001f, 10000.f, "%.3f", ImGuiSliderFlags_Logarithmic);
-                ImGui::Checkbox("Direct Volume Rendering", &data->density_volume.dvr.enabled);
-                if (data->density_volume.dvr.enabled) {
-                    ImGui::Indent();
-                    if (ImPlot::ColormapButton(ImPlot::GetColormapName(data->density_volume.dvr.tf.colormap), button_size, data->density_volume.dvr.tf.colormap)) {
-                        ImGui::OpenPopup("Colormap Selector");
+
+            cpu_profiler::Frame frames[CPU_PROFILER_HISTORY];
+            const size_t num_frames = cpu_profiler::frames(frames, ARRAY_SIZE(frames));
+            if (num_frames > 0) {
+                float frame_ms[CPU_PROFILER_HISTORY];
+                size_t selected = num_frames - 1;
+                size_t slowest = 0;
+                for (size_t i = 0; i < num_frames; ++i) {
+                    frame_ms[i] = (float)(md_time_as_seconds(frames[i].end_time - frames[i].beg_time) * 1000.0);
+                    if (frame_ms[i] > frame_ms[slowest]) slowest = i;
+                    if (frames[i].beg_time == selected_beg) selected = i;
+                }
+
+                // Selecting a frame stops the recording, so its zones are not overwritten while it is inspected
+                ImGui::SameLine();
+                if (ImGui::Button("Slowest")) {
+                    selected = slowest;
+                    selected_beg = frames[selected].beg_time;
+                    cpu_profiler::set_enabled(false);
+                }
+                ImGui::PlotHistogram("##frames", frame_ms, (int)num_frames, 0, NULL, 0.0f, MAX(frame_ms[slowest], 0.01f), ImVec2(-1.0f, ImGui::GetTextLineHeight() * 3.0f));
+                if (ImGui::IsItemHovered() || ImGui::IsItemClicked()) {
+                    const ImVec2 min = ImGui::GetItemRectMin();
+                    const ImVec2 max = ImGui::GetItemRectMax();
+                    const float t = (ImGui::GetMousePos().x - min.x) / MAX(max.x - min.x, 1.0f);
+                    const size_t idx = (size_t)CLAMP(t * (float)num_frames, 0.0f, (float)(num_frames - 1));
+                    if (ImGui::IsItemClicked()) {
+                        selected = idx;
+                        selected_beg = frames[selected].beg_time;
+                        cpu_profiler::set_enabled(false);
+                    } else {
+                        ImGui::SetTooltip("%.3f ms", frame_ms[idx]);
                     }
-                    if (ImGui::BeginPopup("Colormap Selector")) {
-                        for (int map = 4; map < ImPlot::GetColormapCount(); ++map) {
-                            if (ImPlot::ColormapButton(ImPlot::GetColormapName(map), button_size, map)) {
-                                data->density_volume.dvr.tf.colormap = map;
-                                data->density_volume.dvr.tf.dirty = true;
-                                ImGui::CloseCurrentPopup();
-                            }
-                        }
-                        ImGui::EndPopup();
+                }
+
+                const cpu_profiler::Frame& frame = frames[selected];
+                const double frame_s = md_time_as_seconds(frame.end_time - frame.beg_time);
+                ImGui::Text("Frame: %.3f ms, slowest of the last %zu frames: %.3f ms", frame_s * 1000.0, num_frames, frame_ms[slowest]);
+
+                const size_t capacity = 65536;
+                cpu_profiler::Zone* zones = (cpu_profiler::Zone*)md_alloc(frame_allocator, sizeof(cpu_profiler::Zone) * capacity);
+                const size_t num_zones = cpu_profiler::zones(zones, capacity, frame.beg_time, frame.end_time);
+
+                // One row per thread with a lane per depth of zones, where the zones within each lane are nested in the lane above
+                uint32_t num_lanes[CPU_PROFILER_MAX_THREADS] = {};
+                for (size_t i = 0; i < num_zones; ++i) {
+                    num_lanes[zones[i].thread_idx] = MAX(num_lanes[zones[i].thread_idx], (uint32_t)zones[i].depth + 1);
+                }
+                float row_offset[CPU_PROFILER_MAX_THREADS] = {};
+                const float lane_height = ImGui::GetTextLineHeight() + 2.0f;
+                float height = 0.0f;
+                for (uint32_t t = 0; t < CPU_PROFILER_MAX_THREADS; ++t) {
+                    row_offset[t] = height;
+                    height += num_lanes[t] ? num_lanes[t] * lane_height + 2.0f : 0.0f;
+                }
+
+                const ImVec2 size = {ImGui::GetContentRegionAvail().x, MAX(height, lane_height)};
+                const ImVec2 p0 = ImGui::GetCursorScreenPos();
+                const ImVec2 p1 = {p0.x + size.x, p0.y + size.y};
+                ImGui::InvisibleButton("##flame graph", size);
+                const bool hovered = ImGui::IsItemHovered();
+                const ImVec2 mouse = ImGui::GetMousePos();
+
+                ImDrawList* dl = ImGui::GetWindowDrawList();
+                dl->AddRectFilled(p0, p1, ImGui::GetColorU32(ImGuiCol_FrameBg));
+                dl->PushClipRect(p0, p1, true);
+                const double scale = size.x / MAX(frame_s, 1.0e-6);
+                const cpu_profiler::Zone* hovered_zone = nullptr;
+                for (size_t i = 0; i < num_zones; ++i) {
+                    const cpu_profiler::Zone& z = zones[i];
+                    const double beg = md_time_as_seconds(z.beg_time - frame.beg_time);
+                    const double end = md_time_as_seconds(z.end_time - frame.beg_time);
+                    const float x0 = p0.x + (float)(MAX(beg, 0.0) * scale);
+                    const float x1 = MAX(p0.x + (float)(MIN(end, frame_s) * scale), x0 + 1.0f);
+                    const float y0 = p0.y + row_offset[z.thread_idx] + z.depth * lane_height;
+                    const float y1 = y0 + lane_height - 1.0f;
+                    const ImU32 col = (ImHashStr(z.label) & 0x00FFFFFF) | 0xC0000000;
+                    dl->AddRectFilled({x0, y0}, {x1, y1}, col);
+                    if (x1 - x0 > ImGui::CalcTextSize(z.label).x) {
+                        dl->AddText({x0 + 1.0f, y0 + 1.0f}, IM_COL32_BLACK, z.label);
                     }
-                    if (ImGui::SliderFloat("Alpha Scaling", &data->density_volume.dvr.tf.alpha_scale, 0.001f, 10.f, "%.3f", ImGuiSliderFlags_Logarithmic)) {
-                        data->density_volume.dvr.tf.dirty = true;
+                    if (hovered && x0 <= mouse.x && mouse.x <= x1 && y0 <= mouse.y && mouse.y <= y1) {
+                        hovered_zone = &z;
                     }
-                    ImGui::Unindent();
                 }
-                ImGui::Checkbox("Iso Surfaces", &data->density_volume.iso.enabled);
-                if (data->density_volume.iso.enabled) {
-                    ImGui::Indent();
-                    for (int i = 0; i < data->density_volume.iso.count; ++i) {
-                        ImGui::PushID(i);
-                        ImGui::SliderFloat("##Isovalue", &data->density_volume.iso.values[i], 0.0f, 10.f, "%.3f", ImGuiSliderFlags_Logarithmic);
-                        if (ImGui::IsItemDeactivatedAfterEdit()) {
-                            // @TODO(Robin): Sort?
-                        }
-                        ImGui::SameLine();
-                        ImGui::ColorEdit4Minimal("##Color", data->density_volume.iso.colors[i].elem);
-                        ImGui::SameLine();
-                        if (ImGui::DeleteButton(ICON_FA_XMARK)) {
-                            for (int j = i; j < data->density_volume.iso.count - 1; ++j) {
-                                data->density_volume.iso.colors[j] = data->density_volume.iso.colors[j+1];
-                                data->density_volume.iso.values[j] = data->density_volume.iso.values[j+1];
-                            }
-                            data->density_volume.iso.count -= 1;
-                        }
-                        ImGui::PopID();
+                dl->PopClipRect();
+                if (hovered_zone) {
+                    const cpu_profiler::Zone& z = *hovered_zone;
+                    const double dur = md_time_as_seconds(z.end_time - z.beg_time);
+                    ImGui::SetTooltip("%s\nThread: %u\nDuration: %.3f ms (%.1f%% of the frame)", z.label, z.thread_idx, dur * 1000.0, dur / MAX(frame_s, 1.0e-6) * 100.0);
+                }
+                ImGui::Text("Zones: %zu", num_zones);
+            }
+#else
+            ImGui::TextDisabled("Built without CPU zones (VIAMD_CPU_PROFILER)");
+#endif
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Scratch Arenas")) {
+            for (size_t i = 0; i < task_system::scratch_num_arenas(); ++i) {
+                task_system::ScratchStats stats = {};
+                if (task_system::scratch_stats(&stats, i)) {
+                    ImGui::Text("[%i]: high water %.2f / %.2f MB, heap fallbacks %llu", (int)i, (double)stats.high_water / (1024.0 * 1024.0), (double)stats.capacity / (1024.0 * 1024.0), (unsigned long long)stats.fallbacks);
+                }
+            }
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Task Trace")) {
+            static float window_s = 2.0f;
+            bool record = task_system::trace_enabled();
+            if (ImGui::Checkbox("Record", &record)) {
+                task_system::trace_set_enabled(record);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) {
+                task_system::trace_clear();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Save trace")) {
+                char path_buf[1024] = "";
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "json")) {
+                    size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                    if (!extract_ext(NULL, {path_buf, path_len})) {
+                        path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".json");
                     }
-                    if ((data->density_volume.iso.count < (int)ARRAY_SIZE(data->density_volume.iso.values)) && ImGui::Button("Add", button_size)) {
-                        int idx = data->density_volume.iso.count++;
-                        data->density_volume.iso.values[idx] = 0.1f;
-                        data->density_volume.iso.colors[idx] = { 0.2f, 0.1f, 0.9f, 1.0f };
-                        // @TODO(Robin): Sort?
+                    if (task_system::trace_write_chrome_json({path_buf, path_len})) {
+                        LOG_SUCCESS("Wrote task trace to '%.*s'", (int)path_len, path_buf);
                     }
-                        ImGui::SameLine();
-                    if (ImGui::Button("Clear", button_size)) {
-                        data->density_volume.iso.count = 0;
+                }
+            }
+            ImGui::SliderFloat("Window (s)", &window_s, 0.1f, 10.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+
+            const size_t capacity = task_system::trace_capacity();
+            task_system::TraceEvent* events = (task_system::TraceEvent*)md_alloc(md_heap_allocator, sizeof(task_system::TraceEvent) * capacity);
+            defer { md_free(md_heap_allocator, events, sizeof(task_system::TraceEvent) * capacity); };
+            const size_t num_events = task_system::trace_events(events, capacity);
+
+            // One row per thread of the pool, where row 0 is the main thread
+            const uint32_t num_rows = task_system::pool_num_threads();
+            const float row_height = ImGui::GetTextLineHeight() + 2.0f;
+            const ImVec2 size = {ImGui::GetContentRegionAvail().x, row_height * num_rows};
+            const ImVec2 p0 = ImGui::GetCursorScreenPos();
+            const ImVec2 p1 = {p0.x + size.x, p0.y + size.y};
+            ImGui::InvisibleButton("##timeline", size);
+            const bool hovered = ImGui::IsItemHovered();
+            const ImVec2 mouse = ImGui::GetMousePos();
+
+            ImDrawList* dl = ImGui::GetWindowDrawList();
+            dl->AddRectFilled(p0, p1, ImGui::GetColorU32(ImGuiCol_FrameBg));
+            const md_timestamp_t now = md_time_current();
+            const double scale = size.x / window_s;
+            const task_system::TraceEvent* hovered_event = nullptr;
+            for (size_t i = 0; i < num_events; ++i) {
+                const task_system::TraceEvent& e = events[i];
+                if (e.thread_idx >= num_rows) continue;
+                const double beg = window_s - md_time_as_seconds(now - e.beg_time);
+                const double end = window_s - md_time_as_seconds(now - e.end_time);
+                if (end < 0.0) continue;
+                const float x0 = p0.x + (float)(MAX(beg, 0.0) * scale);
+                const float x1 = MAX(p0.x + (float)(end * scale), x0 + 1.0f);
+                const float y0 = p0.y + e.thread_idx * row_height;
+                const float y1 = y0 + row_height - 1.0f;
+                const ImU32 col = (ImHashStr(e.label) & 0x00FFFFFF) | 0xC0000000;
+                dl->AddRectFilled({x0, y0}, {x1, y1}, col);
+                if (x1 - x0 > ImGui::CalcTextSize(e.label).x) {
+                    dl->AddText({x0 + 1.0f, y0 + 1.0f}, IM_COL32_BLACK, e.label);
+                }
+                if (hovered && x0 <= mouse.x && mouse.x <= x1 && y0 <= mouse.y && mouse.y <= y1) {
+                    hovered_event = &e;
+                }
+            }
+            if (hovered_event) {
+                const task_system::TraceEvent& e = *hovered_event;
+                ImGui::SetTooltip("%s\nThread: %u\nDuration: %.3f ms\nQueued: %.3f ms\nRange: %u", e.label, e.thread_idx,
+                    md_time_as_seconds(e.end_time - e.beg_time) * 1000.0, md_time_as_seconds(e.beg_time - e.enqueue_time) * 1000.0, e.range_size);
+            }
+            ImGui::Text("Events: %zu / %zu", num_events, capacity);
+            ImGui::TreePop();
+        }
+
+        ImGuiID active = ImGui::GetActiveID();
+        ImGuiID hover  = ImGui::GetHoveredID();
+        ImGui::Text("Active ID: %u, Hover ID: %u", active, hover);
+
+        ImGui::Text("Mouse Pos: (%.3f, %.3f)", ImGui::GetMousePos().x, ImGui::GetMousePos().y);
+        ImGui::Text("Camera Position: (%.3f, %.3f, %.3f)", data->view.camera.position.x, data->view.camera.position.y, data->view.camera.position.z);
+        ImGui::Text("Camera Orientation: (%.3f, %.3f, %.3f, %.3f)", data->view.camera.orientation.x, data->view.camera.orientation.y, data->view.camera.orientation.z, data->view.camera.orientation.w);
+
+		ImGui::Text("proj_matrix:");
+    }
+    ImGui::End();
+}
+
+static void draw_script_editor_window(ApplicationData* data) {
+    ASSERT(data);
+
+    ImGui::SetNextWindowSize({300,200}, ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("Script Editor", &data->show_script_window, ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_MenuBar)) {
+        ImGui::SetWindowSize(ImVec2(800, 600), ImGuiCond_FirstUseEver);
+        if (ImGui::BeginMenuBar())
+        {
+            if (ImGui::BeginMenu("File")) {
+                char path_buf[1024] = "";
+                if (ImGui::MenuItem("Load")) {
+                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Open, "txt")) {
+                        str_t txt = load_textfile(str_from_cstr(path_buf), frame_allocator);
+                        std::string str(txt.ptr, txt.len);
+                        editor.SetText(str);
+                    }
+                }
+                if (ImGui::MenuItem("Save")) {
+                    auto textToSave = editor.GetText();
+                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "txt")) {
+                        size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                        str_t path = str_t{path_buf, path_len};
+                        if (!extract_ext(NULL, path)) {
+                            path.len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".txt");
+                        }
+                        md_file_o* file = md_file_open(path, MD_FILE_WRITE);
+                        if (file) {
+                            md_file_write(file, textToSave.c_str(), textToSave.length());
+                            md_file_close(file);
+                        } else {
+                            LOG_ERROR("Failed to open file '%s' for saving script", path_buf);
+                        }
                     }
-                    ImGui::Unindent();
+                }
+                if (ImGui::MenuItem("Export")) {
+                    data->show_property_export_window = true;
                 }
                 ImGui::EndMenu();
             }
+            if (ImGui::BeginMenu("Edit")) {
+                bool ro = editor.IsReadOnly();
+                if (ImGui::MenuItem("Read-only mode", nullptr, &ro))
+                    editor.SetReadOnly(ro);
+                ImGui::Separator();
+
+                if (ImGui::MenuItem("Undo", "ALT-Backspace", nullptr, !ro && editor.CanUndo()))
+                    editor.Undo();
+                if (ImGui::MenuItem("Redo", "Ctrl-Y", nullptr, !ro && editor.CanRedo()))
+                    editor.Redo();
+
+                ImGui::Separator();
+
+                if (ImGui::MenuItem("Copy", "Ctrl-C", nullptr, editor.HasSelection()))
+                    editor.Copy();
+                if (ImGui::MenuItem("Cut", "Ctrl-X", nullptr, !ro && editor.HasSelection()))
+                    editor.Cut();
+                if (ImGui::MenuItem("Delete", "Del", nullptr, !ro && editor.HasSelection()))
+                    editor.Delete();
+                if (ImGui::MenuItem("Paste", "Ctrl-V", nullptr, !ro && ImGui::GetClipboardText() != nullptr))
+                    editor.Paste();
+
+                ImGui::Separator();
+
+                if (ImGui::MenuItem("Select all", nullptr, nullptr))
+                    editor.SetSelection(TextEditor::Coordinates(), TextEditor::Coordinates(editor.GetTotalLines(), 0));
 
-            if (ImGui::BeginMenu("Clip planes")) {
-                ImGui::RangeSliderFloat("x", &data->density_volume.clip_volume.min.x, &data->density_volume.clip_volume.max.x, 0.0f, 1.0f);
-                ImGui::RangeSliderFloat("y", &data->density_volume.clip_volume.min.y, &data->density_volume.clip_volume.max.y, 0.0f, 1.0f);
-                ImGui::RangeSliderFloat("z", &data->density_volume.clip_volume.min.z, &data->density_volume.clip_volume.max.z, 0.0f, 1.0f);
                 ImGui::EndMenu();
             }
-            if (ImGui::BeginMenu("Show")) {
-                ImGui::Checkbox("Bounding Box", &data->density_volume.show_bounding_box);
-                if (data->density_volume.show_bounding_box) {
-                    ImGui::Indent();
-                    ImGui::ColorEdit4("Color", data->density_volume.bounding_box_color.elem);
-                    ImGui::Unindent();
-                }
-                ImGui::Checkbox("Reference Structure", &data->density_volume.show_reference_structures);
-                if (data->density_volume.show_reference_structures) {
-                    ImGui::Indent();
-                    auto& rep = data->density_volume.rep;
-                    ImGui::Checkbox("Show Superimposed Structures", &data->density_volume.show_reference_ensemble);
-                    if (ImGui::Combo("type", (int*)(&rep.type), "Space Fill\0Licorice\0Ball & Stick\0Ribbons\0Cartoon\0")) {
-                        data->density_volume.dirty_rep = true;
-                    }
-                    if (ImGui::Combo("color", (int*)(&rep.colormap), "Uniform Color\0CPK\0Atom Label\0Atom Idx\0Res Id\0Res Idx\0Chain Id\0Chain Idx\0Secondary Structure\0")) {
-                        data->density_volume.dirty_rep = true;
-                    }
-                    if (rep.colormap == ColorMapping::Uniform) {
-                        data->density_volume.dirty_rep |= ImGui::ColorEdit4("color", rep.color.elem, ImGuiColorEditFlags_NoInputs);
-                    }
-                    if (rep.type == RepresentationType::SpaceFill || rep.type == RepresentationType::Licorice) {
-                        data->density_volume.dirty_rep |= ImGui::SliderFloat("scale", &rep.param[0], 0.1f, 2.f);
-                    }
-                    if (rep.type == RepresentationType::Ribbons) {
-                        data->density_volume.dirty_rep |= ImGui::SliderFloat("width", &rep.param[0], 0.1f, 2.f);
-                        data->density_volume.dirty_rep |= ImGui::SliderFloat("thickness", &rep.param[1], 0.1f, 2.f);
-                    }
-                    if (rep.type == RepresentationType::Cartoon) {
-                        data->density_volume.dirty_rep |= ImGui::SliderFloat("coil scale",  &rep.param[0], 0.1f, 3.f);
-                        data->density_volume.dirty_rep |= ImGui::SliderFloat("sheet scale", &rep.param[1], 0.1f, 3.f);
-                        data->density_volume.dirty_rep |= ImGui::SliderFloat("helix scale", &rep.param[2], 0.1f, 3.f);
-                    }
-                    ImGui::Unindent();
-                }
-                ImGui::Checkbox("Legend", &data->density_volume.legend.enabled);
-                if (data->density_volume.legend.enabled) {
-                    ImGui::Indent();
-                    const char* colormap_modes[] = {"Opaque", "Transparent", "Split"};
-                    if (ImGui::BeginCombo("Colormap", colormap_modes[data->density_volume.legend.colormap_mode])) {
-                        for (int i = 0; i < IM_ARRAYSIZE(colormap_modes); ++i) {
-                            if (ImGui::Selectable(colormap_modes[i])) {
-                                data->density_volume.legend.colormap_mode = i;
-                            }
-                        }
-                        ImGui::EndCombo();
-                    }
-                    ImGui::Checkbox("Use Checkerboard", &data->density_volume.legend.checkerboard);
-                    if (ImGui::IsItemHovered()) {
-                        ImGui::SetTooltip("Use a checkerboard background for transparent parts in the legend.");
-                    }
-                    ImGui::Unindent();
-                }
+            if (ImGui::BeginMenu("Settings")) {
+                if (ImGui::MenuItem("Dark palette"))
+                    editor.SetPalette(TextEditor::GetDarkPalette());
+                if (ImGui::MenuItem("Light palette"))
+                    editor.SetPalette(TextEditor::GetLightPalette());
+                if (ImGui::MenuItem("Retro blue palette"))
+                    editor.SetPalette(TextEditor::GetRetroBluePalette());
+                ImGui::Separator();
+                ImGui::ColorEdit4("Point Color",      data->script.point_color.elem);
+                ImGui::ColorEdit4("Line Color",       data->script.line_color.elem);
+                ImGui::ColorEdit4("Triangle Color",   data->script.triangle_color.elem);
+
                 ImGui::EndMenu();
             }
 
             ImGui::EndMenuBar();
         }
 
-        update_density_volume(data);
+        if (editor.IsTextChanged()) {
+            data->mold.script.compile_ir = true;
+            data->mold.script.time_since_last_change = 0;
+        }
 
-        /*
-        // Canvas
-        // Using InvisibleButton() as a convenience 1) it will advance the layout cursor and 2) allows us to use IsItemHovered()/IsItemActive()
-        ImVec2 canvas_p0 = ImGui::GetCursorScreenPos();      // ImDrawList API uses screen coordinates!
-        ImVec2 canvas_p1 = ImVec2(canvas_p0.x + canvas_sz.x, canvas_p0.y + canvas_sz.y);
-        */
-        ImVec2 canvas_sz = ImGui::GetContentRegionAvail();   // Resize canvas to what's available
-        canvas_sz.x = MAX(canvas_sz.x, 50.0f);
-        canvas_sz.y = MAX(canvas_sz.y, 50.0f);
+        const ImVec2 content_size = ImGui::GetContentRegionAvail();
+        const char* btn_text = "Evaluate";
+        const ImVec2 label_size = ImGui::CalcTextSize(btn_text, NULL, true) * ImVec2(1.4, 1.0);
+        const ImVec2 btn_size = ImGui::CalcItemSize(ImVec2(0,0), label_size.x + ImGui::GetStyle().FramePadding.x * 2.0f, label_size.y + ImGui::GetStyle().FramePadding.y * 2.0f);
+        const ImVec2 text_size(content_size - ImVec2(0, btn_size.y + ImGui::GetStyle().ItemSpacing.y));
 
-        // This will catch our interactions
-        ImGui::InvisibleButton("canvas", canvas_sz, ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonRight);
+        editor.Render("TextEditor", text_size);
 
-        // Draw border and background color
-        ImGuiIO& io = ImGui::GetIO();
+        
+        bool eval = false;
+        if (editor.IsFocused() && ImGui::IsKeyDown(KEY_SCRIPT_EVALUATE_MOD) && ImGui::IsKeyPressed(KEY_SCRIPT_EVALUATE)) {
+            eval = true;
+        }
 
-        ImVec2 canvas_p0 = ImGui::GetItemRectMin();
-        ImVec2 canvas_p1 = ImGui::GetItemRectMax();
+        ImGui::SetCursorPosX(ImGui::GetCursorPosX() + content_size.x - btn_size.x);
+        ImGui::SetCursorPosY(ImGui::GetCursorPosY() + ImGui::GetStyle().ItemSpacing.y);
 
-        ImDrawList* draw_list = ImGui::GetWindowDrawList();
-        draw_list->AddImage((ImTextureID)(intptr_t)data->density_volume.fbo.deferred.post_tonemap, canvas_p0, canvas_p1, { 0,1 }, { 1,0 });
-        draw_list->AddRect(canvas_p0, canvas_p1, IM_COL32(50, 50, 50, 255));
+        const bool valid = md_script_ir_valid(data->mold.script.ir);
 
-        if (data->density_volume.dvr.enabled && data->density_volume.legend.enabled) {
-            ImVec2 canvas_ext = canvas_p1 - canvas_p0;
-            ImVec2 cmap_ext = {MIN(canvas_ext.x * 0.5f, 250.0f), MIN(canvas_ext.y * 0.25f, 30.0f)};
-            ImVec2 cmap_pad = {10, 10};
-            ImVec2 cmap_pos = canvas_p1 - ImVec2(cmap_ext.x, cmap_ext.y) - cmap_pad;
-            ImPlotColormap cmap = data->density_volume.dvr.tf.colormap;
-            ImPlotContext& gp = *ImPlot::GetCurrentContext();
-            ImU32 checker_bg = IM_COL32(255, 255, 255, 255);
-            ImU32 checker_fg = IM_COL32(128, 128, 128, 255);
-            float checker_size = 8.0f;
-            ImVec2 checker_offset = ImVec2(0,0);
+        if (!valid) ImGui::PushDisabled();
+        if (ImGui::Button(btn_text, btn_size)) {
+            eval = true;
+        }
+        if (!valid) ImGui::PopDisabled();
 
-            int mode = data->density_volume.legend.colormap_mode;
+        if (eval && valid) {
+            request_evaluation(data);
+        }
 
-            ImVec2 opaque_scl = ImVec2(1,1);
-            ImVec2 transp_scl = ImVec2(0,0);
+        const TextEditor::Marker* hovered_marker = editor.GetHoveredMarker();
+        if (hovered_marker && hovered_marker->payload) {
+            if (md_semaphore_try_aquire(&data->mold.script.ir_semaphore)) {
+                defer { md_semaphore_release(&data->mold.script.ir_semaphore); };
+                
+                if (md_script_ir_valid(data->mold.script.ir)) {
+                    md_script_vis_ctx_t ctx = {
+                        .ir = data->mold.script.ir,
+                        .mol = &data->mold.mol,
+                        .traj = data->mold.traj,
+                    };
+                    const md_script_vis_payload_o* payload = (const md_script_vis_payload_o*)hovered_marker->payload;
+
+                    data->mold.script.vis = vis_cache_get(&data->mold.script.vis_cache, vis_cache_key(data, data->mold.script.ir, payload, 0, 0), &ctx);
+                    
+                    if (data->mold.script.vis && !md_bitfield_empty(&data->mold.script.vis->atom_mask)) {
+                        md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->mold.script.vis->atom_mask);
+                        data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                    }
+                }
+            }
+        }
+    }
+    ImGui::End();
+}
+
+static bool export_xvg(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename) {
+    ASSERT(column_data);
+    ASSERT(column_labels);
+
+    time_t t;
+    struct tm* info;
+    time(&t);
+    info = localtime(&t);
+
+    // Header and legend meta, the rows are formatted in parallel by table_write_text
+    md_strb_t sb = md_strb_create(frame_allocator);
+    md_strb_fmt(&sb, "# This file was created %s", asctime(info));
+    md_strb_fmt(&sb, "# Created by:\n");
+    md_strb_fmt(&sb, "# VIAMD \n");
+    md_strb_fmt(&sb, "@    title \"VIAMD Properties\"\n");
+    md_strb_fmt(&sb, "@    xaxis  label \"Time\"\n");
+    md_strb_fmt(&sb, "@ TYPE xy\n");
+    md_strb_fmt(&sb, "@ view 0.15, 0.15, 0.75, 0.85\n");
+    md_strb_fmt(&sb, "@ legend on\n");
+    md_strb_fmt(&sb, "@ legend box on\n");
+    md_strb_fmt(&sb, "@ legend loctype view\n");
+    md_strb_fmt(&sb, "@ legend 0.78, 0.8\n");
+    md_strb_fmt(&sb, "@ legend length %zu\n", num_columns);
+    for (size_t j = 0; j < num_columns; ++j) {
+        md_strb_fmt(&sb, "@ s%zu legend \"%s\"\n", j, column_labels[j]);
+    }
+
+    if (!table_write_text(filename, md_strb_to_str(&sb), column_data, num_columns, num_rows, TableTextFormat_XVG)) {
+        return false;
+    }
+    LOG_SUCCESS("Successfully exported XVG file to '%.*s'", (int)filename.len, filename.ptr);
+    return true;
+}
+
+static bool export_csv(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename) {
+    ASSERT(column_data);
+    ASSERT(column_labels);
+
+    str_t* labels = (str_t*)md_alloc(frame_allocator, sizeof(str_t) * num_columns);
+    for (size_t i = 0; i < num_columns; ++i) {
+        labels[i] = str_from_cstr(column_labels[i]);
+    }
+
+    if (!table_write_text(filename, table_csv_header(labels, num_columns, frame_allocator), column_data, num_columns, num_rows, TableTextFormat_CSV)) {
+        return false;
+    }
+    LOG_SUCCESS("Successfully exported CSV file to '%.*s'", (int)filename.len, filename.ptr);
+    return true;
+}
+
+// Writes the columns in the format of the extension (xvg, csv or npy), the legends and axis labels are only used by xvg
+static bool export_table(str_t path, str_t ext, str_t title, str_t x_label, str_t y_label, const float* const* columns, const str_t* labels, size_t num_columns, size_t num_rows, const str_t* legends, size_t num_legends) {
+    if (str_eq_cstr_ignore_case(ext, "xvg")) {
+        str_t header = md_xvg_format_header(title, x_label, y_label, num_legends, legends, frame_allocator);
+        return table_write_text(path, header, columns, num_columns, num_rows, TableTextFormat_XVG);
+    } else if (str_eq_cstr_ignore_case(ext, "csv")) {
+        return table_write_text(path, table_csv_header(labels, num_columns, frame_allocator), columns, num_columns, num_rows, TableTextFormat_CSV);
+    } else if (str_eq_cstr_ignore_case(ext, "npy")) {
+        return table_write_npy(path, columns, num_columns, num_rows);
+    }
+    LOG_ERROR("Unrecognized export format '%.*s'", (int)ext.len, ext.ptr);
+    return false;
+}
+
+// A volume prepared for export, which owns copies of everything it writes so it can be written by the pool while the property changes
+struct VolumeExport {
+    md_allocator_i* arena;
+    str_t path;
+    str_t label;
+    str_t header;       // Everything of the cube file but the voxels
+    float* values;
+    int dim[3];
+    bool npy;
+    bool result;
+    uint32_t num_slabs;
+    std::atomic_uint32_t slabs_written;
+};
+
+static void free_volume_export(VolumeExport* job) {
+    if (job) md_arena_allocator_destroy(job->arena);
+}
+
+static VolumeExport* prepare_volume_export(ApplicationData& data, const md_script_property_t* prop, str_t filename, bool npy) {
+    // @NOTE: First we need to extract some meta data for the cube format, we need the atom indices/bits for any SDF
+    // And the origin + extent of the volume in spatial coordinates (Ångström)
+
+    if (!prop) {
+        LOG_ERROR("Export Cube: The property to be exported did not exist");
+        return nullptr;
+    }
+
+    // Copy mol and replace with initial coords
+    md_molecule_t mol = data.mold.mol;
+
+    size_t stride = ALIGN_TO(data.mold.mol.atom.count, 8);
+    float* coords = (float*)md_alloc(frame_allocator, stride * sizeof(float) * 3);
+    mol.atom.x = coords + stride * 0;
+    mol.atom.y = coords + stride * 1;
+    mol.atom.z = coords + stride * 2;
+    
+    if (!md_trajectory_load_frame(data.mold.traj, 0, NULL, mol.atom.x, mol.atom.y, mol.atom.z)) {
+        return nullptr;
+    }
+
+    bool result = false;
+    md_script_vis_t vis = { 0 };
+    md_script_vis_init(&vis, frame_allocator);
+    defer { md_script_vis_free(&vis); };
+    
+    if (md_script_ir_valid(data.mold.script.eval_ir)) {
+        md_script_vis_ctx_t ctx = {
+            .ir = data.mold.script.eval_ir,
+            .mol = &data.mold.mol,
+            .traj = data.mold.traj,
+        };
+        result = md_script_vis_eval_payload(&vis, prop->vis_payload, 0, &ctx, MD_SCRIPT_VISUALIZE_ATOMS | MD_SCRIPT_VISUALIZE_SDF);
+    }
+
+    if (!result) {
+        LOG_ERROR("Failed to visualize volume for export.");
+        return nullptr;
+    }
 
-            if (mode == LegendColorMapMode_Split) {
-                opaque_scl = ImVec2(1.0f, 0.5f);
-                transp_scl = ImVec2(0.0f, 0.5f);
-            }
+    md_allocator_i* arena = md_arena_allocator_create(persistent_allocator, MEGABYTES(1));
+    VolumeExport* job = (VolumeExport*)md_alloc(arena, sizeof(VolumeExport));
+    MEMSET(job, 0, sizeof(VolumeExport));
+    job->arena = arena;
+    job->path = str_copy(filename, arena);
+    job->label = str_copy(prop->ident, arena);
+    job->npy = npy;
+    job->dim[0] = prop->data.dim[0];
+    job->dim[1] = prop->data.dim[1];
+    job->dim[2] = prop->data.dim[2];
+    const size_t num_values = (size_t)job->dim[0] * job->dim[1] * job->dim[2];
+    job->values = (float*)md_alloc(arena, sizeof(float) * num_values);
+    MEMCPY(job->values, prop->data.values, sizeof(float) * num_values);
+    job->num_slabs = npy ? 1 : volume_cube_num_slabs(job->dim);
+
+    md_strb_t sb = md_strb_create(arena);
+
+    // Two comment lines
+    md_strb_fmt(&sb, "EXPORTED DENSITY VOLUME FROM VIAMD, UNITS IN BOHR\n");
+    md_strb_fmt(&sb, "OUTER LOOP: X, MIDDLE LOOP: Y, INNER LOOP: Z\n");
+
+    if (md_array_size(vis.sdf.structures) > 0) {
+        const float angstrom_to_bohr = (float)(1.0 / 0.529177210903);
+
+        // transformation matrix from world to volume
+        mat4_t M = vis.sdf.matrices[0];
+        const md_bitfield_t* bf = &vis.sdf.structures[0];
+        const int num_atoms = (int)md_bitfield_popcount(bf);
+        const int* vol_dim = job->dim;
+        const double extent = vis.sdf.extent * 2.0 * angstrom_to_bohr;
+        const double voxel_ext[3] = {
+            (double)extent / (double)vol_dim[0],
+            (double)extent / (double)vol_dim[1],
+            (double)extent / (double)vol_dim[2],
+        };
 
-            ImRect opaque_rect = ImRect(cmap_pos, cmap_pos + cmap_ext * opaque_scl);
-            ImRect transp_rect = ImRect(cmap_pos + cmap_ext * transp_scl, cmap_pos + cmap_ext);
-            
-            // Opaque
-            if (mode == LegendColorMapMode_Opaque || mode == LegendColorMapMode_Split) {
-                ImPlot::RenderColorBar(gp.ColormapData.GetKeys(cmap),gp.ColormapData.GetKeyCount(cmap),*draw_list,opaque_rect,false,false,!gp.ColormapData.IsQual(cmap));
-            }
-            
-            if (mode == LegendColorMapMode_Transparent || mode == LegendColorMapMode_Split) {
-                if (data->density_volume.legend.checkerboard) {
-                    // Checkerboard
-                    ImGui::DrawCheckerboard(draw_list, transp_rect.Min, transp_rect.Max, checker_bg, checker_fg, checker_size, checker_offset);
-                }
-                // Transparent
-                draw_list->AddImage((ImTextureID)(intptr_t)data->density_volume.dvr.tf.id, transp_rect.Min, transp_rect.Max);
-            }
-            
-            // Boarder
-            draw_list->AddRect(cmap_pos, cmap_pos + cmap_ext, IM_COL32(0, 0, 0, 255));
+        const double half_ext = extent * 0.5;
+
+        md_strb_fmt(&sb, "%5i %12.6f %12.6f %12.6f\n", -num_atoms, -half_ext, -half_ext, -half_ext);
+        md_strb_fmt(&sb, "%5i %12.6f %12.6f %12.6f\n", vol_dim[0], voxel_ext[0], 0.0, 0.0);
+        md_strb_fmt(&sb, "%5i %12.6f %12.6f %12.6f\n", vol_dim[1], 0.0, voxel_ext[1], 0.0);
+        md_strb_fmt(&sb, "%5i %12.6f %12.6f %12.6f\n", vol_dim[2], 0.0, 0.0, voxel_ext[2]);
+
+        const float scl = angstrom_to_bohr;
+        M = mat4_mul(mat4_scale(scl, scl, scl), M);
+
+        int64_t beg_bit = bf->beg_bit;
+        int64_t end_bit = bf->end_bit;
+        while ((beg_bit = md_bitfield_scan(bf, beg_bit, end_bit)) != 0) {
+            int64_t i = beg_bit - 1;
+            vec3_t coord = {mol.atom.x[i], mol.atom.y[i], mol.atom.z[i]};
+            coord = mat4_mul_vec3(M, coord, 1.0f);
+            // @NOTE(Robin): If we don't have any elements available for example in the case of coarse grained, we use a placeholder of 1 (Hydrogen).
+            md_element_t elem = mol.atom.element ? mol.atom.element[i] : 1;
+            md_strb_fmt(&sb, "%5i %12.6f %12.6f %12.6f %12.6f\n", elem, (float)elem, coord.x, coord.y, coord.z);
         }
 
-        const bool is_hovered = ImGui::IsItemHovered();
-        const bool is_active = ImGui::IsItemActive();
-        const ImVec2 origin(canvas_p0.x, canvas_p0.y);  // Lock scrolled origin
-        const ImVec2 mouse_pos_in_canvas(io.MousePos.x - origin.x, io.MousePos.y - origin.y);
+        // This entry somehow relates to the number of densities
+        md_strb_fmt(&sb, "%5i %5i\n", 1, 1);
+    } else {
+        // Without a structure there is no geometry to write the voxels against
+        job->dim[0] = job->dim[1] = job->dim[2] = 0;
+        job->num_slabs = 0;
+    }
+    job->header = md_strb_to_str(&sb);
 
-        auto& gbuf = data->density_volume.fbo;
-        if (gbuf.width != canvas_sz.x || gbuf.height != canvas_sz.y) {
-            init_gbuffer(&gbuf, canvas_sz.x, canvas_sz.y);
-        }
+    return job;
+}
 
-        static bool init = true;
-        if (init) {
-            const vec3_t ext = {10,10,10};
-            const vec3_t cen = {0.5f,0.5f,0.5f};
-            const vec3_t pos = cen + ext * vec3_t{1.0f,0.5f,0.7f} * 2.f;
-            const vec3_t up = {0,1,0};
+static bool write_volume_export(VolumeExport* job) {
+    ASSERT(job);
+    if (job->npy) {
+        job->result = volume_write_npy(job->path, job->values, job->dim);
+        job->slabs_written = 1;
+    } else {
+        job->result = volume_write_cube(job->path, job->header, job->values, job->dim, &job->slabs_written);
+    }
+    return job->result;
+}
 
-            data->density_volume.camera.position = pos;
-            data->density_volume.camera.focus_distance = vec3_length(pos - cen);
-            data->density_volume.camera.orientation = quat_from_mat4(mat4_look_at(data->density_volume.camera.position, cen, up));
-            init = false;
-        }
+static bool export_cube(ApplicationData& data, const md_script_property_t* prop, str_t filename) {
+    VolumeExport* job = prepare_volume_export(data, prop, filename, false);
+    if (!job) return false;
+    defer { free_volume_export(job); };
+    return write_volume_export(job);
+}
 
-        if (is_active || is_hovered) {
-            static const TrackballControllerParam param = {
-                .min_distance = 1.0,
-                .max_distance = 1000.0,
-            };
+// Writes the volume on the pool, the progress is shown in the async task window
+static void launch_volume_export(ApplicationData* data, const md_script_property_t* prop, str_t filename, bool npy) {
+    if (task_system::task_is_running(data->tasks.export_volume)) {
+        LOG_ERROR("A volume is already being exported, please wait for it to complete");
+        return;
+    }
+    VolumeExport* job = prepare_volume_export(*data, prop, filename, npy);
+    if (!job) return;
 
-            vec2_t delta = { io.MouseDelta.x, io.MouseDelta.y };
-            vec2_t curr = {mouse_pos_in_canvas.x, mouse_pos_in_canvas.y};
-            vec2_t prev = curr - delta;
-            float  wheel_delta = io.MouseWheel;
+    data->volume_export = job;
+    data->tasks.export_volume = task_system::pool_enqueue(STR("Export Volume"), [](void* user_data) {
+        write_volume_export((VolumeExport*)user_data);
+    }, job, 0, task_system::Priority_Interactive);
 
-            TrackballControllerInput input = {
-                .rotate_button = is_active && ImGui::IsMouseDown(ImGuiMouseButton_Left),
-                .pan_button    = is_active && ImGui::IsMouseDown(ImGuiMouseButton_Right),
-                .dolly_button  = is_active && ImGui::IsMouseDown(ImGuiMouseButton_Middle),
-                .dolly_delta   = is_hovered ? wheel_delta : 0.0f,
-                .mouse_coord_prev = prev,
-                .mouse_coord_curr = curr,
-                .screen_size = {canvas_sz.x, canvas_sz.y},
-                .fov_y = data->density_volume.camera.fov_y,
-            };
-            camera_controller_trackball(&data->density_volume.camera.position, &data->density_volume.camera.orientation, &data->density_volume.camera.focus_distance, input, param);
+    task_system::main_enqueue(STR("##Volume Export Complete"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        VolumeExport* job = data->volume_export;
+        if (job->result) {
+            LOG_SUCCESS("Successfully exported property '" STR_FMT "' to '" STR_FMT "'", STR_ARG(job->label), STR_ARG(job->path));
         }
+        free_volume_export(job);
+        data->volume_export = nullptr;
+    }, data, data->tasks.export_volume);
+}
 
-        mat4_t view_mat = camera_world_to_view_matrix(data->density_volume.camera);
-        mat4_t proj_mat = camera_perspective_projection_matrix(data->density_volume.camera, (float)canvas_sz.x / (float)canvas_sz.y);
-        mat4_t inv_proj_mat = camera_inverse_perspective_projection_matrix(data->density_volume.camera, (float)canvas_sz.x / (float)canvas_sz.y);
+// #repack
+struct TrajectoryRepack {
+    md_allocator_i* arena;
+    str_t path;
+    int32_t* indices;           // Atoms of the subset or NULL
+    size_t num_atoms;
+    size_t num_frames;
+    ChunkedTrajectoryWriteDesc desc;
+    std::atomic_uint32_t frames_written;
+    bool result;
+};
 
-        clear_gbuffer(&gbuf);
+static float repack_fraction_complete(const TrajectoryRepack* job) {
+    return job->num_frames ? (float)job->frames_written.load(std::memory_order_relaxed) / (float)job->num_frames : 0.0f;
+}
 
-        glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
-        glClearColor(1, 1, 1, 1);
-        glClear(GL_COLOR_BUFFER_BIT);
+// Writes the loaded trajectory (as it is transformed on load) into a chunked trajectory on the pool
+// With a subset, the atoms which pass the filter are written together with a GRO structure of them next to the trajectory
+static void launch_trajectory_repack(ApplicationData* data, str_t path) {
+    ASSERT(data);
+    if (task_system::task_is_running(data->tasks.repack_trajectory)) {
+        LOG_ERROR("A trajectory is already being repacked, please wait for it to complete");
+        return;
+    }
+    const md_molecule_t& mol = data->mold.mol;
+    if (!data->mold.traj || !mol.atom.count || !md_trajectory_num_frames(data->mold.traj)) {
+        LOG_ERROR("Repack: There is no trajectory to repack");
+        return;
+    }
 
-        glEnable(GL_DEPTH_TEST);
-        glDepthMask(GL_TRUE);
+    md_allocator_i* arena = md_arena_allocator_create(persistent_allocator, MEGABYTES(1));
+    TrajectoryRepack* job = (TrajectoryRepack*)md_alloc(arena, sizeof(TrajectoryRepack));
+    PLACEMENT_NEW(job) TrajectoryRepack();
+    job->arena = arena;
+    job->path = str_copy(path, arena);
+    job->num_atoms = mol.atom.count;
+    job->num_frames = md_trajectory_num_frames(data->mold.traj);
+
+    if (data->repack.subset) {
+        md_bitfield_t mask = {0};
+        md_bitfield_init(&mask, frame_allocator);
+        char err_buf[256] = "";
+        if (!filter_expression(data, str_from_cstr(data->repack.filter), &mask, NULL, err_buf, sizeof(err_buf))) {
+            LOG_ERROR("Repack: Invalid subset filter: %s", err_buf);
+            md_arena_allocator_destroy(arena);
+            return;
+        }
+        job->num_atoms = md_bitfield_popcount(&mask);
+        if (job->num_atoms == 0) {
+            LOG_ERROR("Repack: The subset filter did not match any atoms");
+            md_arena_allocator_destroy(arena);
+            return;
+        }
+        job->indices = (int32_t*)md_alloc(arena, sizeof(int32_t) * job->num_atoms);
+        size_t count = 0;
+        md_bitfield_iter_t it = md_bitfield_iter_create(&mask);
+        while (md_bitfield_iter_next(&it)) {
+            job->indices[count++] = (int32_t)md_bitfield_iter_idx(&it);
+        }
 
-        const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY,
-            GL_COLOR_ATTACHMENT_PICKING, GL_COLOR_ATTACHMENT_POST_TONEMAP };
+        // The subset can only be opened together with a structure of the same atoms
+        char gro_buf[1024];
+        str_t base = path;
+        str_t ext;
+        if (extract_ext(&ext, path)) base.len -= ext.len + 1;
+        snprintf(gro_buf, sizeof(gro_buf), STR_FMT ".gro", STR_ARG(base));
+        if (!chunked_trajectory_write_subset_structure(str_from_cstr(gro_buf), &mol, job->indices, job->num_atoms, mol.atom.x, mol.atom.y, mol.atom.z)) {
+            md_arena_allocator_destroy(arena);
+            return;
+        }
+    }
 
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
+    job->desc.path = job->path;
+    job->desc.src = data->mold.traj;
+    job->desc.atom_indices = job->indices;
+    job->desc.num_atoms = job->num_atoms;
+    job->desc.block_frames = (uint32_t)CLAMP(data->repack.block_frames, 1, 256);
+    job->desc.precision = CLAMP(data->repack.precision, 0.0001f, 1.0f);
+    job->desc.frames_written = &job->frames_written;
+
+    data->repack.job = job;
+    data->tasks.repack_trajectory = task_system::pool_enqueue(STR("Repack Trajectory"), [](void* user_data) {
+        TrajectoryRepack* job = (TrajectoryRepack*)user_data;
+        job->result = chunked_trajectory_write(&job->desc);
+    }, job, 0, task_system::Priority_Interactive);
+
+    task_system::main_enqueue(STR("##Trajectory Repack Complete"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        TrajectoryRepack* job = data->repack.job;
+        if (job->result) {
+            LOG_SUCCESS("Successfully repacked the trajectory to '" STR_FMT "'", STR_ARG(job->path));
+        }
+        md_arena_allocator_destroy(job->arena);
+        data->repack.job = nullptr;
+    }, data, data->tasks.repack_trajectory);
+}
 
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(GL_LESS);
+#define APPEND_BUF(buf, len, fmt, ...) (len += snprintf(buf + len, MAX(0, (int)sizeof(buf) - len), fmt, ##__VA_ARGS__) + 1)
 
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf.deferred.fbo);
-        glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
-        glViewport(0, 0, gbuf.width, gbuf.height);
+static md_array(float) sample_range(float beg, float end, int sample_count, md_allocator_i* alloc) {
+    md_array(float) result = md_array_create(float, sample_count, alloc);
+    double step = (end - beg) / (double)(sample_count - 1);
+    for (int i = 0; i < sample_count; ++i) {
+        result[i] = (float)((double)beg + step * (double)i);
+    }
+    return result;
+}
 
-        int64_t num_reps = md_array_size(data->density_volume.gl_reps);
-        if (data->density_volume.show_reference_structures && num_reps > 0) {
-            num_reps = data->density_volume.show_reference_ensemble ? num_reps : 1;
+static void draw_property_export_window(ApplicationData* data) {
+    ASSERT(data);
 
-            md_gl_draw_op_t* draw_ops = 0;
+    struct ExportFormat {
+        const char* label;
+        const char* extension;
+    };
 
-            md_gl_draw_op_t op = {};
-            op.type = (md_gl_representation_type_t)data->density_volume.rep.type;
-            MEMCPY(&op.args, data->density_volume.rep.param, sizeof(op.args));
+    ExportFormat table_formats[] {
+        {"XVG", "xvg"},
+        {"CSV", "csv"},
+        {"NumPy", "npy"},
+    };
 
-            for (int64_t i = 0; i < num_reps; ++i) {
-                op.rep = &data->density_volume.gl_reps[i];
-                op.model_matrix = &data->density_volume.rep_model_mats[i].elem[0][0];
-                md_array_push(draw_ops, op, frame_allocator);
-            }
+    ExportFormat volume_formats[] {
+        {"Gaussian Cube", "cube"},
+        {"NumPy", "npy"},
+    };
 
-            md_gl_draw_args_t draw_args = {
-                .shaders = &data->mold.gl_shaders,
-                .draw_operations = {
-                    .count = (uint32_t)md_array_size(draw_ops),
-                    .ops = draw_ops
-                },
-                .view_transform = {
-                    .view_matrix = &view_mat.elem[0][0],
-                    .projection_matrix = &proj_mat.elem[0][0],
-                },
-            };
+    if (ImGui::Begin("Property Export", &data->show_property_export_window)) {
+        static int type = DisplayProperty::Type_Temporal;
+        static int property_idx  = 0;
+        static int table_format  = 0;
+        static int volume_format = 0;
 
-            md_gl_draw(&draw_args);
+        int num_properties = (int)md_array_size(data->display_properties);
+        if (num_properties == 0) {
+            ImGui::Text("No properties available for export, try evaluating the script.");
+			ImGui::End();
+            property_idx = 0;
+			return;
+        }
 
-            if (is_hovered) {
-                vec2_t coord = {mouse_pos_in_canvas.x, (float)gbuf.height - mouse_pos_in_canvas.y};
-                PickingData pd = read_picking_data(&gbuf, (int)coord.x, (int)coord.y);
-                if (pd.idx != INVALID_PICKING_IDX) {
-                    draw_info_window(*data, pd.idx);
+        if (task_system::task_is_running(data->tasks.evaluate_full)) {
+            ImGui::Text("The properties is currently being evaluated, please wait...");
+            ImGui::End();
+            property_idx = 0;
+            return;
+        }
+
+        ImGui::PushItemWidth(200);
+        if (ImGui::Combo("Data Type", (int*)(&type), "Temporal\0Distribution\0Density Volume\0")) {
+            if (property_idx != -1) {
+                const char* cur_lbl = data->display_properties[property_idx].label;
+                for (int i = 0; i < (int)md_array_size(data->display_properties); ++i) {
+                    const DisplayProperty& dp = data->display_properties[i];
+                    if (type == dp.type && strcmp(cur_lbl, dp.label) == 0) {
+                        property_idx = i;
+                        break;
+                    }
                 }
             }
-
-            glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
-
-            PUSH_GPU_SECTION("Postprocessing")
-                postprocessing::Descriptor postprocess_desc = {
-                .background = {
-                        .intensity = data->visuals.background.color * data->visuals.background.intensity,
-                },
-                .bloom = {
-                            .enabled = false,
-                },
-                .tonemapping = {
-                            .enabled = data->visuals.tonemapping.enabled,
-                            .mode = data->visuals.tonemapping.tonemapper,
-                            .exposure = data->visuals.tonemapping.exposure,
-                            .gamma = data->visuals.tonemapping.gamma,
-                },
-                .ambient_occlusion = {
-                            .enabled = data->visuals.ssao.enabled,
-                            .radius = data->visuals.ssao.radius,
-                            .intensity = data->visuals.ssao.intensity,
-                            .bias = data->visuals.ssao.bias,
-                },
-                .depth_of_field = {
-                            .enabled = data->visuals.dof.enabled,
-                            .focus_depth = data->visuals.dof.focus_depth,
-                            .focus_scale = data->visuals.dof.focus_scale,
-                },
-                .temporal_reprojection = {
-                            .enabled = false,
-                },
-                .input_textures = {
-                            .depth = gbuf.deferred.depth,
-                            .color = gbuf.deferred.color,
-                            .normal = gbuf.deferred.normal,
-                            .velocity = gbuf.deferred.velocity,
+        }
+        ImGui::Separator();
+        
+        if (ImGui::BeginCombo("Property", property_idx != -1 ? data->display_properties[property_idx].label : "")) {
+            for (int i = 0; i < (int)md_array_size(data->display_properties); ++i) {
+                const DisplayProperty& dp = data->display_properties[i];
+                if (type == dp.type) {
+                    if (ImGui::Selectable(dp.label, property_idx == i)) {
+                        property_idx = i;
+                    }
                 }
-            };
-
-            ViewParam view_param = {
-                .matrix = {
-                    .current = {
-                    .view = view_mat,
-                    .proj = proj_mat,
-                    .norm = view_mat,
-                },
-                .inverse = {
-                    .proj = inv_proj_mat,
+            }
+            ImGui::EndCombo();
+        }
+        
+        const char* file_extension = "";
+        if (type == DisplayProperty::Type_Distribution || type == DisplayProperty::Type_Temporal) {
+            if (ImGui::BeginCombo("File Format", table_formats[table_format].label)) {
+                for (int i = 0; i < (int)ARRAY_SIZE(table_formats); ++i) {
+                    if (ImGui::Selectable(table_formats[i].label, table_format == i)) {
+                        table_format = i;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            file_extension = table_formats[table_format].extension;
+        } else if (type == DisplayProperty::Type_Volume) {
+            if (ImGui::BeginCombo("File Format", volume_formats[volume_format].label)) {
+                for (int i = 0; i < (int)ARRAY_SIZE(volume_formats); ++i) {
+                    if (ImGui::Selectable(volume_formats[i].label, volume_format == i)) {
+                        volume_format = i;
+                    }
                 }
-                },
-                .clip_planes = {
-                    .near = data->density_volume.camera.near_plane,
-                    .far = data->density_volume.camera.far_plane,
-                },
-                .fov_y = data->density_volume.camera.fov_y,
-                .resolution = {canvas_sz.x, canvas_sz.y}
-            };
+                ImGui::EndCombo();
+            }
+            file_extension = volume_formats[volume_format].extension;
+		}
 
-            postprocessing::shade_and_postprocess(postprocess_desc, view_param);
-            POP_GPU_SECTION()
+        if (property_idx != -1) {
+            if (type != data->display_properties[property_idx].type) {
+				property_idx = -1;
+			}
         }
 
-        glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
-        glEnable(GL_DEPTH_TEST);
-        glDepthMask(GL_TRUE);
-
-        if (data->density_volume.show_bounding_box) {
-            if (data->density_volume.model_mat != mat4_t{0}) {
-                const vec3_t min_box = {0,0,0};
-                const vec3_t max_box = {1,1,1};
-
-                immediate::set_model_view_matrix(mat4_mul(view_mat, data->density_volume.model_mat));
-                immediate::set_proj_matrix(proj_mat);
+        if (property_idx == -1) ImGui::PushDisabled();
+        bool export_clicked = ImGui::Button("Export");
+        if (property_idx == -1) ImGui::PopDisabled();
 
-                uint32_t box_color = convert_color(data->density_volume.bounding_box_color);
-                uint32_t clip_color = convert_color(data->density_volume.clip_volume_color);
-                immediate::draw_box_wireframe(min_box, max_box, box_color);
-                immediate::draw_box_wireframe(data->density_volume.clip_volume.min, data->density_volume.clip_volume.max, clip_color);
+        if (export_clicked) {
+            ASSERT(property_idx != -1);
+            char path_buf[1024];
+            DisplayProperty& dp = data->display_properties[property_idx];
+            md_array(const float*)  column_data = 0;
+            md_array(str_t)         column_labels = 0;
+            md_array(str_t)         legends = 0;
 
-                immediate::render();
-            }
-        }
+            if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, file_extension)) {
+                size_t path_len = strnlen(path_buf, sizeof(path_buf));
+                if (!extract_ext(NULL, {path_buf, path_len})) {
+                    path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".%s", file_extension);
+                }
+                str_t path = {path_buf, path_len};
+                if (dp.type == DisplayProperty::Type_Volume) {
+                    launch_volume_export(data, dp.prop, path, strcmp(file_extension, "npy") == 0);
+                } else {
+                    bool exported = false;
+                    const str_t ext = str_from_cstr(file_extension);
+                    if (dp.type == DisplayProperty::Type_Temporal) {
+                        const double* traj_times = md_trajectory_frame_times(data->mold.traj);
+                        const int64_t num_frames = md_trajectory_num_frames(data->mold.traj);
+                        md_array(float) time = md_array_create(float, num_frames, frame_allocator);
+                        for (int64_t i = 0; i < num_frames; ++i) {
+                            time[i] = (float)traj_times[i];
+                        }
 
-        if (data->density_volume.show_density_volume) {
-            if (data->density_volume.model_mat != mat4_t{ 0 }) {
-                volume::RenderDesc vol_desc = {
-                    .render_target = {
-                        .texture = gbuf.deferred.post_tonemap,
-                        .width   = gbuf.width,
-                        .height  = gbuf.height,
-                    },
-                    .texture = {
-                        .volume = data->density_volume.volume_texture.id,
-                        .transfer_function = data->density_volume.dvr.tf.id,
-                        .depth = gbuf.deferred.depth,
-                    },
-                    .matrix = {
-                        .model = data->density_volume.model_mat,
-                        .view = view_mat,
-                        .proj = proj_mat,
-                    },
-                    .clip_volume = {
-                        .min = data->density_volume.clip_volume.min,
-                        .max = data->density_volume.clip_volume.max,
-                    },
-                    .bounding_box = {
-                        .color = data->density_volume.bounding_box_color,
-                        .enabled = data->density_volume.show_bounding_box,
-                    },
-                    .global_scaling = {
-                        .density = data->density_volume.density_scale,
-                    },
-                    .iso_surface = {
-                        .count = data->density_volume.iso.count,
-                        .values = data->density_volume.iso.values,
-                        .colors = data->density_volume.iso.colors,
-                    },
-                    .isosurface_enabled = data->density_volume.iso.enabled,
-                    .direct_volume_rendering_enabled = data->density_volume.dvr.enabled,
+                        str_t x_label = STR("Frame");
+                        str_t y_label = str_from_cstr(dp.label);
 
-                    .voxel_spacing = data->density_volume.voxel_spacing
-                };
-                volume::render_volume(vol_desc);
-            }
-        }
+                        if (!md_unit_empty(dp.unit)) {
+                            y_label = alloc_printf(frame_allocator, "%s (%s)", dp.label, dp.unit_str);
+                        }
 
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        glDrawBuffer(GL_BACK);
-    }
+                        md_unit_t time_unit = md_trajectory_time_unit(data->mold.traj);
+                        if (!md_unit_empty(time_unit)) {
+                            char time_buf[64];
+                            size_t len = md_unit_print(time_buf, sizeof(time_buf), time_unit);
+                            x_label = alloc_printf(frame_allocator, "Time (" STR_FMT ")", len, time_buf);
+                        }
 
-    ImGui::End();
-}
+                        md_array_push(column_data, time, frame_allocator);
+                        md_array_push(column_labels, x_label, frame_allocator);
 
-static void draw_dataset_window(ApplicationData* data) {
-    ASSERT(data);
+                        if (dp.dim > 1) {
+                            for (int i = 0; i < dp.dim; ++i) {
+                                str_t legend = alloc_printf(frame_allocator, "%s[%i]", dp.label, i + 1);
+                                md_array_push(column_data, dp.prop->data.values + i * num_frames, frame_allocator);
+                                md_array_push(legends, legend, frame_allocator);
+                                md_array_push(column_labels, legend, frame_allocator);
+                            }
+                        } else {
+                            md_array_push(column_data, dp.prop->data.values, frame_allocator);
+                            md_array_push(column_labels, y_label, frame_allocator);
+                        }
 
-    ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
-    if (ImGui::Begin("Dataset", &data->dataset.show_window)) {
-        ImGui::Text("Molecular data: %s", data->files.molecule);
-        ImGui::Text("Num atoms:    %9i", (int)data->mold.mol.atom.count);
-        ImGui::Text("Num residues: %9i", (int)data->mold.mol.residue.count);
-        ImGui::Text("Num chains:   %9i", (int)data->mold.mol.chain.count);
+                        exported = export_table(path, ext, str_from_cstr(dp.label), x_label, y_label, column_data, column_labels, md_array_size(column_data), num_frames, legends, md_array_size(legends));
 
-        if (data->files.trajectory[0] != '\0') {
-            ImGui::Separator();
-            ImGui::Text("Trajectory data: %s", data->files.trajectory);
-            ImGui::Text("Num frames:    %9i", (int)md_trajectory_num_frames(data->mold.traj));
-            ImGui::Text("Num atoms:     %9i", (int)md_trajectory_num_atoms(data->mold.traj));
-        }
+                    } else if (dp.type == DisplayProperty::Type_Distribution) {
+                        md_array(float) x_values = sample_range(dp.hist.x_min, dp.hist.x_max, dp.hist.num_bins, frame_allocator);
 
-        const char* lbls[] = {"Chains", "Residue Names", "Atom Labels"};
-        const md_array(DatasetItem) items[] = {data->dataset.chains, data->dataset.residue_names, data->dataset.atom_types};
-        STATIC_ASSERT(ARRAY_SIZE(lbls) == ARRAY_SIZE(items));
+                        str_t x_label = str_from_cstr(dp.unit_str);
+                        str_t y_label = str_from_cstr(dp.label);
 
-        const ImVec2 item_size = ImVec2(ImGui::GetFontSize() * 1.8f, ImGui::GetFontSize() * 1.1f);
-        const float window_x_max = ImGui::GetWindowPos().x + ImGui::GetWindowContentRegionMax().x;
-        for (size_t i = 0; i < ARRAY_SIZE(lbls); ++i) {
-            const size_t count = md_array_size(items[i]);
-            if (count) {
-                if (ImGui::CollapsingHeader(lbls[i])) {
-                    for (size_t j = 0; j < count; ++j) {
-                        const DatasetItem& item = items[i][j];
-                        const float t = powf(item.fraction, 0.2f) * 0.5f;
-                        ImGui::PushStyleColor(ImGuiCol_Header, ImPlot::SampleColormap(t, ImPlotColormap_Plasma));
-                        ImGui::Selectable(item.label, true, 0, item_size);
-                        ImGui::PopStyleColor();
+                        md_array_push(column_data, x_values, frame_allocator);
+                        md_array_push(column_labels, x_label, frame_allocator);
 
-                        if (ImGui::IsItemHovered()) {
-                            ImGui::SetTooltip("%s: count %d", item.label, item.count);
-                            if (filter_expression(data, str_from_cstr(item.query), &data->selection.current_highlight_mask)) {
-                                data->mold.dirty_buffers |= MolBit_DirtyFlags;
+                        if (dp.hist.dim > 1) {
+                            for (int i = 0; i < dp.hist.dim; ++i) {
+                                md_array_push(column_data, dp.hist.bins + i * dp.hist.num_bins, frame_allocator);
+                                str_t legend = alloc_printf(frame_allocator, "%s[%i]", dp.label, i + 1);
+                                md_array_push(legends, legend, frame_allocator);
+                                md_array_push(column_labels, legend, frame_allocator);
                             }
+                        } else {
+                            md_array_push(column_data, dp.hist.bins, frame_allocator);
+                            md_array_push(column_labels, y_label, frame_allocator);
                         }
 
-                        float last_item_x = ImGui::GetItemRectMax().x;
-                        float next_button_x = last_item_x + item_size.x;
-                        if (j + 1 < count && next_button_x < window_x_max) {
-                            ImGui::SameLine();
-                        }
+                        exported = export_table(path, ext, str_from_cstr(dp.label), x_label, y_label, column_data, column_labels, md_array_size(column_data), dp.hist.num_bins, legends, md_array_size(legends));
+                    }
+                    if (exported) {
+                        LOG_SUCCESS("Successfully exported property '%s' to '%.*s'", dp.label, (int)path.len, path.ptr);
                     }
                 }
             }
         }
-
-        const size_t num_mappings = md_array_size(data->dataset.atom_element_remappings);
-        if (num_mappings) {
-            if (ImGui::CollapsingHeader("Atom Element Mappings")) {
-                for (size_t i = 0; i < num_mappings; ++i) {
-                    const auto& mapping = data->dataset.atom_element_remappings[i];
-                    ImGui::Text("%s -> %s (%s)", mapping.lbl, md_util_element_name(mapping.elem).ptr, md_util_element_symbol(mapping.elem).ptr);
-                }
-            }
-        }
+        ImGui::PopItemWidth();
     }
     ImGui::End();
 }
 
-static void draw_debug_window(ApplicationData* data) {
-    ASSERT(data);
-
-    ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
-    if (ImGui::Begin("Debug", &data->show_debug_window)) {
-        size_t sema_count = 0;
-        if (md_semaphore_query_count(&data->mold.script.ir_semaphore, &sema_count)) {
-            ImGui::Text("Script IR semaphore count: %zu", sema_count);
-        }
-        
-        task_system::ID* tasks = task_system::pool_running_tasks(md_heap_allocator);
-        int64_t num_tasks = md_array_size(tasks);
-        if (num_tasks > 0) {
-            ImGui::Text("Running Pool Tasks:");
-            for (size_t i = 0; i < md_array_size(tasks); ++i) {
-                str_t lbl = task_system::task_label(tasks[i]);
-                ImGui::Text("[%i]: %.*s", (int)i, (int)lbl.len, lbl.ptr);
-            }
-        }
-
-        ImGuiID active = ImGui::GetActiveID();
-        ImGuiID hover  = ImGui::GetHoveredID();
-        ImGui::Text("Active ID: %u, Hover ID: %u", active, hover);
-
-        ImGui::Text("Mouse Pos: (%.3f, %.3f)", ImGui::GetMousePos().x, ImGui::GetMousePos().y);
-        ImGui::Text("Camera Position: (%.3f, %.3f, %.3f)", data->view.camera.position.x, data->view.camera.position.y, data->view.camera.position.z);
-        ImGui::Text("Camera Orientation: (%.3f, %.3f, %.3f, %.3f)", data->view.camera.orientation.x, data->view.camera.orientation.y, data->view.camera.orientation.z, data->view.camera.orientation.w);
+// #gbuffer
+static void init_gbuffer(GBuffer* gbuf, int width, int height) {
+    ASSERT(gbuf);
 
-		ImGui::Text("proj_matrix:");
+    bool attach_textures_deferred = false;
+    if (!gbuf->deferred.fbo) {
+        glGenFramebuffers(1, &gbuf->deferred.fbo);
+        attach_textures_deferred = true;
     }
-    ImGui::End();
-}
 
-static void draw_script_editor_window(ApplicationData* data) {
-    ASSERT(data);
+    if (!gbuf->deferred.depth) glGenTextures(1, &gbuf->deferred.depth);
+    if (!gbuf->deferred.color) glGenTextures(1, &gbuf->deferred.color);
+    if (!gbuf->deferred.normal) glGenTextures(1, &gbuf->deferred.normal);
+    if (!gbuf->deferred.velocity) glGenTextures(1, &gbuf->deferred.velocity);
+    if (!gbuf->deferred.post_tonemap) glGenTextures(1, &gbuf->deferred.post_tonemap);
+    if (!gbuf->deferred.picking) glGenTextures(1, &gbuf->deferred.picking);
+    if (!gbuf->pbo_picking.color[0]) glGenBuffers((int)ARRAY_SIZE(gbuf->pbo_picking.color), gbuf->pbo_picking.color);
+    if (!gbuf->pbo_picking.depth[0]) glGenBuffers((int)ARRAY_SIZE(gbuf->pbo_picking.depth), gbuf->pbo_picking.depth);
 
-    ImGui::SetNextWindowSize({300,200}, ImGuiCond_FirstUseEver);
-    if (ImGui::Begin("Script Editor", &data->show_script_window, ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_MenuBar)) {
-        ImGui::SetWindowSize(ImVec2(800, 600), ImGuiCond_FirstUseEver);
-        if (ImGui::BeginMenuBar())
-        {
-            if (ImGui::BeginMenu("File")) {
-                char path_buf[1024] = "";
-                if (ImGui::MenuItem("Load")) {
-                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Open, "txt")) {
-                        str_t txt = load_textfile(str_from_cstr(path_buf), frame_allocator);
-                        std::string str(txt.ptr, txt.len);
-                        editor.SetText(str);
-                    }
-                }
-                if (ImGui::MenuItem("Save")) {
-                    auto textToSave = editor.GetText();
-                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "txt")) {
-                        size_t path_len = strnlen(path_buf, sizeof(path_buf));
-                        str_t path = str_t{path_buf, path_len};
-                        if (!extract_ext(NULL, path)) {
-                            path.len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".txt");
-                        }
-                        md_file_o* file = md_file_open(path, MD_FILE_WRITE);
-                        if (file) {
-                            md_file_write(file, textToSave.c_str(), textToSave.length());
-                            md_file_close(file);
-                        } else {
-                            LOG_ERROR("Failed to open file '%s' for saving script", path_buf);
-                        }
-                    }
-                }
-                if (ImGui::MenuItem("Export")) {
-                    data->show_property_export_window = true;
-                }
-                ImGui::EndMenu();
-            }
-            if (ImGui::BeginMenu("Edit")) {
-                bool ro = editor.IsReadOnly();
-                if (ImGui::MenuItem("Read-only mode", nullptr, &ro))
-                    editor.SetReadOnly(ro);
-                ImGui::Separator();
+    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-                if (ImGui::MenuItem("Undo", "ALT-Backspace", nullptr, !ro && editor.CanUndo()))
-                    editor.Undo();
-                if (ImGui::MenuItem("Redo", "Ctrl-Y", nullptr, !ro && editor.CanRedo()))
-                    editor.Redo();
+    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.normal);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, width, height, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-                ImGui::Separator();
+    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.velocity);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-                if (ImGui::MenuItem("Copy", "Ctrl-C", nullptr, editor.HasSelection()))
-                    editor.Copy();
-                if (ImGui::MenuItem("Cut", "Ctrl-X", nullptr, !ro && editor.HasSelection()))
-                    editor.Cut();
-                if (ImGui::MenuItem("Delete", "Del", nullptr, !ro && editor.HasSelection()))
-                    editor.Delete();
-                if (ImGui::MenuItem("Paste", "Ctrl-V", nullptr, !ro && ImGui::GetClipboardText() != nullptr))
-                    editor.Paste();
+    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.post_tonemap);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-                ImGui::Separator();
+    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.picking);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-                if (ImGui::MenuItem("Select all", nullptr, nullptr))
-                    editor.SetSelection(TextEditor::Coordinates(), TextEditor::Coordinates(editor.GetTotalLines(), 0));
+    for (uint32_t i = 0; i < ARRAY_SIZE(gbuf->pbo_picking.color); ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, gbuf->pbo_picking.color[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4, NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
 
-                ImGui::EndMenu();
-            }
-            if (ImGui::BeginMenu("Settings")) {
-                if (ImGui::MenuItem("Dark palette"))
-                    editor.SetPalette(TextEditor::GetDarkPalette());
-                if (ImGui::MenuItem("Light palette"))
-                    editor.SetPalette(TextEditor::GetLightPalette());
-                if (ImGui::MenuItem("Retro blue palette"))
-                    editor.SetPalette(TextEditor::GetRetroBluePalette());
-                ImGui::Separator();
-                ImGui::ColorEdit4("Point Color",      data->script.point_color.elem);
-                ImGui::ColorEdit4("Line Color",       data->script.line_color.elem);
-                ImGui::ColorEdit4("Triangle Color",   data->script.triangle_color.elem);
+    for (uint32_t i = 0; i < ARRAY_SIZE(gbuf->pbo_picking.depth); ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, gbuf->pbo_picking.depth[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4, NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
 
-                ImGui::EndMenu();
-            }
+    if (!gbuf->composite.tex) glGenTextures(1, &gbuf->composite.tex);
+    if (!gbuf->composite.fbo) glGenFramebuffers(1, &gbuf->composite.fbo);
 
-            ImGui::EndMenuBar();
-        }
+    glBindTexture(GL_TEXTURE_2D, gbuf->composite.tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-        if (editor.IsTextChanged()) {
-            data->mold.script.compile_ir = true;
-            data->mold.script.time_since_last_change = 0;
-        }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf->composite.fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gbuf->composite.tex, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-        const ImVec2 content_size = ImGui::GetContentRegionAvail();
-        const char* btn_text = "Evaluate";
-        const ImVec2 label_size = ImGui::CalcTextSize(btn_text, NULL, true) * ImVec2(1.4, 1.0);
-        const ImVec2 btn_size = ImGui::CalcItemSize(ImVec2(0,0), label_size.x + ImGui::GetStyle().FramePadding.x * 2.0f, label_size.y + ImGui::GetStyle().FramePadding.y * 2.0f);
-        const ImVec2 text_size(content_size - ImVec2(0, btn_size.y + ImGui::GetStyle().ItemSpacing.y));
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-        editor.Render("TextEditor", text_size);
+    gbuf->width = width;
+    gbuf->height = height;
 
-        
-        bool eval = false;
-        if (editor.IsFocused() && ImGui::IsKeyDown(KEY_SCRIPT_EVALUATE_MOD) && ImGui::IsKeyPressed(KEY_SCRIPT_EVALUATE)) {
-            eval = true;
+    const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY,
+                                   GL_COLOR_ATTACHMENT_POST_TONEMAP, GL_COLOR_ATTACHMENT_PICKING};
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf->deferred.fbo);
+    if (attach_textures_deferred) {
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbuf->deferred.depth, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, gbuf->deferred.depth, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_COLOR, GL_TEXTURE_2D, gbuf->deferred.color, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_NORMAL, GL_TEXTURE_2D, gbuf->deferred.normal, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_VELOCITY, GL_TEXTURE_2D, gbuf->deferred.velocity, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_POST_TONEMAP, GL_TEXTURE_2D, gbuf->deferred.post_tonemap, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_PICKING, GL_TEXTURE_2D, gbuf->deferred.picking, 0);
+    }
+    ASSERT(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+static void destroy_gbuffer(GBuffer* gbuf) {
+    ASSERT(gbuf);
+    if (gbuf->deferred.fbo) glDeleteFramebuffers(1, &gbuf->deferred.fbo);
+    if (gbuf->deferred.depth) glDeleteTextures(1, &gbuf->deferred.depth);
+    if (gbuf->deferred.color) glDeleteTextures(1, &gbuf->deferred.color);
+    if (gbuf->deferred.normal) glDeleteTextures(1, &gbuf->deferred.normal);
+    if (gbuf->deferred.post_tonemap) glDeleteTextures(1, &gbuf->deferred.post_tonemap);
+    if (gbuf->deferred.picking) glDeleteTextures(1, &gbuf->deferred.picking);
+    if (gbuf->composite.fbo) glDeleteFramebuffers(1, &gbuf->composite.fbo);
+    if (gbuf->composite.tex) glDeleteTextures(1, &gbuf->composite.tex);
+
+    if (gbuf->pbo_picking.color[0]) glDeleteBuffers(2, gbuf->pbo_picking.color);
+    if (gbuf->pbo_picking.depth[0]) glDeleteBuffers(2, gbuf->pbo_picking.depth);
+}
+
+// Granularity of the comparison against the previously uploaded flags
+#define FLAG_UPLOAD_BLOCK 256
+// Changed blocks which are closer than this are merged into a single upload
+#define FLAG_UPLOAD_MERGE_GAP 4096
+
+// ORs flag into every entry of flags which corresponds to a set bit in the mask
+// Fully set masks are expanded with a plain (vectorizable) loop, otherwise md_bitfield_scan skips the empty words
+static void expand_bitfield_flags(uint8_t* flags, size_t count, const md_bitfield_t* mask, uint8_t flag) {
+    const int64_t beg_bit = mask->beg_bit;
+    const int64_t end_bit = MIN((int64_t)mask->end_bit, (int64_t)count);
+    if (beg_bit >= end_bit) return;
+
+    if ((int64_t)md_bitfield_popcount_range(mask, beg_bit, end_bit) == end_bit - beg_bit) {
+        for (int64_t i = beg_bit; i < end_bit; ++i) {
+            flags[i] |= flag;
         }
+        return;
+    }
 
-        ImGui::SetCursorPosX(ImGui::GetCursorPosX() + content_size.x - btn_size.x);
-        ImGui::SetCursorPosY(ImGui::GetCursorPosY() + ImGui::GetStyle().ItemSpacing.y);
+    int64_t bit = beg_bit;
+    while ((bit = md_bitfield_scan(mask, bit, end_bit)) != 0) {
+        flags[bit - 1] |= flag;
+    }
+}
 
-        const bool valid = md_script_ir_valid(data->mold.script.ir);
+static void build_atom_flags(uint8_t* flags, size_t count, const md_bitfield_t* highlight, const md_bitfield_t* selection, const md_bitfield_t* visibility) {
+    MEMSET(flags, 0, count);
+    expand_bitfield_flags(flags, count, highlight,  AtomBit_Highlighted);
+    expand_bitfield_flags(flags, count, selection,  AtomBit_Selected);
+    expand_bitfield_flags(flags, count, visibility, AtomBit_Visible);
+}
 
-        if (!valid) ImGui::PushDisabled();
-        if (ImGui::Button(btn_text, btn_size)) {
-            eval = true;
+static void update_md_buffers(ApplicationData* data) {
+    ASSERT(data);
+    const auto& mol = data->mold.mol;
+
+    if (mol.atom.count == 0) return;
+
+    if (data->mold.dirty_buffers & MolBit_DirtyPosition) {
+        const vec3_t pbc_ext = data->mold.mol.unit_cell.basis * vec3_t{1,1,1};
+        md_gl_molecule_set_atom_position(&data->mold.gl_mol, 0, (uint32_t)mol.atom.count, mol.atom.x, mol.atom.y, mol.atom.z, 0);
+        md_gl_molecule_compute_velocity(&data->mold.gl_mol, pbc_ext.elem);
+        for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+            SubsetRepresentation* sub = data->representation.reps[i].subset;
+            if (!sub || !sub->gl_valid) continue;
+            upload_subset_positions(data, sub);
+            md_gl_molecule_compute_velocity(&sub->gl_mol, pbc_ext.elem);
         }
-        if (!valid) ImGui::PopDisabled();
+#if EXPERIMENTAL_GFX_API
+        md_gfx_structure_set_atom_position(data->mold.gfx_structure, 0, (uint32_t)mol.atom.count, mol.atom.x, mol.atom.y, mol.atom.z, 0);
+        md_gfx_structure_set_aabb(data->mold.gfx_structure, &data->mold.mol_aabb_min, &data->mold.mol_aabb_max);
+#endif
+    }
 
-        if (eval && valid) {
-            data->mold.script.eval_init = true;
+    if (data->mold.dirty_buffers & MolBit_DirtyRadius) {
+        md_gl_molecule_set_atom_radius(&data->mold.gl_mol, 0, (uint32_t)mol.atom.count, mol.atom.radius, 0);
+        for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+            SubsetRepresentation* sub = data->representation.reps[i].subset;
+            if (!sub || !sub->gl_valid) continue;
+            const size_t n = md_array_size(sub->atom_src);
+            float* r = (float*)frame_scratch(FrameScratch_Subset, sizeof(float) * n);
+            gather_floats(r, mol.atom.radius, sub->atom_src, n);
+            md_gl_molecule_set_atom_radius(&sub->gl_mol, 0, (uint32_t)n, r, 0);
         }
+#if EXPERIMENTAL_GFX_API
+        md_gfx_structure_set_atom_radius(data->mold.gfx_structure, 0, (uint32_t)mol.atom.count, mol.atom.radius, 0);
+#endif
+    }
 
-        const TextEditor::Marker* hovered_marker = editor.GetHoveredMarker();
-        if (hovered_marker && hovered_marker->payload) {
-            if (md_semaphore_try_aquire(&data->mold.script.ir_semaphore)) {
-                defer { md_semaphore_release(&data->mold.script.ir_semaphore); };
-                
-                if (md_script_ir_valid(data->mold.script.ir)) {
-                    data->mold.script.vis = {0};
-                    md_script_vis_init(&data->mold.script.vis, frame_allocator);
-                    md_script_vis_ctx_t ctx = {
-                        .ir = data->mold.script.ir,
-                        .mol = &data->mold.mol,
-                        .traj = data->mold.traj,
-                    };
-                    const md_script_vis_payload_o* payload = (const md_script_vis_payload_o*)hovered_marker->payload;
+    if (data->mold.dirty_buffers & MolBit_DirtyFlags) {
+        const size_t count = mol.atom.count;
+        uint8_t* flags = (uint8_t*)frame_scratch(FrameScratch_AtomFlags, count);
+        build_atom_flags(flags, count, &data->selection.current_highlight_mask.bits, &data->selection.current_selection_mask.bits, &data->representation.atom_visibility_mask);
+        const culling::ChunkSet& chunks = data->representation.culling.chunks;
+        if (data->representation.culling.active && chunks.count > 0 && chunks.atom_offset[chunks.count] == count) {
+            for (size_t i = 0; i < chunks.count; ++i) {
+                if (chunks.state[i] == culling::ChunkState_Culled) continue;
+                const uint8_t bits = chunks.state[i] == culling::ChunkState_Detail ? (AtomBit_InView | AtomBit_Detail) : AtomBit_InView;
+                for (uint32_t j = chunks.atom_offset[i]; j < chunks.atom_offset[i + 1]; ++j) {
+                    flags[j] |= bits;
+                }
+            }
 
-                    md_script_vis_eval_payload(&data->mold.script.vis, payload, 0, &ctx, 0);
-                    
-                    if (!md_bitfield_empty(&data->mold.script.vis.atom_mask)) {
-                        md_bitfield_copy(&data->selection.current_highlight_mask, &data->mold.script.vis.atom_mask);
-                        data->mold.dirty_buffers |= MolBit_DirtyFlags;
-                    }
+            auto& lod = data->representation.lod;
+            if (lod.num_proxies == chunks.count) {
+                uint8_t* proxy_flags = (uint8_t*)md_alloc(frame_allocator, chunks.count);
+                for (size_t i = 0; i < chunks.count; ++i) {
+                    proxy_flags[i] = chunks.state[i] == culling::ChunkState_Proxy ? AtomBit_InView : 0;
+                }
+                md_gl_molecule_set_atom_flags(&lod.gl_mol, 0, (uint32_t)chunks.count, proxy_flags, 0);
+            }
+        }
+
+        uint8_t* prev = data->mold.atom_flags;
+        if (md_array_size(prev) != count) {
+            md_array_resize(data->mold.atom_flags, count, persistent_allocator);
+            MEMCPY(data->mold.atom_flags, flags, count);
+            md_gl_molecule_set_atom_flags(&data->mold.gl_mol, 0, (uint32_t)count, flags, 0);
+        } else {
+            // Compare against what was uploaded last and only upload the ranges which differ
+            size_t range_beg = SIZE_MAX;
+            size_t range_end = 0;
+            for (size_t beg = 0; beg < count; beg += FLAG_UPLOAD_BLOCK) {
+                const size_t end = MIN(beg + FLAG_UPLOAD_BLOCK, count);
+                if (memcmp(prev + beg, flags + beg, end - beg) == 0) continue;
+                if (range_beg != SIZE_MAX && beg - range_end > FLAG_UPLOAD_MERGE_GAP) {
+                    md_gl_molecule_set_atom_flags(&data->mold.gl_mol, (uint32_t)range_beg, (uint32_t)(range_end - range_beg), flags + range_beg, 0);
+                    MEMCPY(prev + range_beg, flags + range_beg, range_end - range_beg);
+                    range_beg = SIZE_MAX;
                 }
+                if (range_beg == SIZE_MAX) range_beg = beg;
+                range_end = end;
             }
+            if (range_beg != SIZE_MAX) {
+                md_gl_molecule_set_atom_flags(&data->mold.gl_mol, (uint32_t)range_beg, (uint32_t)(range_end - range_beg), flags + range_beg, 0);
+                MEMCPY(prev + range_beg, flags + range_beg, range_end - range_beg);
+            }
+        }
+
+        for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+            SubsetRepresentation* sub = data->representation.reps[i].subset;
+            if (sub && sub->gl_valid) upload_subset_flags(data, sub);
         }
+        data->selection.screen_space.dirty = true;
     }
-    ImGui::End();
-}
 
-static bool export_xvg(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename) {
-    ASSERT(column_data);
-    ASSERT(column_labels);
-    ASSERT(num_columns >= 0);
-    ASSERT(num_rows >= 0);
+    if (data->mold.dirty_buffers & MolBit_DirtyBonds) {
+        md_gl_molecule_set_bonds(&data->mold.gl_mol, 0, (uint32_t)mol.bond.count, mol.bond.pairs, sizeof(md_bond_pair_t));
+        // The number of bonds within a subset can change, so its molecule is created again
+        for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+            SubsetRepresentation* sub = data->representation.reps[i].subset;
+            if (sub && sub->gl_valid) build_subset_molecule(data, sub);
+        }
+    }
 
-    md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
-    if (!file) {
-        LOG_ERROR("Failed to open file '" STR_FMT "' to write data.", STR_ARG(filename));
-        return false;
-    }    
+    if (data->mold.dirty_buffers & MolBit_DirtySecondaryStructure) {
+        if (mol.backbone.secondary_structure) {
+            size_t beg = 0;
+            size_t end = mol.backbone.count;
+            if (data->mold.ss_dirty_beg < data->mold.ss_dirty_end) {
+                beg = data->mold.ss_dirty_beg;
+                end = MIN(data->mold.ss_dirty_end, (size_t)mol.backbone.count);
+            }
+            if (beg < end) {
+                md_gl_molecule_set_backbone_secondary_structure(&data->mold.gl_mol, (uint32_t)beg, (uint32_t)(end - beg), mol.backbone.secondary_structure + beg, 0);
+            }
+        }
+        data->mold.ss_dirty_beg = SIZE_MAX;
+        data->mold.ss_dirty_end = 0;
+    }
 
-    time_t t;
-    struct tm* info;
-    time(&t);
-    info = localtime(&t);
+    data->mold.dirty_buffers = 0;
+}
 
-    // Print Header
-    md_file_printf(file, "# This file was created %s", asctime(info));
-    md_file_printf(file, "# Created by:\n");
-    md_file_printf(file, "# VIAMD \n");
-
-    // Print Legend Meta
-    md_file_printf(file, "@    title \"VIAMD Properties\"\n");
-    md_file_printf(file, "@    xaxis  label \"Time\"\n");
-    md_file_printf(file, "@ TYPE xy\n");
-    md_file_printf(file, "@ view 0.15, 0.15, 0.75, 0.85\n");
-    md_file_printf(file, "@ legend on\n");
-    md_file_printf(file, "@ legend box on\n");
-    md_file_printf(file, "@ legend loctype view\n");
-    md_file_printf(file, "@ legend 0.78, 0.8\n");
-    md_file_printf(file, "@ legend length %i\n", num_columns);
+// Pads the AABBs of the chunks to enclose the bonds, ribbons and cartoons which are drawn between atoms of neighbouring chunks
+#define CULL_AABB_PAD 4.0f
 
-    for (size_t j = 0; j < num_columns; ++j) {
-        md_file_printf(file, "@ s%zu legend \"%s\"\n", j, column_labels[j]);
-    }
+static inline bool representation_has_lod(RepresentationType type) {
+    return type == RepresentationType::SpaceFill || type == RepresentationType::Licorice;
+}
 
-    for (size_t i = 0; i < num_rows; ++i) {
-        for (size_t j = 0; j < num_columns; ++j) {
-            md_file_printf(file, "%12.6f ", column_data[j][i]);
+static void free_representation_lod(ApplicationData* data) {
+    auto& lod = data->representation.lod;
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        Representation& rep = data->representation.reps[i];
+        if (rep.lod_rep_valid) {
+            md_gl_representation_free(&rep.lod_rep);
+            rep.lod_rep_valid = false;
         }
-        md_file_printf(file, "\n");
     }
+    if (lod.num_proxies > 0) {
+        md_gl_molecule_free(&lod.gl_mol);
+    }
+    lod.gl_mol = {};
+    lod.num_proxies = 0;
+}
 
-    md_file_close(file);
-    LOG_SUCCESS("Successfully exported XVG file to '%.*s'", (int)filename.len, filename.ptr);
-    return true;
+// The proxies are a molecule with one atom per chunk, the colors of each representation are updated along with its atoms
+static void init_representation_lod(ApplicationData* data) {
+    free_representation_lod(data);
+    const culling::ChunkSet& chunks = data->representation.culling.chunks;
+    if (chunks.count == 0) return;
+
+    md_molecule_t lod_mol = {};
+    lod_mol.atom.count = chunks.count;
+    lod_mol.atom.x = chunks.proxy_x;
+    lod_mol.atom.y = chunks.proxy_y;
+    lod_mol.atom.z = chunks.proxy_z;
+    lod_mol.atom.radius = chunks.proxy_r;
+    md_gl_molecule_init(&data->representation.lod.gl_mol, &lod_mol);
+    data->representation.lod.num_proxies = (uint32_t)chunks.count;
+    update_all_representations(data);
 }
 
-static bool export_csv(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename) {
-    ASSERT(column_data);
-    ASSERT(column_labels);
-    ASSERT(num_columns >= 0);
-    ASSERT(num_rows >= 0);
+// The color of a proxy is the mean color of the atoms of its chunk which are shown by the representation
+static void update_representation_lod_colors(ApplicationData* data, Representation* rep, const uint32_t* colors) {
+    auto& lod = data->representation.lod;
+    const culling::ChunkSet& chunks = data->representation.culling.chunks;
+    if (lod.num_proxies == 0 || lod.num_proxies != chunks.count || !representation_has_lod(rep->type)) return;
 
-    md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
-    if (!file) {
-        LOG_ERROR("Failed to open file '%.*s' to write data.", (int)filename.len, filename.ptr);
-        return false;
-    }
-    
-    for (size_t i = 0; i < num_columns; ++i) {
-        md_file_printf(file, "%s,", column_labels[i]);
+    if (!rep->lod_rep_valid) {
+        md_gl_representation_init(&rep->lod_rep, &lod.gl_mol);
+        rep->lod_rep_valid = true;
     }
-    md_file_printf(file, "\n");
 
-    for (size_t i = 0; i < num_rows; ++i) {
-        for (size_t j = 0; j < num_columns; ++j) {
-            md_file_printf(file, "%.6g,", column_data[j][i]);
+    uint32_t* proxy_colors = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * chunks.count);
+    defer { md_free(frame_allocator, proxy_colors, sizeof(uint32_t) * chunks.count); };
+    for (size_t i = 0; i < chunks.count; ++i) {
+        uint32_t sum[4] = {};
+        uint32_t n = 0;
+        for (uint32_t j = chunks.atom_offset[i]; j < chunks.atom_offset[i + 1]; ++j) {
+            const uint32_t c = colors[j];
+            if ((c >> 24) == 0) continue;
+            for (int k = 0; k < 4; ++k) sum[k] += (c >> (k * 8)) & 0xFF;
+            n += 1;
         }
-        md_file_printf(file, "\n");
+        uint32_t color = 0;
+        if (n > 0) {
+            for (int k = 0; k < 4; ++k) color |= (sum[k] / n) << (k * 8);
+        }
+        proxy_colors[i] = color;
     }
-
-    md_file_close(file);
-    LOG_SUCCESS("Successfully exported CSV file to '%.*s'", (int)filename.len, filename.ptr);
-    return true;
+    md_gl_representation_set_color(&rep->lod_rep, 0, lod.num_proxies, proxy_colors, 0);
 }
 
-static bool export_cube(ApplicationData& data, const md_script_property_t* prop, str_t filename) {
-    // @NOTE: First we need to extract some meta data for the cube format, we need the atom indices/bits for any SDF
-    // And the origin + extent of the volume in spatial coordinates (Ångström)
-
-    if (!prop) {
-        LOG_ERROR("Export Cube: The property to be exported did not exist");
-        return false;
+static void free_representation_sdf(Representation* rep) {
+    ASSERT(rep);
+    SdfRepresentation* s = rep->sdf;
+    if (!s) return;
+    if (s->task) {
+        task_system::task_interrupt_and_wait_for(s->task);
     }
+    sdf::free_field_data(&s->build);
+    sdf::free_field(&s->field);
+    md_array_free(s->atoms, persistent_allocator);
+    md_array_free(s->build_atoms, persistent_allocator);
+    md_array_free(s->x, persistent_allocator);
+    md_array_free(s->y, persistent_allocator);
+    md_array_free(s->z, persistent_allocator);
+    md_array_free(s->r, persistent_allocator);
+    md_free(persistent_allocator, s, sizeof(SdfRepresentation));
+    rep->sdf = nullptr;
+}
 
-    // Copy mol and replace with initial coords
-    md_molecule_t mol = data.mold.mol;
+// The colors of the field are updated in place, it is marked for a rebuild if the atoms it shows or its parameters change
+static void update_representation_sdf(ApplicationData* data, Representation* rep, const uint32_t* colors) {
+    if (rep->type != RepresentationType::Sdf) {
+        free_representation_sdf(rep);
+        return;
+    }
+    if (!rep->sdf) {
+        rep->sdf = (SdfRepresentation*)md_alloc(persistent_allocator, sizeof(SdfRepresentation));
+        *rep->sdf = {};
+    }
+    SdfRepresentation& s = *rep->sdf;
+    const auto& mol = data->mold.mol;
+    sdf::set_field_colors(&s.field, colors, (uint32_t)mol.atom.count);
 
-    size_t stride = ALIGN_TO(data.mold.mol.atom.count, 8);
-    float* coords = (float*)md_alloc(frame_allocator, stride * sizeof(float) * 3);
-    mol.atom.x = coords + stride * 0;
-    mol.atom.y = coords + stride * 1;
-    mol.atom.z = coords + stride * 2;
-    
-    if (!md_trajectory_load_frame(data.mold.traj, 0, NULL, mol.atom.x, mol.atom.y, mol.atom.z)) {
-        return false;
+    md_array_shrink(s.atoms, 0);
+    for (uint32_t i = 0; i < (uint32_t)mol.atom.count; ++i) {
+        if (colors[i] >> 24) md_array_push(s.atoms, i, persistent_allocator);
     }
+    uint64_t key = script_hash(s.atoms, sizeof(uint32_t) * md_array_size(s.atoms));
+    key = script_hash(&rep->scale, sizeof(rep->scale), key);
+    if (key != s.key) {
+        s.key = key;
+        s.dirty = true;
+    }
+}
 
-    bool result = false;
-    md_script_vis_t vis = { 0 };
-    md_script_vis_init(&vis, frame_allocator);
-    defer { md_script_vis_free(&vis); };
-    
-    //if (md_semaphore_aquire(&data.mold.script.ir_semaphore)) {
-    //    defer { md_semaphore_release(&data.mold.script.ir_semaphore); };
+// Completes the builds which have finished and launches the builds of fields which are dirty, a field is only rebuilt once its previous build completed
+static void update_representation_sdfs(ApplicationData* data) {
+    ASSERT(data);
+    const auto& mol = data->mold.mol;
+    const bool positions_dirty = (data->mold.dirty_buffers & (MolBit_DirtyPosition | MolBit_DirtyRadius)) != 0;
 
-        
-    if (md_script_ir_valid(data.mold.script.eval_ir)) {
-        md_script_vis_ctx_t ctx = {
-            .ir = data.mold.script.eval_ir,
-            .mol = &data.mold.mol,
-            .traj = data.mold.traj,
-        };
-        result = md_script_vis_eval_payload(&vis, prop->vis_payload, 0, &ctx, MD_SCRIPT_VISUALIZE_ATOMS | MD_SCRIPT_VISUALIZE_SDF);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        Representation& rep = data->representation.reps[i];
+        if (!rep.sdf) continue;
+        SdfRepresentation& s = *rep.sdf;
+        s.dirty |= positions_dirty;
+
+        if (s.task) {
+            if (task_system::task_is_running(s.task)) continue;
+            s.task = 0;
+            if (s.build_ok) {
+                sdf::upload_field(&s.field, &s.build);
+            } else {
+                s.field.num_stored = 0;
+            }
+            sdf::free_field_data(&s.build);
+            data->render.dirty = true;
+        }
+
+        if (!s.dirty || !rep.enabled || mol.atom.count == 0) continue;
+        s.dirty = false;
+
+        const size_t n = md_array_size(s.atoms);
+        md_array_resize(s.build_atoms, n, persistent_allocator);
+        md_array_resize(s.x, n, persistent_allocator);
+        md_array_resize(s.y, n, persistent_allocator);
+        md_array_resize(s.z, n, persistent_allocator);
+        md_array_resize(s.r, n, persistent_allocator);
+        for (size_t j = 0; j < n; ++j) {
+            const uint32_t a = s.atoms[j];
+            s.build_atoms[j] = a;
+            s.x[j] = mol.atom.x[a];
+            s.y[j] = mol.atom.y[a];
+            s.z[j] = mol.atom.z[a];
+            s.r[j] = mol.atom.radius[a];
+        }
+        s.radius_scale = rep.scale.x;
+        s.voxel_size = rep.scale.y;
+
+        s.task = task_system::pool_enqueue(STR("Build Distance Field"), [](void* user_data) {
+            SdfRepresentation* s = (SdfRepresentation*)user_data;
+            s->build_ok = sdf::build_field(&s->build, s->x, s->y, s->z, s->r, s->build_atoms, md_array_size(s->build_atoms), s->radius_scale, s->voxel_size);
+        }, &s, 0, task_system::Priority_Interactive);
     }
+}
 
-    if (result == true) {
-        md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
-        if (!file) {
-            LOG_ERROR("Failed to open file '%.*s' in order to write to it.", (int)filename.len, filename.ptr);
-            return false;
+static void draw_representation_sdfs(ApplicationData* data) {
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const Representation& rep = data->representation.reps[i];
+        if (rep.enabled && rep.sdf) {
+            sdf::draw_field(rep.sdf->field, data->view.param);
         }
+    }
+}
 
-        // Two comment lines
-        md_file_printf(file, "EXPORTED DENSITY VOLUME FROM VIAMD, UNITS IN BOHR\n");
-        md_file_printf(file, "OUTER LOOP: X, MIDDLE LOOP: Y, INNER LOOP: Z\n");
+static inline bool representation_has_subset(RepresentationType type) {
+    return type == RepresentationType::SpaceFill || type == RepresentationType::Licorice || type == RepresentationType::BallAndStick;
+}
 
-        if (md_array_size(vis.sdf.structures) > 0) {
-            const float angstrom_to_bohr = (float)(1.0 / 0.529177210903);
+static inline void gather_floats(float* dst, const float* src, const uint32_t* idx, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = src[idx[i]];
+    }
+}
 
-            // transformation matrix from world to volume
-            mat4_t M = vis.sdf.matrices[0];
-            const md_bitfield_t* bf = &vis.sdf.structures[0];
-            const int num_atoms = (int)md_bitfield_popcount(bf);
-            const int vol_dim[3] = {prop->data.dim[0], prop->data.dim[1], prop->data.dim[2]};
-            const double extent = vis.sdf.extent * 2.0 * angstrom_to_bohr;
-            const double voxel_ext[3] = {
-                (double)extent / (double)vol_dim[0],
-                (double)extent / (double)vol_dim[1],
-                (double)extent / (double)vol_dim[2],
-            };
+static void upload_subset_positions(ApplicationData* data, SubsetRepresentation* sub) {
+    const auto& mol = data->mold.mol;
+    const size_t n = md_array_size(sub->atom_src);
+    float* x = (float*)frame_scratch(FrameScratch_Subset, sizeof(float) * n * 3);
+    float* y = x + n;
+    float* z = y + n;
+    gather_floats(x, mol.atom.x, sub->atom_src, n);
+    gather_floats(y, mol.atom.y, sub->atom_src, n);
+    gather_floats(z, mol.atom.z, sub->atom_src, n);
+    md_gl_molecule_set_atom_position(&sub->gl_mol, 0, (uint32_t)n, x, y, z, 0);
+}
 
-            const double half_ext = extent * 0.5;
+static void upload_subset_flags(ApplicationData* data, SubsetRepresentation* sub) {
+    const size_t n = md_array_size(sub->atom_src);
+    if (md_array_size(data->mold.atom_flags) != data->mold.mol.atom.count) return;
+    uint8_t* flags = (uint8_t*)frame_scratch(FrameScratch_Subset, n);
+    for (size_t i = 0; i < n; ++i) {
+        flags[i] = data->mold.atom_flags[sub->atom_src[i]];
+    }
+    md_gl_molecule_set_atom_flags(&sub->gl_mol, 0, (uint32_t)n, flags, 0);
+}
 
-            md_file_printf(file, "%5i %12.6f %12.6f %12.6f\n", -num_atoms, -half_ext, -half_ext, -half_ext);
-            md_file_printf(file, "%5i %12.6f %12.6f %12.6f\n", vol_dim[0], voxel_ext[0], 0, 0);
-            md_file_printf(file, "%5i %12.6f %12.6f %12.6f\n", vol_dim[1], 0, voxel_ext[1], 0);
-            md_file_printf(file, "%5i %12.6f %12.6f %12.6f\n", vol_dim[2], 0, 0, voxel_ext[2]);
+// (Re)creates the compacted molecule from the atoms of the subset, the bonds between them are extracted from the molecule
+static void build_subset_molecule(ApplicationData* data, SubsetRepresentation* sub) {
+    const auto& mol = data->mold.mol;
+    if (sub->gl_valid) {
+        md_gl_representation_free(&sub->gl_rep);
+        md_gl_molecule_free(&sub->gl_mol);
+        sub->gl_valid = false;
+    }
 
-            const float scl = angstrom_to_bohr;
-            M = mat4_mul(mat4_scale(scl, scl, scl), M);
+    const size_t n = md_array_size(sub->atom_src);
+    uint32_t* local_idx = (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * mol.atom.count);
+    MEMSET(local_idx, 0xFF, sizeof(uint32_t) * mol.atom.count);
+    for (size_t i = 0; i < n; ++i) {
+        local_idx[sub->atom_src[i]] = (uint32_t)i;
+    }
 
-            int64_t beg_bit = bf->beg_bit;
-            int64_t end_bit = bf->end_bit;
-            while ((beg_bit = md_bitfield_scan(bf, beg_bit, end_bit)) != 0) {
-                int64_t i = beg_bit - 1;
-                vec3_t coord = {mol.atom.x[i], mol.atom.y[i], mol.atom.z[i]};
-                coord = mat4_mul_vec3(M, coord, 1.0f);
-                // @NOTE(Robin): If we don't have any elements available for example in the case of coarse grained, we use a placeholder of 1 (Hydrogen).
-                md_element_t elem = mol.atom.element ? mol.atom.element[i] : 1;
-                md_file_printf(file, "%5i %12.6f %12.6f %12.6f %12.6f\n", elem, (float)elem, coord.x, coord.y, coord.z);
-            }
+    md_array(md_bond_pair_t) bonds = 0;
+    md_array_shrink(sub->bond_src, 0);
+    for (size_t i = 0; i < mol.bond.count; ++i) {
+        const uint32_t a = local_idx[mol.bond.pairs[i].idx[0]];
+        const uint32_t b = local_idx[mol.bond.pairs[i].idx[1]];
+        if (a == ~0U || b == ~0U) continue;
+        md_bond_pair_t pair = {};
+        pair.idx[0] = a;
+        pair.idx[1] = b;
+        md_array_push(bonds, pair, frame_allocator);
+        md_array_push(sub->bond_src, (uint32_t)i, persistent_allocator);
+    }
 
-            // This entry somehow relates to the number of densities
-            md_file_printf(file, "%5i %5i\n", 1, 1);
+    float* xyzr = (float*)md_alloc(frame_allocator, sizeof(float) * n * 4);
+    md_molecule_t sub_mol = {};
+    sub_mol.atom.count = n;
+    sub_mol.atom.x = xyzr;
+    sub_mol.atom.y = xyzr + n;
+    sub_mol.atom.z = xyzr + n * 2;
+    sub_mol.atom.radius = xyzr + n * 3;
+    gather_floats(sub_mol.atom.x, mol.atom.x, sub->atom_src, n);
+    gather_floats(sub_mol.atom.y, mol.atom.y, sub->atom_src, n);
+    gather_floats(sub_mol.atom.z, mol.atom.z, sub->atom_src, n);
+    gather_floats(sub_mol.atom.radius, mol.atom.radius, sub->atom_src, n);
+    sub_mol.bond.count = md_array_size(bonds);
+    sub_mol.bond.pairs = bonds;
+
+    md_gl_molecule_init(&sub->gl_mol, &sub_mol);
+    md_gl_molecule_zero_velocity(&sub->gl_mol);
+    md_gl_representation_init(&sub->gl_rep, &sub->gl_mol);
+    md_gl_representation_set_color(&sub->gl_rep, 0, (uint32_t)n, sub->colors, 0);
+    upload_subset_flags(data, sub);
+    sub->gl_valid = true;
+    data->selection.screen_space.dirty = true;
+}
 
-            // Write density data
-            int count = 0;
-            for (int x = 0; x < vol_dim[0]; ++x) {
-                for (int y = 0; y < vol_dim[1]; ++y) {
-                    for (int z = 0; z < vol_dim[2]; ++z) {
-                        int idx = z * vol_dim[0] * vol_dim[1] + y * vol_dim[0] + x;
-                        float val = prop->data.values[idx];
-                        md_file_printf(file, " %12.6E", val);
-                        if (++count % 6 == 0) md_file_printf(file, "\n");
-                    }
-                }
-            }
-        }
+static void free_representation_subset(ApplicationData* data, Representation* rep, bool restore_md_rep) {
+    ASSERT(data);
+    ASSERT(rep);
+    SubsetRepresentation* sub = rep->subset;
+    if (!sub) return;
+    if (sub->gl_valid) {
+        md_gl_representation_free(&sub->gl_rep);
+        md_gl_molecule_free(&sub->gl_mol);
+    }
+    md_array_free(sub->atom_src, persistent_allocator);
+    md_array_free(sub->bond_src, persistent_allocator);
+    md_array_free(sub->colors, persistent_allocator);
+    data->representation.subset.slots_used &= ~(1U << sub->slot);
+    md_free(persistent_allocator, sub, sizeof(SubsetRepresentation));
+    data->selection.screen_space.dirty = true;
+    rep->subset = nullptr;
+
+    rep->md_rep = {};
+    md_array_shrink(rep->uploaded_colors, 0);
+    if (restore_md_rep) {
+        md_gl_representation_init(&rep->md_rep, &data->mold.gl_mol);
+    }
+}
 
-        md_file_close(file);
-    } else {
-        LOG_ERROR("Failed to visualize volume for export.");
-        return false;
+static void free_representation_subset_shaders(ApplicationData* data) {
+    auto& s = data->representation.subset;
+    for (uint32_t i = 0; i < SUBSET_MAX_SLOTS; ++i) {
+        if (s.shaders_valid[i]) {
+            md_gl_shaders_free(&s.shaders[i]);
+            s.shaders_valid[i] = false;
+        }
     }
+}
 
-    return true;
+// The shaders are compiled when the representations are first drawn, which keeps them off the startup
+static const md_gl_shaders_t* representation_shaders(ApplicationData* data) {
+    if (!data->mold.gl_shaders_valid) {
+        md_gl_shaders_init(&data->mold.gl_shaders, shader_output_snippet.ptr, shader_output_snippet.len);
+        data->mold.gl_shaders_valid = true;
+    }
+    return &data->mold.gl_shaders;
 }
 
-#define APPEND_BUF(buf, len, fmt, ...) (len += snprintf(buf + len, MAX(0, (int)sizeof(buf) - len), fmt, ##__VA_ARGS__) + 1)
+static const md_gl_shaders_t* representation_shaders_lean_and_mean(ApplicationData* data) {
+    if (!data->mold.gl_shaders_lean_and_mean_valid) {
+        md_gl_shaders_init(&data->mold.gl_shaders_lean_and_mean, shader_output_snippet_lean_and_mean.ptr, shader_output_snippet_lean_and_mean.len);
+        data->mold.gl_shaders_lean_and_mean_valid = true;
+    }
+    return &data->mold.gl_shaders_lean_and_mean;
+}
 
-static md_array(float) sample_range(float beg, float end, int sample_count, md_allocator_i* alloc) {
-    md_array(float) result = md_array_create(float, sample_count, alloc);
-    double step = (end - beg) / (double)(sample_count - 1);
-    for (int i = 0; i < sample_count; ++i) {
-        result[i] = (float)((double)beg + step * (double)i);
+static const md_gl_shaders_t* subset_shaders(ApplicationData* data, uint32_t slot) {
+    auto& s = data->representation.subset;
+    if (!s.shaders_valid[slot]) {
+        char snippet[4096];
+        const int len = snprintf(snippet, sizeof(snippet), "\n#define ATOM_INDEX_TAG 0x%08XU\n%.*s", (slot + 1) << SUBSET_INDEX_BITS, (int)shader_output_snippet.len, shader_output_snippet.ptr);
+        md_gl_shaders_init(&s.shaders[slot], snippet, (size_t)len);
+        s.shaders_valid[slot] = true;
     }
-    return result;
+    return &s.shaders[slot];
 }
 
-static void draw_property_export_window(ApplicationData* data) {
+// Moves the representation to a compacted molecule of its atoms if it shows a small part of the atoms, and back if not
+// The colors are only uploaded for the atoms of the subset
+static void update_representation_subset(ApplicationData* data, Representation* rep, const uint32_t* colors) {
     ASSERT(data);
+    ASSERT(rep);
+    const auto& mol = data->mold.mol;
+    auto& s = data->representation.subset;
+
+    const size_t count = md_bitfield_popcount(&rep->atom_mask);
+    bool eligible = s.enabled && !use_gfx && representation_has_subset(rep->type) && count > 0 && count <= mol.atom.count * SUBSET_MAX_FRACTION;
+    // The local indices and the indices of the molecule must both fit below the tag
+    eligible &= mol.atom.count < (1U << SUBSET_INDEX_BITS) && mol.bond.count < (1U << SUBSET_INDEX_BITS);
+    if (eligible && !rep->subset) {
+        eligible = s.slots_used != (1U << SUBSET_MAX_SLOTS) - 1;
+    }
+    if (!eligible) {
+        free_representation_subset(data, rep, true);
+        return;
+    }
 
-    struct ExportFormat {
-        const char* label;
-        const char* extension;
-    };
-
-    ExportFormat table_formats[] {
-        {"XVG", "xvg"},
-        {"CSV", "csv"}
-    };
+    if (!rep->subset) {
+        uint32_t slot = 0;
+        while (s.slots_used & (1U << slot)) ++slot;
+        s.slots_used |= 1U << slot;
+        rep->subset = (SubsetRepresentation*)md_alloc(persistent_allocator, sizeof(SubsetRepresentation));
+        *rep->subset = {};
+        rep->subset->slot = slot;
+        md_gl_representation_free(&rep->md_rep);
+        rep->md_rep = {};
+    }
+    SubsetRepresentation& sub = *rep->subset;
 
-    ExportFormat volume_formats[] {
-        {"Gaussian Cube", "cube"},
-    };
+    md_array_shrink(sub.atom_src, 0);
+    md_bitfield_iter_t it = md_bitfield_iter_create(&rep->atom_mask);
+    while (md_bitfield_iter_next(&it)) {
+        const uint32_t a = (uint32_t)md_bitfield_iter_idx(&it);
+        if (a >= mol.atom.count) break;
+        md_array_push(sub.atom_src, a, persistent_allocator);
+    }
+    const size_t n = md_array_size(sub.atom_src);
+    md_array_resize(sub.colors, n, persistent_allocator);
+    for (size_t i = 0; i < n; ++i) {
+        sub.colors[i] = colors[sub.atom_src[i]];
+    }
 
-    if (ImGui::Begin("Property Export", &data->show_property_export_window)) {
-        static int type = DisplayProperty::Type_Temporal;
-        static int property_idx  = 0;
-        static int table_format  = 0;
-        static int volume_format = 0;
+    const uint64_t key = script_hash(sub.atom_src, sizeof(uint32_t) * n);
+    if (key != sub.key || !sub.gl_valid) {
+        sub.key = key;
+        build_subset_molecule(data, &sub);
+    } else {
+        md_gl_representation_set_color(&sub.gl_rep, 0, (uint32_t)n, sub.colors, 0);
+    }
+}
 
-        int num_properties = (int)md_array_size(data->display_properties);
-        if (num_properties == 0) {
-            ImGui::Text("No properties available for export, try evaluating the script.");
-			ImGui::End();
-            property_idx = 0;
-			return;
+// Maps the picking indices which are tagged by a compacted representation back to indices of the molecule
+static uint32_t resolve_picking_idx(const ApplicationData* data, uint32_t idx) {
+    ASSERT(data);
+    if (idx == INVALID_PICKING_IDX || data->representation.subset.slots_used == 0) return idx;
+    const uint32_t tag = (idx & 0x7FFFFFFF) >> SUBSET_INDEX_BITS;
+    if (tag == 0) return idx;
+    const uint32_t local = idx & ((1U << SUBSET_INDEX_BITS) - 1);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const SubsetRepresentation* sub = data->representation.reps[i].subset;
+        if (!sub || sub->slot + 1 != tag) continue;
+        if (idx & 0x80000000) {
+            return local < md_array_size(sub->bond_src) ? (0x80000000 | sub->bond_src[local]) : INVALID_PICKING_IDX;
         }
+        return local < md_array_size(sub->atom_src) ? sub->atom_src[local] : INVALID_PICKING_IDX;
+    }
+    return INVALID_PICKING_IDX;
+}
 
-        if (task_system::task_is_running(data->tasks.evaluate_full)) {
-            ImGui::Text("The properties is currently being evaluated, please wait...");
-            ImGui::End();
-            property_idx = 0;
-            return;
+// Even-odd test of p against the polygon
+static bool point_in_polygon(vec2_t p, const vec2_t* poly, int64_t count) {
+    bool inside = false;
+    for (int64_t i = 0, j = count - 1; i < count; j = i++) {
+        if ((poly[i].y > p.y) != (poly[j].y > p.y) && p.x < poly[i].x + (p.y - poly[i].y) * (poly[j].x - poly[i].x) / (poly[j].y - poly[i].y)) {
+            inside = !inside;
         }
+    }
+    return inside;
+}
 
-        ImGui::PushItemWidth(200);
-        if (ImGui::Combo("Data Type", (int*)(&type), "Temporal\0Distribution\0Density Volume\0")) {
-            if (property_idx != -1) {
-                const char* cur_lbl = data->display_properties[property_idx].label;
-                for (int i = 0; i < (int)md_array_size(data->display_properties); ++i) {
-                    const DisplayProperty& dp = data->display_properties[i];
-                    if (type == dp.type && strcmp(cur_lbl, dp.label) == 0) {
-                        property_idx = i;
-                        break;
-                    }
-                }
-            }
-        }
-        ImGui::Separator();
-        
-        if (ImGui::BeginCombo("Property", property_idx != -1 ? data->display_properties[property_idx].label : "")) {
-            for (int i = 0; i < (int)md_array_size(data->display_properties); ++i) {
-                const DisplayProperty& dp = data->display_properties[i];
-                if (type == dp.type) {
-                    if (ImGui::Selectable(dp.label, property_idx == i)) {
-                        property_idx = i;
-                    }
+// Collects the indices of the pixels of the region which has been read back, row by row within the lasso if there is one
+static void collect_region_selection(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    auto& r = data->selection.region;
+    const int32_t w = r.read.rect[2];
+    const int32_t h = r.read.rect[3];
+    const vec2_t* poly = r.read.polygon;
+    const int64_t num_poly = (int64_t)md_array_size(poly);
+    float* cross = num_poly > 2 ? (float*)md_alloc(md_heap_allocator, sizeof(float) * num_poly) : 0;
+
+    uint32_t prev = INVALID_PICKING_IDX;
+    for (int32_t y = 0; y < h; ++y) {
+        // Spans of the row which are inside the lasso, by the crossings of its edges with the center of the row (even-odd)
+        int64_t num_cross = 0;
+        if (cross) {
+            const float yc = (float)(r.read.rect[1] + y) + 0.5f;
+            for (int64_t i = 0, j = num_poly - 1; i < num_poly; j = i++) {
+                const vec2_t a = poly[i];
+                const vec2_t b = poly[j];
+                if ((a.y > yc) == (b.y > yc)) continue;
+                const float x = a.x + (yc - a.y) * (b.x - a.x) / (b.y - a.y);
+                int64_t k = num_cross++;
+                while (k > 0 && cross[k - 1] > x) {
+                    cross[k] = cross[k - 1];
+                    --k;
                 }
+                cross[k] = x;
             }
-            ImGui::EndCombo();
+        } else {
+            num_cross = 2;
         }
-        
-        const char* file_extension = "";
-        if (type == DisplayProperty::Type_Distribution || type == DisplayProperty::Type_Temporal) {
-            if (ImGui::BeginCombo("File Format", table_formats[table_format].label)) {
-                for (int i = 0; i < (int)ARRAY_SIZE(table_formats); ++i) {
-                    if (ImGui::Selectable(table_formats[i].label, table_format == i)) {
-                        table_format = i;
-                    }
-                }
-                ImGui::EndCombo();
+
+        const uint32_t* row = r.mapped + (size_t)y * w;
+        for (int64_t s = 0; s + 1 < num_cross; s += 2) {
+            int32_t beg = 0;
+            int32_t end = w;
+            if (cross) {
+                beg = CLAMP((int32_t)ceilf(cross[s]     - (float)r.read.rect[0] - 0.5f), 0, w);
+                end = CLAMP((int32_t)ceilf(cross[s + 1] - (float)r.read.rect[0] - 0.5f), 0, w);
             }
-            file_extension = table_formats[table_format].extension;
-        } else if (type == DisplayProperty::Type_Volume) {
-            if (ImGui::BeginCombo("File Format", volume_formats[volume_format].label)) {
-                for (int i = 0; i < (int)ARRAY_SIZE(volume_formats); ++i) {
-                    if (ImGui::Selectable(volume_formats[i].label, volume_format == i)) {
-                        volume_format = i;
-                    }
+            for (int32_t x = beg; x < end; ++x) {
+                const uint32_t idx = row[x];
+                // Neighboring pixels mostly hold the same index
+                if (idx == prev || idx == INVALID_PICKING_IDX) continue;
+                prev = idx;
+                if ((idx & 0x7FFFFFFF) >> SUBSET_INDEX_BITS) {
+                    md_array_push(r.tagged, idx, md_heap_allocator);
+                } else if (idx & 0x80000000) {
+                    md_bitfield_set_bit(&r.bonds, idx & 0x7FFFFFFF);
+                } else {
+                    md_bitfield_set_bit(&r.atoms, idx);
                 }
-                ImGui::EndCombo();
             }
-            file_extension = volume_formats[volume_format].extension;
-		}
-
-        if (property_idx != -1) {
-            if (type != data->display_properties[property_idx].type) {
-				property_idx = -1;
-			}
         }
+    }
 
-        if (property_idx == -1) ImGui::PushDisabled();
-        bool export_clicked = ImGui::Button("Export");
-        if (property_idx == -1) ImGui::PopDisabled();
-
-        if (export_clicked) {
-            ASSERT(property_idx != -1);
-            char path_buf[1024];
-            DisplayProperty& dp = data->display_properties[property_idx];
-            md_array(const float*)  column_data = 0;
-            md_array(str_t)         column_labels = 0;
-            md_array(str_t)         legends = 0;
-
-            if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, file_extension)) {
-                size_t path_len = strnlen(path_buf, sizeof(path_buf));
-                if (!extract_ext(NULL, {path_buf, path_len})) {
-                    path_len += snprintf(path_buf + path_len, sizeof(path_buf) - path_len, ".%s", file_extension);
-                }
-                str_t path = {path_buf, path_len};
-                if (dp.type == DisplayProperty::Type_Volume) {
-                    if (strcmp(file_extension, "cube") == 0) {
-                        if (export_cube(*data, dp.prop, path)) {
-                            LOG_SUCCESS("Successfully exported property '%s' to '%.*s'", dp.label, (int)path.len, path.ptr);
-                        }
-                    }
-                } else {
-                    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
-                    if (file) {
-                        str_t out_str = {};
-                        if (dp.type == DisplayProperty::Type_Temporal) {
-                            const double* traj_times = md_trajectory_frame_times(data->mold.traj);
-                            const int64_t num_frames = md_trajectory_num_frames(data->mold.traj);
-                            md_array(float) time = md_array_create(float, num_frames, frame_allocator);
-                            for (int64_t i = 0; i < num_frames; ++i) {
-                                time[i] = (float)traj_times[i];
-                            }
-
-                            str_t x_label = STR("Frame");
-                            str_t y_label = str_from_cstr(dp.label);
-
-                            if (!md_unit_empty(dp.unit)) {
-                                y_label = alloc_printf(frame_allocator, "%s (%s)", dp.label, dp.unit_str);
-                            }
-
-                            md_unit_t time_unit = md_trajectory_time_unit(data->mold.traj);
-                            if (!md_unit_empty(time_unit)) {
-                                char time_buf[64];
-                                size_t len = md_unit_print(time_buf, sizeof(time_buf), time_unit);
-                                x_label = alloc_printf(frame_allocator, "Time (" STR_FMT ")", len, time_buf);
-                            }
-
-                            md_array_push(column_data, time, frame_allocator);
-                            md_array_push(column_labels, x_label, frame_allocator);
-
-                            if (dp.dim > 1) {
-                                for (int i = 0; i < dp.dim; ++i) {
-                                    str_t legend = alloc_printf(frame_allocator, "%s[%i]", dp.label, i + 1);
-                                    md_array_push(column_data, dp.prop->data.values + i * num_frames, frame_allocator);
-                                    md_array_push(legends, legend, frame_allocator);
-                                    md_array_push(column_labels, legend, frame_allocator);
-                                }
-                            } else {
-                                md_array_push(column_data, dp.prop->data.values, frame_allocator);
-                                md_array_push(column_labels, y_label, frame_allocator);
-                            }
-
-                            if (strcmp(file_extension, "xvg") == 0) {
-                                str_t header = md_xvg_format_header(str_from_cstr(dp.label), x_label, y_label, md_array_size(legends), legends, frame_allocator);
-                                out_str = md_xvg_format(header, md_array_size(column_data), num_frames, column_data, frame_allocator);
-                            } else if (strcmp(file_extension, "csv") == 0) {
-                                out_str = md_csv_write_to_str(column_data, column_labels, md_array_size(column_data), num_frames, frame_allocator);
-                            }
-
-
-                        } else if (dp.type == DisplayProperty::Type_Distribution) {
-                            md_array(float) x_values = sample_range(dp.hist.x_min, dp.hist.x_max, dp.hist.num_bins, frame_allocator);
+    if (cross) md_free(md_heap_allocator, cross, sizeof(float) * num_poly);
+}
 
-                            str_t x_label = str_from_cstr(dp.unit_str);
-                            str_t y_label = str_from_cstr(dp.label);
+// Applies the atoms and bonds which were collected from the region to the highlight, and to the selection if the region is committed
+static void apply_region_selection(ApplicationData* data) {
+    ASSERT(data);
+    auto& r = data->selection.region;
+    const md_molecule_t& mol = data->mold.mol;
 
-                            md_array_push(column_data, x_values, frame_allocator);
-                            md_array_push(column_labels, x_label, frame_allocator);
+    md_bitfield_t mask = {0};
+    md_bitfield_init(&mask, frame_allocator);
+    md_bitfield_copy(&mask, &r.atoms);
 
-                            if (dp.hist.dim > 1) {
-                                for (int i = 0; i < dp.hist.dim; ++i) {
-                                    md_array_push(column_data, dp.hist.bins + i * dp.hist.num_bins, frame_allocator);
-                                    str_t legend = alloc_printf(frame_allocator, "%s[%i]", dp.label, i + 1);
-                                    md_array_push(legends, legend, frame_allocator);
-                                    md_array_push(column_labels, legend, frame_allocator);
-                                }
-                            } else {
-                                md_array_push(column_data, dp.hist.bins, frame_allocator);
-                                md_array_push(column_labels, y_label, frame_allocator);
-                            }
+    md_bitfield_iter_t it = md_bitfield_iter_create(&r.bonds);
+    while (md_bitfield_iter_next(&it)) {
+        const uint64_t i = md_bitfield_iter_idx(&it);
+        if (i >= mol.bond.count) break;
+        md_bitfield_set_bit(&mask, mol.bond.pairs[i].idx[0]);
+        md_bitfield_set_bit(&mask, mol.bond.pairs[i].idx[1]);
+    }
 
-                            if (strcmp(file_extension, "xvg") == 0) {
-                                str_t header = md_xvg_format_header(str_from_cstr(dp.label), x_label, y_label, md_array_size(legends), legends, frame_allocator);
-                                out_str = md_xvg_format(header, md_array_size(column_data), dp.hist.num_bins, column_data, frame_allocator);
-                            } else if (strcmp(file_extension, "csv") == 0) {
-                                out_str = md_csv_write_to_str(column_data, column_labels, md_array_size(column_data), dp.hist.num_bins, frame_allocator);
-                            }
-                        }
-                        if (!str_empty(out_str)) {
-                            md_file_write(file, out_str.ptr, out_str.len);
-                            LOG_SUCCESS("Successfully exported property '%s' to '%.*s'", dp.label, (int)path.len, path.ptr);
-                        }
-                        md_file_close(file);
-                    }
-                }
-            }
+    // The indices of compacted representations are resolved here, as it reads the representations
+    for (size_t i = 0; i < md_array_size(r.tagged); ++i) {
+        const uint32_t idx = resolve_picking_idx(data, r.tagged[i]);
+        if (idx == INVALID_PICKING_IDX) continue;
+        if (idx & 0x80000000) {
+            const uint32_t bond_idx = idx & 0x7FFFFFFF;
+            if (bond_idx >= mol.bond.count) continue;
+            md_bitfield_set_bit(&mask, mol.bond.pairs[bond_idx].idx[0]);
+            md_bitfield_set_bit(&mask, mol.bond.pairs[bond_idx].idx[1]);
+        } else {
+            md_bitfield_set_bit(&mask, idx);
         }
-        ImGui::PopItemWidth();
     }
-    ImGui::End();
-}
-
-// #gbuffer
-static void init_gbuffer(GBuffer* gbuf, int width, int height) {
-    ASSERT(gbuf);
 
-    bool attach_textures_deferred = false;
-    if (!gbuf->deferred.fbo) {
-        glGenFramebuffers(1, &gbuf->deferred.fbo);
-        attach_textures_deferred = true;
+    // The molecule may have been replaced while the region was read
+    if (mask.end_bit > mol.atom.count) {
+        md_bitfield_clear_range(&mask, mol.atom.count, mask.end_bit);
     }
+    grow_mask_by_current_selection_granularity(&mask, *data);
 
-    if (!gbuf->deferred.depth) glGenTextures(1, &gbuf->deferred.depth);
-    if (!gbuf->deferred.color) glGenTextures(1, &gbuf->deferred.color);
-    if (!gbuf->deferred.normal) glGenTextures(1, &gbuf->deferred.normal);
-    if (!gbuf->deferred.velocity) glGenTextures(1, &gbuf->deferred.velocity);
-    if (!gbuf->deferred.post_tonemap) glGenTextures(1, &gbuf->deferred.post_tonemap);
-    if (!gbuf->deferred.picking) glGenTextures(1, &gbuf->deferred.picking);
-    if (!gbuf->pbo_picking.color[0]) glGenBuffers((int)ARRAY_SIZE(gbuf->pbo_picking.color), gbuf->pbo_picking.color);
-    if (!gbuf->pbo_picking.depth[0]) glGenBuffers((int)ARRAY_SIZE(gbuf->pbo_picking.depth), gbuf->pbo_picking.depth);
+    if (r.read.remove) {
+        md_bitfield_andnot(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.current_selection_mask.bits, &mask);
+    } else {
+        md_bitfield_or(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.current_selection_mask.bits, &mask);
+    }
+    if (r.read.commit) {
+        md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_selection_mask), &data->selection.current_highlight_mask.bits);
+    }
+    data->mold.dirty_buffers |= MolBit_DirtyFlags;
+}
 
-    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.depth);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+// Sets the region to read next, min_p and max_p are in window coordinates and the lasso is taken from data->selection.region.lasso
+// Only the latest region is read, except that a committed region is kept until it has been read
+static void request_region_selection(ApplicationData* data, vec2_t min_p, vec2_t max_p, bool remove, bool commit) {
+    ASSERT(data);
+    auto& r = data->selection.region;
+    if (r.want.valid && r.want.commit && !commit) return;
+
+    const int32_t w = data->gbuffer.width;
+    const int32_t h = data->gbuffer.height;
+    const int32_t x0 = CLAMP((int32_t)floorf(min_p.x), 0, w);
+    const int32_t x1 = CLAMP((int32_t)ceilf(max_p.x), 0, w);
+    const int32_t y0 = CLAMP(h - (int32_t)ceilf(max_p.y), 0, h);
+    const int32_t y1 = CLAMP(h - (int32_t)floorf(min_p.y), 0, h);
+
+    r.want.valid = true;
+    r.want.remove = remove;
+    r.want.commit = commit;
+    r.want.rect[0] = x0;
+    r.want.rect[1] = y0;
+    r.want.rect[2] = x1 - x0;
+    r.want.rect[3] = y1 - y0;
+    md_array_shrink(r.want.polygon, 0);
+    for (size_t i = 0; i < md_array_size(r.lasso); ++i) {
+        const vec2_t p = {r.lasso[i].x, (float)h - r.lasso[i].y};
+        md_array_push(r.want.polygon, p, persistent_allocator);
+    }
+}
 
-    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.color);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+static void read_region_selection(ApplicationData* data) {
+    ASSERT(data);
+    auto& r = data->selection.region;
+    r.want.valid = false;
+    r.read.remove = r.want.remove;
+    r.read.commit = r.want.commit;
+    MEMCPY(r.read.rect, r.want.rect, sizeof(r.read.rect));
+    md_array_shrink(r.read.polygon, 0);
+    for (size_t i = 0; i < md_array_size(r.want.polygon); ++i) {
+        md_array_push(r.read.polygon, r.want.polygon[i], persistent_allocator);
+    }
 
-    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.normal);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, width, height, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    md_bitfield_clear(&r.atoms);
+    md_bitfield_clear(&r.bonds);
+    md_array_shrink(r.tagged, 0);
 
-    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.velocity);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    const size_t size = (size_t)r.read.rect[2] * r.read.rect[3] * sizeof(uint32_t);
+    if (size == 0) {
+        apply_region_selection(data);
+        return;
+    }
 
-    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.post_tonemap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (!r.pbo) glGenBuffers(1, &r.pbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, data->gbuffer.deferred.fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT_PICKING);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+    if (size > r.pbo_size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        r.pbo_size = size;
+    }
+    glReadPixels(r.read.rect[0], r.read.rect[1], r.read.rect[2], r.read.rect[3], GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-    glBindTexture(GL_TEXTURE_2D, gbuf->deferred.picking);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-    for (uint32_t i = 0; i < ARRAY_SIZE(gbuf->pbo_picking.color); ++i) {
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, gbuf->pbo_picking.color[i]);
-        glBufferData(GL_PIXEL_PACK_BUFFER, 4, NULL, GL_DYNAMIC_READ);
+// Same scheme as update_screenshot_captures, the region is mapped once it has been read back and its indices are collected on the pool
+// If wait is set, the region in flight is completed and no new region is read
+static void update_region_selection(ApplicationData* data, bool wait) {
+    ASSERT(data);
+    auto& r = data->selection.region;
+    if (r.fence) {
+        const GLenum res = glClientWaitSync((GLsync)r.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? UINT64_MAX : 0);
+        if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) return;
+        glDeleteSync((GLsync)r.fence);
+        r.fence = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+        r.mapped = (const uint32_t*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!r.mapped) {
+            LOG_ERROR("Failed to read back the region of the picking buffer");
+        } else {
+            r.task = task_system::pool_enqueue(STR("Region Selection"), collect_region_selection, data, 0, task_system::Priority_Interactive);
+            // Launched now, a task which has not been piped yet reads as completed below
+            task_system::execute_task(r.task);
+        }
     }
 
-    for (uint32_t i = 0; i < ARRAY_SIZE(gbuf->pbo_picking.depth); ++i) {
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, gbuf->pbo_picking.depth[i]);
-        glBufferData(GL_PIXEL_PACK_BUFFER, 4, NULL, GL_DYNAMIC_READ);
+    if (r.task) {
+        if (wait) {
+            task_system::task_wait_for(r.task);
+        } else if (task_system::task_is_running(r.task)) {
+            return;
+        }
+        r.task = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        r.mapped = 0;
+        apply_region_selection(data);
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!wait && r.want.valid) {
+        read_region_selection(data);
+    }
+}
 
-    gbuf->width = width;
-    gbuf->height = height;
+static void free_region_selection(ApplicationData* data) {
+    ASSERT(data);
+    auto& r = data->selection.region;
+    update_region_selection(data, true);
+    if (r.pbo) glDeleteBuffers(1, &r.pbo);
+    r.pbo = 0;
+    md_bitfield_free(&r.atoms);
+    md_bitfield_free(&r.bonds);
+    md_array_free(r.tagged, md_heap_allocator);
+    md_array_free(r.lasso, persistent_allocator);
+    md_array_free(r.want.polygon, persistent_allocator);
+    md_array_free(r.read.polygon, persistent_allocator);
+}
 
-    const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY,
-                                   GL_COLOR_ATTACHMENT_POST_TONEMAP, GL_COLOR_ATTACHMENT_PICKING};
+// The flags are laid out as atoms, bonds and then the atoms and bonds of each compacted molecule, in the index spaces of the picking buffer
+// A bond is flagged if both of its atoms are
+static void update_selection_buffer(ApplicationData* data) {
+    ASSERT(data);
+    auto& ss = data->selection.screen_space;
+    if (!ss.dirty) return;
+    ss.dirty = false;
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf->deferred.fbo);
-    if (attach_textures_deferred) {
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbuf->deferred.depth, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, gbuf->deferred.depth, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_COLOR, GL_TEXTURE_2D, gbuf->deferred.color, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_NORMAL, GL_TEXTURE_2D, gbuf->deferred.normal, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_VELOCITY, GL_TEXTURE_2D, gbuf->deferred.velocity, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_POST_TONEMAP, GL_TEXTURE_2D, gbuf->deferred.post_tonemap, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT_PICKING, GL_TEXTURE_2D, gbuf->deferred.picking, 0);
+    const auto& mol = data->mold.mol;
+    const uint8_t* atom_flags = data->mold.atom_flags;
+    if (md_array_size(atom_flags) != mol.atom.count) return;
+
+    const uint8_t mask = AtomBit_Highlighted | AtomBit_Selected;
+    size_t count = mol.atom.count + mol.bond.count;
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const SubsetRepresentation* sub = data->representation.reps[i].subset;
+        if (sub && sub->gl_valid) count += md_array_size(sub->atom_src) + md_array_size(sub->bond_src);
     }
-    ASSERT(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-}
+    uint8_t* flags = (uint8_t*)frame_scratch(FrameScratch_HighlightFlags, MAX(count, 1));
+    MEMSET(ss.index_offset, 0xFF, sizeof(ss.index_offset));
+    ss.index_offset[0] = 0;
+    ss.index_offset[1] = (uint32_t)mol.atom.count;
+    for (size_t i = 0; i < mol.atom.count; ++i) {
+        flags[i] = atom_flags[i] & mask;
+    }
+    uint8_t* bond_flags = flags + mol.atom.count;
+    for (size_t i = 0; i < mol.bond.count; ++i) {
+        bond_flags[i] = atom_flags[mol.bond.pairs[i].idx[0]] & atom_flags[mol.bond.pairs[i].idx[1]] & mask;
+    }
 
-static void destroy_gbuffer(GBuffer* gbuf) {
-    ASSERT(gbuf);
-    if (gbuf->deferred.fbo) glDeleteFramebuffers(1, &gbuf->deferred.fbo);
-    if (gbuf->deferred.depth) glDeleteTextures(1, &gbuf->deferred.depth);
-    if (gbuf->deferred.color) glDeleteTextures(1, &gbuf->deferred.color);
-    if (gbuf->deferred.normal) glDeleteTextures(1, &gbuf->deferred.normal);
-    if (gbuf->deferred.post_tonemap) glDeleteTextures(1, &gbuf->deferred.post_tonemap);
-    if (gbuf->deferred.picking) glDeleteTextures(1, &gbuf->deferred.picking);
+    size_t offset = mol.atom.count + mol.bond.count;
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const SubsetRepresentation* sub = data->representation.reps[i].subset;
+        if (!sub || !sub->gl_valid) continue;
+        const uint32_t tag = sub->slot + 1;
+        ss.index_offset[tag * 2 + 0] = (uint32_t)offset;
+        for (size_t j = 0; j < md_array_size(sub->atom_src); ++j) {
+            flags[offset++] = flags[sub->atom_src[j]];
+        }
+        ss.index_offset[tag * 2 + 1] = (uint32_t)offset;
+        for (size_t j = 0; j < md_array_size(sub->bond_src); ++j) {
+            flags[offset++] = bond_flags[sub->bond_src[j]];
+        }
+    }
 
-    if (gbuf->pbo_picking.color[0]) glDeleteBuffers(2, gbuf->pbo_picking.color);
-    if (gbuf->pbo_picking.depth[0]) glDeleteBuffers(2, gbuf->pbo_picking.depth);
+    // Culling changes the flags without touching the selection, so the buffer is only uploaded if its content changed
+    if (ss.buffer && md_array_size(ss.flags) == count && MEMCMP(ss.flags, flags, count) == 0) return;
+
+    const bool realloc = md_array_size(ss.flags) != count || !ss.buffer;
+    md_array_resize(ss.flags, count, persistent_allocator);
+    MEMCPY(ss.flags, flags, count);
+
+    if (!ss.buffer) glGenBuffers(1, &ss.buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, ss.buffer);
+    if (realloc) {
+        glBufferData(GL_TEXTURE_BUFFER, MAX(count, 1), flags, GL_DYNAMIC_DRAW);
+    } else {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, count, flags);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
 }
 
-static void update_md_buffers(ApplicationData* data) {
+static void zero_molecule_velocity(ApplicationData* data) {
     ASSERT(data);
-    const auto& mol = data->mold.mol;
+    md_gl_molecule_zero_velocity(&data->mold.gl_mol);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        SubsetRepresentation* sub = data->representation.reps[i].subset;
+        if (sub && sub->gl_valid) md_gl_molecule_zero_velocity(&sub->gl_mol);
+    }
+}
 
-    if (mol.atom.count == 0) return;
+// Has to run before update_md_buffers, as it relies on the dirty state of the buffers and marks the flags dirty when the visibility changes
+static void update_representation_culling(ApplicationData* data) {
+    ASSERT(data);
+    auto& c = data->representation.culling;
+    const auto& mol = data->mold.mol;
 
-    if (data->mold.dirty_buffers & MolBit_DirtyPosition) {
-        const vec3_t pbc_ext = data->mold.mol.unit_cell.basis * vec3_t{1,1,1};
-        md_gl_molecule_set_atom_position(&data->mold.gl_mol, 0, (uint32_t)mol.atom.count, mol.atom.x, mol.atom.y, mol.atom.z, 0);
-        md_gl_molecule_compute_velocity(&data->mold.gl_mol, pbc_ext.elem);
-#if EXPERIMENTAL_GFX_API
-        md_gfx_structure_set_atom_position(data->mold.gfx_structure, 0, (uint32_t)mol.atom.count, mol.atom.x, mol.atom.y, mol.atom.z, 0);
-        md_gfx_structure_set_aabb(data->mold.gfx_structure, &data->mold.mol_aabb_min, &data->mold.mol_aabb_max);
-#endif
+    if (!c.enabled || mol.atom.count == 0 || use_gfx) {
+        if (c.active) {
+            c.active = false;
+            data->mold.dirty_buffers |= MolBit_DirtyFlags;
+        }
+        return;
     }
 
-    if (data->mold.dirty_buffers & MolBit_DirtyRadius) {
-        md_gl_molecule_set_atom_radius(&data->mold.gl_mol, 0, (uint32_t)mol.atom.count, mol.atom.radius, 0);
-#if EXPERIMENTAL_GFX_API
-        md_gfx_structure_set_atom_radius(data->mold.gfx_structure, 0, (uint32_t)mol.atom.count, mol.atom.radius, 0);
-#endif
+    bool aabb_dirty = (data->mold.dirty_buffers & (MolBit_DirtyPosition | MolBit_DirtyRadius)) != 0;
+    if (c.chunks.count == 0) {
+        // Chunks hold whole residues if the residues cover the atoms in order
+        const size_t num_res = mol.residue.count;
+        uint32_t* offset = num_res ? (uint32_t*)md_alloc(frame_allocator, sizeof(uint32_t) * (num_res + 1)) : NULL;
+        for (size_t i = 0; i < num_res; ++i) {
+            const md_range_t range = md_residue_atom_range(mol.residue, i);
+            offset[i] = (uint32_t)range.beg;
+            offset[i + 1] = (uint32_t)range.end;
+            if (i > 0 && offset[i] < offset[i - 1]) {
+                offset = NULL;
+                break;
+            }
+        }
+        culling::init_chunks(&c.chunks, offset, num_res, mol.atom.count, persistent_allocator);
+        culling::compute_chunk_aabbs(&c.chunks, mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.radius, c.radius_scale, CULL_AABB_PAD);
+        init_representation_lod(data);
+        aabb_dirty = true;
     }
 
-    if (data->mold.dirty_buffers & MolBit_DirtyFlags) {
-        uint8_t* flags = (uint8_t*)md_alloc(frame_allocator, mol.atom.count);
-        for (size_t i = 0; i < mol.atom.count; i++) {
-            uint8_t f = 0;
-            f |= md_bitfield_test_bit(&data->selection.current_highlight_mask, i)     ? AtomBit_Highlighted : 0;
-            f |= md_bitfield_test_bit(&data->selection.current_selection_mask, i)     ? AtomBit_Selected : 0;
-            f |= md_bitfield_test_bit(&data->representation.atom_visibility_mask, i)  ? AtomBit_Visible : 0;
-            flags[i] = f;
+    float radius_scale = 1.0f;
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const Representation& rep = data->representation.reps[i];
+        if (rep.enabled && rep.type == RepresentationType::SpaceFill) {
+            radius_scale = MAX(radius_scale, rep.scale.x);
         }
-        md_gl_molecule_set_atom_flags(&data->mold.gl_mol, 0, (uint32_t)mol.atom.count, flags, 0);
     }
-
-    if (data->mold.dirty_buffers & MolBit_DirtyBonds) {
-        md_gl_molecule_set_bonds(&data->mold.gl_mol, 0, (uint32_t)mol.bond.count, mol.bond.pairs, sizeof(md_bond_pair_t));
+    if (radius_scale != c.radius_scale) {
+        c.radius_scale = radius_scale;
+        aabb_dirty = true;
     }
 
-    if (data->mold.dirty_buffers & MolBit_DirtySecondaryStructure) {
-        if (mol.backbone.secondary_structure) {
-            md_gl_molecule_set_backbone_secondary_structure(&data->mold.gl_mol, 0, (uint32_t)mol.backbone.count, mol.backbone.secondary_structure, 0);
+    auto& lod = data->representation.lod;
+    if (aabb_dirty) {
+        culling::compute_chunk_aabbs(&c.chunks, mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.radius, radius_scale, CULL_AABB_PAD);
+        if (lod.num_proxies == c.chunks.count) {
+            const vec3_t pbc_ext = mol.unit_cell.basis * vec3_t{1,1,1};
+            md_gl_molecule_set_atom_position(&lod.gl_mol, 0, lod.num_proxies, c.chunks.proxy_x, c.chunks.proxy_y, c.chunks.proxy_z, 0);
+            md_gl_molecule_set_atom_radius(&lod.gl_mol, 0, lod.num_proxies, c.chunks.proxy_r, 0);
+            md_gl_molecule_compute_velocity(&lod.gl_mol, pbc_ext.elem);
         }
+        c.epoch += 1;
+    }
+    if (data->render.dirty) {
+        c.epoch += 1;
     }
 
-    data->mold.dirty_buffers = 0;
+    // The captured depth depends on the view and on which representations are drawn
+    const mat4_t& view = data->view.param.matrix.current.view;
+    const mat4_t& proj = data->view.param.matrix.current.proj;
+    uint64_t key = script_hash(&c.epoch, sizeof(c.epoch));
+    key = script_hash(&view, sizeof(view), key);
+    key = script_hash(&proj, sizeof(proj), key);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        const Representation& rep = data->representation.reps[i];
+        key = script_hash(&rep.enabled, sizeof(rep.enabled), key);
+        key = script_hash(&rep.type, sizeof(rep.type), key);
+        key = script_hash(&rep.scale, sizeof(rep.scale), key);
+    }
+    const float lod_pixels = lod.enabled ? lod.pixels : 0.0f;
+    key = script_hash(&lod_pixels, sizeof(lod_pixels), key);
+    key = script_hash(&data->representation.periodic_images, sizeof(data->representation.periodic_images), key);
+
+    const bool fetched = culling::hiz_fetch(&c.hiz);
+    if (c.active && !aabb_dirty && !fetched && key == c.key) return;
+    c.key = key;
+
+    const bool changed = culling::cull_chunks(&c.chunks, proj * view, c.occlusion ? &c.hiz : NULL, key, lod_pixels, data->gbuffer.height);
+    if (changed || !c.active) {
+        data->mold.dirty_buffers |= MolBit_DirtyFlags;
+    }
+    c.active = true;
 }
 
 static void interrupt_async_tasks(ApplicationData* data) {
@@ -8543,23 +13640,51 @@ static void interrupt_async_tasks(ApplicationData* data) {
     if (data->mold.script.filt_eval) md_script_eval_interrupt(data->mold.script.filt_eval);
 
     task_system::task_wait_for(data->tasks.backbone_computations);
+    task_system::task_wait_for(data->tasks.tracking_compute);
+    task_system::task_wait_for(data->tasks.similarity_sweep);
+    task_system::task_wait_for(data->tasks.similarity_build);
+    task_system::task_wait_for(data->tasks.fluctuation);
+    task_system::task_wait_for(data->tasks.contacts);
     task_system::task_wait_for(data->tasks.evaluate_full);
     task_system::task_wait_for(data->tasks.evaluate_filt);
     task_system::task_wait_for(data->tasks.prefetch_frames);
+    if (data->mold.traj) load::traj::read_ahead_stop(data->mold.traj);
     task_system::task_wait_for(data->tasks.ramachandran_compute_full_density);
     task_system::task_wait_for(data->tasks.ramachandran_compute_filt_density);
     task_system::task_wait_for(data->tasks.shape_space_evaluate);
+    task_system::task_wait_for(data->shape_space.density.task);
+    task_system::task_wait_for(data->tasks.export_volume);
+    task_system::task_wait_for(data->tasks.repack_trajectory);
+    // The filters hold copies of the molecule which refer to its topology
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        if (data->representation.reps[i].filter) wait_async_filter(data->representation.reps[i].filter);
+        DynamicFilterCache* cache = data->representation.reps[i].filter_cache;
+        if (cache && cache->task) task_system::task_wait_for(cache->task);
+    }
+    wait_async_filter(&data->selection.query.filter);
+    if (data->mold.cell_list.task) {
+        task_system::task_wait_for(data->mold.cell_list.task);
+    }
+    if (data->cpu_picking.task) {
+        task_system::task_wait_for(data->cpu_picking.task);
+    }
+    vis_cache_clear(&data->mold.script.vis_cache);
+    data->mold.script.vis = nullptr;
+    clear_histogram_requests(data);
 }
 
 // #trajectorydata
 static void free_trajectory_data(ApplicationData* data) {
     ASSERT(data);
     interrupt_async_tasks(data);
+    clear_dynamic_filter_masks(data);
+    trajectory_sweep_init(&data->trajectory_sweep, nullptr, 0);
 
     if (data->mold.traj) {
         load::traj::close(data->mold.traj);
         data->mold.traj = nullptr;
     }
+    clear_keyframes(data);
     MEMSET(data->files.trajectory, 0, sizeof(data->files.trajectory));
     
     data->mold.mol.unit_cell = {};
@@ -8571,11 +13696,22 @@ static void free_trajectory_data(ApplicationData* data) {
     data->shape_space.num_structures = 0;
     md_array_shrink(data->shape_space.weights, 0);
     md_array_shrink(data->shape_space.coords, 0);
+
+    stop_tracking(data);
+    stop_fluctuation(data);
+    stop_contacts(data);
+    scrub_proxy_free(&data->scrub.proxy);
+    data->scrub.active = false;
+    progressive_free(&data->shape_space.sweep);
+    progressive_free(&data->trajectory_data.sweep);
+    progressive_free(&data->mold.script.full_sweep);
 }
 
 static void init_trajectory_data(ApplicationData* data) {
     size_t num_frames = md_trajectory_num_frames(data->mold.traj);
     if (num_frames > 0) {
+        trajectory_sweep_init(&data->trajectory_sweep, data->mold.traj, data->mold.mol.atom.count);
+
         size_t min_frame = 0;
         size_t max_frame = num_frames - 1;
         md_trajectory_header_t header;
@@ -8603,69 +13739,252 @@ static void init_trajectory_data(ApplicationData* data) {
         data->mold.mol.unit_cell = frame_header.unit_cell;
 
         if (data->mold.mol.backbone.count > 0) {
-            data->trajectory_data.secondary_structure.stride = data->mold.mol.backbone.count;
-            data->trajectory_data.secondary_structure.count = data->mold.mol.backbone.count * num_frames;
-            md_array_resize(data->trajectory_data.secondary_structure.data, data->mold.mol.backbone.count * num_frames, persistent_allocator);
-            for (size_t i = 0; i < md_array_size(data->trajectory_data.secondary_structure.data); ++i) {
-                data->trajectory_data.secondary_structure.data[i] = MD_SECONDARY_STRUCTURE_COIL;
+            const size_t num_backbone = data->mold.mol.backbone.count;
+            const bool compact = data->trajectory_data.compact;
+
+            data->trajectory_data.secondary_structure.stride = num_backbone;
+            data->trajectory_data.secondary_structure.count = num_backbone * num_frames;
+            data->trajectory_data.secondary_structure.packed_stride = secondary_structure_packed_stride(num_backbone);
+            if (compact) {
+                md_array_free(data->trajectory_data.secondary_structure.data, persistent_allocator);
+                data->trajectory_data.secondary_structure.data = nullptr;
+                md_array_resize(data->trajectory_data.secondary_structure.packed, data->trajectory_data.secondary_structure.packed_stride * num_frames, persistent_allocator);
+                for (size_t i = 0; i < num_frames; ++i) {
+                    secondary_structure_fill_packed(data->trajectory_data.secondary_structure.packed + data->trajectory_data.secondary_structure.packed_stride * i, MD_SECONDARY_STRUCTURE_COIL, num_backbone);
+                }
+            } else {
+                md_array_free(data->trajectory_data.secondary_structure.packed, persistent_allocator);
+                data->trajectory_data.secondary_structure.packed = nullptr;
+                md_array_resize(data->trajectory_data.secondary_structure.data, num_backbone * num_frames, persistent_allocator);
+                for (size_t i = 0; i < md_array_size(data->trajectory_data.secondary_structure.data); ++i) {
+                    data->trajectory_data.secondary_structure.data[i] = MD_SECONDARY_STRUCTURE_COIL;
+                }
             }
-//            MEMSET(data->trajectory_data.secondary_structure.data, 0, md_array_size(data->trajectory_data.secondary_structure.data) * sizeof (md_secondary_structure_t));
 
-            data->trajectory_data.backbone_angles.stride = data->mold.mol.backbone.count;
-            data->trajectory_data.backbone_angles.count = data->mold.mol.backbone.count * num_frames;
-            md_array_resize(data->trajectory_data.backbone_angles.data, data->mold.mol.backbone.count * num_frames, persistent_allocator);
-            MEMSET(data->trajectory_data.backbone_angles.data, 0, md_array_size(data->trajectory_data.backbone_angles.data) * sizeof (md_backbone_angles_t));
+            data->trajectory_data.backbone_angles.stride = num_backbone;
+            data->trajectory_data.backbone_angles.count = num_backbone * num_frames;
+            if (compact) {
+                md_array_free(data->trajectory_data.backbone_angles.data, persistent_allocator);
+                data->trajectory_data.backbone_angles.data = nullptr;
+                md_array_resize(data->trajectory_data.backbone_angles.q16, num_backbone * num_frames, persistent_allocator);
+                MEMSET(data->trajectory_data.backbone_angles.q16, 0, md_array_size(data->trajectory_data.backbone_angles.q16) * sizeof(backbone_angles_q16_t));
+            } else {
+                md_array_free(data->trajectory_data.backbone_angles.q16, persistent_allocator);
+                data->trajectory_data.backbone_angles.q16 = nullptr;
+                md_array_resize(data->trajectory_data.backbone_angles.data, num_backbone * num_frames, persistent_allocator);
+                MEMSET(data->trajectory_data.backbone_angles.data, 0, md_array_size(data->trajectory_data.backbone_angles.data) * sizeof (md_backbone_angles_t));
+            }
 
             // Launch work to compute the values
             task_system::task_interrupt_and_wait_for(data->tasks.backbone_computations);
-
-            data->tasks.backbone_computations = task_system::pool_enqueue(STR("Backbone Operations"), 0, (uint32_t)num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
-                ApplicationData* data = (ApplicationData*)user_data;
-                
-                // Create copy here of molecule since we use the full structure as input
-                md_molecule_t mol = data->mold.mol;
-
-                const size_t stride = ALIGN_TO(mol.atom.count, 8);
-                const size_t bytes = stride * sizeof(float) * 3;
-                float* coords = (float*)md_alloc(md_heap_allocator, bytes);
-                defer { md_free(md_heap_allocator, coords, bytes); };
-                // Overwrite the coordinate section, since we will load trajectory frame data into these
-                mol.atom.x = coords + stride * 0;
-                mol.atom.y = coords + stride * 1;
-                mol.atom.z = coords + stride * 2;
-
-                for (uint32_t frame_idx = range_beg; frame_idx < range_end; ++frame_idx) {
-                    md_trajectory_load_frame(data->mold.traj, frame_idx, NULL, mol.atom.x, mol.atom.y, mol.atom.z);
-                    md_util_backbone_angles_compute(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frame_idx, data->trajectory_data.backbone_angles.stride, &mol);
-                    md_util_backbone_secondary_structure_compute(data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frame_idx, data->trajectory_data.secondary_structure.stride, &mol);
-                }
-            }, data);
-
-            task_system::main_enqueue(STR("Update Trajectory Data"), [](void* user_data) {
-                ApplicationData* data = (ApplicationData*)user_data;
-                data->trajectory_data.backbone_angles.fingerprint = generate_fingerprint();
-                data->trajectory_data.secondary_structure.fingerprint = generate_fingerprint();
-                
-                interpolate_atomic_properties(data);
-                update_md_buffers(data);
-                md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
-
-            }, data, data->tasks.backbone_computations);
+            trajectory_sweep_deactivate(&data->trajectory_sweep, SweepConsumer_Backbone);
+            init_scrub_proxy(data, (uint32_t)num_frames);
+            // Coarse to fine, the partial results are published for each completed pass (see main loop)
+            progressive_init(&data->trajectory_data.sweep, (uint32_t)num_frames, persistent_allocator);
+
+            data->trajectory_data.window_complete = false;
+            progressive_set_background(&data->trajectory_data.sweep, data->trajectory_data.background_fill);
+            trajectory_sweep_set_consumer(&data->trajectory_sweep, SweepConsumer_Backbone, &data->trajectory_data.sweep, process_backbone_frame, data);
+            trajectory_sweep_activate(&data->trajectory_sweep, SweepConsumer_Backbone);
+            launch_backbone_computation(data, STR("Backbone Operations"), (uint32_t)num_frames, task_system::Priority_Background);
         }
 
         data->mold.dirty_buffers |= MolBit_DirtyPosition;
         update_md_buffers(data);
-        md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
+        zero_molecule_velocity(data); // Do this explicitly to update the previous position to avoid motion blur trails
 
         // Prefetch frames
         //launch_prefetch_job(data);
     }
 }
 
-static bool load_trajectory_data(ApplicationData* data, str_t filename, md_trajectory_loader_i* loader, bool deperiodize_on_load) {
-    md_trajectory_i* traj = load::traj::open_file(filename, loader, &data->mold.mol, persistent_allocator);
+#define BACKBONE_WINDOW_EXTENT 16 // Frames on each side of the playhead which are computed first
+
+static void process_backbone_frame(uint32_t frame_idx, const md_trajectory_frame_header_t*, const float* x, const float* y, const float* z, void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+
+    // Create copy here of molecule since we use the full structure as input
+    // The coordinates are only read by the backbone computations
+    md_molecule_t mol = data->mold.mol;
+    mol.atom.x = (float*)x;
+    mol.atom.y = (float*)y;
+    mol.atom.z = (float*)z;
+
+    const size_t num_backbone = data->trajectory_data.backbone_angles.stride;
+    if (data->trajectory_data.backbone_angles.q16) {
+        // In compact mode the frame is computed into scratch memory and then encoded
+        md_backbone_angles_t*     tmp_angles = (md_backbone_angles_t*)task_system::scratch_alloc(sizeof(md_backbone_angles_t) * num_backbone);
+        md_secondary_structure_t* tmp_ss     = (md_secondary_structure_t*)task_system::scratch_alloc(sizeof(md_secondary_structure_t) * num_backbone);
+        md_util_backbone_angles_compute(tmp_angles, num_backbone, &mol);
+        md_util_backbone_secondary_structure_compute(tmp_ss, num_backbone, &mol);
+        backbone_angles_encode(data->trajectory_data.backbone_angles.q16 + num_backbone * frame_idx, tmp_angles, num_backbone);
+        secondary_structure_pack(data->trajectory_data.secondary_structure.packed + data->trajectory_data.secondary_structure.packed_stride * frame_idx, tmp_ss, num_backbone);
+    } else {
+        md_util_backbone_angles_compute(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frame_idx, data->trajectory_data.backbone_angles.stride, &mol);
+        md_util_backbone_secondary_structure_compute(data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frame_idx, data->trajectory_data.secondary_structure.stride, &mol);
+    }
+
+    if (data->scrub.proxy.num_slots) {
+        scrub_proxy_add_frame(&data->scrub.proxy, frame_idx, x, y, z);
+    }
+}
+
+static void launch_backbone_computation(ApplicationData* data, str_t label, uint32_t num_frames, task_system::Priority priority) {
+    // The range only tells how many frames to process, which frames is decided by the sweep (prioritized window first)
+    data->tasks.backbone_computations = trajectory_sweep_enqueue(&data->trajectory_sweep, SweepConsumer_Backbone, label, num_frames, 0, priority);
+
+    task_system::main_enqueue(STR("Update Trajectory Data"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        data->trajectory_data.backbone_angles.fingerprint = generate_fingerprint();
+        data->trajectory_data.secondary_structure.fingerprint = generate_fingerprint();
+
+        interpolate_atomic_properties(data);
+        update_md_buffers(data);
+        zero_molecule_velocity(data); // Do this explicitly to update the previous position to avoid motion blur trails
+
+    }, data, data->tasks.backbone_computations);
+}
+
+// Keeps the frames around the playhead (and then the filter range) prioritized in the backbone sweep
+// Without background fill, the sweep only processes prioritized frames and a new task is launched whenever the window has pending frames
+static void update_backbone_computation(ApplicationData* data) {
+    ProgressiveSweep* sweep = &data->trajectory_data.sweep;
+    if (!sweep->num_frames || !(data->trajectory_data.backbone_angles.data || data->trajectory_data.backbone_angles.q16)) return;
+
+    const uint32_t num_frames = sweep->num_frames;
+    const uint32_t frame = (uint32_t)CLAMP((int64_t)(data->animation.frame + 0.5), 0, (int64_t)num_frames - 1);
+    const uint32_t play_beg = frame > BACKBONE_WINDOW_EXTENT ? frame - BACKBONE_WINDOW_EXTENT : 0;
+    const uint32_t play_end = MIN(frame + BACKBONE_WINDOW_EXTENT + 1, num_frames);
+
+    uint32_t beg = play_beg;
+    uint32_t end = play_end;
+    const bool play_complete = progressive_range_complete(sweep, play_beg, play_end);
+    if (play_complete) {
+        if (!data->trajectory_data.window_complete) {
+            // Make the newly computed frames around the playhead visible
+            data->trajectory_data.window_complete = true;
+            data->trajectory_data.backbone_angles.fingerprint = generate_fingerprint();
+            data->trajectory_data.secondary_structure.fingerprint = generate_fingerprint();
+            interpolate_atomic_properties(data);
+            data->mold.dirty_buffers |= MolBit_DirtyPosition;
+        }
+        // A filter which covers the whole trajectory is left to the coarse to fine order
+        beg = CLAMP((uint32_t)data->timeline.filter.beg_frame, 0, num_frames - 1);
+        end = CLAMP((uint32_t)data->timeline.filter.end_frame + 1, beg + 1, num_frames);
+        if (beg == 0 && end == num_frames) {
+            beg = end = 0;
+        }
+    } else {
+        data->trajectory_data.window_complete = false;
+    }
+
+    progressive_prioritize(sweep, beg, end);
+    progressive_set_background(sweep, data->trajectory_data.background_fill);
+
+    if (!task_system::task_is_running(data->tasks.backbone_computations)) {
+        if (progressive_range_pending(sweep, beg, end)) {
+            // The window is what the user is looking at, the rest is background fill
+            launch_backbone_computation(data, STR("##Backbone Window"), end - beg, task_system::Priority_Interactive);
+        } else if (data->trajectory_data.background_fill && sweep->cursor.load(std::memory_order_relaxed) < num_frames) {
+            launch_backbone_computation(data, STR("Backbone Operations"), num_frames - sweep->cursor.load(std::memory_order_relaxed), task_system::Priority_Background);
+        }
+    }
+}
+
+// #scrub
+#define SCRUB_PROXY_MIN_ATOMS 100000                    // Smaller systems are interactive enough without the proxy
+#define SCRUB_PROXY_MAX_BYTES (256ULL * 1024 * 1024)
+
+// Must be called while the backbone sweep is inactive, since its frames fill the proxy
+static void init_scrub_proxy(ApplicationData* data, uint32_t num_frames) {
+    const md_molecule_t& mol = data->mold.mol;
+    data->scrub.active = false;
+    if (mol.atom.count < SCRUB_PROXY_MIN_ATOMS) {
+        scrub_proxy_free(&data->scrub.proxy);
+        return;
+    }
+
+    uint32_t* colors = (uint32_t*)md_alloc(persistent_allocator, sizeof(uint32_t) * mol.atom.count);
+    if (mol.chain.count) {
+        color_atoms_chain_idx(colors, mol.atom.count, mol);
+    } else {
+        color_atoms_res_idx(colors, mol.atom.count, mol);
+    }
+    scrub_proxy_init(&data->scrub.proxy, &mol, colors, num_frames, SCRUB_PROXY_MAX_BYTES, persistent_allocator);
+    md_free(persistent_allocator, colors, sizeof(uint32_t) * mol.atom.count);
+}
+
+// Returns true when the scrubbing ends, after which the frame has to be updated in full
+static bool update_scrub(ApplicationData* data, bool time_changed) {
+    auto& scrub = data->scrub;
+    const bool mouse_down = ImGui::IsMouseDown(ImGuiMouseButton_Left);
+    if (scrub.active) {
+        if (mouse_down && scrub.enabled) return false;
+        scrub.active = false;
+        data->mold.dirty_buffers |= MolBit_DirtyPosition;
+        return true;
+    }
+    if (!scrub.enabled || !scrub.proxy.num_slots || !time_changed || !mouse_down) return false;
+    if (data->animation.mode != PlaybackMode::Stopped || data->movie.mode != PlaybackMode::Stopped || data->offscreen.active) return false;
+    scrub.active = true;
+    return false;
+}
+
+static void draw_scrub_proxy(ApplicationData* data) {
+    const ScrubProxy& proxy = data->scrub.proxy;
+    const uint32_t n = proxy.num_beads;
+    float* x = (float*)md_alloc(frame_allocator, sizeof(float) * n * 3);
+    float* y = x + n;
+    float* z = y + n;
+    if (scrub_proxy_decode(&proxy, data->animation.frame, x, y, z) < 0) return;
+
+    immediate::set_model_view_matrix(data->view.param.matrix.current.view);
+    immediate::set_proj_matrix(data->view.param.matrix.current.proj_jittered);
+    for (uint32_t i = 0; i < proxy.num_traces; ++i) {
+        const uint32_t a = proxy.trace[i * 2 + 0];
+        const uint32_t b = proxy.trace[i * 2 + 1];
+        immediate::draw_line({x[a], y[a], z[a]}, {x[b], y[b], z[b]}, proxy.bead_color[a]);
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        immediate::draw_point({x[i], y[i], z[i]}, proxy.bead_color[i]);
+    }
+    immediate::render();
+}
+
+#define EVALUATION_WINDOW_EXTENT 16 // Frames on each side of the playhead which are evaluated first
+
+// Orders the full evaluation by what the user is looking at: The frames around the playhead, then the visible range of the timeline.
+// The rest of the trajectory follows in the coarse to fine order of the sweep.
+static void update_evaluation_priority(ApplicationData* data) {
+    ProgressiveSweep* sweep = &data->mold.script.full_sweep;
+    if (!sweep->num_frames || !task_system::task_is_running(data->tasks.evaluate_full)) return;
+
+    const uint32_t num_frames = sweep->num_frames;
+    const uint32_t frame = (uint32_t)CLAMP((int64_t)(data->animation.frame + 0.5), 0, (int64_t)num_frames - 1);
+    uint32_t beg = frame > EVALUATION_WINDOW_EXTENT ? frame - EVALUATION_WINDOW_EXTENT : 0;
+    uint32_t end = MIN(frame + EVALUATION_WINDOW_EXTENT + 1, num_frames);
+
+    if (progressive_range_complete(sweep, beg, end)) {
+        // A view which covers the whole trajectory is left to the coarse to fine order
+        beg = (uint32_t)CLAMP((int64_t)time_to_frame(data->timeline.view_range.beg_x, data->timeline.x_values), 0, (int64_t)num_frames - 1);
+        end = (uint32_t)CLAMP((int64_t)time_to_frame(data->timeline.view_range.end_x, data->timeline.x_values) + 2, (int64_t)beg + 1, (int64_t)num_frames);
+        if (beg == 0 && end == num_frames) {
+            beg = end = 0;
+        }
+    }
+
+    progressive_prioritize(sweep, beg, end);
+}
+
+// A scan of the file made by start_trajectory_scan is taken over, the trajectory is opened from the file if there is none
+static bool load_trajectory_data(ApplicationData* data, str_t filename, md_trajectory_loader_i* loader, bool deperiodize_on_load, md_trajectory_i* scan = nullptr) {
+    md_allocator_i* traj_alloc = memory_tracker_allocator(MemoryTracker_Trajectory);
+    md_trajectory_i* traj = scan ? load::traj::open_scanned(filename, scan, loader, &data->mold.mol, traj_alloc) : load::traj::open_file(filename, loader, &data->mold.mol, traj_alloc);
     if (traj) {
         load::traj::set_deperiodize(traj, deperiodize_on_load);
+        if (data->mold.block_cache_enabled) {
+            load::traj::set_block_cache(traj, true);
+        }
         free_trajectory_data(data);
         data->mold.traj = traj;
         str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), filename);
@@ -8682,16 +14001,30 @@ static bool load_trajectory_data(ApplicationData* data, str_t filename, md_traje
 static void free_molecule_data(ApplicationData* data) {
     ASSERT(data);
     interrupt_async_tasks(data);
+    clear_dynamic_filter_masks(data);
+    // The color keys do not cover the topology
+    lru_cache_clear(&data->representation.colors);
 
     //md_molecule_free(&data->mold.mol, persistent_allocator);
     md_arena_allocator_reset(data->mold.mol_alloc);
     MEMSET(&data->mold.mol, 0, sizeof(data->mold.mol));
 
     md_gl_molecule_free(&data->mold.gl_mol);
+    free_keyframes(data);
+    md_array_shrink(data->mold.atom_flags, 0);
+    free_representation_lod(data);
+    culling::free_chunks(&data->representation.culling.chunks);
+    data->representation.culling.active = false;
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        free_representation_sdf(&data->representation.reps[i]);
+        // The representations are initialized again with the next molecule
+        free_representation_subset(data, &data->representation.reps[i], false);
+    }
     MEMSET(data->files.molecule, 0, sizeof(data->files.molecule));
+    data->files.molecule_identity = 0;
 
-    md_bitfield_clear(&data->selection.current_selection_mask);
-    md_bitfield_clear(&data->selection.current_highlight_mask);
+    md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_selection_mask));
+    md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_highlight_mask));
     if (data->mold.script.ir) {
         md_script_ir_free(data->mold.script.ir);
         data->mold.script.ir = nullptr;
@@ -8708,6 +14041,12 @@ static void free_molecule_data(ApplicationData* data) {
         md_script_eval_free(data->mold.script.filt_eval);
         data->mold.script.filt_eval = nullptr;
     }
+    md_array_free(data->mold.script.ir_statements, persistent_allocator);
+    md_array_free(data->mold.script.eval_statements, persistent_allocator);
+    data->mold.script.ir_statements = nullptr;
+    data->mold.script.eval_statements = nullptr;
+    data->mold.script.ir_source_fingerprint = 0;
+    data->mold.script.eval_source_fingerprint = 0;
     clear_density_volume(data);
 }
 
@@ -8741,29 +14080,205 @@ static void init_molecule_data(ApplicationData* data) {
         update_all_representations(data);
         data->mold.script.compile_ir = true;
 
-        init_dataset_items(data);
+        init_dataset_items(data);
+    }
+}
+
+static void launch_prefetch_job(ApplicationData* data) {
+    const uint32_t num_frames = MIN((uint32_t)md_trajectory_num_frames(data->mold.traj), (uint32_t)load::traj::num_cache_frames(data->mold.traj));
+    if (!num_frames) return;
+
+    task_system::task_interrupt_and_wait_for(data->tasks.prefetch_frames);
+    data->tasks.prefetch_frames = task_system::pool_enqueue(STR("Prefetch Frames"), 0, num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        for (uint32_t i = range_beg; i < range_end && !task_system::task_cancelled(); ++i) {
+            md_trajectory_frame_header_t header;
+            md_trajectory_load_frame(data->mold.traj, i, &header, 0, 0, 0);
+        }
+    }, data, 0, task_system::Priority_Background);
+
+    task_system::main_enqueue(STR("Prefetch Complete"), [](void* user_data) {
+        ApplicationData* data = (ApplicationData*)user_data;
+        interpolate_atomic_properties(data);
+        update_md_buffers(data);
+        zero_molecule_velocity(data); // Do this explicitly to update the previous position to avoid motion blur trails
+    }, data, data->tasks.prefetch_frames);
+}
+
+// Parses and postprocesses the molecule of a file into mol, this does not touch the application state so it can run on the pool
+static bool load_molecule(md_molecule_t* mol, md_allocator_i* alloc, str_t path_to_file, const LoadParam& param, bool use_snapshot, std::atomic<float>* progress = nullptr) {
+    // @NOTE: If the dataset is coarse-grained, then postprocessing must be aware
+    md_util_postprocess_flags_t flags = param.coarse_grained ? MD_UTIL_POSTPROCESS_COARSE_GRAINED : MD_UTIL_POSTPROCESS_ALL;
+
+    // The loader argument is not part of the key, so molecules which depend on one are always parsed
+    char snapshot_path[4096];
+    const int snapshot_len = snprintf(snapshot_path, sizeof(snapshot_path), "%.*s.molcache", (int)path_to_file.len, path_to_file.ptr);
+    const uint64_t snapshot_key = (use_snapshot && !param.mol_loader_arg && 0 < snapshot_len && snapshot_len < (int)sizeof(snapshot_path)) ? mol_snapshot_key(path_to_file, (uint32_t)flags) : 0;
+    const str_t snapshot_file = {snapshot_path, snapshot_key ? (size_t)snapshot_len : 0};
+
+    const md_timestamp_t t0 = md_time_current();
+    if (snapshot_key && mol_snapshot_read(snapshot_file, mol, snapshot_key, alloc)) {
+        LOG_SUCCESS("Restored molecular data of '%.*s' from snapshot in %.1f ms", path_to_file.len, path_to_file.ptr, md_time_as_seconds(md_time_current() - t0) * 1000.0);
+    } else {
+        if (!param.mol_loader->init_from_file(mol, path_to_file, param.mol_loader_arg, alloc)) {
+            LOG_ERROR("Failed to load molecular data from file '%.*s'", path_to_file.len, path_to_file.ptr);
+            return false;
+        }
+        LOG_SUCCESS("Successfully loaded molecular data from file '%.*s'", path_to_file.len, path_to_file.ptr);
+        if (progress) progress->store(0.6f, std::memory_order_relaxed);
+        mol_postprocess(mol, alloc, (uint32_t)flags);
+
+        // Written straight after the postprocess, before the element mappings of the dataset are applied
+        // An interrupted task may have skipped stages of the postprocess, which must not end up in the snapshot
+        if (snapshot_key && mol->atom.count >= MOL_SNAPSHOT_MIN_ATOMS && !task_system::task_cancelled()) {
+            mol_snapshot_write(snapshot_file, mol, snapshot_key);
+        }
+    }
+    if (progress) progress->store(1.0f, std::memory_order_relaxed);
+    return true;
+}
+
+static void trajectory_scan_task(void* user_data) {
+    TrajectoryScan* scan = (TrajectoryScan*)user_data;
+    scan->scan = load::traj::scan_file(str_from_cstr(scan->path), scan->loader, memory_tracker_allocator(MemoryTracker_Trajectory));
+}
+
+// Builds the frame index of a trajectory on the pool, it only needs the file so it does not wait for the molecule
+static void start_trajectory_scan(TrajectoryScan* scan, str_t path, md_trajectory_loader_i* loader, bool deperiodize) {
+    ASSERT(scan);
+    ASSERT(loader);
+    *scan = {};
+    str_copy_to_char_buf(scan->path, sizeof(scan->path), path);
+    scan->loader = loader;
+    scan->deperiodize = deperiodize;
+    scan->task = task_system::pool_enqueue(STR("Scanning Trajectory"), trajectory_scan_task, scan, 0, task_system::Priority_Interactive);
+    task_system::execute_task(scan->task);
+}
+
+static void free_trajectory_scan(TrajectoryScan* scan) {
+    ASSERT(scan);
+    task_system::task_wait_for(scan->task);
+    load::traj::free_scan(scan->scan, scan->loader);
+    *scan = {};
+}
+
+static void load_molecule_task(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    auto& load = data->async_load;
+    load.success = load_molecule(&load.mol, load.alloc, str_from_cstr(load.path), load.param, load.use_snapshot, &load.progress);
+    // interrupt_async_tasks marks every running task, which makes the scheduler skip the parts of the load which had not started yet
+    load.interrupted = task_system::task_cancelled();
+}
+
+static void start_async_load(ApplicationData* data);
+
+// Runs on the main thread once the molecule has been loaded, the new dataset replaces the current one within the frame
+static void swap_in_loaded_molecule(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    auto& load = data->async_load;
+    load.task = task_system::INVALID_ID;
+
+    if (load.interrupted) {
+        LOG_INFO("Loading of '%s' was interrupted, starting over", load.path);
+        md_arena_allocator_reset(load.alloc);
+        load.mol = {};
+        start_async_load(data);
+        return;
+    }
+    load.active = false;
+    if (!load.success) {
+        md_arena_allocator_reset(load.alloc);
+        load.mol = {};
+        free_trajectory_scan(&load.traj);
+        return;
+    }
+
+    free_molecule_data(data);
+    free_trajectory_data(data);
+
+    // The allocator of the previous molecule has been reset by free_molecule_data and is used for the next load
+    md_allocator_i* prev_alloc = data->mold.mol_alloc;
+    data->mold.mol_alloc = load.alloc;
+    data->mold.mol = load.mol;
+    load.alloc = prev_alloc;
+    load.mol = {};
+
+    const str_t path = str_from_cstr(load.path);
+    str_copy_to_char_buf(data->files.molecule, sizeof(data->files.molecule), path);
+    data->files.molecule_identity = eval_cache_file_identity(path);
+    data->files.coarse_grained = load.param.coarse_grained;
+    init_molecule_data(data);
+
+    // @NOTE: Some files contain both atomic coordinates and trajectory, in which case the scan is of the molecule file
+    if (load.traj.loader) {
+        const str_t traj_path = str_from_cstr(load.traj.path);
+        const bool own_file = str_eq(traj_path, path);
+        if (own_file) {
+            LOG_INFO("File may also contain trajectory, attempting to load trajectory");
+        }
+        if (load_trajectory_data(data, traj_path, load.traj.loader, load.traj.deperiodize, load.traj.scan)) {
+            LOG_SUCCESS("Successfully opened trajectory from file '%.*s'", traj_path.len, traj_path.ptr);
+        } else if (!own_file) {
+            LOG_ERROR("Failed to opened trajectory from file '%.*s'", traj_path.len, traj_path.ptr);
+        }
+        load.traj = {};
+    }
+
+    data->animation = {};
+    if (!load.param.keep_representations) {
+        clear_representations(data);
+        create_default_representations(data);
     }
+    recompute_atom_visibility_mask(data);
+    interpolate_atomic_properties(data);
+    reset_view(data, true, load.smooth_view);
 }
 
-static void launch_prefetch_job(ApplicationData* data) {
-    const uint32_t num_frames = MIN((uint32_t)md_trajectory_num_frames(data->mold.traj), (uint32_t)load::traj::num_cache_frames(data->mold.traj));
-    if (!num_frames) return;
+static void start_async_load(ApplicationData* data) {
+    auto& load = data->async_load;
+    load.success = false;
+    load.interrupted = false;
+    load.progress.store(0.0f, std::memory_order_relaxed);
+    load.task = task_system::pool_enqueue(STR("Loading Molecule"), load_molecule_task, data, 0, task_system::Priority_Interactive);
+    // The scan of a restarted load has already completed and is kept
+    const task_system::ID deps[2] = {load.task, load.traj.task};
+    task_system::main_enqueue(STR("##Swap In Molecule"), swap_in_loaded_molecule, data, deps, ARRAY_SIZE(deps), task_system::Priority_Interactive);
+}
 
-    task_system::task_interrupt_and_wait_for(data->tasks.prefetch_frames);
-    data->tasks.prefetch_frames = task_system::pool_enqueue(STR("Prefetch Frames"), 0, num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
-        ApplicationData* data = (ApplicationData*)user_data;
-        for (uint32_t i = range_beg; i < range_end; ++i) {
-            md_trajectory_frame_header_t header;
-            md_trajectory_load_frame(data->mold.traj, i, &header, 0, 0, 0);
-        }
-    }, data);
+// Loads the molecule of a file (and the trajectory it may contain) without blocking the frame, the current dataset stays viewable until then
+// Only one load is in flight at a time, the file queue waits for it and the load dialog is disabled
+// traj_param is a trajectory of the molecule in another file, which is scanned concurrently with the loading of the molecule
+static void load_dataset_async(ApplicationData* data, const LoadParam& param, bool smooth_view, const LoadParam* traj_param) {
+    ASSERT(data);
+    ASSERT(param.mol_loader);
+    auto& load = data->async_load;
+    if (load.active) return;
 
-    task_system::main_enqueue(STR("Prefetch Complete"), [](void* user_data) {
-        ApplicationData* data = (ApplicationData*)user_data;
-        interpolate_atomic_properties(data);
-        update_md_buffers(data);
-        md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
-    }, data, data->tasks.prefetch_frames);
+    str_t path = md_path_make_canonical(param.file_path, frame_allocator);
+    if (!path) {
+        LOG_ERROR("Failed to load molecular data from file '%.*s'", (int)param.file_path.len, param.file_path.ptr);
+        return;
+    }
+    if (!load.alloc) {
+        load.alloc = md_arena_allocator_create(memory_tracker_allocator(MemoryTracker_Molecule), MEGABYTES(1));
+    }
+
+    str_copy_to_char_buf(load.path, sizeof(load.path), path);
+    load.param = param;
+    load.param.file_path = {};
+    if (param.mol_loader_arg) {
+        MEMCPY(&load.lammps_arg, param.mol_loader_arg, sizeof(load.lammps_arg));
+        load.param.mol_loader_arg = &load.lammps_arg;
+    }
+    load.use_snapshot = data->mold.snapshot_enabled;
+    load.smooth_view = smooth_view;
+    load.active = true;
+    if (traj_param && traj_param->traj_loader) {
+        start_trajectory_scan(&load.traj, traj_param->file_path, traj_param->traj_loader, traj_param->deperiodize);
+    } else if (param.traj_loader) {
+        start_trajectory_scan(&load.traj, path, param.traj_loader, param.deperiodize);
+    }
+    start_async_load(data);
 }
 
 static bool load_dataset_from_file(ApplicationData* data, const LoadParam& param) {
@@ -8776,17 +14291,13 @@ static bool load_dataset_from_file(ApplicationData* data, const LoadParam& param
             free_molecule_data(data);
             free_trajectory_data(data);
 
-            if (!param.mol_loader->init_from_file(&data->mold.mol, path_to_file, param.mol_loader_arg, data->mold.mol_alloc)) {
-                LOG_ERROR("Failed to load molecular data from file '%.*s'", path_to_file.len, path_to_file.ptr);
+            if (!load_molecule(&data->mold.mol, data->mold.mol_alloc, path_to_file, param, data->mold.snapshot_enabled)) {
                 return false;
             }
-            LOG_SUCCESS("Successfully loaded molecular data from file '%.*s'", path_to_file.len, path_to_file.ptr);
 
             str_copy_to_char_buf(data->files.molecule, sizeof(data->files.molecule), path_to_file);
+            data->files.molecule_identity = eval_cache_file_identity(path_to_file);
             data->files.coarse_grained = param.coarse_grained;
-            // @NOTE: If the dataset is coarse-grained, then postprocessing must be aware
-            md_util_postprocess_flags_t flags = param.coarse_grained ? MD_UTIL_POSTPROCESS_COARSE_GRAINED : MD_UTIL_POSTPROCESS_ALL;
-            md_util_molecule_postprocess(&data->mold.mol, data->mold.mol_alloc, flags);
             init_molecule_data(data);
 
             // @NOTE: Some files contain both atomic coordinates and trajectory
@@ -8833,6 +14344,8 @@ static RepresentationType get_rep_type(str_t str) {
         return RepresentationType::Ribbons;
     else if (str_eq_cstr(str, "CARTOON"))
         return RepresentationType::Cartoon;
+    else if (str_eq_cstr(str, "DISTANCE_FIELD"))
+        return RepresentationType::Sdf;
     else
         return RepresentationType::SpaceFill;
 }
@@ -8849,6 +14362,8 @@ static str_t get_rep_type_name(RepresentationType type) {
             return STR("RIBBONS");
         case RepresentationType::Cartoon:
             return STR("CARTOON");
+        case RepresentationType::Sdf:
+            return STR("DISTANCE_FIELD");
         default:
             return STR("UNKNOWN");
     }
@@ -8875,6 +14390,8 @@ static ColorMapping get_color_mapping(str_t str) {
         return ColorMapping::ChainIndex;
     else if (str_eq_cstr(str, "SECONDARY_STRUCTURE"))
         return ColorMapping::SecondaryStructure;
+    else if (str_eq_cstr(str, "RMSF"))
+        return ColorMapping::Fluctuation;
     else
         return ColorMapping::Cpk;
 }
@@ -8899,6 +14416,8 @@ static str_t get_color_mapping_name(ColorMapping mapping) {
             return STR("CHAIN_INDEX");
         case ColorMapping::SecondaryStructure:
             return STR("SECONDARY_STRUCTURE");
+        case ColorMapping::Fluctuation:
+            return STR("RMSF");
         default:
             return STR("UNDEFINED");
     }
@@ -8978,12 +14497,14 @@ SerializationObject serialization_targets[] = {
     {"[RenderSettings]", "SsaoIntensity",   SerializationType_Float,    offsetof(ApplicationData, visuals.ssao.intensity)},
     {"[RenderSettings]", "SsaoRadius",      SerializationType_Float,    offsetof(ApplicationData, visuals.ssao.radius)},
     {"[RenderSettings]", "SsaoBias",        SerializationType_Float,    offsetof(ApplicationData, visuals.ssao.bias)},
+    {"[RenderSettings]", "SsaoHalfRes",     SerializationType_Bool,     offsetof(ApplicationData, visuals.ssao.half_res)},
     {"[RenderSettings]", "DofEnabled",      SerializationType_Bool,     offsetof(ApplicationData, visuals.dof.enabled)},
     {"[RenderSettings]", "DofFocusScale",   SerializationType_Bool,     offsetof(ApplicationData, visuals.dof.focus_scale)},
 
     {"[VisualStyle]", "SelectionVisible",   SerializationType_Vec4,     offsetof(ApplicationData, selection.color.selection.visible)},
     {"[VisualStyle]", "SelectionHidden",    SerializationType_Vec4,     offsetof(ApplicationData, selection.color.selection.hidden)},
     {"[VisualStyle]", "SelectionSaturation",SerializationType_Float,    offsetof(ApplicationData, selection.color.saturation)},
+    {"[VisualStyle]", "SelectionScreenSpace",SerializationType_Bool,    offsetof(ApplicationData, selection.screen_space.enabled)},
     {"[VisualStyle]", "HighlightVisible",   SerializationType_Vec4,     offsetof(ApplicationData, selection.color.highlight.visible)},
     {"[VisualStyle]", "HighlightHidden",    SerializationType_Vec4,     offsetof(ApplicationData, selection.color.highlight.hidden)},
 
@@ -9013,8 +14534,12 @@ SerializationObject serialization_targets[] = {
     {"[Selection]", "Mask",                 SerializationType_Bitfield, offsetof(Selection, atom_mask)},
 };
 
+// The representation is updated once the workspace has been read and its dataset loaded, see update_deferred_representations
 void* serialize_create_rep(ApplicationData* data) {
-    return (void*)create_representation(data);
+    Representation rep = {};
+    rep.deferred = true;
+    init_representation(data, &rep);
+    return md_array_push(data->representation.reps, rep, persistent_allocator);
 }
 
 void* serialize_create_atom_elem_mapping(ApplicationData* data) {
@@ -9209,125 +14734,1405 @@ static void deserialize_object(const SerializationObject* target, char* ptr, str
                     return;
                 }
             } else {
-                LOG_ERROR("Malformed start token for bitfield");
-                return;
+                LOG_ERROR("Malformed start token for bitfield");
+                return;
+            }
+        }
+        case SerializationType_Invalid: // fallthrough
+        default:
+            ASSERT(false);
+        }
+    }
+}
+
+static void load_workspace(ApplicationData* data, str_t filename) {
+    str_t txt = load_textfile(filename, frame_allocator);
+    defer { str_free(txt, frame_allocator); };
+
+    if (!txt.len) {
+        LOG_ERROR("Could not open workspace file: '%.*s", (int)filename.len, filename.ptr);
+        return;
+    }
+
+    // Reset and clear things
+    clear_selections(data);
+    clear_representations(data);
+    editor.SetText("");
+
+    data->animation = {};
+    reset_view(data, false, true);
+
+    str_t group = {};
+    str_t c_txt = txt;
+    str_t line = {};
+
+    str_t cur_molecule_file     = str_copy_cstr(data->files.molecule, frame_allocator);
+    str_t cur_trajectory_file   = str_copy_cstr(data->files.trajectory, frame_allocator);
+    bool  cur_coarse_grained    = data->files.coarse_grained;
+    bool  cur_deperiodize       = data->files.deperiodize;
+
+    const SerializationArray* arr_group = NULL;
+    void* ptr = 0;
+
+    while (str_extract_line(&line, &c_txt)) {
+        line = str_trim(line);
+        if (line[0] == '[') {
+            group = line;
+            arr_group = find_serialization_array_group(group);
+            if (arr_group) {
+                ptr = arr_group->create_item_func(data);
+            } else {
+                ptr = data;
+            }
+        } else {
+            size_t loc;
+            if (str_find_char(&loc, line, '=')) {
+                str_t label = str_trim(str_substr(line, 0, loc));
+                const SerializationObject* target = find_serialization_target(group, label);
+                if (target) {
+                    // Move read pointer back 'loc+1' => after '='.
+                    const char* pos = line.ptr + loc + 1;
+                    c_txt.len = c_txt.end() - pos;
+                    c_txt.ptr = pos;
+                    deserialize_object(target, (char*)ptr, &c_txt, filename);
+                } else {
+                    LOG_INFO("Could not recognize serialization target '%.*s' in group '%.*s,", (int)label.len, label.ptr, (int)group.len, group.ptr);
+                }
+            }
+        }
+    }
+    data->view.animation.target_position    = data->view.camera.position;
+    data->view.animation.target_orientation = data->view.camera.orientation;
+    data->view.animation.target_distance    = data->view.camera.focus_distance;
+    
+    str_t new_molecule_file   = str_copy_cstr(data->files.molecule, frame_allocator);
+    str_t new_trajectory_file = str_copy_cstr(data->files.trajectory, frame_allocator);
+    bool  new_coarse_grained  = data->files.coarse_grained;
+    bool  new_deperiodize     = data->files.deperiodize;
+
+    str_copy_to_char_buf(data->files.workspace, sizeof(data->files.workspace), filename);
+    
+    // When we de-serialize we overwrite the two following paths, even though they are not loaded.
+    // So we copy them back to their original values.
+    str_copy_to_char_buf(data->files.molecule, sizeof(data->files.molecule), cur_molecule_file);
+    str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), cur_trajectory_file);
+    data->files.coarse_grained  = cur_coarse_grained;
+    data->files.deperiodize     = cur_deperiodize;
+    
+    str_t mol_ext = {};
+    str_t traj_ext = {};
+
+    extract_ext(&mol_ext, new_molecule_file);
+    extract_ext(&traj_ext, new_trajectory_file);
+
+    load::LoaderState state = {};
+
+    load::init_loader_state(&state, new_molecule_file, frame_allocator);
+
+    LoadParam param = {};
+    param.file_path = new_molecule_file;
+    param.mol_loader = state.mol_loader;
+    param.traj_loader = state.traj_loader;
+    param.coarse_grained = new_coarse_grained;
+    param.deperiodize = new_coarse_grained;
+    param.keep_representations = false;
+    param.mol_loader_arg = state.mol_loader_arg;
+
+    // Opening a large trajectory means that the loader has to scan the file for frame offsets,
+    // so if the workspace refers to the dataset which is already loaded, we keep it.
+    // The files may have been rewritten since they were opened, so their identities have to match as well.
+    const uint64_t cur_trajectory_identity = data->mold.traj ? load::traj::file_identity(data->mold.traj) : 0;
+    const bool reuse_dataset = data->mold.mol.atom.count > 0 &&
+        str_eq(new_molecule_file, cur_molecule_file) &&
+        str_eq(new_trajectory_file, cur_trajectory_file) &&
+        new_coarse_grained == cur_coarse_grained &&
+        new_deperiodize == cur_deperiodize &&
+        data->files.molecule_identity != 0 &&
+        eval_cache_file_identity(new_molecule_file) == data->files.molecule_identity &&
+        (str_empty(new_trajectory_file) || (cur_trajectory_identity != 0 && eval_cache_file_identity(new_trajectory_file) == cur_trajectory_identity));
+
+    if (reuse_dataset) {
+        LOG_INFO("Workspace refers to the currently loaded dataset, skipping reload of '%.*s'", (int)new_molecule_file.len, new_molecule_file.ptr);
+        apply_atom_elem_mappings(data);
+        update_deferred_representations(data);
+        return;
+    }
+
+    // The frame index of the trajectory is built on the pool while the molecule is loaded
+    // Interrupting the tasks of the previous molecule may skip the scan, the trajectory is then opened from the file
+    load::LoaderState traj_state = {};
+    TrajectoryScan traj_scan = {};
+    if (new_trajectory_file && load::init_loader_state(&traj_state, new_trajectory_file, frame_allocator) && traj_state.traj_loader) {
+        interrupt_async_tasks(data);
+        start_trajectory_scan(&traj_scan, new_trajectory_file, traj_state.traj_loader, param.deperiodize);
+    }
+
+    // The representations are initialized with the molecule, the deferred ones are updated once the workspace is complete
+    if (new_molecule_file) {
+        load_dataset_from_file(data, param);
+    }
+
+    if (traj_scan.loader) {
+        task_system::task_wait_for(traj_scan.task);
+        if (data->mold.mol.atom.count) {
+            interrupt_async_tasks(data);
+            if (load_trajectory_data(data, new_trajectory_file, traj_scan.loader, traj_scan.deperiodize, traj_scan.scan)) {
+                LOG_SUCCESS("Successfully opened trajectory from file '%.*s'", new_trajectory_file.len, new_trajectory_file.ptr);
+            } else {
+                LOG_ERROR("Failed to opened trajectory from file '%.*s'", new_trajectory_file.len, new_trajectory_file.ptr);
+            }
+            traj_scan = {};
+        } else {
+            LOG_ERROR("Before loading a trajectory, molecular data needs to be present");
+            free_trajectory_scan(&traj_scan);
+        }
+    }
+
+    apply_atom_elem_mappings(data);
+    update_deferred_representations(data);
+
+    // Restore the previous evaluation of the workspace if the trajectory has a cache, a miss evaluates as usual
+    char cache_path[4096];
+    const size_t cache_path_len = eval_cache_path(cache_path, sizeof(cache_path), data);
+    if (data->mold.script.cache_enabled && cache_path_len && md_path_is_valid({cache_path, cache_path_len})) {
+        request_evaluation(data);
+    }
+}
+
+// #headless
+// viamd --headless [--workspace <file.via>] [--molecule <file>] [--trajectory <file>] [--script <file>] [--export <file.csv|file.xvg|file.npy>] [--threads <n>]
+//                  [--frames <beg>:<end> --shard <file>] [--merge <shard> ...] [--replicas <file> ...]
+// Evaluates the script over the whole trajectory on the worker pool, without a window or GL context, and exports the properties.
+// Temporal properties are written to the export file, each distribution and volume to a file of its own next to it (<export>_<ident>.<ext>, .cube for volumes).
+// A complete evaluation is also stored in the evaluation cache of the trajectory, which is picked up by the GUI when the same script is opened.
+// Long trajectories can be split over several processes: Each evaluates a range of frames into a shard, --merge combines the shards into a complete evaluation.
+// Replicas of the trajectory (of the same molecule and format) are opened as an ensemble, which shares one frame cache budget, and the frames of all
+// members are evaluated in one sweep over the pool. The properties of replica i are exported to <export>_replica<i>.<ext>.
+
+static void print_headless_usage() {
+    printf("Usage: viamd --headless [--workspace <file." STR_FMT ">] [--molecule <file>] [--trajectory <file>] [--script <file>] [--export <file.csv|file.xvg|file.npy>] [--threads <n>]\n"
+           "                     [--frames <beg>:<end> --shard <file>] [--merge <shard> ...] [--replicas <file> ...]\n", STR_ARG(WORKSPACE_FILE_EXTENSION));
+}
+
+// Reads the files, the script and the stored selections of a workspace, everything which concerns the GUI is skipped
+static bool headless_read_workspace(ApplicationData* data, str_t filename) {
+    str_t txt = load_textfile(filename, frame_allocator);
+    if (!txt.len) {
+        LOG_ERROR("Could not open workspace file: '%.*s'", (int)filename.len, filename.ptr);
+        return false;
+    }
+
+    str_t group = {};
+    str_t c_txt = txt;
+    str_t line = {};
+    void* ptr = data;
+
+    while (str_extract_line(&line, &c_txt)) {
+        line = str_trim(line);
+        if (line[0] == '[') {
+            group = line;
+            const SerializationArray* arr_group = find_serialization_array_group(group);
+            if (arr_group) {
+                ptr = str_eq_cstr(group, "[Selection]") ? arr_group->create_item_func(data) : NULL;
+            } else {
+                ptr = data;
+            }
+        } else if (ptr) {
+            size_t loc;
+            if (str_find_char(&loc, line, '=')) {
+                str_t label = str_trim(str_substr(line, 0, loc));
+                const SerializationObject* target = find_serialization_target(group, label);
+                if (target) {
+                    const char* pos = line.ptr + loc + 1;
+                    c_txt.len = c_txt.end() - pos;
+                    c_txt.ptr = pos;
+                    deserialize_object(target, (char*)ptr, &c_txt, filename);
+                }
+            }
+        }
+    }
+    str_copy_to_char_buf(data->files.workspace, sizeof(data->files.workspace), filename);
+    return true;
+}
+
+static bool headless_export(ApplicationData* data, const md_script_eval_t* eval, md_trajectory_i* traj, str_t path) {
+    str_t ext = {};
+    if (!extract_ext(&ext, path) || !(str_eq_cstr_ignore_case(ext, "csv") || str_eq_cstr_ignore_case(ext, "xvg") || str_eq_cstr_ignore_case(ext, "npy"))) {
+        LOG_ERROR("Export file '%.*s' must have the extension csv, xvg or npy", (int)path.len, path.ptr);
+        return false;
+    }
+    const str_t base = str_substr(path, 0, path.len - ext.len - 1);
+
+    const int64_t num_frames = md_trajectory_num_frames(traj);
+    const double* traj_times = md_trajectory_frame_times(traj);
+    const int64_t num_props = md_script_eval_num_properties(eval);
+    const md_script_property_t* props = md_script_eval_properties(eval);
+
+    md_array(float) time = md_array_create(float, num_frames, frame_allocator);
+    for (int64_t i = 0; i < num_frames; ++i) {
+        time[i] = (float)traj_times[i];
+    }
+
+    str_t x_label = STR("Frame");
+    md_unit_t time_unit = md_trajectory_time_unit(traj);
+    if (!md_unit_empty(time_unit)) {
+        char time_buf[64];
+        size_t len = md_unit_print(time_buf, sizeof(time_buf), time_unit);
+        x_label = alloc_printf(frame_allocator, "Time (" STR_FMT ")", len, time_buf);
+    }
+
+    // Same layout as the export of the GUI
+    md_array(const float*) column_data = 0;
+    md_array(str_t) column_labels = 0;
+    md_array(str_t) legends = 0;
+    md_array_push(column_data, time, frame_allocator);
+    md_array_push(column_labels, x_label, frame_allocator);
+
+    bool result = true;
+    for (int64_t i = 0; i < num_props; ++i) {
+        const md_script_property_t& prop = props[i];
+        if (prop.flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL) {
+            const int dim = prop.data.dim[0];
+            if (dim > 1) {
+                for (int j = 0; j < dim; ++j) {
+                    str_t legend = alloc_printf(frame_allocator, STR_FMT "[%i]", STR_ARG(prop.ident), j + 1);
+                    md_array_push(column_data, prop.data.values + j * num_frames, frame_allocator);
+                    md_array_push(column_labels, legend, frame_allocator);
+                    md_array_push(legends, legend, frame_allocator);
+                }
+            } else {
+                md_array_push(column_data, prop.data.values, frame_allocator);
+                md_array_push(column_labels, prop.ident, frame_allocator);
+                md_array_push(legends, prop.ident, frame_allocator);
+            }
+        } else if (prop.flags & MD_SCRIPT_PROPERTY_FLAG_DISTRIBUTION) {
+            const int num_bins = prop.data.dim[0];
+            const float* dist_data[2] = {sample_range(prop.data.min_range[0], prop.data.max_range[0], num_bins, frame_allocator), prop.data.values};
+            str_t dist_labels[2] = {STR("x"), prop.ident};
+            str_t dist_path = alloc_printf(frame_allocator, STR_FMT "_" STR_FMT "." STR_FMT, STR_ARG(base), STR_ARG(prop.ident), STR_ARG(ext));
+            if (export_table(dist_path, ext, prop.ident, dist_labels[0], prop.ident, dist_data, dist_labels, 2, num_bins, &prop.ident, 1)) {
+                LOG_SUCCESS("Successfully exported property '" STR_FMT "' to '" STR_FMT "'", STR_ARG(prop.ident), STR_ARG(dist_path));
+            } else {
+                result = false;
+            }
+        } else if (prop.flags & MD_SCRIPT_PROPERTY_FLAG_VOLUME) {
+            str_t cube_path = alloc_printf(frame_allocator, STR_FMT "_" STR_FMT ".cube", STR_ARG(base), STR_ARG(prop.ident));
+            if (export_cube(*data, &prop, cube_path)) {
+                LOG_SUCCESS("Successfully exported property '" STR_FMT "' to '" STR_FMT "'", STR_ARG(prop.ident), STR_ARG(cube_path));
+            } else {
+                result = false;
+            }
+        }
+    }
+
+    if (md_array_size(column_data) > 1) {
+        if (export_table(path, ext, STR("VIAMD Properties"), x_label, STR(""), column_data, column_labels, md_array_size(column_data), num_frames, legends, md_array_size(legends))) {
+            LOG_SUCCESS("Successfully exported properties to '" STR_FMT "'", STR_ARG(path));
+        } else {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+// Members of an ensemble, whose frames are concatenated into one range for the sweep over the pool
+struct HeadlessEnsemble {
+    ApplicationData* data = nullptr;
+    md_array(md_trajectory_i*) trajs = nullptr;
+    md_array(md_script_eval_t*) evals = nullptr;
+    md_array(uint32_t) offsets = nullptr;  // [count + 1] First frame of each member in the range
+};
+
+static void headless_ensemble_eval_range(uint32_t beg, uint32_t end, void* user_data) {
+    const HeadlessEnsemble* e = (const HeadlessEnsemble*)user_data;
+    ApplicationData* data = e->data;
+    // A range may span the end of one member and the beginning of the next
+    for (size_t m = 0; m < md_array_size(e->trajs) && beg < end; ++m) {
+        const uint32_t m_end = e->offsets[m + 1];
+        if (beg >= m_end) continue;
+        const uint32_t sub_end = MIN(end, m_end);
+        md_script_eval_frame_range(e->evals[m], data->mold.script.eval_ir, &data->mold.mol, e->trajs[m], beg - e->offsets[m], sub_end - e->offsets[m]);
+        beg = sub_end;
+    }
+}
+
+static int run_headless(int argc, char** argv) {
+    headless_mode = true;
+
+    str_t workspace = {};
+    str_t molecule = {};
+    str_t trajectory = {};
+    str_t script = {};
+    str_t export_path = {};
+    str_t shard_path = {};
+    md_array(str_t) merge_paths = 0;
+    md_array(str_t) replica_paths = 0;
+    bool frame_range = false;
+    uint32_t frame_beg = 0;
+    uint32_t frame_end = 0;
+    int num_threads = VIAMD_NUM_WORKER_THREADS;
+    if (const char* env = getenv("VIAMD_NUM_WORKER_THREADS")) {
+        num_threads = MAX(0, atoi(env));
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0) {
+            continue;
+        } else if (strcmp(argv[i], "--workspace") == 0 && has_value) {
+            workspace = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--molecule") == 0 && has_value) {
+            molecule = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--trajectory") == 0 && has_value) {
+            trajectory = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--script") == 0 && has_value) {
+            script = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--export") == 0 && has_value) {
+            export_path = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            num_threads = MAX(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            if (sscanf(argv[++i], "%u:%u", &frame_beg, &frame_end) != 2 || frame_beg >= frame_end) {
+                LOG_ERROR("Invalid frame range '%s', expected <beg>:<end>", argv[i]);
+                return -1;
+            }
+            frame_range = true;
+        } else if (strcmp(argv[i], "--shard") == 0 && has_value) {
+            shard_path = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--merge") == 0 && has_value) {
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                md_array_push(merge_paths, str_from_cstr(argv[++i]), persistent_allocator);
+            }
+        } else if (strcmp(argv[i], "--replicas") == 0 && has_value) {
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                md_array_push(replica_paths, md_path_make_canonical(str_from_cstr(argv[++i]), persistent_allocator), persistent_allocator);
+            }
+        } else {
+            LOG_ERROR("Unrecognized argument '%s'", argv[i]);
+            print_headless_usage();
+            return -1;
+        }
+    }
+
+    if (frame_range && str_empty(shard_path)) {
+        LOG_ERROR("--frames requires --shard, a partial evaluation cannot be exported");
+        return -1;
+    }
+    if (!str_empty(shard_path) && md_array_size(merge_paths) > 0) {
+        LOG_ERROR("--shard and --merge are mutually exclusive");
+        return -1;
+    }
+    if (md_array_size(replica_paths) > 0 && (frame_range || !str_empty(shard_path) || md_array_size(merge_paths) > 0)) {
+        LOG_ERROR("--replicas cannot be combined with --frames, --shard or --merge");
+        return -1;
+    }
+
+    ApplicationData data;
+    data.mold.mol_alloc = md_arena_allocator_create(memory_tracker_allocator(MemoryTracker_Molecule), MEGABYTES(1));
+
+    if (!str_empty(workspace) && !headless_read_workspace(&data, workspace)) {
+        return -1;
+    }
+    if (!str_empty(molecule)) {
+        str_copy_to_char_buf(data.files.molecule, sizeof(data.files.molecule), md_path_make_canonical(molecule, frame_allocator));
+    }
+    if (!str_empty(trajectory)) {
+        str_copy_to_char_buf(data.files.trajectory, sizeof(data.files.trajectory), md_path_make_canonical(trajectory, frame_allocator));
+    }
+
+    // Molecule
+    const str_t mol_path = str_from_cstr(data.files.molecule);
+    load::LoaderState state = {};
+    if (str_empty(mol_path) || !load::init_loader_state(&state, mol_path, frame_allocator) || !state.mol_loader) {
+        LOG_ERROR("Missing or unsupported molecule file '%.*s'", (int)mol_path.len, mol_path.ptr);
+        print_headless_usage();
+        return -1;
+    }
+    // The pool is started before the molecule is loaded, since large files are parsed and postprocessed on it
+    task_system::initialize(num_threads);
+    if (!state.mol_loader->init_from_file(&data.mold.mol, mol_path, state.mol_loader_arg, data.mold.mol_alloc)) {
+        LOG_ERROR("Failed to load molecular data from file '%.*s'", (int)mol_path.len, mol_path.ptr);
+        return -1;
+    }
+    mol_postprocess(&data.mold.mol, data.mold.mol_alloc, data.files.coarse_grained ? MD_UTIL_POSTPROCESS_COARSE_GRAINED : MD_UTIL_POSTPROCESS_ALL);
+
+    // Trajectory, some molecule files contain one as well
+    str_t traj_path = str_from_cstr(data.files.trajectory);
+    md_trajectory_loader_i* traj_loader = state.traj_loader;
+    if (!str_empty(traj_path)) {
+        load::LoaderState traj_state = {};
+        traj_loader = load::init_loader_state(&traj_state, traj_path, frame_allocator) ? traj_state.traj_loader : NULL;
+    } else {
+        traj_path = mol_path;
+    }
+    HeadlessEnsemble ensemble = {};
+    ensemble.data = &data;
+    if (traj_loader && md_array_size(replica_paths) > 0) {
+        // The replicas are read with the loader of the trajectory
+        md_array(str_t) paths = 0;
+        md_array_push(paths, traj_path, frame_allocator);
+        for (size_t i = 0; i < md_array_size(replica_paths); ++i) {
+            md_array_push(paths, replica_paths[i], frame_allocator);
+        }
+        const size_t count = md_array_size(paths);
+        md_array_resize(ensemble.trajs, count, persistent_allocator);
+        const size_t num_opened = load::traj::open_ensemble(ensemble.trajs, paths, count, traj_loader, &data.mold.mol, memory_tracker_allocator(MemoryTracker_Trajectory));
+        md_array_shrink(ensemble.trajs, num_opened);
+        bool valid = num_opened == count;
+        if (!valid) {
+            LOG_ERROR("Failed to open %zu of the %zu members of the ensemble", count - num_opened, count);
+        }
+        for (size_t i = 0; i < num_opened && valid; ++i) {
+            load::traj::set_deperiodize(ensemble.trajs[i], data.files.deperiodize);
+            if (md_trajectory_num_frames(ensemble.trajs[i]) == 0) {
+                LOG_ERROR("Ensemble member '%.*s' has no frames", (int)paths[i].len, paths[i].ptr);
+                valid = false;
+            }
+        }
+        if (!valid) {
+            for (size_t i = 0; i < num_opened; ++i) {
+                load::traj::close(ensemble.trajs[i]);
+            }
+            return -1;
+        }
+        data.mold.traj = ensemble.trajs[0];
+    } else if (traj_loader) {
+        data.mold.traj = load::traj::open_file(traj_path, traj_loader, &data.mold.mol, memory_tracker_allocator(MemoryTracker_Trajectory));
+        if (data.mold.traj) load::traj::set_deperiodize(data.mold.traj, data.files.deperiodize);
+    }
+    if (!data.mold.traj || md_trajectory_num_frames(data.mold.traj) == 0) {
+        LOG_ERROR("Failed to open trajectory '%.*s'", (int)traj_path.len, traj_path.ptr);
+        return -1;
+    }
+    const int64_t num_frames = md_trajectory_num_frames(data.mold.traj);
+    if (!frame_range) {
+        frame_end = (uint32_t)num_frames;
+    } else if (frame_end > num_frames) {
+        LOG_ERROR("Frame range %u:%u is outside of the trajectory (%lld frames)", frame_beg, frame_end, (long long)num_frames);
+        return -1;
+    }
+
+    // Script, relative paths within it are resolved from the workspace or the dataset as in the GUI
+    std::string src;
+    if (!str_empty(script)) {
+        str_t txt = load_textfile(script, frame_allocator);
+        if (!txt.len) {
+            LOG_ERROR("Could not open script file '%.*s'", (int)script.len, script.ptr);
+            return -1;
+        }
+        src.assign(txt.ptr, txt.len);
+    } else {
+        src = editor.GetText();
+    }
+    if (src.empty()) {
+        LOG_ERROR("No script to evaluate, supply one with --script or --workspace");
+        return -1;
+    }
+
+    char buf[1024];
+    size_t len = md_path_write_cwd(buf, sizeof(buf));
+    str_t old_cwd = {buf, len};
+    defer { md_path_set_cwd(old_cwd); };
+    str_t cwd = {};
+    extract_folder_path(&cwd, str_from_cstr(data.files.workspace[0] != '\0' ? data.files.workspace : data.files.trajectory[0] != '\0' ? data.files.trajectory : data.files.molecule));
+    if (!str_empty(cwd)) {
+        md_path_set_cwd(cwd);
+    }
+
+    md_script_ir_t* ir = md_script_ir_create(memory_tracker_allocator(MemoryTracker_ScriptEval));
+    const int64_t num_stored_selections = md_array_size(data.selection.stored_selections);
+    if (num_stored_selections > 0) {
+        md_script_bitfield_identifier_t* idents = 0;
+        for (int64_t i = 0; i < num_stored_selections; ++i) {
+            md_script_bitfield_identifier_t ident = {
+                .identifier_name = str_from_cstr(data.selection.stored_selections[i].name),
+                .bitfield = &data.selection.stored_selections[i].atom_mask,
+            };
+            md_array_push(idents, ident, frame_allocator);
+        }
+        md_script_ir_add_bitfield_identifiers(ir, idents, md_array_size(idents));
+    }
+    md_script_ir_compile_from_source(ir, {src.data(), src.length()}, &data.mold.mol, data.mold.traj, NULL);
+
+    const int64_t num_errors = md_script_ir_num_errors(ir);
+    const md_log_token_t* errors = md_script_ir_errors(ir);
+    for (int64_t i = 0; i < num_errors; ++i) {
+        LOG_ERROR("Script: " STR_FMT, STR_ARG(errors[i].text));
+    }
+    if (!md_script_ir_valid(ir)) {
+        LOG_ERROR("Script did not compile");
+        return -1;
+    }
+    data.mold.script.ir = ir;
+    data.mold.script.eval_ir = ir;
+
+    // Shards and the evaluation cache are keyed in the same way, so a shard is only merged into an evaluation of the same script and dataset
+    const str_t src_str = {src.data(), src.length()};
+    data.mold.script.ir_statements = script_statement_fingerprints(src_str, persistent_allocator);
+    data.mold.script.eval_statements = script_statement_fingerprints(src_str, persistent_allocator);
+    data.mold.script.full_eval = md_script_eval_create(num_frames, ir, STR(""), memory_tracker_allocator(MemoryTracker_ScriptEval));
+    compute_eval_cache_keys(&data);
+    const uint64_t* keys = data.mold.script.cache_keys;
+    const size_t num_keys = md_array_size(data.mold.script.cache_keys);
+
+    int ret = 0;
+
+    if (md_array_size(merge_paths) > 0) {
+        if (!eval_cache_merge_shards(merge_paths, md_array_size(merge_paths), data.mold.script.full_eval, keys, num_keys)) {
+            LOG_ERROR("Failed to merge shards");
+            ret = -1;
+        } else {
+            LOG_INFO("Merged %zu shards", md_array_size(merge_paths));
+        }
+    } else if (md_array_size(ensemble.trajs) > 1) {
+        // The script is compiled against the first member, the members share the molecule
+        const size_t count = md_array_size(ensemble.trajs);
+        md_array_push(ensemble.evals, data.mold.script.full_eval, persistent_allocator);
+        md_array_push(ensemble.offsets, 0, persistent_allocator);
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t n = (uint32_t)md_trajectory_num_frames(ensemble.trajs[i]);
+            if (i > 0) md_array_push(ensemble.evals, md_script_eval_create(n, ir, STR(""), memory_tracker_allocator(MemoryTracker_ScriptEval)), persistent_allocator);
+            md_array_push(ensemble.offsets, ensemble.offsets[i] + n, persistent_allocator);
+        }
+        const uint32_t total_frames = ensemble.offsets[count];
+        LOG_INFO("Evaluating %u frames of %zu ensemble members on %u threads", total_frames, count, task_system::pool_num_threads());
+        const md_timestamp_t t0 = md_time_current();
+        data.tasks.evaluate_full = task_system::pool_enqueue(STR("Eval Ensemble"), 0, total_frames, headless_ensemble_eval_range, &ensemble, 0, task_system::Priority_Normal, estimate_eval_range_memory(&data));
+        task_system::execute_task(data.tasks.evaluate_full);
+        task_system::task_wait_for(data.tasks.evaluate_full);
+        LOG_INFO("Evaluation completed in %.3fs", md_time_as_seconds(md_time_current() - t0));
+    } else {
+        LOG_INFO("Evaluating frames %u:%u on %u threads", frame_beg, frame_end, task_system::pool_num_threads());
+        const md_timestamp_t t0 = md_time_current();
+        data.tasks.evaluate_full = task_system::pool_enqueue(STR("Eval Headless"), frame_beg, frame_end, [](uint32_t beg, uint32_t end, void* user_data) {
+            ApplicationData* data = (ApplicationData*)user_data;
+            md_script_eval_frame_range(data->mold.script.full_eval, data->mold.script.eval_ir, &data->mold.mol, data->mold.traj, beg, end);
+        }, &data, 0, task_system::Priority_Normal, estimate_eval_range_memory(&data));
+        task_system::execute_task(data.tasks.evaluate_full);
+        task_system::task_wait_for(data.tasks.evaluate_full);
+        LOG_INFO("Evaluation completed in %.3fs", md_time_as_seconds(md_time_current() - t0));
+
+        if (!str_empty(shard_path)) {
+            if (eval_cache_write_shard(shard_path, data.mold.script.full_eval, keys, num_keys, frame_beg, frame_end)) {
+                LOG_SUCCESS("Successfully wrote frames %u:%u to shard '%.*s'", frame_beg, frame_end, (int)shard_path.len, shard_path.ptr);
+            } else {
+                ret = -1;
             }
         }
-        case SerializationType_Invalid: // fallthrough
-        default:
-            ASSERT(false);
+    }
+
+    if (ret == 0 && md_script_eval_num_frames_completed(data.mold.script.full_eval) == num_frames) {
+        write_eval_cache(&data);
+        if (!str_empty(export_path)) {
+            ret = headless_export(&data, data.mold.script.full_eval, data.mold.traj, export_path) ? 0 : -1;
+        }
+    }
+
+    // The evaluation cache is keyed by the file of the dataset, so the replicas are only exported
+    for (size_t i = 1; i < md_array_size(ensemble.evals); ++i) {
+        md_script_eval_t* eval = ensemble.evals[i];
+        if (md_script_eval_num_frames_completed(eval) != md_script_eval_num_frames_total(eval)) {
+            LOG_ERROR("Evaluation of ensemble member '%.*s' is incomplete", (int)replica_paths[i - 1].len, replica_paths[i - 1].ptr);
+            ret = -1;
+        } else if (ret == 0 && !str_empty(export_path)) {
+            str_t ext = {};
+            extract_ext(&ext, export_path);
+            const str_t base = str_substr(export_path, 0, export_path.len - ext.len - 1);
+            const str_t path = alloc_printf(frame_allocator, STR_FMT "_replica%zu." STR_FMT, STR_ARG(base), i, STR_ARG(ext));
+            ret = headless_export(&data, eval, ensemble.trajs[i], path) ? 0 : -1;
         }
+        md_script_eval_free(eval);
+    }
+
+    // Peaks are logged before the data is freed, the rates are averages over the run
+    memory_tracker_update();
+    memory_tracker_log();
+    {
+        // Headless runs never reset the frame arena, so its usage is the high water mark of the run
+        const FrameArenaStats arena = frame_arena_stats(&frame_arena);
+        LOG_INFO("Memory: frame arena used %.1f MB of %.1f MB in %u block(s)", (double)arena.used / (1024.0 * 1024.0), (double)arena.capacity / (1024.0 * 1024.0), arena.num_blocks);
     }
+
+    md_script_eval_free(data.mold.script.full_eval);
+    md_script_ir_free(ir);
+    // Member 0 of an ensemble is the trajectory of the dataset
+    for (size_t i = 1; i < md_array_size(ensemble.trajs); ++i) {
+        load::traj::close(ensemble.trajs[i]);
+    }
+    load::traj::close(data.mold.traj);
+    task_system::shutdown();
+    return ret;
 }
 
-static void load_workspace(ApplicationData* data, str_t filename) {
-    str_t txt = load_textfile(filename, frame_allocator);
-    defer { str_free(txt, frame_allocator); };
+#if VIAMD_BENCH
+// #microbench
+// viamd_bench --micro [--molecule <file>] [--trajectory <file>] [--max-atoms <n>] [--threads <n>,<n>,...] [--out <file.json>]
+// Times the CPU hot paths of a frame and of the trajectory analyses on systems which are tiled from copies of the dataset (datasets/1ALA-500.pdb by default)
+// from the size of the dataset up to max-atoms (10M by default), for each of the thread counts (the number of processors by default).
+// The trajectory decode depends on the file format and runs on the frames of the trajectory itself, pass a large trajectory to measure it at scale.
+// The density of the ramachandran plot is uploaded as a texture when it completes, so the benchmark runs with the GL context of the application.
+
+#define MICROBENCH_MIN_SECONDS 0.25
+#define MICROBENCH_MIN_REPEATS 3
+#define MICROBENCH_MAX_ATOMS 10000000
+#define MICROBENCH_MAX_THREAD_COUNTS 16
+#define MICROBENCH_RAMA_FRAMES 16
+#define MICROBENCH_HISTOGRAM_BINS 128
+
+// Copies of the dataset on a grid with the spacing of its unit cell, the first frames of its trajectory are the keyframes of the interpolation
+struct MicrobenchSystem {
+    size_t num_atoms = 0;
+    size_t replica_atoms = 0;
+    uint32_t num_replicas = 0;
+    size_t stride = 0;
+    float* mem = nullptr;               // 4 keyframes followed by the destination, each of stride * 3 floats
+    md_vec3_soa_t keys[4] = {};
+    md_vec3_soa_t dst = {};
+    float* radius = nullptr;
+    float* mass = nullptr;
+    int32_t* indices = nullptr;         // Each replica is one structure of the shape space
+    vec3_t pbc_ext = {};
+};
 
-    if (!txt.len) {
-        LOG_ERROR("Could not open workspace file: '%.*s", (int)filename.len, filename.ptr);
-        return;
+struct MicrobenchResult {
+    const char* name;
+    size_t num_atoms;                   // Atoms per frame, 0 if the kernel does not scale with the atoms
+    double num_frames;                  // Frames per iteration
+    uint32_t num_threads;
+    double seconds;                     // Fastest iteration
+};
+
+typedef void (*MicrobenchFunc)(void* user_data);
+
+static void microbench_init_system(MicrobenchSystem* sys, const md_molecule_t* mol, const md_vec3_soa_t base[4], vec3_t cell_ext, uint32_t num_replicas) {
+    const size_t n = mol->atom.count;
+    sys->replica_atoms = n;
+    sys->num_replicas = num_replicas;
+    sys->num_atoms = n * num_replicas;
+    sys->stride = ALIGN_TO(sys->num_atoms, 8);
+    sys->mem = (float*)md_alloc(md_heap_allocator, sizeof(float) * sys->stride * 3 * 5);
+    for (int k = 0; k < 5; ++k) {
+        float* ptr = sys->mem + sys->stride * 3 * k;
+        const md_vec3_soa_t soa = {ptr, ptr + sys->stride, ptr + sys->stride * 2};
+        if (k < 4) sys->keys[k] = soa; else sys->dst = soa;
+    }
+    sys->radius  = (float*)md_alloc(md_heap_allocator, sizeof(float) * sys->num_atoms);
+    sys->mass    = (float*)md_alloc(md_heap_allocator, sizeof(float) * sys->num_atoms);
+    sys->indices = (int32_t*)md_alloc(md_heap_allocator, sizeof(int32_t) * sys->num_atoms);
+
+    const uint32_t dim = (uint32_t)ceil(cbrt((double)num_replicas));
+    sys->pbc_ext = {cell_ext.x * dim, cell_ext.y * dim, cell_ext.z * dim};
+    for (uint32_t r = 0; r < num_replicas; ++r) {
+        const float ox = cell_ext.x * (float)(r % dim);
+        const float oy = cell_ext.y * (float)((r / dim) % dim);
+        const float oz = cell_ext.z * (float)(r / (dim * dim));
+        const size_t beg = (size_t)r * n;
+        for (int k = 0; k < 4; ++k) {
+            for (size_t i = 0; i < n; ++i) {
+                sys->keys[k].x[beg + i] = base[k].x[i] + ox;
+                sys->keys[k].y[beg + i] = base[k].y[i] + oy;
+                sys->keys[k].z[beg + i] = base[k].z[i] + oz;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            sys->radius[beg + i] = mol->atom.radius ? mol->atom.radius[i] : 1.0f;
+            sys->mass[beg + i]   = mol->atom.mass   ? mol->atom.mass[i]   : 1.0f;
+        }
     }
+    for (size_t i = 0; i < sys->num_atoms; ++i) {
+        sys->indices[i] = (int32_t)i;
+    }
+}
 
-    // Reset and clear things
-    clear_selections(data);
-    clear_representations(data);
-    editor.SetText("");
+static void microbench_free_system(MicrobenchSystem* sys) {
+    md_free(md_heap_allocator, sys->mem, sizeof(float) * sys->stride * 3 * 5);
+    md_free(md_heap_allocator, sys->radius,  sizeof(float) * sys->num_atoms);
+    md_free(md_heap_allocator, sys->mass,    sizeof(float) * sys->num_atoms);
+    md_free(md_heap_allocator, sys->indices, sizeof(int32_t) * sys->num_atoms);
+    *sys = {};
+}
 
-    data->animation = {};
-    reset_view(data, false, true);
+// Repeats func until it has run for MICROBENCH_MIN_SECONDS and at least MICROBENCH_MIN_REPEATS times, the fastest iteration is kept
+static double microbench_time(MicrobenchFunc func, void* user_data) {
+    double best = DBL_MAX;
+    double total = 0;
+    for (int i = 0; i < MICROBENCH_MIN_REPEATS || total < MICROBENCH_MIN_SECONDS; ++i) {
+        const md_timestamp_t t0 = md_time_current();
+        func(user_data);
+        const double dt = md_time_as_seconds(md_time_current() - t0);
+        best = MIN(best, dt);
+        total += dt;
+    }
+    return best;
+}
 
-    str_t group = {};
-    str_t c_txt = txt;
-    str_t line = {};
+static void microbench_run(md_array(MicrobenchResult)* results, const char* name, size_t num_atoms, double num_frames, MicrobenchFunc func, void* user_data) {
+    const MicrobenchResult res = {name, num_atoms, num_frames, task_system::pool_num_threads(), microbench_time(func, user_data)};
+    md_array_push(*results, res, md_heap_allocator);
 
-    str_t cur_molecule_file     = str_copy_cstr(data->files.molecule, frame_allocator);
-    str_t cur_trajectory_file   = str_copy_cstr(data->files.trajectory, frame_allocator);
-    bool  cur_coarse_grained    = data->files.coarse_grained;
-    bool  cur_deperiodize       = data->files.deperiodize;
+    const double frames_per_sec = res.num_frames / res.seconds;
+    if (res.num_atoms) {
+        printf("%-28s %10zu atoms %3u threads %10.3f ms %10.2f Matoms/s %10.1f frames/s\n", res.name, res.num_atoms, res.num_threads, res.seconds * 1000.0, (double)res.num_atoms * frames_per_sec * 1.0e-6, frames_per_sec);
+    } else {
+        printf("%-28s %16s %3u threads %10.3f ms %19s %10.1f frames/s\n", res.name, "", res.num_threads, res.seconds * 1000.0, "", frames_per_sec);
+    }
+    fflush(stdout);
+}
 
-    const SerializationArray* arr_group = NULL;
-    void* ptr = 0;
+static bool microbench_write_json(str_t path, const MicrobenchResult* results, size_t count) {
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE);
+    if (!file) {
+        LOG_ERROR("Failed to open file '%.*s' to write results", (int)path.len, path.ptr);
+        return false;
+    }
+    md_file_printf(file, "[\n");
+    for (size_t i = 0; i < count; ++i) {
+        const MicrobenchResult& r = results[i];
+        const double frames_per_sec = r.num_frames / r.seconds;
+        md_file_printf(file, "  {\"name\": \"%s\", \"atoms\": %zu, \"threads\": %u, \"seconds\": %.9f, \"atoms_per_sec\": %.1f, \"frames_per_sec\": %.3f}%s\n",
+            r.name, r.num_atoms, r.num_threads, r.seconds, (double)r.num_atoms * frames_per_sec, frames_per_sec, i + 1 < count ? "," : "");
+    }
+    md_file_printf(file, "]\n");
+    md_file_close(file);
+    LOG_INFO("Wrote %zu results to '%.*s'", count, (int)path.len, path.ptr);
+    return true;
+}
 
-    while (str_extract_line(&line, &c_txt)) {
-        line = str_trim(line);
-        if (line[0] == '[') {
-            group = line;
-            arr_group = find_serialization_array_group(group);
-            if (arr_group) {
-                ptr = arr_group->create_item_func(data);
-            } else {
-                ptr = data;
+struct MicrobenchDecode {
+    md_trajectory_i* traj;
+    size_t num_atoms;
+    uint32_t num_frames;
+    bool clear_cache;       // The derived tier is cleared, which times the recenter and deperiodize of the frames held by the raw tier
+};
+
+static void microbench_decode(void* user_data) {
+    MicrobenchDecode* d = (MicrobenchDecode*)user_data;
+    if (d->clear_cache) load::traj::clear_cache(d->traj);
+    task_system::ID id = task_system::pool_enqueue(STR("##Decode"), 0, d->num_frames, [](uint32_t beg, uint32_t end, void* user_data) {
+        MicrobenchDecode* d = (MicrobenchDecode*)user_data;
+        task_system::ScratchMark mark = task_system::scratch_mark();
+        defer { task_system::scratch_rewind(mark); };
+        float* x = (float*)task_system::scratch_alloc(sizeof(float) * d->num_atoms * 3);
+        float* y = x + d->num_atoms;
+        float* z = y + d->num_atoms;
+        md_trajectory_frame_header_t header;
+        for (uint32_t i = beg; i < end; ++i) {
+            md_trajectory_load_frame(d->traj, i, &header, x, y, z);
+        }
+    }, d);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+}
+
+static void microbench_interpolate(void* user_data) {
+    execute_interpolation_job((InterpolationJob*)user_data);
+}
+
+struct MicrobenchFlags {
+    uint8_t* flags;
+    size_t count;
+    md_bitfield_t highlight;
+    md_bitfield_t selection;
+    md_bitfield_t visibility;
+};
+
+static void microbench_flags(void* user_data) {
+    MicrobenchFlags* f = (MicrobenchFlags*)user_data;
+    build_atom_flags(f->flags, f->count, &f->highlight, &f->selection, &f->visibility);
+}
+
+struct MicrobenchShapeSpace {
+    const MicrobenchSystem* sys;
+    vec3_t* weights;    // [num_replicas]
+};
+
+static void microbench_shape_space(void* user_data) {
+    MicrobenchShapeSpace* s = (MicrobenchShapeSpace*)user_data;
+    task_system::ID id = task_system::pool_enqueue(STR("##Shape Space"), 0, s->sys->num_replicas, [](uint32_t beg, uint32_t end, void* user_data) {
+        MicrobenchShapeSpace* s = (MicrobenchShapeSpace*)user_data;
+        const MicrobenchSystem* sys = s->sys;
+        for (uint32_t r = beg; r < end; ++r) {
+            const mat3_t M = shape_space_covariance(sys->keys[0].x, sys->keys[0].y, sys->keys[0].z, sys->mass, sys->indices + (size_t)r * sys->replica_atoms, sys->replica_atoms);
+            s->weights[r] = md_util_shape_weights(&M);
+        }
+    }, s);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+}
+
+struct MicrobenchHistogram {
+    HistogramBatch batch;
+    const float* values;
+    uint32_t num_frames;
+    float range_max;
+    md_bitfield_t mask;
+    float counts[MICROBENCH_HISTOGRAM_BINS];
+    uint32_t totals[1];
+};
+
+static void microbench_histogram(void* user_data) {
+    MicrobenchHistogram* h = (MicrobenchHistogram*)user_data;
+    histogram_batch_clear(&h->batch);
+    MEMSET(h->counts, 0, sizeof(h->counts));
+    MEMSET(h->totals, 0, sizeof(h->totals));
+    histogram_batch_add(&h->batch, h->values, 1, MICROBENCH_HISTOGRAM_BINS, 0.0f, h->range_max, false, &h->mask, 0, h->num_frames, h->counts, h->totals);
+    task_system::ID id = histogram_batch_enqueue(&h->batch);
+    task_system::execute_queued_tasks();
+    task_system::task_wait_for(id);
+}
+
+struct MicrobenchRama {
+    rama_rep_t* rep;
+    md_backbone_angles_t* angles;   // Random angles of MICROBENCH_RAMA_FRAMES frames
+    md_array(uint32_t) indices;     // All residues are of the general type
+    uint32_t num_backbone;
+};
+
+static void microbench_rama(void* user_data) {
+    MicrobenchRama* r = (MicrobenchRama*)user_data;
+    const uint32_t* indices[4] = {r->indices, NULL, NULL, NULL};
+    task_system::ID id = rama_rep_compute_density(r->rep, r->angles, indices, 0, MICROBENCH_RAMA_FRAMES, r->num_backbone);
+    task_system::execute_queued_tasks();
+    task_system::task_wait_for(id);
+    // Uploads the density
+    task_system::execute_queued_tasks();
+}
+
+// Molecule and trajectory of the benchmarks, the dataset 1ALA-500.pdb by default
+struct MicrobenchDataset {
+    str_t mol_path;
+    str_t traj_path;
+    md_trajectory_loader_i* traj_loader;
+};
+
+// The task system is expected to be running, as large molecules are loaded on it
+static bool microbench_load_dataset(MicrobenchDataset* ds, ApplicationData* data, str_t molecule, str_t trajectory) {
+    ds->mol_path = molecule;
+    if (str_empty(ds->mol_path)) {
+        char exe[1024];
+        const size_t len = md_path_write_exe(exe, sizeof(exe));
+        str_t folder = {};
+        extract_folder_path(&folder, {exe, len});
+        ds->mol_path = alloc_printf(frame_allocator, STR_FMT "%s", STR_ARG(folder), VIAMD_DATASET_DIR "/1ALA-500.pdb");
+    }
+
+    load::LoaderState state = {};
+    if (!load::init_loader_state(&state, ds->mol_path, frame_allocator) || !state.mol_loader) {
+        LOG_ERROR("Missing or unsupported molecule file '%.*s'", (int)ds->mol_path.len, ds->mol_path.ptr);
+        return false;
+    }
+    if (!state.mol_loader->init_from_file(&data->mold.mol, ds->mol_path, state.mol_loader_arg, data->mold.mol_alloc)) {
+        LOG_ERROR("Failed to load molecular data from file '%.*s'", (int)ds->mol_path.len, ds->mol_path.ptr);
+        return false;
+    }
+    mol_postprocess(&data->mold.mol, data->mold.mol_alloc, MD_UTIL_POSTPROCESS_ALL);
+
+    ds->traj_path = str_empty(trajectory) ? ds->mol_path : trajectory;
+    ds->traj_loader = state.traj_loader;
+    if (!str_empty(trajectory)) {
+        load::LoaderState traj_state = {};
+        ds->traj_loader = load::init_loader_state(&traj_state, ds->traj_path, frame_allocator) ? traj_state.traj_loader : NULL;
+    }
+    if (!ds->traj_loader) {
+        LOG_ERROR("Missing or unsupported trajectory file '%.*s'", (int)ds->traj_path.len, ds->traj_path.ptr);
+        return false;
+    }
+    return true;
+}
+
+// The first frames of the trajectory, which are tiled into the systems, and the spacing of the copies
+struct MicrobenchBase {
+    float* mem;
+    size_t num_atoms;
+    md_vec3_soa_t keys[4];
+    vec3_t cell_ext;
+};
+
+static void microbench_init_base(MicrobenchBase* base, const md_molecule_t* mol, md_trajectory_i* traj) {
+    const size_t n = mol->atom.count;
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(traj);
+    base->num_atoms = n;
+    base->mem = (float*)md_alloc(md_heap_allocator, sizeof(float) * n * 3 * 4);
+    md_trajectory_frame_header_t header = {};
+    for (int k = 0; k < 4; ++k) {
+        float* ptr = base->mem + n * 3 * k;
+        base->keys[k] = {ptr, ptr + n, ptr + n * 2};
+        md_trajectory_load_frame(traj, MIN((uint32_t)k, num_frames - 1), &header, base->keys[k].x, base->keys[k].y, base->keys[k].z);
+    }
+    base->cell_ext = header.unit_cell.basis * vec3_set1(1.0f);
+    if (base->cell_ext.x <= 0 || base->cell_ext.y <= 0 || base->cell_ext.z <= 0) {
+        vec3_t aabb_min, aabb_max;
+        md_util_aabb_compute(&aabb_min, &aabb_max, base->keys[0].x, base->keys[0].y, base->keys[0].z, mol->atom.radius, 0, n);
+        base->cell_ext = aabb_max - aabb_min + vec3_set1(2.0f);
+    }
+}
+
+static void microbench_free_base(MicrobenchBase* base) {
+    md_free(md_heap_allocator, base->mem, sizeof(float) * base->num_atoms * 3 * 4);
+    *base = {};
+}
+
+// Histogram of a property with one frame per atom of the system, with every other block of 64 frames masked out
+static void microbench_init_histogram(MicrobenchHistogram* h, const MicrobenchSystem* sys) {
+    histogram_batch_init(&h->batch, md_heap_allocator);
+    h->values = sys->keys[0].x;
+    h->num_frames = (uint32_t)sys->num_atoms;
+    h->range_max = sys->pbc_ext.x;
+    md_bitfield_init(&h->mask, md_heap_allocator);
+    for (uint32_t beg = 0; beg < h->num_frames; beg += 128) {
+        md_bitfield_set_range(&h->mask, beg, MIN(beg + 64, h->num_frames));
+    }
+}
+
+static void microbench_free_histogram(MicrobenchHistogram* h) {
+    md_bitfield_free(&h->mask);
+    histogram_batch_free(&h->batch);
+}
+
+// Ramachandran density of MICROBENCH_RAMA_FRAMES frames, with the residues of the dataset in every replica
+static void microbench_init_rama(MicrobenchRama* r, rama_rep_t* rep, size_t num_residues, const MicrobenchSystem* sys) {
+    r->rep = rep;
+    r->num_backbone = (uint32_t)(MAX((size_t)1, num_residues) * sys->num_replicas);
+    const size_t num_angles = (size_t)r->num_backbone * MICROBENCH_RAMA_FRAMES;
+    r->angles = (md_backbone_angles_t*)md_alloc(md_heap_allocator, sizeof(md_backbone_angles_t) * num_angles);
+    uint32_t rng = 12345;
+    for (size_t i = 0; i < num_angles; ++i) {
+        rng = rng * 1664525u + 1013904223u;
+        const float u = (float)(rng >> 8) / (float)(1 << 24);
+        rng = rng * 1664525u + 1013904223u;
+        const float v = (float)(rng >> 8) / (float)(1 << 24);
+        r->angles[i] = {(u * 2.0f - 1.0f) * (float)PI, (v * 2.0f - 1.0f) * (float)PI};
+    }
+    md_array_resize(r->indices, r->num_backbone, md_heap_allocator);
+    for (uint32_t i = 0; i < r->num_backbone; ++i) {
+        r->indices[i] = i;
+    }
+}
+
+static void microbench_free_rama(MicrobenchRama* r) {
+    md_free(md_heap_allocator, r->angles, sizeof(md_backbone_angles_t) * r->num_backbone * MICROBENCH_RAMA_FRAMES);
+    md_array_free(r->indices, md_heap_allocator);
+    *r = {};
+}
+
+static void print_microbench_usage() {
+    printf("Usage: viamd_bench --micro [--molecule <file>] [--trajectory <file>] [--max-atoms <n>] [--threads <n>,<n>,...] [--out <file.json>]\n");
+}
+
+static int run_microbench(int argc, char** argv) {
+    str_t molecule = {};
+    str_t trajectory = {};
+    str_t out_path = {};
+    size_t max_atoms = MICROBENCH_MAX_ATOMS;
+    uint32_t thread_counts[MICROBENCH_MAX_THREAD_COUNTS] = {};
+    uint32_t num_thread_counts = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--micro") == 0) {
+            continue;
+        } else if (strcmp(argv[i], "--molecule") == 0 && has_value) {
+            molecule = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--trajectory") == 0 && has_value) {
+            trajectory = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && has_value) {
+            out_path = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--max-atoms") == 0 && has_value) {
+            max_atoms = (size_t)MAX(1LL, atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            for (const char* c = argv[++i]; *c && num_thread_counts < MICROBENCH_MAX_THREAD_COUNTS; ) {
+                thread_counts[num_thread_counts++] = (uint32_t)MAX(1, atoi(c));
+                while (*c && *c != ',') ++c;
+                if (*c == ',') ++c;
             }
         } else {
-            size_t loc;
-            if (str_find_char(&loc, line, '=')) {
-                str_t label = str_trim(str_substr(line, 0, loc));
-                const SerializationObject* target = find_serialization_target(group, label);
-                if (target) {
-                    // Move read pointer back 'loc+1' => after '='.
-                    const char* pos = line.ptr + loc + 1;
-                    c_txt.len = c_txt.end() - pos;
-                    c_txt.ptr = pos;
-                    deserialize_object(target, (char*)ptr, &c_txt, filename);
-                } else {
-                    LOG_INFO("Could not recognize serialization target '%.*s' in group '%.*s,", (int)label.len, label.ptr, (int)group.len, group.ptr);
+            LOG_ERROR("Unrecognized argument '%s'", argv[i]);
+            print_microbench_usage();
+            return -1;
+        }
+    }
+    if (num_thread_counts == 0) {
+        thread_counts[num_thread_counts++] = (uint32_t)md_os_num_processors();
+    }
+
+    ApplicationData data;
+    data.mold.mol_alloc = md_arena_allocator_create(memory_tracker_allocator(MemoryTracker_Molecule), MEGABYTES(1));
+
+    if (!application::initialize(&data.ctx, 0, 0, "VIAMD Microbenchmark")) {
+        LOG_ERROR("Could not initialize application...\n");
+        return -1;
+    }
+    task_system::initialize(thread_counts[0]);
+
+    MicrobenchDataset ds = {};
+    if (!microbench_load_dataset(&ds, &data, molecule, trajectory)) {
+        print_microbench_usage();
+        return -1;
+    }
+    const md_molecule_t& mol = data.mold.mol;
+    const str_t mol_path = ds.mol_path;
+    const str_t traj_path = ds.traj_path;
+    md_trajectory_loader_i* traj_loader = ds.traj_loader;
+
+    data.mold.traj = load::traj::open_file(traj_path, traj_loader, &mol, memory_tracker_allocator(MemoryTracker_Trajectory));
+    md_trajectory_i* scan = load::traj::scan_file(traj_path, traj_loader, memory_tracker_allocator(MemoryTracker_Trajectory));
+    const uint32_t num_traj_frames = data.mold.traj ? (uint32_t)md_trajectory_num_frames(data.mold.traj) : 0;
+    if (!scan || num_traj_frames == 0) {
+        LOG_ERROR("Failed to open trajectory '%.*s'", (int)traj_path.len, traj_path.ptr);
+        return -1;
+    }
+
+    // The recenter and deperiodize transforms of the loader are applied to the whole molecule
+    md_bitfield_t all_atoms = md_bitfield_create(md_heap_allocator);
+    md_bitfield_set_range(&all_atoms, 0, mol.atom.count);
+    load::traj::set_recenter_target(data.mold.traj, &all_atoms);
+    load::traj::set_deperiodize(data.mold.traj, true);
+
+    // Keyframes of the tiled systems
+    const size_t n = mol.atom.count;
+    MicrobenchBase base = {};
+    microbench_init_base(&base, &mol, data.mold.traj);
+
+    // The dataset itself followed by the sizes of a decade each up to max_atoms
+    uint32_t replicas[8] = {1};
+    uint32_t num_systems = 1;
+    for (size_t target = 10000; target <= max_atoms && num_systems < ARRAY_SIZE(replicas); target *= 10) {
+        const uint32_t r = (uint32_t)MAX(1, (target + n / 2) / n);
+        if (r > replicas[num_systems - 1]) replicas[num_systems++] = r;
+    }
+
+    rama_data_t rama = {};
+    rama_init(&rama);
+
+    md_array(MicrobenchResult) results = 0;
+    printf("Microbenchmark of '%.*s' (%zu atoms, %u frames)\n", (int)mol_path.len, mol_path.ptr, n, num_traj_frames);
+
+    for (uint32_t t = 0; t < num_thread_counts; ++t) {
+        task_system::pool_set_num_threads(thread_counts[t]);
+
+        // Decode
+        MicrobenchDecode decode = {scan, n, num_traj_frames, false};
+        microbench_run(&results, "decode_frame_data (raw)", n, num_traj_frames, microbench_decode, &decode);
+        decode = {data.mold.traj, n, num_traj_frames, true};
+        microbench_time(microbench_decode, &decode);    // Brings the frames into the raw tier
+        microbench_run(&results, "decode_frame_data (transform)", n, num_traj_frames, microbench_decode, &decode);
+
+        for (uint32_t s = 0; s < num_systems; ++s) {
+            MicrobenchSystem sys = {};
+            microbench_init_system(&sys, &mol, base.keys, base.cell_ext, replicas[s]);
+
+            // Interpolation
+            {
+                InterpolationJob job = {};
+                job.t = 0.37f;
+                job.s = 0.5f;
+                job.pbc_ext = sys.pbc_ext;
+                job.dst = sys.dst;
+                MEMCPY(job.src, sys.keys, sizeof(job.src));
+                job.radius = sys.radius;
+                job.num_atoms = sys.num_atoms;
+                job.num_atom_chunks = (uint32_t)DIV_UP_CHUNK(job.num_atoms, INTERPOLATION_ATOM_CHUNK);
+                job.aabb_min = (vec3_t*)md_alloc(md_heap_allocator, sizeof(vec3_t) * job.num_atom_chunks);
+                job.aabb_max = (vec3_t*)md_alloc(md_heap_allocator, sizeof(vec3_t) * job.num_atom_chunks);
+
+                job.mode = InterpolationMode::Nearest;
+                microbench_run(&results, "interpolate (nearest)", sys.num_atoms, 1, microbench_interpolate, &job);
+                job.mode = InterpolationMode::Linear;
+                microbench_run(&results, "interpolate (linear)", sys.num_atoms, 1, microbench_interpolate, &job);
+                job.mode = InterpolationMode::CubicSpline;
+                microbench_run(&results, "interpolate (cubic)", sys.num_atoms, 1, microbench_interpolate, &job);
+
+                md_free(md_heap_allocator, job.aabb_min, sizeof(vec3_t) * job.num_atom_chunks);
+                md_free(md_heap_allocator, job.aabb_max, sizeof(vec3_t) * job.num_atom_chunks);
+            }
+
+            // Flags of update_md_buffers: A small highlight, the first half of every other replica selected and everything visible
+            {
+                MicrobenchFlags f = {};
+                f.count = sys.num_atoms;
+                f.flags = (uint8_t*)md_alloc(md_heap_allocator, f.count);
+                md_bitfield_init(&f.highlight,  md_heap_allocator);
+                md_bitfield_init(&f.selection,  md_heap_allocator);
+                md_bitfield_init(&f.visibility, md_heap_allocator);
+                md_bitfield_set_range(&f.highlight, 0, MIN(sys.num_atoms, sys.replica_atoms));
+                for (uint32_t r = 0; r < sys.num_replicas; r += 2) {
+                    const size_t beg = (size_t)r * sys.replica_atoms;
+                    md_bitfield_set_range(&f.selection, beg, beg + sys.replica_atoms / 2);
                 }
+                md_bitfield_set_range(&f.visibility, 0, sys.num_atoms);
+
+                microbench_run(&results, "update_md_buffers (flags)", sys.num_atoms, 1, microbench_flags, &f);
+
+                md_bitfield_free(&f.highlight);
+                md_bitfield_free(&f.selection);
+                md_bitfield_free(&f.visibility);
+                md_free(md_heap_allocator, f.flags, f.count);
+            }
+
+            // Shape space covariance of every replica
+            {
+                MicrobenchShapeSpace ss = {&sys, (vec3_t*)md_alloc(md_heap_allocator, sizeof(vec3_t) * sys.num_replicas)};
+                microbench_run(&results, "shape_space_covariance", sys.num_atoms, 1, microbench_shape_space, &ss);
+                md_free(md_heap_allocator, ss.weights, sizeof(vec3_t) * sys.num_replicas);
             }
+
+            {
+                MicrobenchHistogram h = {};
+                microbench_init_histogram(&h, &sys);
+                microbench_run(&results, "histogram (masked)", 0, h.num_frames, microbench_histogram, &h);
+                microbench_free_histogram(&h);
+            }
+            {
+                MicrobenchRama r = {};
+                microbench_init_rama(&r, &rama.full, mol.backbone.count, &sys);
+                microbench_run(&results, "rama_rep_compute_density", sys.num_atoms, MICROBENCH_RAMA_FRAMES, microbench_rama, &r);
+                microbench_free_rama(&r);
+            }
+
+            microbench_free_system(&sys);
         }
     }
-    data->view.animation.target_position    = data->view.camera.position;
-    data->view.animation.target_orientation = data->view.camera.orientation;
-    data->view.animation.target_distance    = data->view.camera.focus_distance;
-    
-    str_t new_molecule_file   = str_copy_cstr(data->files.molecule, frame_allocator);
-    str_t new_trajectory_file = str_copy_cstr(data->files.trajectory, frame_allocator);
-    bool  new_coarse_grained  = data->files.coarse_grained;
-    bool  new_deperiodize     = data->files.deperiodize;
 
-    str_copy_to_char_buf(data->files.workspace, sizeof(data->files.workspace), filename);
-    
-    // When we de-serialize we overwrite the two following paths, even though they are not loaded.
-    // So we copy them back to their original values.
-    str_copy_to_char_buf(data->files.molecule, sizeof(data->files.molecule), cur_molecule_file);
-    str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), cur_trajectory_file);
-    data->files.coarse_grained  = cur_coarse_grained;
-    data->files.deperiodize     = cur_deperiodize;
-    
-    str_t mol_ext = {};
-    str_t traj_ext = {};
+    int ret = 0;
+    if (!str_empty(out_path) && !microbench_write_json(out_path, results, md_array_size(results))) {
+        ret = -1;
+    }
+
+    md_array_free(results, md_heap_allocator);
+    rama_free(&rama);
+    microbench_free_base(&base);
+    md_bitfield_free(&all_atoms);
+    load::traj::free_scan(scan, traj_loader);
+    load::traj::close(data.mold.traj);
+    task_system::shutdown();
+    application::shutdown(&data.ctx);
+    return ret;
+}
+
+// #perf
+// viamd_bench --perf <open|script|histogram|rama> --baseline <dir> [--tolerance <fraction>] [--update] [--threads <n>] [--molecule <file>] [--trajectory <file>]
+// Performance regression test of one timed scenario, the scenarios are registered with CTest under the label perf (ctest -L perf, see VIAMD_PERF_TESTS).
+// The fastest time of the scenario is compared with the baseline in <dir>/<scenario>.txt and the test fails if it is slower by more than the tolerance.
+// A missing baseline is recorded by the run, as is the result of a run with --update. The baselines depend on the machine, so they are recorded on the
+// machine which runs the tests, with the version which is known to be good.
+
+#define PERF_DEFAULT_TOLERANCE 0.15
+#define PERF_SYSTEM_ATOMS 1000000
+
+// The script of the default dataset, evaluated over the whole trajectory
+static const char perf_script[] =
+    "s1 = resname(\"ALA\")[2:8];\n"
+    "d1 = distance(10,30);\n"
+    "a1 = angle(2,1,3) in resname(\"ALA\");\n"
+    "r = rdf(element('C'), element('H'), 10.0);\n"
+    "v = sdf(s1, element('H'), 10.0);\n";
+
+struct PerfOpen {
+    str_t path;
+    md_trajectory_loader_i* loader;
+    const md_molecule_t* mol;
+    uint32_t num_frames;
+};
+
+// Opens (and indexes) the trajectory, no other instance of it may be open as it would be shared
+static void perf_open(void* user_data) {
+    PerfOpen* p = (PerfOpen*)user_data;
+    md_trajectory_i* traj = load::traj::open_file(p->path, p->loader, p->mol, memory_tracker_allocator(MemoryTracker_Trajectory));
+    p->num_frames = traj ? (uint32_t)md_trajectory_num_frames(traj) : 0;
+    load::traj::close(traj);
+}
+
+struct PerfScript {
+    ApplicationData* data;
+    md_script_ir_t* ir;
+    md_script_eval_t* eval;
+    uint32_t num_frames;
+};
+
+static void perf_script_sweep(void* user_data) {
+    PerfScript* p = (PerfScript*)user_data;
+    p->eval = md_script_eval_create(p->num_frames, p->ir, STR(""), memory_tracker_allocator(MemoryTracker_ScriptEval));
+    task_system::ID id = task_system::pool_enqueue(STR("Eval Perf"), 0, p->num_frames, [](uint32_t beg, uint32_t end, void* user_data) {
+        PerfScript* p = (PerfScript*)user_data;
+        md_script_eval_frame_range(p->eval, p->ir, &p->data->mold.mol, p->data->mold.traj, beg, end);
+    }, p);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+    md_script_eval_free(p->eval);
+    p->eval = NULL;
+}
+
+static bool perf_read_baseline(double* seconds, str_t path) {
+    str_t txt = load_textfile(path, frame_allocator);
+    str_t line;
+    while (str_extract_line(&line, &txt)) {
+        line = str_trim(line);
+        if (str_empty(line) || line.ptr[0] == '#') continue;
+        char buf[64];
+        str_copy_to_char_buf(buf, sizeof(buf), line);
+        return sscanf(buf, "%lf", seconds) == 1 && *seconds > 0.0;
+    }
+    return false;
+}
+
+static bool perf_write_baseline(str_t path, const MicrobenchResult& res) {
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE);
+    if (!file) {
+        LOG_ERROR("Failed to open file '%.*s' to write the baseline", (int)path.len, path.ptr);
+        return false;
+    }
+    md_file_printf(file, "# viamd_bench --perf %s: fastest time in seconds (%zu atoms, %.0f frames, %u threads)\n", res.name, res.num_atoms, res.num_frames, res.num_threads);
+    md_file_printf(file, "%.9f\n", res.seconds);
+    md_file_close(file);
+    return true;
+}
+
+static void print_perf_usage() {
+    printf("Usage: viamd_bench --perf <open|script|histogram|rama> --baseline <dir> [--tolerance <fraction>] [--update] [--threads <n>] [--molecule <file>] [--trajectory <file>]\n");
+}
+
+static int run_perf(int argc, char** argv) {
+    const char* scenario = NULL;
+    str_t molecule = {};
+    str_t trajectory = {};
+    str_t baseline_dir = {};
+    double tolerance = PERF_DEFAULT_TOLERANCE;
+    bool update = false;
+    int num_threads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--perf") == 0 && has_value) {
+            scenario = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_dir = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--tolerance") == 0 && has_value) {
+            tolerance = MAX(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            num_threads = MAX(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--molecule") == 0 && has_value) {
+            molecule = str_from_cstr(argv[++i]);
+        } else if (strcmp(argv[i], "--trajectory") == 0 && has_value) {
+            trajectory = str_from_cstr(argv[++i]);
+        } else {
+            LOG_ERROR("Unrecognized argument '%s'", argv[i]);
+            print_perf_usage();
+            return -1;
+        }
+    }
 
-    extract_ext(&mol_ext, new_molecule_file);
-    extract_ext(&traj_ext, new_trajectory_file);
+    const char* scenarios[] = {"open", "script", "histogram", "rama"};
+    int type = -1;
+    for (int i = 0; i < (int)ARRAY_SIZE(scenarios); ++i) {
+        if (scenario && strcmp(scenario, scenarios[i]) == 0) type = i;
+    }
+    if (type == -1 || str_empty(baseline_dir)) {
+        print_perf_usage();
+        return -1;
+    }
+    const bool needs_gl = type == 3;
 
-    load::LoaderState state = {};
+    ApplicationData data;
+    data.mold.mol_alloc = md_arena_allocator_create(memory_tracker_allocator(MemoryTracker_Molecule), MEGABYTES(1));
 
-    load::init_loader_state(&state, new_molecule_file, frame_allocator);
+    // The density of the ramachandran plot is uploaded as a texture
+    if (needs_gl && !application::initialize(&data.ctx, 0, 0, "VIAMD Performance Test")) {
+        LOG_ERROR("Could not initialize application...\n");
+        return -1;
+    }
+    task_system::initialize(num_threads);
 
-    LoadParam param = {};
-    param.file_path = new_molecule_file;
-    param.mol_loader = state.mol_loader;
-    param.traj_loader = state.traj_loader;
-    param.coarse_grained = new_coarse_grained;
-    param.deperiodize = new_coarse_grained;
-    param.keep_representations = false;
-    param.mol_loader_arg = state.mol_loader_arg;
+    MicrobenchDataset ds = {};
+    if (!microbench_load_dataset(&ds, &data, molecule, trajectory)) {
+        return -1;
+    }
+    const md_molecule_t& mol = data.mold.mol;
+
+    MicrobenchResult res = {scenarios[type], 0, 1, task_system::pool_num_threads(), 0};
+    int ret = 0;
+    if (type == 0) {
+        PerfOpen p = {ds.traj_path, ds.traj_loader, &mol, 0};
+        res.seconds = microbench_time(perf_open, &p);
+        res.num_atoms = mol.atom.count;
+        res.num_frames = p.num_frames;
+        if (p.num_frames == 0) {
+            LOG_ERROR("Failed to open trajectory '%.*s'", (int)ds.traj_path.len, ds.traj_path.ptr);
+            ret = -1;
+        }
+    } else {
+        data.mold.traj = load::traj::open_file(ds.traj_path, ds.traj_loader, &mol, memory_tracker_allocator(MemoryTracker_Trajectory));
+        const uint32_t num_frames = data.mold.traj ? (uint32_t)md_trajectory_num_frames(data.mold.traj) : 0;
+        if (num_frames == 0) {
+            LOG_ERROR("Failed to open trajectory '%.*s'", (int)ds.traj_path.len, ds.traj_path.ptr);
+            return -1;
+        }
 
-    if (new_molecule_file && load_dataset_from_file(data, param)) {
-        init_all_representations(data);
-        update_all_representations(data);
+        if (type == 1) {
+            md_script_ir_t* ir = md_script_ir_create(memory_tracker_allocator(MemoryTracker_ScriptEval));
+            md_script_ir_compile_from_source(ir, str_from_cstr(perf_script), &mol, data.mold.traj, NULL);
+            if (md_script_ir_valid(ir)) {
+                // The frames are in the cache after the first iteration, so the fastest iteration is the evaluation itself
+                PerfScript p = {&data, ir, NULL, num_frames};
+                res.seconds = microbench_time(perf_script_sweep, &p);
+                res.num_atoms = mol.atom.count;
+                res.num_frames = num_frames;
+            } else {
+                LOG_ERROR("The script of the scenario did not compile for '%.*s'", (int)ds.mol_path.len, ds.mol_path.ptr);
+                ret = -1;
+            }
+            md_script_ir_free(ir);
+        } else {
+            MicrobenchBase base = {};
+            microbench_init_base(&base, &mol, data.mold.traj);
+            MicrobenchSystem sys = {};
+            microbench_init_system(&sys, &mol, base.keys, base.cell_ext, (uint32_t)MAX((size_t)1, PERF_SYSTEM_ATOMS / mol.atom.count));
+            if (type == 2) {
+                MicrobenchHistogram h = {};
+                microbench_init_histogram(&h, &sys);
+                res.seconds = microbench_time(microbench_histogram, &h);
+                res.num_frames = h.num_frames;
+                microbench_free_histogram(&h);
+            } else {
+                rama_data_t rama = {};
+                rama_init(&rama);
+                MicrobenchRama r = {};
+                microbench_init_rama(&r, &rama.full, mol.backbone.count, &sys);
+                res.seconds = microbench_time(microbench_rama, &r);
+                res.num_atoms = sys.num_atoms;
+                res.num_frames = MICROBENCH_RAMA_FRAMES;
+                microbench_free_rama(&r);
+                rama_free(&rama);
+            }
+            microbench_free_system(&sys);
+            microbench_free_base(&base);
+        }
+        load::traj::close(data.mold.traj);
     }
 
-    if (new_trajectory_file) {
-        load::init_loader_state(&state, new_trajectory_file, frame_allocator);
-        param.mol_loader = 0;
-        param.traj_loader = state.traj_loader;
-        param.file_path = new_trajectory_file;
-        load_dataset_from_file(data, param);
+    if (ret == 0) {
+        const str_t path = alloc_printf(frame_allocator, STR_FMT "/%s.txt", STR_ARG(baseline_dir), res.name);
+        double baseline = 0.0;
+        if (!update && perf_read_baseline(&baseline, path)) {
+            const double change = res.seconds / baseline - 1.0;
+            printf("perf %s: %.3f ms, baseline %.3f ms (%+.1f%%, tolerance %.1f%%)\n", res.name, res.seconds * 1000.0, baseline * 1000.0, change * 100.0, tolerance * 100.0);
+            if (change > tolerance) {
+                LOG_ERROR("Performance regression in '%s': %.3f ms is %.1f%% slower than the baseline of %.3f ms", res.name, res.seconds * 1000.0, change * 100.0, baseline * 1000.0);
+                ret = 1;
+            }
+        } else {
+            printf("perf %s: %.3f ms, recorded as the baseline '%.*s'\n", res.name, res.seconds * 1000.0, (int)path.len, path.ptr);
+            ret = perf_write_baseline(path, res) ? 0 : -1;
+        }
     }
 
-    apply_atom_elem_mappings(data);
+    task_system::shutdown();
+    if (needs_gl) application::shutdown(&data.ctx);
+    return ret;
 }
+#endif
 
 static void write_entry(FILE* file, SerializationObject target, const void* ptr, str_t filename) {
     fprintf(file, "%s=", target.label);
@@ -9484,52 +16289,814 @@ static void save_workspace(ApplicationData* data, str_t filename) {
     }
 }
 
-void create_screenshot(ApplicationData* data) {
+// The pixels are read back into a PBO and the flip and encoding are done on the pool, see update_screenshot_captures
+void create_screenshot(ApplicationData* data) {
+    ASSERT(data);
+    str_t path = data->screenshot.path_to_file;
+
+    str_t ext = {};
+    extract_ext(&ext, path);
+    if (!str_eq_cstr_ignore_case(ext, "jpg") && !str_eq_cstr_ignore_case(ext, "png") && !str_eq_cstr_ignore_case(ext, "bmp")) {
+        LOG_ERROR("Non supported file-extension '%.*s' when saving screenshot", (int)ext.len, ext.ptr);
+        return;
+    }
+
+    ScreenshotCapture* cap = 0;
+    for (int pass = 0; pass < 2 && !cap; ++pass) {
+        // If all captures are in flight, the oldest are completed first
+        if (pass == 1) update_screenshot_captures(data, true);
+        for (ScreenshotCapture& c : data->screenshot.captures) {
+            if (!c.fence && !c.task) {
+                cap = &c;
+                break;
+            }
+        }
+    }
+    ASSERT(cap);
+
+    cap->width  = data->gbuffer.width;
+    cap->height = data->gbuffer.height;
+    const size_t size = (size_t)cap->width * cap->height * sizeof(uint32_t);
+
+    if (!cap->pbo) glGenBuffers(1, &cap->pbo);
+    application::bind_default_framebuffer(GL_READ_FRAMEBUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, cap->pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    glReadPixels(0, 0, cap->width, cap->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    cap->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    cap->path = str_copy(path, persistent_allocator);
+}
+
+static void encode_screenshot(void* user_data) {
+    ScreenshotCapture* cap = (ScreenshotCapture*)user_data;
+    image_t& img = cap->img;
+
+    // @NOTE: Copy the rows in reverse order to flip image with respect to y-axis
+    const size_t row_byte_size = img.width * sizeof(uint32_t);
+    for (int32_t i = 0; i < img.height; ++i) {
+        MEMCPY(img.data + (size_t)i * img.width, cap->mapped + (size_t)(img.height - 1 - i) * img.width, row_byte_size);
+    }
+
+    str_t ext = {};
+    extract_ext(&ext, cap->path);
+    if (str_eq_cstr_ignore_case(ext, "jpg")) {
+        const int quality = 95;
+        cap->written = image_write_jpg(&img, cap->path, quality);
+    } else if (str_eq_cstr_ignore_case(ext, "png")) {
+        cap->written = image_write_png(&img, cap->path);
+    } else {
+        cap->written = image_write_bmp(&img, cap->path);
+    }
+}
+
+// Maps the captures which have been read back and hands them to the pool, and completes the captures which have been written
+// If wait is set, all captures in flight are completed
+static void update_screenshot_captures(ApplicationData* data, bool wait) {
+    ASSERT(data);
+    for (ScreenshotCapture& cap : data->screenshot.captures) {
+        if (cap.fence) {
+            const GLenum res = glClientWaitSync((GLsync)cap.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? UINT64_MAX : 0);
+            if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) continue;
+            glDeleteSync((GLsync)cap.fence);
+            cap.fence = 0;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, cap.pbo);
+            cap.mapped = (const uint32_t*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if (!cap.mapped) {
+                LOG_ERROR("Failed to read back screenshot '%.*s'", (int)cap.path.len, cap.path.ptr);
+                str_free(cap.path, persistent_allocator);
+                cap.path = {};
+                continue;
+            }
+            image_init(&cap.img, cap.width, cap.height, md_heap_allocator);
+            cap.written = false;
+            cap.task = task_system::pool_enqueue(STR("Encode Screenshot"), encode_screenshot, &cap);
+            // Launched now, a task which has not been piped yet reads as completed below
+            task_system::execute_task(cap.task);
+        }
+
+        if (cap.task) {
+            if (wait) {
+                task_system::task_wait_for(cap.task);
+            } else if (task_system::task_is_running(cap.task)) {
+                continue;
+            }
+            cap.task = 0;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, cap.pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            cap.mapped = 0;
+            image_free(&cap.img, md_heap_allocator);
+
+            if (cap.written) {
+                LOG_SUCCESS("Screenshot saved to: '%.*s'", (int)cap.path.len, cap.path.ptr);
+            } else {
+                LOG_ERROR("Failed to write screenshot to '%.*s'", (int)cap.path.len, cap.path.ptr);
+            }
+            str_free(cap.path, persistent_allocator);
+            cap.path = {};
+        }
+    }
+}
+
+static void free_screenshot_captures(ApplicationData* data) {
+    ASSERT(data);
+    update_screenshot_captures(data, true);
+    for (ScreenshotCapture& cap : data->screenshot.captures) {
+        if (cap.pbo) glDeleteBuffers(1, &cap.pbo);
+        cap = {};
+    }
+}
+
+// Renders the view into a PNG of width x height in tiles, each through the G-Buffer and postprocessing with an off-center projection of the full image
+// Bands of tiles are streamed to the file, so neither the image nor the G-Buffer of its size has to fit in memory
+// The radius of SSAO follows the projection, so it is that of the full image in pixels, and the padding of the tiles provides the neighborhood across their borders
+// Each pixel is the average of num_samples renders, jittered by subpixel offsets of the image
+static bool render_tiled_image(ApplicationData* data, str_t path, int width, int height, int num_samples) {
+    ASSERT(data);
+    if (width <= 0 || height <= 0) {
+        LOG_ERROR("Invalid image size %i x %i", width, height);
+        return false;
+    }
+
+    image_png_stream_t stream = {};
+    if (!image_png_stream_begin(&stream, path, width, height)) {
+        return false;
+    }
+
+    const int tile = TILED_RENDER_TILE_SIZE;
+    const int pad  = TILED_RENDER_TILE_PAD;
+    const int size = tile + 2 * pad;
+    num_samples = CLAMP(num_samples, 1, (int)ARRAY_SIZE(data->view.jitter.sequence));
+
+    const int num_tiles = ((width + tile - 1) / tile) * ((height + tile - 1) / tile);
+    LOG_INFO("Rendering %i x %i image in %i tiles with %i samples", width, height, num_tiles, num_samples);
+
+    GBuffer gbuf = {};
+    init_gbuffer(&gbuf, size, size);
+
+    const float aspect = (float)width / (float)height;
+    mat4_t proj;
+    if (data->view.mode == CameraMode::Perspective) {
+        proj = camera_perspective_projection_matrix(data->view.camera, aspect);
+    } else {
+        const float h = data->view.camera.focus_distance * tanf(data->view.camera.fov_y * 0.5f);
+        const float w = aspect * h;
+        proj = camera_orthographic_projection_matrix(-w, w, -h, h, data->view.camera.near_plane, data->view.camera.far_plane);
+    }
+
+    // Culling and the proxies are evaluated for the current view, so all atoms are drawn
+    const ViewParam view_param = data->view.param;
+    const bool culling_active = data->representation.culling.active;
+    data->representation.culling.active = false;
+
+    // There is no history between the tiles
+    postprocessing::Descriptor desc = postprocessing_descriptor(*data, gbuf);
+    desc.temporal_reprojection.enabled = false;
+    desc.ambient_occlusion.half_res = false;
+
+    const size_t tile_pixels = (size_t)size * size;
+    uint32_t* pixels = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * tile_pixels);
+    uint32_t* accum  = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * tile_pixels * 4);
+    uint32_t* band   = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * width * tile);
+    defer {
+        md_free(md_heap_allocator, pixels, sizeof(uint32_t) * tile_pixels);
+        md_free(md_heap_allocator, accum,  sizeof(uint32_t) * tile_pixels * 4);
+        md_free(md_heap_allocator, band,   sizeof(uint32_t) * width * tile);
+    };
+
+    bool ok = true;
+    // Bands from the top of the image, y is in pixels from the bottom as in GL
+    for (int y1 = height; y1 > 0 && ok; y1 -= tile) {
+        const int y0 = MAX(0, y1 - tile);
+        const int th = y1 - y0;
+        for (int x0 = 0; x0 < width; x0 += tile) {
+            const int tw = MIN(tile, width - x0);
+            MEMSET(accum, 0, sizeof(uint32_t) * tw * th * 4);
+            for (int s = 0; s < num_samples; ++s) {
+                const vec2_t j = num_samples > 1 ? data->view.jitter.sequence[s] - 0.5f : vec2_t{0, 0};
+                // Maps the padded tile onto the viewport, the scale is the size of the image in tiles and the center is that of the tile in NDC of the image
+                const float sx = (float)width  / size;
+                const float sy = (float)height / size;
+                const float cx = 2.0f * (x0 - pad + size * 0.5f + j.x) / width  - 1.0f;
+                const float cy = 2.0f * (y0 - pad + size * 0.5f + j.y) / height - 1.0f;
+                mat4_t S = mat4_ident();
+                S.elem[0][0] = sx;
+                S.elem[1][1] = sy;
+                S.elem[3][0] = -sx * cx;
+                S.elem[3][1] = -sy * cy;
+
+                ViewParam& param = data->view.param;
+                param = view_param;
+                param.matrix.current.proj = S * proj;
+                param.matrix.current.proj_jittered = param.matrix.current.proj;
+                param.matrix.inverse.proj = mat4_inverse(param.matrix.current.proj);
+                param.matrix.inverse.proj_jittered = param.matrix.inverse.proj;
+                param.matrix.previous = param.matrix.current;
+                param.jitter = {};
+                param.resolution = {(float)size, (float)size};
+
+                clear_gbuffer(&gbuf);
+                fill_gbuffer(data, &gbuf);
+                immediate::render();
+
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf.composite.fbo);
+                glDrawBuffer(GL_COLOR_ATTACHMENT0);
+                glViewport(0, 0, size, size);
+                postprocessing::shade_and_postprocess(desc, param);
+
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuf.composite.fbo);
+                glReadBuffer(GL_COLOR_ATTACHMENT0);
+                glReadPixels(pad, pad, tw, th, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                for (size_t i = 0; i < (size_t)tw * th; ++i) {
+                    const uint32_t p = pixels[i];
+                    accum[i * 4 + 0] += (p >>  0) & 0xFF;
+                    accum[i * 4 + 1] += (p >>  8) & 0xFF;
+                    accum[i * 4 + 2] += (p >> 16) & 0xFF;
+                }
+            }
+
+            // The rows are read back from the bottom, the band is from the top
+            const uint32_t n = (uint32_t)num_samples;
+            for (int r = 0; r < th; ++r) {
+                const uint32_t* src = accum + (size_t)(th - 1 - r) * tw * 4;
+                uint32_t* dst = band + (size_t)r * width + x0;
+                for (int i = 0; i < tw; ++i) {
+                    const uint32_t cr = (src[i * 4 + 0] + n / 2) / n;
+                    const uint32_t cg = (src[i * 4 + 1] + n / 2) / n;
+                    const uint32_t cb = (src[i * 4 + 2] + n / 2) / n;
+                    dst[i] = cr | (cg << 8) | (cb << 16) | 0xFF000000U;
+                }
+            }
+        }
+        ok = image_png_stream_write_rows(&stream, band, th);
+    }
+    ok &= image_png_stream_end(&stream);
+
+    data->view.param = view_param;
+    data->representation.culling.active = culling_active;
+    destroy_gbuffer(&gbuf);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    // The targets of the postprocessing have grown to the tile and hold no history of the view
+    postprocessing::initialize(data->gbuffer.width, data->gbuffer.height);
+    data->render.dirty = true;
+
+    if (ok) {
+        LOG_SUCCESS("High resolution image saved to: '%.*s'", (int)path.len, path.ptr);
+    } else {
+        LOG_ERROR("Failed to write high resolution image to '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
+
+#if defined(_WIN32)
+#define popen _popen
+#define pclose _pclose
+#define PIPE_WRITE_MODE "wb"
+#else
+#define PIPE_WRITE_MODE "w"
+#endif
+
+// Starts the export of the frames [beg_frame, end_frame] in steps of frame_step
+// Image sequences are written as path with the index of the frame appended to its name, piped frames are encoded into path by the encoder
+static bool start_movie_export(ApplicationData* data, str_t path) {
+    ASSERT(data);
+    auto& m = data->movie;
+    if (m.active) return false;
+
+    const int64_t num_frames = (int64_t)md_trajectory_num_frames(data->mold.traj);
+    if (num_frames == 0) {
+        LOG_ERROR("No trajectory loaded to export a movie from");
+        return false;
+    }
+    if (m.frame_step <= 0.0) {
+        LOG_ERROR("The frame step of the movie export has to be positive");
+        return false;
+    }
+
+    const double last_frame = (double)(num_frames - 1);
+    m.beg_frame = CLAMP(m.beg_frame, 0.0, last_frame);
+    m.end_frame = CLAMP(m.end_frame, m.beg_frame, last_frame);
+    m.count = (int64_t)((m.end_frame - m.beg_frame) / m.frame_step) + 1;
+
+    if (m.output == MovieOutput::ImageSequence) {
+        str_t ext = {};
+        extract_ext(&ext, path);
+        if (!str_eq_cstr_ignore_case(ext, "jpg") && !str_eq_cstr_ignore_case(ext, "png") && !str_eq_cstr_ignore_case(ext, "bmp")) {
+            LOG_ERROR("Non supported file-extension '%.*s' when exporting image sequence", (int)ext.len, ext.ptr);
+            return false;
+        }
+    } else {
+        char cmd[2048];
+        snprintf(cmd, sizeof(cmd), "%s -loglevel error -y -f rawvideo -pix_fmt rgba -s %dx%d -r %g -i - %s \"%.*s\"",
+            m.encoder, data->gbuffer.width, data->gbuffer.height, m.fps, m.encoder_args, (int)path.len, path.ptr);
+#if !defined(_WIN32)
+        // An encoder which exits early would otherwise terminate the application on the next write
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        m.pipe = popen(cmd, PIPE_WRITE_MODE);
+        if (!m.pipe) {
+            LOG_ERROR("Failed to launch encoder: '%s'", cmd);
+            return false;
+        }
+    }
+
+    m.active = true;
+    m.capture = false;
+    m.failed = false;
+    m.cancel = false;
+    m.next = 0;
+    m.next_encode = 0;
+    m.written = 0;
+    m.width  = data->gbuffer.width;
+    m.height = data->gbuffer.height;
+    m.path = str_copy(path, persistent_allocator);
+    m.last_task = 0;
+    m.mode  = data->animation.mode;
+    m.frame = data->animation.frame;
+
+    LOG_INFO("Exporting %lld frames of %i x %i to '%.*s'", (long long)m.count, m.width, m.height, (int)path.len, path.ptr);
+    return true;
+}
+
+// Steps the animation to the next frame of the movie, called before the animation is evaluated
+// The keyframes are loaded and interpolated synchronously when the frame changes, so the frame rendered after this holds the state of the stepped time
+static void step_movie_export(ApplicationData* data) {
+    ASSERT(data);
+    auto& m = data->movie;
+    if (!m.active || m.capture) return;
+
+    if (m.failed || m.cancel || m.next == m.count) {
+        finish_movie_export(data);
+        return;
+    }
+
+    const double last_frame = (double)MAX(0LL, (int64_t)md_trajectory_num_frames(data->mold.traj) - 1);
+    data->animation.mode  = PlaybackMode::Stopped;
+    data->animation.frame = CLAMP(m.beg_frame + (double)m.next * m.frame_step, 0.0, last_frame);
+    data->render.dirty = true;
+    m.capture = true;
+}
+
+// Reads back the composite of the frame which has been rendered for the current step, called after the scene has been postprocessed
+static void capture_movie_frame(ApplicationData* data) {
+    ASSERT(data);
+    auto& m = data->movie;
+    if (!m.active || !m.capture) return;
+    m.capture = false;
+
+    if (data->gbuffer.width != m.width || data->gbuffer.height != m.height) {
+        LOG_ERROR("The viewport was resized during the movie export");
+        m.failed = true;
+        return;
+    }
+
+    MovieCapture* cap = 0;
+    for (int pass = 0; pass < 3 && !cap; ++pass) {
+        // If all frames are in flight, the ones which are done are completed first and otherwise all are waited for
+        if (pass > 0) update_movie_captures(data, pass == 2);
+        for (MovieCapture& c : m.captures) {
+            if (!c.fence && !c.task) {
+                cap = &c;
+                break;
+            }
+        }
+    }
+    ASSERT(cap);
+
+    const size_t size = (size_t)m.width * m.height * sizeof(uint32_t);
+    cap->width  = m.width;
+    cap->height = m.height;
+    cap->pipe   = m.pipe;
+    cap->index  = m.next++;
+
+    if (m.output == MovieOutput::ImageSequence) {
+        str_t ext = {};
+        extract_ext(&ext, m.path);
+        const int base_len = (int)(m.path.len - ext.len - 1);
+        char buf[1024];
+        int len = snprintf(buf, sizeof(buf), "%.*s_%05lld.%.*s", base_len, m.path.ptr, (long long)cap->index, (int)ext.len, ext.ptr);
+        cap->path = str_copy({buf, (size_t)CLAMP(len, 0, (int)sizeof(buf) - 1)}, persistent_allocator);
+    }
+
+    if (!cap->pbo) glGenBuffers(1, &cap->pbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, data->gbuffer.composite.fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, cap->pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    glReadPixels(0, 0, cap->width, cap->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    cap->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void encode_movie_frame(void* user_data) {
+    MovieCapture* cap = (MovieCapture*)user_data;
+    image_t& img = cap->img;
+
+    // @NOTE: Copy the rows in reverse order to flip image with respect to y-axis
+    const size_t row_byte_size = img.width * sizeof(uint32_t);
+    for (int32_t i = 0; i < img.height; ++i) {
+        MEMCPY(img.data + (size_t)i * img.width, cap->mapped + (size_t)(img.height - 1 - i) * img.width, row_byte_size);
+    }
+
+    str_t ext = {};
+    extract_ext(&ext, cap->path);
+    if (str_eq_cstr_ignore_case(ext, "jpg")) {
+        const int quality = 95;
+        cap->written = image_write_jpg(&img, cap->path, quality);
+    } else if (str_eq_cstr_ignore_case(ext, "png")) {
+        cap->written = image_write_png(&img, cap->path);
+    } else {
+        cap->written = image_write_bmp(&img, cap->path);
+    }
+    cap->done.store(true, std::memory_order_release);
+}
+
+// The rows are written from the top directly from the mapped buffer, the task of each frame depends on that of the previous frame
+static void pipe_movie_frame(void* user_data) {
+    MovieCapture* cap = (MovieCapture*)user_data;
+    bool ok = true;
+    for (int32_t i = cap->height - 1; i >= 0 && ok; --i) {
+        ok = fwrite(cap->mapped + (size_t)i * cap->width, sizeof(uint32_t), cap->width, cap->pipe) == (size_t)cap->width;
+    }
+    cap->written = ok;
+    cap->done.store(true, std::memory_order_release);
+}
+
+// Maps the frames which have been read back and hands them to the pool in the order of the movie, and completes the frames which have been written
+// If wait is set, all frames in flight are completed
+static void update_movie_captures(ApplicationData* data, bool wait) {
+    ASSERT(data);
+    auto& m = data->movie;
+
+    // Visit the frames in order, so that a frame is never handed to the pool before the ones preceding it
+    MovieCapture* caps[MOVIE_EXPORT_IN_FLIGHT];
+    for (int i = 0; i < MOVIE_EXPORT_IN_FLIGHT; ++i) {
+        caps[i] = &m.captures[i];
+        for (int j = i; j > 0 && caps[j]->index < caps[j - 1]->index; --j) {
+            MovieCapture* tmp = caps[j];
+            caps[j] = caps[j - 1];
+            caps[j - 1] = tmp;
+        }
+    }
+
+    for (MovieCapture* c : caps) {
+        MovieCapture& cap = *c;
+        if (cap.fence && cap.index == m.next_encode) {
+            const GLenum res = glClientWaitSync((GLsync)cap.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? UINT64_MAX : 0);
+            if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) continue;
+            glDeleteSync((GLsync)cap.fence);
+            cap.fence = 0;
+            m.next_encode += 1;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, cap.pbo);
+            cap.mapped = (const uint32_t*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if (!cap.mapped) {
+                LOG_ERROR("Failed to read back frame %lld of the movie", (long long)cap.index);
+                m.failed = true;
+                str_free(cap.path, persistent_allocator);
+                cap.path = {};
+                cap.index = -1;
+                continue;
+            }
+            cap.written = false;
+            if (m.output == MovieOutput::ImageSequence) {
+                image_init(&cap.img, cap.width, cap.height, md_heap_allocator);
+                cap.task = task_system::pool_enqueue(STR("Encode Movie Frame"), encode_movie_frame, &cap);
+            } else {
+                cap.task = task_system::pool_enqueue(STR("Pipe Movie Frame"), pipe_movie_frame, &cap, m.last_task);
+                m.last_task = cap.task;
+            }
+            // Launched now, a task which has not been piped yet reads as completed
+            // The pipe task of a later frame is launched by the scheduler once the previous frame has been written
+            task_system::execute_task(cap.task);
+            cap.done = false;
+        }
+
+        if (cap.task) {
+            if (wait) {
+                task_system::task_wait_for(cap.task);
+            }
+            // The slot is only released once the task has run, a pipe task waiting for the previous frame has not
+            if (!cap.done.load(std::memory_order_acquire)) {
+                if (!wait) continue;
+                // The previous frame has been completed before, so the task has been launched
+                while (!cap.done.load(std::memory_order_acquire)) {
+                    task_system::task_wait_for(cap.task);
+                }
+            }
+            cap.task = 0;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, cap.pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            cap.mapped = 0;
+            image_free(&cap.img, md_heap_allocator);
+
+            if (cap.written) {
+                m.written += 1;
+            } else if (!m.failed) {
+                LOG_ERROR("Failed to write frame %lld of the movie", (long long)cap.index);
+                m.failed = true;
+            }
+            str_free(cap.path, persistent_allocator);
+            cap.path = {};
+            cap.index = -1;
+        }
+    }
+}
+
+// Completes the frames in flight, closes the encoder and restores the animation
+static void finish_movie_export(ApplicationData* data) {
+    ASSERT(data);
+    auto& m = data->movie;
+    if (!m.active) return;
+
+    update_movie_captures(data, true);
+
+    if (m.pipe) {
+        if (pclose(m.pipe) != 0 && !m.cancel) {
+            LOG_ERROR("The encoder exited with an error");
+            m.failed = true;
+        }
+        m.pipe = 0;
+    }
+
+    if (m.cancel) {
+        LOG_INFO("Movie export cancelled after %lld frames", (long long)m.written);
+    } else if (m.failed) {
+        LOG_ERROR("Failed to export movie to '%.*s'", (int)m.path.len, m.path.ptr);
+    } else {
+        LOG_SUCCESS("Movie of %lld frames exported to: '%.*s'", (long long)m.written, (int)m.path.len, m.path.ptr);
+    }
+
+    data->animation.mode  = m.mode;
+    data->animation.frame = m.frame;
+    str_free(m.path, persistent_allocator);
+    m.path = {};
+    m.active = false;
+    m.capture = false;
+    m.last_task = 0;
+}
+
+static void free_movie_captures(ApplicationData* data) {
+    ASSERT(data);
+    data->movie.cancel = true;
+    finish_movie_export(data);
+    // The rest of the captures has been reset by finish_movie_export
+    for (MovieCapture& cap : data->movie.captures) {
+        if (cap.pbo) glDeleteBuffers(1, &cap.pbo);
+        cap.pbo = 0;
+    }
+}
+
+// #offscreen
+// viamd --offscreen <workspace.via | files> [--size <w>x<h>] [--device <n>] (--movie <file> [--frames <beg>:<end>] [--step <frames>] | --screenshot <file>)
+// Renders without a window, e.g. on the GPU nodes of a cluster (see VIAMD_HEADLESS_EGL), and closes once the export is done.
+// The scene is set up by the workspace, the movie is encoded as an image sequence for .jpg, .png and .bmp and with the encoder otherwise.
+
+// Frames rendered after the files have been loaded before the export starts, so deferred representations and filters are in place
+#define OFFSCREEN_MIN_LOADED_FRAMES 4
+
+// Number of values which follow a flag of the offscreen rendering, -1 if arg is not one of them
+static int offscreen_arg_values(const char* arg) {
+    if (strcmp(arg, "--offscreen") == 0) return 0;
+    if (strcmp(arg, "--size") == 0 || strcmp(arg, "--device") == 0 || strcmp(arg, "--movie") == 0 ||
+        strcmp(arg, "--screenshot") == 0 || strcmp(arg, "--frames") == 0 || strcmp(arg, "--step") == 0) return 1;
+    return -1;
+}
+
+static bool parse_offscreen_args(ApplicationData* data, int argc, char** argv) {
+    ASSERT(data);
+    auto& o = data->offscreen;
+    bool any = false;
+    for (int i = 1; i < argc; ++i) {
+        const int num_values = offscreen_arg_values(argv[i]);
+        if (num_values < 0) continue;
+        any = true;
+        if (i + num_values >= argc) {
+            LOG_ERROR("Missing value of '%s'", argv[i]);
+            return false;
+        }
+        const char* arg = argv[i];
+        const char* val = num_values ? argv[++i] : "";
+        if (strcmp(arg, "--offscreen") == 0) {
+            o.active = true;
+        } else if (strcmp(arg, "--size") == 0) {
+            if (sscanf(val, "%dx%d", &o.width, &o.height) != 2 || o.width <= 0 || o.height <= 0) {
+                LOG_ERROR("Invalid size '%s', expected <width>x<height>", val);
+                return false;
+            }
+        } else if (strcmp(arg, "--device") == 0) {
+            o.device = MAX(0, atoi(val));
+        } else if (strcmp(arg, "--movie") == 0) {
+            o.movie_path = str_from_cstr(val);
+        } else if (strcmp(arg, "--screenshot") == 0) {
+            o.screenshot_path = str_from_cstr(val);
+        } else if (strcmp(arg, "--frames") == 0) {
+            if (sscanf(val, "%lf:%lf", &o.beg_frame, &o.end_frame) != 2 || o.beg_frame > o.end_frame) {
+                LOG_ERROR("Invalid frame range '%s', expected <beg>:<end>", val);
+                return false;
+            }
+            o.frame_range = true;
+        } else if (strcmp(arg, "--step") == 0) {
+            o.frame_step = atof(val);
+        }
+    }
+    if (!any) return true;
+
+    if (!o.active) {
+        LOG_ERROR("The export flags are only used with --offscreen");
+        return false;
+    }
+    if (str_empty(o.movie_path) == str_empty(o.screenshot_path)) {
+        printf("Usage: viamd --offscreen <workspace." STR_FMT " | files> [--size <w>x<h>] [--device <n>] (--movie <file> [--frames <beg>:<end>] [--step <frames>] | --screenshot <file>)\n", STR_ARG(WORKSPACE_FILE_EXTENSION));
+        return false;
+    }
+    return true;
+}
+
+// Starts the export once the files are loaded and the image has settled, and closes the application when it is done
+static void step_offscreen(ApplicationData* data) {
+    ASSERT(data);
+    auto& o = data->offscreen;
+    if (!o.active) return;
+
+    if (!o.started) {
+        if (data->load_dataset.show_window) {
+            LOG_ERROR("A file of the command line requires the load dialog, which is not available offscreen");
+            o.result = -1;
+            data->ctx.window.should_close = true;
+            return;
+        }
+        if (!file_queue_empty(&data->file_queue) || data->async_load.active) return;
+        // The image is rendered at the size of the context
+        data->dynamic_resolution.enabled = false;
+        if (++o.loaded_frames < OFFSCREEN_MIN_LOADED_FRAMES || data->render.settle_frames > 0) return;
+        o.started = true;
+
+        bool ok = true;
+        if (!str_empty(o.movie_path)) {
+            auto& m = data->movie;
+            str_t ext = {};
+            extract_ext(&ext, o.movie_path);
+            const bool images = str_eq_cstr_ignore_case(ext, "jpg") || str_eq_cstr_ignore_case(ext, "png") || str_eq_cstr_ignore_case(ext, "bmp");
+            m.output = images ? MovieOutput::ImageSequence : MovieOutput::Pipe;
+            m.frame_step = o.frame_step;
+            m.beg_frame = o.frame_range ? o.beg_frame : 0.0;
+            m.end_frame = o.frame_range ? o.end_frame : (double)MAX(0LL, (int64_t)md_trajectory_num_frames(data->mold.traj) - 1);
+            ok = start_movie_export(data, o.movie_path);
+        } else {
+            data->screenshot.hide_gui = true;
+            data->screenshot.path_to_file = str_copy(o.screenshot_path, persistent_allocator);
+        }
+        if (!ok) {
+            o.result = -1;
+            data->ctx.window.should_close = true;
+        }
+        return;
+    }
+
+    if (!str_empty(o.movie_path)) {
+        if (data->movie.active) return;
+        if (data->movie.failed) o.result = -1;
+    } else {
+        if (!str_empty(data->screenshot.path_to_file)) return;
+        update_screenshot_captures(data, true);
+    }
+    data->ctx.window.should_close = true;
+}
+
+#if VIAMD_BENCH
+static void apply_bench_event(ApplicationData* data, const bench::Event& e) {
+    ASSERT(data);
+    switch (e.type) {
+    case bench::Event_Show:
+    case bench::Event_Hide:
+    case bench::Event_Toggle: {
+        if (e.rep < 0 || e.rep >= (int32_t)md_array_size(data->representation.reps)) {
+            LOG_ERROR("Bench: Representation %i does not exist", e.rep);
+            break;
+        }
+        Representation& rep = data->representation.reps[e.rep];
+        rep.enabled = e.type == bench::Event_Show ? true : e.type == bench::Event_Hide ? false : !rep.enabled;
+        if (rep.enabled && rep.deferred) {
+            update_representation(data, &rep);
+        }
+        data->representation.atom_visibility_mask_dirty = true;
+        break;
+    }
+    case bench::Event_Select: {
+        md_bitfield_t mask = {0};
+        md_bitfield_init(&mask, frame_allocator);
+        char err[256];
+        if (filter_expression(data, str_from_cstr(e.query), &mask, NULL, err, sizeof(err))) {
+            modify_selection(data, &mask);
+        } else {
+            LOG_ERROR("Bench: Invalid selection '%s': %s", e.query, err);
+        }
+        break;
+    }
+    case bench::Event_Deselect:
+        md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_selection_mask));
+        data->mold.dirty_buffers |= MolBit_DirtyFlags;
+        break;
+    default:
+        // Camera and time keys are interpolated every frame
+        break;
+    }
+}
+
+// Applies the session to the frame, called after the camera interaction and before the view parameters are updated
+// The replay starts once the files given on the command line have been loaded
+static void step_bench(ApplicationData* data) {
     ASSERT(data);
-    str_t path = data->screenshot.path_to_file;
+    auto& b = data->bench;
+    if (!b.active) return;
+
+    if (!b.started) {
+        if (!file_queue_empty(&data->file_queue) || data->async_load.active) return;
+        b.started = true;
+        // The frame which starts the replay is the first frame of the warmup
+        b.frame = -(int64_t)b.session.warmup - 1;
+        data->ctx.window.vsync = false;
+        // The resolution is fixed, as the frames would not be comparable otherwise
+        data->dynamic_resolution.enabled = false;
+        data->animation.mode = PlaybackMode::Stopped;
+        LOG_INFO("Bench: Replaying %u frames after %u frames of warmup", b.session.num_frames, b.session.warmup);
+    }
 
-    image_t img = {0};
-    image_init(&img, data->gbuffer.width, data->gbuffer.height, frame_allocator);
-    defer { image_free(&img, frame_allocator); };
+    // The events of the first frame are applied before the warmup
+    const int64_t frame = MAX(0, b.frame);
+    while (b.next_event < md_array_size(b.session.events) && b.session.events[b.next_event].frame <= frame) {
+        apply_bench_event(data, b.session.events[b.next_event++]);
+    }
 
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-    glReadBuffer(GL_BACK);
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-    glReadPixels(0, 0, img.width, img.height, GL_RGBA, GL_UNSIGNED_BYTE, img.data);
+    vec3_t pos;
+    quat_t ori;
+    float dist;
+    if (bench::camera_at(&b.session, (double)frame, &pos, &ori, &dist)) {
+        data->view.camera.position = data->view.animation.target_position = pos;
+        data->view.camera.orientation = data->view.animation.target_orientation = ori;
+        data->view.camera.focus_distance = data->view.animation.target_distance = dist;
+    }
 
-    {
-        // @NOTE: Swap Rows to flip image with respect to y-axis
-        const uint32_t row_byte_size = img.width * sizeof(uint32_t);
-        uint32_t* row_t = (uint32_t*)md_alloc(frame_allocator, row_byte_size);
-        defer { md_free(frame_allocator, row_t, row_byte_size); };
-        for (uint32_t i = 0; i < (uint32_t)img.height / 2; ++i) {
-            uint32_t* row_a = img.data + i * img.width;
-            uint32_t* row_b = img.data + (img.height - 1 - i) * img.width;
-            if (row_a != row_b) {
-                MEMCPY(row_t, row_a, row_byte_size);  // tmp = a;
-                MEMCPY(row_a, row_b, row_byte_size);  // a = b;
-                MEMCPY(row_b, row_t, row_byte_size);  // b = tmp;
-            }
-        }
+    double time;
+    if (bench::time_at(&b.session, (double)frame, &time)) {
+        const double max_frame = (double)MAX(0LL, (int64_t)md_trajectory_num_frames(data->mold.traj) - 1);
+        data->animation.mode  = PlaybackMode::Stopped;
+        data->animation.frame = CLAMP(time, 0.0, max_frame);
     }
 
-    str_t ext = {};
-    extract_ext(&ext, path);
+    // Every frame is rendered, the scene would otherwise only be rendered when it changes
+    data->render.dirty = true;
+}
 
-    if (str_eq_cstr_ignore_case(ext, "jpg")) {
-        const int quality = 95;
-        image_write_jpg(&img, path, quality);
-    } else if (str_eq_cstr_ignore_case(ext, "png")) {
-        image_write_png(&img, path);
-    } else if (str_eq_cstr_ignore_case(ext, "bmp")) {
-        image_write_bmp(&img, path);
-    } else {
-        LOG_ERROR("Non supported file-extension '%.*s' when saving screenshot", (int)ext.len, ext.ptr);
-        return;
-    }
+// Called after the buffers have been swapped, writes the results and closes the window after the last frame of the session
+static void end_bench_frame(ApplicationData* data) {
+    ASSERT(data);
+    auto& b = data->bench;
+    if (!b.active || !b.started) return;
 
-    LOG_SUCCESS("Screenshot saved to: '%.*s'", (int)path.len, path.ptr);
+    if (bench::recording()) {
+        bench::end_frame();
+    }
+    b.frame += 1;
+    if (b.frame == 0) {
+        bench::begin_recording();
+    }
+    if (b.frame < (int64_t)b.session.num_frames) return;
+
+    bench::Info info = {};
+    info.session  = b.session_path;
+    info.renderer = (const char*)glGetString(GL_RENDERER);
+    info.vendor   = (const char*)glGetString(GL_VENDOR);
+    info.version  = (const char*)glGetString(GL_VERSION);
+#if defined(NDEBUG)
+    info.build    = "Release " __DATE__;
+#else
+    info.build    = "Debug " __DATE__;
+#endif
+    info.width    = data->gbuffer.width;
+    info.height   = data->gbuffer.height;
+    info.num_atoms = data->mold.mol.atom.count;
+    info.num_traj_frames = md_trajectory_num_frames(data->mold.traj);
+    bench::write_json(b.out_path, info);
+
+    bench::free_session(&b.session, persistent_allocator);
+    b.active = false;
+    data->ctx.window.should_close = true;
 }
+#endif
 
 // #representation
 static Representation* create_representation(ApplicationData* data, RepresentationType type, ColorMapping color_mapping, str_t filter) {
@@ -9550,6 +17117,12 @@ static Representation* clone_representation(ApplicationData* data, const Represe
     Representation* clone = md_array_push(data->representation.reps, rep, persistent_allocator);
     clone->md_rep = {0};
     clone->atom_mask = {0};
+    clone->sdf = nullptr;
+    clone->subset = nullptr;
+    clone->filter = nullptr;
+    clone->filter_cache = nullptr;
+    clone->uploaded_colors = nullptr;
+    clone->color_key = 0;
     init_representation(data, clone);
     update_representation(data, clone);
     return clone;
@@ -9560,7 +17133,25 @@ static void remove_representation(ApplicationData* data, int idx) {
     ASSERT(idx < md_array_size(data->representation.reps));
     auto& rep = data->representation.reps[idx];
     md_bitfield_free(&rep.atom_mask);
-    md_gl_representation_free(&rep.md_rep);
+    if (!rep.subset) {
+        md_gl_representation_free(&rep.md_rep);
+    }
+    if (rep.lod_rep_valid) {
+        md_gl_representation_free(&rep.lod_rep);
+    }
+    free_representation_sdf(&rep);
+    free_representation_subset(data, &rep, false);
+    if (rep.filter) {
+        free_async_filter(rep.filter);
+        md_free(persistent_allocator, rep.filter, sizeof(AsyncFilter));
+        rep.filter = nullptr;
+    }
+    if (rep.filter_cache) {
+        free_dynamic_filter_cache(rep.filter_cache);
+        md_free(persistent_allocator, rep.filter_cache, sizeof(DynamicFilterCache));
+        rep.filter_cache = nullptr;
+    }
+    md_array_free(rep.uploaded_colors, memory_tracker_allocator(MemoryTracker_Representations));
     data->representation.reps[idx] = *md_array_last(data->representation.reps);
     md_array_pop(data->representation.reps);
 }
@@ -9578,23 +17169,285 @@ static void recompute_atom_visibility_mask(ApplicationData* data) {
     }
 
     data->mold.dirty_buffers |= MolBit_DirtyFlags;
+    data->cpu_picking.epoch += 1;
 }
 
+// Deferred representations are left to update_deferred_representations
 static void update_all_representations(ApplicationData* data) {
     for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
         auto& rep = data->representation.reps[i];
         rep.filt_is_dirty = true;
+        if (rep.deferred) continue;
         update_representation(data, &rep);
     }
 }
 
-static void update_representation(ApplicationData* data, Representation* rep) {
+// Updates the deferred representations which are shown
+// Their filters are requested together and are launched alongside each other on the pool by the next execute_queued_tasks, the colors are
+// uploaded by update_representation_filters as the masks complete. Hidden representations stay deferred until they are shown
+static void update_deferred_representations(ApplicationData* data) {
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        auto& rep = data->representation.reps[i];
+        if (rep.deferred && rep.enabled) {
+            update_representation(data, &rep);
+        }
+    }
+    data->representation.atom_visibility_mask_dirty = true;
+}
+
+#define COLOR_UPLOAD_BLOCK 256
+#define COLOR_UPLOAD_MERGE_GAP 4096
+
+// Only the ranges which differ from the colors uploaded last are uploaded, which is what changes when a mask is swapped in during playback
+static void upload_representation_colors(Representation* rep, const uint32_t* colors, size_t count) {
+    uint32_t* prev = rep->uploaded_colors;
+    if (md_array_size(prev) != count) {
+        md_array_resize(rep->uploaded_colors, count, memory_tracker_allocator(MemoryTracker_Representations));
+        MEMCPY(rep->uploaded_colors, colors, count * sizeof(uint32_t));
+        md_gl_representation_set_color(&rep->md_rep, 0, (uint32_t)count, colors, 0);
+        return;
+    }
+    size_t range_beg = SIZE_MAX;
+    size_t range_end = 0;
+    for (size_t beg = 0; beg < count; beg += COLOR_UPLOAD_BLOCK) {
+        const size_t end = MIN(beg + COLOR_UPLOAD_BLOCK, count);
+        if (memcmp(prev + beg, colors + beg, (end - beg) * sizeof(uint32_t)) == 0) continue;
+        if (range_beg != SIZE_MAX && beg - range_end > COLOR_UPLOAD_MERGE_GAP) {
+            md_gl_representation_set_color(&rep->md_rep, (uint32_t)range_beg, (uint32_t)(range_end - range_beg), colors + range_beg, 0);
+            MEMCPY(prev + range_beg, colors + range_beg, (range_end - range_beg) * sizeof(uint32_t));
+            range_beg = SIZE_MAX;
+        }
+        if (range_beg == SIZE_MAX) range_beg = beg;
+        range_end = end;
+    }
+    if (range_beg != SIZE_MAX) {
+        md_gl_representation_set_color(&rep->md_rep, (uint32_t)range_beg, (uint32_t)(range_end - range_beg), colors + range_beg, 0);
+        MEMCPY(prev + range_beg, colors + range_beg, (range_end - range_beg) * sizeof(uint32_t));
+    }
+}
+
+#define COLOR_ATOM_CHUNK (64 * 1024)
+
+// Colors of a mapping or the filtering of colors by a mask, computed in chunks of atoms on the pool
+struct ColorJob {
+    uint32_t* colors = nullptr;
+    size_t count = 0;
+    const md_molecule_t* mol = nullptr;
+    ColorMapping mapping = ColorMapping::Uniform;
+    vec4_t uniform_color = {};
+    const md_bitfield_t* mask = nullptr;    // If set, the colors are filtered by the mask instead
+};
+
+static void color_chunks(uint32_t chunk_beg, uint32_t chunk_end, void* user_data) {
+    const ColorJob* job = (const ColorJob*)user_data;
+    const md_molecule_t& mol = *job->mol;
+    for (uint32_t chunk = chunk_beg; chunk < chunk_end; ++chunk) {
+        const size_t beg = (size_t)chunk * COLOR_ATOM_CHUNK;
+        const md_range_t range = {(int)beg, (int)MIN(beg + COLOR_ATOM_CHUNK, job->count)};
+        if (job->mask) {
+            filter_colors(job->colors, range, job->mask);
+            continue;
+        }
+        switch (job->mapping) {
+        case ColorMapping::Uniform:            color_atoms_uniform(job->colors, range, job->uniform_color); break;
+        case ColorMapping::Cpk:                color_atoms_cpk(job->colors, range, mol); break;
+        case ColorMapping::AtomLabel:          color_atoms_type(job->colors, range, mol); break;
+        case ColorMapping::AtomIndex:          color_atoms_idx(job->colors, range, mol); break;
+        case ColorMapping::ResName:            color_atoms_res_name(job->colors, range, mol); break;
+        case ColorMapping::ResId:              color_atoms_res_id(job->colors, range, mol); break;
+        case ColorMapping::ChainId:            color_atoms_chain_id(job->colors, range, mol); break;
+        case ColorMapping::ChainIndex:         color_atoms_chain_idx(job->colors, range, mol); break;
+        case ColorMapping::SecondaryStructure: color_atoms_sec_str(job->colors, range, mol); break;
+        default:
+            ASSERT(false);
+            break;
+        }
+    }
+}
+
+static void run_color_job(ColorJob* job) {
+    const uint32_t num_chunks = (uint32_t)DIV_UP_CHUNK(job->count, COLOR_ATOM_CHUNK);
+    if (num_chunks > 1) {
+        // The main thread takes part in the work while waiting
+        task_system::ID id = task_system::pool_enqueue(STR("##Color Atoms"), 0, num_chunks, color_chunks, job);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+    } else {
+        color_chunks(0, num_chunks, job);
+    }
+}
+
+// The colormap is sampled once into the table of the representation, so mapping a value is a lookup
+static const uint32_t* property_color_lut(Representation* rep) {
+    if (rep->prop_lut_map != rep->color_map) {
+        for (int i = 0; i < PROPERTY_COLOR_LUT_SIZE; ++i) {
+            const float t = (float)i / (float)(PROPERTY_COLOR_LUT_SIZE - 1);
+            rep->prop_lut[i] = convert_color(vec_cast(ImPlot::SampleColormap(t, rep->color_map)));
+        }
+        rep->prop_lut_map = rep->color_map;
+    }
+    return rep->prop_lut;
+}
+
+static inline uint16_t property_color_entry(const Representation* rep, float value) {
+    const float ext = rep->map_end - rep->map_beg;
+    const float t = ext != 0.0f ? CLAMP((value - rep->map_beg) / ext, 0.0f, 1.0f) : 0.0f;
+    return (uint16_t)(t * (PROPERTY_COLOR_LUT_SIZE - 1) + 0.5f);
+}
+
+// Colormap entries of the property for the current frame, one per structure of an aggregated property
+// Frames whose values map to the same entries give the same colors, so the colors of a representation only change when an entry does
+struct PropertyColors {
+    md_array(uint16_t) entries = nullptr;
+    const md_script_vis_t* vis = nullptr;   // Structures of an aggregated property, valid until the vis cache is used again
+};
+
+// Returns false if the representation has no property, in which case it gets its uniform color
+// An aggregated property whose structures can not be evaluated gives no entries
+static bool eval_property_colors(ApplicationData* data, const Representation* rep, PropertyColors* pc) {
+    const md_script_property_t* prop = rep->prop;
+    if (!prop) return false;
+
+    const int dim = prop->data.aggregate ? prop->data.dim[0] : 1;
+    const int num_frames = dim > 0 ? (int)prop->data.num_values / dim : 0;
+    if (num_frames <= 0) return true;
+
+    if (prop->data.aggregate) {
+        if (!md_script_ir_valid(data->mold.script.eval_ir)) return true;
+        // The structures are evaluated through the vis cache, which is filled ahead on the pool during playback
+        md_script_vis_ctx_t ctx = {
+            .ir   = data->mold.script.eval_ir,
+            .mol  = &data->mold.mol,
+            .traj = data->mold.traj,
+        };
+        const VisCacheKey key = vis_cache_key(data, data->mold.script.eval_ir, prop->vis_payload, 0, MD_SCRIPT_VISUALIZE_ATOMS);
+        pc->vis = vis_cache_get(&data->mold.script.vis_cache, key, &ctx);
+        if (data->animation.mode == PlaybackMode::Playing && key.frame == (double)(int64_t)key.frame) {
+            const uint32_t frame = (uint32_t)key.frame;
+            vis_cache_prefetch(&data->mold.script.vis_cache, key, frame + 1, frame + 1 + VIS_CACHE_BATCH_FRAMES, &ctx);
+        }
+        if (!pc->vis || dim != (int)md_array_size(pc->vis->structures)) {
+            pc->vis = nullptr;
+            return true;
+        }
+    }
+
+    const float* values = prop->data.values;
+    const int i0 = CLAMP((int)data->animation.frame + 0, 0, num_frames - 1);
+    const int i1 = CLAMP((int)data->animation.frame + 1, 0, num_frames - 1);
+    const float frame_fract = fractf((float)data->animation.frame);
+    for (int i = 0; i < dim; ++i) {
+        const float value = lerpf(values[i0 * dim + i], values[i1 * dim + i], frame_fract);
+        md_array_push(pc->entries, property_color_entry(rep, value), frame_allocator);
+    }
+    return true;
+}
+
+static uint64_t property_color_key(ApplicationData* data, const Representation* rep, uint64_t key) {
+    PropertyColors pc = {};
+    if (!eval_property_colors(data, rep, &pc)) {
+        return script_hash(&rep->uniform_color, sizeof(rep->uniform_color), key);
+    }
+    key = script_hash(&rep->prop, sizeof(rep->prop), key);
+    key = script_hash(&rep->color_map, sizeof(rep->color_map), key);
+    if (pc.entries) {
+        key = script_hash(pc.entries, md_array_bytes(pc.entries), key);
+    }
+    if (pc.vis) {
+        // The structures of a dynamic selection change with the frame
+        for (size_t i = 0; i < md_array_size(pc.vis->structures); ++i) {
+            md_bitfield_iter_t it = md_bitfield_iter_create(&pc.vis->structures[i]);
+            while (md_bitfield_iter_next(&it)) {
+                const uint64_t idx = md_bitfield_iter_idx(&it);
+                key = script_hash(&idx, sizeof(idx), key);
+            }
+            key = script_hash(&i, sizeof(i), key);
+        }
+    }
+    return key;
+}
+
+static void color_atoms_property(ApplicationData* data, Representation* rep, uint32_t* colors, size_t count) {
+    PropertyColors pc = {};
+    if (!eval_property_colors(data, rep, &pc)) {
+        color_atoms_uniform(colors, count, rep->uniform_color);
+        return;
+    }
+    const uint32_t* lut = property_color_lut(rep);
+    const size_t num_entries = md_array_size(pc.entries);
+    if (!pc.vis) {
+        if (num_entries == 1 && !rep->prop->data.aggregate) {
+            color_atoms_uniform(colors, count, convert_color(lut[pc.entries[0]]));
+        } else {
+            MEMSET(colors, 0xFF, count * sizeof(uint32_t));
+        }
+        return;
+    }
+    // The atoms outside of the mask of the representation are hidden by the filter which is applied afterwards
+    MEMSET(colors, 0xFF, count * sizeof(uint32_t));
+    for (size_t i = 0; i < num_entries; ++i) {
+        const uint32_t color = lut[pc.entries[i]];
+        md_bitfield_iter_t it = md_bitfield_iter_create(&pc.vis->structures[i]);
+        while (md_bitfield_iter_next(&it)) {
+            const uint64_t idx = md_bitfield_iter_idx(&it);
+            if (idx < count) colors[idx] = color;
+        }
+    }
+}
+
+// The atoms which are not part of the set get the lowest color of the map
+static void color_atoms_fluctuation(ApplicationData* data, Representation* rep, uint32_t* colors, size_t count) {
+    const float* rmsf = data->fluctuation.ready ? data->fluctuation.rmsf : nullptr;
+    if (!rmsf) {
+        color_atoms_uniform(colors, count, rep->uniform_color);
+        return;
+    }
+    const uint32_t* lut = property_color_lut(rep);
+    for (size_t i = 0; i < count; ++i) {
+        colors[i] = lut[property_color_entry(rep, rmsf[i])];
+    }
+}
+
+// Key of the colors of a mapping before they are filtered, 0 if they are not cached
+// The topology is covered by init_representation, which resets the key when the molecule changes
+static uint64_t representation_color_key(ApplicationData* data, const Representation* rep) {
+    const md_molecule_t& mol = data->mold.mol;
+    const uint64_t count = mol.atom.count;
+    uint64_t key = script_hash(&rep->color_mapping, sizeof(rep->color_mapping));
+    key = script_hash(&count, sizeof(count), key);
+    switch (rep->color_mapping) {
+    case ColorMapping::Uniform:
+        key = script_hash(&rep->uniform_color, sizeof(rep->uniform_color), key);
+        break;
+    case ColorMapping::SecondaryStructure:
+        if (mol.backbone.secondary_structure) {
+            key = script_hash(mol.backbone.secondary_structure, mol.backbone.count * sizeof(md_secondary_structure_t), key);
+        }
+        break;
+    case ColorMapping::Property:
+        key = property_color_key(data, rep, key);
+        break;
+    case ColorMapping::Fluctuation:
+        key = script_hash(&data->fluctuation.fingerprint, sizeof(data->fluctuation.fingerprint), key);
+        key = script_hash(&rep->color_map, sizeof(rep->color_map), key);
+        key = script_hash(&rep->map_beg, sizeof(rep->map_beg), key);
+        key = script_hash(&rep->map_end, sizeof(rep->map_end), key);
+        break;
+    default:
+        break;
+    }
+    return key ? key : 1;
+}
+
+// The filter is evaluated on the pool, and the representation is updated again with the new mask once it completes (see update_representation_filters)
+static void update_representation(ApplicationData* data, Representation* rep, bool evaluate_filter) {
     ASSERT(data);
     ASSERT(rep);
+    data->render.dirty = true;
+    rep->deferred = false;
 
     const size_t bytes = data->mold.mol.atom.count * sizeof(uint32_t);
-    uint32_t* colors = (uint32_t*)md_alloc(frame_allocator, bytes);
-    defer { md_free(frame_allocator, colors, bytes); };
+    uint32_t* colors = (uint32_t*)frame_scratch(FrameScratch_RepColors, bytes);
 
     const auto& mol = data->mold.mol;
 
@@ -9603,128 +17456,449 @@ static void update_representation(ApplicationData* data, Representation* rep) {
         //rep->prop_is_valid = md_script_compile_and_eval_property(&prop, rep->prop, &data->mold.mol, frame_allocator, &data->mold.script.ir, rep->prop_error.beg(), rep->prop_error.capacity());
     //}
 
-    switch (rep->color_mapping) {
-        case ColorMapping::Uniform:
-            color_atoms_uniform(colors, mol.atom.count, rep->uniform_color);
-            break;
-        case ColorMapping::Cpk:
-            color_atoms_cpk(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::AtomLabel:
-            color_atoms_type(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::AtomIndex:
-            color_atoms_idx(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::ResName:
-            color_atoms_res_name(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::ResId:
-            color_atoms_res_id(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::ChainId:
-            color_atoms_chain_id(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::ChainIndex:
-            color_atoms_chain_idx(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::SecondaryStructure:
-            color_atoms_sec_str(colors, mol.atom.count, mol);
-            break;
-        case ColorMapping::Property:
-            // @TODO: Map colors accordingly
-            //color_atoms_uniform(colors, mol.atom.count, rep->uniform_color);
-            if (rep->prop) {
-                MEMSET(colors, 0xFFFFFFFF, bytes);
-                const float* values = rep->prop->data.values;
-                if (rep->prop->data.aggregate) {
-                    const int dim = rep->prop->data.dim[0];
-                    md_script_vis_t vis = {0};
-                    bool result = false;
-                    
-                    //if (md_semaphore_aquire(&data->mold.script.ir_semaphore)) {
-                    //    defer { md_semaphore_release(&data->mold.script.ir_semaphore); };
-                        
-                        if (md_script_ir_valid(data->mold.script.eval_ir)) {
-                            md_script_vis_init(&vis, frame_allocator);
-                            md_script_vis_ctx_t ctx = {
-                                .ir = data->mold.script.eval_ir,
-                                .mol = &data->mold.mol,
-                                .traj = data->mold.traj,
-                            };
-                            result = md_script_vis_eval_payload(&vis, rep->prop->vis_payload, 0, &ctx, MD_SCRIPT_VISUALIZE_ATOMS);
-                        }
-                    //}
-                    if (result) {
-                        if (dim == (int)md_array_size(vis.structures)) {
-                            int i0 = CLAMP((int)data->animation.frame + 0, 0, (int)rep->prop->data.num_values / dim - 1);
-                            int i1 = CLAMP((int)data->animation.frame + 1, 0, (int)rep->prop->data.num_values / dim - 1);
-                            float frame_fract = fractf((float)data->animation.frame);
-
-                            md_bitfield_t mask = {0};
-                            md_bitfield_init(&mask, frame_allocator);
-                            for (int i = 0; i < dim; ++i) {
-                                md_bitfield_and(&mask, &rep->atom_mask, &vis.structures[i]);
-                                float value = lerpf(values[i0 * dim + i], values[i1 * dim + i], frame_fract);
-                                float t = CLAMP((value - rep->map_beg) / (rep->map_end - rep->map_beg), 0, 1);
-                                ImVec4 color = ImPlot::SampleColormap(t, rep->color_map);
-                                color_atoms_uniform(colors, mol.atom.count, vec_cast(color), &mask);
-                            }
-                        }
-                    }
-                } else {
-                    int i0 = CLAMP((int)data->animation.frame + 0, 0, (int)rep->prop->data.num_values - 1);
-                    int i1 = CLAMP((int)data->animation.frame + 1, 0, (int)rep->prop->data.num_values - 1);
-                    float value = lerpf(values[i0], values[i1], fractf((float)data->animation.frame));
-                    float t = CLAMP((value - rep->map_beg) / (rep->map_end - rep->map_beg), 0, 1);
-                    ImVec4 color = ImPlot::SampleColormap(t, rep->color_map);
-                    color_atoms_uniform(colors, mol.atom.count, vec_cast(color));
-                }
-            } else {
-                color_atoms_uniform(colors, mol.atom.count, rep->uniform_color);
+    // The colors of a key are shared by the representations, e.g. several representations with the same uniform color
+    const uint64_t color_key = representation_color_key(data, rep);
+    bool cached = false;
+    if (color_key) {
+        const RepColors* c = lru_cache_acquire(&data->representation.colors, color_key);
+        if (c) {
+            cached = c->count == mol.atom.count;
+            if (cached) MEMCPY(colors, c->colors, bytes);
+            lru_cache_release(&data->representation.colors, color_key);
+        }
+    }
+    rep->color_key = color_key;
+    if (!cached) {
+        switch (rep->color_mapping) {
+            case ColorMapping::Uniform:
+            case ColorMapping::Cpk:
+            case ColorMapping::AtomLabel:
+            case ColorMapping::AtomIndex:
+            case ColorMapping::ResName:
+            case ColorMapping::ResId:
+            case ColorMapping::ChainId:
+            case ColorMapping::ChainIndex:
+            case ColorMapping::SecondaryStructure: {
+                ColorJob job = {};
+                job.colors = colors;
+                job.count = mol.atom.count;
+                job.mol = &mol;
+                job.mapping = rep->color_mapping;
+                job.uniform_color = rep->uniform_color;
+                run_color_job(&job);
+                break;
             }
-            break;
-        default:
-            ASSERT(false);
-            break;
+            case ColorMapping::Property:
+                color_atoms_property(data, rep, colors, mol.atom.count);
+                break;
+            case ColorMapping::Fluctuation:
+                color_atoms_fluctuation(data, rep, colors, mol.atom.count);
+                break;
+            default:
+                ASSERT(false);
+                break;
+        }
+        if (color_key) {
+            md_allocator_i* alloc = memory_tracker_allocator(MemoryTracker_Representations);
+            const RepColors c = {(uint32_t*)md_alloc(alloc, bytes), mol.atom.count};
+            MEMCPY(c.colors, colors, bytes);
+            if (!lru_cache_put(&data->representation.colors, color_key, c, bytes)) {
+                md_free(alloc, c.colors, bytes);
+            }
+        }
+    }
+
+    switch (rep->type) {
+    case RepresentationType::SpaceFill:
+    case RepresentationType::Sdf:
+		rep->type_is_valid = true;
+		break;
+    case RepresentationType::Licorice:
+    case RepresentationType::BallAndStick:
+        rep->type_is_valid = mol.bond.count > 0;
+        break;
+    case RepresentationType::Ribbons:
+    case RepresentationType::Cartoon:
+        rep->type_is_valid = mol.backbone.range_count > 0;
+        break;
+    default:
+        ASSERT(false);
+    }
+
+    if (rep->dynamic_evaluation && evaluate_filter) {
+        rep->filt_is_dirty = true;
+    }
+
+    if (rep->filt_is_dirty && evaluate_filter) {
+        if (!rep->filter) {
+            rep->filter = new (md_alloc(persistent_allocator, sizeof(AsyncFilter))) AsyncFilter();
+        }
+        request_async_filter(data, rep->filter, str_from_cstr(rep->filt));
+        rep->filt_is_dirty = false;
+    }
+
+    if (rep->filt_is_valid) {
+        ColorJob filter_job = {};
+        filter_job.colors = colors;
+        filter_job.count = mol.atom.count;
+        filter_job.mol = &mol;
+        filter_job.mask = &rep->atom_mask;
+        run_color_job(&filter_job);
+        data->representation.atom_visibility_mask_dirty = true;
+        update_representation_subset(data, rep, colors);
+        if (!rep->subset) {
+            upload_representation_colors(rep, colors, mol.atom.count);
+        }
+        update_representation_lod_colors(data, rep, colors);
+        update_representation_sdf(data, rep, colors);
+
+#if EXPERIMENTAL_GFX_API
+        md_gfx_rep_attr_t attributes = {};
+        attributes.spacefill.radius_scale = 1.0f;
+        md_gfx_rep_set_type_and_attr(rep->gfx_rep, MD_GFX_REP_TYPE_SPACEFILL, &attributes);
+        md_gfx_rep_set_color(rep->gfx_rep, 0, (uint32_t)mol.atom.count, (md_gfx_color_t*)colors, 0);
+#endif
+    }
+}
+
+// Swaps in the masks of the filters which have completed and updates their representations
+// If wait is set, the filters in flight are completed first
+static void update_representation_filters(ApplicationData* data, bool wait) {
+    ASSERT(data);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        Representation* rep = &data->representation.reps[i];
+        AsyncFilter* f = rep->filter;
+        if (!f || !poll_async_filter(data, f, wait)) continue;
+        // The cached mask of the current frame is newer than a result which was launched for an earlier frame
+        if (rep->filter_cache && rep->filter_cache->shown == (int64_t)(data->animation.frame + 0.5) && !rep->filt_is_dirty) continue;
+
+        md_bitfield_copy(&rep->atom_mask, &f->mask);
+        rep->filt_is_valid = f->ok;
+        rep->filt_is_dynamic = f->is_dynamic;
+        MEMCPY(rep->filt_error, f->error, sizeof(rep->filt_error));
+        if (rep->filter_cache) rep->filter_cache->shown = -1;
+        update_representation(data, rep, false);
+    }
+}
+
+static inline int64_t dynamic_filter_frame(const ApplicationData* data) {
+    const int64_t num_frames = (int64_t)md_trajectory_num_frames(data->mold.traj);
+    return CLAMP((int64_t)(data->animation.frame + 0.5), 0, num_frames - 1);
+}
+
+static uint64_t dynamic_filter_key(const ApplicationData* data, const Representation* rep) {
+    uint64_t key = script_hash(rep->filt, strnlen(rep->filt, sizeof(rep->filt)));
+    const uint64_t params[4] = {data->mold.script.ir_fingerprint, (uint64_t)(uintptr_t)data->mold.traj, md_trajectory_num_frames(data->mold.traj), data->animation.apply_pbc};
+    return script_hash(params, sizeof(params), key);
+}
+
+static void free_dynamic_filter_frame(DynamicFilterFrame* frame) {
+    if (frame->data) md_free(persistent_allocator, frame->data, frame->cap);
+    *frame = {};
+}
+
+// Drops the masks of all representations, including those of the batches which are in flight
+// The trajectory is part of the key only by its address, which may be reused by the next trajectory
+static void clear_dynamic_filter_masks(ApplicationData* data) {
+    ASSERT(data);
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        DynamicFilterCache* c = data->representation.reps[i].filter_cache;
+        if (!c) continue;
+        if (c->task) {
+            task_system::task_wait_for(c->task);
+            c->task = 0;
+        }
+        for (uint32_t j = 0; j < c->num_batch; ++j) {
+            free_dynamic_filter_frame(&c->results[j]);
+        }
+        c->num_batch = 0;
+        c->key = 0;
+        c->shown = -1;
+    }
+    lru_cache_clear(&data->representation.filter_masks);
+}
+
+static void free_dynamic_filter_cache(DynamicFilterCache* c) {
+    ASSERT(c);
+    if (c->task) {
+        task_system::task_wait_for(c->task);
+        c->task = 0;
+    }
+    for (uint32_t i = 0; i < c->num_batch; ++i) {
+        free_dynamic_filter_frame(&c->results[i]);
+    }
+    if (c->coords) md_free(persistent_allocator, c->coords, c->coord_bytes);
+    *c = {};
+}
+
+static size_t script_eval_memory_usage(const md_script_eval_t* eval) {
+    if (!eval) return 0;
+    size_t bytes = 0;
+    const size_t num_frames = md_script_eval_num_frames_total(eval);
+    const md_script_property_t* props = md_script_eval_properties(eval);
+    for (size_t i = 0; i < md_script_eval_num_properties(eval); ++i) {
+        const md_script_property_t& p = props[i];
+        bytes += p.data.num_values * sizeof(float) * (p.data.weights ? 2 : 1);
+        if (p.data.aggregate) {
+            bytes += num_frames * (sizeof(p.data.aggregate->population_mean[0]) + sizeof(p.data.aggregate->population_var[0]) + sizeof(p.data.aggregate->population_ext[0]));
+        }
+    }
+    return bytes;
+}
+
+// Capacity of the caches of derived data which are kept by key, they are evicted least recently used first, also by the memory budget
+#define CELL_LIST_CACHE_CAPACITY 8
+#define RAMA_CHUNK_CACHE_CAPACITY 4
+
+static void init_derived_caches(ApplicationData* data) {
+    ASSERT(data);
+    lru_cache_init(&data->representation.filter_masks, DYNAMIC_FILTER_CACHE_CAPACITY, DYNAMIC_FILTER_CACHE_BUDGET, persistent_allocator,
+        [](const DynamicFilterKey&, DynamicFilterFrame* mask, void*) { free_dynamic_filter_frame(mask); });
+    lru_cache_init(&data->representation.colors, REP_COLOR_CACHE_CAPACITY, 0, persistent_allocator,
+        [](const uint64_t&, RepColors* c, void*) { md_free(memory_tracker_allocator(MemoryTracker_Representations), c->colors, c->count * sizeof(uint32_t)); });
+    lru_cache_init(&data->mold.cell_list.lists, CELL_LIST_CACHE_CAPACITY, 0, persistent_allocator,
+        [](const uint64_t&, CellList* list, void*) { cell_list_free(list); });
+    lru_cache_init(&data->ramachandran.chunk_caches, RAMA_CHUNK_CACHE_CAPACITY, 0, persistent_allocator,
+        [](const uint64_t&, rama_chunk_cache_t* cache, void*) { rama_chunk_cache_free(cache); });
+}
+
+// The cell lists are freed with free_cell_list
+static void free_derived_caches(ApplicationData* data) {
+    ASSERT(data);
+    lru_cache_free(&data->representation.filter_masks);
+    lru_cache_free(&data->representation.colors);
+    lru_cache_free(&data->ramachandran.chunk_caches);
+    rama_chunk_cache_free(&data->ramachandran.chunk_build);
+    data->ramachandran.chunk_build_key = 0;
+    data->ramachandran.chunk_pinned[0] = data->ramachandran.chunk_pinned[1] = 0;
+}
+
+// Hands the grids of a completed rebuild to the cache and releases the grids of the densities which have completed
+static void update_rama_chunk_caches(ApplicationData* data) {
+    ASSERT(data);
+    auto& rama = data->ramachandran;
+    if (!task_system::task_is_running(data->tasks.ramachandran_compute_full_density)) {
+        if (rama.chunk_build_key) {
+            // An interrupted rebuild is not valid
+            if (!rama.chunk_build.valid || !lru_cache_put(&rama.chunk_caches, rama.chunk_build_key, rama.chunk_build, rama_chunk_cache_bytes(&rama.chunk_build))) {
+                rama_chunk_cache_free(&rama.chunk_build);
+            }
+            rama.chunk_build = {};
+            rama.chunk_build_key = 0;
+        }
+        if (rama.chunk_pinned[0]) {
+            lru_cache_release(&rama.chunk_caches, rama.chunk_pinned[0]);
+            rama.chunk_pinned[0] = 0;
+        }
+    }
+    if (rama.chunk_pinned[1] && !task_system::task_is_running(data->tasks.ramachandran_compute_filt_density)) {
+        lru_cache_release(&rama.chunk_caches, rama.chunk_pinned[1]);
+        rama.chunk_pinned[1] = 0;
+    }
+}
+
+// The frame cache and the caches of derived data are shrunk to stay within the memory limit, the rest is accounted for
+static void register_memory_consumers(ApplicationData* data) {
+    memory_budget_register("Frame Cache", MemoryPriority_Cache,
+        [](void*) { return load::traj::cache_memory_usage(); },
+        [](size_t bytes, void*) { return load::traj::cache_release_memory(bytes); }, data);
+
+    memory_budget_register("Frame Scratch", MemoryPriority_Cache,
+        [](void*) { return frame_scratch_memory_usage(); },
+        [](size_t, void*) { return frame_scratch_release(); }, data);
+
+    lru_cache_register_budget(&data->representation.filter_masks, "Dynamic Filter Masks");
+    lru_cache_register_budget(&data->representation.colors, "Representation Colors");
+    lru_cache_register_budget(&data->mold.cell_list.lists, "Cell Lists");
+    lru_cache_register_budget(&data->mold.script.vis_cache.index, "Visualizations");
+    lru_cache_register_budget(&data->ramachandran.chunk_caches, "Ramachandran Chunks", MemoryPriority_Derived);
+
+    memory_budget_register("Backbone Data", MemoryPriority_Derived,
+        [](void* user_data) {
+            const ApplicationData* data = (const ApplicationData*)user_data;
+            const auto& td = data->trajectory_data;
+            return md_array_bytes(td.secondary_structure.data) + md_array_bytes(td.secondary_structure.packed) + md_array_bytes(td.backbone_angles.data) + md_array_bytes(td.backbone_angles.q16);
+        }, NULL, data);
+
+    memory_budget_register("Scrub Proxy", MemoryPriority_Derived,
+        [](void* user_data) {
+            const ApplicationData* data = (const ApplicationData*)user_data;
+            return scrub_proxy_memory_usage(&data->scrub.proxy);
+        }, NULL, data);
+
+    memory_budget_register("Shape Space", MemoryPriority_Derived,
+        [](void* user_data) {
+            const ApplicationData* data = (const ApplicationData*)user_data;
+            return md_array_bytes(data->shape_space.coords);
+        }, NULL, data);
+
+    memory_budget_register("Script Evaluation", MemoryPriority_Analysis,
+        [](void* user_data) {
+            const ApplicationData* data = (const ApplicationData*)user_data;
+            return script_eval_memory_usage(data->mold.script.full_eval) + script_eval_memory_usage(data->mold.script.filt_eval);
+        }, NULL, data);
+}
+
+// Bytes per atom and bond of the buffers of md_gl_molecule (positions, previous positions, radii, flags and bond indices)
+#define GL_MOL_BYTES_PER_ATOM   (2 * 3 * sizeof(float) + sizeof(float) + sizeof(uint8_t))
+#define GL_MOL_BYTES_PER_BOND   (2 * sizeof(uint32_t))
+// Colors of md_gl_representation
+#define GL_REP_BYTES_PER_ATOM   sizeof(uint32_t)
+// Depth-stencil, color, normal, velocity, post tonemap, picking and composite targets of the gbuffer
+#define GBUFFER_BYTES_PER_PIXEL (4 + 4 + 2 + 4 + 4 + 4 + 4)
+
+// GL objects are not allocated through a tracked allocator, their VRAM is estimated from the sizes they were created with
+static void update_vram_estimate(const ApplicationData* data) {
+    const size_t num_atoms = data->mold.mol.atom.count;
+    size_t buffers = num_atoms * GL_MOL_BYTES_PER_ATOM + data->mold.mol.bond.count * GL_MOL_BYTES_PER_BOND;
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        buffers += num_atoms * GL_REP_BYTES_PER_ATOM;
     }
 
-    switch (rep->type) {
-    case RepresentationType::SpaceFill:
-		rep->type_is_valid = true;
-		break;
-    case RepresentationType::Licorice:
-    case RepresentationType::BallAndStick:
-        rep->type_is_valid = mol.bond.count > 0;
-        break;
-    case RepresentationType::Ribbons:
-    case RepresentationType::Cartoon:
-        rep->type_is_valid = mol.backbone.range_count > 0;
-        break;
-    default:
-        ASSERT(false);
+    size_t textures = (size_t)data->gbuffer.width * data->gbuffer.height * GBUFFER_BYTES_PER_PIXEL;
+    const auto& vol = data->density_volume.volume_texture;
+    if (vol.id) {
+        textures += (size_t)vol.dim_x * vol.dim_y * vol.dim_z * sizeof(float);
+    }
+    if (data->shape_space.density.tex) {
+        textures += SHAPE_SPACE_DENSITY_DIM * SHAPE_SPACE_DENSITY_DIM * 4;
     }
 
-    if (rep->dynamic_evaluation) {
-        rep->filt_is_dirty = true;
+    memory_tracker_set(MemoryTracker_GLBuffers, buffers);
+    memory_tracker_set(MemoryTracker_GLTextures, textures);
+}
+
+// Swaps in the cached mask of the current frame, returns false if the frame has not been evaluated
+static bool apply_cached_dynamic_filter(ApplicationData* data, Representation* rep) {
+    ASSERT(data);
+    ASSERT(rep);
+    DynamicFilterCache* c = rep->filter_cache;
+    if (!c || !data->mold.traj || rep->filt_is_dirty) return false;
+    const uint64_t key = dynamic_filter_key(data, rep);
+    const int64_t frame = dynamic_filter_frame(data);
+    if (c->key != key || c->shown != frame) {
+        const DynamicFilterKey mask_key = {key, frame};
+        const DynamicFilterFrame* mask = lru_cache_acquire(&data->representation.filter_masks, mask_key);
+        if (!mask) return false;
+        const bool ok = md_bitfield_deserialize(&rep->atom_mask, mask->data, mask->size);
+        lru_cache_release(&data->representation.filter_masks, mask_key);
+        if (!ok) return false;
+        c->key = key;
+        c->shown = frame;
     }
+    rep->filt_is_valid = true;
+    return true;
+}
 
-    if (rep->filt_is_dirty) {
-        rep->filt_is_valid = filter_expression(data, str_from_cstr(rep->filt), &rep->atom_mask, &rep->filt_is_dynamic, rep->filt_error, sizeof(rep->filt_error));
-        rep->filt_is_dirty = false;
+static void dynamic_filter_task(void* user_data) {
+    DynamicFilterCache* c = (DynamicFilterCache*)user_data;
+    ApplicationData* data = c->data;
+    md_molecule_t& mol = c->mol;
+
+    md_bitfield_t mask = {};
+    md_bitfield_init(&mask, md_heap_allocator);
+    defer { md_bitfield_free(&mask); };
+
+    for (uint32_t i = 0; i < c->num_batch; ++i) {
+        md_trajectory_frame_header_t header = {};
+        if (!md_trajectory_load_frame(data->mold.traj, c->batch[i], &header, mol.atom.x, mol.atom.y, mol.atom.z)) break;
+        mol.unit_cell = header.unit_cell;
+        if (c->apply_pbc) {
+            md_util_deperiodize_system(mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.mass, mol.atom.count, &mol.unit_cell, mol.structures.offsets, mol.structures.indices, md_index_data_count(mol.structures));
+        }
+
+        // The semaphore is held per frame, so the compilation of the script is not held up by a batch
+        if (!md_semaphore_aquire(&data->mold.script.ir_semaphore)) break;
+        bool is_dynamic = false;
+        char error[256];
+        md_bitfield_clear(&mask);
+        const bool ok = md_filter(&mask, str_from_cstr(c->expr), &mol, data->mold.script.ir, &is_dynamic, error, (int)sizeof(error));
+        md_semaphore_release(&data->mold.script.ir_semaphore);
+        if (!ok) break;
+
+        const size_t cap = md_bitfield_serialize_size_in_bytes(&mask);
+        void* blob = md_alloc(persistent_allocator, cap);
+        const size_t size = md_bitfield_serialize(blob, &mask);
+        c->results[i] = {blob, (uint32_t)size, (uint32_t)cap};
+        if (!size) free_dynamic_filter_frame(&c->results[i]);
     }
+}
 
-    if (rep->filt_is_valid) {
-        filter_colors(colors, mol.atom.count, &rep->atom_mask);
-        data->representation.atom_visibility_mask_dirty = true;
-        md_gl_representation_set_color(&rep->md_rep, 0, (uint32_t)mol.atom.count, colors, 0);
+static void launch_dynamic_filter_batch(ApplicationData* data, DynamicFilterCache* c, const Representation* rep) {
+    ASSERT(!c->task);
+    const md_molecule_t& mol = data->mold.mol;
+    const size_t num_atoms = mol.atom.count;
+    const size_t num_ss = mol.backbone.secondary_structure ? mol.backbone.count : 0;
+    const size_t bytes = num_atoms * 3 * sizeof(float) + num_ss * sizeof(md_secondary_structure_t);
+    if (bytes > c->coord_bytes) {
+        if (c->coords) md_free(persistent_allocator, c->coords, c->coord_bytes);
+        c->coords = (float*)md_alloc(persistent_allocator, bytes);
+        c->coord_bytes = bytes;
+    }
 
-#if EXPERIMENTAL_GFX_API
-        md_gfx_rep_attr_t attributes = {};
-        attributes.spacefill.radius_scale = 1.0f;
-        md_gfx_rep_set_type_and_attr(rep->gfx_rep, MD_GFX_REP_TYPE_SPACEFILL, &attributes);
-        md_gfx_rep_set_color(rep->gfx_rep, 0, (uint32_t)mol.atom.count, (md_gfx_color_t*)colors, 0);
-#endif
+    // The positions are loaded per frame by the task, the secondary structures are those of the current frame
+    c->mol = mol;
+    c->mol.atom.x = c->coords + num_atoms * 0;
+    c->mol.atom.y = c->coords + num_atoms * 1;
+    c->mol.atom.z = c->coords + num_atoms * 2;
+    if (num_ss) {
+        c->mol.backbone.secondary_structure = (md_secondary_structure_t*)(c->coords + num_atoms * 3);
+        MEMCPY(c->mol.backbone.secondary_structure, mol.backbone.secondary_structure, num_ss * sizeof(md_secondary_structure_t));
+    }
+
+    c->data = data;
+    c->batch_key = dynamic_filter_key(data, rep);
+    c->apply_pbc = data->animation.apply_pbc;
+    MEMCPY(c->expr, rep->filt, sizeof(c->expr));
+    for (uint32_t i = 0; i < c->num_batch; ++i) {
+        c->results[i] = {};
+    }
+    c->task = task_system::pool_enqueue(STR("Dynamic Filter"), dynamic_filter_task, c, 0, task_system::Priority_Normal);
+}
+
+// Collects the completed batches and launches the evaluation of the frames ahead of the playhead which are missing
+static void update_dynamic_filter_caches(ApplicationData* data) {
+    ASSERT(data);
+    if (!data->mold.traj) return;
+    const int64_t num_frames = (int64_t)md_trajectory_num_frames(data->mold.traj);
+    if (num_frames <= 1) return;
+    const int64_t cur = dynamic_filter_frame(data);
+    const int64_t dir = data->animation.fps < 0 ? -1 : 1;
+
+    for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
+        Representation* rep = &data->representation.reps[i];
+        if (!rep->enabled || !rep->dynamic_evaluation || !rep->filt_is_valid || !rep->filt_is_dynamic || rep->filt_is_dirty) continue;
+
+        if (!rep->filter_cache) {
+            rep->filter_cache = (DynamicFilterCache*)md_alloc(persistent_allocator, sizeof(DynamicFilterCache));
+            *rep->filter_cache = {};
+        }
+        DynamicFilterCache* c = rep->filter_cache;
+
+        // The masks are cached under the key they were evaluated with, so the masks of a previous key (e.g. an earlier expression) are kept as well
+        if (c->task) {
+            if (task_system::task_is_running(c->task)) continue;
+            c->task = 0;
+            for (uint32_t j = 0; j < c->num_batch; ++j) {
+                if (!c->results[j].data || !lru_cache_put(&data->representation.filter_masks, {c->batch_key, c->batch[j]}, c->results[j], c->results[j].cap)) {
+                    free_dynamic_filter_frame(&c->results[j]);
+                }
+                c->results[j] = {};
+            }
+            c->num_batch = 0;
+        }
+
+        // The least recently used masks are evicted when the budget is exceeded, the masks around the playhead are the most recently used
+        // The window wraps around, as playback loops
+        const uint64_t key = dynamic_filter_key(data, rep);
+        c->num_batch = 0;
+        for (int64_t d = 0; d < MIN(DYNAMIC_FILTER_LOOKAHEAD, num_frames) && c->num_batch < DYNAMIC_FILTER_BATCH; ++d) {
+            const int64_t f = ((cur + dir * d) % num_frames + num_frames) % num_frames;
+            if (!lru_cache_contains(&data->representation.filter_masks, {key, f})) c->batch[c->num_batch++] = f;
+        }
+        if (c->num_batch > 0) {
+            launch_dynamic_filter_batch(data, c, rep);
+        }
     }
 }
 
@@ -9732,8 +17906,14 @@ static void init_representation(ApplicationData* data, Representation* rep) {
 #if EXPERIMENTAL_GFX_API
     rep->gfx_rep = md_gfx_rep_create(data->mold.mol.atom.count);
 #endif
+    // A compacted molecule of a previous molecule is stale, the subset is created again when the representation is updated
+    free_representation_subset(data, rep, false);
     md_gl_representation_init(&rep->md_rep, &data->mold.gl_mol);
-    md_bitfield_init(&rep->atom_mask, persistent_allocator);
+    md_array_shrink(rep->uploaded_colors, 0);
+    rep->color_key = 0;
+    rep->lod_rep = {};
+    rep->lod_rep_valid = false;
+    md_bitfield_init(&rep->atom_mask, memory_tracker_allocator(MemoryTracker_Representations));
     rep->filt_is_dirty = true;
 }
 
@@ -10102,47 +18282,85 @@ static void handle_camera_interaction(ApplicationData* data) {
                 const ImU32 fill_col = 0x22222222;
                 const ImU32 line_col = 0x88888888;
 
-                ASSERT(dl);
-                dl->AddRectFilled(pos, pos + ext, fill_col);
-                dl->AddRect(pos, pos + ext, line_col);
+                // Holding Alt draws a lasso along the path of the mouse, which is bounded by the region
+                auto& region = data->selection.region;
+                const bool lasso = ImGui::IsKeyDown(ImGuiMod_Alt);
+                if (!lasso || ImGui::IsMouseClicked(ImGuiMouseButton_Left) || ImGui::IsMouseClicked(ImGuiMouseButton_Right)) {
+                    md_array_shrink(region.lasso, 0);
+                }
+                if (lasso && (ImGui::IsMouseDown(ImGuiMouseButton_Left) || ImGui::IsMouseDown(ImGuiMouseButton_Right))) {
+                    const vec2_t p = vec_cast(ImGui::GetMousePos() - window->Pos);
+                    const vec2_t d = md_array_size(region.lasso) ? p - *md_array_last(region.lasso) : vec2_t{FLT_MAX, 0};
+                    if (d.x * d.x + d.y * d.y > 4.0f) {
+                        md_array_push(region.lasso, p, persistent_allocator);
+                    }
+                }
 
-                const ImVec2 min_p = ImMin(pos, pos + ext) - window->Pos;
-                const ImVec2 max_p = ImMax(pos, pos + ext) - window->Pos;
+                ImVec2 min_p = ImMin(pos, pos + ext) - window->Pos;
+                ImVec2 max_p = ImMax(pos, pos + ext) - window->Pos;
+
+                ASSERT(dl);
+                const int num_lasso = (int)md_array_size(region.lasso);
+                if (num_lasso > 2) {
+                    ImVec2* points = (ImVec2*)md_alloc(frame_allocator, sizeof(ImVec2) * num_lasso);
+                    min_p = max_p = vec_cast(region.lasso[0]);
+                    for (int i = 0; i < num_lasso; ++i) {
+                        const ImVec2 p = vec_cast(region.lasso[i]);
+                        min_p = ImMin(min_p, p);
+                        max_p = ImMax(max_p, p);
+                        points[i] = p + window->Pos;
+                    }
+                    dl->AddPolyline(points, num_lasso, line_col, ImDrawFlags_Closed, 1.0f);
+                } else {
+                    dl->AddRectFilled(pos, pos + ext, fill_col);
+                    dl->AddRect(pos, pos + ext, line_col);
+                }
 
                 md_bitfield_t mask = { 0 };
                 md_bitfield_init(&mask, frame_allocator);
 
-                if (min_p != max_p) {
-                    md_bitfield_clear(&data->selection.current_highlight_mask);
+                if (min_p != max_p && region.from_picking && !region.include_occluded) {
+                    // The highlight and the selection are updated once the region has been read from the picking buffer
+                    data->selection.selecting = true;
+                    request_region_selection(data, vec_cast(min_p), vec_cast(max_p), mode == RegionMode::Remove, pressed || ImGui::IsMouseReleased(0));
+                }
+                else if (min_p != max_p) {
+                    md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_highlight_mask));
                     data->mold.dirty_buffers |= MolBit_DirtyFlags;
                     data->selection.selecting = true;
 
                     const vec2_t res = { (float)data->ctx.window.width, (float)data->ctx.window.height };
                     const mat4_t mvp = data->view.param.matrix.current.proj * data->view.param.matrix.current.view;
+                    const vec2_t ndc_min = {min_p.x / res.x * 2.0f - 1.0f, 1.0f - max_p.y / res.y * 2.0f};
+                    const vec2_t ndc_max = {max_p.x / res.x * 2.0f - 1.0f, 1.0f - min_p.y / res.y * 2.0f};
 
-                    md_bitfield_iter_t it = md_bitfield_iter_create(&data->representation.atom_visibility_mask);
-                    while (md_bitfield_iter_next(&it)) {
-                        const int64_t i = md_bitfield_iter_idx(&it);
-                        const vec4_t p = mat4_mul_vec4(mvp, vec4_set(data->mold.mol.atom.x[i], data->mold.mol.atom.y[i], data->mold.mol.atom.z[i], 1.0f));
-                        const vec2_t c = {
-                            (p.x / p.w * 0.5f + 0.5f) * res.x,
-                            (-p.y / p.w * 0.5f + 0.5f) * res.y
-                        };
+                    if (num_lasso < 3 && data->cpu_picking.enabled && cpu_pick_region(data, &mask, mvp, ndc_min, ndc_max)) {
+                        // Only the nodes of the hierarchy which overlap the region are visited
+                    } else {
+                        md_bitfield_iter_t it = md_bitfield_iter_create(&data->representation.atom_visibility_mask);
+                        while (md_bitfield_iter_next(&it)) {
+                            const int64_t i = md_bitfield_iter_idx(&it);
+                            const vec4_t p = mat4_mul_vec4(mvp, vec4_set(data->mold.mol.atom.x[i], data->mold.mol.atom.y[i], data->mold.mol.atom.z[i], 1.0f));
+                            const vec2_t c = {
+                                (p.x / p.w * 0.5f + 0.5f) * res.x,
+                                (-p.y / p.w * 0.5f + 0.5f) * res.y
+                            };
 
-                        if (min_p.x <= c.x && c.x <= max_p.x && min_p.y <= c.y && c.y <= max_p.y) {
-                            md_bitfield_set_bit(&mask, i);
+                            if (min_p.x <= c.x && c.x <= max_p.x && min_p.y <= c.y && c.y <= max_p.y && (num_lasso < 3 || point_in_polygon(c, region.lasso, num_lasso))) {
+                                md_bitfield_set_bit(&mask, i);
+                            }
                         }
                     }
                     grow_mask_by_current_selection_granularity(&mask, *data);
 
                     if (mode == RegionMode::Append) {
-                        md_bitfield_or(&data->selection.current_highlight_mask, &data->selection.current_selection_mask, &mask);
+                        md_bitfield_or(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.current_selection_mask.bits, &mask);
                     }
                     else if (mode == RegionMode::Remove) {
-                        md_bitfield_andnot(&data->selection.current_highlight_mask, &data->selection.current_selection_mask, &mask);
+                        md_bitfield_andnot(versioned_bitfield_modify(&data->selection.current_highlight_mask), &data->selection.current_selection_mask.bits, &mask);
                     }
                     if (pressed || ImGui::IsMouseReleased(0)) {
-                        md_bitfield_copy(&data->selection.current_selection_mask, &data->selection.current_highlight_mask);
+                        md_bitfield_copy(versioned_bitfield_modify(&data->selection.current_selection_mask), &data->selection.current_highlight_mask.bits);
                     }
                 }
                 else if (pressed) {
@@ -10157,7 +18375,7 @@ static void handle_camera_interaction(ApplicationData* data) {
                                 md_bitfield_set_bit(&mask, pair.idx[1]);
                             }
                             grow_mask_by_current_selection_granularity(&mask, *data);
-                            md_bitfield_or_inplace(&data->selection.current_selection_mask, &mask);
+                            md_bitfield_or_inplace(versioned_bitfield_modify(&data->selection.current_selection_mask), &mask);
                         }
                         else if (mode == RegionMode::Remove) {
                             if (data->selection.atom_idx.hovered != -1) {
@@ -10169,13 +18387,13 @@ static void handle_camera_interaction(ApplicationData* data) {
                                 md_bitfield_set_bit(&mask, pair.idx[1]);
                             }
                             grow_mask_by_current_selection_granularity(&mask, *data);
-                            md_bitfield_andnot_inplace(&data->selection.current_selection_mask, &mask);
+                            md_bitfield_andnot_inplace(versioned_bitfield_modify(&data->selection.current_selection_mask), &mask);
                         }
                     }
                     else {
                         single_selection_sequence_clear(&data->selection.single_selection_sequence);
-                        md_bitfield_clear(&data->selection.current_selection_mask);
-                        md_bitfield_clear(&data->selection.current_highlight_mask);
+                        md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_selection_mask));
+                        md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_highlight_mask));
                     }
                 }
 
@@ -10184,16 +18402,16 @@ static void handle_camera_interaction(ApplicationData* data) {
         }
         else if (ImGui::IsItemHovered() && !ImGui::IsAnyItemActive()) {
             if (data->picking.idx != INVALID_PICKING_IDX) {
-                md_bitfield_clear(&data->selection.current_highlight_mask);
+                md_bitfield_clear(versioned_bitfield_modify(&data->selection.current_highlight_mask));
                 if (data->selection.atom_idx.hovered != -1) {
-                    md_bitfield_set_bit(&data->selection.current_highlight_mask, data->picking.idx);
+                    md_bitfield_set_bit(versioned_bitfield_modify(&data->selection.current_highlight_mask), data->picking.idx);
                 }
                 else if (data->selection.bond_idx.hovered != -1) {
                     md_bond_pair_t pair = data->mold.mol.bond.pairs[data->selection.bond_idx.hovered];
-                    md_bitfield_set_bit(&data->selection.current_highlight_mask, pair.idx[0]);
-                    md_bitfield_set_bit(&data->selection.current_highlight_mask, pair.idx[1]);
+                    md_bitfield_set_bit(versioned_bitfield_modify(&data->selection.current_highlight_mask), pair.idx[0]);
+                    md_bitfield_set_bit(versioned_bitfield_modify(&data->selection.current_highlight_mask), pair.idx[1]);
                 }
-                grow_mask_by_current_selection_granularity(&data->selection.current_highlight_mask, *data);
+                grow_mask_by_current_selection_granularity(versioned_bitfield_modify(&data->selection.current_highlight_mask), *data);
                 data->mold.dirty_buffers |= MolBit_DirtyFlags;
                 draw_info_window(*data, data->picking.idx);
             }
@@ -10335,7 +18553,7 @@ static void clear_gbuffer(GBuffer* gbuffer) {
     POP_GPU_SECTION()
 }
 
-static void fill_gbuffer(ApplicationData* data) {
+static void fill_gbuffer(ApplicationData* data, GBuffer* gbuf) {
     const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY,
         GL_COLOR_ATTACHMENT_PICKING, GL_COLOR_ATTACHMENT_POST_TONEMAP };
 
@@ -10346,7 +18564,7 @@ static void fill_gbuffer(ApplicationData* data) {
     glDepthFunc(GL_LESS);
 
     // Enable all draw buffers
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, data->gbuffer.deferred.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf->deferred.fbo);
     glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
 
     PUSH_GPU_SECTION("G-Buffer fill")
@@ -10394,7 +18612,7 @@ static void fill_gbuffer(ApplicationData* data) {
         PUSH_GPU_SECTION("Blit Static Velocity")
         glDrawBuffer(GL_COLOR_ATTACHMENT_VELOCITY);
         glDepthMask(0);
-        postprocessing::blit_static_velocity(data->gbuffer.deferred.depth, data->view.param);
+        postprocessing::blit_static_velocity(gbuf->deferred.depth, data->view.param);
         glDepthMask(1);
         POP_GPU_SECTION()
     }
@@ -10402,90 +18620,116 @@ static void fill_gbuffer(ApplicationData* data) {
     glColorMask(1, 1, 1, 1);
 
     // DRAW REPRESENTATIONS
-    PUSH_GPU_SECTION("Representation")
-    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
-    draw_representations(data);
-    POP_GPU_SECTION()
+    if (data->scrub.active) {
+        PUSH_GPU_SECTION("Scrub Proxy")
+        glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+        draw_scrub_proxy(data);
+        POP_GPU_SECTION()
+    } else {
+        PUSH_GPU_SECTION("Representation")
+        glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+        draw_representations(data);
+        POP_GPU_SECTION()
+    }
+
+    // The depth of the representations is read back to occlude chunks in the following frames of the same view
+    if (data->representation.culling.active && data->representation.culling.occlusion && !data->scrub.active) {
+        PUSH_GPU_SECTION("Capture HiZ")
+        const mat4_t view_proj = data->view.param.matrix.current.proj * data->view.param.matrix.current.view;
+        culling::hiz_capture(&data->representation.culling.hiz, gbuf->deferred.depth, gbuf->width, gbuf->height, view_proj, data->representation.culling.key);
+        POP_GPU_SECTION()
+        glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+    }
 
     glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);  // Post_Tonemap buffer
 
-    if (!use_gfx) {
+    if (!use_gfx && !data->scrub.active) {
         PUSH_GPU_SECTION("Selection")
-        const bool atom_selection_empty = md_bitfield_popcount(&data->selection.current_selection_mask) == 0;
-        const bool atom_highlight_empty = md_bitfield_popcount(&data->selection.current_highlight_mask) == 0;
+        const bool atom_selection_empty = versioned_bitfield_empty(&data->selection.current_selection_mask);
+        const bool atom_highlight_empty = versioned_bitfield_empty(&data->selection.current_highlight_mask);
 
         glDepthMask(0);
 
-        // @NOTE(Robin): This is a b*tch to get right, What we want is to separate in a single pass, the visible selected from the
-        // non visible selected. In order to achieve this, we start with a cleared stencil of value 1 then either set it to zero selected and not visible
-        // and to two if it is selected and visible. But the visible atoms should always be able to write over a non visible 0, but not the other way around.
-        // Hence the GL_GREATER stencil test against the reference value of 2.
+        if (data->selection.screen_space.enabled && (!atom_selection_empty || !atom_highlight_empty)) {
+            // One pass over the picking indices, which only sees the atoms in front, so the hidden colors are not applied
+            update_selection_buffer(data);
+            if (data->selection.screen_space.buffer) {
+                glDisable(GL_DEPTH_TEST);
+                postprocessing::highlight_selection(gbuf->deferred.picking, data->selection.screen_space.buffer, data->selection.screen_space.index_offset,
+                    data->selection.color.highlight.visible, data->selection.color.selection.visible);
+            }
+        } else {
+            // @NOTE(Robin): This is a b*tch to get right, What we want is to separate in a single pass, the visible selected from the
+            // non visible selected. In order to achieve this, we start with a cleared stencil of value 1 then either set it to zero selected and not visible
+            // and to two if it is selected and visible. But the visible atoms should always be able to write over a non visible 0, but not the other way around.
+            // Hence the GL_GREATER stencil test against the reference value of 2.
 
-        if (!atom_selection_empty) {
-            glColorMask(0, 0, 0, 0);
+            if (!atom_selection_empty) {
+                glColorMask(0, 0, 0, 0);
 
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_EQUAL);
+                glEnable(GL_DEPTH_TEST);
+                glDepthFunc(GL_EQUAL);
 
-            glEnable(GL_STENCIL_TEST);
-            glStencilMask(0xFF);
+                glEnable(GL_STENCIL_TEST);
+                glStencilMask(0xFF);
 
-            glClearStencil(1);
-            glClear(GL_STENCIL_BUFFER_BIT);
+                glClearStencil(1);
+                glClear(GL_STENCIL_BUFFER_BIT);
 
-            glStencilFunc(GL_GREATER, 0x02, 0xFF);
-            glStencilOp(GL_KEEP, GL_ZERO, GL_REPLACE);
-            draw_representations_lean_and_mean(data, AtomBit_Selected | AtomBit_Visible);
+                glStencilFunc(GL_GREATER, 0x02, 0xFF);
+                glStencilOp(GL_KEEP, GL_ZERO, GL_REPLACE);
+                draw_representations_lean_and_mean(data, AtomBit_Selected | AtomBit_Visible);
 
-            glDisable(GL_DEPTH_TEST);
+                glDisable(GL_DEPTH_TEST);
 
-            glStencilMask(0x0);
-            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-            glColorMask(1, 1, 1, 1);
+                glStencilMask(0x0);
+                glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+                glColorMask(1, 1, 1, 1);
 
-            glStencilFunc(GL_EQUAL, 2, 0xFF);
-            postprocessing::blit_color(data->selection.color.selection.visible);
+                glStencilFunc(GL_EQUAL, 2, 0xFF);
+                postprocessing::blit_color(data->selection.color.selection.visible);
 
-            glStencilFunc(GL_EQUAL, 0, 0xFF);
-            postprocessing::blit_color(data->selection.color.selection.hidden);
-        }
+                glStencilFunc(GL_EQUAL, 0, 0xFF);
+                postprocessing::blit_color(data->selection.color.selection.hidden);
+            }
 
-        if (!atom_highlight_empty) {
-            glColorMask(0, 0, 0, 0);
+            if (!atom_highlight_empty) {
+                glColorMask(0, 0, 0, 0);
 
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_EQUAL);
+                glEnable(GL_DEPTH_TEST);
+                glDepthFunc(GL_EQUAL);
 
-            glEnable(GL_STENCIL_TEST);
-            glStencilMask(0xFF);
+                glEnable(GL_STENCIL_TEST);
+                glStencilMask(0xFF);
 
-            glClearStencil(1);
-            glClear(GL_STENCIL_BUFFER_BIT);
+                glClearStencil(1);
+                glClear(GL_STENCIL_BUFFER_BIT);
 
-            glStencilFunc(GL_GREATER, 0x02, 0xFF);
-            glStencilOp(GL_KEEP, GL_ZERO, GL_REPLACE);
-            draw_representations_lean_and_mean(data, AtomBit_Highlighted | AtomBit_Visible);
+                glStencilFunc(GL_GREATER, 0x02, 0xFF);
+                glStencilOp(GL_KEEP, GL_ZERO, GL_REPLACE);
+                draw_representations_lean_and_mean(data, AtomBit_Highlighted | AtomBit_Visible);
 
-            glDisable(GL_DEPTH_TEST);
+                glDisable(GL_DEPTH_TEST);
 
-            glStencilMask(0x0);
-            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-            glColorMask(1, 1, 1, 1);
+                glStencilMask(0x0);
+                glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+                glColorMask(1, 1, 1, 1);
 
-            glStencilFunc(GL_EQUAL, 2, 0xFF);
-            postprocessing::blit_color(data->selection.color.highlight.visible);
+                glStencilFunc(GL_EQUAL, 2, 0xFF);
+                postprocessing::blit_color(data->selection.color.highlight.visible);
 
-            glStencilFunc(GL_EQUAL, 0, 0xFF);
-            postprocessing::blit_color(data->selection.color.highlight.hidden);
-        }
+                glStencilFunc(GL_EQUAL, 0, 0xFF);
+                postprocessing::blit_color(data->selection.color.highlight.hidden);
+            }
 
-        glDisable(GL_STENCIL_TEST);
+            glDisable(GL_STENCIL_TEST);
+        }
 
         if (!atom_selection_empty) {
             PUSH_GPU_SECTION("Desaturate") {
                 const float saturation = data->selection.color.saturation;
                 glDrawBuffer(GL_COLOR_ATTACHMENT_COLOR);
-                postprocessing::scale_hsv(data->gbuffer.deferred.color, vec3_t{1, saturation, 1});
+                postprocessing::scale_hsv(gbuf->deferred.color, vec3_t{1, saturation, 1});
                 glDrawBuffer(GL_COLOR_ATTACHMENT_POST_TONEMAP);
             } POP_GPU_SECTION()
         }
@@ -10503,7 +18747,8 @@ static void fill_gbuffer(ApplicationData* data) {
     immediate::set_model_view_matrix(data->view.param.matrix.current.view);
     immediate::set_proj_matrix(data->view.param.matrix.current.proj);
 
-    const md_script_vis_t& vis = data->mold.script.vis;
+    static const md_script_vis_t empty_vis = {};
+    const md_script_vis_t& vis = data->mold.script.vis ? *data->mold.script.vis : empty_vis;
 
     const uint32_t point_color      = convert_color(data->script.point_color);
     const uint32_t line_color       = convert_color(data->script.line_color);
@@ -10555,7 +18800,7 @@ static void fill_gbuffer(ApplicationData* data) {
 
     md_array_free(model_matrices, frame_allocator);
 
-    md_script_vis_free(&data->mold.script.vis);
+    data->mold.script.vis = nullptr;
 
     glEnable(GL_CULL_FACE);
     POP_GPU_SECTION()
@@ -10570,6 +18815,8 @@ static void handle_picking(ApplicationData* data) {
         if (coord.x < 0.f || coord.x >= (float)data->gbuffer.width || coord.y < 0.f || coord.y >= (float)data->gbuffer.height) {
             data->picking.idx = INVALID_PICKING_IDX;
             data->picking.depth = 1.f;
+        } else if ((data->cpu_picking.enabled || headless_mode) && cpu_pick(data, coord, &data->picking)) {
+            // Picked from the current coordinates, so there is no latency and no picking buffer involved
         } else {
 #if PICKING_JITTER_HACK
             static uint32_t frame_idx = 0;
@@ -10585,6 +18832,7 @@ static void handle_picking(ApplicationData* data) {
 
             if (ref_frame == frame_idx || data->view.param.jitter.current == vec2_t{0, 0}) {
                 data->picking = read_picking_data(data->gbuffer, (int32_t)round(coord.x), (int32_t)round(coord.y));
+                data->picking.idx = resolve_picking_idx(data, data->picking.idx);
                 if (data->picking.idx != INVALID_PICKING_IDX)
                     data->picking.idx = CLAMP(data->picking.idx, 0U, (uint32_t)data->mold.mol.atom.count - 1U);
                 const vec4_t viewport = {0, 0, (float)data->gbuffer.width, (float)data->gbuffer.height};
@@ -10592,6 +18840,7 @@ static void handle_picking(ApplicationData* data) {
             }
 #else
             data->picking = read_picking_data(&data->gbuffer, (int)coord.x, (int)coord.y);
+            data->picking.idx = resolve_picking_idx(data, data->picking.idx);
             const vec4_t viewport = {0, 0, (float)data->gbuffer.width, (float)data->gbuffer.height};
             const mat4_t inv_VP = data->view.param.matrix.inverse.view * data->view.param.matrix.inverse.proj_jittered;
             data->picking.world_coord = mat4_unproject({coord.x, coord.y, data->picking.depth}, inv_VP, viewport);
@@ -10616,8 +18865,383 @@ static void handle_picking(ApplicationData* data) {
     }
     POP_CPU_SECTION()
 }
-static void apply_postprocessing(const ApplicationData& data) {
-    PUSH_GPU_SECTION("Postprocessing")
+// Number of frames which are rendered after the last change before the scene is considered static
+#define RENDER_SETTLE_FRAMES 2
+// Timeout when waiting for events while idle, async tasks shorten this so their results are picked up
+#define RENDER_IDLE_TIMEOUT 0.25
+#define RENDER_TASK_TIMEOUT (1.0 / 30.0)
+
+// Returns true if the scene has to be rendered this frame
+// Must be called before update_md_buffers, since the dirty buffer bits are part of the tracked state
+static bool scene_needs_render(ApplicationData* data) {
+    ASSERT(data);
+    auto& r = data->render;
+
+    bool changed = r.dirty || data->mold.dirty_buffers != 0;
+    changed |= MEMCMP(&r.view, &data->view.param.matrix.current.view, sizeof(mat4_t)) != 0;
+    changed |= MEMCMP(&r.proj, &data->view.param.matrix.current.proj, sizeof(mat4_t)) != 0;
+    changed |= r.frame != data->animation.frame;
+    changed |= MEMCMP(&r.visuals, &data->visuals, sizeof(r.visuals)) != 0;
+    changed |= MEMCMP(&r.simulation_box, &data->simulation_box, sizeof(r.simulation_box)) != 0;
+    changed |= !str_empty(data->screenshot.path_to_file);
+    // GUI interaction can change the scene in ways which are not tracked (e.g. toggling a representation)
+    changed |= ImGui::IsAnyMouseDown() || ImGui::IsAnyItemActive() || ImGui::IsMouseReleased(ImGuiMouseButton_Left) || ImGui::IsMouseReleased(ImGuiMouseButton_Right);
+
+    if (changed) {
+        MEMCPY(&r.view, &data->view.param.matrix.current.view, sizeof(mat4_t));
+        MEMCPY(&r.proj, &data->view.param.matrix.current.proj, sizeof(mat4_t));
+        MEMCPY(&r.visuals, &data->visuals, sizeof(r.visuals));
+        MEMCPY(&r.simulation_box, &data->simulation_box, sizeof(r.simulation_box));
+        r.frame = data->animation.frame;
+        r.dirty = false;
+        // The jitter sequence has to run its course for the temporal accumulation to converge
+        const bool jitter = temporal_reprojection_enabled(*data) && data->visuals.temporal_reprojection.jitter;
+        // As does the accumulation of the half resolution ambient occlusion (which the quality governor may have selected)
+        const bool accumulate_ao = data->visuals.ssao.enabled && (data->visuals.ssao.half_res || (data->quality.enabled && data->quality.level >= 1));
+        r.settle_frames = (jitter || accumulate_ao) ? JITTER_SEQUENCE_SIZE : RENDER_SETTLE_FRAMES;
+    }
+
+    if (!r.enabled) return true;
+    if (changed) return true;
+    if (r.settle_frames > 0) {
+        r.settle_frames -= 1;
+        return true;
+    }
+    return false;
+}
+
+// Selects the scale at which the scene is rendered this frame, must be called before update_view_param
+static void update_dynamic_resolution(ApplicationData* data) {
+    ASSERT(data);
+    auto& dr = data->dynamic_resolution;
+
+    const mat4_t view = camera_world_to_view_matrix(data->view.camera);
+    const bool moving = MEMCMP(&view, &data->view.param.matrix.current.view, sizeof(mat4_t)) != 0;
+    // Screenshots are always taken at full resolution
+    const bool busy = dr.enabled && (moving || data->animation.mode == PlaybackMode::Playing) && str_empty(data->screenshot.path_to_file);
+    const float prev_scale = dr.scale;
+
+    if (!busy) {
+        // The camera can rest for single frames during an interaction, so the full resolution is restored after a few idle frames
+        dr.idle_frames += 1;
+        if (!dr.enabled || dr.idle_frames > RENDER_SETTLE_FRAMES) {
+            dr.scale = 1.0f;
+        }
+    } else if (dr.target_ms <= 0.0f) {
+        dr.scale = dr.min_scale;
+        dr.idle_frames = 0;
+    } else {
+        const float dt_ms = (float)(data->ctx.timing.delta_s * 1000.0);
+        if (dr.idle_frames > 0) {
+            // The time of a frame which waited for events is not representative
+            dr.frame_ms = dr.target_ms;
+            dr.hold_frames = 0;
+        } else {
+            dr.frame_ms = lerp(dr.frame_ms, dt_ms, 0.2f);
+        }
+        if (dr.hold_frames > 0) {
+            dr.hold_frames -= 1;
+        } else if (dr.frame_ms > dr.target_ms && dr.scale > dr.min_scale) {
+            dr.scale = MAX(dr.min_scale, MIN(dr.scale, 1.0f - DYNAMIC_RES_SCALE_STEP) - DYNAMIC_RES_SCALE_STEP);
+            dr.hold_frames = DYNAMIC_RES_HOLD_FRAMES;
+        } else if (dr.frame_ms < dr.target_ms * 0.7f && dr.scale < 1.0f) {
+            dr.scale = MIN(1.0f, dr.scale + DYNAMIC_RES_SCALE_STEP);
+            dr.hold_frames = DYNAMIC_RES_HOLD_FRAMES;
+        }
+        dr.idle_frames = 0;
+    }
+
+    dr.active = dr.scale <= DYNAMIC_RES_MAX_SCALE && data->gbuffer.width > 0 && data->gbuffer.height > 0;
+    if (dr.active) {
+        const int w = MAX(1, (int)(data->gbuffer.width  * dr.scale + 0.5f));
+        const int h = MAX(1, (int)(data->gbuffer.height * dr.scale + 0.5f));
+        if (dr.gbuffer.width != w || dr.gbuffer.height != h) {
+            init_gbuffer(&dr.gbuffer, w, h);
+        }
+    }
+
+    // A change of scale changes the image, which is otherwise not tracked by render on demand
+    if (dr.scale != prev_scale) {
+        data->render.dirty = true;
+    }
+}
+
+// The temporal reprojection (and the jitter it resolves) is also disabled by the scrubbing and the governor
+static bool temporal_reprojection_enabled(const ApplicationData& data) {
+    if (!data.visuals.temporal_reprojection.enabled || data.scrub.active) return false;
+    return !(data.quality.enabled && data.quality.level >= (int)ARRAY_SIZE(QUALITY_LEVELS) - 1);
+}
+
+// Adapts the level of the quality governor to the GPU time of the frames which have been read back since the last call
+static void update_quality_governor(ApplicationData* data) {
+    ASSERT(data);
+    auto& q = data->quality;
+    if (!q.enabled) {
+        if (q.level != 0) {
+            q.level = 0;
+            data->render.dirty = true;
+        }
+        return;
+    }
+    if (!gpu_timing::enabled()) {
+        gpu_timing::set_enabled(true);
+    }
+
+    const uint32_t head = gpu_timing::history_head();
+    if (head == q.head) return;
+
+    size_t num_timers = 0;
+    const gpu_timing::Timer* timers = gpu_timing::timers(&num_timers);
+    const int prev_level = q.level;
+    for (uint32_t h = q.head; h != head; h = (h + 1) % GPU_TIMING_HISTORY) {
+        // Frames which only recomposited the last image (render on demand) tell nothing about the cost of the postprocessing
+        float total_ms = 0.0f;
+        float post_ms = 0.0f;
+        for (size_t i = 0; i < num_timers; ++i) {
+            if (timers[i].depth != 0) continue;
+            total_ms += timers[i].history[h];
+            if (strcmp(timers[i].label, "Postprocessing") == 0) post_ms = timers[i].history[h];
+        }
+        if (post_ms <= 0.0f) continue;
+
+        q.gpu_ms = q.gpu_ms > 0.0f ? lerp(q.gpu_ms, total_ms, 0.2f) : total_ms;
+        if (q.hold_samples > 0) {
+            q.hold_samples -= 1;
+        } else if (q.gpu_ms > q.target_ms && q.level < (int)ARRAY_SIZE(QUALITY_LEVELS) - 1) {
+            q.level += 1;
+            q.hold_samples = QUALITY_HOLD_SAMPLES;
+        } else if (q.gpu_ms < q.target_ms * QUALITY_RESTORE_FRACTION && q.level > 0) {
+            q.level -= 1;
+            // Stepping up is held back longer, so a level which does not fit is not retried at once
+            q.hold_samples = QUALITY_HOLD_SAMPLES * 2;
+        }
+    }
+    q.head = head;
+
+    if (q.level != prev_level) {
+        LOG_INFO("Quality governor: GPU %.1f ms (target %.1f ms), %s quality to '%s'", q.gpu_ms, q.target_ms, q.level > prev_level ? "lowered" : "restored", QUALITY_LEVELS[q.level]);
+        data->render.dirty = true;
+    }
+}
+
+// The G-Buffer which the scene is rendered into this frame
+static GBuffer* scene_gbuffer(ApplicationData* data) {
+    ASSERT(data);
+    return data->dynamic_resolution.active ? &data->dynamic_resolution.gbuffer : &data->gbuffer;
+}
+
+// Upscales the attachments of the reduced G-Buffer into the full G-Buffer
+// The depth, normals and indices are not filtered, as interpolated values are not valid
+static void upscale_gbuffer(GBuffer* dst, const GBuffer* src) {
+    ASSERT(dst);
+    ASSERT(src);
+    const struct {
+        GLenum attachment;
+        GLenum filter;
+    } targets[] = {
+        {GL_COLOR_ATTACHMENT_COLOR,         GL_LINEAR},
+        {GL_COLOR_ATTACHMENT_NORMAL,        GL_NEAREST},
+        {GL_COLOR_ATTACHMENT_VELOCITY,      GL_LINEAR},
+        {GL_COLOR_ATTACHMENT_POST_TONEMAP,  GL_LINEAR},
+        {GL_COLOR_ATTACHMENT_PICKING,       GL_NEAREST},
+    };
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src->deferred.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst->deferred.fbo);
+    for (size_t i = 0; i < ARRAY_SIZE(targets); ++i) {
+        glReadBuffer(targets[i].attachment);
+        glDrawBuffer(targets[i].attachment);
+        glBlitFramebuffer(0, 0, src->width, src->height, 0, 0, dst->width, dst->height, GL_COLOR_BUFFER_BIT, targets[i].filter);
+    }
+    glBlitFramebuffer(0, 0, src->width, src->height, 0, 0, dst->width, dst->height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+// Stores the final image of the backbuffer into the composite target, or recomposites it into the backbuffer
+static void blit_composite(GBuffer* gbuf, bool store) {
+    ASSERT(gbuf);
+    const int w = gbuf->width;
+    const int h = gbuf->height;
+    if (store) {
+        application::bind_default_framebuffer(GL_READ_FRAMEBUFFER);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuf->composite.fbo);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    } else {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuf->composite.fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        application::bind_default_framebuffer(GL_DRAW_FRAMEBUFFER);
+    }
+    glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    application::bind_default_framebuffer(GL_DRAW_FRAMEBUFFER);
+}
+
+// Block on events instead of polling when neither the scene nor the GUI is changing
+static void update_event_wait(ApplicationData* data) {
+    ASSERT(data);
+    const ImGuiIO& io = ImGui::GetIO();
+    bool active = data->render.settle_frames > 0 || data->animation.mode == PlaybackMode::Playing;
+    active |= io.MouseDelta.x != 0 || io.MouseDelta.y != 0 || io.MouseWheel != 0 || io.MouseWheelH != 0;
+    active |= ImGui::IsAnyMouseDown() || ImGui::IsAnyItemActive() || io.WantTextInput || io.InputQueueCharacters.Size > 0;
+    active |= data->mold.script.compile_ir || data->mold.script.eval_init || data->mold.script.evaluate_filt;
+    // Screenshots which are read back are polled every frame
+    for (const ScreenshotCapture& cap : data->screenshot.captures) {
+        active |= cap.fence != 0 || cap.task != 0;
+    }
+    active |= data->movie.active;
+    active |= task_system::main_tasks_deferred();
+#if VIAMD_BENCH
+    active |= data->bench.active;
+#endif
+
+    // ImGui needs a couple of frames to settle after input
+    data->render.idle_frames = active ? 0 : data->render.idle_frames + 1;
+
+    task_system::ID* running = task_system::pool_running_tasks(frame_allocator);
+    const bool tasks = md_array_size(running) > 0;
+
+    data->ctx.events.wait = data->render.enabled && data->render.idle_frames > RENDER_SETTLE_FRAMES;
+    data->ctx.events.timeout_s = tasks ? RENDER_TASK_TIMEOUT : RENDER_IDLE_TIMEOUT;
+}
+
+static void request_evaluation(ApplicationData* data) {
+    ASSERT(data);
+    data->mold.script.eval_init = true;
+    data->mold.script.eval_generation += 1;
+    data->mold.script.time_since_eval_request = 0;
+}
+
+static void request_filt_evaluation(ApplicationData* data) {
+    ASSERT(data);
+    data->mold.script.evaluate_filt = true;
+    data->mold.script.time_since_filt_request = 0;
+}
+
+// Inputs of the script which are not part of the source: the molecule file, the shape of the dataset, how it was loaded
+// (coarse grained, deperiodized and the transform the loader applies to the frames) and the stored selections
+// This is stable between sessions, so it can be used for the keys of the evaluation cache
+static uint64_t script_inputs_fingerprint(const ApplicationData* data) {
+    ASSERT(data);
+    const uint64_t dataset[6] = {
+        eval_cache_file_identity(str_from_cstr(data->files.molecule)),
+        (uint64_t)data->mold.mol.atom.count,
+        data->mold.traj ? (uint64_t)md_trajectory_num_frames(data->mold.traj) : 0,
+        data->mold.traj ? load::traj::transform_key(data->mold.traj) : 0,
+        (uint64_t)data->files.coarse_grained,
+        (uint64_t)data->files.deperiodize,
+    };
+    uint64_t h = script_hash(dataset, sizeof(dataset));
+
+    for (size_t i = 0; i < md_array_size(data->selection.stored_selections); ++i) {
+        const Selection& sel = data->selection.stored_selections[i];
+        h = script_hash(sel.name, strnlen(sel.name, sizeof(sel.name)), h);
+        md_bitfield_iter_t it = md_bitfield_iter_create(&sel.atom_mask);
+        while (md_bitfield_iter_next(&it)) {
+            const uint64_t idx = md_bitfield_iter_idx(&it);
+            h = script_hash(&idx, sizeof(idx), h);
+        }
+    }
+    return h;
+}
+
+// The statements of the compiled source combined with the inputs and the loaded dataset
+static uint64_t script_context_fingerprint(const ApplicationData* data) {
+    ASSERT(data);
+    const ScriptStatementFingerprint* stmts = data->mold.script.ir_statements;
+    const uint64_t h[3] = {script_source_fingerprint(stmts, md_array_size(stmts)), script_inputs_fingerprint(data), (uint64_t)(uintptr_t)data->mold.traj};
+    return script_hash(h, sizeof(h));
+}
+
+static size_t eval_cache_path(char* buf, size_t cap, const ApplicationData* data) {
+    if (data->files.trajectory[0] == '\0') return 0;
+    const int len = snprintf(buf, cap, "%s.evalcache", data->files.trajectory);
+    return (0 < len && (size_t)len < cap) ? (size_t)len : 0;
+}
+
+// One key per property of the full evaluation: The trajectory file, the inputs and the statement which defines the property (including its dependencies)
+static void compute_eval_cache_keys(ApplicationData* data) {
+    ASSERT(data);
+    md_array_shrink(data->mold.script.cache_keys, 0);
+    const md_script_eval_t* eval = data->mold.script.full_eval;
+    if (!eval) return;
+
+    const uint64_t seed[3] = {eval_cache_file_identity(str_from_cstr(data->files.trajectory)), script_inputs_fingerprint(data), EVAL_CACHE_KEY_VERSION};
+    const uint64_t base = script_hash(seed, sizeof(seed));
+    const ScriptStatementFingerprint* stmts = data->mold.script.eval_statements;
+    const size_t num_stmts = md_array_size(stmts);
+
+    const md_script_property_t* props = md_script_eval_properties(eval);
+    const size_t num_props = md_script_eval_num_properties(eval);
+    for (size_t i = 0; i < num_props; ++i) {
+        const uint64_t ident = script_hash(props[i].ident.ptr, props[i].ident.len);
+        uint64_t key = 0;
+        if (seed[0]) {
+            for (size_t j = num_stmts; j > 0; --j) {
+                if (stmts[j - 1].ident == ident) {
+                    key = script_hash(&stmts[j - 1].fingerprint, sizeof(uint64_t), base);
+                    break;
+                }
+            }
+        }
+        md_array_push(data->mold.script.cache_keys, key, persistent_allocator);
+    }
+}
+
+// True if the filtered evaluation has properties which depend on the range as a whole (distributions, volumes)
+static bool filt_eval_required(const ApplicationData* data) {
+    ASSERT(data);
+    const md_script_eval_t* eval = data->mold.script.filt_eval;
+    const int64_t num_props = md_script_eval_num_properties(eval);
+    const md_script_property_t* props = md_script_eval_properties(eval);
+    for (int64_t i = 0; i < num_props; ++i) {
+        if (!(props[i].flags & MD_SCRIPT_PROPERTY_FLAG_TEMPORAL)) return true;
+    }
+    return false;
+}
+
+static bool read_eval_cache(ApplicationData* data) {
+    ASSERT(data);
+    if (!data->mold.script.cache_enabled) return false;
+    compute_eval_cache_keys(data);
+
+    char buf[4096];
+    const size_t len = eval_cache_path(buf, sizeof(buf), data);
+    if (!len) return false;
+    return eval_cache_read({buf, len}, data->mold.script.full_eval, data->mold.script.cache_keys, md_array_size(data->mold.script.cache_keys));
+}
+
+// Called from a pool task once the full evaluation has finished, incomplete (interrupted) evaluations are not written
+static void write_eval_cache(ApplicationData* data) {
+    ASSERT(data);
+    char buf[4096];
+    const size_t len = eval_cache_path(buf, sizeof(buf), data);
+    if (!len || !data->mold.script.full_eval) return;
+    eval_cache_write({buf, len}, data->mold.script.full_eval, data->mold.script.cache_keys, md_array_size(data->mold.script.cache_keys));
+}
+
+// Resizing the pool waits for all tasks, so it is deferred until nothing is running
+static void update_worker_pool(ApplicationData* data) {
+    ASSERT(data);
+    if (data->worker_pool.requested_threads == data->worker_pool.num_threads) return;
+    if (ImGui::IsAnyItemActive()) return;
+
+    task_system::ID* running = task_system::pool_running_tasks(frame_allocator);
+    if (md_array_size(running) > 0) return;
+
+    task_system::pool_set_num_threads((size_t)data->worker_pool.requested_threads);
+    data->worker_pool.num_threads = (int)task_system::pool_num_threads();
+    data->worker_pool.requested_threads = data->worker_pool.num_threads;
+}
+
+// Evaluating a frame holds its coordinates and the temporaries of the script, which are a few times the size of the coordinates
+static size_t estimate_eval_range_memory(const ApplicationData* data) {
+    ASSERT(data);
+    const size_t num_atoms = data->mold.mol.atom.count;
+    return num_atoms * sizeof(float) * 3 * 4 + MEGABYTES(1);
+}
+
+static postprocessing::Descriptor postprocessing_descriptor(const ApplicationData& data, const GBuffer& gbuf) {
     postprocessing::Descriptor desc;
 
     desc.background.intensity = data.visuals.background.color * data.visuals.background.intensity;
@@ -10626,6 +19250,7 @@ static void apply_postprocessing(const ApplicationData& data) {
     desc.ambient_occlusion.intensity = data.visuals.ssao.intensity;
     desc.ambient_occlusion.radius = data.visuals.ssao.radius;
     desc.ambient_occlusion.bias = data.visuals.ssao.bias;
+    desc.ambient_occlusion.half_res = data.visuals.ssao.half_res;
 
     desc.tonemapping.enabled = data.visuals.tonemapping.enabled;
     desc.tonemapping.mode = data.visuals.tonemapping.tonemapper;
@@ -10639,22 +19264,130 @@ static void apply_postprocessing(const ApplicationData& data) {
     constexpr float MOTION_BLUR_REFERENCE_DT = 1.0f / 60.0f;
     const float dt_compensation = MOTION_BLUR_REFERENCE_DT / (float)data.ctx.timing.delta_s;
     const float motion_scale = data.visuals.temporal_reprojection.motion_blur.motion_scale * dt_compensation;
-    desc.temporal_reprojection.enabled = data.visuals.temporal_reprojection.enabled;
+    desc.temporal_reprojection.enabled = temporal_reprojection_enabled(data);
     desc.temporal_reprojection.feedback_min = data.visuals.temporal_reprojection.feedback_min;
     desc.temporal_reprojection.feedback_max = data.visuals.temporal_reprojection.feedback_max;
     desc.temporal_reprojection.motion_blur.enabled = data.visuals.temporal_reprojection.motion_blur.enabled;
     desc.temporal_reprojection.motion_blur.motion_scale = motion_scale;
 
-    desc.input_textures.depth = data.gbuffer.deferred.depth;
-    desc.input_textures.color = data.gbuffer.deferred.color;
-    desc.input_textures.normal = data.gbuffer.deferred.normal;
-    desc.input_textures.velocity = data.gbuffer.deferred.velocity;
-    desc.input_textures.post_tonemap = data.gbuffer.deferred.post_tonemap;
+    // The proxy of the scrubbing is shaded without the effects which need more than a frame to converge
+    if (data.scrub.active) {
+        desc.ambient_occlusion.enabled = false;
+        desc.depth_of_field.enabled = false;
+    }
+
+    const int level = data.quality.enabled ? data.quality.level : 0;
+    if (level >= 1) desc.ambient_occlusion.half_res = true;
+    if (level >= 2) desc.ambient_occlusion.radius *= 0.5f;
+    if (level >= 3) desc.depth_of_field.enabled = false;
+    if (level >= 4) desc.temporal_reprojection.motion_blur.enabled = false;
+    if (level >= 5) desc.ambient_occlusion.enabled = false;
+
+    desc.input_textures.depth = gbuf.deferred.depth;
+    desc.input_textures.color = gbuf.deferred.color;
+    desc.input_textures.normal = gbuf.deferred.normal;
+    desc.input_textures.velocity = gbuf.deferred.velocity;
+    desc.input_textures.post_tonemap = gbuf.deferred.post_tonemap;
+
+    return desc;
+}
+
+static void apply_postprocessing(const ApplicationData& data) {
+    PUSH_GPU_SECTION("Postprocessing")
+    const postprocessing::Descriptor desc = postprocessing_descriptor(data, data.gbuffer);
+
+    // With dynamic resolution the jitter is in pixels of the reduced G-Buffer, the temporal reprojection expects pixels of the full G-Buffer
+    ViewParam param = data.view.param;
+    const vec2_t res_scl = {data.gbuffer.width / param.resolution.x, data.gbuffer.height / param.resolution.y};
+    param.jitter.current  = {param.jitter.current.x  * res_scl.x, param.jitter.current.y  * res_scl.y};
+    param.jitter.previous = {param.jitter.previous.x * res_scl.x, param.jitter.previous.y * res_scl.y};
+    param.jitter.next     = {param.jitter.next.x     * res_scl.x, param.jitter.next.y     * res_scl.y};
+    param.resolution = {(float)data.gbuffer.width, (float)data.gbuffer.height};
 
-    postprocessing::shade_and_postprocess(desc, data.view.param);
+    postprocessing::shade_and_postprocess(desc, param);
     POP_GPU_SECTION()
 }
 
+static void draw_md_gl_ops(ApplicationData* data, const md_gl_draw_op_t* ops, uint32_t count, uint32_t atom_mask, const md_gl_shaders_t* shaders = nullptr) {
+    if (count == 0) return;
+    md_gl_draw_args_t args = {
+        .shaders = shaders ? shaders : representation_shaders(data),
+        .draw_operations = {
+            .count = count,
+            .ops = ops,
+        },
+        .view_transform = {
+            .view_matrix = &data->view.param.matrix.current.view.elem[0][0],
+            .projection_matrix = &data->view.param.matrix.current.proj_jittered.elem[0][0],
+            // These two are for temporal anti-aliasing reprojection (optional)
+            .prev_view_matrix = &data->view.param.matrix.previous.view.elem[0][0],
+            .prev_projection_matrix = &data->view.param.matrix.previous.proj_jittered.elem[0][0],
+        },
+        .atom_mask = atom_mask,
+    };
+
+    md_gl_draw(&args);
+}
+
+// True if the box lies entirely on the outside of one of the clip planes of mvp
+static bool aabb_outside_frustum(const mat4_t& mvp, vec3_t aabb_min, vec3_t aabb_max) {
+    vec4_t clip[8];
+    for (int i = 0; i < 8; ++i) {
+        const vec3_t p = {(i & 1) ? aabb_max.x : aabb_min.x, (i & 2) ? aabb_max.y : aabb_min.y, (i & 4) ? aabb_max.z : aabb_min.z};
+        clip[i] = mat4_mul_vec4(mvp, vec4_from_vec3(p, 1.0f));
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        bool below = true;
+        bool above = true;
+        for (int i = 0; i < 8; ++i) {
+            below &= clip[i].elem[axis] < -clip[i].w;
+            above &= clip[i].elem[axis] >  clip[i].w;
+        }
+        if (below || above) return true;
+    }
+    return false;
+}
+
+// Translations of the periodic images whose bounds intersect the view, the central cell is excluded
+static size_t periodic_image_transforms(ApplicationData* data, mat4_t** transforms) {
+    ASSERT(data);
+    ASSERT(transforms);
+    *transforms = nullptr;
+    const mat3_t& basis = data->mold.mol.unit_cell.basis;
+    if (!data->representation.periodic_images.enabled || basis == mat3_t{0}) return 0;
+
+    const int ext = CLAMP(data->representation.periodic_images.extent, 1, 4);
+    const mat4_t view_proj = data->view.param.matrix.current.proj * data->view.param.matrix.current.view;
+    const vec3_t aabb_min = data->mold.mol_aabb_min;
+    const vec3_t aabb_max = data->mold.mol_aabb_max;
+    for (int k = -ext; k <= ext; ++k) {
+        for (int j = -ext; j <= ext; ++j) {
+            for (int i = -ext; i <= ext; ++i) {
+                if (i == 0 && j == 0 && k == 0) continue;
+                const vec3_t t = basis * vec3_set((float)i, (float)j, (float)k);
+                if (aabb_outside_frustum(view_proj, aabb_min + t, aabb_max + t)) continue;
+                md_array_push(*transforms, mat4_translate(t.x, t.y, t.z), frame_allocator);
+            }
+        }
+    }
+    return md_array_size(*transforms);
+}
+
+// Copies of ops for every image transform, which draw the same buffers translated
+static md_gl_draw_op_t* periodic_image_ops(const md_gl_draw_op_t* ops, size_t num_ops, const mat4_t* transforms, size_t num_transforms) {
+    md_gl_draw_op_t* image_ops = 0;
+    if (num_ops == 0 || num_transforms == 0) return image_ops;
+    md_array_ensure(image_ops, num_ops * num_transforms, frame_allocator);
+    for (size_t t = 0; t < num_transforms; ++t) {
+        for (size_t i = 0; i < num_ops; ++i) {
+            md_gl_draw_op_t op = ops[i];
+            op.model_matrix = &transforms[t].elem[0][0];
+            md_array_push(image_ops, op, frame_allocator);
+        }
+    }
+    return image_ops;
+}
+
 static void draw_representations(ApplicationData* data) {
     ASSERT(data);
 
@@ -10708,10 +19441,21 @@ static void draw_representations(ApplicationData* data) {
         const size_t num_representations = md_array_size(data->representation.reps);
         if (num_representations == 0) return;
 
-        md_gl_draw_op_t* draw_ops = 0;
+        const auto& culling = data->representation.culling;
+        const bool use_lod = culling.active && culling.chunks.num_proxies > 0 && data->representation.lod.num_proxies == culling.chunks.count;
+        const uint32_t in_view = culling.active ? (uint32_t)AtomBit_InView : 0U;
+
+        md_gl_draw_op_t* draw_ops   = 0;    // Drawn with the atoms of chunks in view
+        md_gl_draw_op_t* detail_ops = 0;    // Drawn with the atoms of chunks in view which are not replaced by proxies
+        md_gl_draw_op_t* proxy_ops  = 0;
+        md_gl_draw_op_t* full_ops   = 0;    // All of the above at full detail, for the periodic images
+
+        // The chunk culling and proxies are computed for the central cell, so the images are drawn with all atoms
+        mat4_t* image_transforms = 0;
+        const size_t num_images = periodic_image_transforms(data, &image_transforms);
         for (size_t i = 0; i < num_representations; ++i) {
             const Representation& rep = data->representation.reps[i];
-            if (rep.enabled && rep.type_is_valid) {
+            if (rep.enabled && rep.type_is_valid && rep.type != RepresentationType::Sdf) {
                 md_gl_draw_op_t op = {
                     .type = (md_gl_representation_type_t)rep.type,
                     .args = {},
@@ -10719,26 +19463,57 @@ static void draw_representations(ApplicationData* data) {
                     .model_matrix = NULL,
                 };
                 MEMCPY(&op.args, &rep.scale, sizeof(op.args));
-                md_array_push(draw_ops, op, frame_allocator);
+                const bool lod = use_lod && representation_has_lod(rep.type);
+                if (rep.subset) {
+                    // Drawn from its compacted molecule, with the shaders which tag its picking indices
+                    if (rep.subset->gl_valid) {
+                        op.rep = &rep.subset->gl_rep;
+                        draw_md_gl_ops(data, &op, 1, lod ? (uint32_t)(AtomBit_InView | AtomBit_Detail) : in_view, subset_shaders(data, rep.subset->slot));
+                        if (num_images) {
+                            md_gl_draw_op_t* ops = periodic_image_ops(&op, 1, image_transforms, num_images);
+                            draw_md_gl_ops(data, ops, (uint32_t)md_array_size(ops), 0, subset_shaders(data, rep.subset->slot));
+                        }
+                    }
+                } else if (lod) {
+                    md_array_push(detail_ops, op, frame_allocator);
+                } else {
+                    md_array_push(draw_ops, op, frame_allocator);
+                }
+                if (!rep.subset && num_images) {
+                    md_array_push(full_ops, op, frame_allocator);
+                }
+                if (lod && rep.lod_rep_valid) {
+                    // The proxies of licorice are drawn with the radius of space-fill, as the atoms they replace are bonded
+                    const vec4_t scale = rep.type == RepresentationType::SpaceFill ? rep.scale : vec4_t{1, 1, 1, 1};
+                    op.type = (md_gl_representation_type_t)RepresentationType::SpaceFill;
+                    op.rep = &data->representation.reps[i].lod_rep;
+                    MEMCPY(&op.args, &scale, sizeof(op.args));
+                    md_array_push(proxy_ops, op, frame_allocator);
+                }
             }
         }
 
-        md_gl_draw_args_t args = {
-            .shaders = &data->mold.gl_shaders,
-            .draw_operations = {
-                .count = (uint32_t)md_array_size(draw_ops),
-                .ops = draw_ops,
-            },
-            .view_transform = {
-                .view_matrix = &data->view.param.matrix.current.view.elem[0][0],
-                .projection_matrix = &data->view.param.matrix.current.proj_jittered.elem[0][0],
-                // These two are for temporal anti-aliasing reprojection (optional)
-                .prev_view_matrix = &data->view.param.matrix.previous.view.elem[0][0],
-                .prev_projection_matrix = &data->view.param.matrix.previous.proj_jittered.elem[0][0],
-            },
-        };
+        draw_md_gl_ops(data, draw_ops, (uint32_t)md_array_size(draw_ops), in_view);
+        draw_md_gl_ops(data, detail_ops, (uint32_t)md_array_size(detail_ops), AtomBit_InView | AtomBit_Detail);
+        if (num_images) {
+            md_gl_draw_op_t* ops = periodic_image_ops(full_ops, md_array_size(full_ops), image_transforms, num_images);
+            draw_md_gl_ops(data, ops, (uint32_t)md_array_size(ops), 0);
+        }
+
+        const GLenum draw_buffers[]  = {GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY, GL_COLOR_ATTACHMENT_PICKING, GL_COLOR_ATTACHMENT_POST_TONEMAP};
+        if (md_array_size(proxy_ops) > 0) {
+            // The picking buffer is left untouched, as the indices of the proxies are not indices of atoms
+            const GLenum proxy_buffers[] = {GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY, GL_NONE, GL_COLOR_ATTACHMENT_POST_TONEMAP};
+            glDrawBuffers((int)ARRAY_SIZE(proxy_buffers), proxy_buffers);
+            draw_md_gl_ops(data, proxy_ops, (uint32_t)md_array_size(proxy_ops), AtomBit_InView);
+            glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+        }
 
-        md_gl_draw(&args);
+        // The ray-caster writes color, normal, velocity and picking
+        const GLenum sdf_buffers[]   = {GL_COLOR_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT_NORMAL, GL_COLOR_ATTACHMENT_VELOCITY, GL_COLOR_ATTACHMENT_PICKING, GL_NONE};
+        glDrawBuffers((int)ARRAY_SIZE(sdf_buffers), sdf_buffers);
+        draw_representation_sdfs(data);
+        glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
 #if EXPERIMENTAL_GFX_API
     }
 #endif
@@ -10748,11 +19523,12 @@ static void draw_representations_lean_and_mean(ApplicationData* data, uint32_t m
     md_gl_draw_op_t* draw_ops = 0;
     for (size_t i = 0; i < md_array_size(data->representation.reps); ++i) {
         const Representation& rep = data->representation.reps[i];
-        if (rep.enabled && rep.type_is_valid) {
+        if (rep.enabled && rep.type_is_valid && rep.type != RepresentationType::Sdf) {
+            if (rep.subset && !rep.subset->gl_valid) continue;
             md_gl_draw_op_t op = {
                 .type = (md_gl_representation_type_t)rep.type,
                 .args = {},
-                .rep = &data->representation.reps[i].md_rep,
+                .rep = rep.subset ? &rep.subset->gl_rep : &data->representation.reps[i].md_rep,
                 .model_matrix = NULL,
             };
             MEMCPY(&op.args, &rep.scale, sizeof(op.args));
@@ -10760,8 +19536,18 @@ static void draw_representations_lean_and_mean(ApplicationData* data, uint32_t m
         }
     }
 
+    mat4_t* image_transforms = 0;
+    const size_t num_images = periodic_image_transforms(data, &image_transforms);
+    if (num_images) {
+        const size_t num_ops = md_array_size(draw_ops);
+        md_gl_draw_op_t* image_ops = periodic_image_ops(draw_ops, num_ops, image_transforms, num_images);
+        for (size_t i = 0; i < md_array_size(image_ops); ++i) {
+            md_array_push(draw_ops, image_ops[i], frame_allocator);
+        }
+    }
+
     md_gl_draw_args_t args = {
-        .shaders = &data->mold.gl_shaders_lean_and_mean,
+        .shaders = representation_shaders_lean_and_mean(data),
         .draw_operations = {
             .count = (uint32_t)md_array_size(draw_ops),
             .ops = draw_ops,
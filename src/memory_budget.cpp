@@ -0,0 +1,87 @@
+#include "memory_budget.h"
+
+#include <core/md_common.h>
+#include <core/md_log.h>
+
+struct MemoryConsumer {
+    uint32_t id;
+    const char* name;
+    MemoryPriority priority;
+    MemoryUsageFn usage_fn;
+    MemoryReleaseFn release_fn;
+    void* user_data;
+    size_t usage;               // As of the last enforce
+};
+
+static struct {
+    MemoryConsumer consumers[MEMORY_BUDGET_MAX_CONSUMERS];
+    size_t num_consumers = 0;
+    uint32_t next_id = 1;
+    size_t budget = 0;
+} ctx;
+
+uint32_t memory_budget_register(const char* name, MemoryPriority priority, MemoryUsageFn usage, MemoryReleaseFn release, void* user_data) {
+    ASSERT(name);
+    ASSERT(usage);
+    if (ctx.num_consumers == ARRAY_SIZE(ctx.consumers)) {
+        MD_LOG_ERROR("Memory budget: Too many consumers, '%s' is not accounted for", name);
+        return 0;
+    }
+    MemoryConsumer& c = ctx.consumers[ctx.num_consumers++];
+    c = {ctx.next_id++, name, priority, usage, release, user_data, 0};
+    return c.id;
+}
+
+void memory_budget_unregister(uint32_t id) {
+    for (size_t i = 0; i < ctx.num_consumers; ++i) {
+        if (ctx.consumers[i].id == id) {
+            // The order is kept, as consumers of the same priority are asked in the order they were registered
+            for (size_t j = i + 1; j < ctx.num_consumers; ++j) {
+                ctx.consumers[j - 1] = ctx.consumers[j];
+            }
+            ctx.num_consumers -= 1;
+            return;
+        }
+    }
+}
+
+void memory_budget_set(size_t bytes) {
+    ctx.budget = bytes;
+}
+
+size_t memory_budget_get() {
+    return ctx.budget;
+}
+
+size_t memory_budget_enforce() {
+    size_t total = 0;
+    for (size_t i = 0; i < ctx.num_consumers; ++i) {
+        MemoryConsumer& c = ctx.consumers[i];
+        c.usage = c.usage_fn(c.user_data);
+        total += c.usage;
+    }
+    if (!ctx.budget || total <= ctx.budget) return total;
+
+    for (int prio = MemoryPriority_Cache; prio <= MemoryPriority_Analysis && total > ctx.budget; ++prio) {
+        for (size_t i = 0; i < ctx.num_consumers && total > ctx.budget; ++i) {
+            MemoryConsumer& c = ctx.consumers[i];
+            if (c.priority != prio || !c.release_fn || !c.usage) continue;
+            const size_t released = MIN(c.release_fn(total - ctx.budget, c.user_data), c.usage);
+            if (released) {
+                MD_LOG_DEBUG("Memory budget: '%s' released %.1f MB", c.name, (double)released / (1024.0 * 1024.0));
+            }
+            c.usage -= released;
+            total -= released;
+        }
+    }
+    return total;
+}
+
+size_t memory_budget_stats(MemoryConsumerStats* out, size_t cap) {
+    const size_t count = MIN(cap, ctx.num_consumers);
+    for (size_t i = 0; i < count; ++i) {
+        const MemoryConsumer& c = ctx.consumers[i];
+        out[i] = {c.name, c.usage, c.priority, c.release_fn != NULL};
+    }
+    return count;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Central memory budget over the caches and analysis buffers of the application
+// Each subsystem registers a consumer which reports its usage, and optionally releases memory when asked to (evicting cached data or
+// switching to a smaller storage). memory_budget_enforce sums the usage of all consumers and, if that exceeds the budget, asks the consumers
+// to release the excess in the order of their priority. Consumers without a release callback are accounted for but never asked.
+// All functions are called from the main thread, the callbacks are invoked from within them.
+
+#define MEMORY_BUDGET_MAX_CONSUMERS 32
+
+// Consumers are asked to release memory from the lowest priority up
+enum MemoryPriority {
+    MemoryPriority_Cache = 0,       // Data which is recomputed or reloaded on demand
+    MemoryPriority_Derived,         // Data which is costly to recompute
+    MemoryPriority_Analysis,        // Results which are only released if nothing else is left
+};
+
+typedef size_t (*MemoryUsageFn)(void* user_data);
+// Asked to release at least bytes, returns the number of bytes which were released
+typedef size_t (*MemoryReleaseFn)(size_t bytes, void* user_data);
+
+struct MemoryConsumerStats {
+    const char* name;
+    size_t usage;
+    MemoryPriority priority;
+    bool releasable;
+};
+
+// Returns an id for unregistering the consumer, 0 if there is no room for it
+uint32_t memory_budget_register(const char* name, MemoryPriority priority, MemoryUsageFn usage, MemoryReleaseFn release, void* user_data);
+void memory_budget_unregister(uint32_t id);
+
+// 0 disables the budget
+void   memory_budget_set(size_t bytes);
+size_t memory_budget_get();
+
+// Releases memory until the total usage fits in the budget (or nothing more can be released), returns the total usage
+size_t memory_budget_enforce();
+
+// Usage of the registered consumers as of the last call to memory_budget_enforce, returns the number written to out
+size_t memory_budget_stats(MemoryConsumerStats* out, size_t cap);
@@ -0,0 +1,118 @@
+#include "memory_tracker.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <atomic>
+
+struct MemoryTracker {
+    std::atomic<int64_t>  current{0};
+    std::atomic<int64_t>  peak{0};
+    std::atomic<uint64_t> allocated{0};    // Total bytes allocated, never decreases
+    std::atomic<uint64_t> num_allocs{0};
+
+    // Sampled by memory_tracker_update
+    uint64_t last_allocated = 0;
+    uint64_t last_num_allocs = 0;
+    double bytes_per_sec = 0;
+    double allocs_per_sec = 0;
+};
+
+static const char* tracker_names[MemoryTracker_Count] = {
+    "Loader Cache",
+    "Molecule",
+    "Trajectory",
+    "Script Evaluation",
+    "Representations",
+    "Frame Scratch",
+    "GL Buffers (estimated)",
+    "GL Textures (estimated)",
+};
+
+static MemoryTracker trackers[MemoryTracker_Count];
+static md_allocator_i allocators[MemoryTracker_Count];
+static md_allocator_i* backing_allocator = NULL;
+static md_timestamp_t last_sample = 0;
+
+static void tracker_account(MemoryTracker* t, int64_t delta, bool new_alloc) {
+    if (new_alloc) t->num_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (delta > 0) t->allocated.fetch_add((uint64_t)delta, std::memory_order_relaxed);
+    const int64_t current = t->current.fetch_add(delta, std::memory_order_relaxed) + delta;
+    int64_t peak = t->peak.load(std::memory_order_relaxed);
+    while (current > peak && !t->peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+}
+
+static void* tracked_realloc(struct md_allocator_o* inst, void* ptr, size_t old_size, size_t new_size, const char* file, size_t line) {
+    MemoryTracker* t = (MemoryTracker*)inst;
+    md_allocator_i* backing = backing_allocator ? backing_allocator : md_heap_allocator;
+    void* result = backing->realloc(backing->inst, ptr, old_size, new_size, file, line);
+    if (result || new_size == 0) {
+        tracker_account(t, (int64_t)new_size - (int64_t)old_size, !ptr && new_size > 0);
+    }
+    return result;
+}
+
+void memory_tracker_init(md_allocator_i* backing) {
+    backing_allocator = backing;
+    last_sample = md_time_current();
+}
+
+md_allocator_i* memory_tracker_allocator(MemoryTrackerId id) {
+    ASSERT(0 <= id && id < MemoryTracker_Count);
+    md_allocator_i* a = &allocators[id];
+    if (!a->realloc) {
+        // The instance is the same every time, so a racing initialization writes the same values
+        a->inst = (struct md_allocator_o*)&trackers[id];
+        a->realloc = tracked_realloc;
+    }
+    return a;
+}
+
+void memory_tracker_set(MemoryTrackerId id, size_t bytes) {
+    ASSERT(0 <= id && id < MemoryTracker_Count);
+    MemoryTracker* t = &trackers[id];
+    const int64_t delta = (int64_t)bytes - t->current.load(std::memory_order_relaxed);
+    if (delta) tracker_account(t, delta, delta > 0);
+}
+
+void memory_tracker_update() {
+    const md_timestamp_t now = md_time_current();
+    const double dt = md_time_as_seconds(now - last_sample);
+    if (dt < MEMORY_TRACKER_SAMPLE_INTERVAL) return;
+    last_sample = now;
+
+    for (int i = 0; i < MemoryTracker_Count; ++i) {
+        MemoryTracker& t = trackers[i];
+        const uint64_t allocated  = t.allocated.load(std::memory_order_relaxed);
+        const uint64_t num_allocs = t.num_allocs.load(std::memory_order_relaxed);
+        t.bytes_per_sec  = (double)(allocated  - t.last_allocated)  / dt;
+        t.allocs_per_sec = (double)(num_allocs - t.last_num_allocs) / dt;
+        t.last_allocated  = allocated;
+        t.last_num_allocs = num_allocs;
+    }
+}
+
+void memory_tracker_stats(MemoryTrackerStats out[MemoryTracker_Count]) {
+    for (int i = 0; i < MemoryTracker_Count; ++i) {
+        const MemoryTracker& t = trackers[i];
+        out[i].name = tracker_names[i];
+        out[i].current = (size_t)MAX(0, t.current.load(std::memory_order_relaxed));
+        out[i].peak = (size_t)MAX(0, t.peak.load(std::memory_order_relaxed));
+        out[i].num_allocs = t.num_allocs.load(std::memory_order_relaxed);
+        out[i].bytes_per_sec = t.bytes_per_sec;
+        out[i].allocs_per_sec = t.allocs_per_sec;
+    }
+}
+
+void memory_tracker_log() {
+    MemoryTrackerStats stats[MemoryTracker_Count];
+    memory_tracker_stats(stats);
+    const double mb = 1024.0 * 1024.0;
+    for (int i = 0; i < MemoryTracker_Count; ++i) {
+        const MemoryTrackerStats& s = stats[i];
+        MD_LOG_INFO("Memory: %-24s current %9.1f MB, peak %9.1f MB, %llu allocations, %.1f MB/s",
+            s.name, s.current / mb, s.peak / mb, (unsigned long long)s.num_allocs, s.bytes_per_sec / mb);
+    }
+}
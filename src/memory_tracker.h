@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct md_allocator_i;
+
+// Memory accounting per subsystem, in release builds as well as debug builds
+// Each subsystem allocates through its own allocator which counts the current and peak number of bytes as well as the bytes allocated over
+// time and forwards to the backing allocator. Memory which is not allocated on the heap (GL buffers and textures) is accounted for by setting
+// an estimate of its size. The allocators are thread safe, the remaining functions are called from the main thread.
+
+enum MemoryTrackerId {
+    MemoryTracker_LoaderCache = 0,
+    MemoryTracker_Molecule,
+    MemoryTracker_Trajectory,
+    MemoryTracker_ScriptEval,
+    MemoryTracker_Representations,
+    MemoryTracker_FrameScratch,     // Frame arena and scratch slots (see frame_arena.h)
+    MemoryTracker_GLBuffers,        // Estimated VRAM
+    MemoryTracker_GLTextures,       // Estimated VRAM
+    MemoryTracker_Count
+};
+
+struct MemoryTrackerStats {
+    const char* name;
+    size_t current;
+    size_t peak;
+    uint64_t num_allocs;
+    double bytes_per_sec;    // Bytes allocated per second over the last sample interval
+    double allocs_per_sec;
+};
+
+// Sets the allocator the tracked allocators forward to (md_heap_allocator if not set)
+// Must be called before any allocation is made through them
+void memory_tracker_init(md_allocator_i* backing);
+
+md_allocator_i* memory_tracker_allocator(MemoryTrackerId id);
+
+// Sets the current usage of a subsystem which does not allocate through its allocator
+void memory_tracker_set(MemoryTrackerId id, size_t bytes);
+
+// Samples the allocation rates, at most once per MEMORY_TRACKER_SAMPLE_INTERVAL seconds
+#define MEMORY_TRACKER_SAMPLE_INTERVAL 1.0
+void memory_tracker_update();
+
+void memory_tracker_stats(MemoryTrackerStats out[MemoryTracker_Count]);
+
+// Writes the stats of all subsystems to the log
+void memory_tracker_log();
@@ -0,0 +1,189 @@
+#include "mol_postprocess.h"
+#include "cell_list.h"
+
+#include <md_molecule.h>
+#include <md_util.h>
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+
+#include <string.h>
+
+#define BOND_BLOCK_SIZE 16384
+
+// Stages of md_util_molecule_postprocess which read the bonds
+#define BOND_STAGES (MD_UTIL_POSTPROCESS_BOND_BIT | MD_UTIL_POSTPROCESS_CONNECTIVITY_BIT | MD_UTIL_POSTPROCESS_STRUCTURE_BIT)
+
+struct BondBlock {
+    md_array(md_bond_pair_t) pairs;
+};
+
+struct PostprocessGraph {
+    md_molecule_t* mol;
+    md_allocator_i* alloc;
+    md_util_postprocess_flags_t flags;
+
+    CellList grid;
+    float* cov_radius;      // Covalent radius of each atom, from the elements assigned by the first stage
+    float max_cov_radius;
+    BondBlock* blocks;
+    uint32_t num_blocks;
+};
+
+static void serial_task(void* user_data) {
+    PostprocessGraph* g = (PostprocessGraph*)user_data;
+    md_util_molecule_postprocess(g->mol, g->alloc, g->flags);
+    md_free(md_heap_allocator, g, sizeof(PostprocessGraph));
+}
+
+// Only depends on the coordinates, so it runs alongside the first stage
+static void grid_task(void* user_data) {
+    PostprocessGraph* g = (PostprocessGraph*)user_data;
+    const md_molecule_t* mol = g->mol;
+    const vec3_t pbc_ext = mol->unit_cell.basis * vec3_set1(1);
+    cell_list_build(&g->grid, mol->atom.x, mol->atom.y, mol->atom.z, mol->atom.count, pbc_ext, CELL_LIST_DEFAULT_CELL_SIZE, md_heap_allocator);
+}
+
+static void attribute_task(void* user_data) {
+    PostprocessGraph* g = (PostprocessGraph*)user_data;
+    md_util_molecule_postprocess(g->mol, g->alloc, g->flags & ~BOND_STAGES);
+
+    const md_molecule_t* mol = g->mol;
+    g->max_cov_radius = 0;
+    for (size_t i = 0; i < mol->atom.count; ++i) {
+        g->cov_radius[i] = mol->atom.element ? md_util_element_covalent_radius(mol->atom.element[i]) : 0.0f;
+        g->max_cov_radius = MAX(g->max_cov_radius, g->cov_radius[i]);
+    }
+}
+
+struct BondQuery {
+    const PostprocessGraph* g;
+    BondBlock* block;
+    uint32_t atom;
+};
+
+// Two atoms are bonded if their distance is within [d - 0.5, d + 0.3] where d is the sum of their covalent radii
+static bool bond_query_fn(uint32_t idx, float dist2, void* user_data) {
+    BondQuery* q = (BondQuery*)user_data;
+    if (idx <= q->atom) return true;
+    const float d = q->g->cov_radius[q->atom] + q->g->cov_radius[idx];
+    const float d_min = d - 0.5f;
+    const float d_max = d + 0.3f;
+    if (d_min * d_min < dist2 && dist2 < d_max * d_max) {
+        md_bond_pair_t pair = {};
+        pair.idx[0] = (md_atom_idx_t)q->atom;
+        pair.idx[1] = (md_atom_idx_t)idx;
+        md_array_push(q->block->pairs, pair, md_heap_allocator);
+    }
+    return true;
+}
+
+// Each block holds the bonds of its atoms to atoms with a higher index, so concatenating the blocks in order gives the pairs sorted by their first atom
+static void bond_task(uint32_t beg, uint32_t end, void* user_data) {
+    PostprocessGraph* g = (PostprocessGraph*)user_data;
+    const md_molecule_t* mol = g->mol;
+    for (uint32_t b = beg; b < end; ++b) {
+        BondBlock* block = &g->blocks[b];
+        const uint32_t atom_beg = b * BOND_BLOCK_SIZE;
+        const uint32_t atom_end = (uint32_t)MIN((size_t)atom_beg + BOND_BLOCK_SIZE, mol->atom.count);
+        BondQuery q = {g, block, 0};
+        for (uint32_t i = atom_beg; i < atom_end; ++i) {
+            if (g->cov_radius[i] == 0.0f) continue;
+            q.atom = i;
+            const vec3_t pos = {mol->atom.x[i], mol->atom.y[i], mol->atom.z[i]};
+            // The pairs of the atom sorted by their second index, the cell list visits them in the order of the grid
+            const size_t first = md_array_size(block->pairs);
+            cell_list_query_radius(&g->grid, pos, g->cov_radius[i] + g->max_cov_radius + 0.3f, bond_query_fn, &q);
+            const size_t count = md_array_size(block->pairs) - first;
+            md_bond_pair_t* pairs = block->pairs + first;
+            for (size_t j = 1; j < count; ++j) {
+                const md_bond_pair_t p = pairs[j];
+                size_t k = j;
+                while (k > 0 && pairs[k - 1].idx[1] > p.idx[1]) {
+                    pairs[k] = pairs[k - 1];
+                    --k;
+                }
+                pairs[k] = p;
+            }
+        }
+    }
+}
+
+static void bond_stage_task(void* user_data) {
+    PostprocessGraph* g = (PostprocessGraph*)user_data;
+    md_molecule_t* mol = g->mol;
+    md_allocator_i* alloc = g->alloc;
+
+    size_t num_bonds = 0;
+    for (uint32_t b = 0; b < g->num_blocks; ++b) {
+        num_bonds += md_array_size(g->blocks[b].pairs);
+    }
+
+    md_array_shrink(mol->bond.pairs, 0);
+    md_array_resize(mol->bond.pairs, num_bonds, alloc);
+    md_array_resize(mol->bond.order, num_bonds, alloc);
+    md_array_resize(mol->bond.flags, num_bonds, alloc);
+    size_t offset = 0;
+    for (uint32_t b = 0; b < g->num_blocks; ++b) {
+        const size_t count = md_array_size(g->blocks[b].pairs);
+        MEMCPY(mol->bond.pairs + offset, g->blocks[b].pairs, count * sizeof(md_bond_pair_t));
+        offset += count;
+    }
+    for (size_t i = 0; i < num_bonds; ++i) {
+        mol->bond.order[i] = 1;
+    }
+    MEMSET(mol->bond.flags, 0, md_array_bytes(mol->bond.flags));
+    mol->bond.count = num_bonds;
+
+    // The bonds are already there, so only the stages which depend on them are left
+    md_util_molecule_postprocess(mol, alloc, g->flags & (BOND_STAGES & ~MD_UTIL_POSTPROCESS_BOND_BIT));
+
+    for (uint32_t b = 0; b < g->num_blocks; ++b) {
+        md_array_free(g->blocks[b].pairs, md_heap_allocator);
+    }
+    md_free(md_heap_allocator, g->blocks, sizeof(BondBlock) * g->num_blocks);
+    md_free(md_heap_allocator, g->cov_radius, sizeof(float) * mol->atom.count);
+    cell_list_free(&g->grid);
+    md_free(md_heap_allocator, g, sizeof(PostprocessGraph));
+}
+
+task_system::ID mol_postprocess_enqueue(md_molecule_t* mol, md_allocator_i* alloc, uint32_t flags) {
+    ASSERT(mol);
+    ASSERT(alloc);
+    PostprocessGraph* g = (PostprocessGraph*)md_alloc(md_heap_allocator, sizeof(PostprocessGraph));
+    PLACEMENT_NEW(g) PostprocessGraph();
+    g->mol = mol;
+    g->alloc = alloc;
+    g->flags = (md_util_postprocess_flags_t)flags;
+
+    // Bonds given by the file (e.g. CONECT records) are left to md_util_molecule_postprocess, which completes them
+    const bool parallel = (flags & MD_UTIL_POSTPROCESS_BOND_BIT) && flags != MD_UTIL_POSTPROCESS_COARSE_GRAINED && mol->atom.count >= MOL_POSTPROCESS_PARALLEL_MIN_ATOMS && md_array_size(mol->bond.pairs) == 0;
+    if (!parallel) {
+        const task_system::ID id = task_system::pool_enqueue(STR("##Postprocess Molecule"), serial_task, g, 0, task_system::Priority_Interactive);
+        task_system::execute_task(id);
+        return id;
+    }
+
+    const size_t count = mol->atom.count;
+    g->cov_radius = (float*)md_alloc(md_heap_allocator, sizeof(float) * count);
+    g->num_blocks = (uint32_t)((count + BOND_BLOCK_SIZE - 1) / BOND_BLOCK_SIZE);
+    g->blocks = (BondBlock*)md_alloc(md_heap_allocator, sizeof(BondBlock) * g->num_blocks);
+    MEMSET(g->blocks, 0, sizeof(BondBlock) * g->num_blocks);
+
+    const task_system::ID grid = task_system::pool_enqueue(STR("##Postprocess Grid"), grid_task, g, 0, task_system::Priority_Interactive);
+    const task_system::ID attr = task_system::pool_enqueue(STR("##Postprocess Attributes"), attribute_task, g, 0, task_system::Priority_Interactive);
+    const task_system::ID deps[2] = {grid, attr};
+    const task_system::ID bonds = task_system::pool_enqueue(STR("##Postprocess Bonds"), 0, g->num_blocks, bond_task, g, deps, ARRAY_SIZE(deps), task_system::Priority_Interactive);
+    const task_system::ID done = task_system::pool_enqueue(STR("##Postprocess Bond Stages"), bond_stage_task, g, bonds, task_system::Priority_Interactive);
+
+    // The rest of the graph is launched by the scheduler as the first stages complete
+    task_system::execute_task(grid);
+    task_system::execute_task(attr);
+    return done;
+}
+
+void mol_postprocess(md_molecule_t* mol, md_allocator_i* alloc, uint32_t flags) {
+    task_system::ID id = mol_postprocess_enqueue(mol, alloc, flags);
+    task_system::task_wait_for(id);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <task_system.h>
+
+struct md_allocator_i;
+struct md_molecule_t;
+
+// md_util_molecule_postprocess as a graph of tasks on the pool
+// Covalent bonds are detected in parallel over blocks of atoms using a cell list, which is built while md_util_molecule_postprocess runs the
+// stages that do not depend on bonds (elements, radii, residues, chains, backbone). The stages that need the bonds (connectivity, structures
+// and rings) run once they are done. The stages which write to the molecule share its allocator, so they never run concurrently.
+// Small molecules, molecules with bonds from the file and coarse-grained postprocessing run md_util_molecule_postprocess as a single task.
+
+#define MOL_POSTPROCESS_PARALLEL_MIN_ATOMS 100000
+
+// The stages are launched immediately, returns the task which completes when the molecule is done. The molecule must not be accessed before then
+task_system::ID mol_postprocess_enqueue(md_molecule_t* mol, md_allocator_i* alloc, uint32_t flags);
+
+// Enqueues the stages and waits for them
+void mol_postprocess(md_molecule_t* mol, md_allocator_i* alloc, uint32_t flags);
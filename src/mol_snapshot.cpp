@@ -0,0 +1,164 @@
+#include "mol_snapshot.h"
+#include "eval_cache.h"
+#include "script_fingerprint.h"
+
+#include <md_molecule.h>
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#define MOL_SNAPSHOT_MAGIC   0x534D4D56   // 'VMMS'
+#define MOL_SNAPSHOT_VERSION 1
+
+// Scalar counts of the molecule
+#define MOL_SNAPSHOT_COUNTS(X) \
+    X(atom.count) X(residue.count) X(chain.count) X(bond.count) X(backbone.count) X(backbone.range_count) X(instance.count)
+
+// md_arrays of the molecule, stored with their length
+#define MOL_SNAPSHOT_ARRAYS(X) \
+    X(atom.x) X(atom.y) X(atom.z) X(atom.radius) X(atom.mass) X(atom.valence) X(atom.element) X(atom.type) X(atom.res_idx) X(atom.chain_idx) X(atom.flags) \
+    X(residue.name) X(residue.id) X(residue.atom_offset) X(residue.flags) \
+    X(chain.id) X(chain.res_range) X(chain.atom_range) \
+    X(bond.pairs) X(bond.order) X(bond.flags) \
+    X(conn.index) X(conn.order) X(conn.flags) \
+    X(backbone.range) X(backbone.atoms) X(backbone.angle) X(backbone.secondary_structure) X(backbone.ramachandran_type) X(backbone.residue_idx) \
+    X(structures.offsets) X(structures.indices) X(rings.offsets) X(rings.indices) \
+    X(instance.atom_range) X(instance.transform)
+
+// Arrays with a count of their own
+#define MOL_SNAPSHOT_SPANS(X) \
+    X(hydrogen.donor) X(hydrogen.acceptor)
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout;    // Element sizes of the arrays, snapshots are discarded if they do not match
+    uint32_t _pad;
+    uint64_t key;
+};
+
+static uint32_t layout_hash() {
+    const md_molecule_t* mol = 0;
+#define ELEM_SIZE(field) (uint64_t)sizeof(*mol->field),
+#define SPAN_ELEM_SIZE(field) (uint64_t)sizeof(*mol->field.data),
+    const uint64_t sizes[] = {
+        MOL_SNAPSHOT_ARRAYS(ELEM_SIZE)
+        MOL_SNAPSHOT_SPANS(SPAN_ELEM_SIZE)
+        (uint64_t)sizeof(mol->unit_cell),
+    };
+#undef ELEM_SIZE
+#undef SPAN_ELEM_SIZE
+    return (uint32_t)script_hash(sizes, sizeof(sizes));
+}
+
+uint64_t mol_snapshot_key(str_t src_path, uint32_t postprocess_flags) {
+    const uint64_t identity = eval_cache_file_identity(src_path);
+    if (!identity) return 0;
+    const uint64_t h[3] = {identity, postprocess_flags, MOL_SNAPSHOT_VERSION};
+    return script_hash(h, sizeof(h));
+}
+
+static bool write_block(md_file_o* file, const void* ptr, uint64_t len, size_t elem_size) {
+    const size_t bytes = (size_t)len * elem_size;
+    bool ok = md_file_write(file, &len, sizeof(len)) == sizeof(len);
+    if (ok && bytes) {
+        ok = md_file_write(file, ptr, bytes) == bytes;
+    }
+    return ok;
+}
+
+bool mol_snapshot_write(str_t path, const md_molecule_t* mol, uint64_t key) {
+    ASSERT(mol);
+    if (!key) return false;
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open molecule snapshot '%.*s' for writing", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    const SnapshotHeader hdr = {MOL_SNAPSHOT_MAGIC, MOL_SNAPSHOT_VERSION, layout_hash(), 0, key};
+    bool ok = md_file_write(file, &hdr, sizeof(hdr)) == sizeof(hdr);
+    ok = ok && md_file_write(file, &mol->unit_cell, sizeof(mol->unit_cell)) == sizeof(mol->unit_cell);
+
+#define WRITE_COUNT(field) { const uint64_t count = (uint64_t)mol->field; ok = ok && md_file_write(file, &count, sizeof(count)) == sizeof(count); }
+#define WRITE_ARRAY(field) ok = ok && write_block(file, mol->field, md_array_size(mol->field), sizeof(*mol->field));
+#define WRITE_SPAN(field)  ok = ok && write_block(file, mol->field.data, mol->field.data ? (uint64_t)mol->field.count : 0, sizeof(*mol->field.data));
+    MOL_SNAPSHOT_COUNTS(WRITE_COUNT)
+    MOL_SNAPSHOT_ARRAYS(WRITE_ARRAY)
+    MOL_SNAPSHOT_SPANS(WRITE_SPAN)
+#undef WRITE_COUNT
+#undef WRITE_ARRAY
+#undef WRITE_SPAN
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write molecule snapshot '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
+
+// Reads the length of the next block, which has to fit within the remaining bytes of the file
+static bool read_length(md_file_o* file, uint64_t* len, size_t elem_size, size_t* remaining) {
+    if (*remaining < sizeof(uint64_t) || md_file_read(file, len, sizeof(uint64_t)) != sizeof(uint64_t)) return false;
+    *remaining -= sizeof(uint64_t);
+    if (elem_size && *len > *remaining / elem_size) return false;
+    *remaining -= (size_t)*len * elem_size;
+    return true;
+}
+
+bool mol_snapshot_read(str_t path, md_molecule_t* mol, uint64_t key, md_allocator_i* alloc) {
+    ASSERT(mol);
+    ASSERT(alloc);
+    if (!key) return false;
+
+    md_file_o* file = md_file_open(path, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+    defer { md_file_close(file); };
+
+    size_t remaining = (size_t)md_file_size(file);
+    SnapshotHeader hdr = {};
+    if (remaining < sizeof(hdr) + sizeof(mol->unit_cell) || md_file_read(file, &hdr, sizeof(hdr)) != sizeof(hdr)) return false;
+    if (hdr.magic != MOL_SNAPSHOT_MAGIC || hdr.version != MOL_SNAPSHOT_VERSION || hdr.layout != layout_hash() || hdr.key != key) return false;
+    remaining -= sizeof(hdr);
+
+    md_molecule_t tmp = {};
+    bool ok = md_file_read(file, &tmp.unit_cell, sizeof(tmp.unit_cell)) == sizeof(tmp.unit_cell);
+    remaining -= sizeof(tmp.unit_cell);
+
+    // The arrays are read straight into the allocator of the molecule without an intermediate copy
+#define READ_COUNT(field) { uint64_t count = 0; ok = ok && read_length(file, &count, 0, &remaining); tmp.field = count; }
+#define READ_ARRAY(field) { \
+        uint64_t len = 0; \
+        ok = ok && read_length(file, &len, sizeof(*tmp.field), &remaining); \
+        if (ok && len) { \
+            md_array_resize(tmp.field, (size_t)len, alloc); \
+            ok = md_file_read(file, tmp.field, md_array_bytes(tmp.field)) == md_array_bytes(tmp.field); \
+        } \
+    }
+#define READ_SPAN(field) { \
+        uint64_t len = 0; \
+        ok = ok && read_length(file, &len, sizeof(*tmp.field.data), &remaining); \
+        if (ok && len) { \
+            md_array_resize(tmp.field.data, (size_t)len, alloc); \
+            ok = md_file_read(file, tmp.field.data, md_array_bytes(tmp.field.data)) == md_array_bytes(tmp.field.data); \
+            tmp.field.count = len; \
+        } \
+    }
+    MOL_SNAPSHOT_COUNTS(READ_COUNT)
+    MOL_SNAPSHOT_ARRAYS(READ_ARRAY)
+    MOL_SNAPSHOT_SPANS(READ_SPAN)
+#undef READ_COUNT
+#undef READ_ARRAY
+#undef READ_SPAN
+
+    if (!ok || tmp.atom.count == 0 || md_array_size(tmp.atom.x) != tmp.atom.count) {
+        MD_LOG_ERROR("Molecule snapshot '%.*s' is truncated or corrupt", (int)path.len, path.ptr);
+        return false;
+    }
+
+    *mol = tmp;
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_str.h>
+
+struct md_allocator_i;
+struct md_molecule_t;
+
+// On-disk snapshot of a molecule after md_util_molecule_postprocess, which restores it without parsing the file and running the postprocess again
+// The arrays of the molecule are stored as raw bytes, each one with its length, and are read straight into arrays of the allocator of the molecule.
+// A snapshot is only restored if its key and the element sizes of the arrays match, so it follows the version of mdlib we are built against.
+
+// Smaller molecules are parsed faster than a snapshot is written, so they are not worth caching
+#define MOL_SNAPSHOT_MIN_ATOMS 100000
+
+// Key of the snapshot of a file for a set of postprocess flags, 0 if the file does not exist
+uint64_t mol_snapshot_key(str_t src_path, uint32_t postprocess_flags);
+
+bool mol_snapshot_write(str_t path, const md_molecule_t* mol, uint64_t key);
+
+// Returns false on a miss which leaves mol untouched, the arrays of a snapshot which fails part way stay in alloc until it is reset
+bool mol_snapshot_read(str_t path, md_molecule_t* mol, uint64_t key, md_allocator_i* alloc);
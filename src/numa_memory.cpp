@@ -0,0 +1,176 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "numa_memory.h"
+
+#include <core/md_common.h>
+#include <core/md_log.h>
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// From numaif.h, which would add a dependency on libnuma for two syscalls
+#define NUMA_MPOL_BIND       2
+#define NUMA_MPOL_INTERLEAVE 3
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static std::atomic_uint32_t num_nodes = 0;
+
+static inline size_t page_size(bool huge_pages) {
+    if (huge_pages) return NUMA_HUGE_PAGE_SIZE;
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+uint32_t numa_num_nodes() {
+    uint32_t n = num_nodes.load(std::memory_order_relaxed);
+    if (n) return n;
+    n = 1;
+#if defined(_WIN32)
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest)) n = (uint32_t)highest + 1;
+#elif defined(__linux__)
+    // A list of ranges, e.g. "0-1" or "0,2-3"
+    if (FILE* file = fopen("/sys/devices/system/node/online", "r")) {
+        char buf[256] = {0};
+        if (fgets(buf, sizeof(buf), file)) {
+            for (const char* c = buf; *c; ++c) {
+                if ('0' <= *c && *c <= '9' && (c == buf || c[-1] < '0' || c[-1] > '9')) {
+                    n = MAX(n, (uint32_t)atoi(c) + 1);
+                }
+            }
+        }
+        fclose(file);
+    }
+#endif
+    n = CLAMP(n, 1U, (uint32_t)NUMA_MAX_NODES);
+    num_nodes.store(n, std::memory_order_relaxed);
+    return n;
+}
+
+uint32_t numa_current_node() {
+    uint32_t node = 0;
+#if defined(_WIN32)
+    PROCESSOR_NUMBER proc;
+    USHORT win_node = 0;
+    GetCurrentProcessorNumberEx(&proc);
+    if (GetNumaProcessorNodeEx(&proc, &win_node)) node = win_node;
+#elif defined(__linux__)
+    unsigned cpu = 0;
+    unsigned cpu_node = 0;
+    if (syscall(SYS_getcpu, &cpu, &cpu_node, NULL) == 0) node = cpu_node;
+#endif
+    return MIN(node, numa_num_nodes() - 1);
+}
+
+size_t numa_partition_size(size_t size, bool huge_pages) {
+    const size_t page = page_size(huge_pages);
+    const size_t n = numa_num_nodes();
+    return ALIGN_TO((ALIGN_TO(size, page) + n - 1) / n, page);
+}
+
+#if defined(__linux__)
+static bool bind_range(char* ptr, size_t size, int mode, uint64_t node_mask) {
+    const unsigned long mask = (unsigned long)node_mask;
+    // The kernel reads one bit less than maxnode
+    return syscall(SYS_mbind, ptr, size, mode, &mask, (unsigned long)numa_num_nodes() + 1, 0) == 0;
+}
+#endif
+
+void* numa_alloc(size_t size, bool huge_pages, NumaPolicy policy) {
+    if (size == 0) return NULL;
+    const size_t page = page_size(huge_pages);
+    const size_t map_size = ALIGN_TO(size, page);
+    const uint32_t nodes = numa_num_nodes();
+    char* ptr = NULL;
+
+#if defined(_WIN32)
+    if (huge_pages) {
+        // Requires the 'Lock pages in memory' privilege, large pages are committed as a whole so they are not placed
+        ptr = (char*)VirtualAlloc(NULL, map_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (ptr) return ptr;
+        MD_LOG_DEBUG("Large pages are not available, using regular pages");
+    }
+    ptr = (char*)VirtualAlloc(NULL, map_size, MEM_RESERVE, PAGE_READWRITE);
+    if (!ptr) return NULL;
+    const size_t chunk = policy == NumaPolicy_Partition ? numa_partition_size(size, huge_pages) : policy == NumaPolicy_Interleave ? NUMA_HUGE_PAGE_SIZE : map_size;
+    for (size_t offset = 0, i = 0; offset < map_size; offset += chunk, ++i) {
+        const size_t len = MIN(chunk, map_size - offset);
+        const bool placed = policy != NumaPolicy_FirstTouch && nodes > 1;
+        void* res = placed ? VirtualAllocExNuma(GetCurrentProcess(), ptr + offset, len, MEM_COMMIT, PAGE_READWRITE, (DWORD)(i % nodes)) : VirtualAlloc(ptr + offset, len, MEM_COMMIT, PAGE_READWRITE);
+        if (!res) {
+            VirtualFree(ptr, 0, MEM_RELEASE);
+            return NULL;
+        }
+    }
+    return ptr;
+#else
+#if defined(__linux__)
+    if (huge_pages) {
+        // Explicit huge pages fail at mapping if the pool does not hold enough of them, transparent huge pages are the fallback
+        ptr = (char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) ptr = NULL;
+    }
+#endif
+    if (!ptr) {
+        ptr = (char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) return NULL;
+#if defined(MADV_HUGEPAGE)
+        if (huge_pages && madvise(ptr, map_size, MADV_HUGEPAGE) != 0) {
+            MD_LOG_DEBUG("Transparent huge pages are not available, using regular pages");
+        }
+#endif
+    }
+
+#if defined(__linux__)
+    // The pages are not touched yet, so the policy decides where they are placed
+    if (nodes > 1 && policy == NumaPolicy_Interleave) {
+        const uint64_t all_nodes = nodes == 64 ? ~0ULL : (1ULL << nodes) - 1;
+        if (!bind_range(ptr, map_size, NUMA_MPOL_INTERLEAVE, all_nodes)) {
+            MD_LOG_DEBUG("Failed to interleave memory over %u nodes", nodes);
+        }
+    } else if (nodes > 1 && policy == NumaPolicy_Partition) {
+        const size_t part = numa_partition_size(size, huge_pages);
+        for (uint32_t i = 0; i < nodes && (size_t)i * part < map_size; ++i) {
+            const size_t offset = (size_t)i * part;
+            if (!bind_range(ptr + offset, MIN(part, map_size - offset), NUMA_MPOL_BIND, 1ULL << i)) {
+                MD_LOG_DEBUG("Failed to bind memory to node %u", i);
+            }
+        }
+    }
+#else
+    (void)nodes;
+    (void)policy;
+#endif
+    return ptr;
+#endif
+}
+
+void numa_free(void* ptr, size_t size, bool huge_pages) {
+    if (!ptr) return;
+#if defined(_WIN32)
+    (void)size;
+    (void)huge_pages;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, ALIGN_TO(size, page_size(huge_pages)));
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Page granular allocations for large caches which are filled and read by the workers of the pool, placed on the NUMA nodes of the machine
+// The memory is mapped from the OS, optionally backed by huge pages: explicit huge pages (hugetlb) if the pool of the system has room for
+// the allocation, otherwise transparent huge pages through madvise. Huge pages and placement are hints, the allocation falls back to regular
+// pages on the node which first touches them if they are not available.
+
+#define NUMA_MAX_NODES 64
+#define NUMA_HUGE_PAGE_SIZE (2ULL * 1024 * 1024)
+
+enum NumaPolicy : uint32_t {
+    NumaPolicy_FirstTouch = 0,  // Pages are placed on the node of the thread which first writes them
+    NumaPolicy_Interleave,      // Pages are spread round robin over the nodes
+    NumaPolicy_Partition,       // The allocation is split into numa_num_nodes() contiguous parts of numa_partition_size bytes, one per node
+};
+
+// 1 on machines without NUMA or where it is not exposed
+uint32_t numa_num_nodes();
+
+// Node of the CPU which the calling thread runs on
+uint32_t numa_current_node();
+
+// Size of the parts of an allocation of size bytes with NumaPolicy_Partition, the last part holds the remainder
+size_t numa_partition_size(size_t size, bool huge_pages);
+
+// Returns NULL on failure, the memory is zeroed
+void* numa_alloc(size_t size, bool huge_pages, NumaPolicy policy);
+// size and huge_pages are those which the memory was allocated with
+void  numa_free(void* ptr, size_t size, bool huge_pages);
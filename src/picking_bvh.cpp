@@ -0,0 +1,332 @@
+#include "picking_bvh.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+// Midpoint splits degrade on clustered data, below this depth the nodes are split by count instead which bounds the depth by log2 of the count
+#define PICKING_BVH_MAX_SPLIT_DEPTH 48
+#define PICKING_BVH_STACK_SIZE 128
+
+static inline vec3_t atom_pos(const float* x, const float* y, const float* z, uint32_t i) {
+    return {x[i], y[i], z[i]};
+}
+
+static inline vec3_t prim_center(const PickingPrimitive& p, const float* x, const float* y, const float* z) {
+    const vec3_t a = atom_pos(x, y, z, p.atom[0]);
+    if (p.atom[0] == p.atom[1]) return a;
+    const vec3_t b = atom_pos(x, y, z, p.atom[1]);
+    return {(a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f};
+}
+
+static inline void prim_aabb(vec3_t* aabb_min, vec3_t* aabb_max, const PickingPrimitive& p, const float* x, const float* y, const float* z) {
+    const vec3_t a = atom_pos(x, y, z, p.atom[0]);
+    const vec3_t b = atom_pos(x, y, z, p.atom[1]);
+    const float r = p.radius;
+    *aabb_min = {MIN(a.x, b.x) - r, MIN(a.y, b.y) - r, MIN(a.z, b.z) - r};
+    *aabb_max = {MAX(a.x, b.x) + r, MAX(a.y, b.y) + r, MAX(a.z, b.z) + r};
+}
+
+static inline float dot3(vec3_t a, vec3_t b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline vec3_t sub3(vec3_t a, vec3_t b) {
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline float axis_of(vec3_t v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+void picking_bvh_free(PickingBvh* bvh) {
+    ASSERT(bvh);
+    if (bvh->alloc) {
+        if (bvh->nodes) md_free(bvh->alloc, bvh->nodes, sizeof(PickingBvhNode) * bvh->num_prims * 2);
+        if (bvh->prims) md_free(bvh->alloc, bvh->prims, sizeof(PickingPrimitive) * bvh->num_prims);
+    }
+    *bvh = {};
+}
+
+void picking_bvh_build(PickingBvh* bvh, const PickingPrimitive* prims, size_t num_prims, const float* x, const float* y, const float* z, size_t num_atoms, md_allocator_i* alloc) {
+    ASSERT(bvh);
+    ASSERT(alloc);
+    picking_bvh_free(bvh);
+    bvh->alloc = alloc;
+    bvh->num_atoms = num_atoms;
+    if (num_prims == 0) return;
+
+    // A binary tree with at least one primitive per leaf has fewer than twice as many nodes as primitives
+    bvh->num_prims = num_prims;
+    bvh->prims = (PickingPrimitive*)md_alloc(alloc, sizeof(PickingPrimitive) * num_prims);
+    bvh->nodes = (PickingBvhNode*)md_alloc(alloc, sizeof(PickingBvhNode) * num_prims * 2);
+    MEMCPY(bvh->prims, prims, sizeof(PickingPrimitive) * num_prims);
+
+    const size_t center_bytes = sizeof(vec3_t) * num_prims;
+    vec3_t* center = (vec3_t*)md_alloc(alloc, center_bytes);
+    for (size_t i = 0; i < num_prims; ++i) {
+        center[i] = prim_center(bvh->prims[i], x, y, z);
+    }
+
+    struct Item {
+        uint32_t node;
+        uint32_t depth;
+    };
+    const size_t stack_bytes = sizeof(Item) * num_prims * 2;
+    Item* stack = (Item*)md_alloc(alloc, stack_bytes);
+    size_t stack_size = 0;
+
+    bvh->nodes[0] = {};
+    bvh->nodes[0].first = 0;
+    bvh->nodes[0].count = (uint32_t)num_prims;
+    bvh->num_nodes = 1;
+    stack[stack_size++] = {0, 0};
+
+    while (stack_size > 0) {
+        const Item item = stack[--stack_size];
+        PickingBvhNode& node = bvh->nodes[item.node];
+        if (node.count <= PICKING_BVH_LEAF_SIZE) continue;
+
+        const uint32_t beg = node.first;
+        const uint32_t end = node.first + node.count;
+        uint32_t mid = beg + node.count / 2;
+
+        if (item.depth < PICKING_BVH_MAX_SPLIT_DEPTH) {
+            vec3_t cmin = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+            vec3_t cmax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (uint32_t i = beg; i < end; ++i) {
+                cmin = {MIN(cmin.x, center[i].x), MIN(cmin.y, center[i].y), MIN(cmin.z, center[i].z)};
+                cmax = {MAX(cmax.x, center[i].x), MAX(cmax.y, center[i].y), MAX(cmax.z, center[i].z)};
+            }
+            const vec3_t ext = sub3(cmax, cmin);
+            const int axis = (ext.x >= ext.y && ext.x >= ext.z) ? 0 : (ext.y >= ext.z ? 1 : 2);
+            const float extent = axis_of(ext, axis);
+
+            // With a non zero extent both sides of the midpoint hold at least one primitive
+            if (extent > 0) {
+                const float split = axis_of(cmin, axis) + extent * 0.5f;
+                uint32_t i = beg;
+                uint32_t j = end;
+                while (i < j) {
+                    if (axis_of(center[i], axis) < split) {
+                        ++i;
+                    } else {
+                        --j;
+                        const PickingPrimitive tp = bvh->prims[i]; bvh->prims[i] = bvh->prims[j]; bvh->prims[j] = tp;
+                        const vec3_t tc = center[i]; center[i] = center[j]; center[j] = tc;
+                    }
+                }
+                if (beg < i && i < end) mid = i;
+            }
+        }
+
+        const uint32_t left = (uint32_t)bvh->num_nodes;
+        bvh->num_nodes += 2;
+        bvh->nodes[left + 0] = {};
+        bvh->nodes[left + 0].first = beg;
+        bvh->nodes[left + 0].count = mid - beg;
+        bvh->nodes[left + 1] = {};
+        bvh->nodes[left + 1].first = mid;
+        bvh->nodes[left + 1].count = end - mid;
+
+        PickingBvhNode& parent = bvh->nodes[item.node];
+        parent.first = left;
+        parent.count = 0;
+
+        stack[stack_size++] = {left + 0, item.depth + 1};
+        stack[stack_size++] = {left + 1, item.depth + 1};
+    }
+
+    md_free(alloc, stack, stack_bytes);
+    md_free(alloc, center, center_bytes);
+
+    picking_bvh_refit(bvh, x, y, z);
+}
+
+void picking_bvh_refit(PickingBvh* bvh, const float* x, const float* y, const float* z) {
+    ASSERT(bvh);
+    for (size_t n = bvh->num_nodes; n > 0; --n) {
+        PickingBvhNode& node = bvh->nodes[n - 1];
+        if (node.count > 0) {
+            vec3_t bmin = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+            vec3_t bmax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                vec3_t pmin, pmax;
+                prim_aabb(&pmin, &pmax, bvh->prims[i], x, y, z);
+                bmin = {MIN(bmin.x, pmin.x), MIN(bmin.y, pmin.y), MIN(bmin.z, pmin.z)};
+                bmax = {MAX(bmax.x, pmax.x), MAX(bmax.y, pmax.y), MAX(bmax.z, pmax.z)};
+            }
+            node.aabb_min = bmin;
+            node.aabb_max = bmax;
+        } else {
+            const PickingBvhNode& l = bvh->nodes[node.first + 0];
+            const PickingBvhNode& r = bvh->nodes[node.first + 1];
+            node.aabb_min = {MIN(l.aabb_min.x, r.aabb_min.x), MIN(l.aabb_min.y, r.aabb_min.y), MIN(l.aabb_min.z, r.aabb_min.z)};
+            node.aabb_max = {MAX(l.aabb_max.x, r.aabb_max.x), MAX(l.aabb_max.y, r.aabb_max.y), MAX(l.aabb_max.z, r.aabb_max.z)};
+        }
+    }
+}
+
+// Returns the entry distance of the ray into the box, or FLT_MAX if it misses it within t_max
+static inline float ray_aabb(vec3_t org, vec3_t inv_dir, float t_max, vec3_t bmin, vec3_t bmax) {
+    const float tx0 = (bmin.x - org.x) * inv_dir.x, tx1 = (bmax.x - org.x) * inv_dir.x;
+    const float ty0 = (bmin.y - org.y) * inv_dir.y, ty1 = (bmax.y - org.y) * inv_dir.y;
+    const float tz0 = (bmin.z - org.z) * inv_dir.z, tz1 = (bmax.z - org.z) * inv_dir.z;
+    const float t_enter = MAX(MAX(MIN(tx0, tx1), MIN(ty0, ty1)), MAX(MIN(tz0, tz1), 0.0f));
+    const float t_exit  = MIN(MIN(MAX(tx0, tx1), MAX(ty0, ty1)), MIN(MAX(tz0, tz1), t_max));
+    return t_enter <= t_exit ? t_enter : FLT_MAX;
+}
+
+// Distance to the first intersection in front of the origin, or -1 if there is none or the origin is inside
+static inline float ray_sphere(vec3_t org, vec3_t dir, vec3_t c, float r) {
+    const vec3_t oc = sub3(org, c);
+    const float b = dot3(oc, dir);
+    const float q = dot3(oc, oc) - r * r;
+    const float h = b * b - q;
+    if (h < 0) return -1.0f;
+    const float t = -b - sqrtf(h);
+    return t >= 0 ? t : -1.0f;
+}
+
+static inline float ray_capsule(vec3_t org, vec3_t dir, vec3_t pa, vec3_t pb, float r) {
+    const vec3_t ba = sub3(pb, pa);
+    const vec3_t oa = sub3(org, pa);
+    const float baba = dot3(ba, ba);
+    const float bard = dot3(ba, dir);
+    const float baoa = dot3(ba, oa);
+    const float rdoa = dot3(dir, oa);
+    const float oaoa = dot3(oa, oa);
+    const float a = baba - bard * bard;
+    if (a > 1.0e-8f) {
+        const float b = baba * rdoa - baoa * bard;
+        const float c = baba * oaoa - baoa * baoa - r * r * baba;
+        const float h = b * b - a * c;
+        if (h < 0) return -1.0f;
+        const float t = (-b - sqrtf(h)) / a;
+        const float s = baoa + t * bard;
+        if (t >= 0 && s > 0 && s < baba) return t;
+    }
+    // The body is missed, or the ray is parallel to the axis, so the closest hit is on one of the caps
+    const float ta = ray_sphere(org, dir, pa, r);
+    const float tb = ray_sphere(org, dir, pb, r);
+    if (ta < 0) return tb;
+    if (tb < 0) return ta;
+    return MIN(ta, tb);
+}
+
+bool picking_bvh_cast_ray(const PickingBvh* bvh, const float* x, const float* y, const float* z, vec3_t org, vec3_t dir, float t_max, PickingHit* hit) {
+    ASSERT(bvh);
+    ASSERT(hit);
+    if (bvh->num_nodes == 0) return false;
+
+    const vec3_t inv_dir = {
+        dir.x != 0 ? 1.0f / dir.x : FLT_MAX,
+        dir.y != 0 ? 1.0f / dir.y : FLT_MAX,
+        dir.z != 0 ? 1.0f / dir.z : FLT_MAX,
+    };
+
+    float t_best = t_max;
+    uint32_t best = PICKING_BVH_INVALID_IDX;
+
+    uint32_t stack[PICKING_BVH_STACK_SIZE];
+    size_t stack_size = 0;
+    if (ray_aabb(org, inv_dir, t_best, bvh->nodes[0].aabb_min, bvh->nodes[0].aabb_max) != FLT_MAX) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        const PickingBvhNode& node = bvh->nodes[stack[--stack_size]];
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const PickingPrimitive& p = bvh->prims[i];
+                if (p.radius <= 0) continue;
+                const vec3_t a = atom_pos(x, y, z, p.atom[0]);
+                float t;
+                if (p.atom[0] == p.atom[1]) {
+                    t = ray_sphere(org, dir, a, p.radius);
+                } else {
+                    t = ray_capsule(org, dir, a, atom_pos(x, y, z, p.atom[1]), p.radius);
+                }
+                if (0 <= t && t < t_best) {
+                    t_best = t;
+                    best = p.idx;
+                }
+            }
+            continue;
+        }
+
+        // Visit the closer child first so the farther one is more likely to be culled by the closest hit
+        const uint32_t l = node.first;
+        const uint32_t r = node.first + 1;
+        const float tl = ray_aabb(org, inv_dir, t_best, bvh->nodes[l].aabb_min, bvh->nodes[l].aabb_max);
+        const float tr = ray_aabb(org, inv_dir, t_best, bvh->nodes[r].aabb_min, bvh->nodes[r].aabb_max);
+        ASSERT(stack_size + 2 <= PICKING_BVH_STACK_SIZE);
+        if (tl <= tr) {
+            if (tr != FLT_MAX) stack[stack_size++] = r;
+            if (tl != FLT_MAX) stack[stack_size++] = l;
+        } else {
+            if (tl != FLT_MAX) stack[stack_size++] = l;
+            stack[stack_size++] = r;
+        }
+    }
+
+    if (best == PICKING_BVH_INVALID_IDX) return false;
+    hit->idx = best;
+    hit->t = t_best;
+    hit->pos = {org.x + dir.x * t_best, org.y + dir.y * t_best, org.z + dir.z * t_best};
+    return true;
+}
+
+void picking_bvh_query_planes(const PickingBvh* bvh, const float* x, const float* y, const float* z, const vec4_t* planes, size_t num_planes, PickingBvhQueryFn fn, void* user_data) {
+    ASSERT(bvh);
+    ASSERT(fn);
+    if (bvh->num_nodes == 0) return;
+
+    uint32_t stack[PICKING_BVH_STACK_SIZE];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const PickingBvhNode& node = bvh->nodes[stack[--stack_size]];
+
+        // The box is outside if its corner furthest along the normal of a plane is behind it
+        bool outside = false;
+        for (size_t j = 0; j < num_planes; ++j) {
+            const vec4_t& pl = planes[j];
+            const vec3_t v = {
+                pl.x >= 0 ? node.aabb_max.x : node.aabb_min.x,
+                pl.y >= 0 ? node.aabb_max.y : node.aabb_min.y,
+                pl.z >= 0 ? node.aabb_max.z : node.aabb_min.z,
+            };
+            if (pl.x * v.x + pl.y * v.y + pl.z * v.z + pl.w < 0) {
+                outside = true;
+                break;
+            }
+        }
+        if (outside) continue;
+
+        if (node.count == 0) {
+            ASSERT(stack_size + 2 <= PICKING_BVH_STACK_SIZE);
+            stack[stack_size++] = node.first + 1;
+            stack[stack_size++] = node.first + 0;
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+            const PickingPrimitive& p = bvh->prims[i];
+            const vec3_t c = prim_center(p, x, y, z);
+            bool inside = true;
+            for (size_t j = 0; j < num_planes; ++j) {
+                const vec4_t& pl = planes[j];
+                if (pl.x * c.x + pl.y * c.y + pl.z * c.z + pl.w < 0) {
+                    inside = false;
+                    break;
+                }
+            }
+            if (inside && !fn(p.idx, c, user_data)) return;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <core/md_vec_math.h>
+
+struct md_allocator_i;
+
+// Bounding volume hierarchy over the atom spheres and bond capsules of the representations for picking on the CPU
+// The primitives only refer to the atoms by index, so when the atoms move the tree is refit to the new coordinates instead of being rebuilt.
+// The indices follow the picking buffer, bonds have PICKING_BVH_BOND_BIT set.
+
+#define PICKING_BVH_BOND_BIT 0x80000000U
+#define PICKING_BVH_INVALID_IDX 0xFFFFFFFFU
+#define PICKING_BVH_LEAF_SIZE 4
+
+struct PickingPrimitive {
+    uint32_t idx;       // Atom index or bond index | PICKING_BVH_BOND_BIT
+    uint32_t atom[2];   // End points of the capsule, equal for a sphere
+    float radius;       // A radius of zero is never hit by rays but is found by volume queries
+};
+
+struct PickingBvhNode {
+    vec3_t aabb_min;
+    uint32_t first;     // First primitive of a leaf, or the first of the two consecutive children
+    vec3_t aabb_max;
+    uint32_t count;     // Number of primitives, zero for inner nodes
+};
+
+struct PickingBvh {
+    uint64_t key = 0;           // Key of the primitives it was built from, 0 if empty
+    size_t num_atoms = 0;       // Number of atoms of the molecule the primitives refer to
+    size_t num_nodes = 0;
+    size_t num_prims = 0;
+    PickingBvhNode* nodes = 0;  // Children always follow their parent, so a reverse sweep visits the children before the parent
+    PickingPrimitive* prims = 0;
+    md_allocator_i* alloc = 0;
+};
+
+struct PickingHit {
+    uint32_t idx = PICKING_BVH_INVALID_IDX;
+    float t = 0;                // Distance along the ray
+    vec3_t pos = {};
+};
+
+// Takes a copy of the primitives and sorts them into the tree, the coordinates are only used to partition them
+void picking_bvh_build(PickingBvh* bvh, const PickingPrimitive* prims, size_t num_prims, const float* x, const float* y, const float* z, size_t num_atoms, md_allocator_i* alloc);
+void picking_bvh_free(PickingBvh* bvh);
+
+// Recomputes the bounds of every node for new coordinates of the same atoms
+void picking_bvh_refit(PickingBvh* bvh, const float* x, const float* y, const float* z);
+
+// Returns true and the closest hit if the ray hits a primitive within t_max, dir has to be normalized
+bool picking_bvh_cast_ray(const PickingBvh* bvh, const float* x, const float* y, const float* z, vec3_t origin, vec3_t dir, float t_max, PickingHit* hit);
+
+// Called for every primitive whose center is on the positive side of all planes (dot(plane.xyz, p) + plane.w >= 0), return false to stop
+typedef bool (*PickingBvhQueryFn)(uint32_t idx, vec3_t center, void* user_data);
+void picking_bvh_query_planes(const PickingBvh* bvh, const float* x, const float* y, const float* z, const vec4_t* planes, size_t num_planes, PickingBvhQueryFn fn, void* user_data);
@@ -0,0 +1,213 @@
+#include "progressive.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+
+#include <string.h>
+
+void progressive_init(ProgressiveSweep* sweep, uint32_t num_frames, md_allocator_i* alloc) {
+    ASSERT(sweep);
+    ASSERT(alloc);
+
+    progressive_free(sweep);
+    if (num_frames == 0) return;
+
+    sweep->alloc = alloc;
+    sweep->num_frames = num_frames;
+    sweep->order    = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * num_frames);
+    sweep->state    = (std::atomic_uint8_t*)md_alloc(alloc, sizeof(std::atomic_uint8_t) * num_frames);
+
+    // Smallest power of two stride which keeps the first pass within the target size
+    uint32_t log2_stride = 0;
+    while (((uint64_t)num_frames + (1ULL << log2_stride) - 1) >> log2_stride > PROGRESSIVE_FIRST_PASS_FRAMES) {
+        log2_stride += 1;
+    }
+    // Refine by at least a factor of 4 per pass and never use more passes than we have room for
+    const uint32_t shift = MAX(2, (log2_stride + PROGRESSIVE_MAX_PASSES - 2) / (PROGRESSIVE_MAX_PASSES - 1));
+
+    sweep->num_passes = 0;
+    int32_t l = (int32_t)log2_stride;
+    while (true) {
+        sweep->stride[sweep->num_passes++] = 1U << MAX(l, 0);
+        if (l <= 0) break;
+        l -= shift;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t k = 0; k < sweep->num_passes; ++k) {
+        const uint32_t stride = sweep->stride[k];
+        const uint32_t prev   = k > 0 ? sweep->stride[k - 1] : 0;
+        const uint32_t beg    = count;
+        for (uint32_t f = 0; f < num_frames; f += stride) {
+            if (prev && f % prev == 0) continue;
+            sweep->order[count++] = f;
+        }
+        sweep->pass_size[k] = count - beg;
+    }
+    ASSERT(count == num_frames);
+
+    progressive_reset(sweep);
+}
+
+void progressive_free(ProgressiveSweep* sweep) {
+    ASSERT(sweep);
+    if (sweep->alloc) {
+        md_free(sweep->alloc, sweep->order,    sizeof(uint32_t) * sweep->num_frames);
+        md_free(sweep->alloc, sweep->state,    sizeof(std::atomic_uint8_t) * sweep->num_frames);
+    }
+    sweep->order = nullptr;
+    sweep->state = nullptr;
+    sweep->num_frames = 0;
+    sweep->num_passes = 0;
+    sweep->num_passes_published = 0;
+    sweep->cursor = 0;
+    sweep->window = 0;
+    sweep->window_cursor = 0;
+    sweep->alloc = nullptr;
+}
+
+void progressive_reset(ProgressiveSweep* sweep) {
+    ASSERT(sweep);
+    for (uint32_t i = 0; i < sweep->num_frames; ++i) {
+        sweep->state[i].store(ProgressiveState_Pending, std::memory_order_relaxed);
+    }
+    for (uint32_t k = 0; k < PROGRESSIVE_MAX_PASSES; ++k) {
+        sweep->pass_completed[k] = 0;
+    }
+    sweep->num_passes_published = 0;
+    sweep->cursor = 0;
+    sweep->window = 0;
+    sweep->window_cursor = 0;
+}
+
+static inline bool try_claim(ProgressiveSweep* sweep, uint32_t frame_idx) {
+    uint8_t expected = ProgressiveState_Pending;
+    return sweep->state[frame_idx].compare_exchange_strong(expected, ProgressiveState_Claimed, std::memory_order_acq_rel);
+}
+
+bool progressive_next(ProgressiveSweep* sweep, uint32_t* frame_idx) {
+    ASSERT(sweep);
+    ASSERT(frame_idx);
+
+    // Prioritized window first
+    const uint64_t window = sweep->window.load(std::memory_order_acquire);
+    const uint32_t window_end = MIN((uint32_t)(window & 0xFFFFFFFF), sweep->num_frames);
+    uint32_t i = sweep->window_cursor.load(std::memory_order_relaxed);
+    while (i < window_end) {
+        if (sweep->window_cursor.compare_exchange_weak(i, i + 1, std::memory_order_relaxed)) {
+            if (try_claim(sweep, i)) {
+                *frame_idx = i;
+                return true;
+            }
+            i = i + 1;
+        }
+    }
+
+    if (!sweep->background.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    // Avoid running the cursor past the end, so it can be used to tell how far the sweep has come
+    i = sweep->cursor.load(std::memory_order_relaxed);
+    while (i < sweep->num_frames) {
+        if (sweep->cursor.compare_exchange_weak(i, i + 1, std::memory_order_relaxed)) {
+            const uint32_t f = sweep->order[i];
+            if (try_claim(sweep, f)) {
+                *frame_idx = f;
+                return true;
+            }
+            i = i + 1;
+        }
+    }
+    return false;
+}
+
+bool progressive_claim(ProgressiveSweep* sweep, uint32_t frame_idx) {
+    ASSERT(sweep);
+    if (frame_idx >= sweep->num_frames) return false;
+    if (!sweep->background.load(std::memory_order_relaxed)) {
+        const uint64_t window = sweep->window.load(std::memory_order_acquire);
+        const uint32_t window_beg = (uint32_t)(window >> 32);
+        const uint32_t window_end = (uint32_t)(window & 0xFFFFFFFF);
+        if (frame_idx < window_beg || window_end <= frame_idx) return false;
+    }
+    return try_claim(sweep, frame_idx);
+}
+
+uint32_t progressive_claim_run(ProgressiveSweep* sweep, uint32_t frame_idx, uint32_t max_frames) {
+    ASSERT(sweep);
+    ASSERT(frame_idx < sweep->num_frames);
+    const uint32_t last = (uint32_t)MIN((uint64_t)frame_idx + MAX(max_frames, 1), (uint64_t)sweep->num_frames);
+    uint32_t end = frame_idx + 1;
+    while (end < last && progressive_claim(sweep, end)) {
+        end += 1;
+    }
+    return end;
+}
+
+void progressive_prioritize(ProgressiveSweep* sweep, uint32_t beg, uint32_t end) {
+    ASSERT(sweep);
+    end = MIN(end, sweep->num_frames);
+    beg = MIN(beg, end);
+    const uint64_t window = ((uint64_t)beg << 32) | end;
+    if (sweep->window.load(std::memory_order_relaxed) != window) {
+        // The cursor is reset before the window is published, a claim of a frame in the old window is harmless
+        sweep->window_cursor.store(beg, std::memory_order_relaxed);
+        sweep->window.store(window, std::memory_order_release);
+    }
+}
+
+void progressive_set_background(ProgressiveSweep* sweep, bool enable) {
+    ASSERT(sweep);
+    sweep->background.store(enable, std::memory_order_relaxed);
+}
+
+bool progressive_range_complete(const ProgressiveSweep* sweep, uint32_t beg, uint32_t end) {
+    ASSERT(sweep);
+    end = MIN(end, sweep->num_frames);
+    for (uint32_t i = beg; i < end; ++i) {
+        if (sweep->state[i].load(std::memory_order_acquire) != ProgressiveState_Complete) return false;
+    }
+    return true;
+}
+
+bool progressive_range_pending(const ProgressiveSweep* sweep, uint32_t beg, uint32_t end) {
+    ASSERT(sweep);
+    end = MIN(end, sweep->num_frames);
+    for (uint32_t i = beg; i < end; ++i) {
+        if (sweep->state[i].load(std::memory_order_relaxed) == ProgressiveState_Pending) return true;
+    }
+    return false;
+}
+
+void progressive_complete(ProgressiveSweep* sweep, uint32_t frame_idx) {
+    ASSERT(sweep);
+    ASSERT(frame_idx < sweep->num_frames);
+    sweep->state[frame_idx].store(ProgressiveState_Complete, std::memory_order_release);
+    // The pass of a frame is the first (coarsest) stride which divides it
+    for (uint32_t k = 0; k < sweep->num_passes; ++k) {
+        if (frame_idx % sweep->stride[k] == 0) {
+            sweep->pass_completed[k].fetch_add(1, std::memory_order_release);
+            break;
+        }
+    }
+}
+
+uint32_t progressive_passes_completed(const ProgressiveSweep* sweep) {
+    ASSERT(sweep);
+    uint32_t k = 0;
+    while (k < sweep->num_passes && sweep->pass_completed[k].load(std::memory_order_acquire) == sweep->pass_size[k]) {
+        k += 1;
+    }
+    return k;
+}
+
+bool progressive_pass_published(ProgressiveSweep* sweep) {
+    ASSERT(sweep);
+    const uint32_t completed = progressive_passes_completed(sweep);
+    if (completed > sweep->num_passes_published) {
+        sweep->num_passes_published = completed;
+        return completed < sweep->num_passes;
+    }
+    return false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct md_allocator_i;
+
+// Progressive (coarse to fine) sweep over the frames of a trajectory
+// Frames are visited in passes of decreasing stride: The first pass covers every Nth frame and the following passes fill in the gaps.
+// Work is pulled from a shared cursor, the range given to a range task only tells how many frames to process and not which ones.
+// This keeps the order global over all threads of the pool, so a pass is complete before the bulk of the next one is started.
+// A window of frames can be prioritized (e.g. around the playhead), which is served before the coarse to fine order.
+// If the background fill is disabled, only prioritized frames are processed.
+
+#define PROGRESSIVE_MAX_PASSES 8
+#define PROGRESSIVE_FIRST_PASS_FRAMES 1024
+
+enum ProgressiveState : uint8_t {
+    ProgressiveState_Pending  = 0,
+    ProgressiveState_Claimed  = 1,
+    ProgressiveState_Complete = 2,
+};
+
+struct ProgressiveSweep {
+    uint32_t* order = nullptr;          // [num_frames] Frame indices in the order they are visited
+    std::atomic_uint8_t* state = nullptr; // [num_frames] ProgressiveState of each frame, this is the validity map for consumers
+    uint32_t  num_frames = 0;
+    uint32_t  num_passes = 0;
+    uint32_t  stride[PROGRESSIVE_MAX_PASSES] = {};
+    uint32_t  pass_size[PROGRESSIVE_MAX_PASSES] = {};
+    std::atomic_uint32_t pass_completed[PROGRESSIVE_MAX_PASSES] = {};
+    std::atomic_uint32_t cursor = 0;
+    std::atomic_uint64_t window = 0;        // Prioritized frames, packed as (beg << 32) | end
+    std::atomic_uint32_t window_cursor = 0;
+    std::atomic_bool     background = true; // Process the frames outside of the window
+    uint32_t  num_passes_published = 0; // Main thread only, see progressive_pass_published
+    md_allocator_i* alloc = nullptr;
+};
+
+// Setup the order for num_frames, this also resets the sweep
+// Must not be called while a task is working on the sweep
+void progressive_init(ProgressiveSweep* sweep, uint32_t num_frames, md_allocator_i* alloc);
+void progressive_free(ProgressiveSweep* sweep);
+
+// Restart the sweep, marking all frames as incomplete
+void progressive_reset(ProgressiveSweep* sweep);
+
+// Claim the next frame to process, returns false when there is nothing more to claim
+// Frames of the prioritized window are claimed first, then the coarse to fine order if background is enabled
+bool progressive_next(ProgressiveSweep* sweep, uint32_t* frame_idx);
+void progressive_complete(ProgressiveSweep* sweep, uint32_t frame_idx);
+
+// Claim a specific frame if it is pending and would be visited by the sweep (within the window, or background is enabled)
+// Used to process frames out of order when they are available anyway, e.g. loaded for another sweep
+bool progressive_claim(ProgressiveSweep* sweep, uint32_t frame_idx);
+
+// Claims the pending frames which directly follow a claimed frame, until max_frames are claimed in total, returns the end of the run
+// Used to process runs of consecutive frames together, the frames are then visited ahead of the coarse to fine order
+uint32_t progressive_claim_run(ProgressiveSweep* sweep, uint32_t frame_idx, uint32_t max_frames);
+
+static inline bool progressive_frame_complete(const ProgressiveSweep* sweep, uint32_t frame_idx) {
+    return frame_idx < sweep->num_frames && sweep->state[frame_idx].load(std::memory_order_acquire) == ProgressiveState_Complete;
+}
+
+// Prioritize the frames in [beg, end), which replaces the previous window
+void progressive_prioritize(ProgressiveSweep* sweep, uint32_t beg, uint32_t end);
+
+// Enable or disable processing of the frames outside of the prioritized window
+void progressive_set_background(ProgressiveSweep* sweep, bool enable);
+
+// True if all frames in [beg, end) are complete
+bool progressive_range_complete(const ProgressiveSweep* sweep, uint32_t beg, uint32_t end);
+
+// True if there are frames in [beg, end) which are neither complete nor claimed
+bool progressive_range_pending(const ProgressiveSweep* sweep, uint32_t beg, uint32_t end);
+
+// Number of passes which are fully complete
+uint32_t progressive_passes_completed(const ProgressiveSweep* sweep);
+
+// Returns true once for every pass which completes (except the last), used by the main thread to publish partial results
+bool progressive_pass_published(ProgressiveSweep* sweep);
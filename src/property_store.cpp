@@ -0,0 +1,404 @@
+#include "property_store.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#include <string.h>
+
+#define PROPERTY_STORE_MAGIC 0x53505056    // 'VPPS'
+
+struct SerializedHeader {
+    uint32_t magic;
+    uint32_t stride;
+    uint32_t num_frames;
+    uint32_t block_frames;
+    uint32_t codec;
+    uint32_t num_blocks;
+};
+
+static inline uint32_t float_bits(float f) {
+    uint32_t u;
+    MEMCPY(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bits_float(uint32_t u) {
+    float f;
+    MEMCPY(&f, &u, sizeof(f));
+    return f;
+}
+
+// Round to nearest even, values outside of the range of float16 become infinity
+static inline uint16_t float_to_half(float f) {
+    const uint32_t u = float_bits(f);
+    const uint32_t sign = (u >> 16) & 0x8000;
+    const int32_t  exp  = (int32_t)((u >> 23) & 0xFF);
+    uint32_t mant = u & 0x7FFFFF;
+
+    if (exp == 0xFF) return (uint16_t)(sign | 0x7C00 | (mant ? 0x200 : 0));    // Inf, NaN
+    const int32_t e = exp - 127 + 15;
+    if (e >= 0x1F) return (uint16_t)(sign | 0x7C00);
+    if (e <= 0) {
+        // Subnormal, or zero if it is too small
+        if (e < -10) return (uint16_t)sign;
+        mant |= 0x800000;
+        const uint32_t shift = (uint32_t)(14 - e);
+        uint32_t h = mant >> shift;
+        const uint32_t rem = mant & ((1U << shift) - 1);
+        const uint32_t half = 1U << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h += 1;
+        return (uint16_t)(sign | h);
+    }
+    uint32_t h = ((uint32_t)e << 10) | (mant >> 13);
+    const uint32_t rem = mant & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h += 1;    // A carry into the exponent is still correct
+    return (uint16_t)(sign | h);
+}
+
+static inline float half_to_float(uint16_t h) {
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exp  = (h >> 10) & 0x1F;
+    const uint32_t mant = h & 0x3FF;
+    if (exp == 0) {
+        // Zero or subnormal
+        return bits_float(sign) + (sign ? -1.0f : 1.0f) * (float)mant * (1.0f / 16777216.0f);
+    }
+    if (exp == 0x1F) return bits_float(sign | 0x7F800000 | (mant << 13));
+    return bits_float(sign | ((exp - 15 + 127) << 23) | (mant << 13));
+}
+
+static inline uint32_t block_num_frames(const PropertyStore* store, uint32_t block_idx) {
+    const uint32_t beg = block_idx * store->block_frames;
+    return MIN(beg + store->block_frames, store->num_frames) - beg;
+}
+
+static inline size_t max_encoded_size(const PropertyStore* store, uint32_t count) {
+    const size_t n = (size_t)store->stride * count;
+    return store->codec == PropertyCodec_Float16 ? n * sizeof(uint16_t) : (n + 1) / 2 + n * sizeof(uint32_t);
+}
+
+// The XOR codec stores a nibble per value with the number of bytes which follow (0-4), the nibbles of all values are stored first
+static size_t encode_block(uint8_t* dst, const PropertyStore* store, uint32_t block_idx, const float* values) {
+    const uint32_t beg = block_idx * store->block_frames;
+    const uint32_t count = block_num_frames(store, block_idx);
+    const size_t n = (size_t)store->stride * count;
+
+    if (store->codec == PropertyCodec_Float16) {
+        uint8_t* out = dst;
+        for (uint32_t j = 0; j < store->stride; ++j) {
+            const float* src = values + (size_t)j * store->num_frames + beg;
+            for (uint32_t i = 0; i < count; ++i) {
+                const uint16_t h = float_to_half(src[i]);
+                MEMCPY(out, &h, sizeof(h));
+                out += sizeof(h);
+            }
+        }
+        return n * sizeof(uint16_t);
+    }
+
+    uint8_t* ctrl = dst;
+    uint8_t* out = dst + (n + 1) / 2;
+    MEMSET(ctrl, 0, (n + 1) / 2);
+    size_t k = 0;
+    for (uint32_t j = 0; j < store->stride; ++j) {
+        const float* src = values + (size_t)j * store->num_frames + beg;
+        uint32_t prev = 0;
+        for (uint32_t i = 0; i < count; ++i, ++k) {
+            const uint32_t u = float_bits(src[i]);
+            uint32_t x = u ^ prev;
+            prev = u;
+            uint32_t len = 0;
+            while (x) {
+                *out++ = (uint8_t)x;
+                x >>= 8;
+                len += 1;
+            }
+            ctrl[k >> 1] |= (uint8_t)(len << ((k & 1) * 4));
+        }
+    }
+    return (size_t)(out - dst);
+}
+
+static bool decode_block(float* dst, const PropertyStore* store, uint32_t block_idx) {
+    const uint32_t count = block_num_frames(store, block_idx);
+    const size_t n = (size_t)store->stride * count;
+    const uint8_t* src = store->data + store->block_offset[block_idx];
+    const size_t size = store->block_size[block_idx];
+
+    if (store->codec == PropertyCodec_Float16) {
+        if (size != n * sizeof(uint16_t)) return false;
+        for (uint32_t j = 0; j < store->stride; ++j) {
+            float* out = dst + (size_t)j * store->block_frames;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint16_t h;
+                MEMCPY(&h, src, sizeof(h));
+                src += sizeof(h);
+                out[i] = half_to_float(h);
+            }
+        }
+        return true;
+    }
+
+    const size_t ctrl_size = (n + 1) / 2;
+    if (size < ctrl_size) return false;
+    const uint8_t* ctrl = src;
+    const uint8_t* in  = src + ctrl_size;
+    const uint8_t* end = src + size;
+    size_t k = 0;
+    for (uint32_t j = 0; j < store->stride; ++j) {
+        float* out = dst + (size_t)j * store->block_frames;
+        uint32_t prev = 0;
+        for (uint32_t i = 0; i < count; ++i, ++k) {
+            const uint32_t len = (ctrl[k >> 1] >> ((k & 1) * 4)) & 0xF;
+            if (len > 4 || in + len > end) return false;
+            uint32_t x = 0;
+            for (uint32_t b = 0; b < len; ++b) {
+                x |= (uint32_t)in[b] << (b * 8);
+            }
+            in += len;
+            prev ^= x;
+            out[i] = bits_float(prev);
+        }
+    }
+    return in == end;
+}
+
+static bool reserve_data(PropertyStore* store, size_t capacity) {
+    if (capacity <= store->data_capacity) return true;
+    const size_t new_capacity = MAX(capacity, store->data_capacity * 3 / 2);
+    uint8_t* data = (uint8_t*)md_alloc(store->alloc, new_capacity);
+    if (!data) return false;
+    if (store->data) {
+        MEMCPY(data, store->data, store->data_size);
+        md_free(store->alloc, store->data, store->data_capacity);
+    }
+    store->data = data;
+    store->data_capacity = new_capacity;
+    return true;
+}
+
+bool property_store_init(PropertyStore* store, uint32_t stride, uint32_t num_frames, uint32_t block_frames, PropertyCodec codec, md_allocator_i* alloc) {
+    ASSERT(store);
+    ASSERT(alloc);
+    property_store_free(store);
+    if (stride == 0 || num_frames == 0) return false;
+    if (codec != PropertyCodec_Xor && codec != PropertyCodec_Float16) {
+        MD_LOG_ERROR("Unknown property codec %u", (uint32_t)codec);
+        return false;
+    }
+
+    store->alloc = alloc;
+    store->stride = stride;
+    store->num_frames = num_frames;
+    store->block_frames = block_frames ? block_frames : PROPERTY_STORE_BLOCK_FRAMES;
+    store->num_blocks = (num_frames + store->block_frames - 1) / store->block_frames;
+    store->codec = codec;
+    store->block_offset = (uint64_t*)md_alloc(alloc, sizeof(uint64_t) * store->num_blocks);
+    store->block_size   = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * store->num_blocks);
+    for (uint32_t i = 0; i < store->num_blocks; ++i) {
+        store->block_offset[i] = UINT64_MAX;
+        store->block_size[i] = 0;
+    }
+    return true;
+}
+
+void property_store_free(PropertyStore* store) {
+    ASSERT(store);
+    if (store->alloc) {
+        md_free(store->alloc, store->block_offset, sizeof(uint64_t) * store->num_blocks);
+        md_free(store->alloc, store->block_size, sizeof(uint32_t) * store->num_blocks);
+        if (store->data) md_free(store->alloc, store->data, store->data_capacity);
+        const size_t hot_size = sizeof(float) * store->stride * store->block_frames;
+        for (int i = 0; i < PROPERTY_STORE_HOT_BLOCKS; ++i) {
+            if (store->hot[i].values) md_free(store->alloc, store->hot[i].values, hot_size);
+        }
+    }
+    store->stride = store->num_frames = store->block_frames = store->num_blocks = 0;
+    store->codec = PropertyCodec_Xor;
+    store->block_offset = nullptr;
+    store->block_size = nullptr;
+    store->data = nullptr;
+    store->data_size = store->data_capacity = 0;
+    for (int i = 0; i < PROPERTY_STORE_HOT_BLOCKS; ++i) {
+        store->hot[i] = {};
+    }
+    store->clock = 0;
+    store->alloc = nullptr;
+}
+
+// Readers decode from data, so it is only reallocated while holding the lock
+static bool write_block_locked(PropertyStore* store, uint32_t block_idx, const float* values) {
+    const size_t max_size = max_encoded_size(store, block_num_frames(store, block_idx));
+    if (!reserve_data(store, store->data_size + max_size)) return false;
+
+    // A rewritten block is appended, the bytes of its previous encoding are not reused
+    const size_t size = encode_block(store->data + store->data_size, store, block_idx, values);
+    ASSERT(size <= max_size);
+    store->block_offset[block_idx] = store->data_size;
+    store->block_size[block_idx] = (uint32_t)size;
+    store->data_size += size;
+    for (int i = 0; i < PROPERTY_STORE_HOT_BLOCKS; ++i) {
+        if (store->hot[i].block == block_idx) store->hot[i] = {-1, 0, store->hot[i].values};
+    }
+    return true;
+}
+
+bool property_store_write_block(PropertyStore* store, uint32_t block_idx, const float* values) {
+    ASSERT(store);
+    ASSERT(values);
+    if (block_idx >= store->num_blocks) return false;
+    while (store->lock.test_and_set(std::memory_order_acquire));
+    const bool ok = write_block_locked(store, block_idx, values);
+    store->lock.clear(std::memory_order_release);
+    return ok;
+}
+
+bool property_store_write(PropertyStore* store, const float* values) {
+    ASSERT(store);
+    ASSERT(values);
+    bool ok = true;
+    while (store->lock.test_and_set(std::memory_order_acquire));
+    // Reserve for the typical size of the XOR codec, which is about half of the raw values
+    reserve_data(store, store->data_size + (size_t)store->stride * store->num_frames * sizeof(float) / 2);
+    for (uint32_t i = 0; i < store->num_blocks && ok; ++i) {
+        ok = write_block_locked(store, i, values);
+    }
+    store->lock.clear(std::memory_order_release);
+    return ok;
+}
+
+bool property_store_block_written(const PropertyStore* store, uint32_t block_idx) {
+    ASSERT(store);
+    return block_idx < store->num_blocks && store->block_offset[block_idx] != UINT64_MAX;
+}
+
+// Returns the decoded block, which stays valid while the lock is held
+static const float* hot_block(PropertyStore* store, uint32_t block_idx) {
+    // Empty slots have not been used, so they are taken first
+    PropertyHotBlock* slot = &store->hot[0];
+    for (int i = 0; i < PROPERTY_STORE_HOT_BLOCKS; ++i) {
+        PropertyHotBlock* hot = &store->hot[i];
+        if (hot->block == block_idx) {
+            hot->last_use = ++store->clock;
+            return hot->values;
+        }
+        if (hot->last_use < slot->last_use) slot = hot;
+    }
+
+    if (!slot->values) {
+        slot->values = (float*)md_alloc(store->alloc, sizeof(float) * store->stride * store->block_frames);
+    }
+    slot->block = -1;
+    slot->last_use = 0;
+    if (!slot->values || !decode_block(slot->values, store, block_idx)) {
+        MD_LOG_ERROR("Block %u of the property store is corrupt", block_idx);
+        return nullptr;
+    }
+    slot->block = block_idx;
+    slot->last_use = ++store->clock;
+    return slot->values;
+}
+
+bool property_store_read(PropertyStore* store, uint32_t frame_beg, uint32_t frame_end, float* out) {
+    ASSERT(store);
+    ASSERT(out);
+    if (frame_beg >= frame_end) return true;
+    if (frame_end > store->num_frames) return false;
+
+    const uint32_t count = frame_end - frame_beg;
+    const uint32_t first = frame_beg / store->block_frames;
+    const uint32_t last  = (frame_end - 1) / store->block_frames;
+    bool ok = true;
+    while (store->lock.test_and_set(std::memory_order_acquire));
+    for (uint32_t b = first; b <= last && ok; ++b) {
+        const float* values = property_store_block_written(store, b) ? hot_block(store, b) : nullptr;
+        if (!values) {
+            ok = false;
+            break;
+        }
+        const uint32_t block_beg = b * store->block_frames;
+        const uint32_t beg = MAX(frame_beg, block_beg);
+        const uint32_t end = MIN(frame_end, block_beg + store->block_frames);
+        for (uint32_t j = 0; j < store->stride; ++j) {
+            MEMCPY(out + (size_t)j * count + (beg - frame_beg), values + (size_t)j * store->block_frames + (beg - block_beg), sizeof(float) * (end - beg));
+        }
+    }
+    store->lock.clear(std::memory_order_release);
+    return ok;
+}
+
+size_t property_store_serialized_size(const PropertyStore* store) {
+    ASSERT(store);
+    size_t size = sizeof(SerializedHeader) + sizeof(uint32_t) * store->num_blocks;
+    for (uint32_t i = 0; i < store->num_blocks; ++i) {
+        size += store->block_size[i];
+    }
+    return size;
+}
+
+bool property_store_serialize(const PropertyStore* store, void* dst, size_t size) {
+    ASSERT(store);
+    ASSERT(dst);
+    if (size < property_store_serialized_size(store)) return false;
+    for (uint32_t i = 0; i < store->num_blocks; ++i) {
+        if (!property_store_block_written(store, i)) return false;
+    }
+
+    uint8_t* out = (uint8_t*)dst;
+    const SerializedHeader hdr = {PROPERTY_STORE_MAGIC, store->stride, store->num_frames, store->block_frames, (uint32_t)store->codec, store->num_blocks};
+    MEMCPY(out, &hdr, sizeof(hdr));
+    out += sizeof(hdr);
+    MEMCPY(out, store->block_size, sizeof(uint32_t) * store->num_blocks);
+    out += sizeof(uint32_t) * store->num_blocks;
+    for (uint32_t i = 0; i < store->num_blocks; ++i) {
+        MEMCPY(out, store->data + store->block_offset[i], store->block_size[i]);
+        out += store->block_size[i];
+    }
+    return true;
+}
+
+bool property_store_deserialize(PropertyStore* store, const void* src, size_t size, md_allocator_i* alloc) {
+    ASSERT(store);
+    ASSERT(src);
+    SerializedHeader hdr;
+    if (size < sizeof(hdr)) return false;
+    MEMCPY(&hdr, src, sizeof(hdr));
+    if (hdr.magic != PROPERTY_STORE_MAGIC || hdr.block_frames == 0) return false;
+    if (!property_store_init(store, hdr.stride, hdr.num_frames, hdr.block_frames, (PropertyCodec)hdr.codec, alloc)) return false;
+    if (store->num_blocks != hdr.num_blocks) {
+        property_store_free(store);
+        return false;
+    }
+
+    const uint8_t* in = (const uint8_t*)src + sizeof(hdr);
+    const size_t table_size = sizeof(uint32_t) * store->num_blocks;
+    if (sizeof(hdr) + table_size > size) {
+        property_store_free(store);
+        return false;
+    }
+    MEMCPY(store->block_size, in, table_size);
+    in += table_size;
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < store->num_blocks; ++i) {
+        store->block_offset[i] = offset;
+        offset += store->block_size[i];
+    }
+    if (sizeof(hdr) + table_size + offset != size || !reserve_data(store, offset)) {
+        property_store_free(store);
+        return false;
+    }
+    MEMCPY(store->data, in, offset);
+    store->data_size = offset;
+    return true;
+}
+
+size_t property_store_memory_usage(const PropertyStore* store) {
+    ASSERT(store);
+    size_t bytes = store->data_capacity + (sizeof(uint64_t) + sizeof(uint32_t)) * store->num_blocks;
+    for (int i = 0; i < PROPERTY_STORE_HOT_BLOCKS; ++i) {
+        if (store->hot[i].values) bytes += sizeof(float) * store->stride * store->block_frames;
+    }
+    return bytes;
+}
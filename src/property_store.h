@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct md_allocator_i;
+
+// Compressed storage of the per-frame values of a temporal property
+// The values are laid out as in md_script, [stride][num_frames] where stride is the number of values per frame. The frames are split into
+// blocks which are compressed independently once they are complete, and decoded on access into a small set of hot blocks.
+// The lossless codec stores every value as the XOR with the previous value of the same series, without its leading zero bytes,
+// which are frequent for the slowly varying values of a trajectory. The float16 codec halves the size at a relative precision of 1e-3.
+
+#define PROPERTY_STORE_BLOCK_FRAMES 256
+#define PROPERTY_STORE_HOT_BLOCKS 4
+
+enum PropertyCodec : uint32_t {
+    PropertyCodec_Xor     = 0,
+    PropertyCodec_Float16 = 1,
+};
+
+struct PropertyHotBlock {
+    int64_t  block = -1;
+    uint64_t last_use = 0;
+    float*   values = nullptr;    // [stride][block_frames]
+};
+
+struct PropertyStore {
+    uint32_t stride = 0;
+    uint32_t num_frames = 0;
+    uint32_t block_frames = 0;
+    uint32_t num_blocks = 0;
+    PropertyCodec codec = PropertyCodec_Xor;
+
+    uint64_t* block_offset = nullptr;   // [num_blocks] Offset of each block in data, UINT64_MAX until it is written
+    uint32_t* block_size   = nullptr;   // [num_blocks]
+    uint8_t*  data = nullptr;
+    size_t    data_size = 0;
+    size_t    data_capacity = 0;
+
+    // Decoded blocks, replaced least recently used first
+    PropertyHotBlock hot[PROPERTY_STORE_HOT_BLOCKS];
+    uint64_t clock = 0;
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+    md_allocator_i* alloc = nullptr;
+};
+
+// block_frames of 0 uses PROPERTY_STORE_BLOCK_FRAMES
+bool property_store_init(PropertyStore* store, uint32_t stride, uint32_t num_frames, uint32_t block_frames, PropertyCodec codec, md_allocator_i* alloc);
+void property_store_free(PropertyStore* store);
+
+// Compresses the frames of a completed block from values, which holds all frames ([stride][num_frames])
+bool property_store_write_block(PropertyStore* store, uint32_t block_idx, const float* values);
+
+// Compresses every block of values
+bool property_store_write(PropertyStore* store, const float* values);
+
+bool property_store_block_written(const PropertyStore* store, uint32_t block_idx);
+
+// Decodes the frames [frame_beg, frame_end) of every series into out ([stride][frame_end - frame_beg]), returns false if a block is missing
+bool property_store_read(PropertyStore* store, uint32_t frame_beg, uint32_t frame_end, float* out);
+
+// Serialized form (layout, block sizes and the compressed blocks), which requires every block to be written
+size_t property_store_serialized_size(const PropertyStore* store);
+bool   property_store_serialize(const PropertyStore* store, void* dst, size_t size);
+// Initializes the store from a serialized store, returns false if src is not one
+bool   property_store_deserialize(PropertyStore* store, const void* src, size_t size, md_allocator_i* alloc);
+
+size_t property_store_memory_usage(const PropertyStore* store);
@@ -23,11 +23,13 @@
 #include "gfx/gl_utils.h"
 #include "image.h"
 #include "task_system.h"
+#include "script_fingerprint.h"
 
 #include <string.h>
 #include <stdlib.h>
 
 static const uint32_t density_tex_dim = 512;
+static const uint32_t density_upload_rows = 128;  // Rows of the density texture per step of the upload
 static const uint32_t tex_dim = 1024;
 
 typedef double density_map_t[180][180];
@@ -36,6 +38,7 @@ namespace ramachandran {
 
 static GLuint fbo = 0;
 static GLuint vao = 0;
+static bool initialized = false;
 
 namespace map {
     static GLuint program = 0;
@@ -61,6 +64,16 @@ namespace iso {
     static GLint uniform_loc_iso_contour_line_scale = -1;
 }
 
+// Density computation in compute shaders (OpenGL 4.3)
+namespace gpu {
+    static GLuint program_splat = 0;
+    static GLuint program_blur_counts = 0;  // First pass, which reads the atomic counts
+    static GLuint program_blur = 0;
+    static GLuint density_buf = 0;          // Sums (4) followed by the counts (4 per texel)
+    static GLuint entry_buf = 0;
+    static GLuint tmp_tex = 0;
+}
+
 constexpr str_t v_fs_quad_src = STR(R"(
 #version 150 core
 
@@ -115,6 +128,77 @@ void main() {
 }
 )");
 
+// Angles are the packed backbone_angles_q16_t (phi low, psi high), entries are the residue index with the ramachandran type in the upper two bits
+constexpr str_t c_shader_splat_src = STR(R"(#version 430 core
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) readonly buffer angle_buffer   { uint in_angles[]; };
+layout(std430, binding = 1) readonly buffer entry_buffer   { uint in_entries[]; };
+layout(std430, binding = 2) buffer density_buffer { uint out_sum[4]; uint out_count[]; };
+
+uniform uint u_frame_beg;
+uniform uint u_frame_end;
+uniform uint u_frame_stride;
+uniform uint u_num_entries;
+uniform uint u_dim;
+
+void main() {
+    uint e = gl_GlobalInvocationID.x;
+    if (e >= u_num_entries) return;
+
+    uint entry = in_entries[e];
+    uint res   = entry & 0x3FFFFFFFU;
+    uint type  = entry >> 30;
+    uint count = 0U;
+
+    for (uint f = u_frame_beg + gl_GlobalInvocationID.y; f < u_frame_end; f += gl_NumWorkGroups.y) {
+        uint packed = in_angles[f * u_frame_stride + res];
+        if (packed == 0U) continue;
+        // [-PI, PI) maps to [0, dim), which is exact in the quantized domain
+        uint x = uint(bitfieldExtract(int(packed),  0, 16) + 32768) * u_dim / 65536U;
+        uint y = uint(bitfieldExtract(int(packed), 16, 16) + 32768) * u_dim / 65536U;
+        atomicAdd(out_count[4U * (y * u_dim + x) + type], 1U);
+        count += 1U;
+    }
+    atomicAdd(out_sum[type], count);
+}
+)");
+
+// Box blur pass along u_dir with wrap around, the density is periodic
+constexpr str_t c_shader_blur_src = STR(R"(#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#if SOURCE_COUNTS
+layout(std430, binding = 2) readonly buffer density_buffer { uint in_sum[4]; uint in_count[]; };
+#else
+layout(rgba32f, binding = 0) readonly uniform image2D u_src;
+#endif
+layout(rgba32f, binding = 1) writeonly uniform image2D u_dst;
+
+uniform ivec2 u_dir;
+uniform int   u_width;
+uniform int   u_dim;
+
+vec4 load(ivec2 c) {
+    c = c & ivec2(u_dim - 1);
+#if SOURCE_COUNTS
+    uint i = 4U * uint(c.y * u_dim + c.x);
+    return vec4(in_count[i + 0U], in_count[i + 1U], in_count[i + 2U], in_count[i + 3U]);
+#else
+    return imageLoad(u_src, c);
+#endif
+}
+
+void main() {
+    ivec2 c = ivec2(gl_GlobalInvocationID.xy);
+    vec4 acc = vec4(0);
+    for (int k = -u_width; k <= u_width; ++k) {
+        acc += load(c + k * u_dir);
+    }
+    imageStore(u_dst, c, acc / float(2 * u_width + 1));
+}
+)");
+
 constexpr str_t f_shader_iso_src = STR(R"(
 #version 330 core
 
@@ -270,17 +354,15 @@ static inline double gauss_sample_map(const double map[180][180], double x, doub
 
 
 void initialize() {
+    initialized = true;
     if (!map::program) {
-        GLuint v_shader = gl::compile_shader_from_source(v_fs_quad_src, GL_VERTEX_SHADER);
-        GLuint f_shader = gl::compile_shader_from_source(f_shader_map_src, GL_FRAGMENT_SHADER);
-        defer {
-            glDeleteShader(v_shader);
-            glDeleteShader(f_shader);
+        const gl::ShaderSource shaders[] = {
+            {GL_VERTEX_SHADER, v_fs_quad_src},
+            {GL_FRAGMENT_SHADER, f_shader_map_src},
         };
 
         map::program = glCreateProgram();
-        const GLuint shaders[] = {v_shader, f_shader};
-        gl::attach_link_detach(map::program, shaders, (int)ARRAY_SIZE(shaders));
+        gl::link_program_from_sources(map::program, shaders, (int)ARRAY_SIZE(shaders));
 
         map::uniform_loc_tex_den    = glGetUniformLocation(map::program, "u_tex_den");
         map::uniform_loc_viewport   = glGetUniformLocation(map::program, "u_viewport");
@@ -292,16 +374,13 @@ void initialize() {
     }
 
     if (!iso::program) {
-        GLuint v_shader = gl::compile_shader_from_source(v_fs_quad_src, GL_VERTEX_SHADER);
-        GLuint f_shader = gl::compile_shader_from_source(f_shader_iso_src, GL_FRAGMENT_SHADER);
-        defer {
-            glDeleteShader(v_shader);
-        glDeleteShader(f_shader);
+        const gl::ShaderSource shaders[] = {
+            {GL_VERTEX_SHADER, v_fs_quad_src},
+            {GL_FRAGMENT_SHADER, f_shader_iso_src},
         };
 
         iso::program = glCreateProgram();
-        const GLuint shaders[] = {v_shader, f_shader};
-        gl::attach_link_detach(iso::program, shaders, (int)ARRAY_SIZE(shaders));
+        gl::link_program_from_sources(iso::program, shaders, (int)ARRAY_SIZE(shaders));
 
         iso::uniform_loc_tex_den    = glGetUniformLocation(iso::program, "u_tex_den");
         iso::uniform_loc_viewport   = glGetUniformLocation(iso::program, "u_viewport");
@@ -321,20 +400,69 @@ void initialize() {
     if (!vao) {
         glGenVertexArrays(1, &vao);
     }
+
+    if (glDispatchCompute && !gpu::program_splat) {
+        GLuint c_splat = gl::compile_shader_from_source(c_shader_splat_src, GL_COMPUTE_SHADER);
+        GLuint c_blur_counts = gl::compile_shader_from_source(c_shader_blur_src, GL_COMPUTE_SHADER, STR("#define SOURCE_COUNTS 1"));
+        GLuint c_blur = gl::compile_shader_from_source(c_shader_blur_src, GL_COMPUTE_SHADER, STR("#define SOURCE_COUNTS 0"));
+        defer {
+            glDeleteShader(c_splat);
+            glDeleteShader(c_blur_counts);
+            glDeleteShader(c_blur);
+        };
+
+        if (c_splat && c_blur_counts && c_blur) {
+            gpu::program_splat = glCreateProgram();
+            gpu::program_blur_counts = glCreateProgram();
+            gpu::program_blur = glCreateProgram();
+            gl::attach_link_detach(gpu::program_splat, &c_splat, 1);
+            gl::attach_link_detach(gpu::program_blur_counts, &c_blur_counts, 1);
+            gl::attach_link_detach(gpu::program_blur, &c_blur, 1);
+
+            const GLsizeiptr density_size = sizeof(uint32_t) * (4 + 4 * density_tex_dim * density_tex_dim);
+            glGenBuffers(1, &gpu::density_buf);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu::density_buf);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, density_size, 0, GL_DYNAMIC_COPY);
+            glGenBuffers(1, &gpu::entry_buf);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            glGenTextures(1, &gpu::tmp_tex);
+            glBindTexture(GL_TEXTURE_2D, gpu::tmp_tex);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, density_tex_dim, density_tex_dim);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        } else {
+            MD_LOG_ERROR("Failed to compile compute shaders for ramachandran density, the density will be computed on the CPU");
+        }
+    }
 }
 
 void shutdown() {
     if (fbo) glDeleteFramebuffers(1, &fbo);
     if (vao) glDeleteVertexArrays(1, &vao);
+    if (gpu::program_splat) glDeleteProgram(gpu::program_splat);
+    if (gpu::program_blur_counts) glDeleteProgram(gpu::program_blur_counts);
+    if (gpu::program_blur) glDeleteProgram(gpu::program_blur);
+    if (gpu::density_buf) glDeleteBuffers(1, &gpu::density_buf);
+    if (gpu::entry_buf) glDeleteBuffers(1, &gpu::entry_buf);
+    if (gpu::tmp_tex) glDeleteTextures(1, &gpu::tmp_tex);
+    gpu::program_splat = gpu::program_blur_counts = gpu::program_blur = 0;
+    gpu::density_buf = gpu::entry_buf = gpu::tmp_tex = 0;
+    fbo = vao = 0;
+    initialized = false;
+}
+
+static inline void ensure_initialized() {
+    if (!initialized) initialize();
 }
 
 }  // namespace ramachandran
 
-static inline void blur_rows_acc(vec4_t* out, const vec4_t* in, int dim, int kernel_width) {
+static inline void blur_rows_acc(vec4_t* out, const vec4_t* in, int dim, int kernel_width, int row_beg = 0, int row_end = -1) {
     const int mod = dim - 1;
     const float scl = 1.0f / (2 * kernel_width + 1);
+    if (row_end < 0) row_end = dim;
 
-    for (int row = 0; row < dim; ++row) {
+    for (int row = row_beg; row < row_end; ++row) {
         const vec4_t* src_row = in + dim * row;
         vec4_t* dst_row = out + dim * row;
 
@@ -361,12 +489,13 @@ static inline void blur_rows_acc(vec4_t* out, const vec4_t* in, int dim, int ker
     }
 }
 
-static inline void transpose(vec4_t* dst, const vec4_t* src, int n) {
-    // Block transpose
+// Block transpose, only the rows [row_beg, row_end) of src are transposed (multiples of the block size)
+static inline void transpose(vec4_t* dst, const vec4_t* src, int n, int row_beg = 0, int row_end = -1) {
     const int block = 8;
     ASSERT(n % block == 0);
+    if (row_end < 0) row_end = n;
 
-    for (int i = 0; i < n; i += block) {
+    for (int i = row_beg; i < row_end; i += block) {
         for (int j = 0; j < n; j += block) {
             for (int k = i; k < i + block; ++k) {
                 for (int l = j; l < j + block; ++l) {
@@ -412,6 +541,30 @@ static void blur_density_box(vec4_t* data, int dim, int num_passes) {
     transpose(data, tmp_data, dim);
 }
 
+struct BlurPass {
+    vec4_t* out;
+    const vec4_t* in;
+    int dim;
+    int kernel_width;   // 0 for a transpose
+};
+
+// Runs a pass over the rows on the pool in blocks of 8 rows and waits for it, the calling thread takes part in the work
+static void blur_pass_parallel(vec4_t* out, const vec4_t* in, int dim, int kernel_width) {
+    BlurPass pass = {out, in, dim, kernel_width};
+    task_system::ID id = task_system::pool_enqueue(STR("##Rama blur"), 0, (uint32_t)dim / 8, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        const BlurPass* pass = (const BlurPass*)user_data;
+        const int row_beg = (int)range_beg * 8;
+        const int row_end = (int)range_end * 8;
+        if (pass->kernel_width > 0) {
+            blur_rows_acc(pass->out, pass->in, pass->dim, pass->kernel_width, row_beg, row_end);
+        } else {
+            transpose(pass->out, pass->in, pass->dim, row_beg, row_end);
+        }
+    }, &pass, 0, task_system::Priority_Interactive);
+    task_system::execute_task(id);
+    task_system::task_wait_for(id);
+}
+
 static void blur_density_gaussian(vec4_t* data, int dim, float sigma) {
     ASSERT(dim > 0 && (dim & (dim - 1)) == 0); // Ensure dimension is power of two
 
@@ -422,15 +575,16 @@ static void blur_density_gaussian(vec4_t* data, int dim, float sigma) {
     int box_w[3];
     boxes_for_gauss(box_w, 3, sigma);
 
-    blur_rows_acc(tmp_data, data, dim, box_w[0]);
-    blur_rows_acc(data, tmp_data, dim, box_w[1]);
-    blur_rows_acc(tmp_data, data, dim, box_w[2]);
-    transpose(data, tmp_data, dim);
+    // Every pass only depends on the complete result of the previous one, the rows within a pass are independent
+    blur_pass_parallel(tmp_data, data, dim, box_w[0]);
+    blur_pass_parallel(data, tmp_data, dim, box_w[1]);
+    blur_pass_parallel(tmp_data, data, dim, box_w[2]);
+    blur_pass_parallel(data, tmp_data, dim, 0);
 
-    blur_rows_acc(tmp_data, data, dim, box_w[0]);
-    blur_rows_acc(data, tmp_data, dim, box_w[1]);
-    blur_rows_acc(tmp_data, data, dim, box_w[2]);
-    transpose(data, tmp_data, dim);
+    blur_pass_parallel(tmp_data, data, dim, box_w[0]);
+    blur_pass_parallel(data, tmp_data, dim, box_w[1]);
+    blur_pass_parallel(tmp_data, data, dim, box_w[2]);
+    blur_pass_parallel(data, tmp_data, dim, 0);
 }
 
 static void init_rama_rep(rama_rep_t* rep) {
@@ -446,7 +600,9 @@ static void init_rama_rep(rama_rep_t* rep) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, density_tex_dim, density_tex_dim);
-
+    rep->den_version = 1;
+    rep->map_key = 0;
+    rep->iso_key = 0;
 
     for (int i = 0; i < 4; ++i) {
         glBindTexture(GL_TEXTURE_2D, rep->map_tex[i]);
@@ -591,34 +747,233 @@ bool rama_init(rama_data_t* data) {
     glBindTexture(GL_TEXTURE_2D, data->ref.den_tex);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, density_tex_dim, density_tex_dim, GL_RGBA, GL_FLOAT, density_map);
     glBindTexture(GL_TEXTURE_2D, 0);
+    data->ref.den_version += 1;
 
     return true;
 }
 
+// Upper bound of partial density textures (4 MB each) and the number of angles which motivates another partial
+#define RAMA_MAX_PARTIALS 16
+#define RAMA_ANGLES_PER_PARTIAL (1 << 18)
+
+// Chunk grids hold uint32 counts (4 MB each), the chunks grow beyond RAMA_CHUNK_FRAMES for long trajectories to bound the memory
+#define RAMA_CHUNK_FRAMES 1024
+#define RAMA_MAX_CHUNKS 32
+
 struct UserData {
     uint64_t alloc_size;
     vec4_t* density_tex;
     rama_rep_t* rep;
     const md_backbone_angles_t* angles;
+    const backbone_angles_q16_t* angles_q16;
     const uint32_t* type_indices[4];
     uint32_t frame_beg;
     uint32_t frame_end;
     uint32_t frame_stride;
     float sigma;
+
+    rama_chunk_cache_t* cache;
+    bool rebuild_cache;
+
+    // Frames which are accumulated from the angles, with a valid cache these are only the edges of the range which are not covered by whole chunks
+    uint32_t span_beg[2];
+    uint32_t span_len[2];
+    uint32_t chunk_beg;     // Whole chunks [chunk_beg, chunk_end) which are composed from the cache
+    uint32_t chunk_end;
+
+    // Each partial accumulates a contiguous range of frames into its own texture, partial 0 is density_tex
+    uint32_t num_partials;
+    vec4_t*  partial_tex[RAMA_MAX_PARTIALS];
+    double   partial_sum[RAMA_MAX_PARTIALS][4];
+
+    uint32_t upload_row;    // Rows of density_tex which have been uploaded
 };
 
-task_system::ID rama_rep_compute_density(rama_rep_t* rep, const md_backbone_angles_t* angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma) {
+static inline bool angle_texel(uint32_t* texel, const UserData* data, uint32_t idx) {
+    const float angle_to_coord_scale = 1.0f / (2.0f * PI);
+    const float angle_to_coord_offset = 0.5f;
+
+    md_backbone_angles_t angle;
+    if (data->angles) {
+        angle = data->angles[idx];
+    } else {
+        angle = {backbone_angle_decode(data->angles_q16[idx].phi), backbone_angle_decode(data->angles_q16[idx].psi)};
+    }
+    if ((angle.phi == 0 && angle.psi == 0)) return false;
+    float u = angle.phi * angle_to_coord_scale + angle_to_coord_offset;
+    float v = angle.psi * angle_to_coord_scale + angle_to_coord_offset;
+    uint32_t x = (uint32_t)(u * density_tex_dim) & (density_tex_dim - 1);
+    uint32_t y = (uint32_t)(v * density_tex_dim) & (density_tex_dim - 1);
+    ASSERT(x < density_tex_dim);
+    ASSERT(y < density_tex_dim);
+    *texel = y * density_tex_dim + x;
+    return true;
+}
+
+static void accumulate_density(vec4_t* density_tex, double sum[4], const UserData* data, uint32_t frame_beg, uint32_t frame_end) {
+    for (uint32_t f = frame_beg; f < frame_end; ++f) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            const uint32_t* indices = data->type_indices[c];
+            const uint32_t num_indices = (uint32_t)md_array_size(data->type_indices[c]);
+            vec4_t val = {0, 0, 0, 0};
+            val.elem[c] = 1.0f;
+            for (uint32_t i = 0; i < num_indices; ++i) {
+                uint32_t texel;
+                if (!angle_texel(&texel, data, f * data->frame_stride + indices[i])) continue;
+                density_tex[texel] += val;
+                sum[c] += 1.0;
+            }
+        }
+    }
+}
+
+// Same as above, but into the (4 channel) integer counts of a chunk grid
+static void accumulate_counts(uint32_t* counts, uint64_t sum[4], const UserData* data, uint32_t frame_beg, uint32_t frame_end) {
+    for (uint32_t f = frame_beg; f < frame_end; ++f) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            const uint32_t* indices = data->type_indices[c];
+            const uint32_t num_indices = (uint32_t)md_array_size(data->type_indices[c]);
+            for (uint32_t i = 0; i < num_indices; ++i) {
+                uint32_t texel;
+                if (!angle_texel(&texel, data, f * data->frame_stride + indices[i])) continue;
+                counts[texel * 4 + c] += 1;
+                sum[c] += 1;
+            }
+        }
+    }
+}
+
+static inline size_t chunk_grid_size() {
+    return (size_t)density_tex_dim * density_tex_dim * 4;
+}
+
+void rama_chunk_cache_free(rama_chunk_cache_t* cache) {
+    ASSERT(cache);
+    if (cache->prefix) md_free(md_heap_allocator, cache->prefix, sizeof(uint32_t) * chunk_grid_size() * (cache->num_chunks + 1));
+    if (cache->prefix_sum) md_free(md_heap_allocator, cache->prefix_sum, sizeof(uint64_t) * 4 * (cache->num_chunks + 1));
+    *cache = {};
+}
+
+size_t rama_chunk_cache_bytes(const rama_chunk_cache_t* cache) {
+    ASSERT(cache);
+    if (!cache->prefix) return 0;
+    return (sizeof(uint32_t) * chunk_grid_size() + sizeof(uint64_t) * 4) * (cache->num_chunks + 1);
+}
+
+// Rebuilds the prefix grids of the cache from the frames [0, frame_end)
+static void rebuild_chunk_cache(UserData* data) {
+    rama_chunk_cache_t* cache = data->cache;
+    cache->valid = false;
+
+    const uint32_t num_frames = data->frame_end;
+    const uint32_t chunk_frames = MAX((uint32_t)RAMA_CHUNK_FRAMES, (num_frames + RAMA_MAX_CHUNKS - 1) / RAMA_MAX_CHUNKS);
+    const uint32_t num_chunks = num_frames / chunk_frames;
+    if (num_chunks < 2) return;
+
+    if (cache->num_chunks != num_chunks || !cache->prefix) {
+        rama_chunk_cache_free(cache);
+        cache->prefix = (uint32_t*)md_alloc(md_heap_allocator, sizeof(uint32_t) * chunk_grid_size() * (num_chunks + 1));
+        cache->prefix_sum = (uint64_t*)md_alloc(md_heap_allocator, sizeof(uint64_t) * 4 * (num_chunks + 1));
+        cache->num_chunks = num_chunks;
+    }
+    cache->chunk_frames = chunk_frames;
+    MEMSET(cache->prefix, 0, sizeof(uint32_t) * chunk_grid_size() * (num_chunks + 1));
+    MEMSET(cache->prefix_sum, 0, sizeof(uint64_t) * 4 * (num_chunks + 1));
+
+    // Grid k + 1 first receives the counts of chunk k alone
+    task_system::ID acc_id = task_system::pool_enqueue(STR("##Rama chunks"), 0, num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        UserData* data = (UserData*)user_data;
+        rama_chunk_cache_t* cache = data->cache;
+        for (uint32_t k = range_beg; k < range_end; ++k) {
+            accumulate_counts(cache->prefix + chunk_grid_size() * (k + 1), cache->prefix_sum + 4 * (k + 1), data, k * cache->chunk_frames, (k + 1) * cache->chunk_frames);
+        }
+    }, data, 0, task_system::Priority_Interactive);
+    task_system::execute_task(acc_id);
+    task_system::task_wait_for(acc_id);
+    if (task_system::task_cancelled()) return;
+
+    // Then the grids are summed in place, which is independent for every texel
+    task_system::ID sum_id = task_system::pool_enqueue(STR("##Rama prefix"), 0, density_tex_dim, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        rama_chunk_cache_t* cache = (rama_chunk_cache_t*)user_data;
+        const size_t beg = (size_t)range_beg * density_tex_dim * 4;
+        const size_t end = (size_t)range_end * density_tex_dim * 4;
+        for (uint32_t k = 1; k <= cache->num_chunks; ++k) {
+            const uint32_t* prev = cache->prefix + chunk_grid_size() * (k - 1);
+            uint32_t* curr = cache->prefix + chunk_grid_size() * k;
+            for (size_t i = beg; i < end; ++i) {
+                curr[i] += prev[i];
+            }
+        }
+    }, cache, 0, task_system::Priority_Interactive);
+    task_system::execute_task(sum_id);
+    task_system::task_wait_for(sum_id);
+    if (task_system::task_cancelled()) return;
+
+    for (uint32_t k = 1; k <= num_chunks; ++k) {
+        for (int c = 0; c < 4; ++c) {
+            cache->prefix_sum[4 * k + c] += cache->prefix_sum[4 * (k - 1) + c];
+        }
+    }
+    cache->valid = true;
+}
+
+// Splits the frames into the spans which are accumulated from the angles and the whole chunks which are taken from the cache
+static void plan_spans(UserData* data) {
+    const rama_chunk_cache_t* cache = data->cache;
+    data->chunk_beg = data->chunk_end = 0;
+    data->span_beg[0] = data->frame_beg;
+    data->span_len[0] = data->frame_end > data->frame_beg ? data->frame_end - data->frame_beg : 0;
+    data->span_beg[1] = data->frame_end;
+    data->span_len[1] = 0;
+
+    if (!cache || !cache->valid) return;
+    const uint32_t C = cache->chunk_frames;
+    const uint32_t cb = (data->frame_beg + C - 1) / C;
+    const uint32_t ce = MIN(data->frame_end / C, cache->num_chunks);
+    if (cb >= ce) return;
+
+    data->chunk_beg = cb;
+    data->chunk_end = ce;
+    data->span_len[0] = cb * C - data->frame_beg;
+    data->span_beg[1] = ce * C;
+    data->span_len[1] = data->frame_end - ce * C;
+}
+
+// Accumulates the frames [beg, end) of the concatenated spans
+static void accumulate_spans(vec4_t* density_tex, double sum[4], const UserData* data, uint32_t beg, uint32_t end) {
+    uint32_t offset = 0;
+    for (int s = 0; s < 2; ++s) {
+        const uint32_t b = MAX(beg, offset);
+        const uint32_t e = MIN(end, offset + data->span_len[s]);
+        if (b < e) {
+            accumulate_density(density_tex, sum, data, data->span_beg[s] + (b - offset), data->span_beg[s] + (e - offset));
+        }
+        offset += data->span_len[s];
+    }
+}
+
+static task_system::ID compute_density(rama_rep_t* rep, const md_backbone_angles_t* angles, const backbone_angles_q16_t* angles_q16, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma, rama_chunk_cache_t* cache, bool rebuild_cache) {
+    ASSERT(!rebuild_cache || (cache && frame_beg == 0));
+
+    size_t num_angles = 0;
+    for (int c = 0; c < 4; ++c) {
+        num_angles += md_array_size(rama_type_indices[c]);
+    }
+    num_angles *= frame_end > frame_beg ? frame_end - frame_beg : 0;
+    const uint32_t max_partials = MIN(MIN(task_system::pool_num_threads(), (uint32_t)RAMA_MAX_PARTIALS), MAX(1u, frame_end - frame_beg));
+    const uint32_t num_partials = CLAMP((uint32_t)(num_angles / RAMA_ANGLES_PER_PARTIAL), 1u, max_partials);
 
     uint64_t tex_size = sizeof(vec4_t) * density_tex_dim * density_tex_dim;
-    uint64_t alloc_size = sizeof(UserData) + tex_size + alignof(vec4_t);
-    UserData* user_data = (UserData*)md_alloc(md_heap_allocator, sizeof(UserData) + tex_size);
+    uint64_t alloc_size = sizeof(UserData) + tex_size * num_partials + alignof(vec4_t);
+    UserData* user_data = (UserData*)md_alloc(md_heap_allocator, alloc_size);
     vec4_t* density_tex = (vec4_t*)NEXT_ALIGNED_ADDRESS(user_data + 1, alignof(vec4_t));
-    memset(density_tex, 0, tex_size);
+    memset(density_tex, 0, tex_size * num_partials);
 
     user_data->alloc_size = alloc_size;
     user_data->density_tex = density_tex;
     user_data->rep = rep;
     user_data->angles = angles;
+    user_data->angles_q16 = angles_q16;
     user_data->type_indices[0] = rama_type_indices[0];
     user_data->type_indices[1] = rama_type_indices[1];
     user_data->type_indices[2] = rama_type_indices[2];
@@ -627,80 +982,251 @@ task_system::ID rama_rep_compute_density(rama_rep_t* rep, const md_backbone_angl
     user_data->frame_end = frame_end;
     user_data->frame_stride = frame_stride;
     user_data->sigma = sigma;
+    user_data->cache = cache;
+    user_data->rebuild_cache = rebuild_cache;
+    user_data->num_partials = num_partials;
+    user_data->upload_row = 0;
+    for (uint32_t p = 0; p < num_partials; ++p) {
+        user_data->partial_tex[p] = density_tex + (size_t)p * density_tex_dim * density_tex_dim;
+        MEMSET(user_data->partial_sum[p], 0, sizeof(user_data->partial_sum[p]));
+    }
 
+    // The density task joins the accumulation, reduction and blur passes which it spawns, so its id covers the whole computation
     task_system::ID id = task_system::pool_enqueue(STR("Rama density"), [](void* user_data) {
         UserData* data = (UserData*)user_data;
-        const float angle_to_coord_scale = 1.0f / (2.0f * PI);
-        const float angle_to_coord_offset = 0.5f;
-
-        const uint32_t frame_beg = data->frame_beg;
-        const uint32_t frame_end = data->frame_end;
-        const uint32_t frame_stride = data->frame_stride;
-        const md_backbone_angles_t* angles = data->angles;
-
-        double sum[4] = {0,0,0,0};
 
-        for (uint32_t f = frame_beg; f < frame_end; ++f) {
-            for (uint32_t c = 0; c < 4; ++c) {
-                const uint32_t* indices = data->type_indices[c];
-                const uint32_t num_indices = (uint32_t)md_array_size(data->type_indices[c]);
-                vec4_t val = {0, 0, 0, 0};
-                val.elem[c] = 1.0f;
-                if (num_indices) {
-                    for (uint32_t i = 0; i < num_indices; ++i) {
-                        uint32_t idx = f * frame_stride + indices[i];
-                        if ((angles[idx].phi == 0 && angles[idx].psi == 0)) continue;
-                        float u = angles[idx].phi * angle_to_coord_scale + angle_to_coord_offset;
-                        float v = angles[idx].psi * angle_to_coord_scale + angle_to_coord_offset;
-                        uint32_t x = (uint32_t)(u * density_tex_dim) & (density_tex_dim - 1);
-                        uint32_t y = (uint32_t)(v * density_tex_dim) & (density_tex_dim - 1);
-                        ASSERT(x < density_tex_dim);
-                        ASSERT(y < density_tex_dim);
-                        data->density_tex[y * density_tex_dim + x] += val;
-                        sum[c] += 1.0;
+        if (data->rebuild_cache) {
+            rebuild_chunk_cache(data);
+            if (task_system::task_cancelled()) return;
+        }
+        plan_spans(data);
+
+        task_system::ID acc_id = task_system::pool_enqueue(STR("##Rama accumulate"), 0, data->num_partials, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            UserData* data = (UserData*)user_data;
+            const uint32_t num_frames = data->span_len[0] + data->span_len[1];
+            for (uint32_t p = range_beg; p < range_end; ++p) {
+                const uint32_t beg = (uint32_t)((uint64_t)num_frames * p / data->num_partials);
+                const uint32_t end = (uint32_t)((uint64_t)num_frames * (p + 1) / data->num_partials);
+                accumulate_spans(data->partial_tex[p], data->partial_sum[p], data, beg, end);
+            }
+        }, data, 0, task_system::Priority_Interactive);
+        task_system::execute_task(acc_id);
+        task_system::task_wait_for(acc_id);
+        if (task_system::task_cancelled()) return;
+
+        const bool use_chunks = data->chunk_beg < data->chunk_end;
+        if (data->num_partials > 1 || use_chunks) {
+            task_system::ID red_id = task_system::pool_enqueue(STR("##Rama reduce"), 0, density_tex_dim, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+                UserData* data = (UserData*)user_data;
+                const size_t beg = (size_t)range_beg * density_tex_dim;
+                const size_t end = (size_t)range_end * density_tex_dim;
+                for (uint32_t p = 1; p < data->num_partials; ++p) {
+                    for (size_t i = beg; i < end; ++i) {
+                        data->density_tex[i] += data->partial_tex[p][i];
                     }
                 }
-            }
+                if (data->chunk_beg < data->chunk_end) {
+                    // The counts of the whole chunks are the difference of two prefix grids
+                    const uint32_t* hi = data->cache->prefix + chunk_grid_size() * data->chunk_end;
+                    const uint32_t* lo = data->cache->prefix + chunk_grid_size() * data->chunk_beg;
+                    for (size_t i = beg; i < end; ++i) {
+                        for (int c = 0; c < 4; ++c) {
+                            data->density_tex[i].elem[c] += (float)(hi[i * 4 + c] - lo[i * 4 + c]);
+                        }
+                    }
+                }
+            }, data, 0, task_system::Priority_Interactive);
+            task_system::execute_task(red_id);
+            task_system::task_wait_for(red_id);
         }
 
         blur_density_gaussian(data->density_tex, density_tex_dim, data->sigma);
 
+        double sum[4] = {0,0,0,0};
+        for (uint32_t p = 0; p < data->num_partials; ++p) {
+            for (int c = 0; c < 4; ++c) {
+                sum[c] += data->partial_sum[p][c];
+            }
+        }
+        if (use_chunks) {
+            for (int c = 0; c < 4; ++c) {
+                sum[c] += (double)(data->cache->prefix_sum[4 * data->chunk_end + c] - data->cache->prefix_sum[4 * data->chunk_beg + c]);
+            }
+        }
         data->rep->den_sum[0] = (float)sum[0];
         data->rep->den_sum[1] = (float)sum[1];
         data->rep->den_sum[2] = (float)sum[2];
         data->rep->den_sum[3] = (float)sum[3];
-    }, user_data);
+    }, user_data, 0, task_system::Priority_Interactive);
 
-    task_system::main_enqueue(STR("##Update rama texture"), [](void* user_data) {
+    // The texture is uploaded in bands of rows, which are spread over frames by the budget of the main tasks
+    task_system::main_enqueue_resumable(STR("##Update rama texture"), [](void* user_data) -> bool {
         UserData* data = (UserData*)user_data;
+        const uint32_t beg = data->upload_row;
+        const uint32_t end = MIN(beg + density_upload_rows, density_tex_dim);
         glBindTexture(GL_TEXTURE_2D, data->rep->den_tex);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, density_tex_dim, density_tex_dim, GL_RGBA, GL_FLOAT, data->density_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, beg, density_tex_dim, end - beg, GL_RGBA, GL_FLOAT, data->density_tex + (size_t)beg * density_tex_dim);
         glBindTexture(GL_TEXTURE_2D, 0);
-        
+        data->upload_row = end;
+        if (end < density_tex_dim) return false;
+
+        data->rep->den_version += 1;
         md_free(md_heap_allocator, data, data->alloc_size);
+        return true;
     }, user_data, id);
 
     return id;
 }
 
-void rama_rep_render_map(rama_rep_t* rep, const float viewport[4], const rama_colormap_t colormap[4], uint32_t display_res) {
-    (void)display_res;
+task_system::ID rama_rep_compute_density(rama_rep_t* rep, const md_backbone_angles_t* angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma, rama_chunk_cache_t* cache, bool rebuild_cache) {
+    return compute_density(rep, angles, NULL, rama_type_indices, frame_beg, frame_end, frame_stride, sigma, cache, rebuild_cache);
+}
 
-    glDisable(GL_BLEND);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
+task_system::ID rama_rep_compute_density(rama_rep_t* rep, const backbone_angles_q16_t* angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma, rama_chunk_cache_t* cache, bool rebuild_cache) {
+    return compute_density(rep, NULL, angles, rama_type_indices, frame_beg, frame_end, frame_stride, sigma, cache, rebuild_cache);
+}
 
-    glViewport(0, 0, tex_dim, tex_dim);
+bool rama_gpu_supported() {
+    ramachandran::ensure_initialized();
+    return ramachandran::gpu::program_splat != 0;
+}
 
-    const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+// Frames dispatched per splat, which keeps the duration of a single dispatch short for long trajectories
+#define RAMA_GPU_FRAMES_PER_DISPATCH 4096
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ramachandran::fbo);
-    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+bool rama_gpu_upload_angles(rama_gpu_angles_t* gpu_angles, const md_backbone_angles_t* angles, const backbone_angles_q16_t* angles_q16, uint32_t num_frames, uint32_t frame_stride, uint64_t fingerprint) {
+    ASSERT(gpu_angles);
+    ASSERT(angles || angles_q16);
+    if (!rama_gpu_supported()) return false;
 
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rep->map_tex[0], 0);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, rep->map_tex[1], 0);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, rep->map_tex[2], 0);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, rep->map_tex[3], 0);
+    const size_t count = (size_t)num_frames * frame_stride;
+    const size_t size = count * sizeof(backbone_angles_q16_t);
+    GLint64 max_size = 0;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_size);
+    if (size == 0 || size > (size_t)max_size) {
+        gpu_angles->fingerprint = 0;
+        return false;
+    }
+
+    if (!gpu_angles->buf) glGenBuffers(1, &gpu_angles->buf);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu_angles->buf);
+    if (angles_q16) {
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, angles_q16, GL_STATIC_DRAW);
+    } else {
+        // The GPU always holds the quantized angles, which is more than enough for the resolution of the density
+        backbone_angles_q16_t* tmp = (backbone_angles_q16_t*)md_alloc(md_heap_allocator, size);
+        backbone_angles_encode(tmp, angles, count);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, tmp, GL_STATIC_DRAW);
+        md_free(md_heap_allocator, tmp, size);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    gpu_angles->num_frames = num_frames;
+    gpu_angles->frame_stride = frame_stride;
+    gpu_angles->fingerprint = fingerprint;
+    return true;
+}
+
+void rama_gpu_free_angles(rama_gpu_angles_t* gpu_angles) {
+    ASSERT(gpu_angles);
+    if (gpu_angles->buf) glDeleteBuffers(1, &gpu_angles->buf);
+    *gpu_angles = {};
+}
+
+bool rama_rep_compute_density_gpu(rama_rep_t* rep, const rama_gpu_angles_t* gpu_angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, float sigma) {
+    using namespace ramachandran;
+    ASSERT(rep);
+    ASSERT(gpu_angles);
+    if (!rama_gpu_supported() || !gpu_angles->buf) return false;
+    frame_end = MIN(frame_end, gpu_angles->num_frames);
+
+    md_array(uint32_t) entries = 0;
+    defer { md_array_free(entries, md_heap_allocator); };
+    for (uint32_t c = 0; c < 4; ++c) {
+        for (size_t i = 0; i < md_array_size(rama_type_indices[c]); ++i) {
+            md_array_push(entries, rama_type_indices[c][i] | (c << 30), md_heap_allocator);
+        }
+    }
+    const uint32_t num_entries = (uint32_t)md_array_size(entries);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu::entry_buf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX(num_entries, 1) * sizeof(uint32_t), entries, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu::density_buf);
+    const uint32_t zero = 0;
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu_angles->buf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpu::entry_buf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpu::density_buf);
+
+    if (num_entries > 0) {
+        glUseProgram(gpu::program_splat);
+        glUniform1ui(glGetUniformLocation(gpu::program_splat, "u_frame_stride"), gpu_angles->frame_stride);
+        glUniform1ui(glGetUniformLocation(gpu::program_splat, "u_num_entries"), num_entries);
+        glUniform1ui(glGetUniformLocation(gpu::program_splat, "u_dim"), density_tex_dim);
+        for (uint32_t beg = frame_beg; beg < frame_end; beg += RAMA_GPU_FRAMES_PER_DISPATCH) {
+            const uint32_t end = MIN(beg + RAMA_GPU_FRAMES_PER_DISPATCH, frame_end);
+            glUniform1ui(glGetUniformLocation(gpu::program_splat, "u_frame_beg"), beg);
+            glUniform1ui(glGetUniformLocation(gpu::program_splat, "u_frame_end"), end);
+            glDispatchCompute((num_entries + 63) / 64, MIN(end - beg, 256), 1);
+        }
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Same separable box filters as the CPU path, rows first, ping-ponging between the density texture and a temporary
+    int box_w[3];
+    boxes_for_gauss(box_w, 3, sigma);
+
+    struct Pass {
+        GLuint src;
+        GLuint dst;
+        int dir_x;
+        int width;
+    } passes[6] = {
+        {0,              gpu::tmp_tex,   1, box_w[0]},
+        {gpu::tmp_tex,   rep->den_tex,   1, box_w[1]},
+        {rep->den_tex,   gpu::tmp_tex,   1, box_w[2]},
+        {gpu::tmp_tex,   rep->den_tex,   0, box_w[0]},
+        {rep->den_tex,   gpu::tmp_tex,   0, box_w[1]},
+        {gpu::tmp_tex,   rep->den_tex,   0, box_w[2]},
+    };
+
+    for (int i = 0; i < (int)ARRAY_SIZE(passes); ++i) {
+        const Pass& pass = passes[i];
+        const GLuint program = pass.src ? gpu::program_blur : gpu::program_blur_counts;
+        glUseProgram(program);
+        if (pass.src) glBindImageTexture(0, pass.src, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+        glBindImageTexture(1, pass.dst, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+        glUniform2i(glGetUniformLocation(program, "u_dir"), pass.dir_x, 1 - pass.dir_x);
+        glUniform1i(glGetUniformLocation(program, "u_width"), pass.width);
+        glUniform1i(glGetUniformLocation(program, "u_dim"), (int)density_tex_dim);
+        glDispatchCompute(density_tex_dim / 8, density_tex_dim / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    glUseProgram(0);
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    for (int i = 0; i < 3; ++i) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+    }
+
+    // The sums are small, but reading them waits for the splat to finish
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    uint32_t sum[4] = {0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu::density_buf);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(sum), sum);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    for (int i = 0; i < 4; ++i) {
+        rep->den_sum[i] = (float)sum[i];
+    }
+    rep->den_version += 1;
+
+    return true;
+}
+
+void rama_rep_render_map(rama_rep_t* rep, const float viewport[4], const rama_colormap_t colormap[4], uint32_t display_res) {
+    (void)display_res;
 
     vec4_t vp = {viewport[0], viewport[1], viewport[2] - viewport[0], viewport[3] - viewport[1]};
     vec4_t   colors[64] = {0};
@@ -718,6 +1244,33 @@ void rama_rep_render_map(rama_rep_t* rep, const float viewport[4], const rama_co
         }
     }
 
+    // The key covers everything which ends up in the uniforms
+    uint64_t key = script_hash(&rep->den_version, sizeof(rep->den_version));
+    key = script_hash(&vp, sizeof(vp), key);
+    key = script_hash(colors, sizeof(vec4_t) * idx, key);
+    key = script_hash(length, sizeof(length), key);
+    key = script_hash(range, sizeof(range), key);
+    if (key == rep->map_key) return;
+    rep->map_key = key;
+
+    ramachandran::ensure_initialized();
+
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+
+    glViewport(0, 0, tex_dim, tex_dim);
+
+    const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ramachandran::fbo);
+    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rep->map_tex[0], 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, rep->map_tex[1], 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, rep->map_tex[2], 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, rep->map_tex[3], 0);
+
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, rep->den_tex);
 
@@ -740,22 +1293,6 @@ void rama_rep_render_map(rama_rep_t* rep, const float viewport[4], const rama_co
 }
 
 void rama_rep_render_iso(rama_rep_t* rep, const float viewport[4], const rama_isomap_t isomap[4], uint32_t display_res) {
-    glDisable(GL_BLEND);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-
-    glViewport(0, 0, tex_dim, tex_dim);
-
-    const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
-
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ramachandran::fbo);
-    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
-
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rep->iso_tex[0], 0);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, rep->iso_tex[1], 0);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, rep->iso_tex[2], 0);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, rep->iso_tex[3], 0);
-
     vec4_t vp = {viewport[0], viewport[1], viewport[2] - viewport[0], viewport[3] - viewport[1]};
 
     const uint32_t cap = 32;
@@ -791,6 +1328,33 @@ void rama_rep_render_iso(rama_rep_t* rep, const float viewport[4], const rama_is
 
     float contour_line_scale = (float)tex_dim / (float)display_res;
 
+    uint64_t key = script_hash(&rep->den_version, sizeof(rep->den_version));
+    key = script_hash(&vp, sizeof(vp), key);
+    key = script_hash(length, sizeof(length), key);
+    key = script_hash(level_colors, sizeof(level_colors), key);
+    key = script_hash(contour_colors, sizeof(contour_colors), key);
+    key = script_hash(values, sizeof(values), key);
+    key = script_hash(&contour_line_scale, sizeof(contour_line_scale), key);
+    if (key == rep->iso_key) return;
+    rep->iso_key = key;
+
+    ramachandran::ensure_initialized();
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+
+    glViewport(0, 0, tex_dim, tex_dim);
+
+    const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ramachandran::fbo);
+    glDrawBuffers((int)ARRAY_SIZE(draw_buffers), draw_buffers);
+
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rep->iso_tex[0], 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, rep->iso_tex[1], 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, rep->iso_tex[2], 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, rep->iso_tex[3], 0);
+
     glUseProgram(ramachandran::iso::program);
 
     glUniform1i (ramachandran::iso::uniform_loc_tex_den, 0);
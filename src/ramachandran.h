@@ -4,8 +4,10 @@
 #include <stdbool.h>
 #include <md_molecule.h>
 #include <task_system.h>
+#include <backbone_data.h>
 
 namespace ramachandran {
+	// Compiles the programs, which is otherwise done when they are first used
 	void initialize();
 	void shutdown();
 };
@@ -16,6 +18,11 @@ struct rama_rep_t {
 	uint32_t iso_tex[4];
 	float    den_sum[4];	// Density sum for each ramachandran type (General, Glycine, Proline and PreProline)
 	uint32_t den_tex;		// This uses 4 channels, one for each ramachandran type (General, Glycine, Proline and PreProline)
+	uint64_t den_version;	// Incremented whenever den_tex is written
+
+	// Inputs of the last render into map_tex and iso_tex, which are only rendered again when they change
+	uint64_t map_key;
+	uint64_t iso_key;
 };
 
 struct rama_data_t {
@@ -38,14 +45,52 @@ struct rama_isomap_t {
 	uint32_t count;
 };
 
+// Resamples the reference densities, which is deferred by the application until the densities are shown
 bool rama_init(rama_data_t* data);
 bool rama_free(rama_data_t* data);
 
-task_system::ID rama_rep_compute_density(rama_rep_t* rep, const md_backbone_angles_t* angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma = 5.0f);
+// Counts of chunks of frames in summed form, prefix[k] holds the counts of the frames [0, k * chunk_frames)
+// Any frame range is then composed from the difference of two grids and the frames at the edges which are not covered by whole chunks
+struct rama_chunk_cache_t {
+	uint32_t  chunk_frames;
+	uint32_t  num_chunks;
+	uint32_t* prefix;		// (num_chunks + 1) grids of density_tex_dim^2 * 4 counts
+	uint64_t* prefix_sum;	// (num_chunks + 1) * 4 sums
+	bool      valid;		// Set when a rebuild has completed
+};
+
+void rama_chunk_cache_free(rama_chunk_cache_t* cache);
+size_t rama_chunk_cache_bytes(const rama_chunk_cache_t* cache);
+
+// If a (valid) cache is given, the whole chunks of the range are taken from it
+// With rebuild_cache, the cache is first rebuilt from the frames [0, frame_end), which requires frame_beg to be 0
+// The cache must not be used by another computation while it is rebuilt
+task_system::ID rama_rep_compute_density(rama_rep_t* rep, const md_backbone_angles_t* angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma = 5.0f, rama_chunk_cache_t* cache = NULL, bool rebuild_cache = false);
+// Same as above, but sources the angles from compact (int16 quantized) storage
+task_system::ID rama_rep_compute_density(rama_rep_t* rep, const backbone_angles_q16_t* angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, uint32_t frame_stride, float sigma = 5.0f, rama_chunk_cache_t* cache = NULL, bool rebuild_cache = false);
+
+// GPU path, which keeps the angles resident in a storage buffer and splats and blurs the density in compute shaders
+// Requires OpenGL 4.3 and must be called from the thread which owns the GL context
+struct rama_gpu_angles_t {
+	uint32_t buf;			// Quantized angles (backbone_angles_q16_t) of all frames
+	uint32_t num_frames;
+	uint32_t frame_stride;
+	uint64_t fingerprint;	// Fingerprint of the backbone angles which were uploaded
+};
+
+bool rama_gpu_supported();
+
+// Uploads the angles of all frames (either angles or angles_q16), returns false if they do not fit in a storage buffer
+bool rama_gpu_upload_angles(rama_gpu_angles_t* gpu_angles, const md_backbone_angles_t* angles, const backbone_angles_q16_t* angles_q16, uint32_t num_frames, uint32_t frame_stride, uint64_t fingerprint);
+void rama_gpu_free_angles(rama_gpu_angles_t* gpu_angles);
+
+// Computes the density of [frame_beg, frame_end) directly into the density texture of rep, this executes immediately
+bool rama_rep_compute_density_gpu(rama_rep_t* rep, const rama_gpu_angles_t* gpu_angles, const uint32_t* rama_type_indices[4], uint32_t frame_beg, uint32_t frame_end, float sigma = 5.0f);
 
 // Computes the iso levels given a set of percentiles, e.g. (0.85) will compute which (density) value best corresponds to that
 //bool rama_rep_compute_density_levels(float* out_levels[4], const rama_rep_t* rep, const float* percentiles, int64_t num_percentiles);
 
 // Display resolution is the max dim of the displayed texture resolution, this is used as a hint to get the renderings to look better (anti-aliased lines etc dependent on the effective view resolution)
+// The textures are retained, rendering is skipped if the density, the viewport and the maps are the same as in the last call
 void rama_rep_render_map(rama_rep_t* rep, const float viewport[4], const rama_colormap_t colormap[4], uint32_t display_res);
 void rama_rep_render_iso(rama_rep_t* rep, const float viewport[4], const rama_isomap_t isomap[4], uint32_t display_res);
@@ -0,0 +1,166 @@
+#include "script_fingerprint.h"
+
+#include <core/md_common.h>
+#include <core/md_array.h>
+
+static inline bool is_ident_beg(char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+}
+
+static inline bool is_ident_char(char c) {
+    return is_ident_beg(c) || ('0' <= c && c <= '9');
+}
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+struct Statement {
+    size_t beg;     // Range within the normalized buffer
+    size_t end;
+    size_t eq;      // Position of the assignment, or end if there is none
+    uint64_t ident;
+};
+
+// Strip comments and whitespace (except within strings and where it separates two identifiers) and split into statements on ';'
+static void normalize(char** buf, Statement** stmts, str_t src, md_allocator_i* alloc) {
+    size_t beg = 0;
+    bool in_str = false;
+    bool pending_space = false;
+    for (size_t i = 0; i < src.len; ++i) {
+        const char c = src.ptr[i];
+        if (in_str) {
+            md_array_push(*buf, c, alloc);
+            if (c == '"') in_str = false;
+            continue;
+        }
+        if (c == '#') {
+            while (i < src.len && src.ptr[i] != '\n') ++i;
+            pending_space = true;
+            continue;
+        }
+        if (is_space(c)) {
+            pending_space = true;
+            continue;
+        }
+        if (pending_space) {
+            const size_t len = md_array_size(*buf);
+            if (len > beg && is_ident_char((*buf)[len - 1]) && is_ident_char(c)) {
+                md_array_push(*buf, ' ', alloc);
+            }
+            pending_space = false;
+        }
+        if (c == ';') {
+            const size_t end = md_array_size(*buf);
+            if (end > beg) {
+                Statement s = {beg, end, end, 0};
+                md_array_push(*stmts, s, alloc);
+            }
+            beg = end;
+            continue;
+        }
+        if (c == '"') in_str = true;
+        md_array_push(*buf, c, alloc);
+    }
+    const size_t end = md_array_size(*buf);
+    if (end > beg) {
+        Statement s = {beg, end, end, 0};
+        md_array_push(*stmts, s, alloc);
+    }
+}
+
+static void find_assignment(Statement* s, const char* buf) {
+    for (size_t i = s->beg; i < s->end; ++i) {
+        if (buf[i] != '=') continue;
+        const char prev = i > s->beg ? buf[i - 1] : 0;
+        const char next = i + 1 < s->end ? buf[i + 1] : 0;
+        if (next == '=' || prev == '=' || prev == '<' || prev == '>' || prev == '!') {
+            i += (next == '=');
+            continue;
+        }
+        // The left hand side must be a single identifier
+        size_t b = s->beg;
+        size_t e = i;
+        if (e > b && buf[e - 1] == ' ') --e;
+        if (b == e || !is_ident_beg(buf[b])) return;
+        for (size_t j = b; j < e; ++j) {
+            if (!is_ident_char(buf[j])) return;
+        }
+        s->eq = i;
+        s->ident = script_hash(buf + b, e - b);
+        return;
+    }
+}
+
+ScriptStatementFingerprint* script_statement_fingerprints(str_t src, md_allocator_i* alloc) {
+    ASSERT(alloc);
+    char* buf = 0;
+    Statement* stmts = 0;
+    normalize(&buf, &stmts, src, alloc);
+
+    const size_t num_stmts = md_array_size(stmts);
+    ScriptStatementFingerprint* result = 0;
+    md_array_resize(result, num_stmts, alloc);
+
+    for (size_t i = 0; i < num_stmts; ++i) {
+        Statement& s = stmts[i];
+        find_assignment(&s, buf);
+
+        uint64_t h = script_hash(buf + s.beg, s.end - s.beg);
+
+        // Referenced identifiers resolve to the latest preceding definition
+        const size_t rhs = s.eq < s.end ? s.eq + 1 : s.beg;
+        size_t j = rhs;
+        while (j < s.end) {
+            if (buf[j] == '"') {
+                ++j;
+                while (j < s.end && buf[j] != '"') ++j;
+                ++j;
+                continue;
+            }
+            if (!is_ident_beg(buf[j]) || (j > rhs && is_ident_char(buf[j - 1]))) {
+                ++j;
+                continue;
+            }
+            const size_t b = j;
+            while (j < s.end && is_ident_char(buf[j])) ++j;
+            const uint64_t ident = script_hash(buf + b, j - b);
+            for (size_t k = i; k > 0; --k) {
+                if (stmts[k - 1].ident == ident) {
+                    h = script_hash(&result[k - 1].fingerprint, sizeof(uint64_t), h);
+                    break;
+                }
+            }
+        }
+
+        result[i].ident = s.ident;
+        result[i].fingerprint = h;
+    }
+
+    md_array_free(buf, alloc);
+    md_array_free(stmts, alloc);
+    return result;
+}
+
+uint64_t script_source_fingerprint(const ScriptStatementFingerprint* statements, size_t count) {
+    uint64_t h = script_hash(&count, sizeof(count));
+    for (size_t i = 0; i < count; ++i) {
+        h = script_hash(&statements[i].fingerprint, sizeof(uint64_t), h);
+    }
+    return h;
+}
+
+size_t script_statements_changed(const ScriptStatementFingerprint* curr, size_t curr_count, const ScriptStatementFingerprint* prev, size_t prev_count) {
+    size_t changed = 0;
+    for (size_t i = 0; i < curr_count; ++i) {
+        bool found = false;
+        for (size_t j = 0; j < prev_count; ++j) {
+            if (curr[i].fingerprint == prev[j].fingerprint) {
+                found = true;
+                break;
+            }
+        }
+        changed += !found;
+    }
+    return changed;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_str.h>
+
+struct md_allocator_i;
+
+// Fingerprints of the statements of a script, computed from the source text
+// Whitespace and comments are ignored, so edits which do not change the meaning of a statement keep its fingerprint.
+// The fingerprint of a statement includes the fingerprints of the statements which define the identifiers it references,
+// so a change propagates to everything which depends on it.
+
+struct ScriptStatementFingerprint {
+    uint64_t ident;         // Hash of the assigned identifier, 0 for statements without an assignment
+    uint64_t fingerprint;
+};
+
+// Returns an md_array with one entry per statement in the order of the source
+ScriptStatementFingerprint* script_statement_fingerprints(str_t src, md_allocator_i* alloc);
+
+// Combined fingerprint of all statements, sensitive to their order
+uint64_t script_source_fingerprint(const ScriptStatementFingerprint* statements, size_t count);
+
+// Number of statements in curr which have no statement with the same fingerprint in prev (new or modified)
+size_t script_statements_changed(const ScriptStatementFingerprint* curr, size_t curr_count, const ScriptStatementFingerprint* prev, size_t prev_count);
+
+static inline uint64_t script_hash(const void* data, size_t len, uint64_t seed = 0xcbf29ce484222325ULL) {
+    // FNV-1a
+    const uint8_t* ptr = (const uint8_t*)data;
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= ptr[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
@@ -0,0 +1,193 @@
+#include "scrub_proxy.h"
+
+#include <md_molecule.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#include <float.h>
+#include <string.h>
+#include <new>
+
+#define SCRUB_PROXY_QUANT 65535.0f
+
+bool scrub_proxy_init(ScrubProxy* proxy, const md_molecule_t* mol, const uint32_t* colors, uint32_t num_frames, size_t max_bytes, md_allocator_i* alloc) {
+    ASSERT(proxy);
+    ASSERT(mol);
+    ASSERT(alloc);
+    scrub_proxy_free(proxy);
+    if (mol->residue.count == 0 || num_frames == 0) return false;
+
+    const uint32_t num_beads = (uint32_t)mol->residue.count;
+    proxy->alloc = alloc;
+    proxy->num_beads  = num_beads;
+    proxy->bead_beg   = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * num_beads);
+    proxy->bead_end   = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * num_beads);
+    proxy->bead_color = (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * num_beads);
+    for (uint32_t i = 0; i < num_beads; ++i) {
+        const md_range_t range = md_residue_atom_range(mol->residue, i);
+        proxy->bead_beg[i] = (uint32_t)range.beg;
+        proxy->bead_end[i] = (uint32_t)range.end;
+        proxy->bead_color[i] = (colors && range.end > range.beg) ? colors[range.beg] : 0xFFFFFFFFU;
+    }
+
+    // Backbone residues collapse onto their C-alpha and are traced in order within each backbone range
+    #define VALID_RES(i) (mol->backbone.residue_idx[i] >= 0 && mol->backbone.residue_idx[i] < (int32_t)num_beads)
+    for (int pass = 0; pass < 2; ++pass) {
+        uint32_t num_traces = 0;
+        for (size_t r = 0; r < mol->backbone.range_count; ++r) {
+            const md_range_t range = mol->backbone.range[r];
+            for (int32_t i = range.beg; i < range.end; ++i) {
+                if (!VALID_RES(i)) continue;
+                const int32_t res_idx = mol->backbone.residue_idx[i];
+                if (pass == 1) {
+                    const uint32_t ca = (uint32_t)mol->backbone.atoms[i].ca;
+                    proxy->bead_beg[res_idx] = ca;
+                    proxy->bead_end[res_idx] = ca + 1;
+                }
+                if (i > range.beg && VALID_RES(i - 1)) {
+                    if (pass == 1) {
+                        proxy->trace[num_traces * 2 + 0] = (uint32_t)mol->backbone.residue_idx[i - 1];
+                        proxy->trace[num_traces * 2 + 1] = (uint32_t)res_idx;
+                    }
+                    num_traces += 1;
+                }
+            }
+        }
+        if (pass == 0) {
+            proxy->num_traces = num_traces;
+            proxy->trace = num_traces ? (uint32_t*)md_alloc(alloc, sizeof(uint32_t) * 2 * num_traces) : nullptr;
+        }
+    }
+    #undef VALID_RES
+
+    // Every stride:th frame is kept, starting with the first, as many as fit within max_bytes
+    const size_t slot_bytes = sizeof(uint16_t) * 3 * num_beads + sizeof(float) * 6 + sizeof(std::atomic_uint8_t);
+    const size_t max_slots = MAX((size_t)2, max_bytes / slot_bytes);
+    proxy->num_frames = num_frames;
+    proxy->stride = (uint32_t)(((size_t)num_frames + max_slots - 1) / max_slots);
+    proxy->num_slots = (num_frames + proxy->stride - 1) / proxy->stride;
+    proxy->coords = (uint16_t*)md_alloc(alloc, sizeof(uint16_t) * 3 * num_beads * proxy->num_slots);
+    proxy->box    = (float*)md_alloc(alloc, sizeof(float) * 6 * proxy->num_slots);
+    proxy->ready  = (std::atomic_uint8_t*)md_alloc(alloc, sizeof(std::atomic_uint8_t) * proxy->num_slots);
+    for (uint32_t i = 0; i < proxy->num_slots; ++i) {
+        new (&proxy->ready[i]) std::atomic_uint8_t(0);
+    }
+
+    if (proxy->stride > 1) {
+        MD_LOG_DEBUG("Scrub proxy keeps every %u:th of %u frames", proxy->stride, num_frames);
+    }
+    return true;
+}
+
+void scrub_proxy_free(ScrubProxy* proxy) {
+    ASSERT(proxy);
+    if (proxy->alloc) {
+        const size_t num_beads = proxy->num_beads;
+        md_free(proxy->alloc, proxy->bead_beg, sizeof(uint32_t) * num_beads);
+        md_free(proxy->alloc, proxy->bead_end, sizeof(uint32_t) * num_beads);
+        md_free(proxy->alloc, proxy->bead_color, sizeof(uint32_t) * num_beads);
+        if (proxy->trace) md_free(proxy->alloc, proxy->trace, sizeof(uint32_t) * 2 * proxy->num_traces);
+        md_free(proxy->alloc, proxy->coords, sizeof(uint16_t) * 3 * num_beads * proxy->num_slots);
+        md_free(proxy->alloc, proxy->box, sizeof(float) * 6 * proxy->num_slots);
+        md_free(proxy->alloc, proxy->ready, sizeof(std::atomic_uint8_t) * proxy->num_slots);
+    }
+    *proxy = {};
+}
+
+static inline void bead_position(const ScrubProxy* proxy, uint32_t i, const float* x, const float* y, const float* z, float out[3]) {
+    const uint32_t beg = proxy->bead_beg[i];
+    const uint32_t end = proxy->bead_end[i];
+    if (end - beg == 1) {
+        out[0] = x[beg];
+        out[1] = y[beg];
+        out[2] = z[beg];
+        return;
+    }
+    float sx = 0, sy = 0, sz = 0;
+    for (uint32_t j = beg; j < end; ++j) {
+        sx += x[j];
+        sy += y[j];
+        sz += z[j];
+    }
+    const float inv = end > beg ? 1.0f / (float)(end - beg) : 0.0f;
+    out[0] = sx * inv;
+    out[1] = sy * inv;
+    out[2] = sz * inv;
+}
+
+void scrub_proxy_add_frame(ScrubProxy* proxy, uint32_t frame_idx, const float* x, const float* y, const float* z) {
+    ASSERT(proxy);
+    if (!proxy->num_slots || frame_idx >= proxy->num_frames || frame_idx % proxy->stride != 0) return;
+    const uint32_t slot = frame_idx / proxy->stride;
+    if (proxy->ready[slot].load(std::memory_order_acquire)) return;
+
+    const uint32_t n = proxy->num_beads;
+    float box_min[3] = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+    float box_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (uint32_t i = 0; i < n; ++i) {
+        float p[3];
+        bead_position(proxy, i, x, y, z, p);
+        for (int c = 0; c < 3; ++c) {
+            box_min[c] = MIN(box_min[c], p[c]);
+            box_max[c] = MAX(box_max[c], p[c]);
+        }
+    }
+
+    float* box = proxy->box + slot * 6;
+    float inv_scale[3];
+    for (int c = 0; c < 3; ++c) {
+        const float ext = box_max[c] - box_min[c];
+        box[c] = box_min[c];
+        box[c + 3] = ext > 0 ? ext / SCRUB_PROXY_QUANT : 0.0f;
+        inv_scale[c] = ext > 0 ? SCRUB_PROXY_QUANT / ext : 0.0f;
+    }
+
+    uint16_t* q = proxy->coords + (size_t)slot * 3 * n;
+    for (uint32_t i = 0; i < n; ++i) {
+        float p[3];
+        bead_position(proxy, i, x, y, z, p);
+        for (int c = 0; c < 3; ++c) {
+            q[c * n + i] = (uint16_t)((p[c] - box_min[c]) * inv_scale[c] + 0.5f);
+        }
+    }
+    proxy->ready[slot].store(1, std::memory_order_release);
+}
+
+int64_t scrub_proxy_decode(const ScrubProxy* proxy, double frame, float* x, float* y, float* z) {
+    ASSERT(proxy);
+    if (!proxy->num_slots) return -1;
+
+    // Search outwards from the nearest slot, the sweep may not have reached it yet
+    const double f = CLAMP(frame / (double)proxy->stride + 0.5, 0.0, (double)(proxy->num_slots - 1));
+    const int64_t center = (int64_t)f;
+    int64_t slot = -1;
+    for (int64_t d = 0; d < (int64_t)proxy->num_slots && slot == -1; ++d) {
+        if (center - d >= 0 && proxy->ready[center - d].load(std::memory_order_acquire)) {
+            slot = center - d;
+        } else if (center + d < (int64_t)proxy->num_slots && proxy->ready[center + d].load(std::memory_order_acquire)) {
+            slot = center + d;
+        } else if (center - d < 0 && center + d >= (int64_t)proxy->num_slots) {
+            break;
+        }
+    }
+    if (slot == -1) return -1;
+
+    const uint32_t n = proxy->num_beads;
+    const float* box = proxy->box + slot * 6;
+    const uint16_t* q = proxy->coords + (size_t)slot * 3 * n;
+    for (uint32_t i = 0; i < n; ++i) {
+        x[i] = box[0] + (float)q[i] * box[3];
+        y[i] = box[1] + (float)q[n + i] * box[4];
+        z[i] = box[2] + (float)q[n * 2 + i] * box[5];
+    }
+    return slot * proxy->stride;
+}
+
+size_t scrub_proxy_memory_usage(const ScrubProxy* proxy) {
+    ASSERT(proxy);
+    if (!proxy->alloc) return 0;
+    return sizeof(uint32_t) * 3 * proxy->num_beads + sizeof(uint32_t) * 2 * proxy->num_traces +
+        (sizeof(uint16_t) * 3 * proxy->num_beads + sizeof(float) * 6 + sizeof(std::atomic_uint8_t)) * proxy->num_slots;
+}
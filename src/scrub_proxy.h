@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct md_allocator_i;
+struct md_molecule_t;
+
+// Compact per-frame positions of one bead per residue, which stand in for the structure while the timeline is scrubbed
+// Residues with a backbone are represented by their C-alpha atom and connected into traces along the backbone, other residues by their centroid.
+// The positions are quantized to 16 bits within the bounding box of the frame, and only every stride:th frame is kept if all frames
+// do not fit in the memory limit. Frames are added from the threads of the trajectory sweep, in any order.
+
+struct ScrubProxy {
+    uint32_t num_beads = 0;
+    uint32_t* bead_beg = nullptr;       // [num_beads] Atom range of each bead, a single atom for C-alpha beads
+    uint32_t* bead_end = nullptr;
+    uint32_t* bead_color = nullptr;     // [num_beads]
+
+    uint32_t num_traces = 0;
+    uint32_t* trace = nullptr;          // [num_traces][2] Beads connected along the backbone
+
+    uint32_t num_frames = 0;
+    uint32_t stride = 1;                // Frames per slot
+    uint32_t num_slots = 0;
+    uint16_t* coords = nullptr;         // [num_slots][3][num_beads]
+    float* box = nullptr;               // [num_slots][6] Minimum and scale of each axis
+    std::atomic_uint8_t* ready = nullptr; // [num_slots]
+
+    md_allocator_i* alloc = nullptr;
+};
+
+// colors are the colors of the atoms, which the beads take from their first atom. Returns false if the molecule has no residues
+bool scrub_proxy_init(ScrubProxy* proxy, const md_molecule_t* mol, const uint32_t* colors, uint32_t num_frames, size_t max_bytes, md_allocator_i* alloc);
+void scrub_proxy_free(ScrubProxy* proxy);
+
+// Stores the beads of the frame if it is the first frame of its slot
+void scrub_proxy_add_frame(ScrubProxy* proxy, uint32_t frame_idx, const float* x, const float* y, const float* z);
+
+// Writes the beads of the slot nearest to frame which has been added, returns the frame of the slot or -1 if there is none
+int64_t scrub_proxy_decode(const ScrubProxy* proxy, double frame, float* x, float* y, float* z);
+
+size_t scrub_proxy_memory_usage(const ScrubProxy* proxy);
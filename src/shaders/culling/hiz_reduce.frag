@@ -0,0 +1,25 @@
+#version 150 core
+
+// Reduces the depth buffer into tiles of TILE_SIZE^2 pixels which hold the farthest depth within the tile
+
+#ifndef TILE_SIZE
+#define TILE_SIZE 16
+#endif
+
+uniform sampler2D u_tex_depth;
+
+out vec4 out_frag;
+
+void main() {
+    ivec2 size = textureSize(u_tex_depth, 0);
+    ivec2 beg  = ivec2(gl_FragCoord.xy) * TILE_SIZE;
+    ivec2 end  = min(beg + TILE_SIZE, size);
+
+    float d = 0.0;
+    for (int y = beg.y; y < end.y; ++y) {
+        for (int x = beg.x; x < end.x; ++x) {
+            d = max(d, texelFetch(u_tex_depth, ivec2(x, y), 0).x);
+        }
+    }
+    out_frag = vec4(d);
+}
@@ -2,22 +2,32 @@
 
 uniform sampler2D u_texture_atom_idx;
 uniform usamplerBuffer u_buffer_selection;
-uniform vec3 u_highlight = vec3(1,1,1);
-uniform vec3 u_selection = vec3(1,1,1);
-uniform vec3 u_outline = vec3(1,1,0);
+uniform uint u_index_offset[16];    // Offset into the selection buffer per index tag and bond bit, ~0 if the index space is not present
+uniform vec4 u_highlight = vec4(1,1,0,0.25);
+uniform vec4 u_selection = vec4(0,0,1,0.25);
+uniform float u_outline_alpha = 1.0;
 
 in vec2 tc;
 out vec4 out_frag;
 
 uint unpackUnorm4x8(in vec4 v) {
-    uvec4 uv = uvec4(v * 255.f);
+    uvec4 uv = uvec4(v * 255.f + 0.5);
     return uv.x | (uv.y << 8) | (uv.z << 16) | (uv.w << 24);
 }
 
+// Bit 31 marks bonds and bits 28-30 hold the tag of indices which are local to a compacted molecule
 uint fetch_value(ivec2 coord) {
     vec4 c = texelFetch(u_texture_atom_idx, ivec2(gl_FragCoord.xy) + coord, 0);
-    uint atom_idx = unpackUnorm4x8(c);
-    return texelFetch(u_buffer_selection, int(atom_idx)).x;
+    uint idx = unpackUnorm4x8(c);
+    if (idx == 0xFFFFFFFFU) return 0U;
+    uint tag  = (idx >> 28U) & 7U;
+    uint bond = idx >> 31U;
+    uint local  = idx & (tag != 0U ? 0x0FFFFFFFU : 0x7FFFFFFFU);
+    uint offset = u_index_offset[tag * 2U + bond];
+    if (offset == 0xFFFFFFFFU) return 0U;
+    int i = int(offset + local);
+    if (i >= textureSize(u_buffer_selection)) return 0U;
+    return texelFetch(u_buffer_selection, i).x;
 }
 
 void main() {
@@ -26,17 +36,15 @@ void main() {
     uint xp = fetch_value(ivec2(+1,0));
     uint yn = fetch_value(ivec2(0,-1));
     uint yp = fetch_value(ivec2(0,+1));
+    uint n  = xn | xp | yn | yp;
 
-    float f_c = float(c != 0U);
-    float f_n = float(xn != 0U) + float(xp != 0U) + float(yn != 0U) + float(yp != 0U);
+    if ((c | n) == 0U) discard;
 
-    float line_t = 1.0 - step(0.0, 4.0 * f_c - f_n);
-    float highlight_t = float((c & 1U) != 0U);
-    float selection_t = float((c & 2U) != 0U);
-
-    vec3 line_c = u_outline * line_t;
-    vec3 fill_c = u_highlight * highlight_t + u_selection * selection_t;
-
-    vec3 color = line_c + fill_c;
-    out_frag = vec4(color, 0);
-}
\ No newline at end of file
+    // Fill the covered pixels and outline the pixels outside which border them
+    if (c != 0U) {
+        out_frag = (c & 1U) != 0U ? u_highlight : u_selection;
+    } else {
+        vec4 color = (n & 1U) != 0U ? u_highlight : u_selection;
+        out_frag = vec4(color.rgb, u_outline_alpha);
+    }
+}
@@ -0,0 +1,156 @@
+#version 330 core
+
+#ifndef BRICK_SIZE
+#define BRICK_SIZE 8
+#endif
+
+#ifndef APRON_SIZE
+#define APRON_SIZE (BRICK_SIZE + 2)
+#endif
+
+#define MAX_STEPS 512
+#define HIT_EPS 0.05    // In voxels
+#define MIN_STEP 0.1    // In voxels
+
+uniform sampler3D  u_tex_dist;
+uniform usampler3D u_tex_atom;
+uniform usampler3D u_tex_indirection;
+uniform usamplerBuffer u_tex_color;
+
+uniform mat4 u_view_proj;
+uniform mat4 u_inv_view_proj;
+uniform mat4 u_prev_view_proj;
+uniform mat4 u_view;
+uniform vec4 u_jitter_uv;
+uniform vec2 u_inv_res;
+
+uniform vec3  u_origin;
+uniform float u_voxel_size;
+uniform float u_band;
+uniform ivec3 u_bricks;
+uniform vec3  u_atlas_dim;
+
+layout(location = 0) out vec4 out_color;
+layout(location = 1) out vec4 out_normal;
+layout(location = 2) out vec4 out_velocity;
+layout(location = 3) out vec4 out_atom_index;
+
+vec2 encode_normal (vec3 n) {
+   float p = sqrt(n.z * 8 + 8);
+   return n.xy / p + 0.5;
+}
+
+vec4 encode_index(uint index) {
+    return vec4(
+        (index & 0x000000FFU) >> 0U,
+        (index & 0x0000FF00U) >> 8U,
+        (index & 0x00FF0000U) >> 16U,
+        (index & 0xFF000000U) >> 24U) / 255.0;
+}
+
+vec4 unpack_color(uint c) {
+    return vec4(
+        (c >> 0U)  & 0xFFU,
+        (c >> 8U)  & 0xFFU,
+        (c >> 16U) & 0xFFU,
+        (c >> 24U) & 0xFFU) / 255.0;
+}
+
+bool ray_vs_aabb(out float t_entry, out float t_exit, vec3 ori, vec3 inv_dir, vec3 min_box, vec3 max_box) {
+    vec3 tv_1 = (min_box - ori) * inv_dir;
+    vec3 tv_2 = (max_box - ori) * inv_dir;
+    vec3 tv_min = min(tv_1, tv_2);
+    vec3 tv_max = max(tv_1, tv_2);
+    t_entry = max(max(tv_min.x, tv_min.y), tv_min.z);
+    t_exit  = min(min(tv_max.x, tv_max.y), tv_max.z);
+    return t_exit >= max(t_entry, 0.0);
+}
+
+// Brick of the grid which holds the point in voxel coordinates, w is zero if it is not stored
+uvec4 fetch_brick(ivec3 b) {
+    if (any(lessThan(b, ivec3(0))) || any(greaterThanEqual(b, u_bricks))) return uvec4(0);
+    return texelFetch(u_tex_indirection, b, 0);
+}
+
+// Distance in voxels, points in bricks which are not stored are outside of the band
+float sample_distance(vec3 p) {
+    ivec3 b = ivec3(floor(p / BRICK_SIZE));
+    uvec4 e = fetch_brick(b);
+    if (e.w == 0U) return u_band / u_voxel_size;
+    vec3 local = p - vec3(b * BRICK_SIZE);
+    vec3 tc = (vec3(e.xyz) * APRON_SIZE + 1.0 + local) / u_atlas_dim;
+    return texture(u_tex_dist, tc).x / u_voxel_size;
+}
+
+uint sample_atom(vec3 p) {
+    ivec3 b = ivec3(floor(p / BRICK_SIZE));
+    uvec4 e = fetch_brick(b);
+    if (e.w == 0U) return 0xFFFFFFFFU;
+    ivec3 v = clamp(ivec3(floor(p)) - b * BRICK_SIZE, ivec3(0), ivec3(BRICK_SIZE - 1));
+    return texelFetch(u_tex_atom, ivec3(e.xyz) * APRON_SIZE + 1 + v, 0).x;
+}
+
+void main() {
+    // The ray through the pixel, which also holds for orthographic projections
+    vec2 ndc = gl_FragCoord.xy * u_inv_res * 2.0 - 1.0;
+    vec4 p_near = u_inv_view_proj * vec4(ndc, -1, 1);
+    vec4 p_far  = u_inv_view_proj * vec4(ndc,  1, 1);
+    p_near /= p_near.w;
+    p_far  /= p_far.w;
+
+    // March in voxel coordinates
+    vec3 ro = (p_near.xyz - u_origin) / u_voxel_size;
+    vec3 rd = normalize(p_far.xyz - p_near.xyz);
+    vec3 inv_rd = 1.0 / mix(rd, vec3(1.0e-8), lessThan(abs(rd), vec3(1.0e-8)));
+
+    float t_entry, t_exit;
+    if (!ray_vs_aabb(t_entry, t_exit, ro, inv_rd, vec3(0), vec3(u_bricks * BRICK_SIZE))) discard;
+
+    float t = max(t_entry, 0.0);
+    bool hit = false;
+    for (int i = 0; i < MAX_STEPS && t < t_exit; ++i) {
+        vec3 p = ro + rd * t;
+        ivec3 b = ivec3(floor(p / BRICK_SIZE));
+        if (fetch_brick(b).w == 0U) {
+            // Skip to where the ray leaves the empty brick
+            vec3 b_min = vec3(b * BRICK_SIZE);
+            vec3 b_max = b_min + BRICK_SIZE;
+            vec3 t_b = (mix(b_min, b_max, greaterThan(rd, vec3(0))) - ro) * inv_rd;
+            t = max(min(min(t_b.x, t_b.y), t_b.z), t) + 1.0e-3;
+            continue;
+        }
+        float d = sample_distance(p);
+        if (d < HIT_EPS) {
+            t += d;
+            hit = true;
+            break;
+        }
+        t += max(d, MIN_STEP);
+    }
+    if (!hit) discard;
+
+    vec3 p = ro + rd * t;
+    const vec2 e = vec2(0.5, 0);
+    vec3 grad = vec3(
+        sample_distance(p + e.xyy) - sample_distance(p - e.xyy),
+        sample_distance(p + e.yxy) - sample_distance(p - e.yxy),
+        sample_distance(p + e.yyx) - sample_distance(p - e.yyx));
+    vec3 normal = length(grad) > 0.0 ? normalize(grad) : -rd;
+
+    // Points which are not within a stored brick have no atom, the fetch outside of the buffer returns a transparent color
+    uint atom = sample_atom(p);
+    vec4 color = unpack_color(texelFetch(u_tex_color, int(atom)).x);
+    if (color.a == 0.0) discard;
+
+    vec3 world_pos = u_origin + p * u_voxel_size;
+    vec4 clip_coord = u_view_proj * vec4(world_pos, 1);
+    vec4 prev_clip_coord = u_prev_view_proj * vec4(world_pos, 1);
+    vec2 curr_ndc = clip_coord.xy / clip_coord.w;
+    vec2 prev_ndc = prev_clip_coord.xy / prev_clip_coord.w;
+
+    gl_FragDepth = (clip_coord.z / clip_coord.w) * 0.5 + 0.5;
+    out_color = color;
+    out_normal = vec4(encode_normal(normalize(mat3(u_view) * normal)), 0, 0);
+    out_velocity = vec4((curr_ndc - prev_ndc) * 0.5 + (u_jitter_uv.xy - u_jitter_uv.zw), 0, 0);
+    out_atom_index = encode_index(atom);
+}
@@ -0,0 +1,12 @@
+#version 150 core
+#extension GL_ARB_explicit_attrib_location : enable
+
+uniform mat4 u_view_proj;
+uniform vec3 u_box_min;
+uniform vec3 u_box_ext;
+
+layout(location = 0) in vec3 in_pos;
+
+void main() {
+    gl_Position = u_view_proj * vec4(u_box_min + in_pos * u_box_ext, 1);
+}
@@ -0,0 +1,35 @@
+#version 150 core
+
+// Accumulates the half resolution ambient occlusion over frames
+// The history is reprojected with the velocity and clamped to the neighborhood of the current frame
+
+uniform sampler2D u_tex_ao;
+uniform sampler2D u_tex_history;
+uniform sampler2D u_tex_velocity;
+uniform float u_feedback;
+
+in vec2 tc;
+out vec4 out_frag;
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(u_tex_ao, 0);
+
+    float ao = texelFetch(u_tex_ao, coord, 0).x;
+    float ao_min = ao;
+    float ao_max = ao;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            float s = texelFetch(u_tex_ao, clamp(coord + ivec2(x, y), ivec2(0), size - 1), 0).x;
+            ao_min = min(ao_min, s);
+            ao_max = max(ao_max, s);
+        }
+    }
+
+    vec2 prev_tc = tc - texture(u_tex_velocity, tc).xy;
+    float history = clamp(texture(u_tex_history, prev_tc).x, ao_min, ao_max);
+    bool outside = any(lessThan(prev_tc, vec2(0))) || any(greaterThan(prev_tc, vec2(1)));
+    float feedback = outside ? 0.0 : u_feedback;
+
+    out_frag = vec4(mix(ao, history, feedback));
+}
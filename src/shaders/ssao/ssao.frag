@@ -14,6 +14,11 @@
 #define AO_NUM_SAMPLES 32
 #endif
 
+// Evaluates one pixel of every 2x2 quad of the full resolution, which changes each frame
+#ifndef AO_HALF_RES
+#define AO_HALF_RES 0
+#endif
+
 struct HBAOData {
     float   radius_to_screen;
     float   neg_inv_r2;
@@ -91,8 +96,18 @@ vec3 decode_normal(vec2 enc) {
     return n;
 }
 
+// Full resolution pixel which is evaluated
+ivec2 full_res_coord() {
+#if AO_HALF_RES
+    uint i = control.frame & 3U;
+    return ivec2(gl_FragCoord.xy) * 2 + ivec2(i & 1U, i >> 1U);
+#else
+    return ivec2(gl_FragCoord.xy);
+#endif
+}
+
 vec3 fetch_view_normal(vec2 uv) {
-    vec2 enc = texelFetch(u_tex_normal, ivec2(gl_FragCoord.xy), 0).xy;
+    vec2 enc = texelFetch(u_tex_normal, full_res_coord(), 0).xy;
     //vec2 enc = textureLod(u_tex_normal, uv, 0).xy;
     vec3 n = decode_normal(enc);
     return n * vec3(1,1,-1);
@@ -126,8 +141,13 @@ vec2 rotate_sample(vec2 sample, vec2 cos_sin) {
 //----------------------------------------------------------------------------------
 vec4 get_jitter(vec2 uv) {
     // (cos(Alpha),sin(Alpha),rand1,rand2)
-    vec2 coord = gl_FragCoord.xy / AO_RANDOM_TEX_SIZE;
+    vec2 coord = (vec2(full_res_coord()) + 0.5) / AO_RANDOM_TEX_SIZE;
     vec4 jitter = textureLod(u_tex_random, coord, 0);
+#if AO_HALF_RES
+    // The pattern is rotated after every cycle of the quad, for the accumulation over frames to cover more directions
+    float angle = float((control.frame >> 2U) & 7U) * (3.1415926535 * 0.25);
+    jitter.xy = rotate_sample(jitter.xy, vec2(cos(angle), sin(angle)));
+#endif
 
     return jitter;
 }
@@ -170,7 +190,11 @@ float compute_ao(vec2 full_res_uv, float radius_pixels, vec4 jitter, vec3 view_p
 
 //----------------------------------------------------------------------------------
 void main() {
+#if AO_HALF_RES
+    vec2 uv = (vec2(full_res_coord()) + 0.5) * control.inv_full_res;
+#else
     vec2 uv = tc;
+#endif
     vec3 view_position = fetch_view_pos(uv, 0);
     vec3 view_normal = fetch_view_normal(uv);
 
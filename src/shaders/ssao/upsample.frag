@@ -0,0 +1,34 @@
+#version 150 core
+
+// Depth aware upsampling of the half resolution ambient occlusion
+// The bilinear weights of the four closest texels are scaled by how similar their depth is to the depth of the pixel
+
+uniform sampler2D u_tex_ao;
+uniform sampler2D u_tex_linear_depth;
+uniform float u_sharpness;
+
+out vec4 out_frag;
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(u_tex_ao, 0);
+    float d = texelFetch(u_tex_linear_depth, coord, 0).x;
+
+    vec2 p = gl_FragCoord.xy * 0.5 - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+
+    float ao_sum = 0.0;
+    float w_sum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 o = ivec2(i & 1, i >> 1);
+        ivec2 c = clamp(base + o, ivec2(0), size - 1);
+        vec2 bw = mix(1.0 - f, f, vec2(o));
+        float dd = (texelFetch(u_tex_linear_depth, c * 2, 0).x - d) * u_sharpness;
+        float w = bw.x * bw.y * exp2(-dd*dd) + 1.0e-4;
+        ao_sum += texelFetch(u_tex_ao, c, 0).x * w;
+        w_sum += w;
+    }
+
+    out_frag = vec4(vec3(ao_sum / w_sum), 1);
+}
@@ -40,6 +40,20 @@ uniform sampler2D u_tex_depth;
 uniform sampler3D u_tex_volume;
 uniform sampler2D u_tex_tf;
 
+#if defined(BRICKED_VOLUME)
+// u_tex_volume holds the atlas of stored bricks, each with a one voxel apron
+uniform usampler3D u_tex_brick_index;
+uniform vec3  u_volume_dim;
+uniform vec3  u_atlas_inv_dim;
+uniform float u_value_scale;
+#endif
+
+// Empty-space skipping, the (min, max) of the raw values of each macro cell
+uniform int   u_empty_space_skipping;
+uniform sampler3D u_tex_macro_cells;
+uniform float u_macro_cell_voxels;
+uniform float u_tf_transparent_below;
+
 in  vec3 model_pos;
 in  vec3 model_eye;
 
@@ -49,10 +63,27 @@ const float REF_SAMPLING_RATE = 150.0;
 const float ERT_THRESHOLD = 0.99;
 const float samplingRate = 8.0;
 
+vec3 volumeDim() {
+#if defined(BRICKED_VOLUME)
+    return u_volume_dim;
+#else
+    return vec3(textureSize(u_tex_volume, 0));
+#endif
+}
+
 float getVoxel(in vec3 samplePos) {
     //return samplePos.x;
     //samplePos -= (u_gradient_spacing_tex_space * vec4(-0.5, 0.5, 0.5, 0.0)).xyz;
+#if defined(BRICKED_VOLUME)
+    vec3  p = clamp(samplePos, 0.0, 1.0) * u_volume_dim;
+    ivec3 b = min(ivec3(p / float(BRICK_SIZE)), textureSize(u_tex_brick_index, 0) - 1);
+    uvec4 e = texelFetch(u_tex_brick_index, b, 0);
+    if (e.w == 0U) return 0.0;
+    vec3 atlas_pos = vec3(e.xyz) * float(BRICK_SIZE + 2) + 1.0 + (p - vec3(b * BRICK_SIZE));
+    return texture(u_tex_volume, atlas_pos * u_atlas_inv_dim).r * u_value_scale * u_density_scale;
+#else
     return texture(u_tex_volume, samplePos).r * u_density_scale;
+#endif
 }
 
 vec4 classify(in float density) {
@@ -269,6 +300,43 @@ vec4 drawIsosurfaces(in vec4 curResult,
     return result;
 }
 
+ivec3 macroCellIndex(in vec3 samplePos) {
+    ivec3 cell = ivec3(clamp(samplePos, 0.0, 1.0) * volumeDim() / u_macro_cell_voxels);
+    return min(cell, textureSize(u_tex_macro_cells, 0) - 1);
+}
+
+// Distance along the ray to the exit of the cell
+float macroCellExit(in vec3 pos, in vec3 dir, in ivec3 cell) {
+    vec3 cell_min = vec3(cell) * u_macro_cell_voxels / volumeDim();
+    vec3 cell_max = vec3(cell + 1) * u_macro_cell_voxels / volumeDim();
+    vec3 d = mix(vec3(1.0e-8), dir, greaterThan(abs(dir), vec3(1.0e-8)));
+    vec3 t_exit = (mix(cell_min, cell_max, step(0.0, d)) - pos) / d;
+    return max(0.0, min(min(t_exit.x, t_exit.y), t_exit.z));
+}
+
+// A cell is empty if its range of (scaled) values is transparent in the transfer function and contains no isovalue
+bool macroCellEmpty(in vec2 range) {
+    bool visible = false;
+#if defined(INCLUDE_DVR)
+    visible = visible || range.y >= u_tf_transparent_below;
+#endif
+#if defined(INCLUDE_ISO)
+    for (int i = 0; i < u_iso.count; ++i) {
+        visible = visible || (range.x <= u_iso.values[i] && u_iso.values[i] <= range.y);
+    }
+#endif
+    return !visible;
+}
+
+// Scale of the step for isosurfaces, samples far from every isovalue (relative to the range of the cell) take longer steps
+float isoStepScale(in float density, in vec2 range) {
+    float dist = 1.0e19;
+    for (int i = 0; i < u_iso.count; ++i) {
+        dist = min(dist, abs(u_iso.values[i] - density));
+    }
+    return 1.0 + 3.0 * clamp(dist / max(range.y - range.x, 1.0e-6), 0.0, 1.0);
+}
+
 float PDnrand( vec2 n ) {
     return fract( sin(dot(n.xy, vec2(12.9898, 78.233)))* 43758.5453 );
 }
@@ -313,7 +381,7 @@ void main() {
     vec2 jitter = PDnrand2(gl_FragCoord.xy + vec2(u_time, u_time));
     jitter = vec2(0,0);
 
-    float tIncr = min(tEnd, tEnd / (samplingRate * length(dir * tEnd * textureSize(u_tex_volume, 0))));
+    float tIncr = min(tEnd, tEnd / (samplingRate * length(dir * tEnd * volumeDim())));
     float samples = ceil(tEnd / tIncr);
     tIncr = tEnd / samples;
 
@@ -323,10 +391,32 @@ void main() {
     float density = 0.0;
     uint iso_surface_hit = 0U;
 
+    float baseIncr = tEnd / samples;
+    vec2 cellRange = vec2(0.0);
+    bool resume = false;
+
     while (t < tEnd) {
         vec3 samplePos = entryPos + t * dir;
+
+        if (u_empty_space_skipping != 0) {
+            ivec3 cell = macroCellIndex(samplePos);
+            cellRange = texelFetch(u_tex_macro_cells, cell, 0).rg * u_density_scale;
+            if (macroCellEmpty(cellRange)) {
+                // Continue on the sampling grid of the ray after the cell
+                float tCell = t + macroCellExit(samplePos, dir, cell);
+                t = max(t + baseIncr, ceil(tCell / baseIncr) * baseIncr);
+                resume = true;
+                continue;
+            }
+        }
+
         float prevDensity = density;
         density = getVoxel(samplePos);
+        if (resume) {
+            // There is no isosurface within skipped cells
+            prevDensity = density;
+            resume = false;
+        }
 
 #if defined(INCLUDE_ISO)
         result = drawIsosurfaces(result, density, prevDensity, samplePos, dir, t, tIncr, iso_surface_hit);
@@ -343,7 +433,10 @@ void main() {
             t = tEnd;
         } else {
             // make sure that tIncr has the correct length since drawIsoSurface will modify it
-            tIncr = tEnd / samples;
+            tIncr = baseIncr;
+#if defined(INCLUDE_ISO) && !defined(INCLUDE_DVR)
+            if (u_empty_space_skipping != 0) tIncr *= isoStepScale(density, cellRange);
+#endif
             t += tIncr;
         }
     }
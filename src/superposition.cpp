@@ -0,0 +1,333 @@
+#include "superposition.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+
+#include <math.h>
+#include <string.h>
+
+#define SUPERPOSITION_GATHER 64
+#define SUPERPOSITION_JACOBI_SWEEPS 16
+#define SUPERPOSITION_NEWTON_ITERATIONS 50
+
+bool superposition_ref_init(superposition_ref_t* ref, const float* x, const float* y, const float* z, const float* w, const int32_t* indices, size_t count, md_allocator_i* alloc) {
+    ASSERT(ref);
+    ASSERT(alloc);
+    superposition_ref_free(ref);
+    if (count == 0 || !x || !y || !z || !indices) return false;
+
+    ref->alloc = alloc;
+    ref->count = count;
+    ref->indices = (int32_t*)md_alloc(alloc, sizeof(int32_t) * count);
+    ref->x = (float*)md_alloc(alloc, sizeof(float) * count);
+    ref->y = (float*)md_alloc(alloc, sizeof(float) * count);
+    ref->z = (float*)md_alloc(alloc, sizeof(float) * count);
+    ref->w = (float*)md_alloc(alloc, sizeof(float) * count);
+    MEMCPY(ref->indices, indices, sizeof(int32_t) * count);
+
+    double sw = 0, sx = 0, sy = 0, sz = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t idx = indices[i];
+        const double wi = w ? w[idx] : 1.0;
+        ref->w[i] = (float)wi;
+        sw += wi;
+        sx += wi * x[idx];
+        sy += wi * y[idx];
+        sz += wi * z[idx];
+    }
+    if (sw <= 0.0) {
+        superposition_ref_free(ref);
+        return false;
+    }
+
+    const double cx = sx / sw;
+    const double cy = sy / sw;
+    const double cz = sz / sw;
+    double g = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t idx = indices[i];
+        ref->x[i] = (float)(x[idx] - cx);
+        ref->y[i] = (float)(y[idx] - cy);
+        ref->z[i] = (float)(z[idx] - cz);
+        g += ref->w[i] * ((double)ref->x[i] * ref->x[i] + (double)ref->y[i] * ref->y[i] + (double)ref->z[i] * ref->z[i]);
+    }
+
+    ref->com = {(float)cx, (float)cy, (float)cz};
+    ref->sum_w = sw;
+    ref->sum_w_r2 = g;
+    return true;
+}
+
+void superposition_ref_free(superposition_ref_t* ref) {
+    ASSERT(ref);
+    if (ref->alloc && ref->count) {
+        md_free(ref->alloc, ref->indices, sizeof(int32_t) * ref->count);
+        md_free(ref->alloc, ref->x, sizeof(float) * ref->count);
+        md_free(ref->alloc, ref->y, sizeof(float) * ref->count);
+        md_free(ref->alloc, ref->z, sizeof(float) * ref->count);
+        md_free(ref->alloc, ref->w, sizeof(float) * ref->count);
+    }
+    *ref = {};
+}
+
+// Eigenvector of the largest eigenvalue of a symmetric 4x4 matrix (cyclic Jacobi), A is destroyed
+static double dominant_eigen4(double A[4][4], double v[4]) {
+    double V[4][4] = {{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}};
+    for (int sweep = 0; sweep < SUPERPOSITION_JACOBI_SWEEPS; ++sweep) {
+        double off = 0;
+        for (int p = 0; p < 3; ++p) {
+            for (int q = p + 1; q < 4; ++q) off += A[p][q] * A[p][q];
+        }
+        if (off < 1.0e-22) break;
+
+        for (int p = 0; p < 3; ++p) {
+            for (int q = p + 1; q < 4; ++q) {
+                if (fabs(A[p][q]) < 1.0e-30) continue;
+                const double theta = (A[q][q] - A[p][p]) / (2.0 * A[p][q]);
+                const double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                const double c = 1.0 / sqrt(t * t + 1.0);
+                const double s = t * c;
+                for (int k = 0; k < 4; ++k) {
+                    const double akp = A[k][p];
+                    const double akq = A[k][q];
+                    A[k][p] = c * akp - s * akq;
+                    A[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 4; ++k) {
+                    const double apk = A[p][k];
+                    const double aqk = A[q][k];
+                    A[p][k] = c * apk - s * aqk;
+                    A[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 4; ++k) {
+                    const double vkp = V[k][p];
+                    const double vkq = V[k][q];
+                    V[k][p] = c * vkp - s * vkq;
+                    V[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    int max_i = 0;
+    for (int i = 1; i < 4; ++i) {
+        if (A[i][i] > A[max_i][max_i]) max_i = i;
+    }
+    for (int k = 0; k < 4; ++k) v[k] = V[k][max_i];
+    return A[max_i][max_i];
+}
+
+// Horn's matrix of the cross covariance S = sum w a b^T (row major), its dominant eigenvector is the quaternion (w, x, y, z) which rotates a onto b
+static void horn_matrix(double N[4][4], const double S[9]) {
+    const double Sxx = S[0], Sxy = S[1], Sxz = S[2];
+    const double Syx = S[3], Syy = S[4], Syz = S[5];
+    const double Szx = S[6], Szy = S[7], Szz = S[8];
+
+    N[0][0] = Sxx + Syy + Szz;
+    N[1][1] = Sxx - Syy - Szz;
+    N[2][2] = -Sxx + Syy - Szz;
+    N[3][3] = -Sxx - Syy + Szz;
+    N[0][1] = N[1][0] = Syz - Szy;
+    N[0][2] = N[2][0] = Szx - Sxz;
+    N[0][3] = N[3][0] = Sxy - Syx;
+    N[1][2] = N[2][1] = Sxy + Syx;
+    N[1][3] = N[3][1] = Szx + Sxz;
+    N[2][3] = N[3][2] = Syz + Szy;
+}
+
+static double det4(const double M[4][4]) {
+    const double s0 = M[0][0] * M[1][1] - M[1][0] * M[0][1];
+    const double s1 = M[0][0] * M[1][2] - M[1][0] * M[0][2];
+    const double s2 = M[0][0] * M[1][3] - M[1][0] * M[0][3];
+    const double s3 = M[0][1] * M[1][2] - M[1][1] * M[0][2];
+    const double s4 = M[0][1] * M[1][3] - M[1][1] * M[0][3];
+    const double s5 = M[0][2] * M[1][3] - M[1][2] * M[0][3];
+    const double c5 = M[2][2] * M[3][3] - M[3][2] * M[2][3];
+    const double c4 = M[2][1] * M[3][3] - M[3][1] * M[2][3];
+    const double c3 = M[2][1] * M[3][2] - M[3][1] * M[2][2];
+    const double c2 = M[2][0] * M[3][3] - M[3][0] * M[2][3];
+    const double c1 = M[2][0] * M[3][2] - M[3][0] * M[2][2];
+    const double c0 = M[2][0] * M[3][1] - M[3][0] * M[2][1];
+    return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+}
+
+// Largest eigenvalue of Horn's matrix by Newton iteration on its characteristic polynomial (QCP), starting from the upper bound (Ga + Gb) / 2
+// This is much cheaper than the eigen decomposition when only the RMSD is needed
+static double horn_max_eigenvalue(const double S[9], double upper) {
+    double N[4][4];
+    horn_matrix(N, S);
+
+    double ss = 0;
+    for (int i = 0; i < 9; ++i) ss += S[i] * S[i];
+    const double det_s = S[0] * (S[4] * S[8] - S[5] * S[7]) - S[1] * (S[3] * S[8] - S[5] * S[6]) + S[2] * (S[3] * S[7] - S[4] * S[6]);
+    const double c2 = -2.0 * ss;
+    const double c1 = -8.0 * det_s;
+    const double c0 = det4(N);
+
+    double lambda = upper;
+    for (int i = 0; i < SUPERPOSITION_NEWTON_ITERATIONS; ++i) {
+        const double l2 = lambda * lambda;
+        const double p  = (l2 + c2) * l2 + c1 * lambda + c0;
+        const double dp = 4.0 * l2 * lambda + 2.0 * c2 * lambda + c1;
+        if (dp == 0.0) break;
+        const double next = lambda - p / dp;
+        if (fabs(next - lambda) <= 1.0e-11 * fabs(next)) {
+            lambda = next;
+            break;
+        }
+        lambda = next;
+    }
+    return lambda;
+}
+
+superposition_fit_t superposition_fit(const superposition_ref_t* ref, const float* x, const float* y, const float* z) {
+    ASSERT(ref);
+    superposition_fit_t fit = {{0, 0, 0}, {0, 0, 0, 1}, 0};
+    if (ref->count == 0) return fit;
+
+    // Relative to the first atom to keep the raw moments well conditioned
+    const int32_t* indices = ref->indices;
+    const float ox = x[indices[0]];
+    const float oy = y[indices[0]];
+    const float oz = z[indices[0]];
+
+    // sx, sy, sz, sxx, sxy, sxz, syx, syy, syz, szx, szy, szz, sp2
+    // Since the reference is centered, sum w (p - com) r^T = sum w (p - o) r^T
+    double S[13] = {0};
+    float bx[SUPERPOSITION_GATHER], by[SUPERPOSITION_GATHER], bz[SUPERPOSITION_GATHER];
+    for (size_t beg = 0; beg < ref->count; beg += SUPERPOSITION_GATHER) {
+        const size_t n = MIN(ref->count - beg, (size_t)SUPERPOSITION_GATHER);
+        for (size_t j = 0; j < n; ++j) {
+            const int32_t idx = indices[beg + j];
+            bx[j] = x[idx] - ox;
+            by[j] = y[idx] - oy;
+            bz[j] = z[idx] - oz;
+        }
+        const float* rx = ref->x + beg;
+        const float* ry = ref->y + beg;
+        const float* rz = ref->z + beg;
+        const float* rw = ref->w + beg;
+        float s[13] = {0};
+        for (size_t j = 0; j < n; ++j) {
+            const float wx = rw[j] * bx[j];
+            const float wy = rw[j] * by[j];
+            const float wz = rw[j] * bz[j];
+            s[0]  += wx;
+            s[1]  += wy;
+            s[2]  += wz;
+            s[3]  += wx * rx[j];
+            s[4]  += wx * ry[j];
+            s[5]  += wx * rz[j];
+            s[6]  += wy * rx[j];
+            s[7]  += wy * ry[j];
+            s[8]  += wy * rz[j];
+            s[9]  += wz * rx[j];
+            s[10] += wz * ry[j];
+            s[11] += wz * rz[j];
+            s[12] += wx * bx[j] + wy * by[j] + wz * bz[j];
+        }
+        for (int k = 0; k < 13; ++k) {
+            S[k] += s[k];
+        }
+    }
+
+    const double W = ref->sum_w;
+    const double mx = S[0] / W;
+    const double my = S[1] / W;
+    const double mz = S[2] / W;
+    fit.com = {(float)(ox + mx), (float)(oy + my), (float)(oz + mz)};
+
+    double N[4][4];
+    horn_matrix(N, S + 3);
+    double q[4];
+    const double lambda = dominant_eigen4(N, q);
+
+    const double len = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    if (len > 0.0) {
+        const double s = (q[0] < 0 ? -1.0 : 1.0) / len;
+        fit.rotation = {(float)(q[1] * s), (float)(q[2] * s), (float)(q[3] * s), (float)(q[0] * s)};
+    }
+
+    // sum w |p - com|^2 + sum w |r|^2 - 2 lambda
+    const double ga = S[12] - W * (mx * mx + my * my + mz * mz);
+    const double e = (ga + ref->sum_w_r2 - 2.0 * lambda) / W;
+    fit.rmsd = (float)sqrt(MAX(e, 0.0));
+    return fit;
+}
+
+void superposition_transform(float* x, float* y, float* z, size_t count, vec3_t src_com, quat_t rotation, vec3_t dst_com) {
+    ASSERT(x && y && z);
+    const float qx = rotation.x, qy = rotation.y, qz = rotation.z, qw = rotation.w;
+    const float r00 = 1 - 2 * (qy * qy + qz * qz), r01 = 2 * (qx * qy - qz * qw),     r02 = 2 * (qx * qz + qy * qw);
+    const float r10 = 2 * (qx * qy + qz * qw),     r11 = 1 - 2 * (qx * qx + qz * qz), r12 = 2 * (qy * qz - qx * qw);
+    const float r20 = 2 * (qx * qz - qy * qw),     r21 = 2 * (qy * qz + qx * qw),     r22 = 1 - 2 * (qx * qx + qy * qy);
+
+    // Folding the translation into the offset keeps the loop to a matrix multiply add
+    const float tx = dst_com.x - (r00 * src_com.x + r01 * src_com.y + r02 * src_com.z);
+    const float ty = dst_com.y - (r10 * src_com.x + r11 * src_com.y + r12 * src_com.z);
+    const float tz = dst_com.z - (r20 * src_com.x + r21 * src_com.y + r22 * src_com.z);
+    for (size_t i = 0; i < count; ++i) {
+        const float px = x[i];
+        const float py = y[i];
+        const float pz = z[i];
+        x[i] = r00 * px + r01 * py + r02 * pz + tx;
+        y[i] = r10 * px + r11 * py + r12 * pz + ty;
+        z[i] = r20 * px + r21 * py + r22 * pz + tz;
+    }
+}
+
+bool superposition_ref_copy(superposition_ref_t* dst, const superposition_ref_t* src, md_allocator_i* alloc) {
+    ASSERT(dst && src && dst != src);
+    ASSERT(alloc);
+    superposition_ref_free(dst);
+    if (src->count == 0) return false;
+
+    const size_t count = src->count;
+    *dst = *src;
+    dst->alloc = alloc;
+    dst->indices = (int32_t*)md_alloc(alloc, sizeof(int32_t) * count);
+    dst->x = (float*)md_alloc(alloc, sizeof(float) * count);
+    dst->y = (float*)md_alloc(alloc, sizeof(float) * count);
+    dst->z = (float*)md_alloc(alloc, sizeof(float) * count);
+    dst->w = (float*)md_alloc(alloc, sizeof(float) * count);
+    MEMCPY(dst->indices, src->indices, sizeof(int32_t) * count);
+    MEMCPY(dst->x, src->x, sizeof(float) * count);
+    MEMCPY(dst->y, src->y, sizeof(float) * count);
+    MEMCPY(dst->z, src->z, sizeof(float) * count);
+    MEMCPY(dst->w, src->w, sizeof(float) * count);
+    return true;
+}
+
+float superposition_rmsd(const float* ax, const float* ay, const float* az, const float* bx, const float* by, const float* bz, const float* w, size_t count, double sum_w, double sum_w_r2_a, double sum_w_r2_b) {
+    ASSERT(ax && ay && az && bx && by && bz && w);
+    if (count == 0 || sum_w <= 0.0) return 0.0f;
+
+    // The coordinates are contiguous, so the sums vectorize without a gather
+    double S[9] = {0};
+    for (size_t beg = 0; beg < count; beg += SUPERPOSITION_GATHER) {
+        const size_t end = MIN(count, beg + SUPERPOSITION_GATHER);
+        float s[9] = {0};
+        for (size_t j = beg; j < end; ++j) {
+            const float wx = w[j] * ax[j];
+            const float wy = w[j] * ay[j];
+            const float wz = w[j] * az[j];
+            s[0] += wx * bx[j];
+            s[1] += wx * by[j];
+            s[2] += wx * bz[j];
+            s[3] += wy * bx[j];
+            s[4] += wy * by[j];
+            s[5] += wy * bz[j];
+            s[6] += wz * bx[j];
+            s[7] += wz * by[j];
+            s[8] += wz * bz[j];
+        }
+        for (int k = 0; k < 9; ++k) {
+            S[k] += s[k];
+        }
+    }
+
+    const double g = sum_w_r2_a + sum_w_r2_b;
+    const double lambda = horn_max_eigenvalue(S, 0.5 * g);
+    const double e = (g - 2.0 * lambda) / sum_w;
+    return (float)sqrt(MAX(e, 0.0));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/md_vec_math.h>
+
+struct md_allocator_i;
+
+// Optimal (weighted least squares) superposition of a set of atoms onto a reference structure
+// The covariance between the frame and the reference is accumulated in a single blocked pass over the atoms (the same idiom as the shape space),
+// the rotation is then given by the dominant eigenvector of Horn's 4x4 quaternion matrix, which also gives the RMSD without applying the rotation.
+// Fits are independent, so the frames of a trajectory can be fitted in parallel against a shared reference.
+
+struct superposition_ref_t {
+    int32_t* indices = nullptr;     // [count] Atom indices of the structure
+    float* x = nullptr;             // [count] Reference coordinates relative to its center of mass, in the order of indices
+    float* y = nullptr;
+    float* z = nullptr;
+    float* w = nullptr;             // [count] Weights
+    size_t count = 0;
+    double sum_w = 0;
+    double sum_w_r2 = 0;            // sum w |r|^2
+    vec3_t com = {};                // Center of mass of the reference
+    md_allocator_i* alloc = nullptr;
+};
+
+struct superposition_fit_t {
+    vec3_t com;         // Center of mass of the frame
+    quat_t rotation;    // Rotates the frame about com into the orientation of the reference
+    float  rmsd;        // Weighted RMSD after the superposition
+};
+
+// The reference is the structure given by indices in x, y, z. If w is NULL the atoms are weighted equally
+bool superposition_ref_init(superposition_ref_t* ref, const float* x, const float* y, const float* z, const float* w, const int32_t* indices, size_t count, md_allocator_i* alloc);
+void superposition_ref_free(superposition_ref_t* ref);
+bool superposition_ref_copy(superposition_ref_t* dst, const superposition_ref_t* src, md_allocator_i* alloc);
+
+// Fits the structure of the reference within the coordinates of a frame (indexed by the indices of the reference)
+superposition_fit_t superposition_fit(const superposition_ref_t* ref, const float* x, const float* y, const float* z);
+
+// RMSD after the superposition of two structures which are centered on their center of mass, given by contiguous coordinates and weights
+// sum_w_r2_a and sum_w_r2_b are sum w |r|^2 of each structure. Only the largest eigenvalue is needed, which is found by Newton iteration (QCP)
+float superposition_rmsd(const float* ax, const float* ay, const float* az, const float* bx, const float* by, const float* bz, const float* w, size_t count,
+                         double sum_w, double sum_w_r2_a, double sum_w_r2_b);
+
+// p' = dst_com + rotation * (p - src_com), for count atoms
+void superposition_transform(float* x, float* y, float* z, size_t count, vec3_t src_com, quat_t rotation, vec3_t dst_com);
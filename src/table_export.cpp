@@ -0,0 +1,165 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "table_export.h"
+
+#include <task_system.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEXT_CHUNK_BYTES MEGABYTES(4)   // Upper bound of the formatted text of a chunk
+#define TEXT_MAX_CELL_CHARS 32
+
+struct TextChunks {
+    const float* const* columns;
+    size_t num_columns;
+    size_t num_rows;
+    TableTextFormat format;
+    size_t row_beg;         // First row of the wave
+    size_t chunk_rows;
+    size_t chunk_cap;       // Bytes per chunk buffer
+    char*  buf;             // One buffer per chunk of the wave
+    size_t* len;            // Bytes written to each buffer
+};
+
+static size_t format_rows(char* buf, size_t cap, const TextChunks& t, size_t beg, size_t end) {
+    size_t len = 0;
+    for (size_t i = beg; i < end; ++i) {
+        for (size_t j = 0; j < t.num_columns; ++j) {
+            const float v = t.columns[j][i];
+            int n = 0;
+            if (t.format == TableTextFormat_CSV) {
+                n = snprintf(buf + len, cap - len, j + 1 < t.num_columns ? "%.6g," : "%.6g", v);
+            } else {
+                n = snprintf(buf + len, cap - len, "%12.6f ", v);
+            }
+            len += (size_t)MAX(n, 0);
+        }
+        buf[len++] = '\n';
+    }
+    return len;
+}
+
+str_t table_csv_header(const str_t* labels, size_t num_columns, md_allocator_i* alloc) {
+    ASSERT(alloc);
+    size_t len = 1;
+    for (size_t i = 0; i < num_columns; ++i) {
+        len += labels[i].len + 1;
+    }
+    char* buf = (char*)md_alloc(alloc, len + 1);
+    size_t pos = 0;
+    for (size_t i = 0; i < num_columns; ++i) {
+        MEMCPY(buf + pos, labels[i].ptr, labels[i].len);
+        pos += labels[i].len;
+        if (i + 1 < num_columns) buf[pos++] = ',';
+    }
+    buf[pos++] = '\n';
+    buf[pos] = '\0';
+    return {buf, pos};
+}
+
+bool table_write_text(str_t path, str_t header, const float* const* columns, size_t num_columns, size_t num_rows, TableTextFormat format) {
+    ASSERT(columns || num_columns == 0);
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write data.", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    bool ok = md_file_write(file, header.ptr, header.len) == header.len;
+
+    // The rows are formatted in waves of chunks, which bounds the memory to a few chunks per thread
+    const size_t chunks_per_wave = (size_t)task_system::pool_num_threads() * 2 + 1;
+    TextChunks t = {};
+    t.columns = columns;
+    t.num_columns = num_columns;
+    t.num_rows = num_rows;
+    t.format = format;
+    const size_t row_cap = num_columns * TEXT_MAX_CELL_CHARS + 1;
+    t.chunk_rows = MAX(1, TEXT_CHUNK_BYTES / row_cap);
+    t.chunk_cap = t.chunk_rows * row_cap;
+    t.buf = (char*)md_alloc(md_heap_allocator, t.chunk_cap * chunks_per_wave);
+    t.len = (size_t*)md_alloc(md_heap_allocator, sizeof(size_t) * chunks_per_wave);
+    defer {
+        md_free(md_heap_allocator, t.buf, t.chunk_cap * chunks_per_wave);
+        md_free(md_heap_allocator, t.len, sizeof(size_t) * chunks_per_wave);
+    };
+
+    for (t.row_beg = 0; t.row_beg < num_rows && ok; t.row_beg += chunks_per_wave * t.chunk_rows) {
+        const size_t num_chunks = MIN(chunks_per_wave, (num_rows - t.row_beg + t.chunk_rows - 1) / t.chunk_rows);
+        task_system::ID id = task_system::pool_enqueue(STR("##Format Table"), 0, (uint32_t)num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            TextChunks* t = (TextChunks*)user_data;
+            for (uint32_t c = range_beg; c < range_end; ++c) {
+                const size_t beg = t->row_beg + (size_t)c * t->chunk_rows;
+                const size_t end = MIN(beg + t->chunk_rows, t->num_rows);
+                t->len[c] = format_rows(t->buf + c * t->chunk_cap, t->chunk_cap, *t, beg, end);
+            }
+        }, &t, 0, task_system::Priority_Interactive);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+
+        for (size_t c = 0; c < num_chunks && ok; ++c) {
+            ok = md_file_write(file, t.buf + c * t.chunk_cap, t.len[c]) == t.len[c];
+        }
+    }
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
+
+size_t npy_format_header(char* buf, size_t cap, const size_t* shape, size_t ndim, bool fortran_order) {
+    ASSERT(buf);
+    ASSERT(cap >= 256);
+    // Format version 1.0: magic, version, header length (little endian) and the header padded with spaces so the data is 64 byte aligned
+    const size_t prefix = 10;
+    int len = snprintf(buf + prefix, cap - prefix, "{'descr': '<f4', 'fortran_order': %s, 'shape': (", fortran_order ? "True" : "False");
+    for (size_t i = 0; i < ndim; ++i) {
+        len += snprintf(buf + prefix + len, cap - prefix - len, ndim == 1 ? "%zu," : (i + 1 < ndim ? "%zu, " : "%zu"), shape[i]);
+    }
+    len += snprintf(buf + prefix + len, cap - prefix - len, "), }");
+    const size_t total = MIN(ALIGN_TO(prefix + (size_t)len + 1, 64), cap);
+    while (prefix + (size_t)len < total - 1) buf[prefix + len++] = ' ';
+    buf[prefix + len++] = '\n';
+
+    const uint8_t preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)};
+    MEMCPY(buf, preamble, sizeof(preamble));
+    return prefix + (size_t)len;
+}
+
+bool table_write_npy(str_t path, const float* const* columns, size_t num_columns, size_t num_rows) {
+    ASSERT(columns || num_columns == 0);
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write data.", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    char header[256];
+    const size_t shape[2] = {num_rows, num_columns};
+    const size_t len = npy_format_header(header, sizeof(header), shape, 2, true);
+    bool ok = md_file_write(file, header, len) == len;
+
+    const size_t column_size = num_rows * sizeof(float);
+    for (size_t j = 0; j < num_columns && ok; ++j) {
+        ok = md_file_write(file, columns[j], column_size) == column_size;
+    }
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
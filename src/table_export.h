@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <core/md_str.h>
+
+struct md_allocator_i;
+
+// Export of columns of float values (properties over frames, histograms)
+// Binary exports are written straight from the column arrays, text exports are formatted in parallel on the pool in chunks of rows
+// which are written to the file in order, so the formatting of large tables is not bound by a single thread.
+
+enum TableTextFormat {
+    TableTextFormat_CSV,    // Comma separated, %.6g
+    TableTextFormat_XVG,    // Space separated, %12.6f
+};
+
+// CSV header line with the column labels
+str_t table_csv_header(const str_t* labels, size_t num_columns, md_allocator_i* alloc);
+
+// Writes header followed by one line per row
+bool table_write_text(str_t path, str_t header, const float* const* columns, size_t num_columns, size_t num_rows, TableTextFormat format);
+
+// Preamble and header of a NumPy .npy file of float32 (format version 1.0), padded so the data which follows is 64 byte aligned
+// Returns the number of bytes written to buf, which should hold at least 256 bytes
+size_t npy_format_header(char* buf, size_t cap, const size_t* shape, size_t ndim, bool fortran_order);
+
+// NumPy .npy file of float32 with shape (num_rows, num_columns)
+// The array is stored in Fortran (column major) order, which makes every column contiguous in the file
+bool table_write_npy(str_t path, const float* const* columns, size_t num_columns, size_t num_rows);
@@ -3,6 +3,7 @@
 #endif
 
 #include "task_system.h"
+#include "cpu_profiler.h"
 #include <TaskScheduler.h>
 #include <core/md_common.h>
 #include <core/md_log.h>
@@ -12,6 +13,8 @@
 
 #include <string.h>
 #include <atomic_queue.h>
+#include <thread>
+#include <chrono>
 
 // Blatantly stolen from ImGui (thanks Omar!)
 struct NewDummy {};
@@ -23,6 +26,133 @@ namespace task_system {
 
 constexpr uint32_t MAX_TASKS = 256;
 constexpr uint32_t LABEL_SIZE = 64;
+constexpr size_t   SCRATCH_ARENA_SIZE = MEGABYTES(32);
+
+struct ScratchBlock {
+    ScratchBlock* next;
+    size_t size;
+};
+
+struct ScratchArena {
+    char*  base = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t high_water = 0;
+    uint64_t fallbacks = 0;
+    ScratchBlock* heap_blocks = nullptr;  // Allocations which did not fit
+};
+
+static ScratchArena* scratch_arenas = nullptr;
+static size_t num_scratch_arenas = 0;
+static thread_local ScratchArena* thread_arena = nullptr;
+
+// Ranges may be executed nested (e.g. the main thread executes pool work when waiting for a task), so the arena is rewound to a mark
+static inline ScratchMark scratch_begin(uint32_t thread_num) {
+    ScratchArena* arena = thread_num < num_scratch_arenas ? &scratch_arenas[thread_num] : nullptr;
+    ScratchMark mark = {arena, thread_arena, arena ? arena->used : 0, arena ? arena->heap_blocks : nullptr};
+    thread_arena = arena;
+    return mark;
+}
+
+static inline void scratch_end(const ScratchMark& mark) {
+    if (mark.arena) {
+        ScratchArena* arena = mark.arena;
+        while (arena->heap_blocks != mark.heap_blocks) {
+            ScratchBlock* block = arena->heap_blocks;
+            arena->heap_blocks = block->next;
+            md_free(md_heap_allocator, block, block->size);
+        }
+        arena->used = mark.used;
+    }
+    thread_arena = mark.prev_arena;
+}
+
+constexpr uint32_t TRACE_CAPACITY = 16384;   // Must be a power of two
+STATIC_ASSERT((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0, "Trace capacity must be a power of two");
+
+// The sequence is odd while a slot is being written, readers use it to discard torn copies
+struct TraceSlot {
+    std::atomic_uint64_t seq;
+    TraceEvent event;
+};
+
+static TraceSlot* trace_ring = nullptr;
+static std::atomic_uint64_t trace_head = 0;
+static std::atomic_bool trace_on = false;
+
+static void trace_record(str_t label, ID id, int64_t enqueue_time, int64_t beg_time, int64_t end_time, uint32_t thread_idx, uint32_t range_size, bool main) {
+    if (!trace_ring) return;
+    const uint64_t idx = trace_head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot& slot = trace_ring[idx & (TRACE_CAPACITY - 1)];
+    slot.seq.store(2 * idx + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    TraceEvent& e = slot.event;
+    const size_t len = MIN(label.len, TRACE_LABEL_SIZE - 1);
+    MEMCPY(e.label, label.ptr, len);
+    e.label[len] = '\0';
+    e.id = id;
+    e.enqueue_time = enqueue_time;
+    e.beg_time = beg_time;
+    e.end_time = end_time;
+    e.thread_idx = thread_idx;
+    e.range_size = range_size;
+    e.main = main;
+
+    slot.seq.store(2 * idx + 2, std::memory_order_release);
+}
+
+static std::atomic_size_t memory_budget = 0;
+static std::atomic_size_t memory_in_flight = 0;
+static std::atomic_uint64_t memory_throttled = 0;
+static thread_local size_t thread_memory = 0;   // Admitted memory of the ranges executing (nested) on this thread
+
+// Returns false if the wait was interrupted
+static bool memory_admit(size_t bytes, const std::atomic_bool& interrupt) {
+    // Nested ranges are admitted directly, waiting while holding memory could deadlock
+    if (thread_memory > 0) {
+        memory_in_flight.fetch_add(bytes, std::memory_order_relaxed);
+        return true;
+    }
+    bool throttled = false;
+    size_t cur = memory_in_flight.load(std::memory_order_relaxed);
+    while (true) {
+        const size_t budget = memory_budget.load(std::memory_order_relaxed);
+        if (budget == 0 || cur == 0 || cur + bytes <= budget) {
+            if (memory_in_flight.compare_exchange_weak(cur, cur + bytes, std::memory_order_acquire)) break;
+            continue;
+        }
+        if (interrupt) return false;
+        if (!throttled) {
+            throttled = true;
+            memory_throttled.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        cur = memory_in_flight.load(std::memory_order_relaxed);
+    }
+    return true;
+}
+
+static void memory_release(size_t bytes) {
+    memory_in_flight.fetch_sub(bytes, std::memory_order_release);
+}
+
+class PoolTask;
+static thread_local PoolTask* thread_task = nullptr;  // Pool task which is executing on this thread, used for cancellation
+
+static inline enki::TaskPriority enki_priority(Priority priority) {
+#if ENKITS_TASK_PRIORITIES_NUM > 2
+    switch (priority) {
+    case Priority_Interactive: return enki::TASK_PRIORITY_HIGH;
+    case Priority_Normal:      return enki::TASK_PRIORITY_MED;
+    case Priority_Background:  return enki::TASK_PRIORITY_LOW;
+    default:                   return enki::TASK_PRIORITY_MED;
+    }
+#else
+    (void)priority;
+    return enki::TASK_PRIORITY_HIGH;
+#endif
+}
 
 static inline ID generate_id(uint32_t slot_idx) {
     return (md_time_current() << 8) | (slot_idx & (MAX_TASKS - 1));
@@ -45,33 +175,58 @@ namespace pool {
 class PoolTask : public enki::ITaskSet {
 public:
     PoolTask() = default;
-    PoolTask(uint32_t set_beg_, uint32_t set_end_, RangeTask set_func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0)
-        : ITaskSet(set_end_-set_beg_), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_), m_set_completed(0), m_interrupt(false), m_id(id) {
+    PoolTask(uint32_t set_beg_, uint32_t set_end_, RangeTask set_func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* const* deps = 0, size_t num_deps = 0, Priority priority = Priority_Normal, size_t memory_estimate = 0)
+        : ITaskSet(set_end_-set_beg_), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_), m_set_completed(0), m_interrupt(false), m_memory_estimate(memory_estimate), m_id(id) {
+        m_Priority = enki_priority(priority);
+        m_enqueue_time = md_time_current();
         size_t len = MIN(lbl_.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl_.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
+        for (size_t i = 0; i < num_deps; ++i) {
+            SetDependency(m_dependencies[i], deps[i]);
         }
     }
 
-    PoolTask(Task func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0)
+    PoolTask(Task func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* const* deps = 0, size_t num_deps = 0, Priority priority = Priority_Normal)
         : ITaskSet(1), m_func(func_), m_user_data(user_data_), m_set_completed(0), m_interrupt(false), m_id(id) {
+        m_Priority = enki_priority(priority);
+        m_enqueue_time = md_time_current();
         size_t len = MIN(lbl_.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl_.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
+        for (size_t i = 0; i < num_deps; ++i) {
+            SetDependency(m_dependencies[i], deps[i]);
         }
     }
 
     virtual ~PoolTask() {}
 
     virtual void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) final {
-        (void)threadnum;
-        if (!m_interrupt) {
+        const size_t memory = m_memory_estimate;
+        if (!m_interrupt && (!memory || memory_admit(memory, m_interrupt))) {
+            thread_memory += memory;
+            const bool trace = trace_on.load(std::memory_order_relaxed);
+            const int64_t beg_time = trace ? md_time_current() : 0;
+            ScratchMark mark = scratch_begin(threadnum);
+            // Ranges may be nested when a thread executes other work while waiting
+            PoolTask* prev_task = thread_task;
+            thread_task = this;
+#if VIAMD_CPU_PROFILER
+            cpu_profiler::set_thread(threadnum);
+#endif
+            CPU_ZONE_BEGIN(m_label);
             if (m_set_func)
                 m_set_func(m_range_offset + range.start, m_range_offset + range.end, m_user_data);
             else if (m_func)
                 m_func(m_user_data);
+            CPU_ZONE_END();
+            thread_task = prev_task;
+            scratch_end(mark);
+            if (trace) {
+                trace_record(m_label, m_id, m_enqueue_time, beg_time, md_time_current(), threadnum, range.end - range.start, false);
+            }
+            if (memory) {
+                thread_memory -= memory;
+                memory_release(memory);
+            }
         }
        
         uint32_t range_ext = (range.end - range.start);
@@ -87,103 +242,339 @@ public:
         return !GetIsComplete();
     }
 
+    // Counted by the ranges themselves, a task which is queued or waits for its dependencies has not been handed to the scheduler
+    // which reports it as complete
+    bool Completed() const {
+        return m_set_completed.load(std::memory_order_acquire) >= m_SetSize;
+    }
+
     RangeTask  m_set_func = nullptr;  // either of these two are executed
     Task       m_func     = nullptr;
     void*      m_user_data = nullptr;
     uint32_t   m_range_offset = 0;
     std::atomic_uint32_t m_set_completed = 0;
     std::atomic_bool m_interrupt = false;
-    enki::Dependency m_dependency;
+    size_t     m_memory_estimate = 0;   // Estimated bytes used by each executing range
+    std::atomic_bool m_piped = false;   // Handed to the scheduler (by execute_queued_tasks, execute_task or through its dependencies)
+    enki::Dependency m_dependencies[MAX_DEPENDENCIES];
     char m_buf[LABEL_SIZE];
     str_t m_label = {};
     ID m_id = INVALID_ID;
+    int64_t m_enqueue_time = 0;
 };
 
-class MainTask : public enki::IPinnedTask {
-public:
+// Main tasks are executed by execute_queued_tasks on the main thread, outside of the scheduler
+// Their dependencies are tracked by id, so they can be held back by the time budget of a frame and resumed in the next
+struct MainTask {
     MainTask() = default;
-    MainTask(Task func, void* user_data, str_t lbl = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0) :
-        IPinnedTask(0), m_function(func), m_user_data(user_data), m_id(id) {
+    MainTask(Task func, ResumableTask resumable, void* user_data, str_t lbl, ID id, const ID* deps, size_t num_deps, Priority priority) :
+        m_function(func), m_resumable(resumable), m_user_data(user_data), m_num_dependencies(num_deps), m_priority(priority), m_id(id) {
+        m_enqueue_time = md_time_current();
         size_t len = MIN(lbl.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
+        for (size_t i = 0; i < num_deps; ++i) {
+            m_dependencies[i] = deps[i];
         }
     }
-    virtual void Execute() final {
-        m_function(m_user_data);
-        main::free_slots.push(get_slot_idx(m_id));
+
+    // Returns true when the task has completed, resumable tasks execute one step per call
+    bool Execute() {
+        const bool trace = trace_on.load(std::memory_order_relaxed);
+        const int64_t beg_time = trace ? md_time_current() : 0;
+        ScratchMark mark = scratch_begin(0);
+        CPU_ZONE_BEGIN(m_label);
+        bool done = true;
+        if (m_resumable)
+            done = m_resumable(m_user_data);
+        else if (m_function)
+            m_function(m_user_data);
+        CPU_ZONE_END();
+        scratch_end(mark);
+        if (trace) {
+            trace_record(m_label, m_id, m_enqueue_time, beg_time, md_time_current(), 0, 1, true);
+        }
+        return done;
     }
 
-    Task m_function = nullptr;
+    Task m_function = nullptr;          // either of these two are executed
+    ResumableTask m_resumable = nullptr;
     void* m_user_data = nullptr;
-    enki::Dependency m_dependency;
+    ID m_dependencies[MAX_DEPENDENCIES] = {};
+    size_t m_num_dependencies = 0;
+    Priority m_priority = Priority_Normal;
+    std::atomic_bool m_done = false;
     char m_buf[LABEL_SIZE];
     str_t m_label = {};
     ID m_id = INVALID_ID;
+    int64_t m_enqueue_time = 0;
 };
 
 namespace main {
     static MainTask task_data[MAX_TASKS];
+
+    // Tasks taken from the queue which have not completed, only touched by the main thread
+    static ID pending[MAX_TASKS];
+    static uint32_t num_pending = 0;
+    static bool deferred = false;       // Ready tasks were left by the budget of the last execute_queued_tasks
 }
 
 namespace pool {
     static PoolTask task_data[MAX_TASKS];
 }
 
+// Only pool tasks take part in the dependencies of the scheduler, dependencies of pool tasks on main tasks are ignored
 static inline enki::ICompletable* get_task(ID id) {
     if (id != INVALID_ID) {
         uint32_t slot_idx = get_slot_idx(id);
         PoolTask* ptask = &pool::task_data[slot_idx];
-        MainTask* mtask = &main::task_data[slot_idx];
-        if (ptask->m_id == id)       return ptask;
-        else if (mtask->m_id == id)  return mtask;
+        if (ptask->m_id == id) return ptask;
     }
     return NULL;
 }
 
+// A task whose slot has been reused by another task has completed
+static inline bool task_complete(ID id) {
+    if (id == INVALID_ID) return true;
+    const uint32_t slot_idx = get_slot_idx(id);
+    const PoolTask* ptask = &pool::task_data[slot_idx];
+    if (ptask->m_id == id) return ptask->Completed();
+    const MainTask* mtask = &main::task_data[slot_idx];
+    if (mtask->m_id == id) return mtask->m_done.load(std::memory_order_acquire);
+    return true;
+}
+
+static inline bool main_task_ready(const MainTask* task) {
+    for (size_t i = 0; i < task->m_num_dependencies; ++i) {
+        if (!task_complete(task->m_dependencies[i])) return false;
+    }
+    return true;
+}
+
+// Executes a step of the task (all of it unless it is resumable) and releases its slot once it has completed
+static bool run_main_task(MainTask* task) {
+    if (!task->Execute()) return false;
+    task->m_done.store(true, std::memory_order_release);
+    main::free_slots.push(get_slot_idx(task->m_id));
+    return true;
+}
+
+// Resolves the ids of the dependencies into tasks, skipping the ones which are invalid or have already completed
+// A completed dependency would never launch the task
+static size_t get_dependencies(enki::ICompletable** out_deps, const ID* ids, size_t count) {
+    ASSERT(count <= MAX_DEPENDENCIES);
+    count = MIN(count, MAX_DEPENDENCIES);
+    size_t num_deps = 0;
+    for (size_t i = 0; i < count; ++i) {
+        enki::ICompletable* dep = get_task(ids[i]);
+        if (dep && !dep->GetIsComplete()) {
+            out_deps[num_deps++] = dep;
+        }
+    }
+    return num_deps;
+}
+
 static enki::TaskScheduler ts{};
 
+// One arena per thread of the scheduler, where index 0 is the main thread
+static void init_scratch_arenas() {
+    num_scratch_arenas = ts.GetNumTaskThreads();
+    scratch_arenas = (ScratchArena*)md_alloc(md_heap_allocator, sizeof(ScratchArena) * num_scratch_arenas);
+    for (size_t i = 0; i < num_scratch_arenas; ++i) {
+        PLACEMENT_NEW(&scratch_arenas[i]) ScratchArena();
+        scratch_arenas[i].base = (char*)md_alloc(md_heap_allocator, SCRATCH_ARENA_SIZE);
+        scratch_arenas[i].capacity = SCRATCH_ARENA_SIZE;
+    }
+    thread_arena = &scratch_arenas[0];
+}
+
+static void free_scratch_arenas() {
+    for (size_t i = 0; i < num_scratch_arenas; ++i) {
+        ScratchMark mark = {&scratch_arenas[i], nullptr, 0, nullptr};
+        scratch_end(mark);
+        md_free(md_heap_allocator, scratch_arenas[i].base, scratch_arenas[i].capacity);
+    }
+    md_free(md_heap_allocator, scratch_arenas, sizeof(ScratchArena) * num_scratch_arenas);
+    scratch_arenas = nullptr;
+    num_scratch_arenas = 0;
+}
+
+static uint32_t clamp_num_threads(size_t num_threads) {
+    const size_t num_processors = md_os_num_processors();
+    if (num_threads == 0) num_threads = num_processors;
+    return (uint32_t)CLAMP(num_threads, 2, MAX(num_processors, 2));
+}
+
 void initialize(size_t num_threads = 0) {
-    ts.Initialize((uint32_t)num_threads);
+    ts.Initialize(clamp_num_threads(num_threads));
     for (uint32_t i = 0; i < MAX_TASKS; i++) {
         pool::free_slots.push(i);
         main::free_slots.push(i);
     }
+
+    init_scratch_arenas();
+
+    trace_ring = (TraceSlot*)md_alloc(md_heap_allocator, sizeof(TraceSlot) * TRACE_CAPACITY);
+    for (uint32_t i = 0; i < TRACE_CAPACITY; ++i) {
+        PLACEMENT_NEW(&trace_ring[i]) TraceSlot();
+        trace_ring[i].seq = 0;
+    }
+    trace_head = 0;
 }
 
-void shutdown() { ts.WaitforAllAndShutdown(); }
+void shutdown() {
+    ts.WaitforAllAndShutdown();
+    free_scratch_arenas();
+
+    trace_on = false;
+    md_free(md_heap_allocator, trace_ring, sizeof(TraceSlot) * TRACE_CAPACITY);
+    trace_ring = nullptr;
+}
 
-void execute_queued_tasks() {
+static void pipe_queued_pool_tasks() {
     while (!pool::queued_slots.was_empty()) {
         uint32_t idx = pool::queued_slots.pop();
-        ts.AddTaskSetToPipe(&pool::task_data[idx]);
+        if (!pool::task_data[idx].m_piped.exchange(true)) {
+            ts.AddTaskSetToPipe(&pool::task_data[idx]);
+        }
     }
-    while (!main::queued_slots.was_empty()) {
-        uint32_t idx = main::queued_slots.pop();
-        ts.AddPinnedTask(&main::task_data[idx]);
+}
+
+void execute_queued_tasks(double budget_ms) {
+    if (num_scratch_arenas > 0) {
+        // Rewind what was used on the main thread outside of tasks since the last call
+        ScratchMark mark = {&scratch_arenas[0], &scratch_arenas[0], 0, nullptr};
+        scratch_end(mark);
+    }
+
+    // Ready tasks are executed in order of priority and then of submission, until the budget is spent
+    // At least one task (or step) is executed per call, so the queue always makes progress
+    using namespace main;
+    const int64_t beg_time = md_time_current();
+    bool executed = false;
+    while (true) {
+        // Pool tasks enqueued by the main tasks executed so far are launched before their continuations are considered
+        pipe_queued_pool_tasks();
+        while (!queued_slots.was_empty()) {
+            const uint32_t idx = queued_slots.pop();
+            ASSERT(num_pending < MAX_TASKS);
+            pending[num_pending++] = task_data[idx].m_id;
+        }
+
+        MainTask* next = nullptr;
+        for (uint32_t i = 0; i < num_pending;) {
+            MainTask* task = &task_data[get_slot_idx(pending[i])];
+            if (task->m_id != pending[i] || task->m_done.load(std::memory_order_relaxed)) {
+                // Executed through execute_task
+                pending[i] = pending[--num_pending];
+                continue;
+            }
+            if (main_task_ready(task) && (!next || task->m_priority < next->m_priority ||
+                (task->m_priority == next->m_priority && task->m_enqueue_time < next->m_enqueue_time))) {
+                next = task;
+            }
+            ++i;
+        }
+        deferred = next != nullptr;
+        if (!next) break;
+        if (executed && budget_ms > 0 && md_time_as_seconds(md_time_current() - beg_time) * 1000.0 >= budget_ms) break;
+
+        run_main_task(next);
+        executed = true;
     }
-    ts.RunPinnedTasks();
 }
 
-ID main_enqueue(str_t label, Task func, void* user_data, ID dependency) {
+void execute_task(ID id) {
+    if (id == INVALID_ID) return;
+    const uint32_t slot_idx = get_slot_idx(id);
+
+    // Tasks with a dependency are launched by the scheduler once the dependency completes and are marked as piped when enqueued
+    // The slot is left in the queue, execute_queued_tasks skips it since it is already piped
+    PoolTask* ptask = &pool::task_data[slot_idx];
+    if (ptask->m_id == id) {
+        if (!ptask->m_piped.exchange(true)) {
+            ts.AddTaskSetToPipe(ptask);
+        }
+        return;
+    }
+
+    // Main tasks are completed immediately if their dependencies allow it, the entry in the queue is skipped later
+    MainTask* mtask = &main::task_data[slot_idx];
+    if (mtask->m_id == id && !mtask->m_done) {
+        for (size_t i = 0; i < mtask->m_num_dependencies; ++i) {
+            task_wait_for(mtask->m_dependencies[i]);
+        }
+        if (main_task_ready(mtask)) {
+            while (!run_main_task(mtask));
+        }
+    }
+}
+
+static ID main_enqueue_internal(str_t label, Task func, ResumableTask resumable, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
     using namespace main;
+    ASSERT(num_dependencies <= MAX_DEPENDENCIES);
+    num_dependencies = MIN(num_dependencies, MAX_DEPENDENCIES);
     uint32_t idx = free_slots.pop();
 
     ID id = generate_id(idx);
     MainTask* Task = &task_data[idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) MainTask(func, user_data, label, id, dep_task);
+    PLACEMENT_NEW(Task) MainTask(func, resumable, user_data, label, id, dependencies, num_dependencies, priority);
+    queued_slots.push(idx);
 
-    if (!dep_task) {
-        queued_slots.push(idx);
-    }
-    
     return id;
 }
 
+ID main_enqueue(str_t label, Task func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
+    return main_enqueue_internal(label, func, nullptr, user_data, dependencies, num_dependencies, priority);
+}
+
+ID main_enqueue_resumable(str_t label, ResumableTask func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
+    return main_enqueue_internal(label, nullptr, func, user_data, dependencies, num_dependencies, priority);
+}
+
+ID main_enqueue_resumable(str_t label, ResumableTask func, void* user_data, ID dependency, Priority priority) {
+    return main_enqueue_internal(label, nullptr, func, user_data, &dependency, 1, priority);
+}
+
+ID main_enqueue(str_t label, Task func, void* user_data, ID dependency, Priority priority) {
+    return main_enqueue_internal(label, func, nullptr, user_data, &dependency, 1, priority);
+}
+
+bool main_tasks_deferred() {
+    return main::deferred;
+}
+
 uint32_t pool_num_threads() { return ts.GetNumTaskThreads(); }
 
+void pool_set_num_threads(size_t num_threads) {
+    const uint32_t count = clamp_num_threads(num_threads);
+    if (count == ts.GetNumTaskThreads()) return;
+
+    // Tasks which are queued but not yet piped stay in their queues and are submitted to the new threads
+    ts.WaitforAll();
+    ts.WaitforAllAndShutdown();
+    free_scratch_arenas();
+
+    ts.Initialize(count);
+    init_scratch_arenas();
+    MD_LOG_INFO("Task system restarted with %u threads", count);
+}
+
+void pool_set_memory_budget(size_t bytes) {
+    memory_budget.store(bytes, std::memory_order_relaxed);
+}
+
+size_t pool_memory_budget() {
+    return memory_budget.load(std::memory_order_relaxed);
+}
+
+size_t pool_memory_in_flight() {
+    return memory_in_flight.load(std::memory_order_relaxed);
+}
+
+uint64_t pool_memory_throttled() {
+    return memory_throttled.load(std::memory_order_relaxed);
+}
+
 ID* pool_running_tasks(md_allocator_i* alloc) {
     ASSERT(alloc);
     ID* arr = 0;
@@ -203,40 +594,58 @@ void pool_interrupt_running_tasks() {
     }
 }
 
-ID pool_enqueue(str_t label, Task func, void* user_data, ID dependency) {
+ID pool_enqueue(str_t label, Task func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
     using namespace pool;
 
     uint32_t slot_idx = free_slots.pop();
 
     ID id = generate_id(slot_idx);
     PoolTask* Task = &pool::task_data[slot_idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) PoolTask(func, user_data, label, id, dep_task);
+    enki::ICompletable* deps[MAX_DEPENDENCIES];
+    const size_t num_deps = get_dependencies(deps, dependencies, num_dependencies);
+    PLACEMENT_NEW(Task) PoolTask(func, user_data, label, id, deps, num_deps, priority);
 
-    if (!dep_task) {
+    if (!num_deps) {
         queued_slots.push(slot_idx);
+    } else {
+        Task->m_piped = true;
     }
 
     return id;
 }
 
-ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency) {
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority, size_t memory_estimate) {
     using namespace pool;
 
     uint32_t slot_idx = free_slots.pop();
 
     ID id = generate_id(slot_idx);
     PoolTask* Task = &pool::task_data[slot_idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) PoolTask(range_beg, range_end, range_func, user_data, label, id, dep_task);
+    enki::ICompletable* deps[MAX_DEPENDENCIES];
+    const size_t num_deps = get_dependencies(deps, dependencies, num_dependencies);
+    PLACEMENT_NEW(Task) PoolTask(range_beg, range_end, range_func, user_data, label, id, deps, num_deps, priority, memory_estimate);
 
-    if (!dep_task) {
+    if (!num_deps) {
         queued_slots.push(slot_idx);
+    } else {
+        Task->m_piped = true;
     }
 
     return id;
 }
 
+ID pool_enqueue(str_t label, Task func, void* user_data, ID dependency, Priority priority) {
+    return pool_enqueue(label, func, user_data, &dependency, 1, priority);
+}
+
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency, Priority priority, size_t memory_estimate) {
+    return pool_enqueue(label, range_beg, range_end, range_func, user_data, &dependency, 1, priority, memory_estimate);
+}
+
+ID join(str_t label, const ID* dependencies, size_t num_dependencies) {
+    return pool_enqueue(label, [](void*) {}, NULL, dependencies, num_dependencies, Priority_Interactive);
+}
+
 bool task_is_running(ID id) {
     uint32_t slot_idx = get_slot_idx(id);
     PoolTask* Task = &pool::task_data[slot_idx];
@@ -255,11 +664,24 @@ float task_fraction_complete(ID id) {
     return Task->m_id == id ? (float)Task->m_set_completed / (float)Task->m_SetSize : 0.f;
 }
 
+// The scheduler returns at once for a task it has not been handed yet, so a queued task is launched first
+// and a task which waits for its dependencies (launched by the scheduler once they complete) is waited for until its ranges have run
+static void wait_for_task(PoolTask* task, ID id) {
+    if (!task->m_piped.exchange(true)) {
+        ts.AddTaskSetToPipe(task);
+    }
+    ts.WaitforTask(task);
+    while (task->m_id == id && !task->Completed()) {
+        std::this_thread::yield();
+        ts.WaitforTask(task);
+    }
+}
+
 void task_wait_for(ID id) {
     uint32_t slot_idx = get_slot_idx(id);
     PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id && Task->Running()) {
-        ts.WaitforTask(Task);
+    if (Task->m_id == id && !Task->Completed()) {
+        wait_for_task(Task, id);
     }
 }
 
@@ -274,10 +696,145 @@ void task_interrupt(ID id) {
 void task_interrupt_and_wait_for(ID id) {
     uint32_t slot_idx = get_slot_idx(id);
     PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id && Task->Running()) {
+    if (Task->m_id == id && !Task->Completed()) {
         Task->m_interrupt = true;
-        ts.WaitforTask(Task);
+        wait_for_task(Task, id);
+    }
+}
+
+bool task_cancelled() {
+    PoolTask* task = thread_task;
+    return task ? task->m_interrupt.load(std::memory_order_relaxed) : false;
+}
+
+// Every thread which executes tasks has its own scratch arena, so the arena identifies the thread
+uint32_t thread_index() {
+    const ScratchArena* arena = thread_arena;
+    return arena ? (uint32_t)(arena - scratch_arenas) : UINT32_MAX;
+}
+
+void* scratch_alloc(size_t bytes) {
+    ScratchArena* arena = thread_arena;
+    ASSERT(arena && "Scratch memory requested from a thread which is not part of the task system");
+    bytes = ALIGN_TO(bytes, 16);
+    if (arena->used + bytes <= arena->capacity) {
+        void* ptr = arena->base + arena->used;
+        arena->used += bytes;
+        arena->high_water = MAX(arena->high_water, arena->used);
+        return ptr;
+    }
+
+    // Does not fit, go to the heap and keep track of the block until the arena is rewound
+    const size_t size = sizeof(ScratchBlock) + 16 + bytes;
+    ScratchBlock* block = (ScratchBlock*)md_alloc(md_heap_allocator, size);
+    block->next = arena->heap_blocks;
+    block->size = size;
+    arena->heap_blocks = block;
+    arena->fallbacks += 1;
+    return (void*)ALIGN_TO((uintptr_t)(block + 1), 16);
+}
+
+ScratchMark scratch_mark() {
+    ScratchArena* arena = thread_arena;
+    return {arena, arena, arena ? arena->used : 0, arena ? arena->heap_blocks : nullptr};
+}
+
+void scratch_rewind(ScratchMark mark) {
+    scratch_end(mark);
+}
+
+size_t scratch_num_arenas() { return num_scratch_arenas; }
+
+bool scratch_stats(ScratchStats* stats, size_t arena_idx) {
+    ASSERT(stats);
+    if (arena_idx < num_scratch_arenas) {
+        const ScratchArena& arena = scratch_arenas[arena_idx];
+        stats->capacity   = arena.capacity;
+        stats->high_water = arena.high_water;
+        stats->fallbacks  = arena.fallbacks;
+        return true;
+    }
+    return false;
+}
+
+void trace_set_enabled(bool enabled) {
+    trace_on.store(enabled, std::memory_order_relaxed);
+}
+
+bool trace_enabled() {
+    return trace_on.load(std::memory_order_relaxed);
+}
+
+void trace_clear() {
+    if (!trace_ring) return;
+    // Invalidate the slots through their sequence, events which are in flight at this point may still show up
+    for (uint32_t i = 0; i < TRACE_CAPACITY; ++i) {
+        trace_ring[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t trace_capacity() {
+    return TRACE_CAPACITY;
+}
+
+size_t trace_events(TraceEvent* out_events, size_t capacity) {
+    ASSERT(out_events);
+    if (!trace_ring) return 0;
+    const uint64_t head  = trace_head.load(std::memory_order_acquire);
+    const uint64_t count = MIN(MIN(head, (uint64_t)TRACE_CAPACITY), (uint64_t)capacity);
+    size_t num_events = 0;
+    for (uint64_t idx = head - count; idx < head; ++idx) {
+        const TraceSlot& slot = trace_ring[idx & (TRACE_CAPACITY - 1)];
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * idx + 2) continue;
+        TraceEvent e = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+        out_events[num_events++] = e;
+    }
+    return num_events;
+}
+
+bool trace_write_chrome_json(str_t filename) {
+    TraceEvent* events = (TraceEvent*)md_alloc(md_heap_allocator, sizeof(TraceEvent) * TRACE_CAPACITY);
+    defer { md_free(md_heap_allocator, events, sizeof(TraceEvent) * TRACE_CAPACITY); };
+    const size_t num_events = trace_events(events, TRACE_CAPACITY);
+
+    md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write trace", (int)filename.len, filename.ptr);
+        return false;
+    }
+
+    int64_t base = num_events ? events[0].enqueue_time : 0;
+    for (size_t i = 0; i < num_events; ++i) {
+        base = MIN(base, events[i].enqueue_time);
+    }
+
+    md_file_printf(file, "{\"traceEvents\":[\n");
+    const uint32_t num_threads = ts.GetNumTaskThreads();
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        md_file_printf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}},\n", i, i == 0 ? "Main" : "Worker", i);
+    }
+    for (size_t i = 0; i < num_events; ++i) {
+        const TraceEvent& e = events[i];
+        // Quotes and backslashes are the only characters of a label which can break the JSON
+        char label[TRACE_LABEL_SIZE];
+        size_t len = 0;
+        for (const char* c = e.label; *c; ++c) {
+            label[len++] = (*c == '"' || *c == '\\') ? '_' : *c;
+        }
+        label[len] = '\0';
+
+        const double ts_us    = md_time_as_seconds(e.beg_time - base) * 1.0e6;
+        const double dur_us   = md_time_as_seconds(e.end_time - e.beg_time) * 1.0e6;
+        const double queue_us = md_time_as_seconds(e.beg_time - e.enqueue_time) * 1.0e6;
+        md_file_printf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%llu,\"range\":%u,\"queued_us\":%.3f}}%s\n",
+            label, e.main ? "main" : "pool", e.thread_idx, ts_us, dur_us, (unsigned long long)e.id, e.range_size, queue_us, i + 1 < num_events ? "," : "");
     }
+    md_file_printf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    md_file_close(file);
+    return true;
 }
 
 };  // namespace task_system
@@ -18,18 +18,30 @@ constexpr ID INVALID_ID = 0;
 
 using Task = void (*)(void* user_data);
 using RangeTask = void (*)(uint32_t range_beg, uint32_t range_end, void* user_data);
+using ResumableTask = bool (*)(void* user_data);    // Returns true when the task has completed, false to be called again
 
 /*
 typedef void (*Task) (void* user_data);
 typedef void (*RangeTask)(uint32_t range_beg, uint32_t range_end, void *user_data);
 */
 
+// Priority of pool tasks, the threads of the pool pick up ranges of higher priority tasks first
+// A running range is never preempted, so long running tasks should use ranges of moderate size and poll task_cancelled()
+enum Priority {
+    Priority_Interactive = 0,   // Results the user is waiting for (filtered evaluation, density updates)
+    Priority_Normal      = 1,
+    Priority_Background  = 2,   // Full trajectory sweeps, prefetching
+};
+
+// num_threads includes the main thread, 0 uses the number of processors
 void initialize(size_t num_threads);
 void shutdown();
 
 // Call once per frame at some approriate time, if there are items in the main queue, the main thread will be stalled.
 // Pool tasks will not stall the main thread.
-void execute_queued_tasks();
+// Main tasks whose dependencies have completed are executed in order of priority until budget_ms has passed, the rest are carried over
+// to the next call. At least one task is executed per call, a budget of 0 executes all of them.
+void execute_queued_tasks(double budget_ms = 0);
 
 // Execute the task immediately.
 // If the task is queued for the main thread, it will stall the thread and wait for completion.
@@ -37,28 +49,131 @@ void execute_queued_tasks();
 void execute_task(ID);
 
 // This is to generate tasks for the main thread ("render" thread)
-ID main_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0);
+ID main_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0, Priority priority = Priority_Normal);
+
+// Main tasks which are split into steps, e.g. large uploads, the task is called once per step until it returns true
+// The steps are interleaved with other main tasks and spread over frames by the budget of execute_queued_tasks
+ID main_enqueue_resumable(str_t label, ResumableTask task, void* user_data = 0, ID dependency = 0, Priority priority = Priority_Normal);
+
+// True if main tasks which were ready to execute were carried over by the budget of the last call to execute_queued_tasks
+bool main_tasks_deferred();
 
 // This is to generate tasks for the thread-pool (async operations)
-ID pool_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0);
-ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0);
+ID pool_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0, Priority priority = Priority_Normal);
+// memory_estimate is the number of bytes an executing range is expected to use, which is used to throttle the task (see pool_set_memory_budget)
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0, Priority priority = Priority_Normal, size_t memory_estimate = 0);
+
+// Task graphs
+// A task may depend on up to MAX_DEPENDENCIES predecessors and is launched once all of them have completed.
+// Fan out is implicit, any number of tasks may depend on the same predecessor. Tasks without dependencies are submitted by the next call to
+// execute_queued_tasks, the rest of the graph is launched by the scheduler as its predecessors complete. Dependencies which have already
+// completed (or are invalid) are ignored.
+constexpr size_t MAX_DEPENDENCIES = 8;
+
+// Pool tasks cannot depend on main tasks, such dependencies are ignored
+ID main_enqueue(str_t label, Task task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority_Normal);
+ID main_enqueue_resumable(str_t label, ResumableTask task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority_Normal);
+ID pool_enqueue(str_t label, Task task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority_Normal);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority_Normal, size_t memory_estimate = 0);
+
+// Returns a task which completes when all of the given tasks have completed, which can be used as a single dependency for later tasks
+ID join(str_t label, const ID* dependencies, size_t num_dependencies);
 
 uint32_t pool_num_threads();
 
+// Restarts the pool with a new number of threads (see initialize), this waits for all pool tasks to complete
+// Must be called from the main thread outside of any task
+void pool_set_num_threads(size_t num_threads);
+
+// Admission control for range tasks with a memory estimate
+// A range is only started if the estimated memory of all executing ranges stays within the budget, otherwise the thread waits for memory to be released.
+// A range is always admitted if nothing else is executing, so estimates larger than the budget still make progress. A budget of 0 disables throttling.
+void   pool_set_memory_budget(size_t bytes);
+size_t pool_memory_budget();
+size_t pool_memory_in_flight();     // Estimated bytes of the currently executing ranges
+uint64_t pool_memory_throttled();   // Number of ranges which had to wait for admission
+
 // These do not really reflect the 'current' state since that is illdefined. But rather what the state was at the time of the function call.
 void pool_interrupt_running_tasks();
 ID*  pool_running_tasks(md_allocator_i* alloc);
 
 // These are safe to call with an invalid id, in such case, they will just return some 'zero' default value
+// A pool task is only running once it has been launched, so a task which is polled right after it is enqueued should be launched with execute_task
 bool  task_is_running(ID);
 str_t task_label(ID);
 float task_fraction_complete(ID);
 
 // These are safe to call with an invalid id, and in such case, they do nothing
+// Waiting launches a task which is still queued, and waits for a task which depends on others until it has run
 void task_wait_for(ID);
 void task_interrupt(ID);
 void task_interrupt_and_wait_for(ID);
 
+// Cooperative cancellation: True if the pool task which is executing on the calling thread has been interrupted
+// Ranges which have not started are skipped automatically, this lets long ranges return early. Returns false outside of pool tasks.
+bool task_cancelled();
+
+// Index of the calling thread within the task system (0 is the main thread), UINT32_MAX for threads which are not part of it
+// Lets tasks keep state per thread in arrays of pool_num_threads() entries, which are only ever touched by their thread
+uint32_t thread_index();
+
+// Per-thread scratch memory for tasks
+// Each thread of the pool owns a linear arena which is rewound when the executed range (or task) returns,
+// so temporary buffers within hot loops do not need to touch the global heap.
+// The memory is 16-byte aligned and must not escape the task. Allocations which do not fit in the arena are served by the heap
+// and released at the same point. Outside of tasks on the main thread, the memory lives until the next call to execute_queued_tasks().
+void* scratch_alloc(size_t bytes);
+
+// Explicit scoping of scratch memory, everything allocated after the mark is released when rewinding to it
+struct ScratchArena;
+struct ScratchBlock;
+struct ScratchMark {
+    ScratchArena* arena;
+    ScratchArena* prev_arena;
+    size_t used;
+    ScratchBlock* heap_blocks;
+};
+
+ScratchMark scratch_mark();
+void scratch_rewind(ScratchMark mark);
+
+struct ScratchStats {
+    size_t   capacity;
+    size_t   high_water;    // Largest number of bytes used at once
+    uint64_t fallbacks;     // Number of allocations which did not fit and went to the heap
+};
+
+size_t scratch_num_arenas();
+bool   scratch_stats(ScratchStats* stats, size_t arena_idx);
+
+// Tracing
+// While enabled, every executed range of a pool task and every main task is recorded into a fixed size lock-free ring buffer.
+// Timestamps are md_timestamp_t (see md_os.h), thread index 0 is the main thread.
+constexpr size_t TRACE_LABEL_SIZE = 32;
+
+struct TraceEvent {
+    char     label[TRACE_LABEL_SIZE];
+    ID       id;
+    int64_t  enqueue_time;
+    int64_t  beg_time;
+    int64_t  end_time;
+    uint32_t thread_idx;
+    uint32_t range_size;    // Number of items in the executed range, 1 for plain tasks
+    uint8_t  main;          // Main thread (pinned) task
+};
+
+void trace_set_enabled(bool enabled);
+bool trace_enabled();
+void trace_clear();
+
+// Copies the recorded events into out_events (oldest first) and returns the number of events written
+// Events which are overwritten while being copied are skipped
+size_t trace_events(TraceEvent* out_events, size_t capacity);
+size_t trace_capacity();
+
+// Writes the recorded events as Chrome trace_event JSON (chrome://tracing, Perfetto)
+bool trace_write_chrome_json(str_t filename);
+
 /*
 ID task_create(str_t label, Task Task);
 ID task_create(str_t label, uint32_t range_size, RangeTask RangeTask);
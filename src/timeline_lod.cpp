@@ -0,0 +1,138 @@
+#include "timeline_lod.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+
+#include <math.h>
+
+static inline float nan_min(float a, float b) { return isnan(a) ? b : (isnan(b) ? a : MIN(a, b)); }
+static inline float nan_max(float a, float b) { return isnan(a) ? b : (isnan(b) ? a : MAX(a, b)); }
+
+static void clear_levels(TimelineLod* lod) {
+    for (uint32_t l = 0; l < lod->num_levels; ++l) {
+        const TimelineLodLevel& level = lod->levels[l];
+        const size_t count = (size_t)level.num_blocks * lod->num_series;
+        for (size_t i = 0; i < count; ++i) {
+            level.min[i] = NAN;
+            level.max[i] = NAN;
+        }
+    }
+    md_bitfield_clear(&lod->incorporated);
+}
+
+void timeline_lod_init(TimelineLod* lod, uint32_t num_frames, uint32_t num_series, md_allocator_i* alloc) {
+    ASSERT(lod);
+    ASSERT(alloc);
+    lod->num_frames = num_frames;
+    lod->num_series = num_series;
+    lod->num_levels = 0;
+    lod->alloc = alloc;
+    md_bitfield_init(&lod->incorporated, alloc);
+
+    // The top level has a single block
+    uint32_t block_size = TIMELINE_LOD_BASE_BLOCK;
+    while (lod->num_levels < TIMELINE_LOD_MAX_LEVELS) {
+        TimelineLodLevel& level = lod->levels[lod->num_levels++];
+        level.block_size = block_size;
+        level.num_blocks = (num_frames + block_size - 1) / block_size;
+        level.min = (float*)md_alloc(alloc, sizeof(float) * level.num_blocks * num_series);
+        level.max = (float*)md_alloc(alloc, sizeof(float) * level.num_blocks * num_series);
+        if (level.num_blocks <= 1) break;
+        block_size *= 2;
+    }
+    clear_levels(lod);
+}
+
+void timeline_lod_free(TimelineLod* lod) {
+    ASSERT(lod);
+    if (!lod->alloc) return;
+    for (uint32_t l = 0; l < lod->num_levels; ++l) {
+        TimelineLodLevel& level = lod->levels[l];
+        md_free(lod->alloc, level.min, sizeof(float) * level.num_blocks * lod->num_series);
+        md_free(lod->alloc, level.max, sizeof(float) * level.num_blocks * lod->num_series);
+    }
+    md_bitfield_free(&lod->incorporated);
+    *lod = {};
+}
+
+void timeline_lod_update(TimelineLod* lod, const md_bitfield_t* completed, TimelineLodValueFn value_fn, void* user_data) {
+    ASSERT(lod);
+    ASSERT(completed);
+    ASSERT(value_fn);
+    if (lod->num_levels == 0) return;
+
+    md_bitfield_t tmp = md_bitfield_create(md_heap_allocator);
+    defer { md_bitfield_free(&tmp); };
+
+    // Values of frames which are no longer completed cannot be removed from the blocks
+    md_bitfield_andnot(&tmp, &lod->incorporated, completed);
+    if (!md_bitfield_empty(&tmp)) {
+        clear_levels(lod);
+    }
+
+    md_bitfield_andnot(&tmp, completed, &lod->incorporated);
+    if (md_bitfield_empty(&tmp)) return;
+    md_bitfield_or_inplace(&lod->incorporated, &tmp);
+
+    // Blocks of the base level which contain new frames, in ascending order
+    md_array(uint32_t) dirty = 0;
+    md_bitfield_iter_t it = md_bitfield_iter_create(&tmp);
+    while (md_bitfield_iter_next(&it)) {
+        const uint32_t block = (uint32_t)md_bitfield_iter_idx(&it) / lod->levels[0].block_size;
+        if (block >= lod->levels[0].num_blocks) break;
+        if (md_array_size(dirty) == 0 || *md_array_last(dirty) != block) {
+            md_array_push(dirty, block, md_heap_allocator);
+        }
+    }
+    defer { md_array_free(dirty, md_heap_allocator); };
+
+    const TimelineLodLevel& base = lod->levels[0];
+    for (size_t i = 0; i < md_array_size(dirty); ++i) {
+        const uint32_t b = dirty[i];
+        const uint32_t beg = b * base.block_size;
+        const uint32_t end = MIN(beg + base.block_size, lod->num_frames);
+        for (uint32_t s = 0; s < lod->num_series; ++s) {
+            float mn = NAN;
+            float mx = NAN;
+            for (uint32_t f = beg; f < end; ++f) {
+                const float v = value_fn(f, s, user_data);
+                mn = nan_min(mn, v);
+                mx = nan_max(mx, v);
+            }
+            base.min[s * base.num_blocks + b] = mn;
+            base.max[s * base.num_blocks + b] = mx;
+        }
+    }
+
+    // Propagate to the coarser levels, each block is the union of two blocks of the level below
+    for (uint32_t l = 1; l < lod->num_levels; ++l) {
+        const TimelineLodLevel& src = lod->levels[l - 1];
+        const TimelineLodLevel& dst = lod->levels[l];
+        size_t num_dirty = 0;
+        for (size_t i = 0; i < md_array_size(dirty); ++i) {
+            const uint32_t b = dirty[i] / 2;
+            if (num_dirty > 0 && dirty[num_dirty - 1] == b) continue;
+            dirty[num_dirty++] = b;
+
+            const uint32_t c0 = b * 2;
+            const uint32_t c1 = MIN(c0 + 1, src.num_blocks - 1);
+            for (uint32_t s = 0; s < lod->num_series; ++s) {
+                const size_t so = (size_t)s * src.num_blocks;
+                dst.min[s * dst.num_blocks + b] = nan_min(src.min[so + c0], src.min[so + c1]);
+                dst.max[s * dst.num_blocks + b] = nan_max(src.max[so + c0], src.max[so + c1]);
+            }
+        }
+        md_array_shrink(dirty, num_dirty);
+    }
+}
+
+const TimelineLodLevel* timeline_lod_select(const TimelineLod* lod, uint32_t frame_beg, uint32_t frame_end, uint32_t max_blocks) {
+    ASSERT(lod);
+    const uint32_t num_frames = frame_end > frame_beg ? frame_end - frame_beg : 0;
+    if (num_frames <= max_blocks) return NULL;
+    for (uint32_t l = 0; l < lod->num_levels; ++l) {
+        if (num_frames / lod->levels[l].block_size <= max_blocks) return &lod->levels[l];
+    }
+    return lod->num_levels > 0 ? &lod->levels[lod->num_levels - 1] : NULL;
+}
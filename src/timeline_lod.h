@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <core/md_bitfield.h>
+
+struct md_allocator_i;
+
+// Min/max decimation pyramid of temporal series for drawing timelines of large trajectories
+// Level l holds the minimum and maximum of blocks of (TIMELINE_LOD_BASE_BLOCK << l) frames for every series.
+// Drawing the blocks of the level which matches the pixel width of the view gives the same image as drawing every frame,
+// but the number of points is bounded by the width of the plot instead of the number of frames.
+// The pyramid is updated incrementally, only the blocks which contain frames that have completed since the last update are recomputed.
+
+#define TIMELINE_LOD_BASE_BLOCK 8
+#define TIMELINE_LOD_MAX_LEVELS 24
+
+// Value of a series at a frame, NaN for values which should not be included (frames which are not evaluated)
+typedef float (*TimelineLodValueFn)(uint32_t frame_idx, uint32_t series_idx, void* user_data);
+
+struct TimelineLodLevel {
+    uint32_t block_size = 0;
+    uint32_t num_blocks = 0;
+    float* min = nullptr;   // num_series * num_blocks, NaN for blocks without a value
+    float* max = nullptr;
+};
+
+struct TimelineLod {
+    uint32_t num_frames = 0;
+    uint32_t num_series = 0;
+    uint32_t num_levels = 0;
+    TimelineLodLevel levels[TIMELINE_LOD_MAX_LEVELS];
+    md_bitfield_t incorporated = {};    // Frames whose values are part of the pyramid
+    md_allocator_i* alloc = nullptr;
+};
+
+void timeline_lod_init(TimelineLod* lod, uint32_t num_frames, uint32_t num_series, md_allocator_i* alloc);
+void timeline_lod_free(TimelineLod* lod);
+
+// Incorporates the frames of completed which are not part of the pyramid yet, the pyramid is rebuilt if frames have been removed from completed
+void timeline_lod_update(TimelineLod* lod, const md_bitfield_t* completed, TimelineLodValueFn value_fn, void* user_data);
+
+// The finest level which shows [frame_beg, frame_end) with at most max_blocks blocks, NULL if the frames themselves should be drawn
+const TimelineLodLevel* timeline_lod_select(const TimelineLod* lod, uint32_t frame_beg, uint32_t frame_end, uint32_t max_blocks);
@@ -0,0 +1,101 @@
+#include "trajectory_sweep.h"
+
+#include <progressive.h>
+
+#include <core/md_common.h>
+#include <md_trajectory.h>
+
+#include <thread>
+#include <chrono>
+
+void trajectory_sweep_init(TrajectorySweep* sweep, md_trajectory_i* traj, size_t num_atoms) {
+    ASSERT(sweep);
+    sweep->traj = traj;
+    sweep->num_atoms = num_atoms;
+    for (uint32_t i = 0; i < TRAJECTORY_SWEEP_MAX_CONSUMERS; ++i) {
+        ASSERT(sweep->consumers[i].in_flight == 0);
+        sweep->consumers[i].sweep = sweep;
+        sweep->consumers[i].active = false;
+    }
+}
+
+void trajectory_sweep_set_consumer(TrajectorySweep* sweep, uint32_t slot, ProgressiveSweep* progress, TrajectorySweepFn process, void* user_data, uint32_t flags) {
+    ASSERT(sweep);
+    ASSERT(slot < TRAJECTORY_SWEEP_MAX_CONSUMERS);
+    TrajectorySweepConsumer& c = sweep->consumers[slot];
+    ASSERT(!c.active);
+    c.sweep = sweep;
+    c.progress = progress;
+    c.process = process;
+    c.user_data = user_data;
+    c.flags = flags;
+}
+
+void trajectory_sweep_activate(TrajectorySweep* sweep, uint32_t slot) {
+    ASSERT(sweep);
+    ASSERT(slot < TRAJECTORY_SWEEP_MAX_CONSUMERS);
+    ASSERT(sweep->consumers[slot].process && sweep->consumers[slot].progress);
+    sweep->consumers[slot].active = true;
+}
+
+void trajectory_sweep_deactivate(TrajectorySweep* sweep, uint32_t slot) {
+    ASSERT(sweep);
+    ASSERT(slot < TRAJECTORY_SWEEP_MAX_CONSUMERS);
+    TrajectorySweepConsumer& c = sweep->consumers[slot];
+    c.active = false;
+    // A frame is only processed after in_flight has been incremented and the consumer has been seen as active,
+    // so once in_flight reaches zero no frame can be handed to the consumer
+    while (c.in_flight.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+static void sweep_range(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    TrajectorySweepConsumer* lead = (TrajectorySweepConsumer*)user_data;
+    TrajectorySweep* sweep = lead->sweep;
+
+    const size_t stride = ALIGN_TO(sweep->num_atoms, 8);
+    float* coords = (float*)task_system::scratch_alloc(stride * sizeof(float) * 3);
+    float* x = coords + stride * 0;
+    float* y = coords + stride * 1;
+    float* z = coords + stride * 2;
+
+    TrajectorySweepConsumer* claimed[TRAJECTORY_SWEEP_MAX_CONSUMERS];
+    uint32_t frame_idx;
+    // Cancellation is checked before claiming, so a claimed frame is always completed
+    for (uint32_t i = range_beg; i < range_end && !task_system::task_cancelled() && progressive_next(lead->progress, &frame_idx); ++i) {
+        lead->in_flight.fetch_add(1);
+        uint32_t num_claimed = 0;
+        claimed[num_claimed++] = lead;
+        uint32_t flags = lead->flags;
+        for (uint32_t j = 0; j < TRAJECTORY_SWEEP_MAX_CONSUMERS; ++j) {
+            TrajectorySweepConsumer* c = &sweep->consumers[j];
+            if (c == lead || !c->active.load(std::memory_order_relaxed)) continue;
+            c->in_flight.fetch_add(1);
+            if (c->active.load() && progressive_claim(c->progress, frame_idx)) {
+                claimed[num_claimed++] = c;
+                flags |= c->flags;
+            } else {
+                c->in_flight.fetch_sub(1);
+            }
+        }
+
+        const task_system::ScratchMark mark = task_system::scratch_mark();
+        md_trajectory_frame_header_t header;
+        md_trajectory_load_frame(sweep->traj, frame_idx, (flags & TrajectorySweepFlag_Header) ? &header : NULL, x, y, z);
+        for (uint32_t j = 0; j < num_claimed; ++j) {
+            TrajectorySweepConsumer* c = claimed[j];
+            c->process(frame_idx, (c->flags & TrajectorySweepFlag_Header) ? &header : NULL, x, y, z, c->user_data);
+            progressive_complete(c->progress, frame_idx);
+            c->in_flight.fetch_sub(1);
+        }
+        task_system::scratch_rewind(mark);
+    }
+}
+
+task_system::ID trajectory_sweep_enqueue(TrajectorySweep* sweep, uint32_t lead, str_t label, uint32_t count, task_system::ID dependency, task_system::Priority priority, size_t memory_estimate) {
+    ASSERT(sweep);
+    ASSERT(lead < TRAJECTORY_SWEEP_MAX_CONSUMERS);
+    ASSERT(sweep->consumers[lead].process && sweep->consumers[lead].progress);
+    return task_system::pool_enqueue(label, 0, count, sweep_range, &sweep->consumers[lead], dependency, priority, memory_estimate);
+}
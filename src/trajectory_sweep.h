@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include <core/md_str.h>
+#include <task_system.h>
+
+struct md_trajectory_i;
+struct md_trajectory_frame_header_t;
+struct ProgressiveSweep;
+
+// Shared pass over the frames of a trajectory for several consumers (backbone angles, shape space, ...)
+// Each consumer tracks its own progress with a ProgressiveSweep. A sweep task is driven by one consumer (the lead), which decides the order of the frames.
+// Every frame loaded by the task is also handed to the other active consumers which would visit it and have not processed it yet,
+// so a frame is decoded once even if it is not kept in the frame cache. Frames are processed in parallel over the range of the task,
+// the consumers of a frame are run one after another on the same thread while the coordinates are still in cache.
+
+#define TRAJECTORY_SWEEP_MAX_CONSUMERS 8
+
+enum TrajectorySweepFlags : uint32_t {
+    TrajectorySweepFlag_Header = 1, // The consumer reads the frame header (unit cell, time)
+};
+
+// Process a single frame, the coordinates are only valid for the duration of the call
+// Scratch memory (task_system::scratch_alloc) allocated by the consumer is released after the frame
+typedef void (*TrajectorySweepFn)(uint32_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, void* user_data);
+
+struct TrajectorySweep;
+
+struct TrajectorySweepConsumer {
+    TrajectorySweep* sweep = nullptr;
+    ProgressiveSweep* progress = nullptr;
+    TrajectorySweepFn process = nullptr;
+    void* user_data = nullptr;
+    uint32_t flags = 0;
+    std::atomic_bool active = false;
+    std::atomic_uint32_t in_flight = 0; // Frames which are currently processed by the consumer
+};
+
+struct TrajectorySweep {
+    md_trajectory_i* traj = nullptr;
+    size_t num_atoms = 0;
+    TrajectorySweepConsumer consumers[TRAJECTORY_SWEEP_MAX_CONSUMERS];
+};
+
+// Must not be called while a sweep task is running
+void trajectory_sweep_init(TrajectorySweep* sweep, md_trajectory_i* traj, size_t num_atoms);
+
+// Declare the consumer of a slot, the consumer is inactive until it is activated
+void trajectory_sweep_set_consumer(TrajectorySweep* sweep, uint32_t slot, ProgressiveSweep* progress, TrajectorySweepFn process, void* user_data, uint32_t flags = 0);
+
+// An active consumer receives the frames of sweep tasks led by other consumers
+void trajectory_sweep_activate(TrajectorySweep* sweep, uint32_t slot);
+
+// Deactivate and wait for frames which are currently processed by the consumer, after which its data can be modified
+// This does not interrupt a task led by the consumer, that is up to the caller
+void trajectory_sweep_deactivate(TrajectorySweep* sweep, uint32_t slot);
+
+// Enqueue a task which processes up to count frames claimed from the progress of the lead consumer
+task_system::ID trajectory_sweep_enqueue(TrajectorySweep* sweep, uint32_t lead, str_t label, uint32_t count, task_system::ID dependency = 0, task_system::Priority priority = task_system::Priority_Normal, size_t memory_estimate = 0);
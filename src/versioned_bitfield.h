@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <core/md_bitfield.h>
+
+// Bitfield with a version which is bumped by every modification, so a change is detected by comparing versions instead of the bits
+// The popcount and the range of the set bits are cached for the version they were computed for, which makes repeated queries O(1)
+// until the next modification. Every modification must go through versioned_bitfield_modify, which returns the bitfield to write.
+
+struct VersionedBitfield {
+    md_bitfield_t bits = {};
+    uint64_t version = 1;
+
+    // Cached for stats_version
+    uint64_t stats_version = 0;
+    uint64_t popcount = 0;
+    uint64_t first_bit = 0;     // Lowest set bit
+    uint64_t last_bit = 0;      // Highest set bit + 1, 0 if empty
+};
+
+static inline void versioned_bitfield_init(VersionedBitfield* vbf, md_allocator_i* alloc) {
+    md_bitfield_init(&vbf->bits, alloc);
+    vbf->version += 1;
+}
+
+static inline void versioned_bitfield_free(VersionedBitfield* vbf) {
+    md_bitfield_free(&vbf->bits);
+    vbf->version += 1;
+}
+
+// The version is bumped when the bitfield is handed out, so the pointer should not be kept beyond the modification
+static inline md_bitfield_t* versioned_bitfield_modify(VersionedBitfield* vbf) {
+    vbf->version += 1;
+    return &vbf->bits;
+}
+
+static inline void versioned_bitfield_update_stats(VersionedBitfield* vbf) {
+    if (vbf->stats_version == vbf->version) return;
+    const md_bitfield_t* bf = &vbf->bits;
+    vbf->stats_version = vbf->version;
+    vbf->popcount = md_bitfield_popcount(bf);
+    vbf->first_bit = 0;
+    vbf->last_bit = 0;
+    if (vbf->popcount == 0) return;
+
+    const uint64_t first = md_bitfield_scan(bf, bf->beg_bit, bf->end_bit);
+    vbf->first_bit = first ? first - 1 : 0;
+    // Scan backwards in blocks of 64 bits for the highest set bit
+    uint64_t end = bf->end_bit;
+    while (end > vbf->first_bit) {
+        const uint64_t beg = end - (end - vbf->first_bit < 64 ? end - vbf->first_bit : 64);
+        if (md_bitfield_popcount_range(bf, beg, end)) {
+            while (!md_bitfield_test_bit(bf, end - 1)) --end;
+            break;
+        }
+        end = beg;
+    }
+    vbf->last_bit = end;
+}
+
+static inline uint64_t versioned_bitfield_popcount(VersionedBitfield* vbf) {
+    versioned_bitfield_update_stats(vbf);
+    return vbf->popcount;
+}
+
+static inline bool versioned_bitfield_empty(VersionedBitfield* vbf) {
+    return versioned_bitfield_popcount(vbf) == 0;
+}
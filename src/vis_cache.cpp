@@ -0,0 +1,250 @@
+#include "vis_cache.h"
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <md_trajectory.h>
+
+#include <new>
+#include <thread>
+#include <chrono>
+
+// Counts the bytes of the visualization of the entry, which is only evaluated by one thread at a time
+static void* entry_realloc(struct md_allocator_o* inst, void* ptr, size_t old_size, size_t new_size, const char* file, size_t line) {
+    VisCacheEntry* e = (VisCacheEntry*)inst;
+    void* result = e->backing->realloc(e->backing->inst, ptr, old_size, new_size, file, line);
+    if (result || new_size == 0) {
+        e->bytes = e->bytes + new_size - old_size;
+    }
+    return result;
+}
+
+static VisCacheEntry* entry_create(VisCache* cache, const VisCacheKey& key) {
+    VisCacheEntry* e = new (md_alloc(cache->alloc, sizeof(VisCacheEntry))) VisCacheEntry();
+    e->key = key;
+    e->backing = cache->alloc;
+    e->alloc.inst = (struct md_allocator_o*)e;
+    e->alloc.realloc = entry_realloc;
+    md_script_vis_init(&e->vis, &e->alloc);
+    return e;
+}
+
+static void entry_free(VisCache* cache, VisCacheEntry* e) {
+    md_script_vis_free(&e->vis);
+    e->~VisCacheEntry();
+    md_free(cache->alloc, e, sizeof(VisCacheEntry));
+}
+
+static void entry_release(const VisCacheKey&, VisCacheEntry** e, void* user_data) {
+    entry_free((VisCache*)user_data, *e);
+}
+
+// Hands an evaluated entry to the index, it takes the place of an entry of the same key
+static void entry_publish(VisCache* cache, VisCacheEntry* e) {
+    if (!lru_cache_put(&cache->index, e->key, e, sizeof(VisCacheEntry) + e->bytes)) {
+        // Only the case if the key is pinned, so it is cached already
+        entry_free(cache, e);
+    }
+}
+
+void vis_cache_init(VisCache* cache, md_allocator_i* alloc) {
+    ASSERT(cache);
+    ASSERT(alloc);
+    cache->alloc = alloc;
+    lru_cache_init(&cache->index, VIS_CACHE_CAPACITY, 0, alloc, entry_release, cache);
+    cache->num_pinned = 0;
+    cache->next_pin = 0;
+}
+
+void vis_cache_free(VisCache* cache) {
+    ASSERT(cache);
+    vis_cache_clear(cache);
+    lru_cache_free(&cache->index);
+    cache->alloc = nullptr;
+}
+
+// Waits for the task of the batch, hands the evaluated entries to the index and drops those which it has not evaluated,
+// which is the case for ranges skipped by an interrupt
+static void finish_batch(VisCache* cache, VisCacheBatch* b) {
+    if (b->task == task_system::INVALID_ID) return;
+    task_system::task_wait_for(b->task);
+    for (uint32_t i = 0; i < b->size; ++i) {
+        VisCacheEntry* e = b->entries[i];
+        if (!e) continue;
+        if (e->state.load(std::memory_order_acquire) == VisCacheState_Ready) {
+            entry_publish(cache, e);
+        } else {
+            entry_free(cache, e);
+        }
+        b->entries[i] = nullptr;
+    }
+    b->task = task_system::INVALID_ID;
+    b->size = 0;
+}
+
+// A batch is in flight until its task has completed
+static bool batch_in_flight(VisCache* cache, VisCacheBatch* b) {
+    if (b->task == task_system::INVALID_ID) return false;
+    if (task_system::task_is_running(b->task)) return true;
+    finish_batch(cache, b);
+    return false;
+}
+
+// Entry of key in a batch which is in flight, the index of the entry in the batch is written to slot
+static VisCacheBatch* find_pending(VisCache* cache, const VisCacheKey& key, uint32_t* slot) {
+    for (uint32_t i = 0; i < VIS_CACHE_MAX_BATCHES; ++i) {
+        VisCacheBatch* b = &cache->batches[i];
+        if (b->task == task_system::INVALID_ID) continue;
+        for (uint32_t j = 0; j < b->size; ++j) {
+            if (b->entries[j] && b->entries[j]->key == key) {
+                *slot = j;
+                return b;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Keeps the entry of key pinned until VIS_CACHE_PINNED other keys have been pinned, the caller has acquired it
+static void keep_pinned(VisCache* cache, const VisCacheKey& key) {
+    for (uint32_t i = 0; i < cache->num_pinned; ++i) {
+        if (cache->pinned[i] == key) {
+            lru_cache_release(&cache->index, key);
+            return;
+        }
+    }
+    if (cache->num_pinned == VIS_CACHE_PINNED) {
+        lru_cache_release(&cache->index, cache->pinned[cache->next_pin]);
+    } else {
+        cache->num_pinned += 1;
+    }
+    cache->pinned[cache->next_pin] = key;
+    cache->next_pin = (cache->next_pin + 1) % VIS_CACHE_PINNED;
+}
+
+static void release_pinned(VisCache* cache) {
+    for (uint32_t i = 0; i < cache->num_pinned; ++i) {
+        lru_cache_release(&cache->index, cache->pinned[i]);
+    }
+    cache->num_pinned = 0;
+    cache->next_pin = 0;
+}
+
+void vis_cache_clear(VisCache* cache) {
+    ASSERT(cache);
+    for (uint32_t i = 0; i < VIS_CACHE_MAX_BATCHES; ++i) {
+        task_system::task_interrupt_and_wait_for(cache->batches[i].task);
+        finish_batch(cache, &cache->batches[i]);
+    }
+    release_pinned(cache);
+    lru_cache_clear(&cache->index);
+}
+
+const md_script_vis_t* vis_cache_get(VisCache* cache, const VisCacheKey& key, const md_script_vis_ctx_t* ctx) {
+    ASSERT(cache);
+    ASSERT(cache->alloc);
+    ASSERT(ctx);
+
+    // Completed batches hand over their entries
+    for (uint32_t i = 0; i < VIS_CACHE_MAX_BATCHES; ++i) {
+        batch_in_flight(cache, &cache->batches[i]);
+    }
+
+    uint32_t slot = 0;
+    VisCacheBatch* b = find_pending(cache, key, &slot);
+    if (b) {
+        // The frame is evaluated by a batch task, it is more expensive to evaluate it again than to wait for it unless the batch is held up
+        VisCacheEntry* e = b->entries[slot];
+        const auto beg = std::chrono::steady_clock::now();
+        const auto max_wait = std::chrono::milliseconds(VIS_CACHE_MAX_WAIT_MS);
+        while (e->state.load(std::memory_order_acquire) == VisCacheState_Pending && task_system::task_is_running(b->task) &&
+               std::chrono::steady_clock::now() - beg < max_wait) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        if (e->state.load(std::memory_order_acquire) == VisCacheState_Ready) {
+            // The task is done with the entry, so it is taken out of the batch ahead of the rest
+            b->entries[slot] = nullptr;
+            entry_publish(cache, e);
+        } else {
+            // A cancelled entry is dropped
+            task_system::task_interrupt_and_wait_for(b->task);
+            finish_batch(cache, b);
+        }
+    }
+
+    VisCacheEntry** cached = lru_cache_acquire(&cache->index, key);
+    if (!cached) {
+        VisCacheEntry* e = entry_create(cache, key);
+        e->valid = md_script_vis_eval_payload(&e->vis, key.payload, key.subidx, ctx, key.flags);
+        e->state.store(VisCacheState_Ready, std::memory_order_relaxed);
+        entry_publish(cache, e);
+        cached = lru_cache_acquire(&cache->index, key);
+        // Only a miss if every entry is pinned by the batches and the callers, which the capacity leaves room for
+        if (!cached) return NULL;
+    }
+    keep_pinned(cache, key);
+    return (*cached)->valid ? &(*cached)->vis : NULL;
+}
+
+static void batch_range(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    VisCacheBatch* b = (VisCacheBatch*)user_data;
+
+    md_molecule_t mol = b->mol;
+    const size_t stride = ALIGN_TO(mol.atom.count, 8);
+    float* coords = (float*)task_system::scratch_alloc(stride * sizeof(float) * 3);
+    mol.atom.x = coords + stride * 0;
+    mol.atom.y = coords + stride * 1;
+    mol.atom.z = coords + stride * 2;
+
+    md_script_vis_ctx_t ctx = {
+        .ir   = b->ir,
+        .mol  = &mol,
+        .traj = b->traj,
+    };
+
+    for (uint32_t i = range_beg; i < range_end; ++i) {
+        // Left pending, so the frame is dropped and evaluated again when it is requested
+        if (task_system::task_cancelled()) break;
+        VisCacheEntry* e = b->entries[i];
+        e->valid = false;
+        md_trajectory_frame_header_t header;
+        if (md_trajectory_load_frame(b->traj, (int64_t)e->key.frame, &header, mol.atom.x, mol.atom.y, mol.atom.z)) {
+            mol.unit_cell = header.unit_cell;
+            e->valid = md_script_vis_eval_payload(&e->vis, e->key.payload, e->key.subidx, &ctx, e->key.flags);
+        }
+        e->state.store(VisCacheState_Ready, std::memory_order_release);
+    }
+}
+
+void vis_cache_prefetch(VisCache* cache, const VisCacheKey& key, uint32_t beg, uint32_t end, const md_script_vis_ctx_t* ctx) {
+    ASSERT(cache);
+    ASSERT(cache->alloc);
+    ASSERT(ctx);
+    if (!ctx->traj || !ctx->mol) return;
+
+    VisCacheBatch* b = NULL;
+    for (uint32_t i = 0; i < VIS_CACHE_MAX_BATCHES && !b; ++i) {
+        if (!batch_in_flight(cache, &cache->batches[i])) b = &cache->batches[i];
+    }
+    if (!b) return;
+
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(ctx->traj);
+    end = MIN(end, num_frames);
+
+    b->size = 0;
+    for (uint32_t f = beg; f < end && b->size < VIS_CACHE_BATCH_FRAMES; ++f) {
+        VisCacheKey k = key;
+        k.frame = (double)f;
+        uint32_t slot;
+        if (lru_cache_contains(&cache->index, k) || find_pending(cache, k, &slot)) continue;
+        b->entries[b->size++] = entry_create(cache, k);
+    }
+
+    if (b->size > 0) {
+        b->ir = ctx->ir;
+        b->mol = *ctx->mol;
+        b->traj = ctx->traj;
+        b->task = task_system::pool_enqueue(STR("##Vis Batch"), 0, b->size, batch_range, b, 0, task_system::Priority_Interactive);
+        // Launched now, a task which has not been piped yet reads as completed, so the batch would be reused
+        task_system::execute_task(b->task);
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include <md_script.h>
+#include <md_molecule.h>
+#include <task_system.h>
+
+#include <lru_cache.h>
+
+struct md_trajectory_i;
+
+// Cache of evaluated visualizations of script payloads
+// Hovering a property evaluates its visualization every frame, even though the result only changes with the payload, the flags and the atom positions.
+// Entries are looked up by key in an LruCache, which evicts the least recently used and accounts their bytes in the memory budget.
+// Neighbouring frames can be evaluated ahead (e.g. during playback) in a batch on the pool, the entries of a batch are owned by it until it completes.
+// All functions are called from the main thread, the batch tasks only fill the entries of their batch.
+
+#define VIS_CACHE_CAPACITY 32
+#define VIS_CACHE_BATCH_FRAMES 8
+#define VIS_CACHE_MAX_BATCHES 4     // Batches in flight, e.g. for several properties which are prefetched in the same frame
+#define VIS_CACHE_MAX_WAIT_MS 100   // Waiting for an entry of a batch longer than this cancels the batch
+#define VIS_CACHE_PINNED 4          // The most recent results are pinned, so the callers which hold on to them until drawing are not evicted from under
+
+struct VisCacheKey {
+    uint64_t ir_fingerprint = 0;
+    uint64_t context = 0;       // Fingerprint of everything else the atom positions depend on (trajectory, interpolation)
+    const md_script_vis_payload_o* payload = nullptr;
+    int32_t  subidx = 0;
+    md_script_vis_flags_t flags = 0;
+    double   frame = 0;         // The (fractional) frame of the atom positions
+};
+
+static inline bool operator==(const VisCacheKey& a, const VisCacheKey& b) {
+    return a.ir_fingerprint == b.ir_fingerprint && a.context == b.context && a.payload == b.payload &&
+           a.subidx == b.subidx && a.flags == b.flags && a.frame == b.frame;
+}
+
+static inline uint64_t lru_cache_hash(const VisCacheKey& key) {
+    uint64_t frame_bits;
+    MEMCPY(&frame_bits, &key.frame, sizeof(frame_bits));
+    uint64_t h = lru_cache_hash(key.ir_fingerprint) ^ key.context;
+    h = lru_cache_hash(h) ^ (uint64_t)(uintptr_t)key.payload;
+    h = lru_cache_hash(h) ^ ((uint64_t)(uint32_t)key.subidx << 32 | (uint64_t)(uint32_t)key.flags);
+    h = lru_cache_hash(h) ^ frame_bits;
+    return lru_cache_hash(h);
+}
+
+enum VisCacheState : uint8_t {
+    VisCacheState_Pending = 0, // Evaluated by a batch task
+    VisCacheState_Ready   = 1,
+};
+
+struct VisCacheEntry {
+    VisCacheKey key = {};
+    md_script_vis_t vis = {};
+    std::atomic_uint8_t state = VisCacheState_Pending;
+    bool valid = false;         // Result of the evaluation
+    md_allocator_i alloc = {};  // Allocator of vis, counts its bytes and forwards to the allocator of the cache
+    md_allocator_i* backing = nullptr;
+    size_t bytes = 0;
+};
+
+// Batch evaluation on the pool, a batch is in flight from its enqueue until its entries have been handed to the cache
+struct VisCacheBatch {
+    task_system::ID task = task_system::INVALID_ID;
+    VisCacheEntry* entries[VIS_CACHE_BATCH_FRAMES] = {};   // NULL once taken by the cache
+    uint32_t size = 0;
+    const md_script_ir_t* ir = nullptr;
+    md_molecule_t mol = {};
+    md_trajectory_i* traj = nullptr;
+};
+
+struct VisCache {
+    LruCache<VisCacheKey, VisCacheEntry*> index;
+    md_allocator_i* alloc = nullptr;
+    VisCacheBatch batches[VIS_CACHE_MAX_BATCHES];
+    VisCacheKey pinned[VIS_CACHE_PINNED];
+    uint32_t num_pinned = 0;
+    uint32_t next_pin = 0;
+};
+
+// The allocator is used from the pool and must be thread safe
+void vis_cache_init(VisCache* cache, md_allocator_i* alloc);
+void vis_cache_free(VisCache* cache);
+
+// Drops all entries, cancels and waits for the batch tasks
+// Must be called before the IR, the molecule or the trajectory of any entry is freed
+void vis_cache_clear(VisCache* cache);
+
+// Returns the visualization of key, which is evaluated with ctx on the calling thread on a miss. NULL if the evaluation failed.
+// An entry which is pending in a batch is waited for up to VIS_CACHE_MAX_WAIT_MS, after which the batch is cancelled and the entry evaluated here.
+// The result stays valid until VIS_CACHE_PINNED other keys have been returned or the cache is cleared.
+const md_script_vis_t* vis_cache_get(VisCache* cache, const VisCacheKey& key, const md_script_vis_ctx_t* ctx);
+
+// Evaluate key for the frames in [beg, end) on the pool, frames which are cached are skipped.
+// Nothing is done while VIS_CACHE_MAX_BATCHES batches are in flight.
+// The positions are loaded from ctx->traj, the rest of the structure is copied from ctx->mol and must stay valid until the batch completes.
+void vis_cache_prefetch(VisCache* cache, const VisCacheKey& key, uint32_t beg, uint32_t end, const md_script_vis_ctx_t* ctx);
@@ -0,0 +1,146 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "volume_export.h"
+#include "table_export.h"
+
+#include <task_system.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <stdio.h>
+
+#define SLAB_TEXT_BYTES MEGABYTES(4)    // Target size of the formatted text of a slab
+#define VOXEL_MAX_CHARS 16              // " %12.6E" and the share of a line break
+
+struct CubeSlabs {
+    const float* values;
+    int dim[3];
+    uint32_t planes_per_slab;   // Planes of constant x
+    uint32_t num_slabs;
+    uint32_t slab_beg;          // First slab of the wave
+    size_t slab_cap;            // Bytes per slab buffer
+    char*  buf;                 // One buffer per slab of the wave
+    size_t* len;                // Bytes written to each buffer
+};
+
+// The values are written six per line, counted over the whole volume in the order x, y, z with z innermost
+static size_t format_planes(char* buf, size_t cap, const CubeSlabs& c, int x_beg, int x_end) {
+    const size_t plane_size = (size_t)c.dim[1] * c.dim[2];
+    size_t count = (size_t)x_beg * plane_size;
+    size_t len = 0;
+    for (int x = x_beg; x < x_end; ++x) {
+        for (int y = 0; y < c.dim[1]; ++y) {
+            const float* src = c.values + (size_t)y * c.dim[0] + x;
+            const size_t stride = (size_t)c.dim[0] * c.dim[1];
+            for (int z = 0; z < c.dim[2]; ++z) {
+                const int n = snprintf(buf + len, cap - len, " %12.6E", src[z * stride]);
+                len += (size_t)MAX(n, 0);
+                if (++count % 6 == 0) buf[len++] = '\n';
+            }
+        }
+    }
+    return len;
+}
+
+static uint32_t planes_per_slab(const int dim[3]) {
+    const size_t plane_bytes = (size_t)dim[1] * dim[2] * VOXEL_MAX_CHARS;
+    return (uint32_t)MAX(1, SLAB_TEXT_BYTES / MAX(plane_bytes, 1));
+}
+
+uint32_t volume_cube_num_slabs(const int dim[3]) {
+    ASSERT(dim);
+    const uint32_t planes = planes_per_slab(dim);
+    return ((uint32_t)MAX(dim[0], 0) + planes - 1) / planes;
+}
+
+bool volume_write_cube(str_t path, str_t header, const float* values, const int dim[3], std::atomic_uint32_t* slabs_written) {
+    ASSERT(values);
+    ASSERT(dim);
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write data.", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    bool ok = md_file_write(file, header.ptr, header.len) == header.len;
+
+    // The slabs are formatted in waves, which bounds the memory to a few slabs per thread
+    const size_t slabs_per_wave = (size_t)task_system::pool_num_threads() * 2 + 1;
+    CubeSlabs c = {};
+    c.values = values;
+    MEMCPY(c.dim, dim, sizeof(c.dim));
+    c.planes_per_slab = planes_per_slab(dim);
+    c.num_slabs = volume_cube_num_slabs(dim);
+    c.slab_cap = (size_t)c.planes_per_slab * dim[1] * dim[2] * VOXEL_MAX_CHARS + 1;
+    c.buf = (char*)md_alloc(md_heap_allocator, c.slab_cap * slabs_per_wave);
+    c.len = (size_t*)md_alloc(md_heap_allocator, sizeof(size_t) * slabs_per_wave);
+    defer {
+        md_free(md_heap_allocator, c.buf, c.slab_cap * slabs_per_wave);
+        md_free(md_heap_allocator, c.len, sizeof(size_t) * slabs_per_wave);
+    };
+
+    bool cancelled = false;
+    for (c.slab_beg = 0; c.slab_beg < c.num_slabs && ok; c.slab_beg += (uint32_t)slabs_per_wave) {
+        if (task_system::task_cancelled()) {
+            cancelled = true;
+            break;
+        }
+        const uint32_t num_slabs = (uint32_t)MIN(slabs_per_wave, c.num_slabs - c.slab_beg);
+        task_system::ID id = task_system::pool_enqueue(STR("##Format Cube"), 0, num_slabs, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            CubeSlabs* c = (CubeSlabs*)user_data;
+            for (uint32_t s = range_beg; s < range_end; ++s) {
+                const int x_beg = (int)((c->slab_beg + s) * c->planes_per_slab);
+                const int x_end = MIN(x_beg + (int)c->planes_per_slab, c->dim[0]);
+                c->len[s] = format_planes(c->buf + s * c->slab_cap, c->slab_cap, *c, x_beg, x_end);
+            }
+        }, &c, 0, task_system::Priority_Interactive);
+        task_system::execute_task(id);
+        task_system::task_wait_for(id);
+
+        for (uint32_t s = 0; s < num_slabs && ok; ++s) {
+            ok = md_file_write(file, c.buf + s * c.slab_cap, c.len[s]) == c.len[s];
+            if (slabs_written) slabs_written->fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (cancelled) {
+        MD_LOG_INFO("Export to '%.*s' was cancelled", (int)path.len, path.ptr);
+        return false;
+    }
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
+
+bool volume_write_npy(str_t path, const float* values, const int dim[3]) {
+    ASSERT(values);
+    ASSERT(dim);
+
+    md_file_o* file = md_file_open(path, MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '%.*s' to write data.", (int)path.len, path.ptr);
+        return false;
+    }
+    defer { md_file_close(file); };
+
+    char header[256];
+    const size_t shape[3] = {(size_t)dim[0], (size_t)dim[1], (size_t)dim[2]};
+    const size_t len = npy_format_header(header, sizeof(header), shape, 3, true);
+    bool ok = md_file_write(file, header, len) == len;
+
+    const size_t size = shape[0] * shape[1] * shape[2] * sizeof(float);
+    ok &= md_file_write(file, values, size) == size;
+
+    if (!ok) {
+        MD_LOG_ERROR("Failed to write to file '%.*s'", (int)path.len, path.ptr);
+    }
+    return ok;
+}
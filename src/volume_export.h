@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include <core/md_str.h>
+
+// Export of density volumes
+// The voxels are expected with x varying fastest, index = (z * dim_y + y) * dim_x + x, which is the layout of volume properties.
+// The voxel text of Gaussian cube files is formatted in parallel on the pool in slabs of the outer (x) loop, which are written to the file in order.
+
+// Number of slabs written by volume_write_cube, for reporting progress
+uint32_t volume_cube_num_slabs(const int dim[3]);
+
+// Writes header (comments, origin, axes and atoms) followed by the voxels, the number of written slabs is stored in slabs_written if supplied
+// Stops early if the task which calls it is interrupted
+bool volume_write_cube(str_t path, str_t header, const float* values, const int dim[3], std::atomic_uint32_t* slabs_written = NULL);
+
+// NumPy .npy file of float32 with shape (dim_x, dim_y, dim_z), indexed as the voxels of the cube file
+// The array is stored in Fortran (column major) order, which is the layout of the values, so they are written as is
+bool volume_write_npy(str_t path, const float* values, const int dim[3]);